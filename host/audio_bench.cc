@@ -0,0 +1,238 @@
+// Runs the board-independent audio path over a WAV file on the host and reports the cost of each stage.
+//
+//     audio_bench [--loss percent] [--complexity 0-10] [input.wav [output.wav]]
+//
+// The input, or 10 s of synthetic tones without one, is resampled to 16 kHz and Opus encoded in 60 ms frames
+// like the uplink. The packets then take the downlink path: the jitter buffer with `loss` percent of them
+// dropped, the decoder with FEC and concealment, and the resampler to a 48 kHz codec. The decoded audio goes
+// to output.wav when given. Timings are per frame, in microseconds of this host, and the report is JSON.
+
+#include "wav_file.h"
+#include "frame_resampler.h"
+#include "opus_stream.h"
+#include "jitter_buffer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TAG "AudioBench"
+
+#define BENCH_SAMPLE_RATE 16000
+#define BENCH_OUTPUT_SAMPLE_RATE 48000
+#define BENCH_FRAME_MS 60
+#define BENCH_SYNTHETIC_SECONDS 10
+// The same jitter buffer as Application, with the default prebuffer
+#define BENCH_JITTER_CAPACITY 120
+#define BENCH_JITTER_MIN_DELAY_MS 120
+#define BENCH_JITTER_MAX_DELAY_MS 480
+
+struct StageTimes {
+    const char* name;
+    std::vector<uint32_t> samples;
+
+    void Add(int64_t us) { samples.push_back(us > 0 ? (uint32_t)us : 0); }
+};
+
+static void AddStage(cJSON* stages, StageTimes& stage, double audio_seconds) {
+    auto item = cJSON_CreateObject();
+    auto& samples = stage.samples;
+    std::sort(samples.begin(), samples.end());
+    uint64_t total = 0;
+    for (auto us : samples) {
+        total += us;
+    }
+    cJSON_AddNumberToObject(item, "frames", samples.size());
+    if (!samples.empty()) {
+        cJSON_AddNumberToObject(item, "p50_us", samples[samples.size() / 2]);
+        cJSON_AddNumberToObject(item, "p99_us", samples[samples.size() * 99 / 100]);
+        cJSON_AddNumberToObject(item, "max_us", samples.back());
+        // How many times faster than realtime the stage runs on this host
+        cJSON_AddNumberToObject(item, "realtime_factor", total > 0 ? audio_seconds * 1e6 / total : 0);
+    }
+    cJSON_AddItemToObject(stages, stage.name, item);
+}
+
+// Speech band tones with a slow envelope, so the encoder sees something closer to voice than a constant tone
+static std::vector<int16_t> Synthesize(int seconds) {
+    std::vector<int16_t> pcm(BENCH_SAMPLE_RATE * seconds);
+    for (size_t i = 0; i < pcm.size(); i++) {
+        double t = (double)i / BENCH_SAMPLE_RATE;
+        double envelope = 0.5 + 0.5 * std::sin(2 * M_PI * 3 * t);
+        double value = std::sin(2 * M_PI * 220 * t) + 0.5 * std::sin(2 * M_PI * 1100 * t) + 0.25 * std::sin(2 * M_PI * 2700 * t);
+        pcm[i] = (int16_t)(8000 * envelope * value);
+    }
+    return pcm;
+}
+
+static bool LoadInput(const std::string& path, std::vector<int16_t>& pcm, StageTimes& resample_times) {
+    WavReader reader;
+    if (!reader.Open(path)) {
+        return false;
+    }
+    int channels = reader.channels();
+    FrameResampler resampler;
+    bool resample = reader.sample_rate() != BENCH_SAMPLE_RATE;
+    if (resample) {
+        resampler.Configure(reader.sample_rate(), BENCH_SAMPLE_RATE);
+    }
+    size_t frames = reader.sample_rate() * BENCH_FRAME_MS / 1000;
+    std::vector<int16_t> input(frames * channels);
+    std::vector<int16_t> output(resample ? resampler.GetOutputSamples(frames) : frames);
+    size_t read;
+    while ((read = reader.Read(input.data(), frames)) > 0) {
+        // The first channel is the microphone, like the audio loop takes it
+        size_t samples;
+        if (resample) {
+            int64_t start = esp_timer_get_time();
+            samples = resampler.Process(input.data(), read, output.data(), channels);
+            resample_times.Add(esp_timer_get_time() - start);
+        } else {
+            for (size_t i = 0; i < read; i++) {
+                output[i] = input[i * channels];
+            }
+            samples = read;
+        }
+        pcm.insert(pcm.end(), output.begin(), output.begin() + samples);
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int loss_percent = 0;
+    int complexity = 0;
+    std::string input_path;
+    std::string output_path;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--loss") == 0 && i + 1 < argc) {
+            loss_percent = std::clamp(atoi(argv[++i]), 0, 100);
+        } else if (strcmp(argv[i], "--complexity") == 0 && i + 1 < argc) {
+            complexity = std::clamp(atoi(argv[++i]), 0, 10);
+        } else if (input_path.empty()) {
+            input_path = argv[i];
+        } else {
+            output_path = argv[i];
+        }
+    }
+
+    StageTimes input_resample = {"input_resample", {}};
+    StageTimes encode = {"encode", {}};
+    StageTimes jitter = {"jitter_buffer", {}};
+    StageTimes decode = {"decode", {}};
+    StageTimes output_resample = {"output_resample", {}};
+
+    std::vector<int16_t> pcm;
+    if (input_path.empty()) {
+        pcm = Synthesize(BENCH_SYNTHETIC_SECONDS);
+    } else if (!LoadInput(input_path, pcm, input_resample)) {
+        return 1;
+    }
+    double audio_seconds = (double)pcm.size() / BENCH_SAMPLE_RATE;
+    ESP_LOGI(TAG, "%.1f s of audio, %d%% downlink loss, complexity %d", audio_seconds, loss_percent, complexity);
+
+    // Uplink: fixed size reads through the streaming encoder, as the audio loop feeds it
+    OpusStreamEncoder encoder(BENCH_SAMPLE_RATE, 1, BENCH_FRAME_MS);
+    OpusEncoderProfile profile;
+    profile.complexity = complexity;
+    profile.fec = loss_percent > 0;
+    profile.packet_loss_percent = loss_percent;
+    encoder.Configure(profile);
+    std::vector<AudioStreamPacket> packets;
+    size_t frame_samples = BENCH_SAMPLE_RATE * BENCH_FRAME_MS / 1000;
+    size_t encoded_bytes = 0;
+    for (size_t offset = 0; offset + frame_samples <= pcm.size(); offset += frame_samples) {
+        int64_t start = esp_timer_get_time();
+        encoder.Encode(pcm.data() + offset, frame_samples, [&packets, &encoded_bytes](AudioPayload&& opus) {
+            AudioStreamPacket packet;
+            packet.sample_rate = BENCH_SAMPLE_RATE;
+            packet.frame_duration = BENCH_FRAME_MS;
+            packet.sequence = packets.size() + 1;
+            encoded_bytes += opus.size();
+            packet.payload = std::move(opus);
+            packets.push_back(std::move(packet));
+        });
+        encode.Add(esp_timer_get_time() - start);
+    }
+
+    // Downlink: the same packets arrive with losses and are played out
+    JitterBuffer jitter_buffer(BENCH_JITTER_CAPACITY, BENCH_JITTER_MIN_DELAY_MS, BENCH_JITTER_MAX_DELAY_MS);
+    OpusStreamDecoder decoder(BENCH_SAMPLE_RATE, 1, BENCH_FRAME_MS);
+    FrameResampler resampler;
+    resampler.Configure(BENCH_SAMPLE_RATE, BENCH_OUTPUT_SAMPLE_RATE);
+    std::vector<int16_t> decoded;
+    std::vector<int16_t> output(resampler.GetOutputSamples(frame_samples));
+    WavWriter writer;
+    if (!output_path.empty() && !writer.Open(output_path, BENCH_OUTPUT_SAMPLE_RATE, 1)) {
+        return 1;
+    }
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> percent(0, 99);
+    uint32_t dropped = 0;
+
+    auto play = [&]() {
+        AudioStreamPacket packet;
+        int64_t start = esp_timer_get_time();
+        bool got = jitter_buffer.Get(packet);
+        jitter.Add(esp_timer_get_time() - start);
+        if (!got) {
+            return false;
+        }
+        start = esp_timer_get_time();
+        bool ok = packet.fec ? decoder.DecodeFec(packet.payload.data(), packet.payload.size(), decoded)
+                             : decoder.Decode(packet.payload.data(), packet.payload.size(), decoded);
+        decode.Add(esp_timer_get_time() - start);
+        if (!ok) {
+            return true;
+        }
+        start = esp_timer_get_time();
+        size_t samples = resampler.Process(decoded.data(), decoded.size(), output.data());
+        output_resample.Add(esp_timer_get_time() - start);
+        writer.Write(output.data(), samples);
+        return true;
+    };
+    for (auto& packet : packets) {
+        if (percent(random) < loss_percent) {
+            dropped++;
+            continue;
+        }
+        int64_t start = esp_timer_get_time();
+        jitter_buffer.Put(std::move(packet));
+        jitter.Add(esp_timer_get_time() - start);
+        play();
+    }
+    // The tail is held back until it has waited as long as the prebuffer would take to play
+    while (!jitter_buffer.Empty()) {
+        if (!play()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(BENCH_FRAME_MS));
+        }
+    }
+    writer.Close();
+
+    auto stats = jitter_buffer.GetStats();
+    auto root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "audio_seconds", audio_seconds);
+    cJSON_AddNumberToObject(root, "packets", packets.size());
+    cJSON_AddNumberToObject(root, "uplink_kbps", audio_seconds > 0 ? encoded_bytes * 8 / audio_seconds / 1000 : 0);
+    cJSON_AddNumberToObject(root, "dropped", dropped);
+    cJSON_AddNumberToObject(root, "lost_packets", stats.lost_packets);
+    cJSON_AddNumberToObject(root, "underruns", stats.underruns);
+    auto stages = cJSON_CreateObject();
+    for (auto stage : {&input_resample, &encode, &jitter, &decode, &output_resample}) {
+        AddStage(stages, *stage, audio_seconds);
+    }
+    cJSON_AddItemToObject(root, "stages", stages);
+    auto json_str = cJSON_Print(root);
+    printf("%s\n", json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return 0;
+}
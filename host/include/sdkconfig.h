@@ -0,0 +1,12 @@
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+// Host build: the configuration the core is compiled with. As in the header ESP-IDF generates, an option
+// that is off is not defined at all, so `#if CONFIG_X` leaves the feature out.
+//
+// Off on the host:
+//   CONFIG_USE_BOOT_ARENA      the arena reserves nothing, the Opus states come from the heap
+//   CONFIG_USE_JSON_ARENA      the protocol parses with the plain cJSON allocator
+//   CONFIG_USE_PIPELINE_TRACE  the latency tracer keeps its stages, there is no FreeRTOS trace facility to send
+
+#endif // HOST_SDKCONFIG_H
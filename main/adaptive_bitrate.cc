@@ -0,0 +1,64 @@
+#include "adaptive_bitrate.h"
+
+#include <esp_log.h>
+
+#define TAG "AdaptiveBitrate"
+
+static const AdaptiveBitrateLevel kLevels[] = {
+    { 0,     0,   0, 0 },
+    { 24000, 60,  0, 24000 },
+    { 16000, 60,  3, 16000 },
+    { 12000, 120, 5, 12000 },
+    { 8000,  120, 5, 8000 },
+};
+static constexpr int kLevelCount = sizeof(kLevels) / sizeof(kLevels[0]);
+
+static bool IsPoor(const LinkQuality& quality) {
+    return (quality.signal >= 0 && quality.signal < ADAPTIVE_BITRATE_POOR_SIGNAL) ||
+        quality.queue_percent > ADAPTIVE_BITRATE_POOR_QUEUE_PERCENT ||
+        quality.loss_percent > ADAPTIVE_BITRATE_POOR_LOSS_PERCENT ||
+        quality.send_latency_ms > ADAPTIVE_BITRATE_POOR_SEND_LATENCY_MS ||
+        quality.uplink_dropped > 0;
+}
+
+static bool IsGood(const LinkQuality& quality) {
+    // Unknown values do not hold the recovery back
+    return (quality.signal < 0 || quality.signal >= ADAPTIVE_BITRATE_GOOD_SIGNAL) &&
+        quality.queue_percent <= ADAPTIVE_BITRATE_GOOD_QUEUE_PERCENT &&
+        quality.loss_percent <= ADAPTIVE_BITRATE_GOOD_LOSS_PERCENT &&
+        quality.send_latency_ms <= ADAPTIVE_BITRATE_GOOD_SEND_LATENCY_MS;
+}
+
+bool AdaptiveBitrate::Update(const LinkQuality& quality) {
+    int level = level_;
+    if (IsPoor(quality)) {
+        good_updates_ = 0;
+        if (level < kLevelCount - 1) {
+            level++;
+        }
+    } else if (IsGood(quality)) {
+        if (++good_updates_ >= ADAPTIVE_BITRATE_RECOVER_UPDATES && level > 0) {
+            good_updates_ = 0;
+            level--;
+        }
+    } else {
+        good_updates_ = 0;
+    }
+
+    if (level == level_) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Level %d -> %d (signal %d, queue %d%%, loss %d%%, send %d ms)", level_, level,
+        quality.signal, quality.queue_percent, quality.loss_percent, quality.send_latency_ms);
+    level_ = level;
+    return true;
+}
+
+void AdaptiveBitrate::Reset() {
+    level_ = 0;
+    good_updates_ = 0;
+}
+
+const AdaptiveBitrateLevel& AdaptiveBitrate::current() const {
+    return kLevels[level_];
+}
@@ -0,0 +1,53 @@
+#ifndef ADAPTIVE_BITRATE_H
+#define ADAPTIVE_BITRATE_H
+
+#include <cstdint>
+
+// Degrade right away, recover only after this many good evaluations in a row
+#define ADAPTIVE_BITRATE_RECOVER_UPDATES 3
+#define ADAPTIVE_BITRATE_POOR_SIGNAL 25
+#define ADAPTIVE_BITRATE_GOOD_SIGNAL 50
+#define ADAPTIVE_BITRATE_POOR_QUEUE_PERCENT 40
+#define ADAPTIVE_BITRATE_GOOD_QUEUE_PERCENT 10
+#define ADAPTIVE_BITRATE_POOR_LOSS_PERCENT 10
+#define ADAPTIVE_BITRATE_GOOD_LOSS_PERCENT 3
+#define ADAPTIVE_BITRATE_POOR_SEND_LATENCY_MS 300
+#define ADAPTIVE_BITRATE_GOOD_SEND_LATENCY_MS 100
+
+struct LinkQuality {
+    int signal = -1;            // 0-100 from RSSI or CSQ, -1 if unknown
+    int queue_percent = 0;      // Fill of the uplink send queue
+    int loss_percent = -1;      // Recent downlink loss, -1 if unknown
+    int send_latency_ms = -1;   // Time one send takes, -1 if unknown
+    int uplink_dropped = 0;     // Packets that went stale in the send queue since the last update
+};
+
+struct AdaptiveBitrateLevel {
+    int bitrate;                // Uplink cap, 0 leaves it to the encoder profile
+    int min_frame_duration;     // Longer frames spend less on headers and radio wake-ups
+    int min_complexity;         // At low bitrates a higher complexity keeps speech intelligible
+    int downlink_bitrate;       // Asked of the server, 0 for no preference
+};
+
+/*
+ * Steps the uplink encoder between a few fixed levels from what the link
+ * looks like: signal strength, how far the send queue has backed up, and
+ * the loss and send latency reported by the transport. Any sign of a poor
+ * link drops one level per evaluation, all signs good for a while climb
+ * one level back, so a short fade does not make it flap.
+ */
+class AdaptiveBitrate {
+public:
+    // Returns true if the level changed
+    bool Update(const LinkQuality& quality);
+    void Reset();
+
+    inline int level() const { return level_; }
+    const AdaptiveBitrateLevel& current() const;
+
+private:
+    int level_ = 0;
+    int good_updates_ = 0;
+};
+
+#endif // ADAPTIVE_BITRATE_H
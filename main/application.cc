@@ -4,19 +4,36 @@
 #include "system_info.h"
 #include "ml307_ssl_transport.h"
 #include "audio_codec.h"
+#include "board_audio_traits.h"
+#include "sample_format.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
+#include "udp_protocol.h"
 #include "font_awesome_symbols.h"
 #include "iot/thing_manager.h"
 #include "assets/lang_config.h"
 #include "mcp_server.h"
 #include "audio_debugger.h"
+#include "latency_tracer.h"
+#include "settings.h"
+#include "memory_accounting.h"
+#include "boot_arena.h"
+#include "task_profiler.h"
+#include "deadline_monitor.h"
+#include "pipeline_trace.h"
+#include "deferred_log.h"
+#include "conversation_soak.h"
+#include "task_topology.h"
+#include "network_monitor.h"
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "afe_audio_processor.h"
 #else
 #include "no_audio_processor.h"
 #endif
+#if CONFIG_USE_SHARED_AFE
+#include "shared_afe_audio_processor.h"
+#endif
 
 #if CONFIG_USE_AFE_WAKE_WORD
 #include "afe_wake_word.h"
@@ -25,12 +42,35 @@
 #else
 #include "no_wake_word.h"
 #endif
+#if CONFIG_USE_WAKE_WORD_GATE
+#include "gated_wake_word.h"
+#endif
+#if CONFIG_USE_WAKE_ARBITRATION
+#include "wake_arbiter.h"
+#endif
+#if CONFIG_USE_POWER_GOVERNOR
+#include "power_governor.h"
+#endif
+#if CONFIG_USE_PROMPT_STORE
+#include "prompt_store.h"
+#endif
+#if CONFIG_USE_BENCHMARK_SUITE
+#include "benchmark_suite.h"
+#endif
 
 #include <cstring>
+#include <cassert>
 #include <esp_log.h>
+#include <esp_app_desc.h>
 #include <cJSON.h>
 #include <driver/gpio.h>
 #include <arpa/inet.h>
+#include <algorithm>
+#include <sys/time.h>
+#if CONFIG_USE_WAKE_WORD_BENCHMARK
+#include <thread>
+#include <esp_pthread.h>
+#endif
 
 #define TAG "Application"
 
@@ -50,9 +90,62 @@ static const char* const STATE_STRINGS[] = {
     "invalid_state"
 };
 
+#if CONFIG_USE_COMMAND_WORDS
+// Phrases recognized on the device by MultiNet, their position is the command id.
+// Chinese models take pinyin, English models take the words as written.
+enum LocalCommandAction {
+    kLocalCommandTool,
+    kLocalCommandStop,      // Stop the conversation
+    kLocalCommandTime,      // Show and read out the time
+};
+
+struct LocalCommand {
+    const char* phrase;
+    LocalCommandAction action;
+    const char* tool;               // MCP tool to run, a board without it only logs the error
+    std::string (*arguments)();     // Tool arguments as JSON, nullptr for none
+};
+
+static std::string VolumeStep(int step) {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    int volume = std::clamp(codec->output_volume() + step, 0, 100);
+    return "{\"volume\":" + std::to_string(volume) + "}";
+}
+
+static const LocalCommand kLocalCommands[] = {
+#if CONFIG_LANGUAGE_ZH_CN || CONFIG_LANGUAGE_ZH_TW
+    {"tiao da yin liang", kLocalCommandTool, "self.audio_speaker.set_volume", [] { return VolumeStep(10); }},
+    {"tiao xiao yin liang", kLocalCommandTool, "self.audio_speaker.set_volume", [] { return VolumeStep(-10); }},
+    {"ting zhi shuo hua", kLocalCommandStop, nullptr, nullptr},
+    {"da kai deng", kLocalCommandTool, "self.light.turn_on", nullptr},
+    {"guan bi deng", kLocalCommandTool, "self.light.turn_off", nullptr},
+    {"xian zai ji dian", kLocalCommandTime, nullptr, nullptr},
+#else
+    {"volume up", kLocalCommandTool, "self.audio_speaker.set_volume", [] { return VolumeStep(10); }},
+    {"volume down", kLocalCommandTool, "self.audio_speaker.set_volume", [] { return VolumeStep(-10); }},
+    {"stop talking", kLocalCommandStop, nullptr, nullptr},
+    {"turn on the light", kLocalCommandTool, "self.light.turn_on", nullptr},
+    {"turn off the light", kLocalCommandTool, "self.light.turn_off", nullptr},
+    {"what time is it", kLocalCommandTime, nullptr, nullptr},
+#endif
+};
+#endif
+
 Application::Application() {
     event_group_ = xEventGroupCreate();
-    background_task_ = new BackgroundTask(4096 * 7);
+    // The async flows resume on the main loop like any scheduled callback
+    AsyncFlow::SetExecutor([](TaskCallback callback) {
+        Application::GetInstance().Schedule(std::move(callback));
+    });
+    background_task_ = new BackgroundTask();
+    audio_encode_task_ = new BackgroundTask(kTaskAudioEncode, AUDIO_ENCODE_TASK_MAX_PENDING);
+    audio_decode_task_ = new BackgroundTask(kTaskAudioDecode, AUDIO_DECODE_TASK_MAX_PENDING);
+    // Everything the codec workers allocate belongs to the audio path
+    for (auto task : {audio_encode_task_, audio_decode_task_}) {
+        task->Schedule([]() {
+            MemoryAccounting::SetTaskTag(kMemoryTagAudio);
+        });
+    }
 
 #if CONFIG_USE_DEVICE_AEC
     aec_mode_ = kAecOnDeviceSide;
@@ -62,6 +155,12 @@ Application::Application() {
     aec_mode_ = kAecOff;
 #endif
 
+#if CONFIG_USE_SHARED_AFE
+    // One AFE instance serves both, the processor only takes the wake word detector's output
+    auto afe_wake_word = std::make_unique<AfeWakeWord>();
+    audio_processor_ = std::make_unique<SharedAfeAudioProcessor>(*afe_wake_word);
+    wake_word_ = std::move(afe_wake_word);
+#else
 #if CONFIG_USE_AUDIO_PROCESSOR
     audio_processor_ = std::make_unique<AfeAudioProcessor>();
 #else
@@ -75,6 +174,10 @@ Application::Application() {
 #else
     wake_word_ = std::make_unique<NoWakeWord>();
 #endif
+#endif
+#if CONFIG_USE_WAKE_WORD_GATE
+    wake_word_ = std::make_unique<GatedWakeWord>(std::move(wake_word_));
+#endif
 
     esp_timer_create_args_t clock_timer_args = {
         .callback = [](void* arg) {
@@ -97,109 +200,209 @@ Application::~Application() {
     if (background_task_ != nullptr) {
         delete background_task_;
     }
+    if (audio_encode_task_ != nullptr) {
+        delete audio_encode_task_;
+    }
+    if (audio_decode_task_ != nullptr) {
+        delete audio_decode_task_;
+    }
     vEventGroupDelete(event_group_);
 }
 
-void Application::CheckNewVersion(Ota& ota) {
+static void LogBootPhase(const char* phase) {
+    ESP_LOGI(TAG, "Boot phase %s done at %lld ms", phase, esp_timer_get_time() / 1000);
+#if CONFIG_USE_BENCHMARK_SUITE
+    BenchmarkSuite::GetInstance().OnBootPhase(phase, esp_timer_get_time() / 1000);
+#endif
+}
+
+// Every long-lived state that has a slot, always in this order so the layout does not depend on
+// which of them is created first. Without CONFIG_USE_BOOT_ARENA nothing is reserved
+static void ReserveBootArena(AudioCodec* codec) {
+    auto& arena = BootArena::GetInstance();
+    if (!arena.IsEnabled()) {
+        return;
+    }
+    arena.Reserve(kBootSlotUplinkEncoder, opus_encoder_get_size(1));
+#if CONFIG_USE_AFE_WAKE_WORD
+    arena.Reserve(kBootSlotWakeEncoder, opus_encoder_get_size(1));
+#endif
+    arena.Reserve(kBootSlotDownlinkDecoder, opus_decoder_get_size(std::max(1, codec->output_channels())));
+#if DOWNLINK_DECODER_CACHE_SIZE > 1
+    arena.Reserve(kBootSlotDownlinkDecoder2, opus_decoder_get_size(std::max(1, codec->output_channels())));
+#endif
+    arena.Reserve(kBootSlotPromptDecoder, opus_decoder_get_size(1));
+#if CONFIG_USE_JSON_ARENA
+    arena.Reserve(kBootSlotJsonArena, CONFIG_JSON_ARENA_SIZE);
+#endif
+    arena.PrintLayout();
+}
+
+// The protocol the last completed version check chose, used to connect before the next check
+static std::string GetProtocolType(Ota& ota) {
+    if (ota.HasUdpConfig()) {
+        return "udp";
+    } else if (ota.HasMqttConfig()) {
+        return "mqtt";
+    } else if (ota.HasWebsocketConfig()) {
+        return "websocket";
+    }
+    ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
+    return "mqtt";
+}
+
+/*
+ * A deferred check runs after the device is idle: failures are only logged,
+ * an upgrade waits until the device is idle again and the activation UI is
+ * shown only if the server asks for it.
+ *
+ * The flow runs on the main loop and only holds its coroutine frame while
+ * it waits. The HTTP requests go to the background workers, the waits are
+ * timers. `on_done` gets the result, false after too many failures.
+ */
+AsyncFlow Application::CheckNewVersion(std::shared_ptr<Ota> ota, bool deferred, std::function<void(bool)> on_done) {
     const int MAX_RETRY = 10;
-    int retry_count = 0;
-    int retry_delay = 10; // 初始重试延迟为10秒
+    ReconnectBackoff backoff("version check", VERSION_CHECK_MIN_RETRY_SECONDS * 1000, VERSION_CHECK_MAX_RETRY_SECONDS * 1000);
 
     while (true) {
-        SetDeviceState(kDeviceStateActivating);
         auto display = Board::GetInstance().GetDisplay();
-        display->SetStatus(Lang::Strings::CHECKING_NEW_VERSION);
+        if (!deferred) {
+            SetDeviceState(kDeviceStateActivating);
+            display->QueueStatus(Lang::Strings::CHECKING_NEW_VERSION);
+        }
 
-        if (!ota.CheckVersion()) {
-            retry_count++;
-            if (retry_count >= MAX_RETRY) {
+        bool checked = co_await AsyncBackground(background_task_, [ota]() {
+            return ota->CheckVersion();
+        });
+        if (!checked) {
+            int retry_delay = (backoff.OnFailure() + 999) / 1000;
+            if (backoff.failures() >= MAX_RETRY) {
                 ESP_LOGE(TAG, "Too many retries, exit version check");
-                return;
+                on_done(false);
+                co_return;
             }
 
-            char buffer[128];
-            snprintf(buffer, sizeof(buffer), Lang::Strings::CHECK_NEW_VERSION_FAILED, retry_delay, ota.GetCheckVersionUrl().c_str());
-            Alert(Lang::Strings::ERROR, buffer, "sad", Lang::Sounds::P3_EXCLAMATION);
-
-            ESP_LOGW(TAG, "Check new version failed, retry in %d seconds (%d/%d)", retry_delay, retry_count, MAX_RETRY);
-            for (int i = 0; i < retry_delay; i++) {
-                vTaskDelay(pdMS_TO_TICKS(1000));
-                if (device_state_ == kDeviceStateIdle) {
+            if (deferred) {
+                ESP_LOGW(TAG, "Deferred version check failed, retry in %d seconds (%d/%d)", retry_delay, backoff.failures(), MAX_RETRY);
+            } else {
+                char buffer[128];
+                snprintf(buffer, sizeof(buffer), Lang::Strings::CHECK_NEW_VERSION_FAILED, retry_delay, ota->GetCheckVersionUrl().c_str());
+                Alert(Lang::Strings::ERROR, buffer, "sad", Lang::Sounds::P3_EXCLAMATION);
+                ESP_LOGW(TAG, "Check new version failed, retry in %d seconds (%d/%d)", retry_delay, backoff.failures(), MAX_RETRY);
+            }
+            // The wait ends early when the network comes back
+            while (!backoff.CanAttempt()) {
+                co_await AsyncDelay(1000);
+                if (!deferred && device_state_ == kDeviceStateIdle) {
                     break;
                 }
             }
-            retry_delay *= 2; // 每次重试后延迟时间翻倍
             continue;
         }
-        retry_count = 0;
-        retry_delay = 10; // 重置重试延迟时间
+        backoff.OnSuccess();
 
-        if (ota.HasNewVersion()) {
+        if (ota->HasNewVersion()) {
+            if (deferred) {
+                // 不打断正在进行的对话
+                while (device_state_ != kDeviceStateIdle) {
+                    co_await AsyncDelay(1000);
+                }
+            }
             Alert(Lang::Strings::OTA_UPGRADE, Lang::Strings::UPGRADING, "happy", Lang::Sounds::P3_UPGRADE);
 
-            vTaskDelay(pdMS_TO_TICKS(3000));
+            co_await AsyncDelay(3000);
 
             SetDeviceState(kDeviceStateUpgrading);
             
-            display->SetIcon(FONT_AWESOME_DOWNLOAD);
-            std::string message = std::string(Lang::Strings::NEW_VERSION) + ota.GetFirmwareVersion();
-            display->SetChatMessage("system", message.c_str());
+            display->QueueIcon(FONT_AWESOME_DOWNLOAD);
+            std::string message = std::string(Lang::Strings::NEW_VERSION) + ota->GetFirmwareVersion();
+            display->QueueChatMessage("system", message);
 
             auto& board = Board::GetInstance();
             board.SetPowerSaveMode(false);
+            audio_front_end_ready_.Wait();
             wake_word_->StopDetection();
             // 预先关闭音频输出，避免升级过程有音频操作
             auto codec = board.GetAudioCodec();
             codec->EnableInput(false);
             codec->EnableOutput(false);
-            {
-                std::lock_guard<std::mutex> lock(mutex_);
-                audio_decode_queue_.clear();
-            }
-            background_task_->WaitForCompletion();
+            prompt_player_.Clear();
+            jitter_buffer_.Reset();
+            WaitForAudioTasks();
             delete background_task_;
             background_task_ = nullptr;
+            delete audio_encode_task_;
+            audio_encode_task_ = nullptr;
+            delete audio_decode_task_;
+            audio_decode_task_ = nullptr;
             vTaskDelay(pdMS_TO_TICKS(1000));
 
-            ota.StartUpgrade([display](int progress, size_t speed) {
+            // The device is given over to the upgrade, the main loop blocks in it
+            ota->StartUpgrade([display](const OtaProgress& progress) {
                 char buffer[64];
-                snprintf(buffer, sizeof(buffer), "%d%% %uKB/s", progress, speed / 1024);
-                display->SetChatMessage("system", buffer);
+                snprintf(buffer, sizeof(buffer), "%d%% %uKB/s", progress.progress, progress.speed / 1024);
+                display->QueueChatMessage("system", buffer);
             });
 
             // If upgrade success, the device will reboot and never reach here
-            display->SetStatus(Lang::Strings::UPGRADE_FAILED);
+            display->QueueStatus(Lang::Strings::UPGRADE_FAILED);
             ESP_LOGI(TAG, "Firmware upgrade failed...");
             vTaskDelay(pdMS_TO_TICKS(3000));
             Reboot();
-            return;
+            on_done(false);
+            co_return;
         }
 
         // No new version, mark the current version as valid
-        ota.MarkCurrentVersionValid();
-        if (!ota.HasActivationCode() && !ota.HasActivationChallenge()) {
+        ota->MarkCurrentVersionValid();
+#if CONFIG_USE_PROMPT_STORE
+        if (!ota->GetPromptsUrl().empty() && ota->GetPromptsVersion() != PromptStore::GetInstance().GetVersion()) {
+            // Not awaited, the device is usable while the prompts download
+            background_task_->Schedule([this, url = ota->GetPromptsUrl(), version = ota->GetPromptsVersion()]() {
+                UpdatePrompts(url, version);
+            });
+        }
+#endif
+        if (!ota->HasActivationCode() && !ota->HasActivationChallenge()) {
+            auto protocol_type = GetProtocolType(*ota);
+            Settings settings("ota", true);
+            if (settings.GetString("protocol") != protocol_type) {
+                settings.SetString("protocol", protocol_type);
+            }
             xEventGroupSetBits(event_group_, CHECK_NEW_VERSION_DONE_EVENT);
             // Exit the loop if done checking new version
-            break;
+            on_done(true);
+            co_return;
         }
 
-        display->SetStatus(Lang::Strings::ACTIVATION);
+        if (deferred) {
+            // 服务器要求重新激活，此后和启动时的检查一样
+            deferred = false;
+            SetDeviceState(kDeviceStateActivating);
+        }
+        display->QueueStatus(Lang::Strings::ACTIVATION);
         // Activation code is shown to the user and waiting for the user to input
-        if (ota.HasActivationCode()) {
-            ShowActivationCode(ota.GetActivationCode(), ota.GetActivationMessage());
+        if (ota->HasActivationCode()) {
+            ShowActivationCode(ota->GetActivationCode(), ota->GetActivationMessage());
         }
 
-        // This will block the loop until the activation is done or timeout
+        // Poll until the activation is done or timeout. A server that sets activation.long_poll_ms holds
+        // each request until the code is entered, the device learns of it at once
         for (int i = 0; i < 10; ++i) {
             ESP_LOGI(TAG, "Activating... %d/%d", i + 1, 10);
-            esp_err_t err = ota.Activate();
+            esp_err_t err = co_await AsyncBackground(background_task_, [ota]() {
+                return ota->Activate();
+            });
             if (err == ESP_OK) {
                 xEventGroupSetBits(event_group_, CHECK_NEW_VERSION_DONE_EVENT);
                 break;
             } else if (err == ESP_ERR_TIMEOUT) {
-                vTaskDelay(pdMS_TO_TICKS(3000));
+                // A long poll already waited on the server, the next one starts right away
+                if (!ota->ActivationLongPolled()) {
+                    co_await AsyncDelay(3000);
+                }
             } else {
-                vTaskDelay(pdMS_TO_TICKS(10000));
+                co_await AsyncDelay(10000);
             }
             if (device_state_ == kDeviceStateIdle) {
                 break;
@@ -209,6 +412,12 @@ void Application::CheckNewVersion(Ota& ota) {
 }
 
 void Application::ShowActivationCode(const std::string& code, const std::string& message) {
+    // The digits are queued behind the sentence and play without gaps
+    Alert(Lang::Strings::ACTIVATION, message.c_str(), "happy", Lang::Sounds::P3_ACTIVATION);
+    PlayDigits(code);
+}
+
+void Application::PlayDigits(std::string_view digits) {
     struct digit_sound {
         char digit;
         const std::string_view& sound;
@@ -226,10 +435,7 @@ void Application::ShowActivationCode(const std::string& code, const std::string&
         digit_sound{'9', Lang::Sounds::P3_9}
     }};
 
-    // This sentence uses 9KB of SRAM, so we need to wait for it to finish
-    Alert(Lang::Strings::ACTIVATION, message.c_str(), "happy", Lang::Sounds::P3_ACTIVATION);
-
-    for (const auto& digit : code) {
+    for (const auto& digit : digits) {
         auto it = std::find_if(digit_sounds.begin(), digit_sounds.end(),
             [digit](const digit_sound& ds) { return ds.digit == digit; });
         if (it != digit_sounds.end()) {
@@ -241,9 +447,9 @@ void Application::ShowActivationCode(const std::string& code, const std::string&
 void Application::Alert(const char* status, const char* message, const char* emotion, const std::string_view& sound) {
     ESP_LOGW(TAG, "Alert %s: %s [%s]", status, message, emotion);
     auto display = Board::GetInstance().GetDisplay();
-    display->SetStatus(status);
-    display->SetEmotion(emotion);
-    display->SetChatMessage("system", message);
+    display->QueueStatus(status);
+    display->QueueEmotion(emotion);
+    display->QueueChatMessage("system", message);
     if (!sound.empty()) {
         ResetDecoder();
         PlaySound(sound);
@@ -253,66 +459,50 @@ void Application::Alert(const char* status, const char* message, const char* emo
 void Application::DismissAlert() {
     if (device_state_ == kDeviceStateIdle) {
         auto display = Board::GetInstance().GetDisplay();
-        display->SetStatus(Lang::Strings::STANDBY);
-        display->SetEmotion("neutral");
-        display->SetChatMessage("system", "");
+        display->QueueStatus(Lang::Strings::STANDBY);
+        display->QueueEmotion("neutral");
+        display->QueueChatMessage("system", "");
     }
 }
 
+// Queue a sound asset behind the ones already playing, this never blocks the caller
 void Application::PlaySound(const std::string_view& sound) {
-    // Wait for the previous sound to finish
-    {
-        std::unique_lock<std::mutex> lock(mutex_);
-        audio_decode_cv_.wait(lock, [this]() {
-            return audio_decode_queue_.empty();
-        });
-    }
-    background_task_->WaitForCompletion();
-
-    const char* data = sound.data();
-    size_t size = sound.size();
-    for (const char* p = data; p < data + size; ) {
-        auto p3 = (BinaryProtocol3*)p;
-        p += sizeof(BinaryProtocol3);
-
-        auto payload_size = ntohs(p3->payload_size);
-        AudioStreamPacket packet;
-        packet.sample_rate = 16000;
-        packet.frame_duration = 60;
-        packet.payload.resize(payload_size);
-        memcpy(packet.payload.data(), p3->payload, payload_size);
-        p += payload_size;
-
-        std::lock_guard<std::mutex> lock(mutex_);
-        audio_decode_queue_.emplace_back(std::move(packet));
+    if (!prompt_player_.Enqueue(sound)) {
+        return;
     }
+    NotifyAudioLoop();
 }
 
+#if CONFIG_USE_AUDIO_TESTING
 void Application::EnterAudioTestingMode() {
     ESP_LOGI(TAG, "Entering audio testing mode");
     ResetDecoder();
+    audio_testing_queue_.Clear();
     SetDeviceState(kDeviceStateAudioTesting);
 }
 
 void Application::ExitAudioTestingMode() {
     ESP_LOGI(TAG, "Exiting audio testing mode");
+    // The recorded packets in audio_testing_queue_ are played back by OnAudioOutput
+    // once the decode queue is drained in the wifi configuring state
     SetDeviceState(kDeviceStateWifiConfiguring);
-    // Copy audio_testing_queue_ to audio_decode_queue_
-    std::lock_guard<std::mutex> lock(mutex_);
-    audio_decode_queue_ = std::move(audio_testing_queue_);
-    audio_decode_cv_.notify_all();
 }
+#endif
 
 void Application::ToggleChatState() {
     if (device_state_ == kDeviceStateActivating) {
         SetDeviceState(kDeviceStateIdle);
         return;
     } else if (device_state_ == kDeviceStateWifiConfiguring) {
+#if CONFIG_USE_AUDIO_TESTING
         EnterAudioTestingMode();
+#endif
         return;
+#if CONFIG_USE_AUDIO_TESTING
     } else if (device_state_ == kDeviceStateAudioTesting) {
         ExitAudioTestingMode();
         return;
+#endif
     }
 
     if (!protocol_) {
@@ -322,11 +512,8 @@ void Application::ToggleChatState() {
 
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    return;
-                }
+            if (!ConnectAudioChannel()) {
+                return;
             }
 
             SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
@@ -342,12 +529,48 @@ void Application::ToggleChatState() {
     }
 }
 
+// Main loop: opens the audio channel if needed, false if the server cannot be reached
+bool Application::ConnectAudioChannel() {
+    if (protocol_->IsAudioChannelOpened()) {
+        return true;
+    }
+#if CONFIG_USE_OFFLINE_MODE
+    if (offline_ && !connect_backoff_.CanAttempt()) {
+        // Another attempt this soon would only time out again, the local command words keep working
+        Alert(Lang::Strings::OFFLINE_MODE, Lang::Strings::SERVER_OFFLINE, "sad", Lang::Sounds::P3_EXCLAMATION);
+        return false;
+    }
+#endif
+    SetDeviceState(kDeviceStateConnecting);
+    if (!protocol_->OpenAudioChannel()) {
+#if CONFIG_USE_OFFLINE_MODE
+        offline_ = true;
+        ESP_LOGW(TAG, "Server unreachable, next attempt in %d ms", connect_backoff_.OnFailure());
+#endif
+        return false;
+    }
+#if CONFIG_USE_OFFLINE_MODE
+    connect_backoff_.OnSuccess();
+    if (offline_) {
+        offline_ = false;
+        ESP_LOGI(TAG, "Server reachable again");
+    }
+    if (!offline_actions_.empty()) {
+        protocol_->SendOfflineActions(offline_actions_);
+        offline_actions_.clear();
+    }
+#endif
+    return true;
+}
+
 void Application::StartListening() {
     if (device_state_ == kDeviceStateActivating) {
         SetDeviceState(kDeviceStateIdle);
         return;
     } else if (device_state_ == kDeviceStateWifiConfiguring) {
+#if CONFIG_USE_AUDIO_TESTING
         EnterAudioTestingMode();
+#endif
         return;
     }
 
@@ -357,17 +580,23 @@ void Application::StartListening() {
     }
     
     if (device_state_ == kDeviceStateIdle) {
+        push_to_talk_us_ = esp_timer_get_time();
+#if CONFIG_USE_AUDIO_CAPTURE_RING
+        // The main loop may take a while to get to it and the channel to open, the capture does not wait:
+        // the uplink starts from the ring at the press, the audio until then is sent in a burst
+        uint64_t preroll = PUSH_TO_TALK_PREROLL_MS * Board::GetInstance().GetAudioCodec()->input_sample_rate() / 1000;
+        uint64_t position = audio_capture_->write_position();
+        push_to_talk_position_ = std::max<uint64_t>(position > preroll ? position - preroll : 0, 1);
+#endif
         Schedule([this]() {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    return;
-                }
+            if (!ConnectAudioChannel()) {
+                return;
             }
 
             SetListeningMode(kListeningModeManualStop);
         });
     } else if (device_state_ == kDeviceStateSpeaking) {
+        push_to_talk_us_ = esp_timer_get_time();
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
             SetListeningMode(kListeningModeManualStop);
@@ -376,10 +605,12 @@ void Application::StartListening() {
 }
 
 void Application::StopListening() {
+#if CONFIG_USE_AUDIO_TESTING
     if (device_state_ == kDeviceStateAudioTesting) {
         ExitAudioTestingMode();
         return;
     }
+#endif
 
     const std::array<int, 3> valid_states = {
         kDeviceStateListening,
@@ -400,7 +631,12 @@ void Application::StopListening() {
 }
 
 void Application::Start() {
+#if CONFIG_USE_DEFERRED_LOG
+    DeferredLog::GetInstance().Start();
+#endif
     auto& board = Board::GetInstance();
+    // Before the first state change, so that the LEDs show it too
+    SubscribeEvents();
     SetDeviceState(kDeviceStateStarting);
 
     /* Setup the display */
@@ -408,92 +644,177 @@ void Application::Start() {
 
     /* Setup the audio codec */
     auto codec = board.GetAudioCodec();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_->SetComplexity(0);
-    if (aec_mode_ != kAecOff) {
-        ESP_LOGI(TAG, "AEC mode: %d, setting opus encoder complexity to 0", aec_mode_);
-        opus_encoder_->SetComplexity(0);
-    } else {
-#if CONFIG_USE_AUDIO_PROCESSOR
-        ESP_LOGI(TAG, "Audio processor detected, setting opus encoder complexity to 5");
-        opus_encoder_->SetComplexity(5);
-#else
-        ESP_LOGI(TAG, "Audio processor not detected, setting opus encoder complexity to 0");
-        opus_encoder_->SetComplexity(0);
-#endif
+    ReserveBootArena(codec);
+    // Room for a stereo stream on a stereo codec, a decoder is reconfigured in place for another format
+    downlink_decoders_ = std::make_unique<DownlinkDecoderCache>(codec->output_sample_rate(), OPUS_FRAME_DURATION_MS,
+        codec->output_channels());
+    opus_encoder_ = std::make_unique<OpusStreamEncoder>(16000, 1, OPUS_FRAME_DURATION_MS, kBootSlotUplinkEncoder);
+
+    if constexpr (BoardAudioTraits::kInputSampleRateKnown) {
+        // The input path is specialized for the rate in config.h, the codec must capture at it
+        assert(codec->input_sample_rate() == BoardAudioTraits::kInputSampleRate);
     }
-
-    if (codec->input_sample_rate() != 16000) {
-        input_resampler_.Configure(codec->input_sample_rate(), 16000);
-        reference_resampler_.Configure(codec->input_sample_rate(), 16000);
+    if constexpr (BoardAudioTraits::kInputMayResample) {
+        if (codec->input_sample_rate() != BOARD_AUDIO_PROCESS_SAMPLE_RATE) {
+            input_resamplers_.resize(codec->input_channels());
+            for (auto& resampler : input_resamplers_) {
+                resampler.Configure(codec->input_sample_rate(), BOARD_AUDIO_PROCESS_SAMPLE_RATE);
+            }
+        }
     }
     codec->Start();
+    LogBootPhase("codec");
+#if CONFIG_USE_AUDIO_CAPTURE_RING
+    audio_capture_ = std::make_unique<AudioCapture>(codec);
+    capture_reader_ = audio_capture_->CreateReader();
+    audio_capture_->Start();
+#endif
+#if CONFIG_USE_AUDIO_RECORDER
+    audio_recorder_ = std::make_unique<AudioRecorder>(audio_capture_.get(), codec->input_sample_rate(), codec->input_channels());
+#endif
+#if CONFIG_USE_CODEC_POWER_GATING
+    codec_power_ = std::make_unique<CodecPowerManager>(codec);
+#endif
 
-#if CONFIG_USE_AUDIO_PROCESSOR
-    xTaskCreatePinnedToCore([](void* arg) {
-        Application* app = (Application*)arg;
-        app->AudioLoop();
-        vTaskDelete(NULL);
-    }, "audio_loop", 4096 * 2, this, 8, &audio_loop_task_handle_, 1);
-#else
-    xTaskCreate([](void* arg) {
+    TaskTopology::GetInstance().CreateTask(kTaskAudioLoop, [](void* arg) {
         Application* app = (Application*)arg;
         app->AudioLoop();
-        vTaskDelete(NULL);
-    }, "audio_loop", 4096 * 2, this, 8, &audio_loop_task_handle_);
-#endif
+        TaskTopology::ExitTask();
+    }, this, &audio_loop_task_handle_);
 
     /* Start the clock timer to update the status bar */
-    esp_timer_start_periodic(clock_timer_handle_, 1000000);
+    {
+        std::lock_guard<std::mutex> lock(clock_mutex_);
+        clock_running_ = true;
+    }
+    ScheduleClockTimer();
+
+    // Loading the models does not need the network, it runs while the network connects
+    background_task_->Schedule([this, codec]() {
+        audio_processor_->Initialize(codec);
+        wake_word_->Initialize(codec);
+        LogBootPhase("audio front end");
+    }, kBackgroundTaskPriorityHigh, &audio_front_end_ready_);
 
     /* Wait for the network to be ready */
     board.StartNetwork();
+    LogBootPhase("network");
 
     // Update the status bar immediately to show the network state
     display->UpdateStatusBar(true);
 
-    // Check for new firmware version or get the MQTT broker address
-    Ota ota;
-    CheckNewVersion(ota);
+    // A device that has completed a version check before connects with the saved
+    // protocol config and checks the version in the background once it is idle
+    std::string protocol_type;
+    {
+        Settings settings("ota", false);
+        protocol_type = settings.GetString("protocol");
+    }
+    bool deferred_check = !protocol_type.empty();
+    auto ota = std::make_shared<Ota>();
+    if (!deferred_check) {
+        // Check for new firmware version or get the MQTT broker address. The main loop
+        // is not running yet, its tasks run here until the check gives up or is done
+        bool checked = false;
+        CheckNewVersion(ota, false, [&checked](bool) {
+            checked = true;
+        });
+        while (!checked) {
+            RunMainEvents();
+        }
+        protocol_type = GetProtocolType(*ota);
+        LogBootPhase("version check");
+    }
 
     // Initialize the protocol
-    display->SetStatus(Lang::Strings::LOADING_PROTOCOL);
+    display->QueueStatus(Lang::Strings::LOADING_PROTOCOL);
 
     // Add MCP common tools before initializing the protocol
 #if CONFIG_IOT_PROTOCOL_MCP
     McpServer::GetInstance().AddCommonTools();
 #endif
 
-    if (ota.HasMqttConfig()) {
-        protocol_ = std::make_unique<MqttProtocol>();
-    } else if (ota.HasWebsocketConfig()) {
+    if (protocol_type == "udp") {
+        protocol_ = std::make_unique<UdpProtocol>();
+    } else if (protocol_type == "websocket") {
         protocol_ = std::make_unique<WebsocketProtocol>();
     } else {
-        ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
         protocol_ = std::make_unique<MqttProtocol>();
     }
+    ConfigureUplinkEncoder(protocol_type != "websocket");
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
+    // The boards added their things before Start, the descriptors do not change after this
+    protocol_->SetIotDescriptorsHash(iot::ThingManager::GetInstance().GetDescriptorsHash());
+#endif
+#if CONFIG_USE_DEVICE_ENDPOINTING
+    {
+        Settings settings("audio", false);
+        endpoint_silence_ms_ = settings.GetInt("endpoint_silence_ms", CONFIG_DEVICE_ENDPOINT_SILENCE_MS);
+    }
+#endif
+    protocol_->SetClientFrameDuration(GetPreferredFrameDuration());
+    protocol_->SetOutputChannels(codec->output_channels());
 
-    protocol_->OnNetworkError([this](const std::string& message) {
+    protocol_->OnNetworkError([this, &board](const std::string& message) {
+        board.OnServerConnection(false);
         SetDeviceState(kDeviceStateIdle);
         Alert(Lang::Strings::ERROR, message.c_str(), "sad", Lang::Sounds::P3_EXCLAMATION);
     });
     protocol_->OnIncomingAudio([this](AudioStreamPacket&& packet) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (device_state_ == kDeviceStateSpeaking && audio_decode_queue_.size() < MAX_AUDIO_PACKETS_IN_QUEUE) {
-            audio_decode_queue_.emplace_back(std::move(packet));
+#if CONFIG_USE_PIPELINE_TRACE
+        PipelineTrace::GetInstance().Emit(kPipelineEventAudioReceive, kPipelinePhaseInstant, packet.payload.size());
+#endif
+#if CONFIG_USE_MEDIA_PLAYBACK
+        // A reply over the media brings its own audio, the frames of the media wait for it in their buffer
+        if (media_active_ && !tts_streaming_) {
+            media_buffer_.Put(packet);
+            NotifyAudioLoop();
+            return;
+        }
+#endif
+        if (device_state_ == kDeviceStateSpeaking || tts_streaming_) {
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+            if (!response_cache_.OnIncomingPacket(packet)) {
+                return;
+            }
+#endif
+            jitter_buffer_.Put(std::move(packet));
+            NotifyAudioLoop();
         }
     });
+#if CONFIG_USE_MEDIA_PLAYBACK
+    media_buffer_.OnFlowControl([this](bool hold) {
+        Schedule([this, hold]() {
+            // An interrupted stream stays held until the turn over it is done
+            if (protocol_ && protocol_->media_streaming() && media_active_ && (hold || !media_interrupted_)) {
+                protocol_->SendMediaControl(hold ? "hold" : "fill");
+            }
+        });
+    });
+#endif
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
+        board.OnServerConnection(true);
         board.SetPowerSaveMode(false);
+        uplink_opened_us_ = esp_timer_get_time();
+        SetUplinkFrameDuration(protocol_->client_frame_duration());
+        ApplyUplinkLevel();
+        if (adaptive_bitrate_.level() > 0) {
+            protocol_->SendLinkQuality(adaptive_bitrate_.level(), adaptive_bitrate_.current().downlink_bitrate);
+        }
+#if !CONFIG_USE_OUTPUT_RATE_FOLLOWS_SERVER
         if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
         }
+#endif
 
 #if CONFIG_IOT_PROTOCOL_XIAOZHI
         auto& thing_manager = iot::ThingManager::GetInstance();
-        protocol_->SendIotDescriptors(thing_manager.GetDescriptorsJson());
+        if (protocol_->server_has_iot_descriptors()) {
+            ESP_LOGI(TAG, "Server already has the IoT descriptors");
+        } else {
+            protocol_->SendIotDescriptors(thing_manager.GetDescriptors());
+        }
         std::string states;
         if (thing_manager.GetStatesJson(states, false)) {
             protocol_->SendIotStates(states);
@@ -504,218 +825,210 @@ void Application::Start() {
         board.SetPowerSaveMode(true);
         Schedule([this]() {
             auto display = Board::GetInstance().GetDisplay();
-            display->SetChatMessage("system", "");
+            display->QueueChatMessage("system", "");
             SetDeviceState(kDeviceStateIdle);
         });
     });
-    protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
-        auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
-                Schedule([this]() {
-                    aborted_ = false;
-                    if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
-                        SetDeviceState(kDeviceStateSpeaking);
-                    }
-                });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
-                Schedule([this]() {
-                    background_task_->WaitForCompletion();
-                    if (device_state_ == kDeviceStateSpeaking) {
-                        if (listening_mode_ == kListeningModeManualStop) {
-                            SetDeviceState(kDeviceStateIdle);
-                        } else {
-                            SetDeviceState(kDeviceStateListening);
-                        }
-                    }
-                });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (cJSON_IsString(text)) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
-                    });
-                }
-            }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (cJSON_IsString(text)) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(emotion)) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
-                    display->SetEmotion(emotion_str.c_str());
-                });
-            }
-#if CONFIG_IOT_PROTOCOL_MCP
-        } else if (strcmp(type->valuestring, "mcp") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            if (cJSON_IsObject(payload)) {
-                McpServer::GetInstance().ParseMessage(payload);
-            }
+    protocol_->OnIncomingJson([this](const cJSON* root) {
+        MemoryTagScope tag(kMemoryTagProtocol);
+#if CONFIG_USE_PIPELINE_TRACE
+        PipelineTrace::GetInstance().Emit(kPipelineEventJsonReceive, kPipelinePhaseBegin);
 #endif
-#if CONFIG_IOT_PROTOCOL_XIAOZHI
-        } else if (strcmp(type->valuestring, "iot") == 0) {
-            auto commands = cJSON_GetObjectItem(root, "commands");
-            if (cJSON_IsArray(commands)) {
-                auto& thing_manager = iot::ThingManager::GetInstance();
-                for (int i = 0; i < cJSON_GetArraySize(commands); ++i) {
-                    auto command = cJSON_GetArrayItem(commands, i);
-                    thing_manager.Invoke(command);
-                }
-            }
+        OnIncomingJson(root);
+#if CONFIG_USE_PIPELINE_TRACE
+        PipelineTrace::GetInstance().Emit(kPipelineEventJsonReceive, kPipelinePhaseEnd);
 #endif
-        } else if (strcmp(type->valuestring, "system") == 0) {
-            auto command = cJSON_GetObjectItem(root, "command");
-            if (cJSON_IsString(command)) {
-                ESP_LOGI(TAG, "System command: %s", command->valuestring);
-                if (strcmp(command->valuestring, "reboot") == 0) {
-                    // Do a reboot if user requests a OTA update
-                    Schedule([this]() {
-                        Reboot();
-                    });
-                } else {
-                    ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
-                }
-            }
-        } else if (strcmp(type->valuestring, "alert") == 0) {
-            auto status = cJSON_GetObjectItem(root, "status");
-            auto message = cJSON_GetObjectItem(root, "message");
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
-                Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::P3_VIBRATION);
-            } else {
-                ESP_LOGW(TAG, "Alert command requires status, message and emotion");
-            }
-        } else {
-            ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
-        }
     });
-    bool protocol_started = protocol_->Start();
+    protocol_->OnIncomingControl([this](const ControlMessage& message) {
+        OnIncomingControl(message);
+    });
+    protocol_->OnUplinkBitrateChanged([this](int bitrate) {
+        transport_bitrate_ = bitrate;
+        ApplyUplinkLevel();
+    });
+    bool protocol_started;
+    {
+        MemoryTagScope tag(kMemoryTagProtocol);
+        protocol_started = protocol_->Start();
+    }
+    LogBootPhase("protocol");
+    ProbeEndpoints();
+#if CONFIG_USE_WAKE_ARBITRATION
+    if (board.GetBoardType() == "wifi") {
+        WakeArbiter::GetInstance().Start();
+    }
+#endif
 
     audio_debugger_ = std::make_unique<AudioDebugger>();
-    audio_processor_->Initialize(codec);
-    audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            if (audio_send_queue_.size() >= MAX_AUDIO_PACKETS_IN_QUEUE) {
-                ESP_LOGW(TAG, "Too many audio packets in queue, drop the newest packet");
-                return;
-            }
-        }
-        background_task_->Schedule([this, data = std::move(data)]() mutable {
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                AudioStreamPacket packet;
-                packet.payload = std::move(opus);
-#ifdef CONFIG_USE_SERVER_AEC
-                {
-                    std::lock_guard<std::mutex> lock(timestamp_mutex_);
-                    if (!timestamp_queue_.empty()) {
-                        packet.timestamp = timestamp_queue_.front();
-                        timestamp_queue_.pop_front();
-                    } else {
-                        packet.timestamp = 0;
-                    }
-
-                    if (timestamp_queue_.size() > 3) { // 限制队列长度3
-                        timestamp_queue_.pop_front(); // 该包发送前先出队保持队列长度
-                        return;
-                    }
-                }
+    audio_front_end_ready_.Wait();
+    audio_processor_->OnOutput([this](const int16_t* data, size_t samples) {
+        audio_debugger_->Feed(kAudioDebugStreamProcessed, data, samples, 16000, 1);
+#if CONFIG_USE_DEVICE_ENDPOINTING
+        CheckEndpoint();
 #endif
-                std::lock_guard<std::mutex> lock(mutex_);
-                if (audio_send_queue_.size() >= MAX_AUDIO_PACKETS_IN_QUEUE) {
-                    ESP_LOGW(TAG, "Too many audio packets in queue, drop the oldest packet");
-                    audio_send_queue_.pop_front();
-                }
-                audio_send_queue_.emplace_back(std::move(packet));
-                xEventGroupSetBits(event_group_, SEND_AUDIO_EVENT);
-            });
+        // Counted before the drop check so later frames keep their position
+        uint64_t position = playout_clock_.AdvanceUplink(samples);
+        if (audio_send_queue_.Size() >= GetMaxQueuedPackets(MAX_AUDIO_QUEUE_DURATION_MS)) {
+            DEFERRED_LOGW(TAG, "Too many audio packets in queue, drop the newest packet");
+            uplink_dropped_full_++;
+            return;
+        }
+        // The view is only valid during this call, the copy goes into a slot that keeps its capacity
+        bool queued = uplink_pcm_queue_.PushWith([data, samples, position](UplinkPcm& slot) {
+            slot.pcm.assign(data, data + samples);
+            slot.position = position;
+        });
+        if (!queued) {
+            DEFERRED_LOGW(TAG, "Encoder is behind, drop the newest chunk");
+            uplink_dropped_full_++;
+            return;
+        }
+        audio_encode_task_->Schedule([this]() {
+            EncodeUplinkPcm();
+        }, kBackgroundTaskPriorityHigh);
+    });
+#if CONFIG_USE_UPLINK_SILENCE_SUPPRESSION
+    uplink_silence_gate_.OnEvent([this](UplinkSilenceEvent event, int silence_ms) {
+        Schedule([this, event, silence_ms]() {
+            if (protocol_ && protocol_->IsAudioChannelOpened()) {
+                protocol_->SendUplinkSilence(event != kUplinkVoiceResumed, silence_ms);
+            }
         });
     });
+#endif
     audio_processor_->OnVadStateChange([this](bool speaking) {
-        if (device_state_ == kDeviceStateListening) {
+#if CONFIG_USE_UPLINK_SILENCE_SUPPRESSION
+        uplink_silence_gate_.SetVoice(speaking);
+#endif
+        if (speaking) {
+            speech_end_us_ = 0;
+        } else if (device_state_ == kDeviceStateListening) {
+            speech_end_us_ = esp_timer_get_time();
+        }
+        if (speaking && device_state_ == kDeviceStateSpeaking && listening_mode_ == kListeningModeRealtime &&
+            aec_mode_ == kAecOnDeviceSide) {
+            // Only the device-side AEC removes our own voice from the VAD input
+            BargeIn();
+        } else if (device_state_ == kDeviceStateListening) {
+#if CONFIG_USE_DEVICE_ENDPOINTING
+            if (speaking) {
+                silence_since_us_ = 0;
+                endpoint_armed_ = listening_mode_ == kListeningModeAutoStop && endpoint_silence_ms_ > 0;
+            } else if (endpoint_armed_) {
+                silence_since_us_ = esp_timer_get_time();
+            }
+#endif
             Schedule([this, speaking]() {
-                if (speaking) {
-                    voice_detected_ = true;
-                } else {
-                    voice_detected_ = false;
-                }
-                auto led = Board::GetInstance().GetLed();
-                led->OnStateChanged();
+                voice_detected_ = speaking;
+                PublishVoiceDetected(speaking);
             });
         }
     });
 
-    wake_word_->Initialize(codec);
     wake_word_->OnWakeWordDetected([this](const std::string& wake_word) {
-        Schedule([this, &wake_word]() {
-            if (!protocol_) {
-                return;
-            }
-
-            if (device_state_ == kDeviceStateIdle) {
-                wake_word_->EncodeWakeWordData();
-
-                if (!protocol_->IsAudioChannelOpened()) {
-                    SetDeviceState(kDeviceStateConnecting);
-                    if (!protocol_->OpenAudioChannel()) {
+#if CONFIG_USE_WAKE_WORD_BENCHMARK
+        auto benchmark = wake_word_benchmark_.load();
+        if (benchmark != nullptr) {
+            benchmark->OnDetected(wake_word);
+            return;
+        }
+#endif
+#if CONFIG_USE_WAKE_ARBITRATION
+        auto& arbiter = WakeArbiter::GetInstance();
+        if (arbiter.started() && device_state_ == kDeviceStateIdle) {
+            // Only the device closest to the speaker opens a session, the others listen on
+            float level_db = -100.0f;
+            wake_word_->GetWakeWordLevel(level_db);
+            arbiter.Arbitrate(level_db, [this, &wake_word](bool won) {
+                Schedule([this, &wake_word, won]() {
+                    if (won) {
+                        HandleWakeWord(wake_word);
+                    } else if (device_state_ == kDeviceStateIdle) {
                         wake_word_->StartDetection();
-                        return;
                     }
-                }
-
-                ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
-#if CONFIG_USE_AFE_WAKE_WORD
-                AudioStreamPacket packet;
-                // Encode and send the wake word data to the server
-                while (wake_word_->GetWakeWordOpus(packet.payload)) {
-                    protocol_->SendAudio(packet);
-                }
-                // Set the chat state to wake word detected
-                protocol_->SendWakeWordDetected(wake_word);
-#else
-                // Play the pop up sound to indicate the wake word is detected
-                // And wait 60ms to make sure the queue has been processed by audio task
-                ResetDecoder();
-                PlaySound(Lang::Sounds::P3_POPUP);
-                vTaskDelay(pdMS_TO_TICKS(60));
+                });
+            });
+            return;
+        }
+        if (arbiter.started() && (device_state_ == kDeviceStateListening || device_state_ == kDeviceStateSpeaking)) {
+            // Already in a conversation, the idle devices around leave the wake word to this one
+            arbiter.Announce();
+        }
 #endif
-                SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
-            } else if (device_state_ == kDeviceStateSpeaking) {
-                AbortSpeaking(kAbortReasonWakeWordDetected);
-            } else if (device_state_ == kDeviceStateActivating) {
-                SetDeviceState(kDeviceStateIdle);
-            }
+        Schedule([this, &wake_word]() {
+            HandleWakeWord(wake_word);
         });
     });
+#if CONFIG_USE_COMMAND_WORDS
+    std::vector<std::string> command_words;
+    for (auto& command : kLocalCommands) {
+        command_words.push_back(command.phrase);
+    }
+    if (wake_word_->SetCommandWords(command_words)) {
+        wake_word_->OnCommandDetected([this](const CommandWord& command) {
+            Schedule([this, command]() {
+                HandleCommandWord(command);
+            });
+        });
+    }
+#endif
     wake_word_->StartDetection();
 
-    // Wait for the new version check to finish
-    xEventGroupWaitBits(event_group_, CHECK_NEW_VERSION_DONE_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+    if (!deferred_check) {
+        // Wait for the new version check to finish
+        xEventGroupWaitBits(event_group_, CHECK_NEW_VERSION_DONE_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+        has_server_time_ = ota->HasServerTime();
+    }
     SetDeviceState(kDeviceStateIdle);
+    LogBootPhase("ready");
+
+    if (deferred_check) {
+        if (ota->IsCheckResultFresh()) {
+            // Fresh means the clock set by the last check survived the reset
+            ESP_LOGI(TAG, "Version checked recently, skipping the check");
+            has_server_time_ = true;
+        } else {
+            CheckNewVersion(ota, true, [this, ota](bool success) {
+                if (success) {
+                    has_server_time_ = ota->HasServerTime();
+                    LogBootPhase("deferred version check");
+                }
+            });
+        }
+    }
 
-    has_server_time_ = ota.HasServerTime();
     if (protocol_started) {
-        std::string message = std::string(Lang::Strings::VERSION) + ota.GetCurrentVersion();
-        display->ShowNotification(message.c_str());
-        display->SetChatMessage("system", "");
+        std::string message = std::string(Lang::Strings::VERSION) + esp_app_get_description()->version;
+        display->QueueNotification(message);
+        display->QueueChatMessage("system", "");
         // Play the success sound to indicate the device is ready
         ResetDecoder();
         PlaySound(Lang::Sounds::P3_SUCCESS);
     }
 
+#if CONFIG_DISPLAY_BENCHMARK_AT_BOOT
+    display->RunRenderBenchmark(30);
+#endif
+#if CONFIG_BENCHMARK_SUITE_AT_BOOT
+    BenchmarkSuite::GetInstance().Run();
+#endif
+
     // Print heap stats
     SystemInfo::PrintHeapStats();
-    
+#if CONFIG_USE_TASK_PROFILER
+    TaskProfiler::GetInstance().Start();
+#endif
+#if CONFIG_USE_DEADLINE_MONITOR
+    DeadlineMonitor::GetInstance().Start();
+#endif
+#if CONFIG_USE_PIPELINE_TRACE
+    PipelineTrace::GetInstance().Start();
+    display->EnablePipelineTrace();
+#endif
+#if CONFIG_USE_CONVERSATION_SOAK
+    ConversationSoak::GetInstance().Initialize();
+#endif
+
     // Enter the main event loop
     MainEventLoop();
 }
@@ -723,35 +1036,470 @@ void Application::Start() {
 void Application::OnClockTimer() {
     clock_ticks_++;
 
+    // 升级固件或播放时不读取 4G 网络状态，避免占用 UART 资源
+    DeviceState state = device_state_;
+    NetworkMonitor::GetInstance().OnClockTick(background_task_, state == kDeviceStateIdle ||
+        state == kDeviceStateStarting || state == kDeviceStateWifiConfiguring ||
+        state == kDeviceStateListening || state == kDeviceStateActivating);
+
     auto display = Board::GetInstance().GetDisplay();
     display->UpdateStatusBar();
 
-    // Print the debug info every 10 seconds
-    if (clock_ticks_ % 10 == 0) {
-        // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
-        // SystemInfo::PrintTaskList();
-        SystemInfo::PrintHeapStats();
+    if (clock_ticks_ % LINK_QUALITY_UPDATE_SECONDS == 0 &&
+        (device_state_ == kDeviceStateListening || device_state_ == kDeviceStateSpeaking)) {
+        Schedule([this]() {
+            UpdateLinkQuality();
+        });
+    }
 
-        // If we have synchronized server time, set the status to clock "HH:MM" if the device is idle
-        if (has_server_time_) {
-            if (device_state_ == kDeviceStateIdle) {
-                Schedule([this]() {
-                    // Set status to clock "HH:MM"
-                    time_t now = time(NULL);
-                    char time_str[64];
-                    strftime(time_str, sizeof(time_str), "%H:%M  ", localtime(&now));
-                    Board::GetInstance().GetDisplay()->SetStatus(time_str);
-                });
+#if CONFIG_USE_DEVICE_ENDPOINTING
+    if (endpointed_us_ != 0 && esp_timer_get_time() - endpointed_us_ > ENDPOINT_REPLY_TIMEOUT_MS * 1000LL) {
+        Schedule([this]() {
+            if (endpointed_us_ != 0 && device_state_ == kDeviceStateListening) {
+                ESP_LOGW(TAG, "No reply after the endpoint, ending the turn");
+                SetDeviceState(kDeviceStateIdle);
+            }
+        });
+    }
+#endif
+
+    if (device_state_ == kDeviceStateIdle) {
+        // If we have synchronized server time, set the status to clock "HH:MM". The idle schedule
+        // wakes at every new minute, so it is never a minute behind
+        if (has_server_time_) {
+            time_t now = time(NULL);
+            char time_str[64];
+            strftime(time_str, sizeof(time_str), "%H:%M  ", localtime(&now));
+            display->QueueStatus(time_str);
+        }
+    } else if (clock_ticks_ % 10 == 0) {
+        // Print the debug info every 10 seconds while the device is busy anyway, in idle the
+        // memory is in self.system.get_metrics instead of waking up for a log line
+        // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
+        // SystemInfo::PrintTaskList();
+        SystemInfo::PrintHeapStats();
+    }
+    ScheduleClockTimer();
+}
+
+// One-shot, so an idle device is only woken when something is due instead of every second to count
+void Application::ScheduleClockTimer(bool soon) {
+    std::lock_guard<std::mutex> lock(clock_mutex_);
+    if (!clock_running_) {
+        return;
+    }
+    int64_t delay_us = 1000000;
+    if (device_state_ == kDeviceStateIdle && !soon) {
+        delay_us = CLOCK_IDLE_STATUS_INTERVAL_MS * 1000LL;
+        if (has_server_time_) {
+            // Time zones are whole minutes off UTC, a little after the boundary strftime sees the new minute
+            struct timeval now;
+            gettimeofday(&now, nullptr);
+            int64_t into_minute_us = (now.tv_sec % 60) * 1000000LL + now.tv_usec;
+            delay_us = std::min<int64_t>(delay_us, 60000000LL - into_minute_us + 20000);
+        }
+        int64_t sample_in_us = NetworkMonitor::GetInstance().GetNextSampleUs() - esp_timer_get_time();
+        delay_us = std::min<int64_t>(delay_us, std::max<int64_t>(sample_in_us, 100000));
+    }
+    // The timer may be armed from another task, a stop of one that already fired does nothing
+    esp_timer_stop(clock_timer_handle_);
+    esp_timer_start_once(clock_timer_handle_, delay_us);
+}
+
+// FNV-1a, evaluated at compile time for the dispatch table
+static constexpr uint32_t HashMessageType(std::string_view type) {
+    uint32_t hash = 2166136261u;
+    for (char c : type) {
+        hash = (hash ^ (uint8_t)c) * 16777619u;
+    }
+    return hash;
+}
+
+struct JsonMessageHandler {
+    uint32_t hash;
+    std::string_view type;
+    void (Application::*handler)(const cJSON* root);
+};
+
+#define JSON_MESSAGE_HANDLER(type, handler) { HashMessageType(type), type, &Application::handler }
+
+void Application::OnIncomingJson(const cJSON* root) {
+    static constexpr JsonMessageHandler kHandlers[] = {
+        JSON_MESSAGE_HANDLER("tts", HandleTtsMessage),
+        JSON_MESSAGE_HANDLER("stt", HandleSttMessage),
+        JSON_MESSAGE_HANDLER("llm", HandleLlmMessage),
+#if CONFIG_IOT_PROTOCOL_MCP
+        JSON_MESSAGE_HANDLER("mcp", HandleMcpMessage),
+#endif
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
+        JSON_MESSAGE_HANDLER("iot", HandleIotMessage),
+#endif
+        JSON_MESSAGE_HANDLER("system", HandleSystemMessage),
+        JSON_MESSAGE_HANDLER("alert", HandleAlertMessage),
+#if CONFIG_USE_MEDIA_PLAYBACK
+        JSON_MESSAGE_HANDLER("media", HandleMediaMessage),
+#endif
+    };
+
+    auto type = cJSON_GetObjectItem(root, "type");
+    if (!cJSON_IsString(type)) {
+        ESP_LOGW(TAG, "Message without type");
+        return;
+    }
+    std::string_view type_str = type->valuestring;
+    uint32_t hash = HashMessageType(type_str);
+    for (auto& entry : kHandlers) {
+        if (entry.hash == hash && entry.type == type_str) {
+            (this->*entry.handler)(root);
+            return;
+        }
+    }
+    ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
+}
+
+// CBOR control messages arrive here without a cJSON tree, the views are only valid during the call
+void Application::OnIncomingControl(const ControlMessage& message) {
+    if (message.type == "tts") {
+        HandleTts(message.state, message.text, message.hash);
+    } else if (message.type == "stt") {
+        HandleStt(message.text);
+    } else if (message.type == "llm" && !message.emotion.empty()) {
+        QueueEmotion(message.emotion);
+    }
+}
+
+void Application::HandleTtsMessage(const cJSON* root) {
+    auto state = cJSON_GetObjectItem(root, "state");
+    if (!cJSON_IsString(state)) {
+        return;
+    }
+    auto text = cJSON_GetObjectItem(root, "text");
+    auto hash = cJSON_GetObjectItem(root, "hash");
+    HandleTts(state->valuestring, cJSON_IsString(text) ? text->valuestring : "",
+        cJSON_IsString(hash) ? hash->valuestring : "");
+}
+
+void Application::HandleTts(std::string_view state, std::string_view text, std::string_view hash) {
+    if (state == "start") {
+        // Audio follows right behind this message. Start buffering it now instead of when the
+        // main loop gets to the state change, so the first syllable is not dropped.
+        DeviceState device_state = device_state_;
+        bool can_speak = device_state == kDeviceStateIdle || device_state == kDeviceStateListening ||
+            device_state == kDeviceStateSpeaking;
+        if (can_speak && !tts_streaming_.exchange(true)) {
+            jitter_buffer_.Reset();
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+            response_cache_.Reset();
+            tts_stop_pending_ = false;
+#endif
+#if CONFIG_USE_OUTPUT_PREWARM
+            // Reset already by the prewarm and nothing decoded since, only the format is checked
+            int64_t prewarm_us = output_prewarm_us_.exchange(0);
+            bool prewarmed = prewarm_us != 0 && esp_timer_get_time() - prewarm_us < OUTPUT_PREWARM_VALID_MS * 1000;
+            PrepareDecoder(!prewarmed);
+#else
+            PrepareDecoder(true);
+#endif
+#if CONFIG_USE_CODEC_POWER_GATING
+            // The amplifier and DAC come up while the first packets are still buffering
+            codec_power_->Prewarm();
+#endif
+        }
+        Schedule([this]() {
+            aborted_ = false;
+            Board::GetInstance().GetAudioCodec()->SetOutputMute(false);
+            if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
+                SetDeviceState(kDeviceStateSpeaking);
             }
+        });
+    } else if (state == "stop") {
+        tts_streaming_ = false;
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+        response_cache_.EndSentence();
+        // The server skipped the cached sentences, so the reply may end well before they have played
+        if (response_cache_.Playing()) {
+            tts_stop_pending_ = true;
+            NotifyAudioLoop();
+            return;
+        }
+#endif
+        Schedule([this]() {
+            OnTtsStopped();
+        });
+    } else if (state == "sentence_start") {
+        // Between sentences is the only place the decoder may be swapped if the stream changed
+        PrepareDecoder(false);
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+        // Audio already in the jitter buffer belongs to the sentences before this one and plays first
+        if (response_cache_.StartSentence(hash, tts_streaming_ && protocol_->tts_caching(), jitter_buffer_.GetStats().depth)) {
+            protocol_->SendTtsCacheHit(hash);
+            NotifyAudioLoop();
+        }
+#endif
+        if (!text.empty()) {
+            ESP_LOGI(TAG, "<< %.*s", (int)text.size(), text.data());
+            QueueChatMessage("assistant", text);
+        }
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+    } else if (state == "sentence_end") {
+        response_cache_.EndSentence();
+#endif
+    }
+}
+
+void Application::OnTtsStopped() {
+    audio_decode_task_->WaitForCompletion();
+    auto stats = jitter_buffer_.GetStats();
+    ESP_LOGI(TAG, "Jitter buffer: depth %u/%u, jitter %lu ms, underruns %lu, late %lu, overflow %lu, lost %lu, reordered %lu",
+        stats.depth, stats.target_depth, stats.jitter_ms, stats.underruns, stats.late_drops,
+        stats.overflow_drops, stats.lost_packets, stats.reordered_packets);
+#ifdef CONFIG_USE_SERVER_AEC
+    auto clock = playout_clock_.GetStats();
+    ESP_LOGI(TAG, "Playout clock: drift out %ld ppm, in %ld ppm, tagged %lu, untagged %lu",
+        clock.output_drift_ppm, clock.input_drift_ppm, clock.tagged_frames, clock.untagged_frames);
+#endif
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+    auto cache = response_cache_.GetStats();
+    ESP_LOGI(TAG, "Response cache: %u sentences, %u bytes, hits %lu, misses %lu, evicted %lu, discarded %lu",
+        cache.entries, cache.bytes, cache.hits, cache.misses, cache.evictions, cache.discarded);
+#endif
+#if CONFIG_USE_MEDIA_PLAYBACK
+    if (ResumeInterruptedMedia()) {
+        return;
+    }
+#endif
+    if (device_state_ == kDeviceStateSpeaking) {
+        if (listening_mode_ == kListeningModeManualStop) {
+            SetDeviceState(kDeviceStateIdle);
+        } else {
+            SetDeviceState(kDeviceStateListening);
         }
     }
 }
 
+#if CONFIG_USE_MEDIA_PLAYBACK
+// "start" opens a stream at position_ms, a seek is answered with a new one. "stop" means all of it has been sent
+void Application::HandleMediaMessage(const cJSON* root) {
+    auto state = cJSON_GetObjectItem(root, "state");
+    if (!cJSON_IsString(state)) {
+        return;
+    }
+    if (strcmp(state->valuestring, "start") == 0) {
+        DeviceState device_state = device_state_;
+        if (device_state != kDeviceStateIdle && device_state != kDeviceStateListening &&
+                device_state != kDeviceStateSpeaking) {
+            return;
+        }
+        auto position = cJSON_GetObjectItem(root, "position_ms");
+        if (!media_buffer_.Start(cJSON_IsNumber(position) ? position->valueint : 0)) {
+            protocol_->SendMediaControl("stop");
+            return;
+        }
+        ESP_LOGI(TAG, "Media started");
+        media_active_ = true;
+        PrepareDecoder(true);
+        Schedule([this]() {
+            aborted_ = false;
+            Board::GetInstance().GetAudioCodec()->SetOutputMute(false);
+            // A reply still playing hands over to the media when it stops
+            if (!tts_streaming_ && (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening)) {
+                SetDeviceState(kDeviceStateSpeaking);
+            }
+        });
+    } else if (strcmp(state->valuestring, "stop") == 0) {
+        media_buffer_.Finish();
+        NotifyAudioLoop();
+    }
+}
+
+void Application::OnMediaStopped() {
+    auto stats = media_buffer_.GetStats();
+    ESP_LOGI(TAG, "Media stopped at %lu ms, underruns %lu, overflow %lu", stats.position_ms, stats.underruns,
+        stats.overflow_drops);
+    media_interrupted_ = false;
+    Board::GetInstance().GetAudioCodec()->SetOutputDucking(false);
+    if (device_state_ == kDeviceStateSpeaking && !tts_streaming_) {
+        SetDeviceState(kDeviceStateIdle);
+    }
+}
+
+// Main loop, a wake word over the media
+void Application::InterruptMedia() {
+    media_interrupted_ = true;
+    if (protocol_->media_streaming()) {
+        protocol_->SendMediaControl("hold");
+    }
+    // With AEC the media goes on quietly under the user's voice, without it GetDownlinkPacket holds it back
+    if (aec_mode_ != kAecOff) {
+        Board::GetInstance().GetAudioCodec()->SetOutputDucking(true);
+    }
+}
+
+// Main loop, after the turn over the media or any reply. False when there is no media to go back to,
+// the device then goes on as after any reply
+bool Application::ResumeInterruptedMedia() {
+    media_interrupted_ = false;
+    Board::GetInstance().GetAudioCodec()->SetOutputDucking(false);
+    if (!media_active_ || media_buffer_.paused()) {
+        return false;
+    }
+    media_buffer_.RefreshFlow();
+    SetDeviceState(kDeviceStateSpeaking);
+    NotifyAudioLoop();
+    return true;
+}
+
+std::string Application::ControlMedia(std::string_view action, int position_ms) {
+    if (!media_active_) {
+        return "{\"success\": false, \"message\": \"No media is playing\"}";
+    }
+    if (action == "pause") {
+        media_buffer_.SetPaused(true);
+    } else if (action == "resume") {
+        media_buffer_.SetPaused(false);
+        Schedule([this]() {
+            if (media_active_ && !tts_streaming_ && !media_interrupted_ &&
+                    (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening)) {
+                SetDeviceState(kDeviceStateSpeaking);
+            }
+            NotifyAudioLoop();
+        });
+    } else if (action == "seek") {
+        // The frames on their way are dropped too, the server answers with a new start at the position
+        media_buffer_.Flush(position_ms);
+        decode_generation_++;
+        Board::GetInstance().GetAudioCodec()->FlushOutput();
+    } else if (action == "stop") {
+        media_buffer_.Stop();
+        media_active_ = false;
+        Schedule([this]() {
+            OnMediaStopped();
+        });
+    } else {
+        return "{\"success\": false, \"message\": \"Unknown action\"}";
+    }
+    Schedule([this, action = std::string(action), position_ms]() {
+        if (protocol_ && protocol_->media_streaming()) {
+            protocol_->SendMediaControl(action, action == "seek" ? position_ms : -1);
+        }
+    });
+    return GetMediaStatusJson();
+}
+
+std::string Application::GetMediaStatusJson() {
+    auto stats = media_buffer_.GetStats();
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "active", media_active_);
+    cJSON_AddBoolToObject(root, "paused", stats.paused);
+    cJSON_AddNumberToObject(root, "position_ms", stats.position_ms);
+    cJSON_AddNumberToObject(root, "buffered_ms", stats.buffered_ms);
+    cJSON_AddNumberToObject(root, "buffered_bytes", stats.bytes);
+    cJSON_AddNumberToObject(root, "capacity_bytes", stats.capacity);
+    cJSON_AddBoolToObject(root, "server_held", stats.holding);
+    cJSON_AddBoolToObject(root, "complete", stats.finished);
+    cJSON_AddNumberToObject(root, "underruns", stats.underruns);
+    cJSON_AddNumberToObject(root, "overflow_drops", stats.overflow_drops);
+    std::string result = PrintJson(root);
+    cJSON_Delete(root);
+    return result;
+}
+#endif
+
+void Application::HandleSttMessage(const cJSON* root) {
+    auto text = cJSON_GetObjectItem(root, "text");
+    if (cJSON_IsString(text)) {
+        HandleStt(text->valuestring);
+    }
+}
+
+void Application::HandleStt(std::string_view text) {
+    ESP_LOGI(TAG, ">> %.*s", (int)text.size(), text.data());
+    QueueChatMessage("user", text);
+#if CONFIG_USE_OUTPUT_PREWARM
+    PrewarmOutput();
+#endif
+}
+
+void Application::HandleLlmMessage(const cJSON* root) {
+    auto emotion = cJSON_GetObjectItem(root, "emotion");
+    if (cJSON_IsString(emotion)) {
+        QueueEmotion(emotion->valuestring);
+    }
+#if CONFIG_USE_OUTPUT_PREWARM
+    PrewarmOutput();
+#endif
+}
+
+#if CONFIG_IOT_PROTOCOL_MCP
+void Application::HandleMcpMessage(const cJSON* root) {
+    auto payload = cJSON_GetObjectItem(root, "payload");
+    // An array is a JSON-RPC batch
+    if (cJSON_IsObject(payload) || cJSON_IsArray(payload)) {
+        McpServer::GetInstance().ParseMessage(payload);
+    }
+}
+#endif
+
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
+void Application::HandleIotMessage(const cJSON* root) {
+    auto commands = cJSON_GetObjectItem(root, "commands");
+    if (cJSON_IsArray(commands)) {
+        auto& thing_manager = iot::ThingManager::GetInstance();
+        for (int i = 0; i < cJSON_GetArraySize(commands); ++i) {
+            auto command = cJSON_GetArrayItem(commands, i);
+            thing_manager.Invoke(command);
+        }
+    }
+}
+#endif
+
+void Application::HandleSystemMessage(const cJSON* root) {
+    auto command = cJSON_GetObjectItem(root, "command");
+    if (cJSON_IsString(command)) {
+        ESP_LOGI(TAG, "System command: %s", command->valuestring);
+        if (strcmp(command->valuestring, "reboot") == 0) {
+            // Do a reboot if user requests a OTA update
+            Schedule([this]() {
+                Reboot();
+            });
+        } else {
+            ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
+        }
+    }
+}
+
+void Application::HandleAlertMessage(const cJSON* root) {
+    auto status = cJSON_GetObjectItem(root, "status");
+    auto message = cJSON_GetObjectItem(root, "message");
+    auto emotion = cJSON_GetObjectItem(root, "emotion");
+    if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
+        Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::P3_VIBRATION);
+    } else {
+        ESP_LOGW(TAG, "Alert command requires status, message and emotion");
+    }
+}
+
+// The cJSON tree is freed once the handler returns, so the text is copied once into the
+// display queue. A burst of messages is drawn together on the next LVGL refresh.
+void Application::QueueChatMessage(const char* role, std::string_view message) {
+    Board::GetInstance().GetDisplay()->QueueChatMessage(role, std::string(message));
+}
+
+void Application::QueueEmotion(std::string_view emotion) {
+    Board::GetInstance().GetDisplay()->QueueEmotion(std::string(emotion));
+}
+
 // Add a async task to MainLoop
-void Application::Schedule(std::function<void()> callback) {
-    {
+void Application::Schedule(TaskCallback callback) {
+    // Once the ring has overflowed, keep appending to the list until the main loop drains it
+    // so tasks still run in order
+    if (main_tasks_overflowed_ || !main_tasks_.Push(std::move(callback))) {
         std::lock_guard<std::mutex> lock(mutex_);
-        main_tasks_.push_back(std::move(callback));
+        if (!main_tasks_overflowed_) {
+            ESP_LOGW(TAG, "Main task queue is full, spilling to the heap");
+        }
+        main_tasks_overflowed_ = true;
+        overflow_main_tasks_.push_back(std::move(callback));
     }
     xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
 }
@@ -760,26 +1508,47 @@ void Application::Schedule(std::function<void()> callback) {
 // If other tasks need to access the websocket or chat state,
 // they should use Schedule to call this function
 void Application::MainEventLoop() {
-    // Raise the priority of the main event loop to avoid being interrupted by background tasks (which has priority 2)
-    vTaskPrioritySet(NULL, 3);
+    // Raise the priority of the main event loop to avoid being interrupted by background tasks
+    vTaskPrioritySet(NULL, TaskTopology::GetInstance().Get(kTaskMainLoop).priority);
 
     while (true) {
-        auto bits = xEventGroupWaitBits(event_group_, SCHEDULE_EVENT | SEND_AUDIO_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+        RunMainEvents();
+    }
+}
 
-        if (bits & SEND_AUDIO_EVENT) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            auto packets = std::move(audio_send_queue_);
-            lock.unlock();
-            for (auto& packet : packets) {
-                if (!protocol_->SendAudio(packet)) {
-                    break;
-                }
+// One round of the main event loop, Start() runs it for the boot version check before the loop takes over
+void Application::RunMainEvents() {
+    auto bits = xEventGroupWaitBits(event_group_, SCHEDULE_EVENT | SEND_AUDIO_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+    if (bits & SEND_AUDIO_EVENT) {
+        AudioStreamPacket packet;
+#if CONFIG_USE_DIRECT_UPLINK_SEND
+        std::lock_guard<std::mutex> lock(uplink_send_mutex_);
+#endif
+        uplink_max_depth_ = std::max<uint32_t>(uplink_max_depth_, audio_send_queue_.Size());
+        bool sent = true;
+        while (audio_send_queue_.Pop(packet)) {
+            if (!SendUplinkPacket(packet)) {
+                audio_send_queue_.Clear();
+                sent = false;
+                break;
             }
         }
+#if CONFIG_USE_DIRECT_UPLINK_SEND
+        // Nothing is left to go before the encoder's next packet
+        direct_uplink_ = sent && protocol_->IsAudioSendThreadSafe();
+#endif
+    }
 
-        if (bits & SCHEDULE_EVENT) {
+    if (bits & SCHEDULE_EVENT) {
+        TaskCallback task;
+        while (main_tasks_.Pop(task)) {
+            task();
+            task = nullptr;
+        }
+        if (main_tasks_overflowed_) {
             std::unique_lock<std::mutex> lock(mutex_);
-            auto tasks = std::move(main_tasks_);
+            auto tasks = std::move(overflow_main_tasks_);
+            main_tasks_overflowed_ = false;
             lock.unlock();
             for (auto& task : tasks) {
                 task();
@@ -790,164 +1559,538 @@ void Application::MainEventLoop() {
 
 // The Audio Loop is used to input and output audio data
 void Application::AudioLoop() {
+    MemoryAccounting::SetTaskTag(kMemoryTagAudio);
     auto codec = Board::GetInstance().GetAudioCodec();
     while (true) {
-        OnAudioInput();
-        if (codec->output_enabled()) {
-            OnAudioOutput();
+#if CONFIG_USE_AUDIO_LOOPBACK_BENCHMARK
+        if (audio_loop_pause_) {
+            audio_loop_paused_ = true;
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+            continue;
+        }
+        audio_loop_paused_ = false;
+#endif
+        // While input is running, the blocking I2S read paces the loop on DMA completion
+        bool busy = OnAudioInput();
+        if (codec->output_enabled() || !prompt_player_.Empty()) {
+            busy = OnAudioOutput() || busy;
+        }
+        if (!busy) {
+            // Nothing to feed or play: sleep until new audio, a finished decode or a state change
+            // notifies us. The jitter buffer releases its prebuffer on time, so poll it while it
+            // holds packets; otherwise only the idle output timeout needs a periodic wakeup.
+            TickType_t timeout = jitter_buffer_.Empty() ? pdMS_TO_TICKS(1000) : pdMS_TO_TICKS(10);
+            ulTaskNotifyTake(pdTRUE, timeout);
         }
     }
 }
 
-void Application::OnAudioOutput() {
-    if (busy_decoding_audio_) {
-        return;
+// Network audio in playback order: cached sentences in their place between the streamed ones
+bool Application::GetDownlinkPacket(AudioStreamPacket& packet, AudioMixerSource& source) {
+    source = kAudioSourceVoice;
+#if CONFIG_USE_MEDIA_PLAYBACK
+    // A reply over the media plays first
+    if (media_active_ && !tts_streaming_ && jitter_buffer_.Empty()) {
+        source = kAudioSourceMedia;
+        // Without AEC the microphone would hear the media, it waits while the user talks
+        if (media_interrupted_ && aec_mode_ == kAecOff) {
+            return false;
+        }
+        if (media_buffer_.Get(packet)) {
+            return true;
+        }
+        if (media_buffer_.Drained() && media_active_.exchange(false)) {
+            Schedule([this]() {
+                OnMediaStopped();
+            });
+        }
+        return false;
+    }
+#endif
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+    if (response_cache_.NextFrame(packet, jitter_buffer_.Empty())) {
+        return true;
+    }
+    if (tts_stop_pending_ && !response_cache_.Playing() && tts_stop_pending_.exchange(false)) {
+        Schedule([this]() {
+            OnTtsStopped();
+        });
+    }
+    if (!jitter_buffer_.Get(packet)) {
+        return false;
+    }
+    response_cache_.OnStreamedPacket();
+    return true;
+#else
+    return jitter_buffer_.Get(packet);
+#endif
+}
+
+// Wake the audio loop when there may be new work for it, from any task
+void Application::NotifyAudioLoop() {
+    if (audio_loop_task_handle_ != nullptr) {
+        xTaskNotifyGive(audio_loop_task_handle_);
+    }
+}
+
+bool Application::OnAudioOutput() {
+    // Leave the packet in the queue until the decoder has room for it, the decode task notifies us
+    if (audio_decode_task_->IsFull()) {
+        return false;
     }
 
     auto now = std::chrono::steady_clock::now();
     auto codec = Board::GetInstance().GetAudioCodec();
-    const int max_silence_seconds = 10;
 
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (audio_decode_queue_.empty()) {
+    // Prompt frames are decoded in place from flash and mixed over whatever else plays, the next
+    // one is taken while the mixer runs low. Network audio comes through the jitter buffer
+    const uint8_t* prompt_frame = nullptr;
+    size_t prompt_frame_size = 0;
+    if (audio_mixer_.queued_ms() < OPUS_MIN_FRAME_DURATION_MS && prompt_player_.NextFrame(prompt_frame, prompt_frame_size)) {
+        // The output may have been turned off after a long silence
+        if (!codec->output_enabled()) {
+            codec->EnableOutput(true);
+        }
+    }
+    AudioStreamPacket packet;
+    AudioMixerSource source = kAudioSourceVoice;
+    bool downlink = GetDownlinkPacket(packet, source);
+#if CONFIG_USE_AUDIO_TESTING
+    downlink = downlink || (device_state_ == kDeviceStateWifiConfiguring && audio_testing_queue_.Pop(packet));
+#endif
+    if (!downlink && prompt_frame == nullptr && audio_mixer_.queued_ms() == 0) {
+#if CONFIG_USE_CODEC_POWER_GATING
+        auto idle_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_output_time_).count();
+        codec_power_->OnOutputIdle(idle_ms, device_state_ == kDeviceStateIdle);
+#else
         // Disable the output if there is no audio data for a long time
+        const int max_silence_seconds = 10;
         if (device_state_ == kDeviceStateIdle) {
             auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_output_time_).count();
             if (duration > max_silence_seconds) {
                 codec->EnableOutput(false);
             }
         }
-        return;
+#endif
+        return false;
     }
 
-    auto packet = std::move(audio_decode_queue_.front());
-    audio_decode_queue_.pop_front();
-    lock.unlock();
-    audio_decode_cv_.notify_all();
-
-    // Synchronize the sample rate and frame duration
-    SetDecodeSampleRate(packet.sample_rate, packet.frame_duration);
-
-    busy_decoding_audio_ = true;
-    if (!background_task_->Schedule([this, codec, packet = std::move(packet)]() mutable {
-        busy_decoding_audio_ = false;
-        if (aborted_) {
+    uint32_t generation = decode_generation_;
+    audio_decode_task_->Schedule([this, codec, packet = std::move(packet), downlink, source, prompt_frame,
+            prompt_frame_size, generation]() mutable {
+        // After an abort, keep playing until the soft mute has faded out instead of cutting mid-waveform.
+        // A barge-in drops the frames that were already scheduled.
+        if ((aborted_ && codec->IsOutputSilent()) || generation != decode_generation_) {
+            NotifyAudioLoop();
             return;
         }
 
-        std::vector<int16_t> pcm;
-        if (!opus_decoder_->Decode(std::move(packet.payload), pcm)) {
-            return;
+        if (prompt_frame != nullptr) {
+            DecodePrompt(codec, prompt_frame, prompt_frame_size);
+        }
+        // The downlink frame sets the length, queued prompt audio is mixed into it. Without one
+        // the prompt plays on its own
+        std::vector<int16_t>* output = &mixed_pcm_;
+        if (downlink) {
+            if (!DecodeDownlink(codec, packet, output)) {
+                NotifyAudioLoop();
+                return;
+            }
+            audio_mixer_.Mix(source, *output);
+        } else {
+            audio_mixer_.Drain(mixed_pcm_);
         }
-        // Resample if the sample rate is different
-        if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-            int target_size = output_resampler_.GetOutputSamples(pcm.size());
-            std::vector<int16_t> resampled(target_size);
-            output_resampler_.Process(pcm.data(), pcm.size(), resampled.data());
-            pcm = std::move(resampled);
+        if (output->empty() || generation != decode_generation_) {
+            NotifyAudioLoop();
+            return;
         }
-        codec->OutputData(pcm);
+        {
+            LatencyScope scope(kLatencyStageOutput);
 #ifdef CONFIG_USE_SERVER_AEC
-        std::lock_guard<std::mutex> lock(timestamp_mutex_);
-        timestamp_queue_.push_back(packet.timestamp);
+            playout_clock_.OnOutputFrame(packet.timestamp, output->size() / codec->output_channels(),
+                codec->output_sample_rate());
+#endif
+            if (audio_debugger_) {
+                audio_debugger_->Feed(kAudioDebugStreamPlayback, output->data(), output->size() / codec->output_channels(),
+                    codec->output_sample_rate(), codec->output_channels());
+            }
+            codec->OutputData(*output);
+#ifdef CONFIG_USE_SERVER_AEC
+            playout_clock_.OnOutputWritten();
+#endif
+        }
+#if CONFIG_USE_DEADLINE_MONITOR
+        DeadlineMonitor::GetInstance().OnFrame(kDeadlineStageOutput,
+            output->size() / codec->output_channels() * 1000000LL / codec->output_sample_rate());
 #endif
+        // What the user perceives as the reply time, prompts played before the reply count too
+        int64_t speech_end_us = speech_end_us_.exchange(0);
+        if (speech_end_us != 0) {
+            int64_t response_us = esp_timer_get_time() - speech_end_us;
+            LatencyTracer::GetInstance().Record(kLatencyStageResponse, response_us);
+            ESP_LOGI(TAG, "Response after %lld ms", response_us / 1000);
+        }
         last_output_time_ = std::chrono::steady_clock::now();
-    })) {
-        busy_decoding_audio_ = false;
+        NotifyAudioLoop();
+    }, kBackgroundTaskPriorityHigh);
+    return true;
+}
+
+// Decode task. Decodes a downlink packet at the codec's format, `output` is left pointing at it
+bool Application::DecodeDownlink(AudioCodec* codec, AudioStreamPacket& packet, std::vector<int16_t>*& output) {
+    // Synchronize the sample rate and frame duration, the decoder is only touched by this task
+    SetDecodeSampleRate(packet.sample_rate, packet.frame_duration);
+
+    // A lost frame is recovered from the next packet's FEC data if the jitter buffer had it,
+    // otherwise its empty payload makes the decoder run PLC
+    auto& pcm = decode_pcm_;
+    bool decoded;
+    {
+        LatencyScope scope(kLatencyStageDecode);
+        if (packet.fec) {
+            decoded = downlink_->decoder->DecodeFec(packet.payload.data(), packet.payload.size(), pcm);
+        } else {
+            decoded = downlink_->decoder->Decode(packet.payload.data(), packet.payload.size(), pcm);
+        }
+    }
+    if (!decoded) {
+        return false;
+    }
+    // Resample if the sample rate is different, each channel of a stereo stream on its own
+    output = &pcm;
+    int channels = downlink_->decoder->channels();
+    auto& output_resamplers = downlink_->resamplers;
+    if (downlink_->decoder->sample_rate() != codec->output_sample_rate()) {
+        LatencyScope scope(kLatencyStageResample);
+        size_t frames = pcm.size() / channels;
+        size_t output_frames = 0;
+        resampled_pcm_.resize(output_resamplers[0].GetOutputSamples(frames) * channels);
+        for (int i = 0; i < channels; i++) {
+            output_frames = output_resamplers[i].Process(pcm.data() + i, frames, resampled_pcm_.data() + i,
+                channels, channels);
+        }
+        resampled_pcm_.resize(output_frames * channels);
+        output = &resampled_pcm_;
+    }
+    // A mono stream on a stereo codec, the decoder stays mono and the frame is widened in place
+    if (channels == 1 && codec->output_channels() == 2) {
+        size_t frames = output->size();
+        output->resize(frames * 2);
+        UpmixMonoToStereo(output->data(), output->data(), frames);
+    }
+    return true;
+}
+
+// Decode task. Queues a prompt frame in the mixer at the codec's format
+void Application::DecodePrompt(AudioCodec* codec, const uint8_t* frame, size_t size) {
+    if (prompt_decoder_ == nullptr) {
+        prompt_decoder_ = std::make_unique<OpusStreamDecoder>(PROMPT_SAMPLE_RATE, 1, PROMPT_FRAME_DURATION_MS, 0,
+            kBootSlotPromptDecoder);
+    }
+    bool decoded;
+    {
+        LatencyScope scope(kLatencyStageDecode);
+        decoded = prompt_decoder_->Decode(frame, size, prompt_pcm_);
+    }
+    if (!decoded) {
+        return;
+    }
+    auto* pcm = &prompt_pcm_;
+    int sample_rate = codec->output_sample_rate();
+    if (sample_rate != PROMPT_SAMPLE_RATE) {
+        if (prompt_resampler_.output_sample_rate() != sample_rate) {
+            prompt_resampler_.Configure(PROMPT_SAMPLE_RATE, sample_rate);
+        }
+        prompt_resampled_.resize(prompt_resampler_.GetOutputSamples(prompt_pcm_.size()));
+        prompt_resampled_.resize(prompt_resampler_.Process(prompt_pcm_.data(), prompt_pcm_.size(), prompt_resampled_.data()));
+        pcm = &prompt_resampled_;
     }
+    if (codec->output_channels() == 2) {
+        size_t frames = pcm->size();
+        pcm->resize(frames * 2);
+        UpmixMonoToStereo(pcm->data(), pcm->data(), frames);
+    }
+    audio_mixer_.Configure(sample_rate, codec->output_channels());
+    audio_mixer_.Queue(kAudioSourcePrompt, pcm->data(), pcm->size());
 }
 
-void Application::OnAudioInput() {
+bool Application::OnAudioInput() {
+#if CONFIG_USE_AUDIO_TESTING
     if (device_state_ == kDeviceStateAudioTesting) {
-        if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
+        if (audio_testing_queue_.Size() >= GetMaxQueuedPackets(AUDIO_TESTING_MAX_DURATION_MS)) {
             ExitAudioTestingMode();
-            return;
+            return true;
         }
         std::vector<int16_t> data;
-        int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
+        int frame_duration = uplink_frame_duration_;
+        int samples = frame_duration * 16000 / 1000;
         if (ReadAudio(data, 16000, samples)) {
-            background_task_->Schedule([this, data = std::move(data)]() mutable {
-                opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
+            audio_encode_task_->Schedule([this, frame_duration, data = std::move(data)]() mutable {
+                opus_encoder_->Encode(std::move(data), [this, frame_duration](AudioPayload&& opus) {
                     AudioStreamPacket packet;
                     packet.payload = std::move(opus);
-                    packet.frame_duration = OPUS_FRAME_DURATION_MS;
+                    packet.frame_duration = frame_duration;
                     packet.sample_rate = 16000;
-                    std::lock_guard<std::mutex> lock(mutex_);
-                    audio_testing_queue_.push_back(std::move(packet));
+                    audio_testing_queue_.Push(std::move(packet));
                 });
             });
-            return;
+            return true;
         }
     }
+#endif
 
-    if (wake_word_->IsDetectionRunning()) {
-        std::vector<int16_t> data;
+    bool feed_wake_word = wake_word_->IsDetectionRunning();
+#if CONFIG_USE_CODEC_POWER_GATING
+    // Turns the ADC back on before the read below, and off once nothing has read for a while
+    bool input_needed = feed_wake_word || audio_processor_->IsRunning();
+#if CONFIG_USE_AUDIO_RECORDER
+    input_needed = input_needed || audio_recorder_->IsRecording();
+#endif
+    codec_power_->OnInputDemand(input_needed);
+#endif
+#if CONFIG_USE_SHARED_AFE
+    // Both feed the same AFE instance, the processor path below also keeps the playout clock
+    feed_wake_word = feed_wake_word && !audio_processor_->IsRunning();
+#endif
+#if CONFIG_USE_WAKE_WORD_BENCHMARK
+    // The benchmark feeds the detector itself, live audio would mix into the corpus
+    feed_wake_word = feed_wake_word && wake_word_benchmark_ == nullptr;
+#endif
+#if CONFIG_USE_POWER_GOVERNOR && !CONFIG_USE_WAKE_WORD_GATE
+    // The gate holds its own lock, only while there is voice to detect in
+    PowerGovernor::GetInstance().SetDemand(kPowerDemandWakeWord, feed_wake_word);
+#endif
+    if (feed_wake_word) {
         int samples = wake_word_->GetFeedSize();
         if (samples > 0) {
-            if (ReadAudio(data, 16000, samples)) {
-                wake_word_->Feed(data);
-                return;
+            if (ReadAudio(audio_input_data_, 16000, samples)) {
+                wake_word_->Feed(audio_input_data_);
+                return true;
             }
         }
     }
 
     if (audio_processor_->IsRunning()) {
-        std::vector<int16_t> data;
+#if CONFIG_USE_AUDIO_CAPTURE_RING
+        uint64_t push_to_talk_position = push_to_talk_position_.exchange(0);
+        if (push_to_talk_position != 0) {
+            audio_capture_->Rewind(capture_reader_, push_to_talk_position);
+        }
+#endif
         int samples = audio_processor_->GetFeedSize();
         if (samples > 0) {
-            if (ReadAudio(data, 16000, samples)) {
-                audio_processor_->Feed(data);
-                return;
+            if (ReadAudio(audio_input_data_, 16000, samples)) {
+#ifdef CONFIG_USE_SERVER_AEC
+                auto channels = Board::GetInstance().GetAudioCodec()->input_channels();
+                playout_clock_.OnInputCaptured(audio_input_data_.size() / channels, 16000);
+#endif
+                audio_processor_->Feed(audio_input_data_.data(), audio_input_data_.size());
+                return true;
             }
         }
     }
+#if CONFIG_USE_AUDIO_CAPTURE_RING
+    // Nobody needs the input right now, the next consumer starts at fresh audio
+    audio_capture_->Skip(capture_reader_);
+#endif
+    return false;
+}
+
+#if CONFIG_USE_DEVICE_ENDPOINTING
+// Runs on the audio processor task for every output chunk, the VAD callback only reports transitions
+void Application::CheckEndpoint() {
+    int64_t since = silence_since_us_;
+    if (!endpoint_armed_ || since == 0 || esp_timer_get_time() - since < endpoint_silence_ms_ * 1000LL) {
+        return;
+    }
+    endpoint_armed_ = false;
+    Schedule([this]() {
+        OnEndpoint();
+    });
+}
+
+void Application::OnEndpoint() {
+    if (device_state_ != kDeviceStateListening || listening_mode_ != kListeningModeAutoStop) {
+        return;
+    }
+    ESP_LOGI(TAG, "End of speech detected after %d ms of silence", endpoint_silence_ms_);
+    // What is still queued is trailing silence, the server gets the stop right away instead
+    audio_processor_->Stop();
+    uplink_pcm_queue_.Clear();
+    audio_send_queue_.Clear();
+    protocol_->SendStopListening(true);
+    endpointed_us_ = esp_timer_get_time();
+    voice_detected_ = false;
+    PublishVoiceDetected(false);
+}
+#endif
 
-    vTaskDelay(pdMS_TO_TICKS(OPUS_FRAME_DURATION_MS / 2));
+// Main loop, or the encode task with a direct uplink. False when the transport failed
+bool Application::SendUplinkPacket(const AudioStreamPacket& packet) {
+    // A slow send backs the queue up, skip what is too old instead of building up lag
+    int64_t queued_us = std::max(packet.queued_us, uplink_opened_us_.load());
+    if (esp_timer_get_time() - queued_us > UPLINK_MAX_AGE_MS * 1000) {
+        uplink_dropped_stale_++;
+        return true;
+    }
+    LatencyScope scope(kLatencyStageSend);
+    if (!protocol_->SendAudio(packet)) {
+        return false;
+    }
+    uplink_sent_++;
+    int64_t pressed_us = push_to_talk_us_.exchange(0);
+    if (pressed_us != 0) {
+        int64_t elapsed_us = esp_timer_get_time() - pressed_us;
+        LatencyTracer::GetInstance().Record(kLatencyStagePushToTalk, elapsed_us);
+        ESP_LOGI(TAG, "Push-to-talk: first frame sent %lld ms after the press", elapsed_us / 1000);
+    }
+    return true;
 }
 
+// Runs on the encode task, one call per chunk queued by the audio processor output
+void Application::EncodeUplinkPcm() {
+    if (!uplink_pcm_queue_.Pop(uplink_pcm_)) {
+        return;
+    }
+    int64_t encode_start_us = esp_timer_get_time();
+#if CONFIG_USE_PIPELINE_TRACE
+    PipelineTrace::GetInstance().Emit(kLatencyStageEncode, kPipelinePhaseBegin);
+#endif
+    // The first packet out of this call starts with the samples the encoder still holds
+    size_t buffered = opus_encoder_->buffered_samples();
+    uint64_t frame_position = uplink_pcm_.position >= buffered ? uplink_pcm_.position - buffered : 0;
+    size_t frame_samples = opus_encoder_->sample_rate() / 1000 * opus_encoder_->duration_ms();
+    int frames = 0;
+    auto send = [this](AudioStreamPacket&& packet) {
+        packet.queued_us = esp_timer_get_time();
+#if CONFIG_USE_DIRECT_UPLINK_SEND
+        if (direct_uplink_) {
+            // Without the main loop in between. What is still queued goes first, the main loop is on it
+            std::lock_guard<std::mutex> lock(uplink_send_mutex_);
+            if (audio_send_queue_.Empty()) {
+                if (!SendUplinkPacket(packet)) {
+                    // The main loop deals with the transport from here
+                    direct_uplink_ = false;
+                    xEventGroupSetBits(event_group_, SEND_AUDIO_EVENT);
+                }
+                return;
+            }
+        }
+#endif
+        if (!audio_send_queue_.Push(std::move(packet))) {
+            DEFERRED_LOGW(TAG, "Too many audio packets in queue, drop the newest packet");
+            uplink_dropped_full_++;
+            return;
+        }
+        xEventGroupSetBits(event_group_, SEND_AUDIO_EVENT);
+    };
+    opus_encoder_->Encode(uplink_pcm_.pcm.data(), uplink_pcm_.pcm.size(),
+            [this, encode_start_us, &frame_position, frame_samples, &frames, &send](AudioPayload&& opus) {
+        LatencyTracer::GetInstance().Record(kLatencyStageEncode, esp_timer_get_time() - encode_start_us);
+        frames++;
+        AudioStreamPacket packet;
+        packet.payload = std::move(opus);
+#ifdef CONFIG_USE_SERVER_AEC
+        packet.timestamp = playout_clock_.GetPlayoutTimestamp(frame_position);
+#endif
+        frame_position += frame_samples;
+#if CONFIG_USE_UPLINK_SILENCE_SUPPRESSION
+        if (!uplink_silence_gate_.Admit(packet, opus_encoder_->duration_ms())) {
+            return;
+        }
+        // The pre-roll goes out before the first frame of speech, its age counts from now
+        AudioStreamPacket preroll;
+        while (uplink_silence_gate_.PopPreroll(preroll)) {
+            send(std::move(preroll));
+        }
+#endif
+        send(std::move(packet));
+    });
+#if CONFIG_USE_PIPELINE_TRACE
+    PipelineTrace::GetInstance().Emit(kLatencyStageEncode, kPipelinePhaseEnd);
+#endif
+#if CONFIG_USE_OPUS_COMPLEXITY_GOVERNOR
+    int complexity = complexity_governor_.OnEncoded(esp_timer_get_time() - encode_start_us, frames,
+        opus_encoder_->duration_ms());
+    if (complexity >= 0) {
+        opus_encoder_->SetComplexity(complexity);
+    }
+#endif
+}
+
+// Read a frame into the caller-owned buffer. The intermediate buffer and the resampler state are
+// members that keep their capacity between calls, so the steady state does not allocate. Not reentrant.
 bool Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples) {
     auto codec = Board::GetInstance().GetAudioCodec();
     if (!codec->input_enabled()) {
         return false;
     }
 
-    if (codec->input_sample_rate() != sample_rate) {
-        data.resize(samples * codec->input_sample_rate() / sample_rate);
-        if (!codec->InputData(data)) {
-            return false;
-        }
-        if (codec->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
-        } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
-        }
-    } else {
+    // Native rate samples, straight from the capture ring or read into input_buffer_
+    const int16_t* input = nullptr;
+    int input_sample_rate = BoardAudioTraits::InputSampleRate(codec);
+    // Constant false on a board that captures at the processing rate, the resampling below compiles away
+    bool resample = false;
+    if constexpr (BoardAudioTraits::kInputMayResample) {
+        resample = input_sample_rate != sample_rate;
+    }
+    size_t input_samples = resample ? samples * input_sample_rate / sample_rate : samples;
+#if CONFIG_USE_AUDIO_CAPTURE_RING
+    if (!audio_capture_->Read(capture_reader_, input_samples, input)) {
+        return false;
+    }
+    // How long the newest frame waited in the ring
+    LatencyTracer::GetInstance().Record(kLatencyStageI2sRead,
+        esp_timer_get_time() - audio_capture_->GetTimestamp(capture_reader_.position - 1));
+#else
+    int16_t* target;
+    if (!resample) {
+        // Read straight into the caller's buffer, there is nothing to convert
         data.resize(samples);
-        if (!codec->InputData(data)) {
+        target = data.data();
+    } else {
+        input_buffer_.resize(input_samples);
+        target = input_buffer_.data();
+    }
+    {
+        LatencyScope scope(kLatencyStageI2sRead);
+        if (!codec->InputData(target, input_samples)) {
             return false;
         }
     }
+    input = target;
+#endif
+
+    if (resample) {
+        // Resample every channel straight from and into the interleaved buffers
+        size_t channels = input_resamplers_.size();
+        size_t frames = input_samples / channels;
+        data.resize(input_resamplers_[0].GetOutputSamples(frames) * channels);
+        size_t output_frames = input_resamplers_[0].Process(input, frames, data.data(), channels, channels);
+        for (size_t c = 1; c < channels; c++) {
+            size_t produced = input_resamplers_[c].Process(input + c, frames, data.data() + c, channels, channels);
+            for (size_t i = produced; i < output_frames; i++) {
+                data[i * channels + c] = 0;
+            }
+        }
+        data.resize(output_frames * channels);
+    } else if (input != data.data()) {
+        data.assign(input, input + samples);
+    }
+#if CONFIG_USE_CONVERSATION_SOAK
+    if (sample_rate == SOAK_SAMPLE_RATE) {
+        ConversationSoak::GetInstance().FillInput(data);
+    }
+#endif
     
     // 音频调试：发送原始音频数据
     if (audio_debugger_) {
-        audio_debugger_->Feed(data);
+        int channels = codec->input_channels();
+        audio_debugger_->Feed(kAudioDebugStreamInput, data.data(), data.size() / channels, sample_rate, channels);
     }
+#if CONFIG_USE_DEADLINE_MONITOR
+    DeadlineMonitor::GetInstance().OnFrame(kDeadlineStageInput, samples * 1000000LL / sample_rate);
+#endif
     
     return true;
 }
@@ -955,11 +2098,55 @@ bool Application::ReadAudio(std::vector<int16_t>& data, int sample_rate, int sam
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
+    tts_streaming_ = false;
+#if CONFIG_USE_MEDIA_PLAYBACK
+    // The server ends its media stream on an abort as well
+    if (media_active_.exchange(false)) {
+        media_buffer_.Stop();
+        media_interrupted_ = false;
+    }
+#endif
+    Board::GetInstance().GetAudioCodec()->SetOutputMute(true);
     protocol_->SendAbortSpeaking(reason);
 }
 
+// The user started talking over the reply: silence it now, then tell the server from the main loop
+void Application::BargeIn() {
+    if (aborted_) {
+        return;
+    }
+    ESP_LOGI(TAG, "Barge-in");
+    aborted_ = true;
+    tts_streaming_ = false;
+    decode_generation_++;
+    jitter_buffer_.Reset();
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+    response_cache_.Reset();
+#endif
+    ClearPrompts();
+    auto codec = Board::GetInstance().GetAudioCodec();
+    codec->SetOutputMute(true);
+    codec->FlushOutput();
+    playout_clock_.ResetOutput();
+    NotifyAudioLoop();
+
+    Schedule([this]() {
+        if (device_state_ != kDeviceStateSpeaking) {
+            return;
+        }
+        protocol_->SendAbortSpeaking(kAbortReasonNone);
+        // The audio processor keeps running in realtime mode, so the microphone stream goes on
+        SetDeviceState(kDeviceStateListening);
+    });
+}
+
 void Application::SetListeningMode(ListeningMode mode) {
     listening_mode_ = mode;
+    if (mode == kListeningModeRealtime) {
+        jitter_buffer_.SetDelayRange(JITTER_BUFFER_REALTIME_MIN_DELAY_MS, JITTER_BUFFER_REALTIME_MAX_DELAY_MS);
+    } else {
+        jitter_buffer_.SetDelayRange(JITTER_BUFFER_MIN_DELAY_MS, JITTER_BUFFER_MAX_DELAY_MS);
+    }
     SetDeviceState(kDeviceStateListening);
 }
 
@@ -971,53 +2158,111 @@ void Application::SetDeviceState(DeviceState state) {
     clock_ticks_ = 0;
     auto previous_state = device_state_;
     device_state_ = state;
+    // The first tick of the new state comes after a second, then the state's schedule follows
+    ScheduleClockTimer(true);
+#if CONFIG_USE_DEVICE_ENDPOINTING
+    // Every state change starts a new turn, the next speech arms the endpoint again
+    endpoint_armed_ = false;
+    silence_since_us_ = 0;
+    endpointed_us_ = 0;
+#endif
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
     // The state is changed, wait for all background tasks to finish
-    background_task_->WaitForCompletion();
+    WaitForAudioTasks();
+
+    // The LEDs and the display refresh react on the event bus task, listening starts without waiting for them
+    Event event;
+    event.type = kEventDeviceStateChanged;
+    event.state = state;
+    event.previous_state = previous_state;
+    event.time_us = esp_timer_get_time();
+    EventBus::GetInstance().Publish(event);
+#if CONFIG_USE_POWER_GOVERNOR
+    PowerGovernor::GetInstance().SetDemand(kPowerDemandConversation, state == kDeviceStateConnecting ||
+        state == kDeviceStateListening || state == kDeviceStateSpeaking || state == kDeviceStateAudioTesting);
+#endif
 
     auto& board = Board::GetInstance();
     auto display = board.GetDisplay();
-    auto led = board.GetLed();
-    led->OnStateChanged();
     switch (state) {
         case kDeviceStateUnknown:
         case kDeviceStateIdle:
-            display->SetStatus(Lang::Strings::STANDBY);
-            display->SetEmotion("neutral");
+            display->QueueStatus(Lang::Strings::STANDBY);
+            display->QueueEmotion("neutral");
             audio_processor_->Stop();
+            if (previous_state == kDeviceStateConnecting) {
+                // The channel did not open, drop what was captured for it
+                audio_send_queue_.Clear();
+            }
+            push_to_talk_us_ = 0;
+#if CONFIG_USE_AUDIO_CAPTURE_RING
+            push_to_talk_position_ = 0;
+#endif
             wake_word_->StartDetection();
+#if CONFIG_USE_MEDIA_PLAYBACK
+            // The turn over the media ended without a reply
+            if (media_interrupted_) {
+                Schedule([this]() {
+                    ResumeInterruptedMedia();
+                });
+            }
+#endif
             break;
         case kDeviceStateConnecting:
-            display->SetStatus(Lang::Strings::CONNECTING);
-            display->SetEmotion("neutral");
-            display->SetChatMessage("system", "");
-            timestamp_queue_.clear();
+            display->QueueStatus(Lang::Strings::CONNECTING);
+            display->QueueEmotion("neutral");
+            display->QueueChatMessage("system", "");
+            playout_clock_.ResetOutput();
+            // Capture while the channel opens, the main loop is busy with the handshake,
+            // so the packets wait in the send queue and go out right after the start listening command
+            if (previous_state == kDeviceStateIdle && !audio_processor_->IsRunning()) {
+                audio_send_queue_.Clear();
+                uplink_pcm_queue_.Clear();
+                opus_encoder_->ResetState();
+                playout_clock_.ResetInput();
+                audio_processor_->Start();
+            }
             break;
         case kDeviceStateListening:
-            display->SetStatus(Lang::Strings::LISTENING);
-            display->SetEmotion("neutral");
+            display->QueueStatus(Lang::Strings::LISTENING);
+            display->QueueEmotion("neutral");
             // Update the IoT states before sending the start listening command
 #if CONFIG_IOT_PROTOCOL_XIAOZHI
             UpdateIotStates();
 #endif
 
-            // Make sure the audio processor is running
-            if (!audio_processor_->IsRunning()) {
+            // Make sure the audio processor is running, it already is if it captured during connecting
+            if (!audio_processor_->IsRunning() || previous_state == kDeviceStateConnecting) {
                 // Send the start listening command
                 protocol_->SendStartListening(listening_mode_);
+            }
+            if (!audio_processor_->IsRunning()) {
                 if (previous_state == kDeviceStateSpeaking) {
-                    audio_decode_queue_.clear();
-                    audio_decode_cv_.notify_all();
+                    ClearPrompts();
+                    jitter_buffer_.Reset();
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+                    response_cache_.Reset();
+#endif
                     // FIXME: Wait for the speaker to empty the buffer
                     vTaskDelay(pdMS_TO_TICKS(120));
                 }
+                uplink_pcm_queue_.Clear();
                 opus_encoder_->ResetState();
+                playout_clock_.ResetInput();
+#if CONFIG_USE_UPLINK_SILENCE_SUPPRESSION
+                uplink_silence_gate_.Reset();
+#endif
                 audio_processor_->Start();
-                wake_word_->StopDetection();
             }
+#if CONFIG_USE_UPLINK_SILENCE_SUPPRESSION
+            // Without a VAD, as with device AEC, the gate would never hear the user start talking
+            uplink_silence_gate_.SetEnabled(listening_mode_ == kListeningModeRealtime &&
+                aec_mode_ != kAecOnDeviceSide && protocol_->uplink_silence());
+#endif
+            wake_word_->StopDetection();
             break;
         case kDeviceStateSpeaking:
-            display->SetStatus(Lang::Strings::SPEAKING);
+            display->QueueStatus(Lang::Strings::SPEAKING);
 
             if (listening_mode_ != kListeningModeRealtime) {
                 audio_processor_->Stop();
@@ -1028,36 +2273,309 @@ void Application::SetDeviceState(DeviceState state) {
                 wake_word_->StopDetection();
 #endif
             }
-            ResetDecoder();
+#if CONFIG_USE_SHARED_AFE
+            else {
+                // The uplink keeps running, detection on the same output costs only WakeNet
+                wake_word_->StartDetection();
+            }
+#endif
+            bool streaming = tts_streaming_;
+#if CONFIG_USE_MEDIA_PLAYBACK
+            streaming = streaming || media_active_;
+#endif
+            if (streaming) {
+                // The utterance has been buffering since "tts start", only open the output
+                ClearPrompts();
+                auto codec = board.GetAudioCodec();
+                codec->SetOutputMute(false);
+                codec->EnableOutput(true);
+            } else {
+                ResetDecoder();
+            }
             break;
         default:
             // Do nothing
             break;
     }
+    // Input consumers may have been started, let the audio loop pick them up right away
+    NotifyAudioLoop();
+}
+
+// The LEDs poll the state and the voice flag when told, the display only follows the state
+void Application::SubscribeEvents() {
+    auto& bus = EventBus::GetInstance();
+    bus.Subscribe("led", EVENT_MASK(kEventDeviceStateChanged) | EVENT_MASK(kEventVoiceDetected), [](const Event& event) {
+        Board::GetInstance().GetLed()->OnStateChanged();
+    });
+    bus.Subscribe("display", EVENT_MASK(kEventDeviceStateChanged), [](const Event& event) {
+        auto display = Board::GetInstance().GetDisplay();
+        display->SetRefreshHint(kRefreshHintActive, event.state != kDeviceStateIdle && event.state != kDeviceStateUnknown);
+    });
+}
+
+void Application::PublishVoiceDetected(bool speaking) {
+    Event event;
+    event.type = kEventVoiceDetected;
+    event.state = device_state_;
+    event.previous_state = device_state_;
+    event.flag = speaking;
+    event.time_us = esp_timer_get_time();
+    EventBus::GetInstance().Publish(event);
+}
+
+// Drops the queued prompts and what the mixer already holds of them, from any task
+void Application::ClearPrompts() {
+    prompt_player_.Clear();
+    audio_mixer_.Clear();
 }
 
 void Application::ResetDecoder() {
     std::lock_guard<std::mutex> lock(mutex_);
-    opus_decoder_->ResetState();
-    audio_decode_queue_.clear();
-    audio_decode_cv_.notify_all();
+    downlink_decoders_->Reset();
+    ClearPrompts();
+    jitter_buffer_.Reset();
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+    response_cache_.Reset();
+#endif
     last_output_time_ = std::chrono::steady_clock::now();
     auto codec = Board::GetInstance().GetAudioCodec();
+    codec->SetOutputMute(false);
     codec->EnableOutput(true);
+    NotifyAudioLoop();
 }
 
-void Application::SetDecodeSampleRate(int sample_rate, int frame_duration) {
-    if (opus_decoder_->sample_rate() == sample_rate && opus_decoder_->duration_ms() == frame_duration) {
+// The decoder is owned by the decode task, so it is set up there and never swapped under a frame
+void Application::PrepareDecoder(bool reset) {
+    int sample_rate = protocol_->server_sample_rate();
+    int frame_duration = protocol_->server_frame_duration();
+    int channels = protocol_->server_channels();
+    audio_decode_task_->Schedule([this, sample_rate, frame_duration, channels, reset]() {
+        auto codec = Board::GetInstance().GetAudioCodec();
+#if CONFIG_USE_OUTPUT_RATE_FOLLOWS_SERVER
+        // A reply is about to start and the last one has played out, the codec can switch now
+        if (reset) {
+            codec->SetOutputSampleRate(sample_rate);
+        }
+#endif
+        decode_channels_ = channels;
+        SetDecodeSampleRate(sample_rate, frame_duration);
+        if (!reset) {
+            return;
+        }
+        downlink_decoders_->Reset();
+        downlink_decoders_->ResetResamplers();
+        // Size the frame buffers now so the first packet does not allocate, an upmix widens them in place
+        int frames = sample_rate / 1000 * frame_duration;
+        decode_pcm_.reserve(frames * codec->output_channels());
+        if (!downlink_->resamplers.empty()) {
+            resampled_pcm_.reserve(downlink_->resamplers[0].GetOutputSamples(frames) * codec->output_channels());
+        }
+    }, kBackgroundTaskPriorityHigh);
+}
+
+#if CONFIG_USE_OUTPUT_PREWARM
+// Network thread. A reply follows the stt result and the emotion while the server is still generating it,
+// so the decoder, the amplifier and the I2S DMA get ready now instead of under the first packet
+void Application::PrewarmOutput() {
+    if (device_state_ != kDeviceStateListening || tts_streaming_) {
         return;
     }
+    // stt and llm come close together, one prewarm serves both
+    int64_t now_us = esp_timer_get_time();
+    int64_t last_us = output_prewarm_us_;
+    if (last_us != 0 && now_us - last_us < OUTPUT_PREWARM_VALID_MS * 1000) {
+        return;
+    }
+    output_prewarm_us_ = now_us;
+    PrepareDecoder(true);
+#if CONFIG_USE_CODEC_POWER_GATING
+    codec_power_->Prewarm();
+#endif
+    audio_decode_task_->Schedule([this]() {
+        auto codec = Board::GetInstance().GetAudioCodec();
+#if !CONFIG_USE_CODEC_POWER_GATING
+        // Only the audio loop of an idle device turns it off, not while listening
+        if (!codec->output_enabled()) {
+            codec->EnableOutput(true);
+        }
+#endif
+        // Queued as the lowest priority source so it never ducks the reply. Speaking clears what is left of it
+        size_t samples = codec->output_sample_rate() / 1000 * CONFIG_OUTPUT_PREWARM_SILENCE_MS * codec->output_channels();
+        if (samples > 0) {
+            mixed_pcm_.assign(samples, 0);
+            audio_mixer_.Configure(codec->output_sample_rate(), codec->output_channels());
+            audio_mixer_.Queue(kAudioSourceMedia, mixed_pcm_.data(), mixed_pcm_.size());
+            NotifyAudioLoop();
+        }
+    }, kBackgroundTaskPriorityHigh);
+    ESP_LOGI(TAG, "Output prewarmed for the reply");
+}
+#endif
 
-    opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+void Application::WaitForAudioTasks() {
+    background_task_->WaitForCompletion();
+    audio_encode_task_->WaitForCompletion();
+    audio_decode_task_->WaitForCompletion();
+}
 
+void Application::SetDecodeSampleRate(int sample_rate, int frame_duration) {
+    // The decoders take either layout, Opus downmixes or duplicates whatever the packets carry.
+    // A format seen recently keeps its state, switching back to it does not start from scratch
     auto codec = Board::GetInstance().GetAudioCodec();
-    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
+    downlink_ = &downlink_decoders_->Get(sample_rate, frame_duration, decode_channels_, codec->output_sample_rate());
+}
+
+// UDP over MQTT may lose packets: add in-band FEC on Wi-Fi, and save bandwidth with DTX and a
+// lower bitrate on cellular where data is billed. Websocket runs over TCP and needs neither.
+// Realtime barge-in wants short frames for latency, cellular links want long ones to spend
+// less time transmitting and less header overhead. Settings "audio"/"frame_duration" overrides.
+int Application::GetPreferredFrameDuration() {
+    Settings settings("audio", false);
+    int duration = settings.GetInt("frame_duration", 0);
+    if (duration == 20 || duration == 40 || duration == 60 || duration == 120) {
+        return duration;
+    }
+    if (aec_mode_ != kAecOff) {
+        return OPUS_REALTIME_FRAME_DURATION_MS;
+    }
+    if (Board::GetInstance().GetBoardType() == "ml307") {
+        return OPUS_CELLULAR_FRAME_DURATION_MS;
+    }
+    return OPUS_FRAME_DURATION_MS;
+}
+
+void Application::SetUplinkFrameDuration(int frame_duration) {
+    if (frame_duration == uplink_frame_duration_) {
+        return;
+    }
+    ESP_LOGI(TAG, "Uplink frame duration: %d ms", frame_duration);
+    uplink_frame_duration_ = frame_duration;
+    opus_encoder_->SetFrameDuration(frame_duration);
+}
+
+void Application::ConfigureUplinkEncoder(bool udp_transport) {
+    OpusEncoderProfile profile;
+    if (aec_mode_ != kAecOff) {
+        profile.complexity = 0;
+    } else {
+#if CONFIG_USE_AUDIO_PROCESSOR
+        profile.complexity = 5;
+#else
+        profile.complexity = 0;
+#endif
+        // Saved from a measurement on this chip by self.audio.run_codec_benchmark
+        Settings settings("audio", false);
+        profile.complexity = std::clamp((int)settings.GetInt("opus_complexity", profile.complexity), 0, 10);
+    }
+
+    if (udp_transport) {
+        if (Board::GetInstance().GetBoardType() == "ml307") {
+            profile.bitrate = OPUS_CELLULAR_BITRATE;
+            profile.dtx = true;
+        } else {
+            profile.fec = true;
+            profile.packet_loss_percent = OPUS_WIFI_EXPECTED_LOSS_PERCENT;
+        }
+    }
+    uplink_profile_ = profile;
+    opus_encoder_->Configure(profile);
+}
+
+void Application::UpdateLinkQuality() {
+    if (!protocol_ || !protocol_->IsAudioChannelOpened()) {
+        return;
+    }
+    LinkQuality quality;
+    quality.signal = NetworkMonitor::GetInstance().GetSignalQuality();
+    quality.queue_percent = audio_send_queue_.Size() * 100 / GetMaxQueuedPackets(MAX_AUDIO_QUEUE_DURATION_MS);
+    auto transport = protocol_->GetTransportStats();
+    quality.loss_percent = transport.loss_percent;
+    quality.send_latency_ms = transport.send_latency_ms;
+    uint32_t dropped_stale = uplink_dropped_stale_;
+    if (dropped_stale != reported_stale_drops_) {
+        ESP_LOGW(TAG, "Dropped %lu stale uplink packets, max queue depth %lu",
+            dropped_stale - reported_stale_drops_, uplink_max_depth_.load());
+        quality.uplink_dropped = dropped_stale - reported_stale_drops_;
+        reported_stale_drops_ = dropped_stale;
+    }
+    if (adaptive_bitrate_.Update(quality)) {
+        ApplyUplinkLevel();
+        protocol_->SendLinkQuality(adaptive_bitrate_.level(), adaptive_bitrate_.current().downlink_bitrate);
+    }
+}
+
+UplinkQueueStats Application::GetUplinkQueueStats() {
+    UplinkQueueStats stats;
+    stats.depth = audio_send_queue_.Size();
+    stats.max_depth = uplink_max_depth_;
+    stats.sent = uplink_sent_;
+    stats.dropped_stale = uplink_dropped_stale_;
+    stats.dropped_full = uplink_dropped_full_;
+    return stats;
+}
+
+void Application::OnNetworkChanged() {
+    NetworkMonitor::GetInstance().Refresh();
+    if (protocol_ == nullptr) {
+        return;
+    }
+    // What was learned about the old link says nothing about the new one
+    adaptive_bitrate_.Reset();
+    ApplyUplinkLevel();
+    // The server may well be reachable over the new network, nothing waits for its backoff
+    ReconnectBackoff::OnNetworkUp();
+    protocol_->OnNetworkChanged();
+    // The fastest endpoint depends on the network
+    ProbeEndpoints();
+#if CONFIG_USE_WAKE_ARBITRATION
+    // A dual network board may have moved to Wi-Fi only now
+    if (Board::GetInstance().GetBoardType() == "wifi") {
+        WakeArbiter::GetInstance().Start();
+    }
+#endif
+}
+
+// The probe connects to each candidate endpoint in turn, it runs on a worker and only changes
+// which endpoint the next connection uses
+void Application::ProbeEndpoints() {
+    if (Board::GetInstance().GetBoardType() == "ml307") {
+        // The modem has its own TCP stack, the lwIP sockets of the probe do not go through it
+        return;
+    }
+    background_task_->Schedule([this]() {
+        if (protocol_ != nullptr) {
+            protocol_->ProbeEndpoints();
+        }
+    });
+}
+
+void Application::ApplyUplinkLevel() {
+    auto& level = adaptive_bitrate_.current();
+    int bitrate = uplink_profile_.bitrate;
+    for (int cap : { level.bitrate, transport_bitrate_ }) {
+        if (cap > 0 && (bitrate == 0 || cap < bitrate)) {
+            bitrate = cap;
+        }
+    }
+    if (bitrate != opus_encoder_->profile().bitrate) {
+        ESP_LOGI(TAG, "Uplink bitrate: %d", bitrate);
+        opus_encoder_->SetBitrate(bitrate);
+    }
+#if CONFIG_USE_AUDIO_PROCESSOR
+    // Chips without the audio processor have no cycles to spare for a higher complexity, nor does device AEC
+    int complexity = std::max(uplink_profile_.complexity, level.min_complexity);
+#if CONFIG_USE_OPUS_COMPLEXITY_GOVERNOR
+    // The level's complexity is the floor the governor falls back to when the CPU is busy
+    complexity_governor_.SetFloor(aec_mode_ == kAecOff ? complexity : -1);
+    complexity = complexity_governor_.complexity();
+#endif
+    if (aec_mode_ == kAecOff) {
+        opus_encoder_->SetComplexity(complexity);
+    }
+#endif
+    // Realtime mode keeps its short frames, barge-in latency matters more than the header overhead
+    if (protocol_ && listening_mode_ != kListeningModeRealtime) {
+        SetUplinkFrameDuration(std::max(protocol_->client_frame_duration(), level.min_frame_duration));
     }
 }
 
@@ -1073,7 +2591,81 @@ void Application::UpdateIotStates() {
 
 void Application::Reboot() {
     ESP_LOGI(TAG, "Rebooting...");
-    esp_restart();
+    // The shutdown handlers commit the settings, the version check task may have a PSRAM stack
+    TaskTopology::RunOnInternalStack([]() {
+        esp_restart();
+    });
+}
+
+// Main loop
+void Application::HandleWakeWord(const std::string& wake_word) {
+    if (!protocol_) {
+        return;
+    }
+
+    if (device_state_ == kDeviceStateIdle) {
+#if CONFIG_USE_DIRECT_UPLINK_SEND
+        // The pre-roll goes out from here, ahead of everything the encoder is about to produce
+        direct_uplink_ = false;
+#endif
+        wake_word_->EncodeWakeWordData();
+        std::string speaker;
+#if CONFIG_USE_SPEAKER_ID
+        // Decided before the audio channel is opened, an unknown voice costs no server session
+        if (!IdentifySpeaker(speaker)) {
+            wake_word_->StartDetection();
+            return;
+        }
+#endif
+
+        if (!ConnectAudioChannel()) {
+            wake_word_->StartDetection();
+            return;
+        }
+
+        ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
+#if CONFIG_USE_AFE_WAKE_WORD
+        if (protocol_->wake_word_streaming()) {
+            // The server verifies the pre-roll while it keeps receiving: announce the wake word and
+            // start listening first, the pre-roll goes out next and the audio captured while
+            // connecting follows it from the send queue without a gap
+            protocol_->SendWakeWordDetected(wake_word, speaker);
+            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            AudioStreamPacket packet;
+            while (wake_word_->GetWakeWordOpus(packet.payload)) {
+                protocol_->SendAudio(packet);
+            }
+            return;
+        }
+        AudioStreamPacket packet;
+        // Encode and send the wake word data to the server
+        while (wake_word_->GetWakeWordOpus(packet.payload)) {
+            protocol_->SendAudio(packet);
+        }
+        // Set the chat state to wake word detected
+        protocol_->SendWakeWordDetected(wake_word, speaker);
+#else
+        // Play the pop up sound to indicate the wake word is detected
+        // And wait 60ms to make sure the queue has been processed by audio task
+        ResetDecoder();
+        PlaySound(Lang::Sounds::P3_POPUP);
+        vTaskDelay(pdMS_TO_TICKS(60));
+#endif
+        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+    } else if (device_state_ == kDeviceStateSpeaking) {
+#if CONFIG_USE_MEDIA_PLAYBACK
+        // The media is not a reply to abort, it steps back for the turn and resumes after it
+        if (media_active_ && !tts_streaming_) {
+            InterruptMedia();
+            protocol_->SendWakeWordDetected(wake_word);
+            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            return;
+        }
+#endif
+        AbortSpeaking(kAbortReasonWakeWordDetected);
+    } else if (device_state_ == kDeviceStateActivating) {
+        SetDeviceState(kDeviceStateIdle);
+    }
 }
 
 void Application::WakeWordInvoke(const std::string& wake_word) {
@@ -1106,18 +2698,46 @@ bool Application::CanEnterSleepMode() {
         return false;
     }
 
+#if CONFIG_USE_AUDIO_RECORDER
+    // Power saving would turn the microphone off
+    if (audio_recorder_ && audio_recorder_->IsRecording()) {
+        return false;
+    }
+#endif
+
     // Now it is safe to enter sleep mode
     return true;
 }
 
-void Application::SendMcpMessage(const std::string& payload) {
-    Schedule([this, payload]() {
+void Application::SendMcpMessage(std::string payload) {
+    Schedule([this, payload = std::move(payload)]() {
         if (protocol_) {
             protocol_->SendMcpMessage(payload);
         }
     });
 }
 
+bool Application::CanSendVideo() {
+    return protocol_ && protocol_->video_streaming() && protocol_->IsAudioChannelOpened();
+}
+
+bool Application::SendVideoFrame(std::vector<uint8_t>&& jpeg) {
+    if (!CanSendVideo() || audio_send_queue_.Size() > VIDEO_MAX_UPLINK_DEPTH) {
+        return false;
+    }
+    if (video_frame_pending_.exchange(true)) {
+        return false;
+    }
+    auto timestamp = (uint32_t)(esp_timer_get_time() / 1000);
+    Schedule([this, jpeg = std::move(jpeg), timestamp]() {
+        if (protocol_) {
+            protocol_->SendVideoFrame(jpeg, timestamp);
+        }
+        video_frame_pending_ = false;
+    });
+    return true;
+}
+
 void Application::SetAecMode(AecMode mode) {
     aec_mode_ = mode;
     Schedule([this]() {
@@ -1126,21 +2746,208 @@ void Application::SetAecMode(AecMode mode) {
         switch (aec_mode_) {
         case kAecOff:
             audio_processor_->EnableDeviceAec(false);
-            display->ShowNotification(Lang::Strings::RTC_MODE_OFF);
+            display->QueueNotification(Lang::Strings::RTC_MODE_OFF);
             break;
         case kAecOnServerSide:
             audio_processor_->EnableDeviceAec(false);
-            display->ShowNotification(Lang::Strings::RTC_MODE_ON);
+            display->QueueNotification(Lang::Strings::RTC_MODE_ON);
             break;
         case kAecOnDeviceSide:
             audio_processor_->EnableDeviceAec(true);
-            display->ShowNotification(Lang::Strings::RTC_MODE_ON);
+            display->QueueNotification(Lang::Strings::RTC_MODE_ON);
             break;
         }
 
-        // If the AEC mode is changed, close the audio channel
-        if (protocol_ && protocol_->IsAudioChannelOpened()) {
-            protocol_->CloseAudioChannel();
+        // If the AEC mode is changed, close the audio channel, the next hello proposes a new frame duration
+        if (protocol_) {
+            protocol_->SetClientFrameDuration(GetPreferredFrameDuration());
+            if (protocol_->IsAudioChannelOpened()) {
+                protocol_->CloseAudioChannel();
+            }
+        }
+    });
+}
+
+#if CONFIG_USE_COMMAND_WORDS
+void Application::HandleCommandWord(const CommandWord& command) {
+    auto& local = kLocalCommands[command.id];
+    ESP_LOGI(TAG, "Command word %s, confidence %.2f, handled %lld us after detection", command.phrase.c_str(),
+        command.confidence, esp_timer_get_time() - command.timestamp_us);
+
+    if (local.action == kLocalCommandStop) {
+        if (device_state_ == kDeviceStateSpeaking) {
+            AbortSpeaking(kAbortReasonNone);
+        }
+        return;
+    } else if (local.action == kLocalCommandTime) {
+        SpeakTime();
+        return;
+    }
+
+    auto arguments = local.arguments != nullptr ? cJSON_Parse(local.arguments().c_str()) : cJSON_CreateObject();
+    try {
+        McpServer::GetInstance().CallTool(local.tool, arguments);
+#if CONFIG_USE_OFFLINE_MODE
+        if (offline_) {
+            QueueOfflineAction(local.phrase, local.tool, arguments);
+        }
+#endif
+    } catch (const std::exception& e) {
+        ESP_LOGE(TAG, "Command word %s failed: %s", command.phrase.c_str(), e.what());
+    }
+    cJSON_Delete(arguments);
+}
+
+// The clock is only right once the server has set it, otherwise the command is refused
+void Application::SpeakTime() {
+    if (!has_server_time_) {
+        Alert(Lang::Strings::WARNING, Lang::Strings::SERVER_OFFLINE, "confused", Lang::Sounds::P3_EXCLAMATION);
+        return;
+    }
+    time_t now = time(NULL);
+    char time_str[8];
+    strftime(time_str, sizeof(time_str), "%H:%M", localtime(&now));
+    auto display = Board::GetInstance().GetDisplay();
+    display->QueueChatMessage("system", time_str);
+    ResetDecoder();
+    PlayDigits(std::string_view(time_str, 2));
+    PlayDigits(std::string_view(time_str + 3, 2));
+}
+#endif
+
+#if CONFIG_USE_OFFLINE_MODE
+// What the device did on its own, the server learns about it when the channel opens again
+void Application::QueueOfflineAction(const char* phrase, const char* tool, const cJSON* arguments) {
+    auto action = cJSON_CreateObject();
+    cJSON_AddStringToObject(action, "phrase", phrase);
+    cJSON_AddStringToObject(action, "tool", tool);
+    cJSON_AddItemToObject(action, "arguments", cJSON_Duplicate(arguments, true));
+    cJSON_AddNumberToObject(action, "time", has_server_time_ ? (double)time(NULL) : 0);
+    auto json = cJSON_PrintUnformatted(action);
+    if (offline_actions_.size() >= OFFLINE_MAX_QUEUED_ACTIONS) {
+        offline_actions_.erase(offline_actions_.begin());
+    }
+    offline_actions_.push_back(json);
+    cJSON_free(json);
+    cJSON_Delete(action);
+}
+#endif
+
+#if CONFIG_USE_SPEAKER_ID
+bool Application::IdentifySpeaker(std::string& speaker) {
+    std::vector<float> embedding;
+    bool valid = wake_word_->GetSpeakerEmbedding(embedding);
+    {
+        // Cleared when there is no sample, so an enrollment never takes the previous speaker
+        std::lock_guard<std::mutex> lock(speaker_mutex_);
+        speaker_embedding_ = embedding;
+    }
+    if (!valid) {
+        // Too little voice to tell, the wake word itself was still heard
+        return true;
+    }
+    float distance = 0;
+    speaker = speaker_profiles_.Match(embedding, CONFIG_SPEAKER_ID_MAX_DISTANCE / 100.0f, &distance);
+    ESP_LOGI(TAG, "Speaker %s, distance %.2f", speaker.empty() ? "unknown" : speaker.c_str(), distance);
+#if CONFIG_SPEAKER_ID_REJECT_UNKNOWN
+    if (speaker.empty() && !speaker_profiles_.empty()) {
+        ESP_LOGI(TAG, "Wake word from an unknown speaker ignored");
+        return false;
+    }
+#endif
+    return true;
+}
+
+std::string Application::EnrollSpeaker(const std::string& name) {
+    std::vector<float> embedding;
+    {
+        std::lock_guard<std::mutex> lock(speaker_mutex_);
+        embedding = speaker_embedding_;
+    }
+    if (embedding.empty()) {
+        return "{\"success\": false, \"message\": \"No voice sample, the conversation must be started with the wake word\"}";
+    }
+    if (!speaker_profiles_.Enroll(name, embedding)) {
+        return "{\"success\": false, \"message\": \"Invalid name or too many speakers\"}";
+    }
+    return "{\"success\": true}";
+}
+#endif
+
+#if CONFIG_USE_PROMPT_STORE
+std::string Application::PlayPrompt(const std::string& name) {
+    auto sound = PromptStore::GetInstance().Get(name);
+    if (sound.empty()) {
+        return "{\"success\": false, \"message\": \"No such prompt, or the prompts are being updated\"}";
+    }
+    PlaySound(sound);
+    return "{\"success\": true}";
+}
+
+std::string Application::UpdatePrompts(const std::string& url, const std::string& version) {
+    // The queued prompts may point into the partition that is about to be erased
+    ClearPrompts();
+    if (!PromptStore::GetInstance().Update(url, version)) {
+        return "{\"success\": false, \"message\": \"Failed to update the prompts\"}";
+    }
+    return PromptStore::GetInstance().GetJson();
+}
+#endif
+
+#if CONFIG_USE_WAKE_WORD_BENCHMARK
+std::string Application::RunWakeWordBenchmark(const std::string& manifest_path, int speed) {
+    if (device_state_ != kDeviceStateIdle || wake_word_benchmark_ != nullptr) {
+        return "{\"error\":\"The device must be idle\"}";
+    }
+    auto codec = Board::GetInstance().GetAudioCodec();
+    WakeWordBenchmark benchmark(*wake_word_, codec->input_channels());
+    wake_word_->StopDetection();
+    wake_word_benchmark_ = &benchmark;
+
+    // Opus decoding of P3 corpora needs more stack than a tool call has
+    std::string report;
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    cfg.thread_name = "kws_benchmark";
+    cfg.stack_size = TaskTopology::GetInstance().Get(kTaskAudioDecode).stack_size;
+    cfg.prio = 2;
+    esp_pthread_set_cfg(&cfg);
+    std::thread thread([&]() {
+        report = benchmark.Run(manifest_path, speed);
+    });
+    thread.join();
+
+    wake_word_benchmark_ = nullptr;
+    Schedule([this]() {
+        if (device_state_ == kDeviceStateIdle) {
+            wake_word_->StartDetection();
+        }
+    });
+    return report;
+}
+#endif
+
+#if CONFIG_USE_AUDIO_LOOPBACK_BENCHMARK
+std::string Application::RunAudioLoopbackBenchmark(int seconds, bool flash_writes) {
+    if (device_state_ != kDeviceStateIdle || audio_loop_pause_.exchange(true)) {
+        return "{\"error\":\"The device must be idle\"}";
+    }
+    // The loop finishes the read or write it is in before it lets go of the codec
+    NotifyAudioLoop();
+    while (!audio_loop_paused_) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    wake_word_->StopDetection();
+
+    AudioLoopbackBenchmark benchmark(Board::GetInstance().GetAudioCodec());
+    auto report = benchmark.Run(seconds, flash_writes);
+
+    audio_loop_pause_ = false;
+    NotifyAudioLoop();
+    Schedule([this]() {
+        if (device_state_ == kDeviceStateIdle) {
+            wake_word_->StartDetection();
         }
     });
+    return report;
 }
+#endif
@@ -12,10 +12,8 @@
 #include <vector>
 #include <condition_variable>
 #include <memory>
-
-#include <opus_encoder.h>
-#include <opus_decoder.h>
-#include <opus_resampler.h>
+#include <atomic>
+#include <functional>
 
 #include "protocol.h"
 #include "ota.h"
@@ -23,34 +21,152 @@
 #include "audio_processor.h"
 #include "wake_word.h"
 #include "audio_debugger.h"
+#include "spsc_ring_buffer.h"
+#include "jitter_buffer.h"
+#include "opus_stream.h"
+#include "frame_resampler.h"
+#include "downlink_decoder_cache.h"
+#include "prompt_player.h"
+#include "audio_mixer.h"
+#include "playout_clock.h"
+#include "task_callback.h"
+#include "mpsc_ring_buffer.h"
+#include "adaptive_bitrate.h"
+#include "reconnect_backoff.h"
+#include "device_state.h"
+#include "event_bus.h"
+#include "async_flow.h"
+#if CONFIG_USE_WAKE_WORD_BENCHMARK
+#include "wake_word_benchmark.h"
+#endif
+#if CONFIG_USE_AUDIO_LOOPBACK_BENCHMARK
+#include "audio_loopback_benchmark.h"
+#endif
+#if CONFIG_USE_SPEAKER_ID
+#include "speaker_id.h"
+#endif
+#if CONFIG_USE_AUDIO_CAPTURE_RING
+#include "audio_capture.h"
+#endif
+#if CONFIG_USE_AUDIO_RECORDER
+#include "audio_recorder.h"
+#endif
+#if CONFIG_USE_CODEC_POWER_GATING
+#include "codec_power_manager.h"
+#endif
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+#include "response_audio_cache.h"
+#endif
+#if CONFIG_USE_OPUS_COMPLEXITY_GOVERNOR
+#include "complexity_governor.h"
+#endif
+#if CONFIG_USE_MEDIA_PLAYBACK
+#include "media_buffer.h"
+#endif
+#if CONFIG_USE_UPLINK_SILENCE_SUPPRESSION
+#include "uplink_silence_gate.h"
+#endif
+
+class AudioCodec;
 
 #define SCHEDULE_EVENT (1 << 0)
 #define SEND_AUDIO_EVENT (1 << 1)
 #define CHECK_NEW_VERSION_DONE_EVENT (1 << 2)
 
+// Pending Schedule() callbacks held without allocating, a burst beyond this spills to a list
+#if CONFIG_USE_LEAN_PROFILE
+#define MAX_MAIN_TASKS_IN_QUEUE 16
+#else
+#define MAX_MAIN_TASKS_IN_QUEUE 32
+#endif
+
+struct UplinkQueueStats {
+    uint32_t depth = 0;
+    uint32_t max_depth = 0;
+    uint32_t sent = 0;
+    uint32_t dropped_stale = 0;     // Older than UPLINK_MAX_AGE_MS when their turn came
+    uint32_t dropped_full = 0;      // Queue full when they were encoded
+};
+
+struct UplinkPcm {
+    std::vector<int16_t> pcm;
+    uint64_t position = 0;          // Uplink sample position of the first sample, for the playout clock
+};
+
 enum AecMode {
     kAecOff,
     kAecOnDeviceSide,
     kAecOnServerSide,
 };
 
-enum DeviceState {
-    kDeviceStateUnknown,
-    kDeviceStateStarting,
-    kDeviceStateWifiConfiguring,
-    kDeviceStateIdle,
-    kDeviceStateConnecting,
-    kDeviceStateListening,
-    kDeviceStateSpeaking,
-    kDeviceStateUpgrading,
-    kDeviceStateActivating,
-    kDeviceStateAudioTesting,
-    kDeviceStateFatalError
-};
-
+// The uplink frame duration is negotiated in the hello exchange: short frames for
+// realtime barge-in, long frames to save power and bandwidth on cellular links
 #define OPUS_FRAME_DURATION_MS 60
-#define MAX_AUDIO_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+#define OPUS_REALTIME_FRAME_DURATION_MS 20
+#define OPUS_CELLULAR_FRAME_DURATION_MS 120
+#define OPUS_MIN_FRAME_DURATION_MS 20
+// The lean profile keeps half the audio queued, still above the jitter buffer's maximum delay
+#if CONFIG_USE_LEAN_PROFILE
+#define MAX_AUDIO_QUEUE_DURATION_MS 1200
+#else
+#define MAX_AUDIO_QUEUE_DURATION_MS 2400
+#endif
+// Uplink audio that waited longer than this is dropped, late speech only delays the ASR result
+#define UPLINK_MAX_AGE_MS 1000
+// A camera frame is dropped while more audio than this waits to go up, speech comes first
+#define VIDEO_MAX_UPLINK_DEPTH 2
+// Queues are allocated for the shortest frames, the runtime limit follows the negotiated duration
+#define MAX_AUDIO_PACKETS_IN_QUEUE (MAX_AUDIO_QUEUE_DURATION_MS / OPUS_MIN_FRAME_DURATION_MS)
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
+// Processed PCM chunks waiting for the encoder, about half a second of 32 ms AFE chunks
+#if CONFIG_USE_LEAN_PROFILE
+#define UPLINK_PCM_QUEUE_SIZE 8
+#else
+#define UPLINK_PCM_QUEUE_SIZE 16
+#endif
+// After a device-side endpoint the reply has to start within this time, or the turn is given up
+#define ENDPOINT_REPLY_TIMEOUT_MS 10000
+// Push-to-talk uplink starts this long before the press, people start talking as they press
+#define PUSH_TO_TALK_PREROLL_MS 100
+// A prewarm older than this is done again, and no longer spares "tts start" the decoder reset
+#define OUTPUT_PREWARM_VALID_MS 5000
+#define OPUS_CELLULAR_BITRATE 16000
+#define OPUS_WIFI_EXPECTED_LOSS_PERCENT 10
+// Downlink audio buffered before playback starts, the adaptive depth may grow beyond it
+#define JITTER_BUFFER_MIN_DELAY_MS CONFIG_TTS_PREBUFFER_MS
+#define JITTER_BUFFER_MAX_DELAY_MS 480
+// Realtime mode starts playing after one frame and trades the odd underrun for a faster reply
+#define JITTER_BUFFER_REALTIME_MIN_DELAY_MS 20
+#define JITTER_BUFFER_REALTIME_MAX_DELAY_MS 240
+#if CONFIG_USE_LEAN_PROFILE
+#define MAX_QUEUED_PROMPTS 8
+#else
+#define MAX_QUEUED_PROMPTS 16
+#endif
+// After a failed connection the next attempt waits this long, doubling up to CONFIG_OFFLINE_MAX_RETRY_SECONDS
+#define OFFLINE_MIN_RETRY_SECONDS 5
+#define VERSION_CHECK_MIN_RETRY_SECONDS 10
+#define VERSION_CHECK_MAX_RETRY_SECONDS 600
+// Command words run offline that are reported to the server, the oldest are dropped
+#if CONFIG_USE_LEAN_PROFILE
+#define OFFLINE_MAX_QUEUED_ACTIONS 8
+#else
+#define OFFLINE_MAX_QUEUED_ACTIONS 16
+#endif
+#define LINK_QUALITY_UPDATE_SECONDS 2
+// The clock timer ticks every second outside idle. In idle it only wakes for the next minute
+// on the clock, the next network sample, or to refresh the status bar after this long
+#define CLOCK_IDLE_STATUS_INTERVAL_MS 30000
+
+// Uplink encoding and downlink decoding run on their own workers so that an
+// encode burst never delays playback, see TaskTopology for where they run
+#define AUDIO_ENCODE_TASK_MAX_PENDING MAX_AUDIO_PACKETS_IN_QUEUE
+#define AUDIO_DECODE_TASK_MAX_PENDING 2
+// Sound assets are 16 kHz mono in 60 ms frames
+#define PROMPT_SAMPLE_RATE 16000
+#define PROMPT_FRAME_DURATION_MS 60
+// Every pending decode job may carry a prompt frame before the first one is mixed
+#define AUDIO_MIXER_QUEUE_MS ((AUDIO_DECODE_TASK_MAX_PENDING + 2) * PROMPT_FRAME_DURATION_MS)
 
 class Application {
 public:
@@ -65,7 +181,7 @@ public:
     void Start();
     DeviceState GetDeviceState() const { return device_state_; }
     bool IsVoiceDetected() const { return voice_detected_; }
-    void Schedule(std::function<void()> callback);
+    void Schedule(TaskCallback callback);
     void SetDeviceState(DeviceState state);
     void Alert(const char* status, const char* message, const char* emotion = "", const std::string_view& sound = "");
     void DismissAlert();
@@ -78,21 +194,78 @@ public:
     void WakeWordInvoke(const std::string& wake_word);
     void PlaySound(const std::string_view& sound);
     bool CanEnterSleepMode();
-    void SendMcpMessage(const std::string& payload);
+    void SendMcpMessage(std::string payload);
+    // The server accepts camera frames and the audio channel is open
+    bool CanSendVideo();
+    // Queues a JPEG frame for the main loop, false when it was dropped
+    bool SendVideoFrame(std::vector<uint8_t>&& jpeg);
     void SetAecMode(AecMode mode);
     bool ReadAudio(std::vector<int16_t>& data, int sample_rate, int samples);
     AecMode GetAecMode() const { return aec_mode_; }
     BackgroundTask* GetBackgroundTask() const { return background_task_; }
+    BackgroundTask* GetAudioEncodeTask() const { return audio_encode_task_; }
+    AudioProcessor* GetAudioProcessor() const { return audio_processor_.get(); }
+#if CONFIG_USE_WAKE_WORD_BENCHMARK
+    // Replays a labeled corpus through the wake word detector while idle, blocks until done
+    std::string RunWakeWordBenchmark(const std::string& manifest_path, int speed);
+#endif
+#if CONFIG_USE_AUDIO_LOOPBACK_BENCHMARK
+    // Measures the I2S path while idle with the audio loop paused, blocks until done
+    std::string RunAudioLoopbackBenchmark(int seconds, bool flash_writes);
+#endif
+#if CONFIG_USE_SPEAKER_ID
+    // Enrolls whoever said the wake word that started the current conversation
+    std::string EnrollSpeaker(const std::string& name);
+    SpeakerProfiles& GetSpeakerProfiles() { return speaker_profiles_; }
+#endif
+#if CONFIG_USE_AUDIO_RECORDER
+    AudioRecorder* GetAudioRecorder() const { return audio_recorder_.get(); }
+#endif
+#if CONFIG_USE_PROMPT_STORE
+    // Queues a custom prompt of the prompts partition by name, any task
+    std::string PlayPrompt(const std::string& name);
+    // Replaces the custom prompts with the image at `url`, blocks until it is written
+    std::string UpdatePrompts(const std::string& url, const std::string& version);
+#endif
+    JitterBufferStats GetJitterBufferStats() { return jitter_buffer_.GetStats(); }
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+    ResponseAudioCacheStats GetResponseAudioCacheStats() { return response_cache_.GetStats(); }
+#endif
+#if CONFIG_USE_MEDIA_PLAYBACK
+    // pause, resume, seek or stop the media stream, any task. Returns the media status as JSON
+    std::string ControlMedia(std::string_view action, int position_ms);
+    std::string GetMediaStatusJson();
+#endif
+    UplinkQueueStats GetUplinkQueueStats();
+    // Main loop: the board switched the network that new connections are made on
+    void OnNetworkChanged();
 
 private:
     Application();
     ~Application();
 
     std::unique_ptr<WakeWord> wake_word_;
+#if CONFIG_USE_WAKE_WORD_BENCHMARK
+    // Owns the detector while set, live audio is not fed and detections go to the benchmark
+    std::atomic<WakeWordBenchmark*> wake_word_benchmark_{nullptr};
+#endif
+#if CONFIG_USE_AUDIO_LOOPBACK_BENCHMARK
+    // The audio loop leaves the codec alone while the benchmark is set, and reports when it has
+    std::atomic<bool> audio_loop_pause_{false};
+    std::atomic<bool> audio_loop_paused_{false};
+#endif
+#if CONFIG_USE_SPEAKER_ID
+    SpeakerProfiles speaker_profiles_;
+    std::mutex speaker_mutex_;
+    std::vector<float> speaker_embedding_;     // From the wake word of the current conversation
+#endif
     std::unique_ptr<AudioProcessor> audio_processor_;
     std::unique_ptr<AudioDebugger> audio_debugger_;
     std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
+    // Any task -> main loop
+    MpscRingBuffer<TaskCallback> main_tasks_{MAX_MAIN_TASKS_IN_QUEUE};
+    std::list<TaskCallback> overflow_main_tasks_;  // Guarded by mutex_
+    std::atomic<bool> main_tasks_overflowed_{false};
     std::unique_ptr<Protocol> protocol_;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
@@ -101,44 +274,222 @@ private:
     AecMode aec_mode_ = kAecOff;
 
     bool has_server_time_ = false;
-    bool aborted_ = false;
+    std::atomic<bool> aborted_{false};
+    // Set from "tts start" until "tts stop", the downlink is buffered before the state becomes speaking
+    std::atomic<bool> tts_streaming_{false};
+    // Bumped by a barge-in so decode jobs scheduled before it are dropped
+    std::atomic<uint32_t> decode_generation_{0};
+#if CONFIG_USE_OUTPUT_PREWARM
+    // When stt or llm last got the output ready for the reply, 0 once "tts start" has used it
+    std::atomic<int64_t> output_prewarm_us_{0};
+#endif
     bool voice_detected_ = false;
-    bool busy_decoding_audio_ = false;
+#if CONFIG_USE_DEVICE_ENDPOINTING
+    // Auto-stop turns end on the device after this much trailing silence, 0 leaves it to the server
+    int endpoint_silence_ms_ = 0;
+    std::atomic<bool> endpoint_armed_{false};       // Speech seen in this turn, set by the VAD callback
+    std::atomic<int64_t> silence_since_us_{0};      // Start of the current trailing silence, 0 in speech
+    int64_t endpointed_us_ = 0;                     // Main loop, when the uplink was stopped for this turn
+#endif
+#if CONFIG_USE_OFFLINE_MODE
+    // Main loop: the server could not be reached, connections wait for the backoff
+    bool offline_ = false;
+    ReconnectBackoff connect_backoff_{"server", OFFLINE_MIN_RETRY_SECONDS * 1000, CONFIG_OFFLINE_MAX_RETRY_SECONDS * 1000};
+    std::vector<std::string> offline_actions_;
+#endif
     int clock_ticks_ = 0;
-    TaskHandle_t check_new_version_task_handle_ = nullptr;
+    // Guards the one-shot clock timer, rearmed by every tick and by state changes
+    std::mutex clock_mutex_;
+    bool clock_running_ = false;
+    // Done when the audio processor and wake word models are loaded
+    BackgroundTaskToken audio_front_end_ready_;
 
     // Audio encode / decode
     TaskHandle_t audio_loop_task_handle_ = nullptr;
     BackgroundTask* background_task_ = nullptr;
+    BackgroundTask* audio_encode_task_ = nullptr;
+    BackgroundTask* audio_decode_task_ = nullptr;
     std::chrono::steady_clock::time_point last_output_time_;
-    std::list<AudioStreamPacket> audio_send_queue_;
-    std::list<AudioStreamPacket> audio_decode_queue_;
-    std::condition_variable audio_decode_cv_;
-    std::list<AudioStreamPacket> audio_testing_queue_;
+    // Audio processor -> encoder, the slots keep their buffers so steady state does not allocate
+    SpscRingBuffer<UplinkPcm> uplink_pcm_queue_{UPLINK_PCM_QUEUE_SIZE};
+    UplinkPcm uplink_pcm_;                          // Encoder
+    // Encoder -> main loop
+    SpscRingBuffer<AudioStreamPacket> audio_send_queue_{MAX_AUDIO_PACKETS_IN_QUEUE};
+    // Written by whoever sends, read by the metrics tasks
+    std::atomic<uint32_t> uplink_sent_{0};
+    std::atomic<uint32_t> uplink_dropped_stale_{0};
+    std::atomic<uint32_t> uplink_max_depth_{0};
+#if CONFIG_USE_DIRECT_UPLINK_SEND
+    // Set by the main loop once it has emptied the queue on a transport that takes audio from any task,
+    // the encoder then sends its packets itself. Cleared while the main loop has packets to send first
+    std::atomic<bool> direct_uplink_{false};
+    // Held around every uplink send, the packets leave in order whichever task sends them
+    std::mutex uplink_send_mutex_;
+#endif
+    std::atomic<uint32_t> uplink_dropped_full_{0};  // Encoder
+    std::atomic<bool> video_frame_pending_{false};  // One camera frame waits for the main loop at most
+    uint32_t reported_stale_drops_ = 0;
+    // Audio captured while the channel opened is as old as the handshake, its age counts from here
+    std::atomic<int64_t> uplink_opened_us_{0};
+    // Button task -> main loop, when push-to-talk was pressed, 0 once its first frame went up
+    std::atomic<int64_t> push_to_talk_us_{0};
+    // When the VAD last reported the end of the user's speech, 0 once the reply started playing
+    std::atomic<int64_t> speech_end_us_{0};
+    // PlaySound -> audio loop, queued sound assets decoded straight from flash
+    PromptPlayer prompt_player_{MAX_QUEUED_PROMPTS};
+    // Protocol -> audio loop, reorders downlink packets and absorbs network jitter
+    JitterBuffer jitter_buffer_{MAX_AUDIO_PACKETS_IN_QUEUE, JITTER_BUFFER_MIN_DELAY_MS, JITTER_BUFFER_MAX_DELAY_MS};
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+    // Protocol -> audio loop, sentences the server marked with a hash play from here the next time
+    ResponseAudioCache response_cache_{CONFIG_RESPONSE_AUDIO_CACHE_SIZE_KB * 1024};
+    // "tts stop" came while cached sentences were still playing, the audio loop reports when they are done
+    std::atomic<bool> tts_stop_pending_{false};
+#endif
+#if CONFIG_USE_MEDIA_PLAYBACK
+    // Protocol -> audio loop, the frames of a long media stream while media_active_
+    MediaBuffer media_buffer_{CONFIG_MEDIA_BUFFER_SIZE_KB * 1024, CONFIG_MEDIA_PREBUFFER_MS,
+        CONFIG_MEDIA_LOW_WATERMARK_MS, CONFIG_MEDIA_HIGH_WATERMARK_MS};
+    std::atomic<bool> media_active_{false};
+    // A wake word started a turn over the media, it resumes once the turn is over
+    std::atomic<bool> media_interrupted_{false};
+#endif
+#if CONFIG_USE_AUDIO_TESTING
+    // Encoder -> main loop, played back by the audio loop when audio testing ends
+    SpscRingBuffer<AudioStreamPacket> audio_testing_queue_{AUDIO_TESTING_MAX_DURATION_MS / OPUS_MIN_FRAME_DURATION_MS};
+#endif
+
+    // Pairs uplink frames with the playout timestamps for server-side AEC (decoder -> encoder)
+    PlayoutClock playout_clock_;
 
-    // 新增：用于维护音频包的timestamp队列
-    std::list<uint32_t> timestamp_queue_;
-    std::mutex timestamp_mutex_;
+    std::unique_ptr<OpusStreamEncoder> opus_encoder_;
+    std::atomic<int> uplink_frame_duration_{OPUS_FRAME_DURATION_MS};
+    // Main loop only: the profile chosen for the transport, stepped down by the link quality
+    // and capped by the transport's own congestion control
+    OpusEncoderProfile uplink_profile_;
+    AdaptiveBitrate adaptive_bitrate_;
+    int transport_bitrate_ = 0;
+#if CONFIG_USE_OPUS_COMPLEXITY_GOVERNOR
+    // Raises the complexity above the level's on the encode task while the CPU has room
+    ComplexityGovernor complexity_governor_;
+#endif
+#if CONFIG_USE_UPLINK_SILENCE_SUPPRESSION
+    // Holds the encoded uplink back while the VAD hears nothing in realtime mode (encode task)
+    UplinkSilenceGate uplink_silence_gate_{CONFIG_UPLINK_SILENCE_HANGOVER_MS, CONFIG_UPLINK_SILENCE_PREROLL_MS,
+        CONFIG_UPLINK_SILENCE_KEEPALIVE_MS, CONFIG_UPLINK_SILENCE_PREROLL_MS / OPUS_MIN_FRAME_DURATION_MS + 1};
+#endif
+    std::unique_ptr<DownlinkDecoderCache> downlink_decoders_;
+    // The entry of the current stream format, decode task only
+    DownlinkDecoder* downlink_ = nullptr;
 
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
-    std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
+    // One per input channel, each keeps its own filter history
+    std::vector<FrameResampler> input_resamplers_;
+    // Agreed in the server hello, owned by the decode task
+    int decode_channels_ = 1;
 
-    OpusResampler input_resampler_;
-    OpusResampler reference_resampler_;
-    OpusResampler output_resampler_;
+    // Reusable frame buffers for the audio input path, owned by the audio loop
+    std::vector<int16_t> audio_input_data_;
+    std::vector<int16_t> input_buffer_;
+#if CONFIG_USE_AUDIO_CAPTURE_RING
+    // I2S input runs continuously into the ring, the audio loop reads it at whatever size its consumer needs
+    std::unique_ptr<AudioCapture> audio_capture_;
+    AudioCapture::Reader capture_reader_;
+    // Button task -> audio loop, the ring position the push-to-talk uplink starts from, 0 if none
+    std::atomic<uint64_t> push_to_talk_position_{0};
+#endif
+#if CONFIG_USE_AUDIO_RECORDER
+    std::unique_ptr<AudioRecorder> audio_recorder_;
+#endif
+#if CONFIG_USE_CODEC_POWER_GATING
+    std::unique_ptr<CodecPowerManager> codec_power_;
+#endif
+    // Reusable frame buffers for the audio output path, owned by the decode task
+    std::vector<int16_t> decode_pcm_;
+    std::vector<int16_t> resampled_pcm_;
+    // Prompts have a decoder of their own so they mix over a reply without touching its stream,
+    // decoded at the codec's format into the mixer (decode task)
+    std::unique_ptr<OpusStreamDecoder> prompt_decoder_;
+    FrameResampler prompt_resampler_;
+    std::vector<int16_t> prompt_pcm_;
+    std::vector<int16_t> prompt_resampled_;
+    AudioMixer audio_mixer_{AUDIO_MIXER_QUEUE_MS};
+    std::vector<int16_t> mixed_pcm_;
 
     void MainEventLoop();
-    void OnAudioInput();
-    void OnAudioOutput();
+    void RunMainEvents();
+    void OnIncomingJson(const cJSON* root);
+    void OnIncomingControl(const ControlMessage& message);
+    void HandleTtsMessage(const cJSON* root);
+    void HandleSttMessage(const cJSON* root);
+    void HandleLlmMessage(const cJSON* root);
+    void HandleTts(std::string_view state, std::string_view text, std::string_view hash);
+    void OnTtsStopped();
+#if CONFIG_USE_MEDIA_PLAYBACK
+    void HandleMediaMessage(const cJSON* root);
+    void OnMediaStopped();
+    void InterruptMedia();
+    bool ResumeInterruptedMedia();
+#endif
+    void HandleStt(std::string_view text);
+    void HandleMcpMessage(const cJSON* root);
+    void HandleIotMessage(const cJSON* root);
+    void HandleSystemMessage(const cJSON* root);
+    void HandleAlertMessage(const cJSON* root);
+#if CONFIG_USE_COMMAND_WORDS
+    void HandleCommandWord(const CommandWord& command);
+    void SpeakTime();
+#endif
+#if CONFIG_USE_OFFLINE_MODE
+    void QueueOfflineAction(const char* phrase, const char* tool, const cJSON* arguments);
+#endif
+    bool ConnectAudioChannel();
+    void HandleWakeWord(const std::string& wake_word);
+#if CONFIG_USE_SPEAKER_ID
+    bool IdentifySpeaker(std::string& speaker);
+#endif
+    void QueueChatMessage(const char* role, std::string_view message);
+    void QueueEmotion(std::string_view emotion);
+    bool OnAudioInput();
+    bool OnAudioOutput();
+    bool GetDownlinkPacket(AudioStreamPacket& packet, AudioMixerSource& source);
+    bool DecodeDownlink(AudioCodec* codec, AudioStreamPacket& packet, std::vector<int16_t>*& output);
+    void DecodePrompt(AudioCodec* codec, const uint8_t* frame, size_t size);
+    void NotifyAudioLoop();
     void ResetDecoder();
+    void ClearPrompts();
+    void PrepareDecoder(bool reset);
+#if CONFIG_USE_OUTPUT_PREWARM
+    void PrewarmOutput();
+#endif
+    void BargeIn();
+    void SubscribeEvents();
+    void ProbeEndpoints();
+    void PublishVoiceDetected(bool speaking);
+#if CONFIG_USE_DEVICE_ENDPOINTING
+    void CheckEndpoint();
+    void OnEndpoint();
+#endif
+    void WaitForAudioTasks();
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
-    void CheckNewVersion(Ota& ota);
+    void ConfigureUplinkEncoder(bool udp_transport);
+    int GetPreferredFrameDuration();
+    void SetUplinkFrameDuration(int frame_duration);
+    void UpdateLinkQuality();
+    void ApplyUplinkLevel();
+    void EncodeUplinkPcm();
+    bool SendUplinkPacket(const AudioStreamPacket& packet);
+    inline size_t GetMaxQueuedPackets(int max_duration_ms) const { return max_duration_ms / uplink_frame_duration_; }
+    AsyncFlow CheckNewVersion(std::shared_ptr<Ota> ota, bool deferred, std::function<void(bool)> on_done);
     void ShowActivationCode(const std::string& code, const std::string& message);
+    void PlayDigits(std::string_view digits);
     void OnClockTimer();
+    // `soon` ticks after a second whatever the state
+    void ScheduleClockTimer(bool soon = false);
     void SetListeningMode(ListeningMode mode);
     void AudioLoop();
+#if CONFIG_USE_AUDIO_TESTING
     void EnterAudioTestingMode();
     void ExitAudioTestingMode();
+#endif
 };
 
 #endif // _APPLICATION_H_
@@ -0,0 +1,48 @@
+#include "async_flow.h"
+
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define TAG "AsyncFlow"
+
+static AsyncExecutor executor_ = nullptr;
+
+void AsyncFlow::SetExecutor(AsyncExecutor executor) {
+    executor_ = executor;
+}
+
+void AsyncFlow::Resume(std::coroutine_handle<> handle) {
+    executor_([handle]() {
+        handle.resume();
+    });
+}
+
+AsyncDelay::~AsyncDelay() {
+    if (timer_ != nullptr) {
+        // One-shot and fired, it is no longer running
+        esp_timer_delete(timer_);
+    }
+}
+
+bool AsyncDelay::await_suspend(std::coroutine_handle<> handle) {
+    handle_ = handle;
+    esp_timer_create_args_t args = {
+        .callback = [](void* arg) {
+            auto self = (AsyncDelay*)arg;
+            AsyncFlow::Resume(self->handle_);
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "async_delay",
+        .skip_unhandled_events = true,
+    };
+    if (esp_timer_create(&args, &timer_) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create the timer, waiting in place");
+        timer_ = nullptr;
+        vTaskDelay(pdMS_TO_TICKS(ms_));
+        return false;
+    }
+    esp_timer_start_once(timer_, (uint64_t)ms_ * 1000);
+    return true;
+}
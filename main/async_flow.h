@@ -0,0 +1,99 @@
+#ifndef ASYNC_FLOW_H
+#define ASYNC_FLOW_H
+
+#include <esp_timer.h>
+
+#include <coroutine>
+#include <type_traits>
+#include <utility>
+#include <cstdlib>
+
+#include "task_callback.h"
+#include "background_task.h"
+
+// Runs a resumption on the task that owns the flows, set once at boot
+using AsyncExecutor = void (*)(TaskCallback callback);
+
+/*
+ * Return type of a fire-and-forget coroutine, for the long flows of the
+ * application that mostly wait: the version check, the activation polling.
+ *
+ * A flow starts running in the call and runs on until its first co_await.
+ * The awaitables below resume it through the executor, so every step
+ * between two waits runs on the same task, the main loop, and the flow
+ * may touch the application state like any scheduled callback. While it
+ * waits it holds no task and no stack, only its frame on the heap, which
+ * is freed when the flow returns.
+ *
+ * Arguments are copied into the frame. A reference argument must outlive
+ * the flow, pass a shared_ptr instead when the caller returns first.
+ */
+class AsyncFlow {
+public:
+    struct promise_type {
+        AsyncFlow get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { abort(); }
+    };
+
+    static void SetExecutor(AsyncExecutor executor);
+    // Any task, posts the flow to the executor
+    static void Resume(std::coroutine_handle<> handle);
+};
+
+// co_await AsyncDelay(ms) in place of vTaskDelay
+class AsyncDelay {
+public:
+    explicit AsyncDelay(int ms) : ms_(ms) {}
+    ~AsyncDelay();
+    AsyncDelay(const AsyncDelay&) = delete;
+    AsyncDelay& operator=(const AsyncDelay&) = delete;
+
+    bool await_ready() const { return ms_ <= 0; }
+    bool await_suspend(std::coroutine_handle<> handle);
+    void await_resume() {}
+
+private:
+    int ms_;
+    esp_timer_handle_t timer_ = nullptr;
+    std::coroutine_handle<> handle_;
+};
+
+// co_await AsyncBackground(executor, work) runs a blocking call, an HTTP request,
+// on a worker and yields its result. It runs in place when the worker queue is full
+template <typename Work>
+class AsyncBackground {
+public:
+    using Result = std::invoke_result_t<Work&>;
+
+    AsyncBackground(BackgroundTask* executor, Work work) : executor_(executor), work_(std::move(work)) {}
+    AsyncBackground(const AsyncBackground&) = delete;
+    AsyncBackground& operator=(const AsyncBackground&) = delete;
+
+    bool await_ready() const { return executor_ == nullptr; }
+    bool await_suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+        return executor_->Schedule([this]() {
+            result_ = work_();
+            done_ = true;
+            AsyncFlow::Resume(handle_);
+        });
+    }
+    Result await_resume() {
+        if (!done_) {
+            result_ = work_();
+        }
+        return std::move(result_);
+    }
+
+private:
+    BackgroundTask* executor_;
+    Work work_;
+    Result result_{};
+    bool done_ = false;
+    std::coroutine_handle<> handle_;
+};
+
+#endif // ASYNC_FLOW_H
@@ -0,0 +1,138 @@
+#include "audio_capture.h"
+#include "task_topology.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "AudioCapture"
+
+AudioCapture::AudioCapture(AudioCodec* codec) : codec_(codec), channels_(codec->input_channels()) {
+    int rate = codec_->input_sample_rate();
+    block_ = AUDIO_CODEC_DMA_FRAME_NUM;
+    // A whole number of blocks, so a block is always written in one piece
+    capacity_ = (rate * AUDIO_CAPTURE_RING_MS / 1000 + block_ - 1) / block_ * block_;
+    mirror_ = rate * AUDIO_CAPTURE_MAX_READ_MS / 1000;
+    size_t bytes = (capacity_ + mirror_) * channels_ * sizeof(int16_t);
+    ring_ = (int16_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);
+    if (ring_ == nullptr) {
+        ring_ = (int16_t*)heap_caps_malloc(bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (ring_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for the capture ring", bytes);
+        return;
+    }
+    ESP_LOGI(TAG, "Capture ring: %u frames of %d channels at %d Hz", capacity_, channels_, rate);
+}
+
+AudioCapture::~AudioCapture() {
+    if (task_handle_ != nullptr) {
+        vTaskDelete(task_handle_);
+    }
+    heap_caps_free(ring_);
+}
+
+void AudioCapture::Start() {
+    if (ring_ == nullptr || task_handle_ != nullptr) {
+        return;
+    }
+    // Above the audio loop in the task topology, a DMA frame has to be picked up before the next one lands
+    TaskTopology::GetInstance().CreateTask(kTaskAudioCapture, [](void* arg) {
+        ((AudioCapture*)arg)->CaptureTask();
+    }, this, &task_handle_);
+}
+
+void AudioCapture::CaptureTask() {
+    bool enabled = false;
+    while (true) {
+        if (!codec_->input_enabled()) {
+            enabled = false;
+            vTaskDelay(pdMS_TO_TICKS(20));
+            continue;
+        }
+        if (!enabled) {
+            // What is in the ring is older than the pause, readers skip it without counting an overrun
+            restart_position_ = write_position_.load();
+            enabled = true;
+        }
+
+        uint64_t position = write_position_;
+        size_t index = position % capacity_;
+        int16_t* dest = ring_ + index * channels_;
+        if (!codec_->InputData(dest, block_ * channels_)) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+            continue;
+        }
+        if (index < mirror_) {
+            size_t frames = std::min(block_, mirror_ - index);
+            memcpy(ring_ + (capacity_ + index) * channels_, dest, frames * channels_ * sizeof(int16_t));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            last_block_us_ = esp_timer_get_time();
+            write_position_ = position + block_;
+        }
+        cv_.notify_all();
+
+        uint32_t overflows = codec_->input_overflows();
+        if (overflows != reported_dma_overflows_) {
+            ESP_LOGW(TAG, "I2S RX DMA overflowed %lu times", (unsigned long)(overflows - reported_dma_overflows_));
+            reported_dma_overflows_ = overflows;
+        }
+    }
+}
+
+AudioCapture::Reader AudioCapture::CreateReader() {
+    Reader reader;
+    reader.position = write_position_;
+    return reader;
+}
+
+void AudioCapture::Rewind(Reader& reader, uint64_t position) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The same margin as Read(), the oldest block may be being overwritten
+    uint64_t write = write_position_;
+    uint64_t history = capacity_ - mirror_ - block_;
+    uint64_t oldest = std::max<uint64_t>(write > history ? write - history : 0, restart_position_);
+    reader.position = std::min(std::max(position, oldest), write);
+}
+
+bool AudioCapture::Read(Reader& reader, size_t samples, const int16_t*& data, TickType_t timeout) {
+    size_t frames = samples / channels_;
+    if (ring_ == nullptr || frames > mirror_) {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t restart = restart_position_;
+    if (reader.position < restart) {
+        reader.position = restart;
+    }
+    // A block of margin, the writer may already be filling the slot behind the oldest frame
+    uint64_t write = write_position_;
+    if (write > reader.position + capacity_ - mirror_ - block_) {
+        uint64_t oldest = write - (capacity_ - mirror_ - block_);
+        reader.skipped_frames += oldest - reader.position;
+        reader.overruns++;
+        ESP_LOGW(TAG, "Reader fell behind, skipped %lu frames", (unsigned long)(oldest - reader.position));
+        reader.position = oldest;
+    }
+    auto ready = [this, &reader, frames] { return write_position_ >= reader.position + frames; };
+    if (!cv_.wait_for(lock, std::chrono::milliseconds(pdTICKS_TO_MS(timeout)), ready)) {
+        return false;
+    }
+    lock.unlock();
+
+    data = ring_ + (reader.position % capacity_) * channels_;
+    reader.position += frames;
+    return true;
+}
+
+int64_t AudioCapture::GetTimestamp(uint64_t position) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t frames_before = (int64_t)write_position_ - (int64_t)position;
+    return last_block_us_ - frames_before * 1000000 / codec_->input_sample_rate();
+}
@@ -0,0 +1,80 @@
+#ifndef AUDIO_CAPTURE_H
+#define AUDIO_CAPTURE_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <cstdint>
+
+#include "audio_codec.h"
+
+// History kept in the ring, a reader that falls further behind loses the oldest audio
+#define AUDIO_CAPTURE_RING_MS 480
+// The longest single read, the first samples of the ring are mirrored past its end for it
+#define AUDIO_CAPTURE_MAX_READ_MS 120
+
+/*
+ * Reads the I2S input continuously, one DMA frame at a time, into a ring
+ * buffer in PSRAM, independent of what the consumers need.
+ *
+ * Every sample has a position, counted in frames of all channels since the
+ * capture started, and the time at which it was captured follows from the
+ * last DMA completion. Readers keep their own position: each can read
+ * chunks of any size at its own cadence, and gets a pointer straight into
+ * the ring instead of a copy. The writer never waits for a reader. A reader
+ * that falls more than the ring behind is moved to the newest audio and the
+ * skipped frames are counted as an overrun, instead of the I2S DMA
+ * overflowing and the glitch going unnoticed.
+ *
+ * The pointer returned by Read() stays valid until the writer comes around
+ * again, AUDIO_CAPTURE_RING_MS - AUDIO_CAPTURE_MAX_READ_MS later.
+ */
+class AudioCapture {
+public:
+    struct Reader {
+        uint64_t position = 0;      // Next frame to read
+        uint32_t overruns = 0;
+        uint64_t skipped_frames = 0;
+    };
+
+    explicit AudioCapture(AudioCodec* codec);
+    ~AudioCapture();
+
+    void Start();
+    // A reader that starts at the newest audio
+    Reader CreateReader();
+    // Moves the reader to the newest audio without counting an overrun, for readers that paused on purpose
+    void Skip(Reader& reader) { reader.position = write_position_; }
+    // Moves the reader back to `position`, or to the oldest audio still in the ring if that is gone
+    void Rewind(Reader& reader, uint64_t position);
+    // Waits up to timeout for the samples (all channels, interleaved), false if they did not arrive
+    bool Read(Reader& reader, size_t samples, const int16_t*& data, TickType_t timeout = pdMS_TO_TICKS(100));
+    // The time a frame was captured, by the clock of esp_timer
+    int64_t GetTimestamp(uint64_t position);
+    inline uint64_t write_position() const { return write_position_; }
+
+private:
+    AudioCodec* codec_;
+    int channels_;
+    size_t capacity_;           // Frames in the ring
+    size_t mirror_;             // Frames copied past the end, the longest read
+    size_t block_;              // Frames per I2S read
+    int16_t* ring_ = nullptr;
+    TaskHandle_t task_handle_ = nullptr;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::atomic<uint64_t> write_position_{0};
+    // Audio before this position is from before the input was last disabled
+    std::atomic<uint64_t> restart_position_{0};
+    int64_t last_block_us_ = 0;  // Guarded by mutex_
+    uint32_t reported_dma_overflows_ = 0;
+
+    void CaptureTask();
+};
+
+#endif // AUDIO_CAPTURE_H
@@ -1,29 +1,235 @@
 #include "audio_codec.h"
 #include "board.h"
 #include "settings.h"
+#include "task_topology.h"
 
 #include <esp_log.h>
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <driver/i2s_common.h>
 
 #define TAG "AudioCodec"
 
-AudioCodec::AudioCodec() {
+// Q15 fixed point gain
+#define GAIN_UNITY (1 << 15)
+
+AudioCodec::AudioCodec() : target_gain_(GAIN_UNITY) {
+    esp_timer_create_args_t volume_save_timer_args = {
+        .callback = [](void* arg) {
+            AudioCodec* codec = (AudioCodec*)arg;
+            codec->SaveOutputVolume();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "volume_save",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&volume_save_timer_args, &volume_save_timer_);
 }
 
 AudioCodec::~AudioCodec() {
+    if (volume_save_timer_ != nullptr) {
+        esp_timer_stop(volume_save_timer_);
+        esp_timer_delete(volume_save_timer_);
+        SaveOutputVolume();
+    }
 }
 
 void AudioCodec::OutputData(std::vector<int16_t>& data) {
-    Write(data.data(), data.size());
+    if (!amplifier_enabled_) {
+        EnableAmplifier(true);
+    }
+#if CONFIG_USE_ASYNC_AUDIO_OUTPUT
+    if (playout_task_ != nullptr) {
+        // The decoder runs ahead until the buffered audio reaches the watermark, a CPU spike on
+        // the decode path then eats into the buffer instead of leaving a gap
+        int watermark = CONFIG_AUDIO_PLAYOUT_BUFFER_MS * output_sample_rate_ / 1000 * output_channels_;
+        while (queued_samples_ >= watermark) {
+            xSemaphoreTake(playout_space_, pdMS_TO_TICKS(CONFIG_AUDIO_PLAYOUT_BUFFER_MS));
+        }
+        PlayoutFrame* frame;
+        if (xQueueReceive(free_frames_, &frame, portMAX_DELAY) == pdTRUE) {
+            queued_samples_ += data.size();
+            frame->pcm.swap(data);
+            frame->generation = flush_generation_;
+            xQueueSend(queued_frames_, &frame, portMAX_DELAY);
+            return;
+        }
+    }
+#endif
+    WriteFrame(data);
 }
 
-bool AudioCodec::InputData(std::vector<int16_t>& data) {
-    int samples = Read(data.data(), data.size());
-    if (samples > 0) {
+// On the output thread: the caller of OutputData, or the playout task
+void AudioCodec::WriteFrame(std::vector<int16_t>& data) {
+#if CONFIG_USE_CODEC_POWER_GATING
+    // The I2S channels may be stopped, a disabled output would not be heard anyway
+    if (!output_enabled_) {
+        return;
+    }
+#endif
+    std::lock_guard<std::mutex> lock(output_mutex_);
+    ApplyOutputGain(data.data(), data.size());
+    // Write one DMA frame at a time so a flush does not wait for the whole packet to be queued
+    size_t chunk = AUDIO_CODEC_DMA_FRAME_NUM * output_channels_;
+    for (size_t offset = 0; offset < data.size(); offset += chunk) {
+        if (flush_output_.exchange(false)) {
+            FlushOutputDma();
+            // A flush before the first chunk only clears what is left of older packets
+            if (offset > 0) {
+                return;
+            }
+        }
+        Write(data.data() + offset, std::min(chunk, data.size() - offset));
+    }
+}
+
+#if CONFIG_USE_ASYNC_AUDIO_OUTPUT
+void AudioCodec::PlayoutTask() {
+    int64_t last_write_us = 0;
+    uint32_t drained = output_drained_;
+    while (true) {
+        PlayoutFrame* frame;
+        xQueueReceive(queued_frames_, &frame, portMAX_DELAY);
+
+        // Frames queued before a flush are what the flush was meant to drop
+        if (frame->generation != flush_generation_) {
+            queued_samples_ -= frame->pcm.size();
+            xQueueSend(free_frames_, &frame, portMAX_DELAY);
+            xSemaphoreGive(playout_space_);
+            continue;
+        }
+        uint32_t now_drained = output_drained_;
+        if (now_drained != drained && esp_timer_get_time() - last_write_us < AUDIO_CODEC_UNDERRUN_WINDOW_MS * 1000) {
+            output_underruns_++;
+            ESP_LOGW(TAG, "Output underrun, the DMA played silence for %lu buffers",
+                (unsigned long)(now_drained - drained));
+        }
+
+        WriteFrame(frame->pcm);
+        last_write_us = esp_timer_get_time();
+        drained = output_drained_;
+        queued_samples_ -= frame->pcm.size();
+        xQueueSend(free_frames_, &frame, portMAX_DELAY);
+        xSemaphoreGive(playout_space_);
+    }
+}
+
+int AudioCodec::output_buffered_ms() const {
+    int rate = output_sample_rate_ * output_channels_;
+    return rate > 0 ? (int64_t)queued_samples_ * 1000 / rate : 0;
+}
+#endif
+
+void AudioCodec::FlushOutput() {
+#if CONFIG_USE_ASYNC_AUDIO_OUTPUT
+    flush_generation_++;
+#endif
+    flush_output_ = true;
+}
+
+bool AudioCodec::SetOutputSampleRate(int sample_rate) {
+    if (sample_rate == output_sample_rate_) {
         return true;
     }
-    return false;
+    std::lock_guard<std::mutex> lock(output_mutex_);
+    if (!ReclockOutput(sample_rate)) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Output reclocked from %d to %d Hz", output_sample_rate_, sample_rate);
+    output_sample_rate_ = sample_rate;
+    return true;
+}
+
+void AudioCodec::FlushOutputDma() {
+    if (tx_handle_ == nullptr || !output_enabled_) {
+        return;
+    }
+    // Restarting the channel discards the queued descriptors, it then plays silence until the next write
+    if (i2s_channel_disable(tx_handle_) != ESP_OK || i2s_channel_enable(tx_handle_) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to flush the output DMA");
+    }
+}
+
+void AudioCodec::ApplyOutputGain(int16_t* data, int samples) {
+    if (restart_ramp_.exchange(false)) {
+        current_gain_ = 0;
+    }
+    int32_t target = target_gain_.load();
+    int32_t gain = current_gain_;
+
+    int i = 0;
+    if (gain != target) {
+        int ramp_samples = output_sample_rate_ * output_channels_ * AUDIO_CODEC_GAIN_RAMP_MS / 1000;
+        int32_t step = GAIN_UNITY / (ramp_samples > 0 ? ramp_samples : 1);
+        if (step <= 0) {
+            step = 1;
+        }
+        for (; i < samples && gain != target; i++) {
+            if (gain < target) {
+                gain = std::min(gain + step, target);
+            } else {
+                gain = std::max(gain - step, target);
+            }
+            data[i] = (int32_t(data[i]) * gain) >> 15;
+        }
+        current_gain_ = gain;
+    }
+
+    // The rest of the buffer is at a steady gain
+    if (gain == GAIN_UNITY) {
+        return;
+    } else if (gain == 0) {
+        memset(data + i, 0, (samples - i) * sizeof(int16_t));
+    } else {
+        for (; i < samples; i++) {
+            data[i] = (int32_t(data[i]) * gain) >> 15;
+        }
+    }
+}
+
+void AudioCodec::UpdateTargetGain() {
+    int32_t gain = GAIN_UNITY;
+    if (output_muted_) {
+        gain = 0;
+    } else if (software_volume_) {
+        // Perceived loudness follows the square of the volume setting
+        gain = pow(double(output_volume_) / 100.0, 2) * GAIN_UNITY;
+    }
+    if (output_ducked_) {
+        gain >>= AUDIO_CODEC_DUCKING_SHIFT;
+    }
+    target_gain_.store(gain);
+}
+
+void AudioCodec::SetOutputMute(bool mute) {
+    if (mute == output_muted_) {
+        return;
+    }
+    output_muted_ = mute;
+    UpdateTargetGain();
+    ESP_LOGI(TAG, "Set output mute to %s", mute ? "true" : "false");
+}
+
+void AudioCodec::SetOutputDucking(bool duck) {
+    if (duck == output_ducked_) {
+        return;
+    }
+    output_ducked_ = duck;
+    UpdateTargetGain();
+}
+
+bool AudioCodec::IsOutputSilent() const {
+    return output_muted_ && current_gain_ == 0;
+}
+
+bool AudioCodec::InputData(std::vector<int16_t>& data) {
+    return InputData(data.data(), data.size());
+}
+
+bool AudioCodec::InputData(int16_t* data, int samples) {
+    return Read(data, samples) > 0;
 }
 
 void AudioCodec::Start() {
@@ -33,21 +239,82 @@ void AudioCodec::Start() {
         ESP_LOGW(TAG, "Output volume value (%d) is too small, setting to default (10)", output_volume_);
         output_volume_ = 10;
     }
+    saved_output_volume_ = output_volume_;
+    UpdateTargetGain();
+
+    // Callbacks can only be registered while the channel is still disabled
+    i2s_event_callbacks_t rx_callbacks = {};
+    rx_callbacks.on_recv_q_ovf = [](i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) -> bool {
+        ((std::atomic<uint32_t>*)user_ctx)->fetch_add(1, std::memory_order_relaxed);
+        return false;
+    };
+    i2s_channel_register_event_callback(rx_handle_, &rx_callbacks, &input_overflows_);
+    // The TX queue overflows when every DMA buffer has played out and none was refilled
+    i2s_event_callbacks_t tx_callbacks = {};
+    tx_callbacks.on_send_q_ovf = [](i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) -> bool {
+        ((AudioCodec*)user_ctx)->output_drained_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    };
+    tx_callbacks.on_sent = [](i2s_chan_handle_t handle, i2s_event_data_t* event, void* user_ctx) -> bool {
+        ((AudioCodec*)user_ctx)->OnOutputBufferSent();
+        return false;
+    };
+    i2s_channel_register_event_callback(tx_handle_, &tx_callbacks, this);
 
     ESP_ERROR_CHECK(i2s_channel_enable(tx_handle_));
     ESP_ERROR_CHECK(i2s_channel_enable(rx_handle_));
+#if CONFIG_USE_CODEC_POWER_GATING
+    clocks_running_ = true;
+#endif
 
     EnableInput(true);
     EnableOutput(true);
+
+#if CONFIG_USE_ASYNC_AUDIO_OUTPUT
+    free_frames_ = xQueueCreate(AUDIO_CODEC_PLAYOUT_QUEUE_SIZE, sizeof(PlayoutFrame*));
+    queued_frames_ = xQueueCreate(AUDIO_CODEC_PLAYOUT_QUEUE_SIZE, sizeof(PlayoutFrame*));
+    playout_space_ = xSemaphoreCreateBinary();
+    for (auto& frame : playout_frames_) {
+        PlayoutFrame* pointer = &frame;
+        xQueueSend(free_frames_, &pointer, 0);
+    }
+    TaskTopology::GetInstance().CreateTask(kTaskAudioPlayout, [](void* arg) {
+        ((AudioCodec*)arg)->PlayoutTask();
+    }, this, &playout_task_);
+#endif
     ESP_LOGI(TAG, "Audio codec started");
 }
 
 void AudioCodec::SetOutputVolume(int volume) {
     output_volume_ = volume;
+    UpdateTargetGain();
     ESP_LOGI(TAG, "Set output volume to %d", output_volume_);
-    
+
+    // Coalesce repeated changes (knobs, MCP calls) into a single flash write
+    if (volume_save_timer_ != nullptr) {
+        esp_timer_stop(volume_save_timer_);
+        esp_timer_start_once(volume_save_timer_, AUDIO_CODEC_VOLUME_SAVE_DELAY_MS * 1000);
+    } else {
+        SaveOutputVolume();
+    }
+}
+
+void AudioCodec::SaveOutputVolume() {
+    int volume = output_volume_;
+    if (volume == saved_output_volume_) {
+        return;
+    }
+    saved_output_volume_ = volume;
     Settings settings("audio", true);
-    settings.SetInt("output_volume", output_volume_);
+    settings.SetInt("output_volume", volume);
+}
+
+std::string AudioCodec::input_channel_map() const {
+    if (!input_channel_map_.empty()) {
+        return input_channel_map_;
+    }
+    int references = input_reference_ ? 1 : 0;
+    return std::string(input_channels_ - references, 'M') + std::string(references, 'R');
 }
 
 void AudioCodec::EnableInput(bool enable) {
@@ -56,6 +323,9 @@ void AudioCodec::EnableInput(bool enable) {
     }
     input_enabled_ = enable;
     ESP_LOGI(TAG, "Set input enable to %s", enable ? "true" : "false");
+#if CONFIG_USE_CODEC_POWER_GATING
+    UpdateClocks();
+#endif
 }
 
 void AudioCodec::EnableOutput(bool enable) {
@@ -63,5 +333,35 @@ void AudioCodec::EnableOutput(bool enable) {
         return;
     }
     output_enabled_ = enable;
+    if (enable) {
+        // Fade in so re-enabling the speaker does not pop
+        restart_ramp_ = true;
+    }
     ESP_LOGI(TAG, "Set output enable to %s", enable ? "true" : "false");
+#if CONFIG_USE_CODEC_POWER_GATING
+    UpdateClocks();
+#endif
+}
+
+#if CONFIG_USE_CODEC_POWER_GATING
+// With both directions down nothing needs BCLK or MCLK, stopping the channels stops the clocks
+void AudioCodec::UpdateClocks() {
+    bool running = input_enabled_ || output_enabled_;
+    if (running == clocks_running_ || tx_handle_ == nullptr) {
+        return;
+    }
+    clocks_running_ = running;
+    for (auto handle : {tx_handle_, rx_handle_}) {
+        if (handle != nullptr) {
+            esp_err_t err = running ? i2s_channel_enable(handle) : i2s_channel_disable(handle);
+            ESP_ERROR_CHECK_WITHOUT_ABORT(err);
+        }
+    }
+    ESP_LOGI(TAG, "I2S clocks %s", running ? "started" : "stopped");
+}
+#endif
+
+void AudioCodec::EnableAmplifier(bool enable) {
+    amplifier_enabled_ = enable;
+    ESP_LOGD(TAG, "Set amplifier enable to %s", enable ? "true" : "false");
 }
@@ -3,17 +3,36 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include <driver/i2s_std.h>
+#include <esp_timer.h>
 
 #include <vector>
 #include <string>
+#include <atomic>
+#include <mutex>
 #include <functional>
 
 #include "board.h"
 
-#define AUDIO_CODEC_DMA_DESC_NUM 6
+// Together the buffers of a direction must outlast a flash sector erase, when no task runs
+#define AUDIO_CODEC_DMA_DESC_NUM CONFIG_AUDIO_DMA_DESC_NUM
 #define AUDIO_CODEC_DMA_FRAME_NUM 240
 #define AUDIO_CODEC_DEFAULT_MIC_GAIN 30.0
+// Gain changes are ramped linearly over this time to avoid clicks
+#define AUDIO_CODEC_GAIN_RAMP_MS 10
+// A ducked output plays 18 dB down, e.g. media while the user talks to the device
+#define AUDIO_CODEC_DUCKING_SHIFT 3
+// Volume changes are written to NVS once they have settled for this long
+#define AUDIO_CODEC_VOLUME_SAVE_DELAY_MS 2000
+#if CONFIG_USE_ASYNC_AUDIO_OUTPUT
+// Decoded frames waiting for the playout task. The decoder runs up to CONFIG_AUDIO_PLAYOUT_BUFFER_MS
+// ahead of the speaker, the buffers are enough for that in the shortest frames plus the one being written
+#define AUDIO_CODEC_PLAYOUT_QUEUE_SIZE (CONFIG_AUDIO_PLAYOUT_BUFFER_MS / 20 + 1)
+#endif
+// The DMA running dry within this time after a frame counts as an underrun, later it is the end of the reply
+#define AUDIO_CODEC_UNDERRUN_WINDOW_MS 100
 
 class AudioCodec {
 public:
@@ -23,9 +42,26 @@ public:
     virtual void SetOutputVolume(int volume);
     virtual void EnableInput(bool enable);
     virtual void EnableOutput(bool enable);
+    // Gates only the speaker amplifier, the DAC stays configured so it comes back without a pop.
+    // OutputData switches it back on by itself
+    virtual void EnableAmplifier(bool enable);
+    // Fade the output to silence (or back) without touching the volume setting
+    void SetOutputMute(bool mute);
+    // True once a mute has fully faded out
+    bool IsOutputSilent() const;
+    // Lower the output without touching the volume setting, a mute still wins
+    void SetOutputDucking(bool duck);
+    // Drop the audio queued in the TX DMA, the output thread acts on it within one DMA frame
+    void FlushOutput();
+    // Reclock the output so a stream at this rate plays without resampling. False when the hardware
+    // cannot follow, the caller keeps resampling then. Waits for the frame being written to finish
+    bool SetOutputSampleRate(int sample_rate);
 
+    // With CONFIG_USE_ASYNC_AUDIO_OUTPUT the frame is swapped into the playout queue and this only
+    // waits while the queue is full, data comes back holding an old buffer to reuse
     virtual void OutputData(std::vector<int16_t>& data);
     virtual bool InputData(std::vector<int16_t>& data);
+    bool InputData(int16_t* data, int samples);
     virtual void Start();
 
     inline bool duplex() const { return duplex_; }
@@ -33,10 +69,23 @@ public:
     inline int input_sample_rate() const { return input_sample_rate_; }
     inline int output_sample_rate() const { return output_sample_rate_; }
     inline int input_channels() const { return input_channels_; }
+    // One 'M' (microphone) or 'R' (playback reference) per interleaved input channel, in the
+    // order Read() returns them, as the AFE input format expects. The first channel is a microphone
+    std::string input_channel_map() const;
     inline int output_channels() const { return output_channels_; }
     inline int output_volume() const { return output_volume_; }
     inline bool input_enabled() const { return input_enabled_; }
     inline bool output_enabled() const { return output_enabled_; }
+    inline bool output_muted() const { return output_muted_; }
+    inline bool amplifier_enabled() const { return amplifier_enabled_; }
+    // RX DMA buffers that were overwritten before they were read, each one is an audible gap
+    inline uint32_t input_overflows() const { return input_overflows_; }
+    // Times the TX DMA ran out while a reply was playing and played silence instead
+    inline uint32_t output_underruns() const { return output_underruns_; }
+#if CONFIG_USE_ASYNC_AUDIO_OUTPUT
+    // Decoded audio waiting for the speaker
+    int output_buffered_ms() const;
+#endif
 
 protected:
     i2s_chan_handle_t tx_handle_ = nullptr;
@@ -46,14 +95,69 @@ protected:
     bool input_reference_ = false;
     bool input_enabled_ = false;
     bool output_enabled_ = false;
+    std::atomic<bool> amplifier_enabled_{true};
     int input_sample_rate_ = 0;
     int output_sample_rate_ = 0;
     int input_channels_ = 1;
+    // Empty means every microphone first and the reference, if any, last
+    std::string input_channel_map_;
     int output_channels_ = 1;
     int output_volume_ = 70;
+    // Codecs without a hardware volume control let the gain stage apply the volume
+    bool software_volume_ = false;
 
+    void ApplyOutputGain(int16_t* data, int samples);
+    // Called on the output thread, codecs that do not own tx_handle_ can override it
+    virtual void FlushOutputDma();
+    // Called from the I2S interrupt after each TX DMA buffer has played, keep it short
+    virtual void OnOutputBufferSent() {}
+    // Called with no frame being written. Codecs whose TX clock is free to change switch it here,
+    // the default keeps the rate for those that share one clock with the input
+    virtual bool ReclockOutput(int sample_rate) { return false; }
     virtual int Read(int16_t* dest, int samples) = 0;
     virtual int Write(const int16_t* data, int samples) = 0;
+
+private:
+    std::atomic<int32_t> target_gain_;
+    std::atomic<bool> output_muted_{false};
+    std::atomic<bool> output_ducked_{false};
+    std::atomic<bool> restart_ramp_{false};
+    std::atomic<bool> flush_output_{false};
+    std::atomic<uint32_t> input_overflows_{0};
+    std::atomic<uint32_t> output_drained_{0};   // TX DMA queue overflows, every buffer played out
+    std::atomic<uint32_t> output_underruns_{0};
+    std::mutex output_mutex_;   // Held by the output thread while it writes a frame
+    int32_t current_gain_ = 0;  // Only touched by the output thread
+    int saved_output_volume_ = -1;
+    esp_timer_handle_t volume_save_timer_ = nullptr;
+
+    void UpdateTargetGain();
+    void SaveOutputVolume();
+    void WriteFrame(std::vector<int16_t>& data);
+
+#if CONFIG_USE_CODEC_POWER_GATING
+    bool clocks_running_ = false;
+    void UpdateClocks();
+#endif
+
+#if CONFIG_USE_ASYNC_AUDIO_OUTPUT
+    struct PlayoutFrame {
+        std::vector<int16_t> pcm;
+        uint32_t generation = 0;
+    };
+    // Buffers go round between the two queues, so steady playback does not allocate
+    PlayoutFrame playout_frames_[AUDIO_CODEC_PLAYOUT_QUEUE_SIZE];
+    QueueHandle_t free_frames_ = nullptr;
+    QueueHandle_t queued_frames_ = nullptr;
+    TaskHandle_t playout_task_ = nullptr;
+    // Samples in queued_frames_ and the frame being written, OutputData waits while they reach the watermark
+    std::atomic<int> queued_samples_{0};
+    SemaphoreHandle_t playout_space_ = nullptr;
+    // Bumped by FlushOutput, frames queued before it are dropped by the playout task
+    std::atomic<uint32_t> flush_generation_{0};
+
+    void PlayoutTask();
+#endif
 };
 
 #endif // _AUDIO_CODEC_H
@@ -0,0 +1,292 @@
+#include "audio_loopback_benchmark.h"
+#include "task_topology.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_pthread.h>
+#include <nvs_flash.h>
+#include <nvs.h>
+#include <cJSON.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+
+#define TAG "AudioLoopbackBenchmark"
+
+AudioLoopbackBenchmark::AudioLoopbackBenchmark(AudioCodec* codec) : codec_(codec) {
+}
+
+void AudioLoopbackBenchmark::StreamStats::OnCall(int64_t call_start_us, int64_t now_us, size_t call_frames, int64_t warm_us) {
+    if (now_us < warm_us) {
+        start_us = now_us;
+        return;
+    }
+    call_times.Add(now_us - call_start_us);
+    frames += call_frames;
+    end_us = now_us;
+}
+
+// Frames from the end of the last warmup call to the end of the last call, so the first counted
+// call covers time that was really spent on it
+double AudioLoopbackBenchmark::StreamStats::MeasuredRate() const {
+    return end_us > start_us ? frames * 1000000.0 / (end_us - start_us) : 0;
+}
+
+// A linear sweep with short fades, so the correlation has one sharp peak and the speaker does not click
+std::vector<int16_t> AudioLoopbackBenchmark::MakeChirp(int sample_rate) {
+    size_t samples = sample_rate / 1000 * AUDIO_LOOPBACK_CHIRP_MS;
+    size_t fade = sample_rate / 200;
+    double duration = AUDIO_LOOPBACK_CHIRP_MS / 1000.0;
+    double sweep = (AUDIO_LOOPBACK_CHIRP_END_HZ - AUDIO_LOOPBACK_CHIRP_START_HZ) / duration;
+    std::vector<int16_t> chirp(samples);
+    for (size_t i = 0; i < samples; i++) {
+        double t = (double)i / sample_rate;
+        double phase = 2 * M_PI * (AUDIO_LOOPBACK_CHIRP_START_HZ * t + sweep * t * t / 2);
+        double envelope = 1.0;
+        size_t edge = std::min(i, samples - 1 - i);
+        if (edge < fade) {
+            envelope = 0.5 - 0.5 * cos(M_PI * edge / fade);
+        }
+        chirp[i] = 16384 * envelope * sin(phase);
+    }
+    return chirp;
+}
+
+// Silence, with the chirp mixed into the frames after a request. Every frame is filled again,
+// OutputData may hand back a different buffer
+void AudioLoopbackBenchmark::WriteLoop() {
+    int channels = codec_->output_channels();
+    size_t frames = codec_->output_sample_rate() / 1000 * AUDIO_LOOPBACK_FRAME_MS;
+    size_t chirp_offset = output_chirp_.size();
+    std::vector<int16_t> frame;
+    while (writing_) {
+        frame.assign(frames * channels, 0);
+        int64_t start_us = esp_timer_get_time();
+        if (chirp_offset == output_chirp_.size() && chirp_requested_.exchange(false)) {
+            chirp_offset = 0;
+            chirp_written_us_ = start_us;
+        }
+        for (size_t i = 0; i < frames && chirp_offset < output_chirp_.size(); i++, chirp_offset++) {
+            for (int c = 0; c < channels; c++) {
+                frame[i * channels + c] = output_chirp_[chirp_offset];
+            }
+        }
+        codec_->OutputData(frame);
+        output_.OnCall(start_us, esp_timer_get_time(), frames, warm_us_);
+    }
+}
+
+bool AudioLoopbackBenchmark::ReadFrame(std::vector<int16_t>& frame, std::vector<int16_t>& mono, int64_t& captured_us) {
+    int channels = codec_->input_channels();
+    int rate = codec_->input_sample_rate();
+    size_t frames = rate / 1000 * AUDIO_LOOPBACK_FRAME_MS;
+    frame.resize(frames * channels);
+    int64_t start_us = esp_timer_get_time();
+    if (!codec_->InputData(frame)) {
+        return false;
+    }
+    int64_t now_us = esp_timer_get_time();
+    input_.OnCall(start_us, now_us, frames, warm_us_);
+
+    // The read waited for this frame, so its first sample was recorded one frame ago
+    captured_us = now_us - (int64_t)frames * 1000000 / rate;
+    mono.resize(frames);
+    for (size_t i = 0; i < frames; i++) {
+        mono[i] = frame[i * channels];
+    }
+    return true;
+}
+
+void AudioLoopbackBenchmark::RunTrial() {
+    int rate_khz = codec_->input_sample_rate() / 1000;
+    size_t window = rate_khz * AUDIO_LOOPBACK_WINDOW_MS;
+    std::vector<int16_t> recording;
+    std::vector<int16_t> frame;
+    std::vector<int16_t> mono;
+    int64_t recording_start_us = 0;
+    recording.reserve(window + rate_khz * AUDIO_LOOPBACK_FRAME_MS);
+
+    chirp_written_us_ = 0;
+    chirp_requested_ = true;
+    while (recording.size() < window) {
+        int64_t captured_us;
+        if (!ReadFrame(frame, mono, captured_us)) {
+            return;
+        }
+        if (recording.empty()) {
+            recording_start_us = captured_us;
+        }
+        recording.insert(recording.end(), mono.begin(), mono.end());
+    }
+    chirp_requested_ = false;
+    int64_t written_us = chirp_written_us_;
+    size_t n = input_chirp_.size();
+    if (written_us == 0 || recording.size() < n) {
+        ESP_LOGW(TAG, "The chirp was not played in time");
+        return;
+    }
+
+    // The microphone may be wired with either polarity, the strongest peak of either sign wins
+    int64_t best = 0;
+    size_t best_lag = 0;
+    for (size_t lag = 0; lag + n <= recording.size(); lag++) {
+        int64_t sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += (int32_t)recording[lag + i] * input_chirp_[i];
+        }
+        if (llabs(sum) > llabs(best)) {
+            best = sum;
+            best_lag = lag;
+        }
+    }
+    double chirp_energy = 0;
+    double recorded_energy = 0;
+    for (size_t i = 0; i < n; i++) {
+        chirp_energy += (double)input_chirp_[i] * input_chirp_[i];
+        recorded_energy += (double)recording[best_lag + i] * recording[best_lag + i];
+    }
+    float correlation = recorded_energy > 0 ? std::fabs(best) / sqrt(chirp_energy * recorded_energy) : 0;
+    correlations_.push_back(correlation);
+
+    int64_t heard_us = recording_start_us + (int64_t)best_lag * 1000000 / codec_->input_sample_rate();
+    if (correlation < AUDIO_LOOPBACK_MIN_CORRELATION || heard_us < written_us) {
+        ESP_LOGW(TAG, "Chirp not heard, best correlation %.2f", correlation);
+        return;
+    }
+    round_trips_us_.push_back(heard_us - written_us);
+    ESP_LOGI(TAG, "Chirp heard after %.1f ms, correlation %.2f", (heard_us - written_us) / 1000.0, correlation);
+}
+
+void AudioLoopbackBenchmark::FlashWriteLoop() {
+    nvs_handle_t handle;
+    if (nvs_open("loopback_bench", NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open the NVS namespace");
+        return;
+    }
+    // Every write differs from the last, so NVS really programs it and now and then erases a page
+    std::vector<uint8_t> blob(AUDIO_LOOPBACK_FLASH_WRITE_SIZE);
+    while (flash_writing_) {
+        for (auto& byte : blob) {
+            byte = rand();
+        }
+        int64_t start = esp_timer_get_time();
+        nvs_set_blob(handle, "blob", blob.data(), blob.size());
+        nvs_commit(handle);
+        flash_write_max_us_ = std::max<uint32_t>(flash_write_max_us_, esp_timer_get_time() - start);
+        flash_writes_++;
+        vTaskDelay(pdMS_TO_TICKS(AUDIO_LOOPBACK_FLASH_WRITE_INTERVAL_MS));
+    }
+    nvs_erase_key(handle, "blob");
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+std::string AudioLoopbackBenchmark::Run(int seconds, bool flash_writes) {
+    bool input_enabled = codec_->input_enabled();
+    bool output_enabled = codec_->output_enabled();
+    codec_->EnableInput(true);
+    codec_->EnableOutput(true);
+    codec_->SetOutputMute(false);
+    output_chirp_ = MakeChirp(codec_->output_sample_rate());
+    input_chirp_ = MakeChirp(codec_->input_sample_rate());
+    uint32_t overflows = codec_->input_overflows();
+    uint32_t underruns = codec_->output_underruns();
+
+    warm_us_ = esp_timer_get_time() + AUDIO_LOOPBACK_WARMUP_MS * 1000;
+    writing_ = true;
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    cfg.thread_name = "loopback_out";
+    cfg.stack_size = 4096;
+    cfg.prio = TaskTopology::GetInstance().Get(kTaskAudioPlayout).priority;
+    esp_pthread_set_cfg(&cfg);
+    std::thread writer([this]() {
+        WriteLoop();
+    });
+
+    // Throughput over silence first, then the round trip trials keep the same streams running
+    std::vector<int16_t> frame;
+    std::vector<int16_t> mono;
+    int64_t captured_us;
+    int64_t end_us = warm_us_ + seconds * 1000000LL;
+    std::thread flash_writer;
+    if (flash_writes) {
+        cfg.thread_name = "loopback_flash";
+        cfg.stack_size = 4096;
+        cfg.prio = 2;
+        esp_pthread_set_cfg(&cfg);
+        flash_writing_ = true;
+        flash_writer = std::thread([this]() {
+            FlashWriteLoop();
+        });
+    }
+    while (esp_timer_get_time() < end_us && ReadFrame(frame, mono, captured_us)) {
+    }
+    if (flash_writes) {
+        flash_writing_ = false;
+        flash_writer.join();
+    }
+    for (int i = 0; i < AUDIO_LOOPBACK_CHIRP_TRIALS; i++) {
+        RunTrial();
+    }
+
+    writing_ = false;
+    writer.join();
+    overflows = codec_->input_overflows() - overflows;
+    underruns = codec_->output_underruns() - underruns;
+    codec_->EnableInput(input_enabled);
+    codec_->EnableOutput(output_enabled);
+    return Report(overflows, underruns);
+}
+
+std::string AudioLoopbackBenchmark::Report(uint32_t overflows, uint32_t underruns) {
+    cJSON* json = cJSON_CreateObject();
+    auto add_stream = [json](const char* name, const StreamStats& stats, int sample_rate, const char* xrun_name, uint32_t xruns) {
+        auto stream = cJSON_CreateObject();
+        double measured = stats.MeasuredRate();
+        cJSON_AddNumberToObject(stream, "sample_rate", sample_rate);
+        cJSON_AddNumberToObject(stream, "measured_hz", round(measured * 10) / 10);
+        cJSON_AddNumberToObject(stream, "error_ppm", measured > 0 ? round((measured / sample_rate - 1) * 1e6) : 0);
+        cJSON_AddNumberToObject(stream, xrun_name, xruns);
+        auto calls = cJSON_CreateObject();
+        cJSON_AddNumberToObject(calls, "calls", stats.call_times.count());
+        cJSON_AddNumberToObject(calls, "mean", stats.call_times.mean_us());
+        cJSON_AddNumberToObject(calls, "p50", stats.call_times.Percentile(50));
+        cJSON_AddNumberToObject(calls, "p99", stats.call_times.Percentile(99));
+        cJSON_AddNumberToObject(calls, "max", stats.call_times.max_us());
+        cJSON_AddItemToObject(stream, "call_us", calls);
+        cJSON_AddItemToObject(json, name, stream);
+    };
+    add_stream("input", input_, codec_->input_sample_rate(), "overflows", overflows);
+    add_stream("output", output_, codec_->output_sample_rate(), "underruns", underruns);
+    if (flash_writes_ > 0) {
+        auto flash = cJSON_CreateObject();
+        cJSON_AddNumberToObject(flash, "writes", flash_writes_);
+        cJSON_AddNumberToObject(flash, "max_write_us", flash_write_max_us_);
+        cJSON_AddNumberToObject(flash, "dma_buffer_ms", AUDIO_CODEC_DMA_DESC_NUM * AUDIO_CODEC_DMA_FRAME_NUM * 1000 / codec_->input_sample_rate());
+        cJSON_AddItemToObject(json, "flash", flash);
+    }
+
+    auto round_trip = cJSON_CreateObject();
+    cJSON_AddNumberToObject(round_trip, "trials", correlations_.size());
+    cJSON_AddNumberToObject(round_trip, "heard", round_trips_us_.size());
+    if (!round_trips_us_.empty()) {
+        std::sort(round_trips_us_.begin(), round_trips_us_.end());
+        cJSON_AddNumberToObject(round_trip, "min_ms", round_trips_us_.front() / 1000.0);
+        cJSON_AddNumberToObject(round_trip, "median_ms", round_trips_us_[round_trips_us_.size() / 2] / 1000.0);
+        cJSON_AddNumberToObject(round_trip, "max_ms", round_trips_us_.back() / 1000.0);
+    }
+    auto correlations = cJSON_CreateArray();
+    for (float correlation : correlations_) {
+        cJSON_AddItemToArray(correlations, cJSON_CreateNumber(round(correlation * 100) / 100));
+    }
+    cJSON_AddItemToObject(round_trip, "correlation", correlations);
+    cJSON_AddItemToObject(json, "round_trip", round_trip);
+
+    auto str = cJSON_PrintUnformatted(json);
+    std::string result(str);
+    cJSON_free(str);
+    cJSON_Delete(json);
+    ESP_LOGI(TAG, "Benchmark: %s", result.c_str());
+    return result;
+}
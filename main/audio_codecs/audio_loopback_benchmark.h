@@ -0,0 +1,96 @@
+#ifndef AUDIO_LOOPBACK_BENCHMARK_H
+#define AUDIO_LOOPBACK_BENCHMARK_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+#include "audio_codec.h"
+#include "timing_histogram.h"
+
+// Reads and writes are one frame of this length, as the audio loop does
+#define AUDIO_LOOPBACK_FRAME_MS 20
+// Throughput is timed after this much audio, once the DMA queues have filled
+#define AUDIO_LOOPBACK_WARMUP_MS 300
+// Round trip trials: a chirp is played and searched for in a recording window of this length
+#define AUDIO_LOOPBACK_CHIRP_TRIALS 3
+#define AUDIO_LOOPBACK_CHIRP_MS 100
+#define AUDIO_LOOPBACK_CHIRP_START_HZ 500
+#define AUDIO_LOOPBACK_CHIRP_END_HZ 4000
+#define AUDIO_LOOPBACK_WINDOW_MS 600
+// A correlation peak below this fraction of the perfect match counts as not heard
+#define AUDIO_LOOPBACK_MIN_CORRELATION 0.2
+// With flash writes, an NVS blob of this size is written and committed this often during the throughput phase
+#define AUDIO_LOOPBACK_FLASH_WRITE_SIZE 512
+#define AUDIO_LOOPBACK_FLASH_WRITE_INTERVAL_MS 100
+// Call times go into a histogram of 100 us buckets, the last one collects everything slower
+#define AUDIO_LOOPBACK_CALL_BUCKET_US 100
+#define AUDIO_LOOPBACK_CALL_BUCKETS 256
+
+/*
+ * Qualifies the I2S path of a board with numbers instead of by ear.
+ *
+ * The output plays silence from its own thread while the input is read, both
+ * one frame per call. The first phase times the calls and counts the samples
+ * that went through against the wall clock, which gives the real sample rate
+ * of each direction and catches DMA overflows and underruns. The second phase
+ * plays a short chirp a few times and cross-correlates the microphone with it:
+ * the peak is the round trip from handing the chirp to OutputData until it is
+ * back in the input buffer, DMA queues and the air gap included.
+ *
+ * With flash_writes, a helper thread writes and commits NVS during the
+ * first phase, as volume changes and settings do in use. While a flash
+ * sector is written or erased no task runs and only the DMA goes on, so the
+ * overflows and underruns of such a run, against one without, show whether
+ * the DMA buffers (CONFIG_AUDIO_DMA_DESC_NUM) outlast the flash operations.
+ *
+ * The caller keeps the audio loop away from the codec while Run() is active.
+ */
+class AudioLoopbackBenchmark {
+public:
+    explicit AudioLoopbackBenchmark(AudioCodec* codec);
+
+    // Blocks for about `seconds` plus the chirp trials, returns the report as JSON
+    std::string Run(int seconds, bool flash_writes = false);
+
+private:
+    // One direction: call times, and the frames that went through once past the warmup
+    struct StreamStats {
+        TimingHistogram call_times{AUDIO_LOOPBACK_CALL_BUCKET_US, AUDIO_LOOPBACK_CALL_BUCKETS};
+        uint64_t frames = 0;
+        int64_t start_us = 0;
+        int64_t end_us = 0;
+
+        void OnCall(int64_t call_start_us, int64_t now_us, size_t call_frames, int64_t warm_us);
+        double MeasuredRate() const;
+    };
+
+    AudioCodec* codec_;
+    int64_t warm_us_ = 0;       // Calls before this are only filling the DMA queues
+    StreamStats input_;
+    StreamStats output_;
+
+    // Set by the reader, the writer plays the chirp in its next frame and stamps when it did
+    std::atomic<bool> chirp_requested_{false};
+    std::atomic<int64_t> chirp_written_us_{0};
+    std::atomic<bool> writing_{false};
+    std::vector<int16_t> output_chirp_;
+    std::vector<int16_t> input_chirp_;
+    std::vector<int> round_trips_us_;
+    std::vector<float> correlations_;
+    // Flash writes of the throughput phase
+    std::atomic<bool> flash_writing_{false};
+    uint32_t flash_writes_ = 0;
+    uint32_t flash_write_max_us_ = 0;
+
+    static std::vector<int16_t> MakeChirp(int sample_rate);
+    void WriteLoop();
+    // One frame of the first input channel, returns the time the frame started to be recorded
+    bool ReadFrame(std::vector<int16_t>& frame, std::vector<int16_t>& mono, int64_t& captured_us);
+    void RunTrial();
+    void FlashWriteLoop();
+    std::string Report(uint32_t overflows, uint32_t underruns);
+};
+
+#endif // AUDIO_LOOPBACK_BENCHMARK_H
@@ -0,0 +1,40 @@
+#ifndef BOARD_AUDIO_TRAITS_H
+#define BOARD_AUDIO_TRAITS_H
+
+#include "audio_codec.h"
+
+// The rate of the audio processor, the wake word and the encoder
+#define BOARD_AUDIO_PROCESS_SAMPLE_RATE 16000
+
+/*
+ * The audio configuration of the board of this build, known at compile time.
+ *
+ * CMakeLists.txt reads AUDIO_INPUT_SAMPLE_RATE from the config.h of the
+ * board and passes it as BOARD_AUDIO_INPUT_SAMPLE_RATE. The input path
+ * branches on these traits with if constexpr, so on a board that captures
+ * at 16 kHz the input resampling is not in the firmware at all and no
+ * rate is compared per frame. Without the definition the traits fall back
+ * to asking the codec at runtime.
+ *
+ * The output rate is not a trait, SetOutputSampleRate changes it at runtime.
+ */
+struct BoardAudioTraits {
+#ifdef BOARD_AUDIO_INPUT_SAMPLE_RATE
+    static constexpr int kInputSampleRate = BOARD_AUDIO_INPUT_SAMPLE_RATE;
+#else
+    static constexpr int kInputSampleRate = 0;
+#endif
+    static constexpr bool kInputSampleRateKnown = kInputSampleRate != 0;
+    // False only when the board is known to capture at the processing rate
+    static constexpr bool kInputMayResample = kInputSampleRate != BOARD_AUDIO_PROCESS_SAMPLE_RATE;
+
+    static int InputSampleRate(const AudioCodec* codec) {
+        if constexpr (kInputSampleRateKnown) {
+            return kInputSampleRate;
+        } else {
+            return codec->input_sample_rate();
+        }
+    }
+};
+
+#endif // BOARD_AUDIO_TRAITS_H
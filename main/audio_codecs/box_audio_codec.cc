@@ -8,89 +8,59 @@
 
 BoxAudioCodec::BoxAudioCodec(void* i2c_master_handle, int input_sample_rate, int output_sample_rate,
     gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din,
-    gpio_num_t pa_pin, uint8_t es8311_addr, uint8_t es7210_addr, bool input_reference) {
+    gpio_num_t pa_pin, uint8_t es8311_addr, uint8_t es7210_addr, bool input_reference,
+    const std::vector<uint8_t>& mic_slots) {
     duplex_ = true; // 是否双工
     input_reference_ = input_reference; // 是否使用参考输入，实现回声消除
-    input_channels_ = input_reference_ ? 2 : 1; // 输入通道数
+    uint16_t mic_mask = 0;
+    for (uint8_t slot : mic_slots) {
+        assert(slot < 4 && slot != BOX_AUDIO_CODEC_REFERENCE_SLOT);
+        mic_mask |= ESP_CODEC_DEV_MAKE_CHANNEL_MASK(slot);
+    }
+    assert(mic_mask & (ESP_CODEC_DEV_MAKE_CHANNEL_MASK(BOX_AUDIO_CODEC_REFERENCE_SLOT) - 1));
+    // esp_codec_dev returns the selected slots in slot order
+    for (int slot = 0; slot < 4; slot++) {
+        if (mic_mask & ESP_CODEC_DEV_MAKE_CHANNEL_MASK(slot)) {
+            input_channel_map_.push_back('M');
+        } else if (slot == BOX_AUDIO_CODEC_REFERENCE_SLOT && input_reference_) {
+            input_channel_map_.push_back('R');
+        }
+    }
+    input_channels_ = input_channel_map_.size(); // 输入通道数
     input_sample_rate_ = input_sample_rate;
     output_sample_rate_ = output_sample_rate;
+    input_device_channels_ = 4;
+    input_channel_mask_ = mic_mask;
+    if (input_reference_) {
+        input_channel_mask_ |= ESP_CODEC_DEV_MAKE_CHANNEL_MASK(BOX_AUDIO_CODEC_REFERENCE_SLOT);
+    }
+    input_gain_mask_ = mic_mask;
 
-    CreateDuplexChannels(mclk, bclk, ws, dout, din);
-
-    // Do initialize of related interface: data_if, ctrl_if and gpio_if
-    audio_codec_i2s_cfg_t i2s_cfg = {
-        .port = I2S_NUM_0,
-        .rx_handle = rx_handle_,
-        .tx_handle = tx_handle_,
-    };
-    data_if_ = audio_codec_new_i2s_data(&i2s_cfg);
-    assert(data_if_ != NULL);
-
-    // Output
-    audio_codec_i2c_cfg_t i2c_cfg = {
-        .port = (i2c_port_t)1,
-        .addr = es8311_addr,
-        .bus_handle = i2c_master_handle,
-    };
-    out_ctrl_if_ = audio_codec_new_i2c_ctrl(&i2c_cfg);
-    assert(out_ctrl_if_ != NULL);
-
-    gpio_if_ = audio_codec_new_gpio();
-    assert(gpio_if_ != NULL);
+    CreateTdmChannels(mclk, bclk, ws, dout, din);
+    CreateInterfaces();
 
+    // Output, the ES8311 driver switches the amplifier itself
     es8311_codec_cfg_t es8311_cfg = {};
-    es8311_cfg.ctrl_if = out_ctrl_if_;
-    es8311_cfg.gpio_if = gpio_if_;
+    es8311_cfg.ctrl_if = CreateI2cControl(i2c_master_handle, (i2c_port_t)1, es8311_addr);
+    es8311_cfg.gpio_if = gpio_if();
     es8311_cfg.codec_mode = ESP_CODEC_DEV_WORK_MODE_DAC;
     es8311_cfg.pa_pin = pa_pin;
     es8311_cfg.use_mclk = true;
     es8311_cfg.hw_gain.pa_voltage = 5.0;
     es8311_cfg.hw_gain.codec_dac_voltage = 3.3;
-    out_codec_if_ = es8311_codec_new(&es8311_cfg);
-    assert(out_codec_if_ != NULL);
-
-    esp_codec_dev_cfg_t dev_cfg = {
-        .dev_type = ESP_CODEC_DEV_TYPE_OUT,
-        .codec_if = out_codec_if_,
-        .data_if = data_if_,
-    };
-    output_dev_ = esp_codec_dev_new(&dev_cfg);
-    assert(output_dev_ != NULL);
+    auto output_codec = es8311_codec_new(&es8311_cfg);
 
     // Input
-    i2c_cfg.addr = es7210_addr;
-    in_ctrl_if_ = audio_codec_new_i2c_ctrl(&i2c_cfg);
-    assert(in_ctrl_if_ != NULL);
-
     es7210_codec_cfg_t es7210_cfg = {};
-    es7210_cfg.ctrl_if = in_ctrl_if_;
+    es7210_cfg.ctrl_if = CreateI2cControl(i2c_master_handle, (i2c_port_t)1, es7210_addr);
     es7210_cfg.mic_selected = ES7120_SEL_MIC1 | ES7120_SEL_MIC2 | ES7120_SEL_MIC3 | ES7120_SEL_MIC4;
-    in_codec_if_ = es7210_codec_new(&es7210_cfg);
-    assert(in_codec_if_ != NULL);
-
-    dev_cfg.dev_type = ESP_CODEC_DEV_TYPE_IN;
-    dev_cfg.codec_if = in_codec_if_;
-    input_dev_ = esp_codec_dev_new(&dev_cfg);
-    assert(input_dev_ != NULL);
+    auto input_codec = es7210_codec_new(&es7210_cfg);
 
+    CreateDevices(output_codec, input_codec);
     ESP_LOGI(TAG, "BoxAudioDevice initialized");
 }
 
-BoxAudioCodec::~BoxAudioCodec() {
-    ESP_ERROR_CHECK(esp_codec_dev_close(output_dev_));
-    esp_codec_dev_delete(output_dev_);
-    ESP_ERROR_CHECK(esp_codec_dev_close(input_dev_));
-    esp_codec_dev_delete(input_dev_);
-
-    audio_codec_delete_codec_if(in_codec_if_);
-    audio_codec_delete_ctrl_if(in_ctrl_if_);
-    audio_codec_delete_codec_if(out_codec_if_);
-    audio_codec_delete_ctrl_if(out_ctrl_if_);
-    audio_codec_delete_gpio_if(gpio_if_);
-    audio_codec_delete_data_if(data_if_);
-}
-
-void BoxAudioCodec::CreateDuplexChannels(gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din) {
+void BoxAudioCodec::CreateTdmChannels(gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din) {
     assert(input_sample_rate_ == output_sample_rate_);
 
     i2s_chan_config_t chan_cfg = {
@@ -177,66 +147,3 @@ void BoxAudioCodec::CreateDuplexChannels(gpio_num_t mclk, gpio_num_t bclk, gpio_
     ESP_ERROR_CHECK(i2s_channel_init_tdm_mode(rx_handle_, &tdm_cfg));
     ESP_LOGI(TAG, "Duplex channels created");
 }
-
-void BoxAudioCodec::SetOutputVolume(int volume) {
-    ESP_ERROR_CHECK(esp_codec_dev_set_out_vol(output_dev_, volume));
-    AudioCodec::SetOutputVolume(volume);
-}
-
-void BoxAudioCodec::EnableInput(bool enable) {
-    if (enable == input_enabled_) {
-        return;
-    }
-    if (enable) {
-        esp_codec_dev_sample_info_t fs = {
-            .bits_per_sample = 16,
-            .channel = 4,
-            .channel_mask = ESP_CODEC_DEV_MAKE_CHANNEL_MASK(0),
-            .sample_rate = (uint32_t)output_sample_rate_,
-            .mclk_multiple = 0,
-        };
-        if (input_reference_) {
-            fs.channel_mask |= ESP_CODEC_DEV_MAKE_CHANNEL_MASK(1);
-        }
-        ESP_ERROR_CHECK(esp_codec_dev_open(input_dev_, &fs));
-        ESP_ERROR_CHECK(esp_codec_dev_set_in_channel_gain(input_dev_, ESP_CODEC_DEV_MAKE_CHANNEL_MASK(0), AUDIO_CODEC_DEFAULT_MIC_GAIN));
-    } else {
-        ESP_ERROR_CHECK(esp_codec_dev_close(input_dev_));
-    }
-    AudioCodec::EnableInput(enable);
-}
-
-void BoxAudioCodec::EnableOutput(bool enable) {
-    if (enable == output_enabled_) {
-        return;
-    }
-    if (enable) {
-        // Play 16bit 1 channel
-        esp_codec_dev_sample_info_t fs = {
-            .bits_per_sample = 16,
-            .channel = 1,
-            .channel_mask = 0,
-            .sample_rate = (uint32_t)output_sample_rate_,
-            .mclk_multiple = 0,
-        };
-        ESP_ERROR_CHECK(esp_codec_dev_open(output_dev_, &fs));
-        ESP_ERROR_CHECK(esp_codec_dev_set_out_vol(output_dev_, output_volume_));
-    } else {
-        ESP_ERROR_CHECK(esp_codec_dev_close(output_dev_));
-    }
-    AudioCodec::EnableOutput(enable);
-}
-
-int BoxAudioCodec::Read(int16_t* dest, int samples) {
-    if (input_enabled_) {
-        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_read(input_dev_, (void*)dest, samples * sizeof(int16_t)));
-    }
-    return samples;
-}
-
-int BoxAudioCodec::Write(const int16_t* data, int samples) {
-    if (output_enabled_) {
-        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_write(output_dev_, (void*)data, samples * sizeof(int16_t)));
-    }
-    return samples;
-}
\ No newline at end of file
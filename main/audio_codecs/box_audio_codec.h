@@ -1,37 +1,31 @@
 #ifndef _BOX_AUDIO_CODEC_H
 #define _BOX_AUDIO_CODEC_H
 
-#include "audio_codec.h"
-
-#include <esp_codec_dev.h>
-#include <esp_codec_dev_defaults.h>
-
-class BoxAudioCodec : public AudioCodec {
+#include "esp_codec_dev_audio_codec.h"
+
+#include <vector>
+
+// The ES7210 slot the board wires to the DAC output for the echo reference
+#define BOX_AUDIO_CODEC_REFERENCE_SLOT 1
+
+/*
+ * ES8311 output and ES7210 input on one TDM bus. The ES7210 has four
+ * slots. `mic_slots` lists the ones with a microphone, a board with a
+ * two-mic array passes both (in config.h as AUDIO_INPUT_MIC_SLOTS) so the
+ * AFE can beamform. Read() returns the selected slots interleaved in slot
+ * order, input_channel_map() tells which of them is the reference. The
+ * first microphone must sit below the reference slot, consumers that look
+ * at a single channel take the first one.
+ */
+class BoxAudioCodec : public EspCodecDevAudioCodec {
 private:
-    const audio_codec_data_if_t* data_if_ = nullptr;
-    const audio_codec_ctrl_if_t* out_ctrl_if_ = nullptr;
-    const audio_codec_if_t* out_codec_if_ = nullptr;
-    const audio_codec_ctrl_if_t* in_ctrl_if_ = nullptr;
-    const audio_codec_if_t* in_codec_if_ = nullptr;
-    const audio_codec_gpio_if_t* gpio_if_ = nullptr;
-
-    esp_codec_dev_handle_t output_dev_ = nullptr;
-    esp_codec_dev_handle_t input_dev_ = nullptr;
-
-    void CreateDuplexChannels(gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din);
-
-    virtual int Read(int16_t* dest, int samples) override;
-    virtual int Write(const int16_t* data, int samples) override;
+    void CreateTdmChannels(gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din);
 
 public:
     BoxAudioCodec(void* i2c_master_handle, int input_sample_rate, int output_sample_rate,
         gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din,
-        gpio_num_t pa_pin, uint8_t es8311_addr, uint8_t es7210_addr, bool input_reference);
-    virtual ~BoxAudioCodec();
-
-    virtual void SetOutputVolume(int volume) override;
-    virtual void EnableInput(bool enable) override;
-    virtual void EnableOutput(bool enable) override;
+        gpio_num_t pa_pin, uint8_t es8311_addr, uint8_t es7210_addr, bool input_reference,
+        const std::vector<uint8_t>& mic_slots = {0});
 };
 
 #endif // _BOX_AUDIO_CODEC_H
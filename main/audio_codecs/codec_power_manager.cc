@@ -0,0 +1,59 @@
+#include "codec_power_manager.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+
+#define TAG "CodecPowerManager"
+
+CodecPowerManager::CodecPowerManager(AudioCodec* codec) : codec_(codec) {
+}
+
+void CodecPowerManager::Prewarm() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t start_us = esp_timer_get_time();
+    prewarm_us_ = start_us;
+    if (codec_->output_enabled() && codec_->amplifier_enabled()) {
+        return;
+    }
+    codec_->EnableOutput(true);
+    codec_->EnableAmplifier(true);
+
+    uint32_t wake_us = esp_timer_get_time() - start_us;
+    last_wake_us_ = wake_us;
+    max_wake_us_ = std::max<uint32_t>(max_wake_us_, wake_us);
+    ESP_LOGI(TAG, "Output woke in %lu us, slowest %lu us", wake_us, max_wake_us_.load());
+}
+
+void CodecPowerManager::OnOutputIdle(int64_t idle_ms, bool device_idle) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // A prewarm counts as output, the audio it announced may still be on its way
+    int64_t since_prewarm_ms = (esp_timer_get_time() - prewarm_us_) / 1000;
+    idle_ms = std::min(idle_ms, since_prewarm_ms);
+
+    if (codec_->amplifier_enabled() && idle_ms >= CONFIG_CODEC_AMPLIFIER_IDLE_MS) {
+        codec_->EnableAmplifier(false);
+    }
+    if (device_idle && codec_->output_enabled() && idle_ms >= CONFIG_CODEC_OUTPUT_IDLE_SECONDS * 1000LL) {
+        codec_->EnableOutput(false);
+    }
+}
+
+void CodecPowerManager::OnInputDemand(bool needed) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (needed) {
+        input_idle_since_us_ = 0;
+        if (!codec_->input_enabled()) {
+            int64_t start_us = esp_timer_get_time();
+            codec_->EnableInput(true);
+            ESP_LOGI(TAG, "Input woke in %lu us", (uint32_t)(esp_timer_get_time() - start_us));
+        }
+        return;
+    }
+    int64_t now_us = esp_timer_get_time();
+    if (input_idle_since_us_ == 0) {
+        input_idle_since_us_ = now_us;
+    } else if (codec_->input_enabled() && now_us - input_idle_since_us_ >= CODEC_POWER_INPUT_IDLE_MS * 1000LL) {
+        codec_->EnableInput(false);
+    }
+}
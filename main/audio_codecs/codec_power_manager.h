@@ -0,0 +1,50 @@
+#ifndef _CODEC_POWER_MANAGER_H
+#define _CODEC_POWER_MANAGER_H
+
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+#include "audio_codec.h"
+
+// The ADC goes down once nothing has read the input for this long
+#define CODEC_POWER_INPUT_IDLE_MS 2000
+
+/*
+ * Powers the codec stages down one by one as the audio they serve goes idle.
+ *
+ * The amplifier draws the most and wakes fastest, so it goes first, after
+ * CONFIG_CODEC_AMPLIFIER_IDLE_MS without output. The DAC follows after
+ * CONFIG_CODEC_OUTPUT_IDLE_SECONDS, and only in the idle state. The ADC
+ * goes down when no consumer reads the input (no wake word, no
+ * conversation), and once both directions are down AudioCodec stops the I2S
+ * clocks. The first frame brings the amplifier back by itself. Prewarm()
+ * ("tts start") brings the whole output up before the first frame is even
+ * decoded, and measures how long that takes.
+ */
+class CodecPowerManager {
+public:
+    explicit CodecPowerManager(AudioCodec* codec);
+
+    // Playback is imminent, bring the output up now so the first syllable is not cut
+    void Prewarm();
+    // From the audio loop while there is nothing to play, idle_ms is the time since the last frame
+    void OnOutputIdle(int64_t idle_ms, bool device_idle);
+    // From the audio loop on every pass, whether anything wants to read the input
+    void OnInputDemand(bool needed);
+
+    // Time the last and the slowest wake-up of the output took
+    inline uint32_t last_wake_us() const { return last_wake_us_; }
+    inline uint32_t max_wake_us() const { return max_wake_us_; }
+
+private:
+    AudioCodec* codec_;
+    // Prewarm runs on the network thread, the rest on the audio loop
+    std::mutex mutex_;
+    std::atomic<int64_t> prewarm_us_{0};
+    int64_t input_idle_since_us_ = 0;
+    std::atomic<uint32_t> last_wake_us_{0};
+    std::atomic<uint32_t> max_wake_us_{0};
+};
+
+#endif // _CODEC_POWER_MANAGER_H
@@ -15,171 +15,21 @@ Es8311AudioCodec::Es8311AudioCodec(void* i2c_master_handle, i2c_port_t i2c_port,
     pa_pin_ = pa_pin;
     pa_inverted_ = pa_inverted;
 
-    assert(input_sample_rate_ == output_sample_rate_);
     CreateDuplexChannels(mclk, bclk, ws, dout, din);
-
-    // Do initialize of related interface: data_if, ctrl_if and gpio_if
-    audio_codec_i2s_cfg_t i2s_cfg = {
-        .port = I2S_NUM_0,
-        .rx_handle = rx_handle_,
-        .tx_handle = tx_handle_,
-    };
-    data_if_ = audio_codec_new_i2s_data(&i2s_cfg);
-    assert(data_if_ != NULL);
-
-    // Output
-    audio_codec_i2c_cfg_t i2c_cfg = {
-        .port = i2c_port,
-        .addr = es8311_addr,
-        .bus_handle = i2c_master_handle,
-    };
-    ctrl_if_ = audio_codec_new_i2c_ctrl(&i2c_cfg);
-    assert(ctrl_if_ != NULL);
-
-    gpio_if_ = audio_codec_new_gpio();
-    assert(gpio_if_ != NULL);
+    CreateInterfaces();
 
     es8311_codec_cfg_t es8311_cfg = {};
-    es8311_cfg.ctrl_if = ctrl_if_;
-    es8311_cfg.gpio_if = gpio_if_;
+    es8311_cfg.ctrl_if = CreateI2cControl(i2c_master_handle, i2c_port, es8311_addr);
+    es8311_cfg.gpio_if = gpio_if();
     es8311_cfg.codec_mode = ESP_CODEC_DEV_WORK_MODE_BOTH;
     es8311_cfg.pa_pin = pa_pin;
     es8311_cfg.use_mclk = use_mclk;
     es8311_cfg.hw_gain.pa_voltage = 5.0;
     es8311_cfg.hw_gain.codec_dac_voltage = 3.3;
     es8311_cfg.pa_reverted = pa_inverted_;
-    codec_if_ = es8311_codec_new(&es8311_cfg);
-    assert(codec_if_ != NULL);
+    auto codec_if = es8311_codec_new(&es8311_cfg);
+    // ADC and DAC power up together, one device stays open while either direction is in use
+    CreateDevices(codec_if, codec_if, kSharedDevice);
 
     ESP_LOGI(TAG, "Es8311AudioCodec initialized");
 }
-
-Es8311AudioCodec::~Es8311AudioCodec() {
-    esp_codec_dev_delete(dev_);
-
-    audio_codec_delete_codec_if(codec_if_);
-    audio_codec_delete_ctrl_if(ctrl_if_);
-    audio_codec_delete_gpio_if(gpio_if_);
-    audio_codec_delete_data_if(data_if_);
-}
-
-void Es8311AudioCodec::UpdateDeviceState() {
-    if ((input_enabled_ || output_enabled_) && dev_ == nullptr) {
-        esp_codec_dev_cfg_t dev_cfg = {
-            .dev_type = ESP_CODEC_DEV_TYPE_IN_OUT,
-            .codec_if = codec_if_,
-            .data_if = data_if_,
-        };
-        dev_ = esp_codec_dev_new(&dev_cfg);
-        assert(dev_ != NULL);
-
-        esp_codec_dev_sample_info_t fs = {
-            .bits_per_sample = 16,
-            .channel = 1,
-            .channel_mask = 0,
-            .sample_rate = (uint32_t)input_sample_rate_,
-            .mclk_multiple = 0,
-        };
-        ESP_ERROR_CHECK(esp_codec_dev_open(dev_, &fs));
-        ESP_ERROR_CHECK(esp_codec_dev_set_in_gain(dev_, AUDIO_CODEC_DEFAULT_MIC_GAIN));
-        ESP_ERROR_CHECK(esp_codec_dev_set_out_vol(dev_, output_volume_));
-    } else if (!input_enabled_ && !output_enabled_ && dev_ != nullptr) {
-        esp_codec_dev_close(dev_);
-        dev_ = nullptr;
-    }
-    if (pa_pin_ != GPIO_NUM_NC) {
-        int level = output_enabled_ ? 1 : 0;
-        gpio_set_level(pa_pin_, pa_inverted_ ? !level : level);
-    }
-}
-
-void Es8311AudioCodec::CreateDuplexChannels(gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din) {
-    assert(input_sample_rate_ == output_sample_rate_);
-
-    i2s_chan_config_t chan_cfg = {
-        .id = I2S_NUM_0,
-        .role = I2S_ROLE_MASTER,
-        .dma_desc_num = AUDIO_CODEC_DMA_DESC_NUM,
-        .dma_frame_num = AUDIO_CODEC_DMA_FRAME_NUM,
-        .auto_clear_after_cb = true,
-        .auto_clear_before_cb = false,
-        .intr_priority = 0,
-    };
-    ESP_ERROR_CHECK(i2s_new_channel(&chan_cfg, &tx_handle_, &rx_handle_));
-
-    i2s_std_config_t std_cfg = {
-        .clk_cfg = {
-            .sample_rate_hz = (uint32_t)output_sample_rate_,
-            .clk_src = I2S_CLK_SRC_DEFAULT,
-            .mclk_multiple = I2S_MCLK_MULTIPLE_256,
-			#ifdef   I2S_HW_VERSION_2    
-				.ext_clk_freq_hz = 0,
-			#endif
-        },
-        .slot_cfg = {
-            .data_bit_width = I2S_DATA_BIT_WIDTH_16BIT,
-            .slot_bit_width = I2S_SLOT_BIT_WIDTH_AUTO,
-            .slot_mode = I2S_SLOT_MODE_STEREO,
-            .slot_mask = I2S_STD_SLOT_BOTH,
-            .ws_width = I2S_DATA_BIT_WIDTH_16BIT,
-            .ws_pol = false,
-            .bit_shift = true,
-            #ifdef   I2S_HW_VERSION_2   
-                .left_align = true,
-                .big_endian = false,
-                .bit_order_lsb = false
-            #endif
-        },
-        .gpio_cfg = {
-            .mclk = mclk,
-            .bclk = bclk,
-            .ws = ws,
-            .dout = dout,
-            .din = din,
-            .invert_flags = {
-                .mclk_inv = false,
-                .bclk_inv = false,
-                .ws_inv = false
-            }
-        }
-    };
-
-    ESP_ERROR_CHECK(i2s_channel_init_std_mode(tx_handle_, &std_cfg));
-    ESP_ERROR_CHECK(i2s_channel_init_std_mode(rx_handle_, &std_cfg));
-    ESP_LOGI(TAG, "Duplex channels created");
-}
-
-void Es8311AudioCodec::SetOutputVolume(int volume) {
-    ESP_ERROR_CHECK(esp_codec_dev_set_out_vol(dev_, volume));
-    AudioCodec::SetOutputVolume(volume);
-}
-
-void Es8311AudioCodec::EnableInput(bool enable) {
-    if (enable == input_enabled_) {
-        return;
-    }
-    AudioCodec::EnableInput(enable);
-    UpdateDeviceState();
-}
-
-void Es8311AudioCodec::EnableOutput(bool enable) {
-    if (enable == output_enabled_) {
-        return;
-    }
-    AudioCodec::EnableOutput(enable);
-    UpdateDeviceState();
-}
-
-int Es8311AudioCodec::Read(int16_t* dest, int samples) {
-    if (input_enabled_) {
-        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_read(dev_, (void*)dest, samples * sizeof(int16_t)));
-    }
-    return samples;
-}
-
-int Es8311AudioCodec::Write(const int16_t* data, int samples) {
-    if (output_enabled_) {
-        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_write(dev_, (void*)data, samples * sizeof(int16_t)));
-    }
-    return samples;
-}
\ No newline at end of file
@@ -4,6 +4,11 @@
 
 #define TAG "Es8388AudioCodec"
 
+// Analog output volume to 0dB, the driver leaves them at -45dB: HP_LVOL, HP_RVOL, SPK_LVOL, SPK_RVOL
+static const EspCodecDevAudioCodec::RegisterWrite kOutputRegisters[] = {
+    {46, 30}, {47, 30}, {48, 30}, {49, 30},
+};
+
 Es8388AudioCodec::Es8388AudioCodec(void* i2c_master_handle, i2c_port_t i2c_port, int input_sample_rate, int output_sample_rate,
     gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din,
     gpio_num_t pa_pin, uint8_t es8388_addr) {
@@ -12,194 +17,31 @@ Es8388AudioCodec::Es8388AudioCodec(void* i2c_master_handle, i2c_port_t i2c_port,
     input_channels_ = 1; // 输入通道数
     input_sample_rate_ = input_sample_rate;
     output_sample_rate_ = output_sample_rate;
-    pa_pin_ = pa_pin;                                                                                                                                                                                     CreateDuplexChannels(mclk, bclk, ws, dout, din);
-
-    // Do initialize of related interface: data_if, ctrl_if and gpio_if
-    audio_codec_i2s_cfg_t i2s_cfg = {
-        .port = I2S_NUM_0,
-        .rx_handle = rx_handle_,
-        .tx_handle = tx_handle_,
-    };
-    data_if_ = audio_codec_new_i2s_data(&i2s_cfg);
-    assert(data_if_ != NULL);
-
-    // Output
-    audio_codec_i2c_cfg_t i2c_cfg = {
-        .port = i2c_port,
-        .addr = es8388_addr,
-        .bus_handle = i2c_master_handle,
-    };
-    ctrl_if_ = audio_codec_new_i2c_ctrl(&i2c_cfg);
-    assert(ctrl_if_ != NULL);
+#if CONFIG_USE_STEREO_AUDIO_OUTPUT
+    output_channels_ = 2; // LOUT 与 ROUT 分别输出左右声道
+#endif
+    pa_pin_ = pa_pin;
+    input_gain_ = 24.0;
 
-    gpio_if_ = audio_codec_new_gpio();
-    assert(gpio_if_ != NULL);
+    CreateDuplexChannels(mclk, bclk, ws, dout, din);
+    CreateInterfaces();
 
+    ctrl_if_ = CreateI2cControl(i2c_master_handle, i2c_port, es8388_addr);
     es8388_codec_cfg_t es8388_cfg = {};
     es8388_cfg.ctrl_if = ctrl_if_;
-    es8388_cfg.gpio_if = gpio_if_;
+    es8388_cfg.gpio_if = gpio_if();
     es8388_cfg.codec_mode = ESP_CODEC_DEV_WORK_MODE_BOTH;
     es8388_cfg.master_mode = true;
     es8388_cfg.pa_pin = pa_pin;
     es8388_cfg.pa_reverted = false;
     es8388_cfg.hw_gain.pa_voltage = 5.0;
     es8388_cfg.hw_gain.codec_dac_voltage = 3.3;
-    codec_if_ = es8388_codec_new(&es8388_cfg);
-    assert(codec_if_ != NULL);
+    auto codec_if = es8388_codec_new(&es8388_cfg);
+    CreateDevices(codec_if, codec_if);
 
-    esp_codec_dev_cfg_t outdev_cfg = {
-        .dev_type = ESP_CODEC_DEV_TYPE_OUT,
-        .codec_if = codec_if_,
-        .data_if = data_if_,
-    };
-    output_dev_ = esp_codec_dev_new(&outdev_cfg);
-    assert(output_dev_ != NULL);
-
-    esp_codec_dev_cfg_t indev_cfg = {
-        .dev_type = ESP_CODEC_DEV_TYPE_IN,
-        .codec_if = codec_if_,
-        .data_if = data_if_,
-    };
-    input_dev_ = esp_codec_dev_new(&indev_cfg);
-    assert(input_dev_ != NULL);
-    esp_codec_set_disable_when_closed(output_dev_, false);
-    esp_codec_set_disable_when_closed(input_dev_, false);
     ESP_LOGI(TAG, "Es8388AudioCodec initialized");
 }
 
-Es8388AudioCodec::~Es8388AudioCodec() {
-    ESP_ERROR_CHECK(esp_codec_dev_close(output_dev_));
-    esp_codec_dev_delete(output_dev_);
-    ESP_ERROR_CHECK(esp_codec_dev_close(input_dev_));
-    esp_codec_dev_delete(input_dev_);
-
-    audio_codec_delete_codec_if(codec_if_);
-    audio_codec_delete_ctrl_if(ctrl_if_);
-    audio_codec_delete_gpio_if(gpio_if_);
-    audio_codec_delete_data_if(data_if_);
-}
-
-void Es8388AudioCodec::CreateDuplexChannels(gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din){
-    assert(input_sample_rate_ == output_sample_rate_);
-
-    i2s_chan_config_t chan_cfg = {
-        .id = I2S_NUM_0,
-        .role = I2S_ROLE_MASTER,
-        .dma_desc_num = AUDIO_CODEC_DMA_DESC_NUM,
-        .dma_frame_num = AUDIO_CODEC_DMA_FRAME_NUM,
-        .auto_clear_after_cb = true,
-        .auto_clear_before_cb = false,
-        .intr_priority = 0,
-    };
-    ESP_ERROR_CHECK(i2s_new_channel(&chan_cfg, &tx_handle_, &rx_handle_));
-
-    i2s_std_config_t std_cfg = {
-        .clk_cfg = {
-            .sample_rate_hz = (uint32_t)output_sample_rate_,
-            .clk_src = I2S_CLK_SRC_DEFAULT,
-            .ext_clk_freq_hz = 0,
-            .mclk_multiple = I2S_MCLK_MULTIPLE_256
-        },
-        .slot_cfg = {
-            .data_bit_width = I2S_DATA_BIT_WIDTH_16BIT,
-            .slot_bit_width = I2S_SLOT_BIT_WIDTH_AUTO,
-            .slot_mode = I2S_SLOT_MODE_STEREO,
-            .slot_mask = I2S_STD_SLOT_BOTH,
-            .ws_width = I2S_DATA_BIT_WIDTH_16BIT,
-            .ws_pol = false,
-            .bit_shift = true,
-            .left_align = true,
-            .big_endian = false,
-            .bit_order_lsb = false
-        },
-        .gpio_cfg = {
-            .mclk = mclk,
-            .bclk = bclk,
-            .ws = ws,
-            .dout = dout,
-            .din = din,
-            .invert_flags = {
-                .mclk_inv = false,
-                .bclk_inv = false,
-                .ws_inv = false
-            }
-        }
-    };
-
-    ESP_ERROR_CHECK(i2s_channel_init_std_mode(tx_handle_, &std_cfg));
-    ESP_ERROR_CHECK(i2s_channel_init_std_mode(rx_handle_, &std_cfg));
-    ESP_LOGI(TAG, "Duplex channels created");
-}
-
-void Es8388AudioCodec::SetOutputVolume(int volume) {
-    ESP_ERROR_CHECK(esp_codec_dev_set_out_vol(output_dev_, volume));
-    AudioCodec::SetOutputVolume(volume);
-}
-
-void Es8388AudioCodec::EnableInput(bool enable) {
-    if (enable == input_enabled_) {
-        return;
-    }
-    if (enable) {
-        esp_codec_dev_sample_info_t fs = {
-            .bits_per_sample = 16,
-            .channel = 1,
-            .channel_mask = 0,
-            .sample_rate = (uint32_t)input_sample_rate_,
-            .mclk_multiple = 0,
-        };
-        ESP_ERROR_CHECK(esp_codec_dev_open(input_dev_, &fs));
-        ESP_ERROR_CHECK(esp_codec_dev_set_in_gain(input_dev_, 24.0));
-    } else {
-        ESP_ERROR_CHECK(esp_codec_dev_close(input_dev_));
-    }
-    AudioCodec::EnableInput(enable);
-}
-
-void Es8388AudioCodec::EnableOutput(bool enable) {
-    if (enable == output_enabled_) {
-        return;
-    }
-    if (enable) {
-        esp_codec_dev_sample_info_t fs = {
-            .bits_per_sample = 16,
-            .channel = 1,
-            .channel_mask = 0,
-            .sample_rate = (uint32_t)output_sample_rate_,
-            .mclk_multiple = 0,
-        };
-        ESP_ERROR_CHECK(esp_codec_dev_open(output_dev_, &fs));
-        ESP_ERROR_CHECK(esp_codec_dev_set_out_vol(output_dev_, output_volume_));
-
-        // Set analog output volume to 0dB, default is -45dB
-        uint8_t reg_val = 30; // 0dB
-        uint8_t regs[] = { 46, 47, 48, 49 }; // HP_LVOL, HP_RVOL, SPK_LVOL, SPK_RVOL
-        for (uint8_t reg : regs) {
-            ctrl_if_->write_reg(ctrl_if_, reg, 1, &reg_val, 1);
-        }
-
-        if (pa_pin_ != GPIO_NUM_NC) {
-            gpio_set_level(pa_pin_, 1);
-        }
-    } else {
-        ESP_ERROR_CHECK(esp_codec_dev_close(output_dev_));
-        if (pa_pin_ != GPIO_NUM_NC) {
-            gpio_set_level(pa_pin_, 0);
-        }
-    }
-    AudioCodec::EnableOutput(enable);
-}
-
-int Es8388AudioCodec::Read(int16_t* dest, int samples) {
-    if (input_enabled_) {
-        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_read(input_dev_, (void*)dest, samples * sizeof(int16_t)));
-    }
-    return samples;
-}
-
-int Es8388AudioCodec::Write(const int16_t* data, int samples) {
-    if (output_enabled_) {
-        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_write(output_dev_, (void*)data, samples * sizeof(int16_t)));
-    }
-    return samples;
+void Es8388AudioCodec::OnOutputOpened() {
+    WriteRegisters(ctrl_if_, kOutputRegisters, sizeof(kOutputRegisters) / sizeof(kOutputRegisters[0]));
 }
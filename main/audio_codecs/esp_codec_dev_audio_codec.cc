@@ -0,0 +1,270 @@
+#include "esp_codec_dev_audio_codec.h"
+
+#include <esp_log.h>
+
+#define TAG "EspCodecDevAudioCodec"
+
+EspCodecDevAudioCodec::~EspCodecDevAudioCodec() {
+    if (input_dev_ != nullptr && input_dev_ != output_dev_) {
+        esp_codec_dev_close(input_dev_);
+        esp_codec_dev_delete(input_dev_);
+    }
+    if (output_dev_ != nullptr) {
+        esp_codec_dev_close(output_dev_);
+        esp_codec_dev_delete(output_dev_);
+    }
+    for (auto codec_if : codec_ifs_) {
+        audio_codec_delete_codec_if(codec_if);
+    }
+    for (auto ctrl_if : ctrl_ifs_) {
+        audio_codec_delete_ctrl_if(ctrl_if);
+    }
+    if (gpio_if_ != nullptr) {
+        audio_codec_delete_gpio_if(gpio_if_);
+    }
+    if (data_if_ != nullptr) {
+        audio_codec_delete_data_if(data_if_);
+    }
+}
+
+void EspCodecDevAudioCodec::CreateDuplexChannels(gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din) {
+    assert(input_sample_rate_ == output_sample_rate_);
+
+    i2s_chan_config_t chan_cfg = {
+        .id = I2S_NUM_0,
+        .role = I2S_ROLE_MASTER,
+        .dma_desc_num = AUDIO_CODEC_DMA_DESC_NUM,
+        .dma_frame_num = AUDIO_CODEC_DMA_FRAME_NUM,
+        .auto_clear_after_cb = true,
+        .auto_clear_before_cb = false,
+        .intr_priority = 0,
+    };
+    ESP_ERROR_CHECK(i2s_new_channel(&chan_cfg, &tx_handle_, &rx_handle_));
+
+    i2s_std_config_t std_cfg = {
+        .clk_cfg = {
+            .sample_rate_hz = (uint32_t)output_sample_rate_,
+            .clk_src = I2S_CLK_SRC_DEFAULT,
+            .mclk_multiple = I2S_MCLK_MULTIPLE_256,
+			#ifdef   I2S_HW_VERSION_2    
+				.ext_clk_freq_hz = 0,
+			#endif
+        },
+        .slot_cfg = {
+            .data_bit_width = I2S_DATA_BIT_WIDTH_16BIT,
+            .slot_bit_width = I2S_SLOT_BIT_WIDTH_AUTO,
+            .slot_mode = I2S_SLOT_MODE_STEREO,
+            .slot_mask = I2S_STD_SLOT_BOTH,
+            .ws_width = I2S_DATA_BIT_WIDTH_16BIT,
+            .ws_pol = false,
+            .bit_shift = true,
+            #ifdef   I2S_HW_VERSION_2   
+                .left_align = true,
+                .big_endian = false,
+                .bit_order_lsb = false
+            #endif
+        },
+        .gpio_cfg = {
+            .mclk = mclk,
+            .bclk = bclk,
+            .ws = ws,
+            .dout = dout,
+            .din = din,
+            .invert_flags = {
+                .mclk_inv = false,
+                .bclk_inv = false,
+                .ws_inv = false
+            }
+        }
+    };
+
+    ESP_ERROR_CHECK(i2s_channel_init_std_mode(tx_handle_, &std_cfg));
+    ESP_ERROR_CHECK(i2s_channel_init_std_mode(rx_handle_, &std_cfg));
+    ESP_LOGI(TAG, "Duplex channels created");
+}
+
+void EspCodecDevAudioCodec::CreateInterfaces() {
+    audio_codec_i2s_cfg_t i2s_cfg = {
+        .port = I2S_NUM_0,
+        .rx_handle = rx_handle_,
+        .tx_handle = tx_handle_,
+    };
+    data_if_ = audio_codec_new_i2s_data(&i2s_cfg);
+    assert(data_if_ != NULL);
+
+    gpio_if_ = audio_codec_new_gpio();
+    assert(gpio_if_ != NULL);
+}
+
+const audio_codec_ctrl_if_t* EspCodecDevAudioCodec::CreateI2cControl(void* i2c_master_handle, i2c_port_t i2c_port, uint8_t addr) {
+    audio_codec_i2c_cfg_t i2c_cfg = {
+        .port = i2c_port,
+        .addr = addr,
+        .bus_handle = i2c_master_handle,
+    };
+    auto ctrl_if = audio_codec_new_i2c_ctrl(&i2c_cfg);
+    assert(ctrl_if != NULL);
+    ctrl_ifs_.push_back(ctrl_if);
+    return ctrl_if;
+}
+
+void EspCodecDevAudioCodec::CreateDevices(const audio_codec_if_t* output_codec, const audio_codec_if_t* input_codec,
+    DeviceLayout layout) {
+    assert(output_codec != NULL && input_codec != NULL);
+    codec_ifs_.push_back(output_codec);
+    if (input_codec != output_codec) {
+        codec_ifs_.push_back(input_codec);
+    }
+
+    esp_codec_dev_cfg_t dev_cfg = {
+        .dev_type = ESP_CODEC_DEV_TYPE_OUT,
+        .codec_if = output_codec,
+        .data_if = data_if_,
+    };
+    if (layout == kSharedDevice) {
+        assert(input_codec == output_codec);
+        shared_device_ = true;
+        dev_cfg.dev_type = ESP_CODEC_DEV_TYPE_IN_OUT;
+        output_dev_ = esp_codec_dev_new(&dev_cfg);
+        assert(output_dev_ != NULL);
+        input_dev_ = output_dev_;
+        return;
+    }
+
+    output_dev_ = esp_codec_dev_new(&dev_cfg);
+    assert(output_dev_ != NULL);
+    dev_cfg.dev_type = ESP_CODEC_DEV_TYPE_IN;
+    dev_cfg.codec_if = input_codec;
+    input_dev_ = esp_codec_dev_new(&dev_cfg);
+    assert(input_dev_ != NULL);
+    if (input_codec == output_codec) {
+        // Closing one direction must not power down the chip under the other
+        esp_codec_set_disable_when_closed(output_dev_, false);
+        esp_codec_set_disable_when_closed(input_dev_, false);
+    }
+}
+
+void EspCodecDevAudioCodec::WriteRegisters(const audio_codec_ctrl_if_t* ctrl_if, const RegisterWrite* writes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int reg = writes[i].reg;
+        uint8_t value = writes[i].value;
+        if (ctrl_if->write_reg(ctrl_if, reg, 1, &value, 1) != 0) {
+            ESP_LOGW(TAG, "Failed to write register %d", reg);
+        }
+    }
+}
+
+void EspCodecDevAudioCodec::SetOutputVolume(int volume) {
+    ESP_ERROR_CHECK(esp_codec_dev_set_out_vol(output_dev_, volume));
+    AudioCodec::SetOutputVolume(volume);
+}
+
+void EspCodecDevAudioCodec::OpenInput() {
+    esp_codec_dev_sample_info_t fs = {
+        .bits_per_sample = 16,
+        .channel = input_device_channels_,
+        .channel_mask = input_channel_mask_,
+        .sample_rate = (uint32_t)input_sample_rate_,
+        .mclk_multiple = 0,
+    };
+    ESP_ERROR_CHECK(esp_codec_dev_open(input_dev_, &fs));
+    if (input_gain_mask_ != 0) {
+        ESP_ERROR_CHECK(esp_codec_dev_set_in_channel_gain(input_dev_, input_gain_mask_, input_gain_));
+    } else {
+        ESP_ERROR_CHECK(esp_codec_dev_set_in_gain(input_dev_, input_gain_));
+    }
+}
+
+void EspCodecDevAudioCodec::OpenOutput() {
+    // Play 16bit, interleaved when the codec drives two outputs
+    esp_codec_dev_sample_info_t fs = {
+        .bits_per_sample = 16,
+        .channel = (uint8_t)output_channels_,
+        .channel_mask = 0,
+        .sample_rate = (uint32_t)output_sample_rate_,
+        .mclk_multiple = 0,
+    };
+    ESP_ERROR_CHECK(esp_codec_dev_open(output_dev_, &fs));
+    ESP_ERROR_CHECK(esp_codec_dev_set_out_vol(output_dev_, output_volume_));
+    OnOutputOpened();
+}
+
+void EspCodecDevAudioCodec::UpdateSharedDevice() {
+    if ((input_enabled_ || output_enabled_) && !shared_device_open_) {
+        // One stream for both directions, the rates are the same
+        OpenInput();
+        ESP_ERROR_CHECK(esp_codec_dev_set_out_vol(output_dev_, output_volume_));
+        OnOutputOpened();
+        shared_device_open_ = true;
+    } else if (!input_enabled_ && !output_enabled_ && shared_device_open_) {
+        esp_codec_dev_close(output_dev_);
+        shared_device_open_ = false;
+    }
+    SetAmplifierPin(output_enabled_ && amplifier_enabled_);
+}
+
+void EspCodecDevAudioCodec::SetAmplifierPin(bool on) {
+    if (pa_pin_ != GPIO_NUM_NC) {
+        gpio_set_level(pa_pin_, pa_inverted_ ? !on : on);
+    }
+}
+
+void EspCodecDevAudioCodec::EnableInput(bool enable) {
+    if (enable == input_enabled_) {
+        return;
+    }
+    if (shared_device_) {
+        AudioCodec::EnableInput(enable);
+        UpdateSharedDevice();
+        return;
+    }
+    if (enable) {
+        OpenInput();
+    } else {
+        ESP_ERROR_CHECK(esp_codec_dev_close(input_dev_));
+    }
+    AudioCodec::EnableInput(enable);
+}
+
+void EspCodecDevAudioCodec::EnableOutput(bool enable) {
+    if (enable == output_enabled_) {
+        return;
+    }
+    if (shared_device_) {
+        AudioCodec::EnableOutput(enable);
+        UpdateSharedDevice();
+        return;
+    }
+    if (enable) {
+        OpenOutput();
+        SetAmplifierPin(amplifier_enabled_);
+    } else {
+        ESP_ERROR_CHECK(esp_codec_dev_close(output_dev_));
+        SetAmplifierPin(false);
+    }
+    AudioCodec::EnableOutput(enable);
+}
+
+void EspCodecDevAudioCodec::EnableAmplifier(bool enable) {
+    if (enable == amplifier_enabled_) {
+        return;
+    }
+    AudioCodec::EnableAmplifier(enable);
+    if (output_enabled_) {
+        SetAmplifierPin(enable);
+    }
+}
+
+int EspCodecDevAudioCodec::Read(int16_t* dest, int samples) {
+    if (input_enabled_) {
+        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_read(input_dev_, (void*)dest, samples * sizeof(int16_t)));
+    }
+    return samples;
+}
+
+int EspCodecDevAudioCodec::Write(const int16_t* data, int samples) {
+    if (output_enabled_) {
+        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_write(output_dev_, (void*)data, samples * sizeof(int16_t)));
+    }
+    return samples;
+}
@@ -0,0 +1,93 @@
+#ifndef _ESP_CODEC_DEV_AUDIO_CODEC_H
+#define _ESP_CODEC_DEV_AUDIO_CODEC_H
+
+#include "audio_codec.h"
+
+#include <driver/i2c_master.h>
+#include <driver/gpio.h>
+#include <esp_codec_dev.h>
+#include <esp_codec_dev_defaults.h>
+
+#include <vector>
+
+/*
+ * Common base of the codecs driven through esp_codec_dev.
+ *
+ * A concrete codec only describes its chip: it creates the I2S channels,
+ * builds the driver configuration of its ADC and DAC from the interfaces
+ * made here, and sets the stream formats below. Opening and closing the
+ * devices, volume, gain, the amplifier pin and the PCM path are shared.
+ * Read() and Write() hand the caller's buffer straight to esp_codec_dev,
+ * which copies it into the I2S DMA buffers without another staging copy.
+ *
+ * A chip with ADC and DAC in one, that cannot power them separately, uses
+ * a single device that stays open while either direction is enabled.
+ */
+class EspCodecDevAudioCodec : public AudioCodec {
+public:
+    struct RegisterWrite {
+        uint8_t reg;
+        uint8_t value;
+    };
+
+    virtual ~EspCodecDevAudioCodec();
+
+    virtual void SetOutputVolume(int volume) override;
+    virtual void EnableInput(bool enable) override;
+    virtual void EnableOutput(bool enable) override;
+    virtual void EnableAmplifier(bool enable) override;
+
+protected:
+    enum DeviceLayout {
+        kSeparateDevices,
+        kSharedDevice,
+    };
+
+    EspCodecDevAudioCodec() = default;
+
+    // 16-bit stereo standard mode on I2S_NUM_0, TX and RX share the clock
+    void CreateDuplexChannels(gpio_num_t mclk, gpio_num_t bclk, gpio_num_t ws, gpio_num_t dout, gpio_num_t din);
+    // Once the channels exist: the data and GPIO interfaces every codec driver needs
+    void CreateInterfaces();
+    const audio_codec_ctrl_if_t* CreateI2cControl(void* i2c_master_handle, i2c_port_t i2c_port, uint8_t addr);
+    // Takes ownership of the codec interfaces, pass the same one twice for a chip with ADC and DAC in one
+    void CreateDevices(const audio_codec_if_t* output_codec, const audio_codec_if_t* input_codec,
+        DeviceLayout layout = kSeparateDevices);
+    // Registers the driver leaves alone, written in one pass
+    void WriteRegisters(const audio_codec_ctrl_if_t* ctrl_if, const RegisterWrite* writes, size_t count);
+    // After the output device has been opened, for chips that need registers the driver does not set
+    virtual void OnOutputOpened() {}
+
+    inline const audio_codec_data_if_t* data_if() const { return data_if_; }
+    inline const audio_codec_gpio_if_t* gpio_if() const { return gpio_if_; }
+
+    gpio_num_t pa_pin_ = GPIO_NUM_NC;
+    bool pa_inverted_ = false;
+    // The input stream opened on the device, Read() returns these channels interleaved
+    uint8_t input_device_channels_ = 1;
+    uint16_t input_channel_mask_ = 0;
+    // Channels the microphone gain applies to, 0 for all of them
+    uint16_t input_gain_mask_ = 0;
+    float input_gain_ = AUDIO_CODEC_DEFAULT_MIC_GAIN;
+
+    esp_codec_dev_handle_t output_dev_ = nullptr;
+    esp_codec_dev_handle_t input_dev_ = nullptr;
+
+private:
+    const audio_codec_data_if_t* data_if_ = nullptr;
+    const audio_codec_gpio_if_t* gpio_if_ = nullptr;
+    std::vector<const audio_codec_ctrl_if_t*> ctrl_ifs_;
+    std::vector<const audio_codec_if_t*> codec_ifs_;
+    bool shared_device_ = false;
+    bool shared_device_open_ = false;
+
+    void OpenInput();
+    void OpenOutput();
+    void UpdateSharedDevice();
+    void SetAmplifierPin(bool on);
+
+    virtual int Read(int16_t* dest, int samples) override;
+    virtual int Write(const int16_t* data, int samples) override;
+};
+
+#endif // _ESP_CODEC_DEV_AUDIO_CODEC_H
@@ -1,11 +1,22 @@
 #include "no_audio_codec.h"
 
 #include <esp_log.h>
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <cstring>
 
 #define TAG "NoAudioCodec"
 
+NoAudioCodec::NoAudioCodec() {
+    // There is no hardware volume control, the base class gain stage applies the volume
+    software_volume_ = true;
+#if CONFIG_USE_SOFTWARE_AEC_REFERENCE
+    input_channels_ = 2;
+    input_reference_ = true;
+#endif
+}
+
 NoAudioCodec::~NoAudioCodec() {
     if (rx_handle_ != nullptr) {
         ESP_ERROR_CHECK(i2s_channel_disable(rx_handle_));
@@ -336,59 +347,182 @@ NoAudioCodecSimplexPdm::NoAudioCodecSimplexPdm(int input_sample_rate, int output
 }
 
 int NoAudioCodec::Write(const int16_t* data, int samples) {
-    std::vector<int32_t> buffer(samples);
-
-    // output_volume_: 0-100
-    // volume_factor_: 0-65536
-    int32_t volume_factor = pow(double(output_volume_) / 100.0, 2) * 65536;
-    for (int i = 0; i < samples; i++) {
-        int64_t temp = int64_t(data[i]) * volume_factor; // 使用 int64_t 进行乘法运算
-        if (temp > INT32_MAX) {
-            buffer[i] = INT32_MAX;
-        } else if (temp < INT32_MIN) {
-            buffer[i] = INT32_MIN;
-        } else {
-            buffer[i] = static_cast<int32_t>(temp);
-        }
+    if (tx_buffer_.size() < (size_t)samples) {
+        tx_buffer_.resize(samples);
     }
 
+    // The volume is already applied by AudioCodec::ApplyOutputGain, only widen to the 32-bit slots here
+    int32_t* out = tx_buffer_.data();
+    ConvertSamples({data, SampleFormat::kInt16}, {out, SampleFormat::kInt32}, samples);
+
+#if CONFIG_USE_SOFTWARE_AEC_REFERENCE
+    StoreReference(data, samples);
+#endif
+
     size_t bytes_written;
-    ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, buffer.data(), samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
+    ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, out, samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
     return bytes_written / sizeof(int32_t);
 }
 
 int NoAudioCodec::Read(int16_t* dest, int samples) {
     size_t bytes_read;
 
-    std::vector<int32_t> bit32_buffer(samples);
-    if (i2s_channel_read(rx_handle_, bit32_buffer.data(), samples * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
+    // With the software reference only every other sample comes from the microphone
+    int frames = samples / input_channels_;
+    if (rx_buffer_.size() < (size_t)frames) {
+        rx_buffer_.resize(frames);
+    }
+    if (i2s_channel_read(rx_handle_, rx_buffer_.data(), frames * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
         ESP_LOGE(TAG, "Read Failed!");
         return 0;
     }
 
-    samples = bytes_read / sizeof(int32_t);
-    for (int i = 0; i < samples; i++) {
-        int32_t value = bit32_buffer[i] >> 12;
-        dest[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+    frames = bytes_read / sizeof(int32_t);
+    ConvertSamples({rx_buffer_.data(), SampleFormat::kInt32}, {dest, SampleFormat::kInt16, (size_t)input_channels_},
+        frames, input_gain_shift_);
+#if CONFIG_USE_SOFTWARE_AEC_REFERENCE
+    ReadReference(dest, frames);
+#endif
+    return frames * input_channels_;
+}
+
+// The speaker amplifiers on these boards take their timing from BCLK, only the I2S clock changes
+bool NoAudioCodec::ReclockOutput(int sample_rate) {
+#if CONFIG_USE_SOFTWARE_AEC_REFERENCE
+    // The reference timeline converts played frames at one fixed output rate
+    return false;
+#else
+    if (duplex_ || tx_handle_ == nullptr) {
+        // One port for both directions, the microphone would be reclocked with the speaker
+        return false;
+    }
+    // The clock can only be changed while the channel is stopped, it may already be by power gating
+    bool running = i2s_channel_disable(tx_handle_) == ESP_OK;
+    i2s_std_clk_config_t clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG((uint32_t)sample_rate);
+    esp_err_t err = i2s_channel_reconfig_std_clock(tx_handle_, &clk_cfg);
+    if (running) {
+        ESP_ERROR_CHECK(i2s_channel_enable(tx_handle_));
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to reclock the output to %d Hz: %s", sample_rate, esp_err_to_name(err));
+        return false;
+    }
+    return true;
+#endif
+}
+
+#if CONFIG_USE_SOFTWARE_AEC_REFERENCE
+void NoAudioCodec::Start() {
+    reference_.assign(NO_AUDIO_CODEC_REFERENCE_FRAMES, 0);
+    if (output_sample_rate_ != input_sample_rate_) {
+        reference_resampler_.Configure(output_sample_rate_, input_sample_rate_);
+    }
+    AudioCodec::Start();
+}
+
+uint32_t NoAudioCodec::ToInputFrames(uint64_t output_frames) const {
+    return output_frames * input_sample_rate_ / output_sample_rate_;
+}
+
+void NoAudioCodec::OnOutputBufferSent() {
+    portENTER_CRITICAL_ISR(&reference_lock_);
+    sent_frames_ += AUDIO_CODEC_DMA_FRAME_NUM;
+    pending_frames_ -= std::min<uint32_t>(pending_frames_, AUDIO_CODEC_DMA_FRAME_NUM);
+    portEXIT_CRITICAL_ISR(&reference_lock_);
+}
+
+void NoAudioCodec::FlushOutputDma() {
+    AudioCodec::FlushOutputDma();
+    // The queued audio never plays, so it is no reference either
+    portENTER_CRITICAL(&reference_lock_);
+    pending_frames_ = 0;
+    uint64_t sent = sent_frames_;
+    portEXIT_CRITICAL(&reference_lock_);
+    reference_end_.store(ToInputFrames(sent), std::memory_order_release);
+}
+
+void NoAudioCodec::StoreReference(const int16_t* data, int samples) {
+    // The frame plays once everything queued ahead of it has played
+    portENTER_CRITICAL(&reference_lock_);
+    uint64_t start = sent_frames_ + pending_frames_;
+    pending_frames_ += samples;
+    portEXIT_CRITICAL(&reference_lock_);
+
+    const uint32_t mask = NO_AUDIO_CODEC_REFERENCE_FRAMES - 1;
+    uint32_t position = ToInputFrames(start);
+    uint32_t end = reference_end_.load(std::memory_order_relaxed);
+    int32_t gap = position - end;
+    if (std::abs(gap) <= (int32_t)ToInputFrames(AUDIO_CODEC_DMA_FRAME_NUM)) {
+        // Gapless playback, continue the stream so the rounding of positions does not add clicks
+        position = end;
+    } else {
+        // The DMA ran dry and played silence in between
+        for (int32_t i = 0; i < std::min<int32_t>(gap, NO_AUDIO_CODEC_REFERENCE_FRAMES); i++) {
+            reference_[(end + i) & mask] = 0;
+        }
+        reference_resampler_.Reset();
+    }
+
+    const int16_t* input = data;
+    size_t frames = samples;
+    if (reference_resampler_.input_sample_rate() != 0) {
+        resampled_.resize(reference_resampler_.GetOutputSamples(samples));
+        frames = reference_resampler_.Process(data, samples, resampled_.data());
+        input = resampled_.data();
     }
-    return samples;
+    for (size_t i = 0; i < frames; i++) {
+        reference_[(position + i) & mask] = input[i];
+    }
+    reference_end_.store(position + frames, std::memory_order_release);
 }
 
+void NoAudioCodec::ReadReference(int16_t* dest, int frames) {
+    portENTER_CRITICAL(&reference_lock_);
+    uint64_t sent = sent_frames_;
+    portEXIT_CRITICAL(&reference_lock_);
+
+    // The DMA only counts whole buffers, one buffer back keeps the reference ahead of its echo
+    uint32_t start = ToInputFrames(sent) - ToInputFrames(AUDIO_CODEC_DMA_FRAME_NUM) - frames;
+    // Both clocks come from the same crystal, the position only jumps after a pause in reading
+    int32_t drift = start - reference_read_;
+    if (!reference_synced_ || std::abs(drift) > (int32_t)ToInputFrames(2 * AUDIO_CODEC_DMA_FRAME_NUM)) {
+        reference_read_ = start;
+        reference_synced_ = true;
+    }
+
+    const uint32_t mask = NO_AUDIO_CODEC_REFERENCE_FRAMES - 1;
+    uint32_t end = reference_end_.load(std::memory_order_acquire);
+    for (int i = 0; i < frames; i++) {
+        uint32_t position = reference_read_ + i;
+        // Positions not written yet, or written a lap ago, played silence
+        int32_t age = end - position;
+        dest[i * 2 + 1] = (age > 0 && age <= NO_AUDIO_CODEC_REFERENCE_FRAMES / 2) ? reference_[position & mask] : 0;
+    }
+    reference_read_ += frames;
+}
+#endif
+
 int NoAudioCodecSimplexPdm::Read(int16_t* dest, int samples) {
     size_t bytes_read;
 
-    // PDM 解调后的数据位宽为 16 位
-    std::vector<int16_t> bit16_buffer(samples);
-    if (i2s_channel_read(rx_handle_, bit16_buffer.data(), samples * sizeof(int16_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
+    // PDM 解调后的数据位宽为 16 位，直接读入目标缓冲区
+    int frames = samples / input_channels_;
+    if (i2s_channel_read(rx_handle_, dest, frames * sizeof(int16_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
         ESP_LOGE(TAG, "Read Failed!");
         return 0;
     }
 
     // 计算实际读取的样本数
-    samples = bytes_read / sizeof(int16_t);
-
-    // 将 16 位数据直接复制到目标缓冲区
-    memcpy(dest, bit16_buffer.data(), samples * sizeof(int16_t));
-
-    return samples;
+    frames = bytes_read / sizeof(int16_t);
+#if !SOC_I2S_SUPPORTS_PDM_RX_HP_FILTER
+    dc_filter_.Process(dest, frames);
+#endif
+#if CONFIG_USE_SOFTWARE_AEC_REFERENCE
+    // Spread the microphone to the even slots from the back, so nothing is overwritten before it moved
+    for (int i = frames - 1; i > 0; i--) {
+        dest[i * 2] = dest[i];
+    }
+    ReadReference(dest, frames);
+#endif
+    return frames * input_channels_;
 }
@@ -2,16 +2,68 @@
 #define _NO_AUDIO_CODEC_H
 
 #include "audio_codec.h"
+#include "sample_format.h"
 
 #include <driver/gpio.h>
 #include <driver/i2s_pdm.h>
 
+#if CONFIG_USE_SOFTWARE_AEC_REFERENCE
+#include "frame_resampler.h"
+
+// Reference history at the input rate, a power of two so the positions may wrap
+#define NO_AUDIO_CODEC_REFERENCE_FRAMES 4096
+#endif
+
+/*
+ * With CONFIG_USE_SOFTWARE_AEC_REFERENCE the codec has no loopback, so
+ * Write() keeps what it sends to the DAC, resampled to the input rate, on a
+ * timeline of played frames. The TX DMA counts every buffer it plays,
+ * silence included, so a written frame lands at the position where the
+ * queued audio ahead of it runs out. Read() then returns two channels, the
+ * microphone and the reference that played at the same time.
+ */
 class NoAudioCodec : public AudioCodec {
 private:
+    // Reused across calls so playback and capture never allocate per frame
+    std::vector<int32_t> tx_buffer_;
+    std::vector<int32_t> rx_buffer_;
+
     virtual int Write(const int16_t* data, int samples) override;
     virtual int Read(int16_t* dest, int samples) override;
+    virtual bool ReclockOutput(int sample_rate) override;
+
+#if CONFIG_USE_SOFTWARE_AEC_REFERENCE
+    std::vector<int16_t> reference_;
+    FrameResampler reference_resampler_;
+    std::vector<int16_t> resampled_;
+    portMUX_TYPE reference_lock_ = portMUX_INITIALIZER_UNLOCKED;
+    uint64_t sent_frames_ = 0;      // Output frames the TX DMA played, silence included
+    uint32_t pending_frames_ = 0;   // Output frames written and not played yet
+    // Input rate positions, the end is published by the output thread after the samples are in place
+    std::atomic<uint32_t> reference_end_{0};
+    uint32_t reference_read_ = 0;   // Only touched by the input thread
+    bool reference_synced_ = false;
+
+    uint32_t ToInputFrames(uint64_t output_frames) const;
+    void StoreReference(const int16_t* data, int samples);
+    void OnOutputBufferSent() override;
+    void FlushOutputDma() override;
+
+protected:
+    // Fills the odd slots of an interleaved buffer whose even slots hold the microphone
+    void ReadReference(int16_t* dest, int frames);
 
 public:
+    virtual void Start() override;
+#endif
+
+protected:
+    // Raise in 6 dB steps when narrowing the 32-bit microphone slots to 16 bits, boards with
+    // a more sensitive microphone lower it for headroom
+    int input_gain_shift_ = 4;
+
+public:
+    NoAudioCodec();
     virtual ~NoAudioCodec();
 };
 
@@ -35,6 +87,12 @@ class NoAudioCodecSimplexPdm : public NoAudioCodec {
 public:
     NoAudioCodecSimplexPdm(int input_sample_rate, int output_sample_rate, gpio_num_t spk_bclk, gpio_num_t spk_ws, gpio_num_t spk_dout, gpio_num_t mic_sck,  gpio_num_t mic_din);
     int Read(int16_t* dest, int samples);
+
+#if !SOC_I2S_SUPPORTS_PDM_RX_HP_FILTER
+private:
+    // Chips with the PDM high-pass filter remove the offset in hardware, the rest do it here
+    DcFilter dc_filter_;
+#endif
 };
 
 #endif // _NO_AUDIO_CODEC_H
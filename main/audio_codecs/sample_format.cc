@@ -0,0 +1,167 @@
+#include "sample_format.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+// Every pair gets its own loop, the format switch is paid once per call and not per sample
+template <typename Source, typename Convert>
+void ConvertTo(const Source* in, size_t in_stride, SampleView destination, size_t count, Convert convert) {
+    switch (destination.format) {
+    case SampleFormat::kInt16: {
+        auto out = (int16_t*)destination.data;
+        for (size_t i = 0; i < count; i++) {
+            int64_t value = convert(in[i * in_stride]) >> 16;
+            out[i * destination.stride] = (int16_t)std::clamp<int64_t>(value, -INT16_MAX, INT16_MAX);
+        }
+        break;
+    }
+    case SampleFormat::kInt32: {
+        auto out = (int32_t*)destination.data;
+        for (size_t i = 0; i < count; i++) {
+            int64_t value = convert(in[i * in_stride]);
+            out[i * destination.stride] = (int32_t)std::clamp<int64_t>(value, -INT32_MAX, INT32_MAX);
+        }
+        break;
+    }
+    case SampleFormat::kFloat32: {
+        auto out = (float*)destination.data;
+        for (size_t i = 0; i < count; i++) {
+            float value = convert(in[i * in_stride]) * (1.0f / 2147483648.0f);
+            out[i * destination.stride] = std::clamp(value, -1.0f, 1.0f);
+        }
+        break;
+    }
+    }
+}
+
+}
+
+// Values pass through a left aligned 64-bit intermediate, so shifts in either direction stay exact
+void ConvertSamples(ConstSampleView source, SampleView destination, size_t count, int gain_shift) {
+    if (source.format == destination.format && gain_shift == 0 && source.stride == 1 && destination.stride == 1) {
+        memmove(destination.data, source.data, count * SampleFormatBytes(source.format));
+        return;
+    }
+    // The I2S paths stay in 32-bit arithmetic, they run for every sample played or captured
+    if (source.format == SampleFormat::kInt32 && destination.format == SampleFormat::kInt16 &&
+        gain_shift <= 16 && gain_shift > -16) {
+        auto in = (const int32_t*)source.data;
+        auto out = (int16_t*)destination.data;
+        int shift = 16 - gain_shift;
+        for (size_t i = 0; i < count; i++) {
+            int32_t value = in[i * source.stride] >> shift;
+            out[i * destination.stride] = (int16_t)std::clamp<int32_t>(value, -INT16_MAX, INT16_MAX);
+        }
+        return;
+    }
+    if (source.format == SampleFormat::kInt16 && destination.format == SampleFormat::kInt32 && gain_shift == 0) {
+        auto in = (const int16_t*)source.data;
+        auto out = (int32_t*)destination.data;
+        for (size_t i = 0; i < count; i++) {
+            out[i * destination.stride] = (int32_t)in[i * source.stride] << 16;
+        }
+        return;
+    }
+
+    int up = std::max(gain_shift, 0);
+    int down = std::max(-gain_shift, 0);
+    switch (source.format) {
+    case SampleFormat::kInt16:
+        ConvertTo((const int16_t*)source.data, source.stride, destination, count,
+            [up, down](int16_t value) { return (((int64_t)value << 16) << up) >> down; });
+        break;
+    case SampleFormat::kInt32:
+        ConvertTo((const int32_t*)source.data, source.stride, destination, count,
+            [up, down](int32_t value) { return ((int64_t)value << up) >> down; });
+        break;
+    case SampleFormat::kFloat32: {
+        float scale = std::ldexp(2147483648.0f, gain_shift);
+        ConvertTo((const float*)source.data, source.stride, destination, count,
+            [scale](float value) { return (int64_t)std::llrintf(std::clamp(value * scale, -4.0e18f, 4.0e18f)); });
+        break;
+    }
+    }
+}
+
+// Unrolled by four, the loads of a group go before its stores since in place they overwrite its own source
+void UpmixMonoToStereo(const int16_t* source, int16_t* destination, size_t frames) {
+    // may_alias keeps the compiler from moving int16 loads past the frame stores
+    typedef uint32_t __attribute__((may_alias)) StereoFrame;
+    auto out = (StereoFrame*)destination;
+    size_t i = frames;
+    while (i >= 4) {
+        i -= 4;
+        uint32_t s0 = (uint16_t)source[i];
+        uint32_t s1 = (uint16_t)source[i + 1];
+        uint32_t s2 = (uint16_t)source[i + 2];
+        uint32_t s3 = (uint16_t)source[i + 3];
+        out[i + 3] = s3 * 0x00010001u;
+        out[i + 2] = s2 * 0x00010001u;
+        out[i + 1] = s1 * 0x00010001u;
+        out[i] = s0 * 0x00010001u;
+    }
+    while (i > 0) {
+        i--;
+        out[i] = (uint16_t)source[i] * 0x00010001u;
+    }
+}
+
+// A steady gain, the usual case, runs four samples per iteration without the ramp arithmetic
+void MixSamples(int16_t* destination, const int16_t* source, size_t count, int32_t gain_from, int32_t gain_to) {
+    size_t i = 0;
+    if (gain_from == gain_to) {
+        int32_t gain = gain_to;
+        for (; i + 4 <= count; i += 4) {
+            int32_t m0 = destination[i] + ((source[i] * gain) >> 15);
+            int32_t m1 = destination[i + 1] + ((source[i + 1] * gain) >> 15);
+            int32_t m2 = destination[i + 2] + ((source[i + 2] * gain) >> 15);
+            int32_t m3 = destination[i + 3] + ((source[i + 3] * gain) >> 15);
+            destination[i] = (int16_t)std::clamp<int32_t>(m0, -INT16_MAX, INT16_MAX);
+            destination[i + 1] = (int16_t)std::clamp<int32_t>(m1, -INT16_MAX, INT16_MAX);
+            destination[i + 2] = (int16_t)std::clamp<int32_t>(m2, -INT16_MAX, INT16_MAX);
+            destination[i + 3] = (int16_t)std::clamp<int32_t>(m3, -INT16_MAX, INT16_MAX);
+        }
+    }
+    // The ramp in Q15.16, exact at both ends
+    int64_t gain = ((int64_t)gain_from << 16);
+    int64_t step = count > 0 ? (int64_t)(gain_to - gain_from) * 65536 / (int64_t)count : 0;
+    gain += step * i;
+    for (; i < count; i++, gain += step) {
+        int32_t mixed = destination[i] + (int32_t)((source[i] * (gain >> 16)) >> 15);
+        destination[i] = (int16_t)std::clamp<int32_t>(mixed, -INT16_MAX, INT16_MAX);
+    }
+}
+
+void ScaleSamples(int16_t* data, size_t count, int32_t gain_from, int32_t gain_to) {
+    if (gain_from == SAMPLE_GAIN_UNITY && gain_to == SAMPLE_GAIN_UNITY) {
+        return;
+    }
+    int64_t gain = ((int64_t)gain_from << 16);
+    int64_t step = count > 0 ? (int64_t)(gain_to - gain_from) * 65536 / (int64_t)count : 0;
+    for (size_t i = 0; i < count; i++, gain += step) {
+        // Gains stay at or below unity, the product cannot overflow 16 bits
+        data[i] = (int16_t)((data[i] * (int32_t)(gain >> 16)) >> 15);
+    }
+}
+
+// y[n] = x[n] - x[n-1] + (1 - 1/256) y[n-1], integer only for the chips without an FPU
+void DcFilter::Process(int16_t* data, size_t count, size_t stride) {
+    int32_t last_input = last_input_;
+    int32_t output = output_;
+    for (size_t i = 0; i < count; i++) {
+        int32_t input = data[i * stride];
+        output += ((input - last_input) << 8) - (output >> 8);
+        last_input = input;
+        data[i * stride] = std::clamp<int32_t>(output >> 8, -INT16_MAX, INT16_MAX);
+    }
+    last_input_ = last_input;
+    output_ = output;
+}
+
+void DcFilter::Reset() {
+    last_input_ = 0;
+    output_ = 0;
+}
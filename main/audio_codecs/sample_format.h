@@ -0,0 +1,70 @@
+#ifndef _SAMPLE_FORMAT_H
+#define _SAMPLE_FORMAT_H
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Sample formats seen at the I2S and processing boundaries.
+ *
+ * All formats share one full scale: int32 samples are left aligned, so an
+ * int16 sample is the top half of its int32 value, and float samples run
+ * from -1.0 to 1.0. A 24-bit I2S microphone read as 32-bit slots is
+ * therefore already kInt32, without knowing its real resolution.
+ */
+enum class SampleFormat : uint8_t {
+    kInt16,
+    kInt32,
+    kFloat32,
+};
+
+inline size_t SampleFormatBytes(SampleFormat format) {
+    return format == SampleFormat::kInt16 ? sizeof(int16_t) : sizeof(int32_t);
+}
+
+// A strided run of samples, the stride addresses one channel of an interleaved buffer
+struct ConstSampleView {
+    const void* data;
+    SampleFormat format;
+    size_t stride = 1;
+};
+
+struct SampleView {
+    void* data;
+    SampleFormat format;
+    size_t stride = 1;
+
+    operator ConstSampleView() const { return ConstSampleView{data, format, stride}; }
+};
+
+// Converts `count` samples. `gain_shift` raises the level by 6 dB per step, or lowers it when
+// negative, in the same pass; results saturate symmetrically at the full scale of the destination
+void ConvertSamples(ConstSampleView source, SampleView destination, size_t count, int gain_shift = 0);
+
+// Duplicates a mono frame into both channels of an interleaved stereo frame, one 32-bit store per
+// output frame. Works from the end, so `destination` may be `source` resized to twice the samples.
+// `destination` must be 4-byte aligned, as the data of a std::vector is
+void UpmixMonoToStereo(const int16_t* source, int16_t* destination, size_t frames);
+
+// Q15 gains for the two below, unity is 1 << 15
+#define SAMPLE_GAIN_UNITY 32768
+
+// `destination` += `source` * gain, saturating. The gain moves linearly from `gain_from` to `gain_to`
+// over the run, so a source fades in or ducks without a click
+void MixSamples(int16_t* destination, const int16_t* source, size_t count, int32_t gain_from, int32_t gain_to);
+// The same gain ramp applied in place
+void ScaleSamples(int16_t* data, size_t count, int32_t gain_from, int32_t gain_to);
+
+// Removes the DC offset of a microphone in place, one pole at about fs / 1600 (10 Hz at 16 kHz).
+// Keeps its state between calls, so a stream is filtered frame by frame without seams
+class DcFilter {
+public:
+    void Process(int16_t* data, size_t count, size_t stride = 1);
+    void Reset();
+
+private:
+    int32_t last_input_ = 0;
+    int32_t output_ = 0;    // Q8, the pole would round small signals away at 16 bits
+};
+
+#endif // _SAMPLE_FORMAT_H
@@ -0,0 +1,74 @@
+#include "audio_payload.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <new>
+
+#define TAG "AudioPayloadPool"
+
+#if CONFIG_USE_LEAN_PROFILE
+// In .bss, so it counts in the RAM budget of the build instead of taking a block of the heap at boot
+static uint8_t s_payload_slab[AUDIO_PAYLOAD_BLOCK_SIZE * AUDIO_PAYLOAD_POOL_BLOCKS] __attribute__((aligned(4)));
+#endif
+
+AudioPayloadPool::AudioPayloadPool() {
+#if CONFIG_USE_LEAN_PROFILE
+    slab_ = s_payload_slab;
+#elif CONFIG_SPIRAM
+    slab_ = (uint8_t*)heap_caps_malloc(AUDIO_PAYLOAD_BLOCK_SIZE * AUDIO_PAYLOAD_POOL_BLOCKS, MALLOC_CAP_SPIRAM);
+#endif
+    if (slab_ == nullptr) {
+        slab_ = (uint8_t*)heap_caps_malloc(AUDIO_PAYLOAD_BLOCK_SIZE * AUDIO_PAYLOAD_POOL_BLOCKS, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (slab_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the payload slab, using the heap");
+        return;
+    }
+    for (int32_t i = AUDIO_PAYLOAD_POOL_BLOCKS - 1; i >= 0; i--) {
+        *(int32_t*)(slab_ + i * AUDIO_PAYLOAD_BLOCK_SIZE) = free_head_;
+        free_head_ = i;
+    }
+    free_count_ = AUDIO_PAYLOAD_POOL_BLOCKS;
+    ESP_LOGI(TAG, "Payload pool: %d blocks of %d bytes", AUDIO_PAYLOAD_POOL_BLOCKS, AUDIO_PAYLOAD_BLOCK_SIZE);
+}
+
+AudioPayloadPool::~AudioPayloadPool() {
+#if !CONFIG_USE_LEAN_PROFILE
+    if (slab_ != nullptr) {
+        heap_caps_free(slab_);
+    }
+#endif
+}
+
+void* AudioPayloadPool::Allocate(size_t size) {
+    if (size <= AUDIO_PAYLOAD_BLOCK_SIZE) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_head_ >= 0) {
+            uint8_t* block = slab_ + free_head_ * AUDIO_PAYLOAD_BLOCK_SIZE;
+            free_head_ = *(int32_t*)block;
+            free_count_--;
+            return block;
+        }
+        fallback_allocations_++;
+    }
+    void* ptr = heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void AudioPayloadPool::Free(void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    uint8_t* block = (uint8_t*)ptr;
+    if (slab_ == nullptr || block < slab_ || block >= slab_ + AUDIO_PAYLOAD_BLOCK_SIZE * AUDIO_PAYLOAD_POOL_BLOCKS) {
+        heap_caps_free(ptr);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    *(int32_t*)block = free_head_;
+    free_head_ = (block - slab_) / AUDIO_PAYLOAD_BLOCK_SIZE;
+    free_count_++;
+}
@@ -0,0 +1,77 @@
+#ifndef AUDIO_PAYLOAD_H
+#define AUDIO_PAYLOAD_H
+
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+// Opus packets of the frame durations we use fit in one block, bigger ones fall back to the heap
+#define AUDIO_PAYLOAD_BLOCK_SIZE 512
+#if CONFIG_SPIRAM
+#define AUDIO_PAYLOAD_POOL_BLOCKS 256
+#else
+#define AUDIO_PAYLOAD_POOL_BLOCKS 32
+#endif
+
+/*
+ * Fixed-size slab of packet payload blocks, allocated once.
+ *
+ * The slab is placed in PSRAM when the board has it, otherwise in internal RAM,
+ * so the constant churn of audio packets (network receive, encode callbacks,
+ * decryption) no longer fragments the internal heap. When the pool runs dry
+ * or a payload is bigger than a block, the heap is used as before.
+ */
+class AudioPayloadPool {
+public:
+    static AudioPayloadPool& GetInstance() {
+        static AudioPayloadPool instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    AudioPayloadPool(const AudioPayloadPool&) = delete;
+    AudioPayloadPool& operator=(const AudioPayloadPool&) = delete;
+
+    void* Allocate(size_t size);
+    void Free(void* ptr);
+
+    inline size_t free_blocks() const { return free_count_; }
+    inline size_t fallback_allocations() const { return fallback_allocations_; }
+
+private:
+    AudioPayloadPool();
+    ~AudioPayloadPool();
+
+    std::mutex mutex_;
+    uint8_t* slab_ = nullptr;
+    // Intrusive free list, each free block stores the index of the next one
+    int32_t free_head_ = -1;
+    size_t free_count_ = 0;
+    size_t fallback_allocations_ = 0;
+};
+
+// Routes std::vector storage through AudioPayloadPool, the block returns to the pool when the vector goes away
+template <typename T>
+struct AudioPayloadAllocator {
+    using value_type = T;
+
+    AudioPayloadAllocator() noexcept = default;
+    template <typename U>
+    AudioPayloadAllocator(const AudioPayloadAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(AudioPayloadPool::GetInstance().Allocate(n * sizeof(T)));
+    }
+    void deallocate(T* ptr, size_t) noexcept {
+        AudioPayloadPool::GetInstance().Free(ptr);
+    }
+
+    template <typename U>
+    bool operator==(const AudioPayloadAllocator<U>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const AudioPayloadAllocator<U>&) const noexcept { return false; }
+};
+
+using AudioPayload = std::vector<uint8_t, AudioPayloadAllocator<uint8_t>>;
+
+#endif // AUDIO_PAYLOAD_H
@@ -1,10 +1,35 @@
 #include "afe_audio_processor.h"
+#include "latency_tracer.h"
+#include "settings.h"
+#include "sr_model_registry.h"
+#include "task_topology.h"
+#include "deferred_log.h"
 #include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cJSON.h>
 
 #define PROCESSOR_RUNNING 0x01
+#define PROCESSOR_RECONFIGURE 0x02
+#define PROCESSOR_PARKED 0x04
+#define PROCESSOR_RESUME 0x08
 
 #define TAG "AfeAudioProcessor"
 
+static const AfeProfile kAfeProfiles[] = {
+    {"eco", AFE_MODE_LOW_COST, AEC_MODE_VOIP_LOW_COST, AFE_NS_MODE_WEBRTC},
+    {"quality", AFE_MODE_HIGH_PERF, AEC_MODE_VOIP_HIGH_PERF, AFE_NS_MODE_NET},
+};
+static constexpr size_t kAfeProfileCount = sizeof(kAfeProfiles) / sizeof(kAfeProfiles[0]);
+
+static size_t FindProfile(const std::string& name) {
+    for (size_t i = 0; i < kAfeProfileCount; i++) {
+        if (name == kAfeProfiles[i].name) {
+            return i;
+        }
+    }
+    return kAfeProfileCount;
+}
+
 AfeAudioProcessor::AfeAudioProcessor()
     : afe_data_(nullptr) {
     event_group_ = xEventGroupCreate();
@@ -12,29 +37,50 @@ AfeAudioProcessor::AfeAudioProcessor()
 
 void AfeAudioProcessor::Initialize(AudioCodec* codec) {
     codec_ = codec;
-    int ref_num = codec_->input_reference() ? 1 : 0;
+    // With two or more microphones the AFE adds beamforming in front of the rest of the pipeline
+    input_format_ = codec_->input_channel_map();
+#ifdef CONFIG_USE_DEVICE_AEC
+    device_aec_ = true;
+#endif
 
-    std::string input_format;
-    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
-        input_format.push_back('M');
+    costs_.resize(kAfeProfileCount);
+    Settings settings("audio", false);
+    size_t profile = FindProfile(settings.GetString("afe_profile", AFE_DEFAULT_PROFILE));
+    if (profile == kAfeProfileCount) {
+        profile = FindProfile(AFE_DEFAULT_PROFILE);
     }
-    for (int i = 0; i < ref_num; i++) {
-        input_format.push_back('R');
+    if (!CreateInstance(profile)) {
+        return;
     }
-
-    srmodel_list_t *models = esp_srmodel_init("model");
-    char* ns_model_name = esp_srmodel_filter(models, ESP_NSNET_PREFIX, NULL);
-    char* vad_model_name = esp_srmodel_filter(models, ESP_VADN_PREFIX, NULL);
     
-    afe_config_t* afe_config = afe_config_init(input_format.c_str(), NULL, AFE_TYPE_VC, AFE_MODE_HIGH_PERF);
-    afe_config->aec_mode = AEC_MODE_VOIP_HIGH_PERF;
+    TaskTopology::GetInstance().CreateTask(kTaskAudioProcessor, [](void* arg) {
+        auto this_ = (AfeAudioProcessor*)arg;
+        this_->AudioProcessorTask();
+        TaskTopology::ExitTask();
+    }, this, &task_handle_);
+}
+
+bool AfeAudioProcessor::CreateInstance(size_t profile) {
+    auto& config = kAfeProfiles[profile];
+    auto& registry = SrModelRegistry::GetInstance();
+    char* ns_model_name = registry.Find(ESP_NSNET_PREFIX);
+    char* vad_model_name = registry.Find(ESP_VADN_PREFIX);
+
+    size_t internal_before = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    size_t psram_before = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+
+    afe_config_t* afe_config = afe_config_init(input_format_.c_str(), NULL, AFE_TYPE_VC, config.mode);
+    afe_config->aec_mode = config.aec_mode;
     afe_config->vad_mode = VAD_MODE_0;
     afe_config->vad_min_noise_ms = 100;
     if (vad_model_name != nullptr) {
         afe_config->vad_model_name = vad_model_name;
     }
 
-    if (ns_model_name != nullptr) {
+    if (config.ns_mode == AFE_NS_MODE_WEBRTC) {
+        afe_config->ns_init = true;
+        afe_config->afe_ns_mode = AFE_NS_MODE_WEBRTC;
+    } else if (ns_model_name != nullptr) {
         afe_config->ns_init = true;
         afe_config->ns_model_name = ns_model_name;
         afe_config->afe_ns_mode = AFE_NS_MODE_NET;
@@ -49,7 +95,7 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec) {
 
 #ifdef CONFIG_USE_DEVICE_AEC
     afe_config->aec_init = true;
-    afe_config->vad_init = false;
+    afe_config->vad_init = !device_aec_;
 #else
     afe_config->aec_init = false;
     afe_config->vad_init = true;
@@ -57,12 +103,110 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec) {
 
     afe_iface_ = esp_afe_handle_from_config(afe_config);
     afe_data_ = afe_iface_->create_from_config(afe_config);
-    
-    xTaskCreate([](void* arg) {
-        auto this_ = (AfeAudioProcessor*)arg;
-        this_->AudioProcessorTask();
-        vTaskDelete(NULL);
-    }, "audio_communication", 4096, this, 3, NULL);
+    afe_config_free(afe_config);
+    if (afe_data_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create AFE with profile %s", config.name);
+        return false;
+    }
+#ifdef CONFIG_USE_DEVICE_AEC
+    if (!device_aec_) {
+        afe_iface_->disable_aec(afe_data_);
+    }
+#endif
+
+    // Other tasks allocate meanwhile, so this is an estimate, good to compare profiles
+    size_t internal_after = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    size_t psram_after = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    costs_[profile].internal_bytes = internal_before > internal_after ? internal_before - internal_after : 0;
+    costs_[profile].psram_bytes = psram_before > psram_after ? psram_before - psram_after : 0;
+    profile_ = profile;
+    ESP_LOGI(TAG, "AFE profile %s: %u bytes internal, %u bytes PSRAM", config.name,
+        costs_[profile].internal_bytes, costs_[profile].psram_bytes);
+    return true;
+}
+
+// Switches by parking the processing task, replacing the instance and resuming it.
+// Feed waits on the mutex meanwhile, so a switch during a conversation only drops a few chunks.
+bool AfeAudioProcessor::SetProfile(const std::string& name) {
+    size_t profile = FindProfile(name);
+    if (profile == kAfeProfileCount) {
+        ESP_LOGE(TAG, "Unknown AFE profile: %s", name.c_str());
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(profile_mutex_);
+    if (afe_data_ == nullptr || task_handle_ == nullptr) {
+        return false;
+    }
+    if (profile != profile_) {
+        bool running = IsRunning();
+        if (running) {
+            MeasureCpu();
+        }
+        xEventGroupSetBits(event_group_, PROCESSOR_RECONFIGURE);
+        xEventGroupWaitBits(event_group_, PROCESSOR_PARKED, pdTRUE, pdTRUE, portMAX_DELAY);
+        bool created;
+        {
+            std::lock_guard<std::mutex> feed_lock(afe_mutex_);
+            size_t previous = profile_;
+            afe_iface_->destroy(afe_data_);
+            afe_data_ = nullptr;
+            created = CreateInstance(profile);
+            if (!created && !CreateInstance(previous)) {
+                ESP_LOGE(TAG, "Failed to restore AFE profile %s", kAfeProfiles[previous].name);
+            }
+        }
+        is_speaking_ = false;
+        xEventGroupClearBits(event_group_, PROCESSOR_RECONFIGURE);
+        xEventGroupSetBits(event_group_, PROCESSOR_RESUME);
+        if (running) {
+            cpu_total_start_ = 0;
+            MeasureCpu();
+        }
+        if (!created) {
+            return false;
+        }
+    }
+
+    Settings settings("audio", true);
+    settings.SetString("afe_profile", name);
+    return true;
+}
+
+// Closes the measuring interval that started at the previous call, and starts a new one
+void AfeAudioProcessor::MeasureCpu() {
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    uint64_t task = ulTaskGetRunTimeCounter(task_handle_);
+    uint64_t total = portGET_RUN_TIME_COUNTER_VALUE();
+    if (cpu_total_start_ != 0 && total > cpu_total_start_) {
+        costs_[profile_].cpu_percent = (task - cpu_task_start_) * 100 / (total - cpu_total_start_);
+    }
+    cpu_task_start_ = task;
+    cpu_total_start_ = total;
+#endif
+}
+
+std::string AfeAudioProcessor::GetProfilesJson() {
+    std::lock_guard<std::mutex> lock(profile_mutex_);
+    if (IsRunning()) {
+        MeasureCpu();
+    }
+    cJSON* json = cJSON_CreateArray();
+    for (size_t i = 0; i < kAfeProfileCount; i++) {
+        auto item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "name", kAfeProfiles[i].name);
+        cJSON_AddBoolToObject(item, "active", i == profile_);
+        if (i < costs_.size()) {
+            cJSON_AddNumberToObject(item, "internal_bytes", costs_[i].internal_bytes);
+            cJSON_AddNumberToObject(item, "psram_bytes", costs_[i].psram_bytes);
+            cJSON_AddNumberToObject(item, "cpu_percent", costs_[i].cpu_percent);
+        }
+        cJSON_AddItemToArray(json, item);
+    }
+    auto str = cJSON_PrintUnformatted(json);
+    std::string result(str);
+    cJSON_free(str);
+    cJSON_Delete(json);
+    return result;
 }
 
 AfeAudioProcessor::~AfeAudioProcessor() {
@@ -73,25 +217,40 @@ AfeAudioProcessor::~AfeAudioProcessor() {
 }
 
 size_t AfeAudioProcessor::GetFeedSize() {
+    std::lock_guard<std::mutex> lock(afe_mutex_);
     if (afe_data_ == nullptr) {
         return 0;
     }
     return afe_iface_->get_feed_chunksize(afe_data_) * codec_->input_channels();
 }
 
-void AfeAudioProcessor::Feed(const std::vector<int16_t>& data) {
+void AfeAudioProcessor::Feed(const int16_t* data, size_t samples) {
+    std::lock_guard<std::mutex> lock(afe_mutex_);
     if (afe_data_ == nullptr) {
         return;
     }
-    afe_iface_->feed(afe_data_, data.data());
+    afe_iface_->feed(afe_data_, data);
+    last_feed_us_ = esp_timer_get_time();
 }
 
 void AfeAudioProcessor::Start() {
+    {
+        std::lock_guard<std::mutex> lock(profile_mutex_);
+        cpu_total_start_ = 0;
+        MeasureCpu();
+    }
     xEventGroupSetBits(event_group_, PROCESSOR_RUNNING);
 }
 
 void AfeAudioProcessor::Stop() {
     xEventGroupClearBits(event_group_, PROCESSOR_RUNNING);
+    {
+        // Idle time would only dilute the number
+        std::lock_guard<std::mutex> lock(profile_mutex_);
+        MeasureCpu();
+        cpu_total_start_ = 0;
+    }
+    std::lock_guard<std::mutex> lock(afe_mutex_);
     if (afe_data_ != nullptr) {
         afe_iface_->reset_buffer(afe_data_);
     }
@@ -101,7 +260,7 @@ bool AfeAudioProcessor::IsRunning() {
     return xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING;
 }
 
-void AfeAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
+void AfeAudioProcessor::OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) {
     output_callback_ = callback;
 }
 
@@ -116,18 +275,32 @@ void AfeAudioProcessor::AudioProcessorTask() {
         feed_size, fetch_size);
 
     while (true) {
-        xEventGroupWaitBits(event_group_, PROCESSOR_RUNNING, pdFALSE, pdTRUE, portMAX_DELAY);
+        auto bits = xEventGroupWaitBits(event_group_, PROCESSOR_RUNNING | PROCESSOR_RECONFIGURE,
+            pdFALSE, pdFALSE, portMAX_DELAY);
+        if (bits & PROCESSOR_RECONFIGURE) {
+            // SetProfile replaces the instance while we wait here
+            xEventGroupSetBits(event_group_, PROCESSOR_PARKED);
+            xEventGroupWaitBits(event_group_, PROCESSOR_RESUME, pdTRUE, pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        if (afe_data_ == nullptr) {
+            // Neither profile could be created, only another switch can bring the processor back
+            vTaskDelay(pdMS_TO_TICKS(AFE_FETCH_TIMEOUT_MS));
+            continue;
+        }
 
-        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
+        auto res = afe_iface_->fetch_with_delay(afe_data_, pdMS_TO_TICKS(AFE_FETCH_TIMEOUT_MS));
         if ((xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING) == 0) {
             continue;
         }
         if (res == nullptr || res->ret_value == ESP_FAIL) {
             if (res != nullptr) {
-                ESP_LOGI(TAG, "Error code: %d", res->ret_value);
+                DEFERRED_LOGW(TAG, "AFE fetch error code: %d", res->ret_value);
             }
             continue;
         }
+        // Time from the feed that completed this chunk until AFE released it
+        LatencyTracer::GetInstance().Record(kLatencyStageAfe, esp_timer_get_time() - last_feed_us_);
 
         // VAD state change
         if (vad_state_change_callback_) {
@@ -141,20 +314,27 @@ void AfeAudioProcessor::AudioProcessorTask() {
         }
 
         if (output_callback_) {
-            output_callback_(std::vector<int16_t>(res->data, res->data + res->data_size / sizeof(int16_t)));
+            // The fetch buffer stays valid until the next fetch, which waits for this callback
+            output_callback_(res->data, res->data_size / sizeof(int16_t));
         }
     }
 }
 
 void AfeAudioProcessor::EnableDeviceAec(bool enable) {
+    std::lock_guard<std::mutex> lock(afe_mutex_);
+    if (afe_data_ == nullptr) {
+        return;
+    }
     if (enable) {
 #if CONFIG_USE_DEVICE_AEC
+        device_aec_ = true;
         afe_iface_->disable_vad(afe_data_);
         afe_iface_->enable_aec(afe_data_);
 #else
         ESP_LOGE(TAG, "Device AEC is not supported");
 #endif
     } else {
+        device_aec_ = false;
         afe_iface_->disable_aec(afe_data_);
         afe_iface_->enable_vad(afe_data_);
     }
@@ -8,35 +8,70 @@
 
 #include <string>
 #include <vector>
+#include <atomic>
+#include <mutex>
 #include <functional>
 
 #include "audio_processor.h"
 #include "audio_codec.h"
 
+#define AFE_DEFAULT_PROFILE "quality"
+// The processing task returns from fetch this often while idle, so a profile switch can park it
+#define AFE_FETCH_TIMEOUT_MS 100
+
+struct AfeProfile {
+    const char* name;
+    afe_mode_t mode;
+    afe_aec_mode_t aec_mode;
+    afe_ns_mode_t ns_mode;          // AFE_NS_MODE_NET needs an NSNet model, WebRTC NS is built in
+};
+
+// Cost measured while a profile was in use, zero until it has been
+struct AfeProfileCost {
+    size_t internal_bytes = 0;      // Heap taken when the instance was created
+    size_t psram_bytes = 0;
+    int cpu_percent = -1;           // Share of one core used by the processing task, -1 without run time stats
+};
+
 class AfeAudioProcessor : public AudioProcessor {
 public:
     AfeAudioProcessor();
     ~AfeAudioProcessor();
 
     void Initialize(AudioCodec* codec) override;
-    void Feed(const std::vector<int16_t>& data) override;
+    void Feed(const int16_t* data, size_t samples) override;
     void Start() override;
     void Stop() override;
     bool IsRunning() override;
-    void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) override;
+    void OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) override;
     void OnVadStateChange(std::function<void(bool speaking)> callback) override;
     size_t GetFeedSize() override;
     void EnableDeviceAec(bool enable) override;
+    bool SetProfile(const std::string& name) override;
+    std::string GetProfilesJson() override;
 
 private:
     EventGroupHandle_t event_group_ = nullptr;
     esp_afe_sr_iface_t* afe_iface_ = nullptr;
     esp_afe_sr_data_t* afe_data_ = nullptr;
-    std::function<void(std::vector<int16_t>&& data)> output_callback_;
+    std::function<void(const int16_t* data, size_t samples)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     AudioCodec* codec_ = nullptr;
     bool is_speaking_ = false;
+    std::atomic<int64_t> last_feed_us_{0};
+    TaskHandle_t task_handle_ = nullptr;
+    std::string input_format_;
+    bool device_aec_ = false;
+    // Held by Feed and while the instance is replaced, the processing task is parked instead
+    std::mutex afe_mutex_;
+    std::mutex profile_mutex_;
+    size_t profile_ = 0;
+    std::vector<AfeProfileCost> costs_;
+    uint64_t cpu_task_start_ = 0;
+    uint64_t cpu_total_start_ = 0;
 
+    bool CreateInstance(size_t profile);
+    void MeasureCpu();
     void AudioProcessorTask();
 };
 
@@ -1,68 +1,87 @@
 #include "afe_wake_word.h"
 #include "application.h"
+#include "latency_tracer.h"
+#include "sr_model_registry.h"
+#include "task_topology.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <model_path.h>
+#include <esp_mn_models.h>
+#include <esp_mn_speech_commands.h>
 #include <arpa/inet.h>
-#include <sstream>
+#include <algorithm>
 
 #define DETECTION_RUNNING_EVENT 1
+#define OUTPUT_RUNNING_EVENT 2
+#define WAKE_WORD_PREROLL_MS 2000
 
 #define TAG "AfeWakeWord"
 
 AfeWakeWord::AfeWakeWord()
     : afe_data_(nullptr),
-      wake_word_pcm_(),
-      wake_word_opus_() {
+      preroll_opus_(WAKE_WORD_PREROLL_MS / OPUS_FRAME_DURATION_MS) {
 
     event_group_ = xEventGroupCreate();
 }
 
 AfeWakeWord::~AfeWakeWord() {
+    if (multinet_data_ != nullptr) {
+        multinet_->destroy(multinet_data_);
+    }
     if (afe_data_ != nullptr) {
         afe_iface_->destroy(afe_data_);
     }
 
-    if (wake_word_encode_task_stack_ != nullptr) {
-        heap_caps_free(wake_word_encode_task_stack_);
-    }
-
     vEventGroupDelete(event_group_);
 }
 
 void AfeWakeWord::Initialize(AudioCodec* codec) {
     codec_ = codec;
-    int ref_num = codec_->input_reference() ? 1 : 0;
 
-    srmodel_list_t *models = esp_srmodel_init("model");
-    if (models == nullptr || models->num == -1) {
+    auto& registry = SrModelRegistry::GetInstance();
+    srmodel_list_t* models = registry.models();
+    if (models == nullptr) {
         ESP_LOGE(TAG, "Failed to initialize wakenet model");
         return;
     }
-    for (int i = 0; i < models->num; i++) {
-        ESP_LOGI(TAG, "Model %d: %s", i, models->model_name[i]);
-        if (strstr(models->model_name[i], ESP_WN_PREFIX) != NULL) {
-            wakenet_model_ = models->model_name[i];
-            auto words = esp_srmodel_get_wake_words(models, wakenet_model_);
-            // split by ";" to get all wake words
-            std::stringstream ss(words);
-            std::string word;
-            while (std::getline(ss, word, ';')) {
-                wake_words_.push_back(word);
-            }
+    for (char* name : registry.FindAll(ESP_WN_PREFIX)) {
+        if (wakenet_models_.size() == 2) {
+            ESP_LOGW(TAG, "Only two wakenet models can run at once, ignoring %s", name);
+            continue;
         }
+        wakenet_models_.push_back(name);
+        wake_words_.push_back(registry.GetWakeWords(name));
     }
 
-    std::string input_format;
-    for (int i = 0; i < codec_->input_channels() - ref_num; i++) {
-        input_format.push_back('M');
-    }
-    for (int i = 0; i < ref_num; i++) {
-        input_format.push_back('R');
-    }
+    // With two or more microphones the AFE separates the sources (BSS) before WakeNet
+    std::string input_format = codec_->input_channel_map();
     afe_config_t* afe_config = afe_config_init(input_format.c_str(), models, AFE_TYPE_SR, AFE_MODE_HIGH_PERF);
     afe_config->aec_init = codec_->input_reference();
     afe_config->aec_mode = AEC_MODE_SR_HIGH_PERF;
+    if (wakenet_models_.size() > 0) {
+        afe_config->wakenet_model_name = wakenet_models_[0];
+    }
+    if (wakenet_models_.size() > 1) {
+        afe_config->wakenet_model_name_2 = wakenet_models_[1];
+    }
+#if CONFIG_USE_SHARED_AFE
+    // The same output is sent to the server, so it gets the noise suppression and VAD of the VC pipeline
+    char* ns_model_name = registry.Find(ESP_NSNET_PREFIX);
+    char* vad_model_name = registry.Find(ESP_VADN_PREFIX);
+    if (ns_model_name != nullptr) {
+        afe_config->ns_init = true;
+        afe_config->ns_model_name = ns_model_name;
+        afe_config->afe_ns_mode = AFE_NS_MODE_NET;
+    }
+    if (vad_model_name != nullptr) {
+        afe_config->vad_model_name = vad_model_name;
+    }
+    afe_config->vad_init = true;
+    afe_config->vad_mode = VAD_MODE_0;
+    afe_config->vad_min_noise_ms = 100;
+    afe_config->agc_init = false;
+#endif
     afe_config->afe_perferred_core = 1;
     afe_config->afe_perferred_priority = 1;
     afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
@@ -70,11 +89,80 @@ void AfeWakeWord::Initialize(AudioCodec* codec) {
     afe_iface_ = esp_afe_handle_from_config(afe_config);
     afe_data_ = afe_iface_->create_from_config(afe_config);
 
-    xTaskCreate([](void* arg) {
+#if CONFIG_USE_COMMAND_WORDS
+    InitializeMultiNet();
+#endif
+
+    preroll_encoder_ = std::make_unique<OpusStreamEncoder>(16000, 1, OPUS_FRAME_DURATION_MS, kBootSlotWakeEncoder);
+    preroll_encoder_->SetComplexity(0); // 0 is the fastest
+
+    TaskTopology::GetInstance().CreateTask(kTaskWakeWord, [](void* arg) {
         auto this_ = (AfeWakeWord*)arg;
         this_->AudioDetectionTask();
-        vTaskDelete(NULL);
-    }, "audio_detection", 4096, this, 3, nullptr);
+        TaskTopology::ExitTask();
+    }, this);
+}
+
+void AfeWakeWord::InitializeMultiNet() {
+    // Command phrases are written in the device language, pinyin for Chinese
+#if CONFIG_LANGUAGE_ZH_CN || CONFIG_LANGUAGE_ZH_TW
+    char* mn_name = SrModelRegistry::GetInstance().Find(ESP_MN_PREFIX, ESP_MN_CHINESE);
+#else
+    char* mn_name = SrModelRegistry::GetInstance().Find(ESP_MN_PREFIX, ESP_MN_ENGLISH);
+#endif
+    if (mn_name == nullptr) {
+        ESP_LOGW(TAG, "No multinet model found, command words are disabled");
+        return;
+    }
+    multinet_ = esp_mn_handle_from_name(mn_name);
+    multinet_data_ = multinet_->create(mn_name, COMMAND_WORD_TIMEOUT_MS);
+    if (multinet_data_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create multinet %s", mn_name);
+        multinet_ = nullptr;
+        return;
+    }
+    // MultiNet consumes the AFE output chunk by chunk, the sizes have to agree
+    int mn_chunk = multinet_->get_samp_chunksize(multinet_data_);
+    int afe_chunk = afe_iface_->get_fetch_chunksize(afe_data_);
+    if (mn_chunk != afe_chunk) {
+        ESP_LOGE(TAG, "Multinet chunk size %d does not match AFE fetch size %d", mn_chunk, afe_chunk);
+        multinet_->destroy(multinet_data_);
+        multinet_data_ = nullptr;
+        multinet_ = nullptr;
+        return;
+    }
+    esp_mn_commands_alloc(multinet_, multinet_data_);
+    ESP_LOGI(TAG, "Multinet %s loaded", mn_name);
+}
+
+bool AfeWakeWord::SetCommandWords(const std::vector<std::string>& phrases) {
+    if (multinet_data_ == nullptr) {
+        return false;
+    }
+    // The phrase table is rebuilt while MultiNet is idle, so this must not race with detection
+    if (IsDetectionRunning()) {
+        ESP_LOGE(TAG, "Command words can only be set while detection is stopped");
+        return false;
+    }
+    esp_mn_commands_clear();
+    for (size_t i = 0; i < phrases.size(); i++) {
+        if (esp_mn_commands_add(i, phrases[i].c_str()) != ESP_OK) {
+            ESP_LOGW(TAG, "Invalid command word: %s", phrases[i].c_str());
+        }
+    }
+    auto errors = esp_mn_commands_update();
+    if (errors != nullptr) {
+        for (int i = 0; i < errors->num; i++) {
+            ESP_LOGW(TAG, "Command word rejected by multinet: %s", errors->phrases[i]->string);
+        }
+    }
+    multinet_->clean(multinet_data_);
+    command_words_ = phrases;
+    return true;
+}
+
+void AfeWakeWord::OnCommandDetected(std::function<void(const CommandWord& command)> callback) {
+    command_detected_callback_ = callback;
 }
 
 void AfeWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
@@ -82,12 +170,26 @@ void AfeWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_
 }
 
 void AfeWakeWord::StartDetection() {
+    {
+        // Drop the stale pre-roll from before detection was stopped
+        std::lock_guard<std::mutex> lock(wake_word_mutex_);
+        preroll_head_ = 0;
+        preroll_count_ = 0;
+    }
+    preroll_pcm_queue_.Clear();
+    if (preroll_encoder_) {
+        preroll_encoder_->ResetState();
+    }
+#if CONFIG_USE_SPEAKER_ID
+    speaker_features_.Reset();
+#endif
     xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
 }
 
 void AfeWakeWord::StopDetection() {
-    xEventGroupClearBits(event_group_, DETECTION_RUNNING_EVENT);
-    if (afe_data_ != nullptr) {
+    auto bits = xEventGroupClearBits(event_group_, DETECTION_RUNNING_EVENT);
+    // Audio still queued in the AFE belongs to the uplink if that is running
+    if (afe_data_ != nullptr && !(bits & OUTPUT_RUNNING_EVENT)) {
         afe_iface_->reset_buffer(afe_data_);
     }
 }
@@ -97,10 +199,49 @@ bool AfeWakeWord::IsDetectionRunning() {
 }
 
 void AfeWakeWord::Feed(const std::vector<int16_t>& data) {
+    Feed(data.data(), data.size());
+}
+
+void AfeWakeWord::Feed(const int16_t* data, size_t samples) {
+    if (afe_data_ == nullptr) {
+        return;
+    }
+    afe_iface_->feed(afe_data_, data);
+    last_feed_us_ = esp_timer_get_time();
+}
+
+void AfeWakeWord::StartOutput() {
+    xEventGroupSetBits(event_group_, OUTPUT_RUNNING_EVENT);
+}
+
+void AfeWakeWord::StopOutput() {
+    auto bits = xEventGroupClearBits(event_group_, OUTPUT_RUNNING_EVENT);
+    if (afe_data_ != nullptr && !(bits & DETECTION_RUNNING_EVENT)) {
+        afe_iface_->reset_buffer(afe_data_);
+    }
+}
+
+bool AfeWakeWord::IsOutputRunning() {
+    return xEventGroupGetBits(event_group_) & OUTPUT_RUNNING_EVENT;
+}
+
+void AfeWakeWord::OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) {
+    output_callback_ = callback;
+}
+
+void AfeWakeWord::OnVadStateChange(std::function<void(bool speaking)> callback) {
+    vad_state_change_callback_ = callback;
+}
+
+void AfeWakeWord::EnableVad(bool enable) {
     if (afe_data_ == nullptr) {
         return;
     }
-    afe_iface_->feed(afe_data_, data.data());
+    if (enable) {
+        afe_iface_->enable_vad(afe_data_);
+    } else {
+        afe_iface_->disable_vad(afe_data_);
+    }
 }
 
 size_t AfeWakeWord::GetFeedSize() {
@@ -117,76 +258,163 @@ void AfeWakeWord::AudioDetectionTask() {
         feed_size, fetch_size);
 
     while (true) {
-        xEventGroupWaitBits(event_group_, DETECTION_RUNNING_EVENT, pdFALSE, pdTRUE, portMAX_DELAY);
+        // Either consumer keeps the fetch going, each result is handed to those running
+        xEventGroupWaitBits(event_group_, DETECTION_RUNNING_EVENT | OUTPUT_RUNNING_EVENT, pdFALSE, pdFALSE, portMAX_DELAY);
 
         auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
         if (res == nullptr || res->ret_value == ESP_FAIL) {
             continue;;
         }
+        auto bits = xEventGroupGetBits(event_group_);
+
+        if (bits & DETECTION_RUNNING_EVENT) {
+            // Store the wake word data for voice recognition, like who is speaking
+            StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
+#if CONFIG_USE_WAKE_ARBITRATION
+            level_meter_.Feed(res->data, res->data_size / sizeof(int16_t));
+#endif
+
+            if (res->wakeup_state == WAKENET_DETECTED) {
+                StopDetection();
+                // Both indexes are 1-based, the model index tells which word list the word is from
+                size_t model = std::max(res->wakenet_model_index, 1) - 1;
+                size_t word = res->wake_word_index - 1;
+                if (model < wake_words_.size() && word < wake_words_[model].size()) {
+                    last_detected_wake_word_ = wake_words_[model][word];
+                } else {
+                    last_detected_wake_word_ = "unknown";
+                }
+                // WakeNet only reports that its threshold was crossed, there is no score to pass on
+                ESP_LOGI(TAG, "Wake word %s detected by model %d at %lld us, volume %.1f dB",
+                    last_detected_wake_word_.c_str(), (int)model + 1, esp_timer_get_time(), res->data_volume);
+#if CONFIG_USE_WAKE_ARBITRATION
+                wake_word_level_db_ = level_meter_.level_db();
+#endif
 
-        // Store the wake word data for voice recognition, like who is speaking
-        StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
+                if (wake_word_detected_callback_) {
+                    wake_word_detected_callback_(last_detected_wake_word_);
+                }
+            } else if (multinet_data_ != nullptr && !command_words_.empty()) {
+                DetectCommand(res);
+            }
+        }
 
-        if (res->wakeup_state == WAKENET_DETECTED) {
-            StopDetection();
-            last_detected_wake_word_ = wake_words_[res->wake_word_index - 1];
+        if (bits & OUTPUT_RUNNING_EVENT) {
+            LatencyTracer::GetInstance().Record(kLatencyStageAfe, esp_timer_get_time() - last_feed_us_);
+            if (vad_state_change_callback_) {
+                if (res->vad_state == VAD_SPEECH && !is_speaking_) {
+                    is_speaking_ = true;
+                    vad_state_change_callback_(true);
+                } else if (res->vad_state == VAD_SILENCE && is_speaking_) {
+                    is_speaking_ = false;
+                    vad_state_change_callback_(false);
+                }
+            }
+            if (output_callback_) {
+                output_callback_(res->data, res->data_size / sizeof(int16_t));
+            }
+        }
+    }
+}
 
-            if (wake_word_detected_callback_) {
-                wake_word_detected_callback_(last_detected_wake_word_);
+void AfeWakeWord::DetectCommand(const afe_fetch_result_t* res) {
+    auto state = multinet_->detect(multinet_data_, res->data);
+    if (state == ESP_MN_STATE_DETECTING) {
+        return;
+    }
+    if (state == ESP_MN_STATE_DETECTED) {
+        // Candidates come sorted by probability, only the best one is acted on
+        auto results = multinet_->get_results(multinet_data_);
+        if (results->num > 0) {
+            int id = results->command_id[0];
+            float confidence = results->prob[0];
+            if (id >= 0 && id < (int)command_words_.size()) {
+                ESP_LOGI(TAG, "Command word %s, confidence %.2f", command_words_[id].c_str(), confidence);
+                if (confidence >= COMMAND_WORD_MIN_CONFIDENCE && command_detected_callback_) {
+                    command_detected_callback_(CommandWord{id, command_words_[id], confidence, esp_timer_get_time()});
+                }
             }
         }
     }
+    // Detected or timed out, either way listen for the next phrase on fresh audio
+    multinet_->clean(multinet_data_);
 }
 
 void AfeWakeWord::StoreWakeWordData(const int16_t* data, size_t samples) {
-    // store audio data to wake_word_pcm_
-    wake_word_pcm_.emplace_back(std::vector<int16_t>(data, data + samples));
-    // keep about 2 seconds of data, detect duration is 30ms (sample_rate == 16000, chunksize == 512)
-    while (wake_word_pcm_.size() > 2000 / 30) {
-        wake_word_pcm_.pop_front();
+    // Encode on the audio encode worker, which is idle while we wait for the wake word.
+    // The encoder buffers partial frames, so each fetch chunk can be passed as is.
+    auto encode_task = Application::GetInstance().GetAudioEncodeTask();
+    if (encode_task == nullptr || !preroll_encoder_) {
+        return;
+    }
+    // The chunk is copied into a queue slot that keeps its buffer, this runs for every fetch while idle
+    bool queued = preroll_pcm_queue_.PushWith([data, samples](std::vector<int16_t>& slot) {
+        slot.assign(data, data + samples);
+    });
+    if (!queued) {
+        return;
+    }
+    encode_task->Schedule([this]() {
+        if (!preroll_pcm_queue_.Pop(preroll_pcm_)) {
+            return;
+        }
+#if CONFIG_USE_SPEAKER_ID
+        speaker_features_.Push(preroll_pcm_.data(), preroll_pcm_.size());
+#endif
+        preroll_encoder_->Encode(preroll_pcm_.data(), preroll_pcm_.size(), [this](AudioPayload&& opus) {
+            PushPrerollPacket(std::move(opus));
+        });
+    });
+}
+
+void AfeWakeWord::PushPrerollPacket(AudioPayload&& opus) {
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
+    if (preroll_count_ == preroll_opus_.size()) {
+        // Overwrite the oldest packet
+        preroll_head_ = (preroll_head_ + 1) % preroll_opus_.size();
+        preroll_count_--;
     }
+    auto& slot = preroll_opus_[(preroll_head_ + preroll_count_) % preroll_opus_.size()];
+    slot = std::move(opus);
+    preroll_count_++;
 }
 
 void AfeWakeWord::EncodeWakeWordData() {
-    wake_word_opus_.clear();
-    if (wake_word_encode_task_stack_ == nullptr) {
-        wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
+    // The pre-roll is already encoded, only wait for the chunks fetched before the detection
+    auto encode_task = Application::GetInstance().GetAudioEncodeTask();
+    if (encode_task != nullptr) {
+        encode_task->WaitForCompletion();
     }
-    wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
-        auto this_ = (AfeWakeWord*)arg;
-        {
-            auto start_time = esp_timer_get_time();
-            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-            encoder->SetComplexity(0); // 0 is the fastest
-
-            int packets = 0;
-            for (auto& pcm: this_->wake_word_pcm_) {
-                encoder->Encode(std::move(pcm), [this_](std::vector<uint8_t>&& opus) {
-                    std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-                    this_->wake_word_opus_.emplace_back(std::move(opus));
-                    this_->wake_word_cv_.notify_all();
-                });
-                packets++;
-            }
-            this_->wake_word_pcm_.clear();
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
+    ESP_LOGI(TAG, "Wake word pre-roll ready: %u packets", preroll_count_);
+}
 
-            auto end_time = esp_timer_get_time();
-            ESP_LOGI(TAG, "Encode wake word opus %d packets in %ld ms", packets, (long)((end_time - start_time) / 1000));
+bool AfeWakeWord::GetSpeakerEmbedding(std::vector<float>& embedding) {
+#if CONFIG_USE_SPEAKER_ID
+    // Call after EncodeWakeWordData, the features are computed on the encode task as well
+    return speaker_features_.GetEmbedding(embedding);
+#else
+    return false;
+#endif
+}
 
-            std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-            this_->wake_word_opus_.push_back(std::vector<uint8_t>());
-            this_->wake_word_cv_.notify_all();
-        }
-        vTaskDelete(NULL);
-    }, "encode_detect_packets", 4096 * 8, this, 2, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
+bool AfeWakeWord::GetWakeWordLevel(float& level_db) {
+#if CONFIG_USE_WAKE_ARBITRATION
+    level_db = wake_word_level_db_;
+    return true;
+#else
+    return false;
+#endif
 }
 
-bool AfeWakeWord::GetWakeWordOpus(std::vector<uint8_t>& opus) {
-    std::unique_lock<std::mutex> lock(wake_word_mutex_);
-    wake_word_cv_.wait(lock, [this]() {
-        return !wake_word_opus_.empty();
-    });
-    opus.swap(wake_word_opus_.front());
-    wake_word_opus_.pop_front();
-    return !opus.empty();
+bool AfeWakeWord::GetWakeWordOpus(AudioPayload& opus) {
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
+    if (preroll_count_ == 0) {
+        opus.clear();
+        return false;
+    }
+    opus = std::move(preroll_opus_[preroll_head_]);
+    preroll_head_ = (preroll_head_ + 1) % preroll_opus_.size();
+    preroll_count_--;
+    return true;
 }
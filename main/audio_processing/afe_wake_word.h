@@ -7,16 +7,29 @@
 
 #include <esp_afe_sr_models.h>
 #include <esp_nsn_models.h>
+#include <esp_mn_iface.h>
 
-#include <list>
 #include <string>
 #include <vector>
+#include <memory>
 #include <functional>
 #include <mutex>
-#include <condition_variable>
+#include <atomic>
 
 #include "audio_codec.h"
 #include "wake_word.h"
+#include "opus_stream.h"
+#include "spsc_ring_buffer.h"
+#if CONFIG_USE_SPEAKER_ID
+#include "speaker_id.h"
+#endif
+
+// MultiNet results below this probability are dropped, short phrases false trigger on TV audio
+#define COMMAND_WORD_MIN_CONFIDENCE 0.3f
+// A command is only listened for this long before MultiNet restarts on fresh audio
+#define COMMAND_WORD_TIMEOUT_MS 6000
+// Fetched chunks waiting for the encode task, each slot keeps its buffer
+#define WAKE_WORD_PREROLL_PCM_QUEUE_SIZE 4
 
 class AfeWakeWord : public WakeWord {
 public:
@@ -25,35 +38,70 @@ public:
 
     void Initialize(AudioCodec* codec);
     void Feed(const std::vector<int16_t>& data);
+    void Feed(const int16_t* data, size_t samples);
     void OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback);
     void StartDetection();
     void StopDetection();
     bool IsDetectionRunning();
     size_t GetFeedSize();
     void EncodeWakeWordData();
-    bool GetWakeWordOpus(std::vector<uint8_t>& opus);
+    bool GetWakeWordOpus(AudioPayload& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
+    bool SetCommandWords(const std::vector<std::string>& phrases);
+    void OnCommandDetected(std::function<void(const CommandWord& command)> callback);
+    bool GetSpeakerEmbedding(std::vector<float>& embedding);
+    bool GetWakeWordLevel(float& level_db);
+
+    // Shared front end (CONFIG_USE_SHARED_AFE): the cleaned stream also goes to the voice uplink,
+    // so wake word detection and voice communication run on one AFE instance
+    void StartOutput();
+    void StopOutput();
+    bool IsOutputRunning();
+    void OnOutput(std::function<void(const int16_t* data, size_t samples)> callback);
+    void OnVadStateChange(std::function<void(bool speaking)> callback);
+    void EnableVad(bool enable);
 
 private:
     esp_afe_sr_iface_t* afe_iface_ = nullptr;
     esp_afe_sr_data_t* afe_data_ = nullptr;
-    char* wakenet_model_ = NULL;
-    std::vector<std::string> wake_words_;
+    // The AFE runs up to two WakeNet models side by side, each with its own word list
+    std::vector<char*> wakenet_models_;
+    std::vector<std::vector<std::string>> wake_words_;
+    esp_mn_iface_t* multinet_ = nullptr;
+    model_iface_data_t* multinet_data_ = nullptr;
+    std::vector<std::string> command_words_;
+    std::function<void(const CommandWord& command)> command_detected_callback_;
     EventGroupHandle_t event_group_;
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
     AudioCodec* codec_ = nullptr;
     std::string last_detected_wake_word_;
+    std::function<void(const int16_t* data, size_t samples)> output_callback_;
+    std::function<void(bool speaking)> vad_state_change_callback_;
+    bool is_speaking_ = false;
+    std::atomic<int64_t> last_feed_us_{0};
 
-    TaskHandle_t wake_word_encode_task_ = nullptr;
-    StaticTask_t wake_word_encode_task_buffer_;
-    StackType_t* wake_word_encode_task_stack_ = nullptr;
-    std::list<std::vector<int16_t>> wake_word_pcm_;
-    std::list<std::vector<uint8_t>> wake_word_opus_;
+    // The pre-roll is encoded continuously into a fixed ring of Opus packets that
+    // holds the last ~2 seconds, so the packets are ready when the wake word fires
+    std::unique_ptr<OpusStreamEncoder> preroll_encoder_;
+    SpscRingBuffer<std::vector<int16_t>> preroll_pcm_queue_{WAKE_WORD_PREROLL_PCM_QUEUE_SIZE};
+    std::vector<int16_t> preroll_pcm_;  // Encode task
+    std::vector<AudioPayload> preroll_opus_;
+    size_t preroll_head_ = 0;
+    size_t preroll_count_ = 0;
     std::mutex wake_word_mutex_;
-    std::condition_variable wake_word_cv_;
+#if CONFIG_USE_SPEAKER_ID
+    SpeakerFeatures speaker_features_;
+#endif
+#if CONFIG_USE_WAKE_ARBITRATION
+    WakeWordLevelMeter level_meter_;    // Detection task
+    std::atomic<float> wake_word_level_db_ = -100.0f;
+#endif
 
     void StoreWakeWordData(const int16_t* data, size_t size);
+    void PushPrerollPacket(AudioPayload&& opus);
     void AudioDetectionTask();
+    void InitializeMultiNet();
+    void DetectCommand(const afe_fetch_result_t* res);
 };
 
 #endif
@@ -3,15 +3,38 @@
 
 #if CONFIG_USE_AUDIO_DEBUGGER
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <errno.h>
 #include <cstring>
 #include <string>
+#include <algorithm>
 #endif
 
 #define TAG "AudioDebugger"
 
+#if CONFIG_USE_AUDIO_DEBUGGER
+static const int16_t kAdpcmStepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+static const int8_t kAdpcmIndexTable[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+static void PutLe16(uint8_t* p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void PutLe32(uint8_t* p, uint32_t v) {
+    PutLe16(p, v & 0xffff);
+    PutLe16(p + 2, v >> 16);
+}
+#endif
 
 AudioDebugger::AudioDebugger() {
 #if CONFIG_USE_AUDIO_DEBUGGER
@@ -20,16 +43,16 @@ AudioDebugger::AudioDebugger() {
         // 解析配置的服务器地址 "IP:PORT"
         std::string server_addr = CONFIG_AUDIO_DEBUG_UDP_SERVER;
         size_t colon_pos = server_addr.find(':');
-        
+
         if (colon_pos != std::string::npos) {
             std::string ip = server_addr.substr(0, colon_pos);
             int port = std::stoi(server_addr.substr(colon_pos + 1));
-            
+
             memset(&udp_server_addr_, 0, sizeof(udp_server_addr_));
             udp_server_addr_.sin_family = AF_INET;
             udp_server_addr_.sin_port = htons(port);
             inet_pton(AF_INET, ip.c_str(), &udp_server_addr_.sin_addr);
-            
+
             ESP_LOGI(TAG, "Initialized server address: %s", CONFIG_AUDIO_DEBUG_UDP_SERVER);
         } else {
             ESP_LOGW(TAG, "Invalid server address: %s, should be IP:PORT", CONFIG_AUDIO_DEBUG_UDP_SERVER);
@@ -39,11 +62,55 @@ AudioDebugger::AudioDebugger() {
     } else {
         ESP_LOGW(TAG, "Failed to create UDP socket: %d", errno);
     }
+    if (udp_sockfd_ < 0) {
+        return;
+    }
+
+#if CONFIG_AUDIO_DEBUG_STREAM_INPUT
+    enabled_streams_ |= 1 << kAudioDebugStreamInput;
+#endif
+#if CONFIG_AUDIO_DEBUG_STREAM_PROCESSED
+    enabled_streams_ |= 1 << kAudioDebugStreamProcessed;
+#endif
+#if CONFIG_AUDIO_DEBUG_STREAM_PLAYBACK
+    enabled_streams_ |= 1 << kAudioDebugStreamPlayback;
+#endif
+#if CONFIG_AUDIO_DEBUG_COMPRESS
+    compress_ = true;
+#endif
+
+    // One extra byte, a message buffer of N bytes holds N - 1
+    buffer_storage_ = (uint8_t*)heap_caps_malloc(AUDIO_DEBUG_BUFFER_SIZE + 1, MALLOC_CAP_SPIRAM);
+    if (buffer_storage_ == nullptr) {
+        buffer_storage_ = (uint8_t*)heap_caps_malloc(AUDIO_DEBUG_BUFFER_SIZE + 1, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (buffer_storage_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the send buffer");
+        close(udp_sockfd_);
+        udp_sockfd_ = -1;
+        return;
+    }
+    buffer_ = xMessageBufferCreateStatic(AUDIO_DEBUG_BUFFER_SIZE + 1, buffer_storage_, &buffer_struct_);
+    running_ = true;
+    xTaskCreate([](void* arg) {
+        auto debugger = static_cast<AudioDebugger*>(arg);
+        debugger->SenderLoop();
+        debugger->sender_task_ = nullptr;
+        vTaskDelete(NULL);
+    }, "audio_debug", AUDIO_DEBUG_SENDER_STACK_SIZE, this, 1, &sender_task_);
 #endif
 }
 
 AudioDebugger::~AudioDebugger() {
 #if CONFIG_USE_AUDIO_DEBUGGER
+    running_ = false;
+    while (sender_task_ != nullptr) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    if (buffer_storage_ != nullptr) {
+        vMessageBufferDelete(buffer_);
+        heap_caps_free(buffer_storage_);
+    }
     if (udp_sockfd_ >= 0) {
         close(udp_sockfd_);
         ESP_LOGI(TAG, "Closed UDP socket");
@@ -51,18 +118,139 @@ AudioDebugger::~AudioDebugger() {
 #endif
 }
 
-void AudioDebugger::Feed(const std::vector<int16_t>& data) {
+void AudioDebugger::Feed(AudioDebugStream stream, const int16_t* data, size_t frames, int sample_rate, int channels) {
 #if CONFIG_USE_AUDIO_DEBUGGER
-    if (udp_sockfd_ >= 0) {
-        ssize_t sent = sendto(udp_sockfd_, data.data(), data.size() * sizeof(int16_t), 0,
-                             (struct sockaddr*)&udp_server_addr_, sizeof(udp_server_addr_));
-        if (sent < 0) {
-            ESP_LOGW(TAG, "Failed to send audio data to %s: %d", CONFIG_AUDIO_DEBUG_UDP_SERVER, errno);
+    if (!running_ || !(enabled_streams_ & (1 << stream)) || channels < 1 || channels > AUDIO_DEBUG_MAX_CHANNELS) {
+        return;
+    }
+    uint64_t time_us = esp_timer_get_time();
+    size_t max_frames = compress_
+        ? (AUDIO_DEBUG_MAX_DATAGRAM - AUDIO_DEBUG_HEADER_SIZE - 4 * channels) * 2 / channels
+        : (AUDIO_DEBUG_MAX_DATAGRAM - AUDIO_DEBUG_HEADER_SIZE) / (2 * channels);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& state = streams_[stream];
+    while (frames > 0) {
+        size_t chunk = std::min(frames, max_frames);
+        uint8_t* header = datagram_;
+        header[0] = 'A';
+        header[1] = 'D';
+        header[2] = AUDIO_DEBUG_VERSION;
+        header[3] = stream;
+        header[4] = compress_ ? AUDIO_DEBUG_CODEC_IMA_ADPCM : AUDIO_DEBUG_CODEC_PCM16;
+        header[5] = channels;
+        PutLe16(header + 6, chunk);
+        PutLe32(header + 8, sample_rate);
+        PutLe32(header + 12, state.sequence++);
+        PutLe32(header + 16, state.frame_index);
+        PutLe32(header + 20, time_us & 0xffffffff);
+        PutLe32(header + 24, time_us >> 32);
+
+        size_t size = AUDIO_DEBUG_HEADER_SIZE;
+        if (compress_) {
+            size += EncodeAdpcm(data, chunk, channels, state.step_index, datagram_ + size);
         } else {
-            ESP_LOGD(TAG, "Sent %d bytes audio data to %s", sent, CONFIG_AUDIO_DEBUG_UDP_SERVER);
+            for (size_t i = 0; i < chunk * channels; i++) {
+                PutLe16(datagram_ + size + i * 2, data[i]);
+            }
+            size += chunk * channels * 2;
+        }
+        // A dropped datagram still used its sequence number and frames, the receiver sees the gap
+        if (xMessageBufferSend(buffer_, datagram_, size, 0) == 0) {
+            dropped_++;
+        }
+
+        state.frame_index += chunk;
+        data += chunk * channels;
+        frames -= chunk;
+    }
+#endif
+}
+
+void AudioDebugger::SenderLoop() {
+#if CONFIG_USE_AUDIO_DEBUGGER
+    uint8_t datagram[AUDIO_DEBUG_MAX_DATAGRAM];
+    uint32_t reported_drops = 0;
+    int64_t last_report_us = 0;
+    while (running_) {
+        size_t size = xMessageBufferReceive(buffer_, datagram, sizeof(datagram), pdMS_TO_TICKS(100));
+        if (size > 0) {
+            ssize_t sent = sendto(udp_sockfd_, datagram, size, 0,
+                                 (struct sockaddr*)&udp_server_addr_, sizeof(udp_server_addr_));
+            if (sent < 0) {
+                ESP_LOGD(TAG, "Failed to send audio data to %s: %d", CONFIG_AUDIO_DEBUG_UDP_SERVER, errno);
+            }
+        }
+        // At most one warning a second, the audio tasks keep dropping while the link is slow
+        int64_t now = esp_timer_get_time();
+        if (dropped_ != reported_drops && now - last_report_us > 1000000) {
+            ESP_LOGW(TAG, "Dropped %lu datagrams, the link is slower than the enabled streams",
+                (unsigned long)(dropped_ - reported_drops));
+            reported_drops = dropped_;
+            last_report_us = now;
         }
     }
 #endif
 }
 
- 
\ No newline at end of file
+// IMA ADPCM of interleaved samples, each channel starts from its first sample so the datagram decodes alone
+size_t AudioDebugger::EncodeAdpcm(const int16_t* data, size_t frames, int channels, uint8_t* step_index, uint8_t* out) {
+#if CONFIG_USE_AUDIO_DEBUGGER
+    int predictor[AUDIO_DEBUG_MAX_CHANNELS];
+    int index[AUDIO_DEBUG_MAX_CHANNELS];
+    uint8_t* p = out;
+    for (int c = 0; c < channels; c++) {
+        predictor[c] = data[c];
+        index[c] = step_index[c];
+        PutLe16(p, (uint16_t)data[c]);
+        p[2] = index[c];
+        p[3] = 0;
+        p += 4;
+    }
+
+    size_t samples = frames * channels;
+    for (size_t i = 0; i < samples; i++) {
+        int c = i % channels;
+        int step = kAdpcmStepTable[index[c]];
+        int diff = data[i] - predictor[c];
+        int code = 0;
+        if (diff < 0) {
+            code = 8;
+            diff = -diff;
+        }
+        int delta = step >> 3;
+        if (diff >= step) {
+            code |= 4;
+            diff -= step;
+            delta += step;
+        }
+        if (diff >= step >> 1) {
+            code |= 2;
+            diff -= step >> 1;
+            delta += step >> 1;
+        }
+        if (diff >= step >> 2) {
+            code |= 1;
+            delta += step >> 2;
+        }
+        predictor[c] = std::clamp(code & 8 ? predictor[c] - delta : predictor[c] + delta, -32768, 32767);
+        index[c] = std::clamp(index[c] + kAdpcmIndexTable[code], 0, 88);
+
+        // Low nibble first
+        if (i % 2 == 0) {
+            *p = code;
+        } else {
+            *p++ |= code << 4;
+        }
+    }
+    if (samples % 2 != 0) {
+        p++;
+    }
+    for (int c = 0; c < channels; c++) {
+        step_index[c] = index[c];
+    }
+    return p - out;
+#else
+    return 0;
+#endif
+}
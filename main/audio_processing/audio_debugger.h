@@ -1,22 +1,95 @@
 #ifndef AUDIO_DEBUGGER_H
 #define AUDIO_DEBUGGER_H
 
-#include <vector>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/message_buffer.h>
+
+#include <atomic>
+#include <mutex>
 #include <cstdint>
+#include <cstddef>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 
+// Points of the audio path that can be captured, the stream id in each datagram
+enum AudioDebugStream {
+    kAudioDebugStreamInput = 0,      // Raw codec input after resampling, microphones and reference interleaved
+    kAudioDebugStreamProcessed = 1,  // Audio processor output, what the encoder gets
+    kAudioDebugStreamPlayback = 2,   // Decoded downlink as written to the codec
+    kAudioDebugStreamCount
+};
+
+#define AUDIO_DEBUG_VERSION 1
+#define AUDIO_DEBUG_HEADER_SIZE 28
+#define AUDIO_DEBUG_CODEC_PCM16 0
+#define AUDIO_DEBUG_CODEC_IMA_ADPCM 1
+// Streams with more channels are not sent
+#define AUDIO_DEBUG_MAX_CHANNELS 4
+// Datagrams stay below the Wi-Fi MTU so none of them is fragmented
+#define AUDIO_DEBUG_MAX_DATAGRAM 1400
+// Datagrams wait here for the sender task, when it is full new ones are dropped and counted
+#define AUDIO_DEBUG_BUFFER_SIZE (32 * 1024)
+#define AUDIO_DEBUG_SENDER_STACK_SIZE 4096
+
+/*
+ * Sends taps of the audio path to CONFIG_AUDIO_DEBUG_UDP_SERVER for
+ * scripts/audio_debug_server.py.
+ *
+ * Every datagram starts with a little-endian header:
+ *
+ *     0  'A' 'D'            4  codec            8  sample rate (u32)
+ *     2  version            5  channels        12  sequence, per stream (u32)
+ *     3  stream id          6  frames (u16)    16  first frame index, per stream (u32)
+ *                                              20  esp_timer time of the Feed call (u64, us)
+ *
+ * The sequence reveals lost datagrams and the frame index places the audio
+ * of each stream on its own timeline even after a loss. The esp_timer time
+ * lines up the streams against each other, e.g. the reference against the
+ * playback when tuning AEC. With CONFIG_AUDIO_DEBUG_COMPRESS the samples are
+ * IMA ADPCM, 4 bits each, preceded by the predictor (i16) and step index
+ * (u8, then a pad byte) of every channel, so each datagram decodes alone.
+ *
+ * Feed() only formats the datagrams into a message buffer, a low priority
+ * task sends them. The audio tasks never wait for the network: if the link
+ * cannot keep up, datagrams are dropped, which the sequence shows.
+ */
 class AudioDebugger {
 public:
     AudioDebugger();
     ~AudioDebugger();
 
-    void Feed(const std::vector<int16_t>& data);
+    // `frames` of `channels` interleaved samples, safe to call from any task
+    void Feed(AudioDebugStream stream, const int16_t* data, size_t frames, int sample_rate, int channels);
 
 private:
     int udp_sockfd_ = -1;
     struct sockaddr_in udp_server_addr_;
+    uint32_t enabled_streams_ = 0;
+    bool compress_ = false;
+
+    // A message buffer has a single writer, the streams are fed from different tasks
+    std::mutex mutex_;
+    uint8_t* buffer_storage_ = nullptr;
+    StaticMessageBuffer_t buffer_struct_;
+    MessageBufferHandle_t buffer_ = nullptr;
+    TaskHandle_t sender_task_ = nullptr;
+    std::atomic<bool> running_{false};
+    std::atomic<uint32_t> dropped_{0};
+    uint8_t datagram_[AUDIO_DEBUG_MAX_DATAGRAM];
+
+    struct StreamState {
+        uint32_t sequence = 0;
+        uint32_t frame_index = 0;
+        // ADPCM step index of each channel, carried from one datagram to the next
+        uint8_t step_index[AUDIO_DEBUG_MAX_CHANNELS] = {};
+    };
+    StreamState streams_[kAudioDebugStreamCount];
+
+    void SenderLoop();
+    // Encodes `frames` interleaved frames into `out`, returns the bytes written
+    static size_t EncodeAdpcm(const int16_t* data, size_t frames, int channels, uint8_t* step_index, uint8_t* out);
 };
 
-#endif 
\ No newline at end of file
+#endif
@@ -0,0 +1,141 @@
+#include "audio_mixer.h"
+#include "sample_format.h"
+#include "memory_accounting.h"
+
+#include <esp_log.h>
+
+#include <algorithm>
+
+#define TAG "AudioMixer"
+
+AudioMixer::AudioMixer(int queue_ms) : queue_ms_(queue_ms) {
+    gains_.fill(SAMPLE_GAIN_UNITY);
+}
+
+void AudioMixer::Configure(int sample_rate, int channels) {
+    if (sample_rate == sample_rate_ && channels == channels_) {
+        return;
+    }
+    ESP_LOGI(TAG, "Mixing at %d Hz, %d channels", sample_rate, channels);
+    sample_rate_ = sample_rate;
+    channels_ = channels;
+    MemoryTagScope tag(kMemoryTagAudio);
+    for (auto& queue : queues_) {
+        // The streaming sources are mixed from their own frames, only queues in use are allocated
+        if (!queue.ring.empty()) {
+            queue.ring.assign(sample_rate / 1000 * queue_ms_ * channels, 0);
+        }
+    }
+    Reset();
+}
+
+void AudioMixer::Queue(AudioMixerSource source, const int16_t* pcm, size_t samples) {
+    auto& queue = queues_[source];
+    ApplyClear();
+    if (sample_rate_ == 0) {
+        return;
+    }
+    if (queue.ring.empty()) {
+        MemoryTagScope tag(kMemoryTagAudio);
+        queue.ring.assign(sample_rate_ / 1000 * queue_ms_ * channels_, 0);
+    }
+    size_t capacity = queue.ring.size();
+    size_t size = queue.size;
+    if (samples > capacity - size) {
+        ESP_LOGW(TAG, "Source %d overflow, %u samples dropped", source, samples - (capacity - size));
+        samples = capacity - size;
+    }
+    size_t tail = (queue.head + size) % capacity;
+    size_t first = std::min(samples, capacity - tail);
+    std::copy(pcm, pcm + first, queue.ring.begin() + tail);
+    std::copy(pcm + first, pcm + samples, queue.ring.begin());
+    queue.size = size + samples;
+}
+
+void AudioMixer::MixQueued(AudioMixerSource source, int16_t* destination, size_t count, int32_t gain) {
+    auto& queue = queues_[source];
+    size_t capacity = queue.ring.size();
+    // The ramp is split in proportion where the ring wraps
+    size_t first = std::min(count, capacity - queue.head);
+    int32_t middle = gains_[source] + (int32_t)((int64_t)(gain - gains_[source]) * (int64_t)first / (int64_t)count);
+    MixSamples(destination, queue.ring.data() + queue.head, first, gains_[source], middle);
+    MixSamples(destination + first, queue.ring.data(), count - first, middle, gain);
+    gains_[source] = gain;
+    queue.head = (queue.head + count) % capacity;
+    queue.size -= count;
+    // The next time it plays it starts from its own level again
+    if (queue.size == 0) {
+        gains_[source] = SAMPLE_GAIN_UNITY;
+    }
+}
+
+void AudioMixer::Mix(AudioMixerSource source, std::vector<int16_t>& frame) {
+    ApplyClear();
+    // The highest priority playing in this frame, everything below it ducks
+    int top = source;
+    for (int i = source + 1; i < kAudioSourceCount; i++) {
+        if (queues_[i].size > 0) {
+            top = i;
+        }
+    }
+
+    int32_t gain = source < top ? AUDIO_MIXER_DUCKING_GAIN : SAMPLE_GAIN_UNITY;
+    ScaleSamples(frame.data(), frame.size(), gains_[source], gain);
+    gains_[source] = gain;
+
+    for (int i = 0; i < kAudioSourceCount; i++) {
+        size_t count = std::min<size_t>(queues_[i].size, frame.size());
+        if (i == source || count == 0) {
+            continue;
+        }
+        MixQueued((AudioMixerSource)i, frame.data(), count, i < top ? AUDIO_MIXER_DUCKING_GAIN : SAMPLE_GAIN_UNITY);
+    }
+}
+
+void AudioMixer::Drain(std::vector<int16_t>& frame) {
+    ApplyClear();
+    int top = -1;
+    size_t samples = 0;
+    for (int i = 0; i < kAudioSourceCount; i++) {
+        if (queues_[i].size > 0) {
+            top = i;
+            samples = std::max<size_t>(samples, queues_[i].size);
+        }
+    }
+    frame.assign(samples, 0);
+    for (int i = 0; i <= top; i++) {
+        size_t count = queues_[i].size;
+        if (count > 0) {
+            MixQueued((AudioMixerSource)i, frame.data(), count, i < top ? AUDIO_MIXER_DUCKING_GAIN : SAMPLE_GAIN_UNITY);
+        }
+    }
+}
+
+void AudioMixer::Clear() {
+    clear_pending_ = true;
+}
+
+void AudioMixer::ApplyClear() {
+    if (clear_pending_.exchange(false)) {
+        Reset();
+    }
+}
+
+void AudioMixer::Reset() {
+    for (auto& queue : queues_) {
+        queue.head = 0;
+        queue.size = 0;
+    }
+    gains_.fill(SAMPLE_GAIN_UNITY);
+}
+
+int AudioMixer::queued_ms() const {
+    if (sample_rate_ == 0 || clear_pending_) {
+        return 0;
+    }
+    size_t samples = 0;
+    for (auto& queue : queues_) {
+        samples = std::max<size_t>(samples, queue.size);
+    }
+    return samples / channels_ * 1000 / sample_rate_;
+}
@@ -0,0 +1,77 @@
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+#include <array>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Q15 gain of a source while one with a higher priority plays, about -12 dB
+#define AUDIO_MIXER_DUCKING_GAIN 8231
+
+// Lowest priority first
+enum AudioMixerSource : uint8_t {
+    kAudioSourceMedia,
+    kAudioSourceVoice,
+    kAudioSourcePrompt,
+    kAudioSourceCount,
+};
+
+/*
+ * Mixes overlay audio, such as the prompts, into the downlink frames on their
+ * way to the codec, so a prompt no longer has to wait for the reply or the
+ * media to end, nor cut them off.
+ *
+ * The downlink frame of the source that is streaming is mixed in place: the
+ * audio queued for the other sources is added on top of it, and every source
+ * with a higher priority one playing alongside is ducked. Gains move linearly
+ * across a frame, so a source ducks and comes back without a click. When
+ * nothing streams, Drain() turns the queued audio alone into a frame.
+ *
+ * Everything runs on the decode task except queued_ms(), which the audio loop
+ * reads to decide when to decode the next overlay frame, and Clear(), which
+ * is carried out by the next call on the decode task. The queues are
+ * allocated by Configure() and only again when the output format changes.
+ */
+class AudioMixer {
+public:
+    explicit AudioMixer(int queue_ms);
+
+    // The codec's output format, the queued audio is dropped when it changes
+    void Configure(int sample_rate, int channels);
+    // Interleaved samples in the configured format, what does not fit is dropped
+    void Queue(AudioMixerSource source, const int16_t* pcm, size_t samples);
+    // Mixes the queued audio into `frame`, a downlink frame of `source`, at most its length
+    void Mix(AudioMixerSource source, std::vector<int16_t>& frame);
+    // Replaces `frame` with all the queued audio, which keeps its capacity
+    void Drain(std::vector<int16_t>& frame);
+
+    // Any task
+    void Clear();
+    int queued_ms() const;
+
+private:
+    struct Fifo {
+        std::vector<int16_t> ring;
+        size_t head = 0;
+        std::atomic<size_t> size{0};
+    };
+
+    int queue_ms_;
+    std::atomic<int> sample_rate_{0};
+    std::atomic<int> channels_{1};
+    std::array<Fifo, kAudioSourceCount> queues_;
+    // The gain each source ended its last frame with
+    std::array<int32_t, kAudioSourceCount> gains_;
+    std::atomic<bool> clear_pending_{false};
+
+    // Empties the queues now if Clear() was called
+    void ApplyClear();
+    void Reset();
+
+    // Mixes `count` samples from the front of the queue into `destination` and pops them
+    void MixQueued(AudioMixerSource source, int16_t* destination, size_t count, int32_t gain);
+};
+
+#endif // AUDIO_MIXER_H
@@ -7,19 +7,30 @@
 
 #include "audio_codec.h"
 
+/*
+ * Audio is passed as pointer and sample count in both directions. Feed only
+ * reads the caller's buffer, and the output callback gets a view of the
+ * processor's own buffer that is valid until the callback returns, so the
+ * consumer copies what it keeps into storage it reuses.
+ */
 class AudioProcessor {
 public:
     virtual ~AudioProcessor() = default;
     
     virtual void Initialize(AudioCodec* codec) = 0;
-    virtual void Feed(const std::vector<int16_t>& data) = 0;
+    virtual void Feed(const int16_t* data, size_t samples) = 0;
     virtual void Start() = 0;
     virtual void Stop() = 0;
     virtual bool IsRunning() = 0;
-    virtual void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) = 0;
+    virtual void OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) = 0;
     virtual void OnVadStateChange(std::function<void(bool speaking)> callback) = 0;
     virtual size_t GetFeedSize() = 0;
     virtual void EnableDeviceAec(bool enable) = 0;
+
+    // Named trade-offs between quality and CPU / memory, switched at runtime.
+    // Processors without profiles accept none and report an empty list.
+    virtual bool SetProfile(const std::string& name) { return false; }
+    virtual std::string GetProfilesJson() { return "[]"; }
 };
 
 #endif
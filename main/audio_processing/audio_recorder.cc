@@ -0,0 +1,263 @@
+#include "audio_recorder.h"
+#include "frame_resampler.h"
+#include "opus_stream.h"
+#include "memory_accounting.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cJSON.h>
+
+#include <cstring>
+
+#define TAG "AudioRecorder"
+
+AudioRecorder::AudioRecorder(AudioCapture* capture, int input_sample_rate, int input_channels)
+    : capture_(capture), input_sample_rate_(input_sample_rate), input_channels_(input_channels) {
+}
+
+AudioRecorder::~AudioRecorder() {
+    Stop();
+}
+
+bool AudioRecorder::Start(const std::string& path, int max_segments) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (recording_ || encode_task_ != nullptr || write_task_ != nullptr) {
+        ESP_LOGW(TAG, "Recording is already in progress");
+        return false;
+    }
+
+    MemoryTagScope tag(kMemoryTagAudio);
+    if (buffer_storage_ == nullptr) {
+        // One extra byte, a message buffer of N bytes holds N - 1
+        buffer_storage_ = (uint8_t*)heap_caps_malloc(AUDIO_RECORDER_BUFFER_SIZE + 1, MALLOC_CAP_SPIRAM);
+        if (buffer_storage_ == nullptr) {
+            buffer_storage_ = (uint8_t*)heap_caps_malloc(AUDIO_RECORDER_BUFFER_SIZE + 1, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        }
+        if (buffer_storage_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate the recording buffer");
+            return false;
+        }
+        buffer_ = xMessageBufferCreateStatic(AUDIO_RECORDER_BUFFER_SIZE + 1, buffer_storage_, &buffer_struct_);
+    }
+    xMessageBufferReset(buffer_);
+
+    path_ = path;
+    max_segments_ = max_segments;
+    segment_ = 0;
+    frames_ = 0;
+    dropped_frames_ = 0;
+    capture_overruns_ = 0;
+    bytes_written_ = 0;
+    write_error_ = false;
+    encode_done_ = false;
+    recording_ = true;
+
+    xTaskCreate([](void* arg) {
+        auto recorder = static_cast<AudioRecorder*>(arg);
+        recorder->WriteLoop();
+        {
+            std::lock_guard<std::mutex> lock(recorder->mutex_);
+            recorder->write_task_ = nullptr;
+        }
+        vTaskDelete(NULL);
+    }, "audio_rec_write", AUDIO_RECORDER_WRITE_STACK_SIZE, this, 3, &write_task_);
+    xTaskCreate([](void* arg) {
+        auto recorder = static_cast<AudioRecorder*>(arg);
+        recorder->EncodeLoop();
+        {
+            std::lock_guard<std::mutex> lock(recorder->mutex_);
+            recorder->encode_task_ = nullptr;
+        }
+        recorder->encode_done_ = true;
+        vTaskDelete(NULL);
+    }, "audio_rec_encode", AUDIO_RECORDER_ENCODE_STACK_SIZE, this, 4, &encode_task_);
+    ESP_LOGI(TAG, "Recording to %s", GetSegmentPath(0).c_str());
+    return true;
+}
+
+bool AudioRecorder::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!recording_) {
+            return false;
+        }
+        recording_ = false;
+    }
+    // The encoder finishes its frame, then the writer drains the buffer and closes the file
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (encode_task_ == nullptr && write_task_ == nullptr) {
+                break;
+            }
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    ESP_LOGI(TAG, "Recording stopped: %lu frames, %llu bytes, %lu frames dropped",
+        (unsigned long)frames_.load(), bytes_written_.load(), (unsigned long)dropped_frames_.load());
+    return true;
+}
+
+std::string AudioRecorder::GetStatusJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "recording", recording_);
+    if (!path_.empty()) {
+        cJSON_AddStringToObject(root, "file", GetSegmentPath(segment_).c_str());
+        cJSON_AddNumberToObject(root, "segments", segment_ + 1);
+    }
+    cJSON_AddNumberToObject(root, "duration_seconds", frames_ * AUDIO_RECORDER_FRAME_MS / 1000);
+    cJSON_AddNumberToObject(root, "bytes_written", bytes_written_);
+    cJSON_AddNumberToObject(root, "dropped_frames", dropped_frames_);
+    cJSON_AddNumberToObject(root, "capture_overruns", capture_overruns_);
+    cJSON_AddBoolToObject(root, "write_error", write_error_);
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
+
+void AudioRecorder::EncodeLoop() {
+    MemoryTagScope tag(kMemoryTagAudio);
+    auto reader = capture_->CreateReader();
+    size_t input_frames = input_sample_rate_ * AUDIO_RECORDER_FRAME_MS / 1000;
+
+    FrameResampler resampler;
+    bool resample = input_sample_rate_ != AUDIO_RECORDER_SAMPLE_RATE;
+    std::vector<int16_t> pcm;
+    if (resample) {
+        resampler.Configure(input_sample_rate_, AUDIO_RECORDER_SAMPLE_RATE);
+        pcm.resize(resampler.GetOutputSamples(input_frames));
+    } else {
+        pcm.resize(input_frames);
+    }
+
+    OpusStreamEncoder encoder(AUDIO_RECORDER_SAMPLE_RATE, 1, AUDIO_RECORDER_FRAME_MS);
+    OpusEncoderProfile profile;
+    profile.bitrate = AUDIO_RECORDER_BITRATE;
+    encoder.Configure(profile);
+
+    std::vector<uint8_t> packet;
+    packet.reserve(AUDIO_RECORDER_MAX_PACKET_SIZE);
+    while (recording_) {
+        const int16_t* data;
+        if (!capture_->Read(reader, input_frames * input_channels_, data)) {
+            // Input disabled or not started yet
+            continue;
+        }
+        capture_overruns_ = reader.overruns;
+
+        // Only the first channel, the others are the reference or a second microphone
+        size_t samples;
+        if (resample) {
+            samples = resampler.Process(data, input_frames, pcm.data(), input_channels_);
+        } else {
+            for (size_t i = 0; i < input_frames; i++) {
+                pcm[i] = data[i * input_channels_];
+            }
+            samples = input_frames;
+        }
+
+        encoder.Encode(pcm.data(), samples, [this, &packet](AudioPayload&& opus) {
+            // [1 字节类型, 1 字节保留, 2 字节长度（大端）, Opus 数据]
+            packet.resize(4 + opus.size());
+            packet[0] = 0;
+            packet[1] = 0;
+            packet[2] = opus.size() >> 8;
+            packet[3] = opus.size() & 0xff;
+            memcpy(packet.data() + 4, opus.data(), opus.size());
+            if (xMessageBufferSend(buffer_, packet.data(), packet.size(), 0) == 0) {
+                dropped_frames_++;
+            } else {
+                frames_++;
+            }
+        });
+    }
+}
+
+void AudioRecorder::WriteLoop() {
+    MemoryTagScope tag(kMemoryTagAudio);
+    const int frames_per_segment = AUDIO_RECORDER_SEGMENT_SECONDS * 1000 / AUDIO_RECORDER_FRAME_MS;
+    std::vector<uint8_t> staged;
+    staged.reserve(AUDIO_RECORDER_WRITE_SIZE);
+    std::vector<uint8_t> packet(AUDIO_RECORDER_MAX_PACKET_SIZE);
+    int segment = 0;
+    int segment_frames = 0;
+    FILE* file = OpenSegment(segment);
+
+    while (true) {
+        // Read before receiving, an empty buffer after the encoder is done stays empty
+        bool done = encode_done_;
+        size_t size = xMessageBufferReceive(buffer_, packet.data(), packet.size(), pdMS_TO_TICKS(100));
+        if (size == 0) {
+            if (done) {
+                break;
+            }
+            continue;
+        }
+
+        if (segment_frames == frames_per_segment) {
+            WriteStaged(file, staged);
+            if (file != nullptr) {
+                fclose(file);
+            }
+            segment++;
+            segment_frames = 0;
+            file = OpenSegment(segment);
+        }
+        if (staged.size() + size > AUDIO_RECORDER_WRITE_SIZE) {
+            WriteStaged(file, staged);
+        }
+        staged.insert(staged.end(), packet.begin(), packet.begin() + size);
+        segment_frames++;
+    }
+
+    WriteStaged(file, staged);
+    if (file != nullptr) {
+        fclose(file);
+    }
+}
+
+std::string AudioRecorder::GetSegmentPath(int index) const {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "_%03d.p3", index);
+    return path_ + suffix;
+}
+
+FILE* AudioRecorder::OpenSegment(int index) {
+    if (max_segments_ > 0 && index >= max_segments_) {
+        auto oldest = GetSegmentPath(index - max_segments_);
+        if (remove(oldest.c_str()) != 0) {
+            ESP_LOGW(TAG, "Failed to delete %s", oldest.c_str());
+        }
+    }
+
+    auto path = GetSegmentPath(index);
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        ESP_LOGE(TAG, "Failed to open %s", path.c_str());
+        write_error_ = true;
+        return nullptr;
+    }
+    // The writes are already large, stdio buffering would only copy them once more
+    setvbuf(file, nullptr, _IONBF, 0);
+    segment_ = index;
+    return file;
+}
+
+bool AudioRecorder::WriteStaged(FILE* file, std::vector<uint8_t>& staged) {
+    if (staged.empty()) {
+        return true;
+    }
+    // After an error the frames are still drained, so the encoder does not stall on a full buffer
+    bool ok = file != nullptr && fwrite(staged.data(), 1, staged.size(), file) == staged.size();
+    if (ok) {
+        bytes_written_ += staged.size();
+    } else if (!write_error_) {
+        ESP_LOGE(TAG, "Failed to write %u bytes, the card may be full", staged.size());
+        write_error_ = true;
+    }
+    staged.clear();
+    return ok;
+}
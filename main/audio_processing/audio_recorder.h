@@ -0,0 +1,93 @@
+#ifndef AUDIO_RECORDER_H
+#define AUDIO_RECORDER_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/message_buffer.h>
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstdio>
+#include <cstdint>
+
+#include "audio_capture.h"
+
+// P3 files: 60 ms Opus frames at 16 kHz, as the sound asset scripts read them
+#define AUDIO_RECORDER_SAMPLE_RATE 16000
+#define AUDIO_RECORDER_FRAME_MS 60
+// 16 kbps 的语音足够清楚，一小时约 7 MB
+#define AUDIO_RECORDER_BITRATE 16000
+// Encoded frames wait here while the card is busy, about a minute of audio at AUDIO_RECORDER_BITRATE
+#define AUDIO_RECORDER_BUFFER_SIZE (128 * 1024)
+// FAT on an SD card is much faster with a few large writes than with one write per frame
+#define AUDIO_RECORDER_WRITE_SIZE (16 * 1024)
+// One P3 packet: the 4 byte header and the largest Opus frame
+#define AUDIO_RECORDER_MAX_PACKET_SIZE (4 + 1275)
+// Each file of a recording covers this long
+#define AUDIO_RECORDER_SEGMENT_SECONDS 300
+#define AUDIO_RECORDER_ENCODE_STACK_SIZE (4096 * 6)
+#define AUDIO_RECORDER_WRITE_STACK_SIZE 4096
+
+/*
+ * Records the microphone to files as Opus, for meetings that run for hours.
+ *
+ * The recorder is one more reader of the AudioCapture ring, so it shares
+ * the I2S input with the audio loop instead of driving the peripheral
+ * itself. An encode task takes the first channel, resamples it to 16 kHz
+ * and encodes it into P3 packets, the format of the sound assets, which
+ * scripts/p3_tools convert and play. The packets go through a fixed-size
+ * message buffer to a writer task that puts them on the card in
+ * AUDIO_RECORDER_WRITE_SIZE writes. A slow card only fills the buffer, and
+ * once it is full new frames are dropped and counted: neither the capture
+ * nor the audio loop ever waits for storage.
+ *
+ * A recording is split into files of AUDIO_RECORDER_SEGMENT_SECONDS named
+ * <path>_000.p3, <path>_001.p3 and so on. With max_segments the oldest file
+ * is deleted when a new one starts, so a recording of any length keeps the
+ * latest max_segments files and its storage stays bounded.
+ */
+class AudioRecorder {
+public:
+    AudioRecorder(AudioCapture* capture, int input_sample_rate, int input_channels);
+    ~AudioRecorder();
+
+    // path is without extension, max_segments 0 keeps every file
+    bool Start(const std::string& path, int max_segments);
+    // Returns once the buffered audio is written and the file is closed
+    bool Stop();
+    inline bool IsRecording() const { return recording_; }
+    std::string GetStatusJson();
+
+private:
+    AudioCapture* capture_;
+    int input_sample_rate_;
+    int input_channels_;
+
+    std::mutex mutex_;
+    std::atomic<bool> recording_{false};
+    std::atomic<bool> encode_done_{false};
+    TaskHandle_t encode_task_ = nullptr;
+    TaskHandle_t write_task_ = nullptr;
+    uint8_t* buffer_storage_ = nullptr;
+    StaticMessageBuffer_t buffer_struct_;
+    MessageBufferHandle_t buffer_ = nullptr;
+
+    std::string path_;
+    int max_segments_ = 0;
+    std::atomic<int> segment_{0};
+    std::atomic<uint32_t> frames_{0};
+    std::atomic<uint32_t> dropped_frames_{0};
+    std::atomic<uint32_t> capture_overruns_{0};
+    std::atomic<uint64_t> bytes_written_{0};
+    std::atomic<bool> write_error_{false};
+
+    void EncodeLoop();
+    void WriteLoop();
+    std::string GetSegmentPath(int index) const;
+    FILE* OpenSegment(int index);
+    bool WriteStaged(FILE* file, std::vector<uint8_t>& staged);
+};
+
+#endif // AUDIO_RECORDER_H
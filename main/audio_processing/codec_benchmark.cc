@@ -0,0 +1,234 @@
+#include "codec_benchmark.h"
+#include "opus_stream.h"
+#include "frame_resampler.h"
+#include "memory_accounting.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_chip_info.h>
+#include <freertos/task.h>
+
+#include <algorithm>
+#include <cmath>
+
+#define TAG "CodecBenchmark"
+
+// The uplink is encoded at 16 kHz, the server sends 16 or 24 kHz
+#define CODEC_BENCHMARK_UPLINK_SAMPLE_RATE 16000
+#define CODEC_BENCHMARK_FRAME_MS 60
+
+CodecBenchmark::CodecBenchmark() {
+    done_ = xSemaphoreCreateBinary();
+}
+
+CodecBenchmark::~CodecBenchmark() {
+    vSemaphoreDelete(done_);
+}
+
+std::string CodecBenchmark::Run(int frames) {
+    frames_ = frames;
+    recommended_complexity_ = -1;
+    over_budget_ = false;
+    root_ = cJSON_CreateObject();
+
+    esp_chip_info_t chip_info;
+    esp_chip_info(&chip_info);
+    auto chip = cJSON_CreateObject();
+    cJSON_AddStringToObject(chip, "target", CONFIG_IDF_TARGET);
+    cJSON_AddNumberToObject(chip, "revision", chip_info.revision);
+    cJSON_AddNumberToObject(chip, "cores", chip_info.cores);
+    cJSON_AddNumberToObject(chip, "cpu_mhz", CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+    cJSON_AddItemToObject(root_, "chip", chip);
+    cJSON_AddNumberToObject(root_, "frames_per_case", frames);
+
+    // The calling task may have a small stack, the encoder at complexity 10 does not fit in it
+    TaskHandle_t task;
+    if (xTaskCreate([](void* arg) {
+            auto benchmark = static_cast<CodecBenchmark*>(arg);
+            benchmark->RunCases();
+            xSemaphoreGive(benchmark->done_);
+            vTaskDelete(NULL);
+        }, "codec_bench", CODEC_BENCHMARK_STACK_SIZE, this, 2, &task) != pdPASS) {
+        cJSON_Delete(root_);
+        root_ = nullptr;
+        return "{\"error\":\"Failed to create the benchmark task\"}";
+    }
+    xSemaphoreTake(done_, portMAX_DELAY);
+
+    cJSON_AddNumberToObject(root_, "recommended_complexity", recommended_complexity_);
+    auto json_str = cJSON_PrintUnformatted(root_);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root_);
+    root_ = nullptr;
+    ESP_LOGI(TAG, "%s", json.c_str());
+    return json;
+}
+
+void CodecBenchmark::RunCases() {
+    MemoryTagScope tag(kMemoryTagAudio);
+    times_.reserve(frames_);
+
+    auto encode = cJSON_CreateArray();
+    for (int complexity : { 0, 1, 2, 3, 5, 8, 10 }) {
+        RunEncodeCase(encode, complexity, 0, CODEC_BENCHMARK_FRAME_MS);
+    }
+    for (int bitrate : { 8000, 16000, 24000, 32000 }) {
+        RunEncodeCase(encode, 0, bitrate, CODEC_BENCHMARK_FRAME_MS);
+    }
+    for (int duration_ms : { 20, 40, 120 }) {
+        RunEncodeCase(encode, 0, 0, duration_ms);
+    }
+    cJSON_AddItemToObject(root_, "encode", encode);
+
+    auto decode = cJSON_CreateArray();
+    for (int sample_rate : { 16000, 24000 }) {
+        for (int duration_ms : { 20, 60 }) {
+            RunDecodeCase(decode, sample_rate, duration_ms);
+        }
+    }
+    cJSON_AddItemToObject(root_, "decode", decode);
+
+    auto resample = cJSON_CreateArray();
+    const int rates[][2] = {
+        { 16000, 24000 }, { 16000, 48000 }, { 24000, 16000 }, { 24000, 48000 },
+        { 44100, 16000 }, { 48000, 16000 },
+    };
+    for (auto& rate : rates) {
+        RunResampleCase(resample, rate[0], rate[1]);
+    }
+    cJSON_AddItemToObject(root_, "resample", resample);
+}
+
+void CodecBenchmark::RunEncodeCase(cJSON* cases, int complexity, int bitrate, int duration_ms) {
+    OpusStreamEncoder encoder(CODEC_BENCHMARK_UPLINK_SAMPLE_RATE, 1, duration_ms);
+    OpusEncoderProfile profile;
+    profile.complexity = complexity;
+    profile.bitrate = bitrate;
+    encoder.Configure(profile);
+
+    size_t samples = CODEC_BENCHMARK_UPLINK_SAMPLE_RATE * duration_ms / 1000;
+    std::vector<int16_t> pcm(samples);
+    size_t encoded_bytes = 0;
+    times_.clear();
+    for (int i = 0; i < frames_ + CODEC_BENCHMARK_WARMUP_FRAMES; i++) {
+        Synthesize(CODEC_BENCHMARK_UPLINK_SAMPLE_RATE, i * samples, pcm.data(), samples);
+        size_t bytes = 0;
+        int64_t start = esp_timer_get_time();
+        encoder.Encode(pcm.data(), samples, [&bytes](AudioPayload&& opus) {
+            bytes = opus.size();
+        });
+        int64_t elapsed = esp_timer_get_time() - start;
+        if (i >= CODEC_BENCHMARK_WARMUP_FRAMES) {
+            times_.push_back(elapsed);
+            encoded_bytes += bytes;
+        }
+    }
+
+    auto item = cJSON_CreateObject();
+    cJSON_AddNumberToObject(item, "complexity", complexity);
+    cJSON_AddNumberToObject(item, "bitrate", bitrate);
+    cJSON_AddNumberToObject(item, "frame_ms", duration_ms);
+    cJSON_AddNumberToObject(item, "kbps", encoded_bytes * 8.0 / (frames_ * duration_ms));
+    uint32_t p99 = AddTimes(item, duration_ms);
+    cJSON_AddItemToArray(cases, item);
+
+    // The sweep runs upwards from 0, once a complexity is over the budget the higher ones do not count
+    if (bitrate == 0 && duration_ms == CODEC_BENCHMARK_FRAME_MS && !over_budget_) {
+        if (p99 * 100 <= (uint32_t)duration_ms * 1000 * CODEC_BENCHMARK_ENCODE_BUDGET_PERCENT) {
+            recommended_complexity_ = complexity;
+        } else {
+            over_budget_ = true;
+        }
+    }
+    ESP_LOGI(TAG, "Encode complexity %d, bitrate %d, %d ms: p99 %lu us", complexity, bitrate, duration_ms, (unsigned long)p99);
+}
+
+void CodecBenchmark::RunDecodeCase(cJSON* cases, int sample_rate, int duration_ms) {
+    // The packets come from the uplink encoder settings, the server sends similar ones
+    OpusStreamEncoder encoder(sample_rate, 1, duration_ms);
+    size_t samples = sample_rate * duration_ms / 1000;
+    std::vector<int16_t> pcm(samples);
+    std::vector<AudioPayload> packets;
+    packets.reserve(frames_ + CODEC_BENCHMARK_WARMUP_FRAMES);
+    for (int i = 0; i < frames_ + CODEC_BENCHMARK_WARMUP_FRAMES; i++) {
+        Synthesize(sample_rate, i * samples, pcm.data(), samples);
+        encoder.Encode(pcm.data(), samples, [&packets](AudioPayload&& opus) {
+            packets.push_back(std::move(opus));
+        });
+    }
+
+    OpusStreamDecoder decoder(sample_rate, 1, duration_ms);
+    times_.clear();
+    for (size_t i = 0; i < packets.size(); i++) {
+        int64_t start = esp_timer_get_time();
+        decoder.Decode(packets[i].data(), packets[i].size(), pcm);
+        int64_t elapsed = esp_timer_get_time() - start;
+        if (i >= CODEC_BENCHMARK_WARMUP_FRAMES) {
+            times_.push_back(elapsed);
+        }
+    }
+
+    auto item = cJSON_CreateObject();
+    cJSON_AddNumberToObject(item, "sample_rate", sample_rate);
+    cJSON_AddNumberToObject(item, "frame_ms", duration_ms);
+    uint32_t p99 = AddTimes(item, duration_ms);
+    cJSON_AddItemToArray(cases, item);
+    ESP_LOGI(TAG, "Decode %d Hz, %d ms: p99 %lu us", sample_rate, duration_ms, (unsigned long)p99);
+}
+
+void CodecBenchmark::RunResampleCase(cJSON* cases, int input_sample_rate, int output_sample_rate) {
+    FrameResampler resampler;
+    resampler.Configure(input_sample_rate, output_sample_rate);
+    size_t samples = input_sample_rate * CODEC_BENCHMARK_FRAME_MS / 1000;
+    std::vector<int16_t> input(samples);
+    std::vector<int16_t> output(resampler.GetOutputSamples(samples));
+    times_.clear();
+    for (int i = 0; i < frames_ + CODEC_BENCHMARK_WARMUP_FRAMES; i++) {
+        Synthesize(input_sample_rate, i * samples, input.data(), samples);
+        int64_t start = esp_timer_get_time();
+        resampler.Process(input.data(), samples, output.data());
+        int64_t elapsed = esp_timer_get_time() - start;
+        if (i >= CODEC_BENCHMARK_WARMUP_FRAMES) {
+            times_.push_back(elapsed);
+        }
+    }
+
+    auto item = cJSON_CreateObject();
+    cJSON_AddNumberToObject(item, "input_sample_rate", input_sample_rate);
+    cJSON_AddNumberToObject(item, "output_sample_rate", output_sample_rate);
+    cJSON_AddNumberToObject(item, "frame_ms", CODEC_BENCHMARK_FRAME_MS);
+    uint32_t p99 = AddTimes(item, CODEC_BENCHMARK_FRAME_MS);
+    cJSON_AddItemToArray(cases, item);
+    ESP_LOGI(TAG, "Resample %d -> %d Hz: p99 %lu us", input_sample_rate, output_sample_rate, (unsigned long)p99);
+}
+
+uint32_t CodecBenchmark::AddTimes(cJSON* item, int duration_ms) {
+    if (times_.empty()) {
+        return 0;
+    }
+    std::sort(times_.begin(), times_.end());
+    uint64_t total = 0;
+    for (auto us : times_) {
+        total += us;
+    }
+    uint32_t p99 = times_[times_.size() * 99 / 100];
+    cJSON_AddNumberToObject(item, "p50_us", times_[times_.size() / 2]);
+    cJSON_AddNumberToObject(item, "p99_us", p99);
+    cJSON_AddNumberToObject(item, "max_us", times_.back());
+    // Share of one core the stage takes at realtime
+    cJSON_AddNumberToObject(item, "cpu_percent", total * 100.0 / times_.size() / (duration_ms * 1000));
+    return p99;
+}
+
+// Speech band tones with a slow envelope and some noise, a constant tone would be unrealistically cheap to encode
+void CodecBenchmark::Synthesize(int sample_rate, size_t offset, int16_t* pcm, size_t samples) {
+    uint32_t noise = offset * 2654435761u;
+    for (size_t i = 0; i < samples; i++) {
+        double t = (double)(offset + i) / sample_rate;
+        double envelope = 0.5 + 0.5 * std::sin(2 * M_PI * 3 * t);
+        double value = std::sin(2 * M_PI * 220 * t) + 0.5 * std::sin(2 * M_PI * 1100 * t) + 0.25 * std::sin(2 * M_PI * 2700 * t);
+        noise = noise * 1664525 + 1013904223;
+        pcm[i] = (int16_t)(8000 * envelope * value + (int16_t)(noise >> 16) / 32);
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef CODEC_BENCHMARK_H
+#define CODEC_BENCHMARK_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <cJSON.h>
+
+// The cases run on their own task, Opus at a high complexity needs about as much stack as the audio encode task
+#define CODEC_BENCHMARK_STACK_SIZE (4096 * 7)
+// The encoder runs alongside the audio processor, wake word and network: it may take this share of each frame
+#define CODEC_BENCHMARK_ENCODE_BUDGET_PERCENT 25
+// Frames encoded before the timing starts, the first ones allocate and fill the analysis buffers
+#define CODEC_BENCHMARK_WARMUP_FRAMES 5
+
+/*
+ * Times the Opus encoder, the Opus decoder and the resampler frame by frame
+ * on this chip, so the uplink complexity is chosen from numbers.
+ *
+ * Each case runs `frames` frames of a synthetic voice-like signal with one
+ * parameter changed: the encoder over complexity, bitrate and frame duration
+ * at the 16 kHz uplink rate, the decoder at the uplink and downlink sample
+ * rates, and the resampler over the rate pairs the codecs need. A case
+ * reports p50, p99 and max microseconds per frame and the share of realtime
+ * the mean takes.
+ *
+ * The recommended complexity is the highest one whose p99 encode time for a
+ * 60 ms frame stays within CODEC_BENCHMARK_ENCODE_BUDGET_PERCENT of the
+ * frame. Application reads it from Settings "audio"/"opus_complexity" once
+ * it is saved there.
+ *
+ * The numbers are only meaningful on an idle device, the audio loop and the
+ * network compete for the same cores.
+ */
+class CodecBenchmark {
+public:
+    CodecBenchmark();
+    ~CodecBenchmark();
+
+    // Blocks until every case has run, returns the report as JSON
+    std::string Run(int frames);
+    // -1 before Run() or when not even complexity 0 fits the budget
+    inline int recommended_complexity() const { return recommended_complexity_; }
+
+private:
+    SemaphoreHandle_t done_;
+    int frames_ = 0;
+    int recommended_complexity_ = -1;
+    bool over_budget_ = false;
+    std::vector<uint32_t> times_;
+    cJSON* root_ = nullptr;
+
+    void RunCases();
+    void RunEncodeCase(cJSON* cases, int complexity, int bitrate, int duration_ms);
+    void RunDecodeCase(cJSON* cases, int sample_rate, int duration_ms);
+    void RunResampleCase(cJSON* cases, int input_sample_rate, int output_sample_rate);
+    // Adds the statistics of times_ to `item`, returns the p99 in microseconds
+    uint32_t AddTimes(cJSON* item, int duration_ms);
+    static void Synthesize(int sample_rate, size_t offset, int16_t* pcm, size_t samples);
+};
+
+#endif // CODEC_BENCHMARK_H
@@ -0,0 +1,86 @@
+#include "complexity_governor.h"
+
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <algorithm>
+
+#define TAG "ComplexityGovernor"
+
+void ComplexityGovernor::SetFloor(int complexity) {
+    floor_ = complexity;
+}
+
+int ComplexityGovernor::complexity() const {
+    return std::max<int>(complexity_, floor_);
+}
+
+void ComplexityGovernor::ResetWindow() {
+    window_encode_us_ = 0;
+    window_audio_us_ = 0;
+}
+
+int ComplexityGovernor::GetIdlePercent() {
+#if configGENERATE_RUN_TIME_STATS
+    int core = xPortGetCoreID();
+    uint64_t idle_time = ulTaskGetIdleRunTimeCounterForCore(core);
+    uint64_t total_time = portGET_RUN_TIME_COUNTER_VALUE();
+    // An unpinned encoder may have moved, the counters of the new core need a baseline first
+    bool valid = core == idle_core_ && total_time > last_total_time_;
+    int percent = valid ? (idle_time - last_idle_time_) * 100 / (total_time - last_total_time_) : -1;
+    idle_core_ = core;
+    last_idle_time_ = idle_time;
+    last_total_time_ = total_time;
+    return percent;
+#else
+    return -1;
+#endif
+}
+
+int ComplexityGovernor::OnEncoded(int64_t encode_us, int frames, int frame_duration_ms) {
+    int floor = floor_;
+    if (floor < 0 || frames <= 0) {
+        return -1;
+    }
+    int current = std::max<int>(complexity_, floor);
+    int64_t audio_us = (int64_t)frames * frame_duration_ms * 1000;
+    int target = current;
+
+    if (encode_us * 100 > audio_us * COMPLEXITY_GOVERNOR_SPIKE_PERCENT) {
+        target = floor;
+        good_windows_ = 0;
+        ResetWindow();
+    } else {
+        window_encode_us_ += encode_us;
+        window_audio_us_ += audio_us;
+        if (window_audio_us_ < COMPLEXITY_GOVERNOR_WINDOW_MS * 1000) {
+            return -1;
+        }
+        int load = window_encode_us_ * 100 / window_audio_us_;
+        int idle = GetIdlePercent();
+        ResetWindow();
+        if (idle >= 0 && idle < COMPLEXITY_GOVERNOR_MIN_IDLE_PERCENT) {
+            target = floor;
+            good_windows_ = 0;
+        } else if (load > COMPLEXITY_GOVERNOR_HIGH_LOAD_PERCENT) {
+            target = std::max(floor, current - 1);
+            good_windows_ = 0;
+        } else if (load < COMPLEXITY_GOVERNOR_LOW_LOAD_PERCENT && (idle < 0 || idle > COMPLEXITY_GOVERNOR_GOOD_IDLE_PERCENT)) {
+            if (++good_windows_ >= COMPLEXITY_GOVERNOR_RAISE_WINDOWS) {
+                good_windows_ = 0;
+                target = std::min(current + 1, std::max(floor, COMPLEXITY_GOVERNOR_MAX_COMPLEXITY));
+            }
+        } else {
+            good_windows_ = 0;
+        }
+        ESP_LOGD(TAG, "Encoder load %d%%, idle %d%%, complexity %d", load, idle, current);
+    }
+
+    complexity_ = target;
+    if (target == current) {
+        return -1;
+    }
+    ESP_LOGI(TAG, "Complexity %d -> %d", current, target);
+    return target;
+}
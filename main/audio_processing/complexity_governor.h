@@ -0,0 +1,56 @@
+#ifndef COMPLEXITY_GOVERNOR_H
+#define COMPLEXITY_GOVERNOR_H
+
+#include <atomic>
+#include <cstdint>
+
+#define COMPLEXITY_GOVERNOR_MAX_COMPLEXITY 8
+// Load and idle time are judged over this much encoded audio
+#define COMPLEXITY_GOVERNOR_WINDOW_MS 2000
+// Share of the audio duration the encoder takes to encode it
+#define COMPLEXITY_GOVERNOR_HIGH_LOAD_PERCENT 35
+#define COMPLEXITY_GOVERNOR_LOW_LOAD_PERCENT 15
+// One frame above this share of its duration means something preempted the encoder
+#define COMPLEXITY_GOVERNOR_SPIKE_PERCENT 70
+// Idle share of the core the encoder runs on
+#define COMPLEXITY_GOVERNOR_MIN_IDLE_PERCENT 15
+#define COMPLEXITY_GOVERNOR_GOOD_IDLE_PERCENT 40
+// Windows with headroom in a row before the next step up
+#define COMPLEXITY_GOVERNOR_RAISE_WINDOWS 3
+
+/*
+ * Raises the uplink Opus complexity above the configured floor while the
+ * encoder has CPU to spare, and takes it back as soon as it has not.
+ *
+ * Each encode call reports how long it took against the duration of the
+ * audio it produced. Over a window the governor also reads how much of the
+ * time the encoder's core was idle, which is where the AFE and the display
+ * show up. A step up needs a low encoder load and an idle core for a few
+ * windows; a loaded window steps down by one, and a frame that took most of
+ * its own duration or a core without idle time drops to the floor at once.
+ */
+class ComplexityGovernor {
+public:
+    // Any task. -1 disables the governor, e.g. with device AEC which needs every cycle
+    void SetFloor(int complexity);
+    // Encode task. Returns the complexity to use from now on, or -1 to keep the current one
+    int OnEncoded(int64_t encode_us, int frames, int frame_duration_ms);
+    // The complexity in use, never below the floor
+    int complexity() const;
+
+private:
+    std::atomic<int> floor_ = -1;
+    std::atomic<int> complexity_ = 0;
+    int64_t window_encode_us_ = 0;
+    int64_t window_audio_us_ = 0;
+    int good_windows_ = 0;
+    int idle_core_ = -1;
+    uint64_t last_idle_time_ = 0;
+    uint64_t last_total_time_ = 0;
+
+    void ResetWindow();
+    // Of the core the caller runs on since the last call, -1 if unknown
+    int GetIdlePercent();
+};
+
+#endif // COMPLEXITY_GOVERNOR_H
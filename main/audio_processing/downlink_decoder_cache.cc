@@ -0,0 +1,74 @@
+#include "downlink_decoder_cache.h"
+#include "deferred_log.h"
+
+#include <esp_log.h>
+
+#define TAG "DownlinkDecoderCache"
+
+static const BootSlot kEntrySlots[] = {
+    kBootSlotDownlinkDecoder,
+    kBootSlotDownlinkDecoder2,
+};
+
+DownlinkDecoderCache::DownlinkDecoderCache(int sample_rate, int frame_duration, int max_channels) {
+    for (int i = 0; i < DOWNLINK_DECODER_CACHE_SIZE; i++) {
+        BootSlot slot = i < (int)(sizeof(kEntrySlots) / sizeof(kEntrySlots[0])) ? kEntrySlots[i] : kBootSlotNone;
+        entries_[i].decoder = std::make_unique<OpusStreamDecoder>(sample_rate, 1, frame_duration, max_channels, slot);
+    }
+}
+
+DownlinkDecoder& DownlinkDecoderCache::Get(int sample_rate, int frame_duration, int channels, int output_sample_rate) {
+    clock_++;
+    DownlinkDecoder* entry = nullptr;
+    for (auto& candidate : entries_) {
+        auto& decoder = *candidate.decoder;
+        if (candidate.last_used != 0 && decoder.sample_rate() == sample_rate &&
+                decoder.duration_ms() == frame_duration && decoder.channels() == channels) {
+            entry = &candidate;
+            break;
+        }
+    }
+
+    if (entry == nullptr) {
+        // An entry that never served a stream has the oldest time of all
+        entry = &entries_[0];
+        for (auto& candidate : entries_) {
+            if (candidate.last_used < entry->last_used) {
+                entry = &candidate;
+            }
+        }
+        entry->decoder->Configure(sample_rate, channels, frame_duration);
+        for (auto& resampler : entry->resamplers) {
+            resampler.Reset();
+        }
+        misses_++;
+        DEFERRED_LOGI(TAG, "Decoder for %d Hz, %d ms, %d channels", sample_rate, frame_duration, channels);
+    }
+    entry->last_used = clock_;
+
+    // The codec rate may have changed too, when the output follows the server
+    if (sample_rate != output_sample_rate && (entry->resamplers.size() != (size_t)channels ||
+            entry->resamplers[0].input_sample_rate() != sample_rate ||
+            entry->resamplers[0].output_sample_rate() != output_sample_rate)) {
+        DEFERRED_LOGI(TAG, "Resampling audio from %d to %d", sample_rate, output_sample_rate);
+        entry->resamplers.resize(channels);
+        for (auto& resampler : entry->resamplers) {
+            resampler.Configure(sample_rate, output_sample_rate);
+        }
+    }
+    return *entry;
+}
+
+void DownlinkDecoderCache::Reset() {
+    for (auto& entry : entries_) {
+        entry.decoder->ResetState();
+    }
+}
+
+void DownlinkDecoderCache::ResetResamplers() {
+    for (auto& entry : entries_) {
+        for (auto& resampler : entry.resamplers) {
+            resampler.Reset();
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef DOWNLINK_DECODER_CACHE_H
+#define DOWNLINK_DECODER_CACHE_H
+
+#include <sdkconfig.h>
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include "opus_stream.h"
+#include "frame_resampler.h"
+
+// Stream formats that keep their own decoder state, each costs one Opus decoder state
+#if CONFIG_USE_LEAN_PROFILE
+#define DOWNLINK_DECODER_CACHE_SIZE 1
+#else
+#define DOWNLINK_DECODER_CACHE_SIZE 2
+#endif
+
+struct DownlinkDecoder {
+    std::unique_ptr<OpusStreamDecoder> decoder;
+    // One per decoded channel when the stream rate is not the codec's, they read and write
+    // the interleaved frame in place
+    std::vector<FrameResampler> resamplers;
+    uint32_t last_used = 0;     // 0 while the entry has never served a stream
+};
+
+/*
+ * Decoders and output resamplers for the downlink, one per stream format
+ * (sample rate, frame duration, channels).
+ *
+ * When the server interleaves two formats, e.g. an alert at 16 kHz inside a
+ * 24 kHz reply, every switch used to reinitialize the single decoder and
+ * recompute the resampler filters, so each stream restarted from an empty
+ * state and clicked. Each format now keeps its entry, with its Opus state and
+ * its filter history. A format that is not cached takes the least recently
+ * used entry, which is reinitialized in place. All the states are allocated
+ * at construction and never again.
+ *
+ * Owned by the decode task, except Reset() which any task may call.
+ */
+class DownlinkDecoderCache {
+public:
+    // States sized for `max_channels`, the first entries from the boot arena slots of the downlink
+    DownlinkDecoderCache(int sample_rate, int frame_duration, int max_channels);
+
+    // The entry for the format, its resamplers configured for `output_sample_rate`
+    DownlinkDecoder& Get(int sample_rate, int frame_duration, int channels, int output_sample_rate);
+    // Clears the Opus state of every entry, the next frame of each format starts fresh
+    void Reset();
+    // Clears the filter history of every entry, decode task only
+    void ResetResamplers();
+
+    inline uint32_t misses() const { return misses_; }
+
+private:
+    DownlinkDecoder entries_[DOWNLINK_DECODER_CACHE_SIZE];
+    uint32_t clock_ = 0;
+    uint32_t misses_ = 0;
+};
+
+#endif // DOWNLINK_DECODER_CACHE_H
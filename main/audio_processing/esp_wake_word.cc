@@ -1,5 +1,6 @@
 #include "esp_wake_word.h"
 #include "application.h"
+#include "sr_model_registry.h"
 
 #include <esp_log.h>
 #include <model_path.h>
@@ -17,7 +18,6 @@ EspWakeWord::EspWakeWord() {
 EspWakeWord::~EspWakeWord() {
     if (wakenet_data_ != nullptr) {
         wakenet_iface_->destroy(wakenet_data_);
-        esp_srmodel_deinit(wakenet_model_);
     }
 
     vEventGroupDelete(event_group_);
@@ -26,18 +26,16 @@ EspWakeWord::~EspWakeWord() {
 void EspWakeWord::Initialize(AudioCodec* codec) {
     codec_ = codec;
 
-    wakenet_model_ = esp_srmodel_init("model");
-    if (wakenet_model_ == nullptr || wakenet_model_->num == -1) {
-        ESP_LOGE(TAG, "Failed to initialize wakenet model");
+    // The partition stays mapped by the registry, the model data is used in place
+    auto models = SrModelRegistry::GetInstance().FindAll(ESP_WN_PREFIX);
+    if (models.empty()) {
+        ESP_LOGE(TAG, "No wakenet model found");
         return;
     }
-    if(wakenet_model_->num > 1) {
+    if (models.size() > 1) {
         ESP_LOGW(TAG, "More than one model found, using the first one");
-    } else if (wakenet_model_->num == 0) {
-        ESP_LOGE(TAG, "No model found");
-        return;
     }
-    char *model_name = wakenet_model_->model_name[0];
+    char *model_name = models[0];
     wakenet_iface_ = (esp_wn_iface_t*)esp_wn_handle_from_name(model_name);
     wakenet_data_ = wakenet_iface_->create(model_name, DET_MODE_95);
 
@@ -63,10 +61,16 @@ bool EspWakeWord::IsDetectionRunning() {
 }
 
 void EspWakeWord::Feed(const std::vector<int16_t>& data) {
+#if CONFIG_USE_WAKE_ARBITRATION
+    level_meter_.Feed(data.data(), data.size());
+#endif
     int res = wakenet_iface_->detect(wakenet_data_, (int16_t *)data.data());
     if (res > 0) {
         StopDetection();
         last_detected_wake_word_ = wakenet_iface_->get_word_name(wakenet_data_, res);
+#if CONFIG_USE_WAKE_ARBITRATION
+        wake_word_level_db_ = level_meter_.level_db();
+#endif
 
         if (wake_word_detected_callback_) {
             wake_word_detected_callback_(last_detected_wake_word_);
@@ -84,6 +88,15 @@ size_t EspWakeWord::GetFeedSize() {
 void EspWakeWord::EncodeWakeWordData() {
 }
 
-bool EspWakeWord::GetWakeWordOpus(std::vector<uint8_t>& opus) {
+bool EspWakeWord::GetWakeWordOpus(AudioPayload& opus) {
+    return false;
+}
+
+bool EspWakeWord::GetWakeWordLevel(float& level_db) {
+#if CONFIG_USE_WAKE_ARBITRATION
+    level_db = wake_word_level_db_;
+    return true;
+#else
     return false;
+#endif
 }
@@ -15,6 +15,7 @@
 #include <functional>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 
 #include "audio_codec.h"
 #include "wake_word.h"
@@ -32,18 +33,22 @@ public:
     bool IsDetectionRunning();
     size_t GetFeedSize();
     void EncodeWakeWordData();
-    bool GetWakeWordOpus(std::vector<uint8_t>& opus);
+    bool GetWakeWordOpus(AudioPayload& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
+    bool GetWakeWordLevel(float& level_db);
 
 private:
     esp_wn_iface_t *wakenet_iface_ = nullptr;
     model_iface_data_t *wakenet_data_ = nullptr;
-    srmodel_list_t *wakenet_model_ = nullptr;
     EventGroupHandle_t event_group_;
     AudioCodec* codec_ = nullptr;
 
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
     std::string last_detected_wake_word_;
+#if CONFIG_USE_WAKE_ARBITRATION
+    WakeWordLevelMeter level_meter_;    // Feeding task
+    std::atomic<float> wake_word_level_db_ = -100.0f;
+#endif
 };
 
 #endif
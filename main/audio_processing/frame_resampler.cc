@@ -0,0 +1,139 @@
+#include "frame_resampler.h"
+
+#include <esp_log.h>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
+
+#define TAG "FrameResampler"
+
+// Zero crossings of the windowed sinc on each side, at the lower of the two rates
+#define FRAME_RESAMPLER_ZERO_CROSSINGS 8
+
+void FrameResampler::Configure(int input_sample_rate, int output_sample_rate) {
+    if (input_sample_rate == input_sample_rate_ && output_sample_rate == output_sample_rate_) {
+        Reset();
+        return;
+    }
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+
+    int divisor = std::gcd(input_sample_rate, output_sample_rate);
+    up_ = output_sample_rate / divisor;
+    down_ = input_sample_rate / divisor;
+    interpolate_ = up_ > FRAME_RESAMPLER_MAX_PHASES;
+    phases_ = interpolate_ ? FRAME_RESAMPLER_MAX_PHASES : up_;
+
+    // The cutoff is relative to the input Nyquist frequency, leave some room when decimating
+    double cutoff = up_ >= down_ ? 1.0 : 0.95 * up_ / down_;
+    int half = (int)std::ceil(FRAME_RESAMPLER_ZERO_CROSSINGS / cutoff);
+    taps_ = half * 2;
+
+    coefficients_.assign((phases_ + 1) * taps_, 0);
+    std::vector<double> row(taps_);
+    for (int p = 0; p <= phases_; p++) {
+        double fraction = (double)p / phases_;
+        double sum = 0;
+        for (int j = 0; j < taps_; j++) {
+            double t = fraction + half - 1 - j;
+            double x = cutoff * t;
+            double sinc = x == 0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+            double w = std::fabs(t) >= half ? 0 : 0.42 + 0.5 * std::cos(M_PI * t / half) + 0.08 * std::cos(2 * M_PI * t / half);
+            row[j] = sinc * w;
+            sum += row[j];
+        }
+        // Normalize every phase to unity gain at DC, and put the rounding error on the largest tap
+        int total = 0;
+        int largest = 0;
+        int16_t* coefficients = &coefficients_[p * taps_];
+        for (int j = 0; j < taps_; j++) {
+            coefficients[j] = (int16_t)std::lround(row[j] / sum * 32767);
+            total += coefficients[j];
+            if (std::abs(coefficients[j]) > std::abs(coefficients[largest])) {
+                largest = j;
+            }
+        }
+        coefficients[largest] = (int16_t)std::clamp(coefficients[largest] + 32767 - total, -32768, 32767);
+    }
+
+    work_.assign(taps_ - 1, 0);
+    Reset();
+    ESP_LOGI(TAG, "Resampler %d -> %d: %d/%d, %d taps, %d phases%s", input_sample_rate, output_sample_rate,
+        up_, down_, taps_, phases_, interpolate_ ? ", interpolated" : "");
+}
+
+void FrameResampler::Reset() {
+    if (taps_ == 0) {
+        return;
+    }
+    std::fill(work_.begin(), work_.end(), 0);
+    base_ = taps_ / 2 - 1;
+    phase_ = 0;
+}
+
+size_t FrameResampler::GetOutputSamples(size_t input_frames) const {
+    return (input_frames * up_ + down_ - 1) / down_ + 1;
+}
+
+static inline int32_t DotProduct(const int16_t* samples, const int16_t* coefficients, int taps) {
+    int32_t acc = 0;
+    int j = 0;
+    for (; j + 4 <= taps; j += 4) {
+        acc += samples[j] * coefficients[j];
+        acc += samples[j + 1] * coefficients[j + 1];
+        acc += samples[j + 2] * coefficients[j + 2];
+        acc += samples[j + 3] * coefficients[j + 3];
+    }
+    for (; j < taps; j++) {
+        acc += samples[j] * coefficients[j];
+    }
+    return acc;
+}
+
+size_t FrameResampler::Process(const int16_t* input, size_t input_frames, int16_t* output,
+    size_t input_stride, size_t output_stride) {
+    if (taps_ == 0) {
+        ESP_LOGE(TAG, "Resampler is not configured");
+        return 0;
+    }
+
+    size_t history = taps_ - 1;
+    size_t length = history + input_frames;
+    if (work_.size() < length) {
+        work_.resize(length);
+    }
+    // Gather the frame behind the history, picking one channel when the input is interleaved
+    int16_t* samples = work_.data();
+    for (size_t i = 0; i < input_frames; i++) {
+        samples[history + i] = input[i * input_stride];
+    }
+
+    size_t half = taps_ / 2;
+    size_t produced = 0;
+    while (base_ + half < length) {
+        const int16_t* window = samples + base_ + 1 - half;
+        int32_t value;
+        if (!interpolate_) {
+            value = DotProduct(window, &coefficients_[phase_ * taps_], taps_) >> 15;
+        } else {
+            int64_t scaled = (int64_t)phase_ * phases_;
+            int p = scaled / up_;
+            int32_t weight = ((scaled % up_) << 15) / up_;
+            int32_t a = DotProduct(window, &coefficients_[p * taps_], taps_);
+            int32_t b = DotProduct(window, &coefficients_[(p + 1) * taps_], taps_);
+            value = (a + (int32_t)(((int64_t)(b - a) * weight) >> 15)) >> 15;
+        }
+        output[produced * output_stride] = (int16_t)std::clamp<int32_t>(value, INT16_MIN, INT16_MAX);
+        produced++;
+
+        phase_ += down_;
+        base_ += phase_ / up_;
+        phase_ %= up_;
+    }
+
+    // Keep the tail of this frame as the history of the next one
+    memmove(samples, samples + input_frames, history * sizeof(int16_t));
+    base_ -= input_frames;
+    return produced;
+}
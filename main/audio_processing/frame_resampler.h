@@ -0,0 +1,56 @@
+#ifndef FRAME_RESAMPLER_H
+#define FRAME_RESAMPLER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Streaming polyphase sample rate converter for 16-bit mono frames.
+ *
+ * The ratio is reduced to up/down. When `up` has at most
+ * FRAME_RESAMPLER_MAX_PHASES phases, every output sample is a single dot
+ * product with an exact phase of the filter bank, so integer ratios like
+ * 24k->48k (2/1) and 48k->16k (1/3) never interpolate. Other ratios, such as
+ * 44.1k->16k, interpolate between two of the FRAME_RESAMPLER_MAX_PHASES phases.
+ *
+ * The filter history lives in the resampler, so consecutive frames join
+ * without discontinuities, and its buffers only grow on the first frame.
+ * The strides let a caller read one channel of an interleaved buffer and
+ * write into an interleaved buffer directly, so no separate deinterleave
+ * pass is needed.
+ */
+#define FRAME_RESAMPLER_MAX_PHASES 64
+
+class FrameResampler {
+public:
+    FrameResampler() = default;
+
+    void Configure(int input_sample_rate, int output_sample_rate);
+    void Reset();
+    // Upper bound of the output frames produced for `input_frames`, to size buffers
+    size_t GetOutputSamples(size_t input_frames) const;
+    // Returns the number of output frames written
+    size_t Process(const int16_t* input, size_t input_frames, int16_t* output,
+        size_t input_stride = 1, size_t output_stride = 1);
+
+    inline int input_sample_rate() const { return input_sample_rate_; }
+    inline int output_sample_rate() const { return output_sample_rate_; }
+
+private:
+    int input_sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+    int up_ = 1;
+    int down_ = 1;
+    int phases_ = 1;
+    int taps_ = 0;
+    bool interpolate_ = false;
+    // (phases_ + 1) rows of taps_ Q15 coefficients, the last row is one input sample later than row 0
+    std::vector<int16_t> coefficients_;
+    // taps_ - 1 samples of history followed by the current frame
+    std::vector<int16_t> work_;
+    size_t base_ = 0;
+    int phase_ = 0;
+};
+
+#endif // FRAME_RESAMPLER_H
@@ -0,0 +1,160 @@
+#include "gated_wake_word.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <cstdlib>
+
+#define TAG "GatedWakeWord"
+
+GatedWakeWord::GatedWakeWord(std::unique_ptr<WakeWord> detector) : detector_(std::move(detector)) {
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "wake_word", &pm_lock_) != ESP_OK) {
+        // Without power management there is nothing to lock, the gate still saves the detector's work
+        pm_lock_ = nullptr;
+    }
+}
+
+GatedWakeWord::~GatedWakeWord() {
+    Close();
+    if (pm_lock_ != nullptr) {
+        esp_pm_lock_delete(pm_lock_);
+    }
+}
+
+void GatedWakeWord::Initialize(AudioCodec* codec) {
+    codec_ = codec;
+    detector_->Initialize(codec);
+}
+
+int GatedWakeWord::MeasureLevel(const std::vector<int16_t>& data) const {
+    // The first channel is a microphone, the reference channels follow it
+    int channels = codec_->input_channels();
+    size_t samples = data.size() / channels;
+    if (samples == 0) {
+        return 0;
+    }
+    int64_t sum = 0;
+    for (size_t i = 0; i < data.size(); i += channels) {
+        sum += std::abs(data[i]);
+    }
+    return sum / samples;
+}
+
+void GatedWakeWord::Feed(const std::vector<int16_t>& data) {
+    if (reset_.exchange(false)) {
+        Close();
+        backfill_count_ = 0;
+        noise_floor_ = 0;
+    }
+    if (backfill_.empty()) {
+        int chunk_ms = std::max<int>(1, data.size() / codec_->input_channels() / 16);
+        backfill_.resize(std::max(1, WAKE_WORD_GATE_BACKFILL_MS / chunk_ms));
+        hangover_chunks_ = std::max(1, WAKE_WORD_GATE_HANGOVER_MS / chunk_ms);
+    }
+
+    // The floor follows quiet passages at once and louder ones only over seconds
+    int level = MeasureLevel(data);
+    if (noise_floor_ == 0 || level < noise_floor_) {
+        noise_floor_ = level;
+    } else {
+        noise_floor_ += std::max(1, (level - noise_floor_) / 256);
+    }
+    bool voiced = level >= WAKE_WORD_GATE_MIN_LEVEL && level > noise_floor_ * WAKE_WORD_GATE_RATIO;
+
+    if (voiced) {
+        hangover_left_ = hangover_chunks_;
+        if (!open_) {
+            Open();
+        }
+    }
+    if (open_) {
+        detector_->Feed(data);
+        if (!voiced && --hangover_left_ <= 0) {
+            Close();
+        }
+        return;
+    }
+
+    auto& slot = backfill_[(backfill_head_ + backfill_count_) % backfill_.size()];
+    if (backfill_count_ == backfill_.size()) {
+        backfill_head_ = (backfill_head_ + 1) % backfill_.size();
+    } else {
+        backfill_count_++;
+    }
+    slot.assign(data.begin(), data.end());
+}
+
+void GatedWakeWord::Open() {
+    if (pm_lock_ != nullptr) {
+        esp_pm_lock_acquire(pm_lock_);
+    }
+    open_ = true;
+    segments_++;
+    ESP_LOGD(TAG, "Voice segment %lu, noise floor %d", segments_, noise_floor_);
+
+    // Oldest first, so the detector sees the onset the gate reacted to late
+    for (size_t i = 0; i < backfill_count_; i++) {
+        detector_->Feed(backfill_[(backfill_head_ + i) % backfill_.size()]);
+    }
+    backfill_head_ = 0;
+    backfill_count_ = 0;
+}
+
+void GatedWakeWord::Close() {
+    if (!open_) {
+        return;
+    }
+    open_ = false;
+    if (pm_lock_ != nullptr) {
+        esp_pm_lock_release(pm_lock_);
+    }
+}
+
+void GatedWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
+    detector_->OnWakeWordDetected(callback);
+}
+
+void GatedWakeWord::StartDetection() {
+    reset_ = true;
+    detector_->StartDetection();
+}
+
+// The gate is closed by the next StartDetection, a running conversation needs the CPU anyway
+void GatedWakeWord::StopDetection() {
+    detector_->StopDetection();
+}
+
+bool GatedWakeWord::IsDetectionRunning() {
+    return detector_->IsDetectionRunning();
+}
+
+size_t GatedWakeWord::GetFeedSize() {
+    return detector_->GetFeedSize();
+}
+
+void GatedWakeWord::EncodeWakeWordData() {
+    detector_->EncodeWakeWordData();
+}
+
+bool GatedWakeWord::GetWakeWordOpus(AudioPayload& opus) {
+    return detector_->GetWakeWordOpus(opus);
+}
+
+const std::string& GatedWakeWord::GetLastDetectedWakeWord() const {
+    return detector_->GetLastDetectedWakeWord();
+}
+
+bool GatedWakeWord::SetCommandWords(const std::vector<std::string>& phrases) {
+    return detector_->SetCommandWords(phrases);
+}
+
+void GatedWakeWord::OnCommandDetected(std::function<void(const CommandWord& command)> callback) {
+    detector_->OnCommandDetected(callback);
+}
+
+bool GatedWakeWord::GetSpeakerEmbedding(std::vector<float>& embedding) {
+    return detector_->GetSpeakerEmbedding(embedding);
+}
+
+bool GatedWakeWord::GetWakeWordLevel(float& level_db) {
+    return detector_->GetWakeWordLevel(level_db);
+}
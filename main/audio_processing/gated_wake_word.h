@@ -0,0 +1,72 @@
+#ifndef GATED_WAKE_WORD_H
+#define GATED_WAKE_WORD_H
+
+#include <esp_pm.h>
+
+#include <memory>
+#include <vector>
+#include <atomic>
+
+#include "wake_word.h"
+
+// Audio kept while the gate is closed and replayed into the detector when it opens
+#define WAKE_WORD_GATE_BACKFILL_MS 320
+// The gate stays open this long after the last voiced chunk, wake words have short pauses
+#define WAKE_WORD_GATE_HANGOVER_MS 1500
+// Voiced when the level is this many times the noise floor, about 10 dB
+#define WAKE_WORD_GATE_RATIO 3
+// Mean absolute sample value below which nothing counts as voice, about -50 dBFS
+#define WAKE_WORD_GATE_MIN_LEVEL 100
+
+/*
+ * Runs the wake word detector only while someone is talking.
+ *
+ * Each feed chunk costs one pass over the samples to measure its level
+ * against a slowly rising noise floor. While the level stays near the
+ * floor the chunks only go into a short ring, and the CPU is free to clock
+ * down. A loud chunk opens the gate: the ring is replayed so the detector
+ * sees the onset of the word, then chunks pass through until the hangover
+ * runs out. A PM lock keeps the CPU at full speed while the gate is open.
+ */
+class GatedWakeWord : public WakeWord {
+public:
+    explicit GatedWakeWord(std::unique_ptr<WakeWord> detector);
+    ~GatedWakeWord();
+
+    void Initialize(AudioCodec* codec) override;
+    void Feed(const std::vector<int16_t>& data) override;
+    void OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) override;
+    void StartDetection() override;
+    void StopDetection() override;
+    bool IsDetectionRunning() override;
+    size_t GetFeedSize() override;
+    void EncodeWakeWordData() override;
+    bool GetWakeWordOpus(AudioPayload& opus) override;
+    const std::string& GetLastDetectedWakeWord() const override;
+    bool SetCommandWords(const std::vector<std::string>& phrases) override;
+    void OnCommandDetected(std::function<void(const CommandWord& command)> callback) override;
+    bool GetSpeakerEmbedding(std::vector<float>& embedding) override;
+    bool GetWakeWordLevel(float& level_db) override;
+
+private:
+    std::unique_ptr<WakeWord> detector_;
+    AudioCodec* codec_ = nullptr;
+    esp_pm_lock_handle_t pm_lock_ = nullptr;
+    // Set by StartDetection, the gate state itself belongs to the thread that feeds
+    std::atomic<bool> reset_ = true;
+
+    std::vector<std::vector<int16_t>> backfill_;
+    size_t backfill_head_ = 0;
+    size_t backfill_count_ = 0;
+    int noise_floor_ = 0;
+    int hangover_chunks_ = 0;
+    int hangover_left_ = 0;
+    bool open_ = false;
+    uint32_t segments_ = 0;
+
+    int MeasureLevel(const std::vector<int16_t>& data) const;
+    void Open();
+    void Close();
+};
+
+#endif // GATED_WAKE_WORD_H
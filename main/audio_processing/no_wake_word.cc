@@ -35,7 +35,7 @@ void NoWakeWord::EncodeWakeWordData() {
     // Do nothing - no encoding needed
 }
 
-bool NoWakeWord::GetWakeWordOpus(std::vector<uint8_t>& opus) {
+bool NoWakeWord::GetWakeWordOpus(AudioPayload& opus) {
     opus.clear();
     return false;  // No opus data available
 }
@@ -21,7 +21,7 @@ public:
     bool IsDetectionRunning() override;
     size_t GetFeedSize() override;
     void EncodeWakeWordData() override;
-    bool GetWakeWordOpus(std::vector<uint8_t>& opus) override;
+    bool GetWakeWordOpus(AudioPayload& opus) override;
     const std::string& GetLastDetectedWakeWord() const override;
 
 private:
@@ -0,0 +1,227 @@
+#include "opus_stream.h"
+
+#include <esp_log.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+#define TAG "OpusStream"
+
+#define MAX_OPUS_PACKET_SIZE 1500
+
+// From the boot arena slot if it has room, else from the heap. `held` tells the owner where to give it back
+static void* AllocateState(BootSlot slot, size_t size, BootSlot& held) {
+    void* state = BootArena::GetInstance().Acquire(slot, size);
+    if (state != nullptr) {
+        held = slot;
+        return state;
+    }
+    held = kBootSlotNone;
+    return malloc(size);
+}
+
+static void FreeState(void* state, BootSlot held) {
+    if (held != kBootSlotNone) {
+        BootArena::GetInstance().Release(held);
+    } else {
+        free(state);
+    }
+}
+
+OpusStreamEncoder::OpusStreamEncoder(int sample_rate, int channels, int duration_ms, BootSlot slot)
+    : sample_rate_(sample_rate), channels_(channels), duration_ms_(duration_ms) {
+    encoder_ = (OpusEncoder*)AllocateState(slot, opus_encoder_get_size(channels), slot_);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the audio encoder");
+        return;
+    }
+    int error = opus_encoder_init(encoder_, sample_rate, channels, OPUS_APPLICATION_VOIP);
+    if (error != OPUS_OK) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+        FreeState(encoder_, slot_);
+        encoder_ = nullptr;
+        return;
+    }
+    frame_size_ = sample_rate / 1000 * channels * duration_ms;
+    Configure(profile_);
+}
+
+OpusStreamEncoder::~OpusStreamEncoder() {
+    if (encoder_ != nullptr) {
+        FreeState(encoder_, slot_);
+    }
+}
+
+void OpusStreamEncoder::Configure(const OpusEncoderProfile& profile) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    profile_ = profile;
+    if (encoder_ == nullptr) {
+        return;
+    }
+    opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(profile.complexity));
+    opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(profile.bitrate > 0 ? profile.bitrate : OPUS_AUTO));
+    opus_encoder_ctl(encoder_, OPUS_SET_VBR(profile.vbr ? 1 : 0));
+    opus_encoder_ctl(encoder_, OPUS_SET_INBAND_FEC(profile.fec ? 1 : 0));
+    opus_encoder_ctl(encoder_, OPUS_SET_PACKET_LOSS_PERC(profile.fec ? profile.packet_loss_percent : 0));
+    opus_encoder_ctl(encoder_, OPUS_SET_DTX(profile.dtx ? 1 : 0));
+    ESP_LOGI(TAG, "Encoder profile: complexity %d, bitrate %d, vbr %d, fec %d (%d%%), dtx %d",
+        profile.complexity, profile.bitrate, profile.vbr, profile.fec, profile.packet_loss_percent, profile.dtx);
+}
+
+void OpusStreamEncoder::SetComplexity(int complexity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    profile_.complexity = complexity;
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(complexity));
+    }
+}
+
+void OpusStreamEncoder::SetBitrate(int bitrate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    profile_.bitrate = bitrate;
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(bitrate > 0 ? bitrate : OPUS_AUTO));
+    }
+}
+
+void OpusStreamEncoder::SetFrameDuration(int duration_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (duration_ms == duration_ms_) {
+        return;
+    }
+    duration_ms_ = duration_ms;
+    frame_size_ = sample_rate_ / 1000 * channels_ * duration_ms;
+    in_buffer_.clear();
+    ESP_LOGI(TAG, "Encoder frame duration: %d ms", duration_ms);
+}
+
+void OpusStreamEncoder::Encode(std::vector<int16_t>&& pcm, std::function<void(AudioPayload&& opus)> handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Audio encoder is not configured");
+        return;
+    }
+
+    if (in_buffer_.empty()) {
+        in_buffer_ = std::move(pcm);
+    } else {
+        in_buffer_.insert(in_buffer_.end(), pcm.begin(), pcm.end());
+    }
+    EncodeFrames(handler);
+}
+
+void OpusStreamEncoder::Encode(const int16_t* pcm, size_t samples, std::function<void(AudioPayload&& opus)> handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Audio encoder is not configured");
+        return;
+    }
+
+    in_buffer_.insert(in_buffer_.end(), pcm, pcm + samples);
+    EncodeFrames(handler);
+}
+
+void OpusStreamEncoder::EncodeFrames(const std::function<void(AudioPayload&& opus)>& handler) {
+    size_t offset = 0;
+    while (in_buffer_.size() - offset >= (size_t)frame_size_) {
+        out_buffer_.resize(MAX_OPUS_PACKET_SIZE);
+        auto ret = opus_encode(encoder_, in_buffer_.data() + offset, frame_size_ / channels_, out_buffer_.data(), out_buffer_.size());
+        offset += frame_size_;
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to encode audio, error code: %ld", (long)ret);
+            continue;
+        }
+        // With DTX a 1-2 byte packet marks silence, it is still sent so the server keeps its timing
+        if (handler != nullptr) {
+            handler(AudioPayload(out_buffer_.begin(), out_buffer_.begin() + ret));
+        }
+    }
+    in_buffer_.erase(in_buffer_.begin(), in_buffer_.begin() + offset);
+}
+
+size_t OpusStreamEncoder::buffered_samples() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return in_buffer_.size() / channels_;
+}
+
+void OpusStreamEncoder::ResetState() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    }
+    in_buffer_.clear();
+}
+
+// The state size only depends on the channel count, so a new sample rate or frame duration
+// reuses the same block instead of leaving a hole in the heap for every stream format
+OpusStreamDecoder::OpusStreamDecoder(int sample_rate, int channels, int duration_ms, int max_channels, BootSlot slot)
+    : max_channels_(std::max(channels, max_channels)) {
+    decoder_ = (OpusDecoder*)AllocateState(slot, opus_decoder_get_size(max_channels_), slot_);
+    if (decoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the audio decoder");
+        return;
+    }
+    Configure(sample_rate, channels, duration_ms);
+}
+
+OpusStreamDecoder::~OpusStreamDecoder() {
+    if (decoder_ != nullptr) {
+        FreeState(decoder_, slot_);
+    }
+}
+
+bool OpusStreamDecoder::Configure(int sample_rate, int channels, int duration_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sample_rate_ = sample_rate;
+    channels_ = channels;
+    duration_ms_ = duration_ms;
+    frame_size_ = sample_rate / 1000 * channels * duration_ms;
+    configured_ = false;
+    if (decoder_ == nullptr) {
+        return false;
+    }
+    if (channels > max_channels_) {
+        ESP_LOGE(TAG, "Decoder state is sized for %d channels, not %d", max_channels_, channels);
+        return false;
+    }
+    int error = opus_decoder_init(decoder_, sample_rate, channels);
+    if (error != OPUS_OK) {
+        ESP_LOGE(TAG, "Failed to initialize audio decoder, error code: %d", error);
+        return false;
+    }
+    configured_ = true;
+    return true;
+}
+
+bool OpusStreamDecoder::Decode(const uint8_t* opus, size_t size, std::vector<int16_t>& pcm) {
+    return DecodeInternal(opus, size, pcm, 0);
+}
+
+bool OpusStreamDecoder::DecodeFec(const uint8_t* next_opus, size_t size, std::vector<int16_t>& pcm) {
+    return DecodeInternal(next_opus, size, pcm, 1);
+}
+
+bool OpusStreamDecoder::DecodeInternal(const uint8_t* opus, size_t size, std::vector<int16_t>& pcm, int decode_fec) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!configured_) {
+        ESP_LOGE(TAG, "Audio decoder is not configured");
+        return false;
+    }
+
+    pcm.resize(frame_size_);
+    auto data = size == 0 ? nullptr : opus;
+    auto ret = opus_decode(decoder_, data, size, pcm.data(), frame_size_ / channels_, decode_fec);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to decode audio, error code: %d", ret);
+        return false;
+    }
+    pcm.resize(ret * channels_);
+    return true;
+}
+
+void OpusStreamDecoder::ResetState() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (configured_) {
+        opus_decoder_ctl(decoder_, OPUS_RESET_STATE);
+    }
+}
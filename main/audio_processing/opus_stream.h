@@ -0,0 +1,103 @@
+#ifndef OPUS_STREAM_H
+#define OPUS_STREAM_H
+
+#include <opus.h>
+
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+#include "audio_payload.h"
+#include "boot_arena.h"
+
+// Uplink encoder settings, chosen per transport by Application
+struct OpusEncoderProfile {
+    int complexity = 0;
+    int bitrate = 0;                // bits per second, 0 lets Opus choose
+    bool vbr = true;
+    bool fec = false;               // in-band forward error correction
+    int packet_loss_percent = 0;    // expected loss, drives how much FEC data is added
+    bool dtx = false;               // discontinuous transmission during silence
+};
+
+/*
+ * OpusEncoderWrapper / OpusDecoderWrapper only expose complexity and DTX.
+ * These keep the same streaming interface but own the raw Opus state so the
+ * application can tune bitrate, VBR and FEC, and recover lost frames.
+ */
+class OpusStreamEncoder {
+public:
+    // The state comes from `slot` of the boot arena when it was reserved, else from the heap
+    OpusStreamEncoder(int sample_rate, int channels, int duration_ms, BootSlot slot = kBootSlotNone);
+    ~OpusStreamEncoder();
+
+    inline int sample_rate() const { return sample_rate_; }
+    inline int duration_ms() const { return duration_ms_; }
+    inline const OpusEncoderProfile& profile() const { return profile_; }
+
+    void Configure(const OpusEncoderProfile& profile);
+    void SetComplexity(int complexity);
+    void SetBitrate(int bitrate);
+    // Change the frame duration, any partially buffered frame is dropped
+    void SetFrameDuration(int duration_ms);
+    void Encode(std::vector<int16_t>&& pcm, std::function<void(AudioPayload&& opus)> handler);
+    // Copies into the frame buffer, which keeps its capacity, so a caller-owned buffer can be reused
+    void Encode(const int16_t* pcm, size_t samples, std::function<void(AudioPayload&& opus)> handler);
+    // Samples waiting for the next full frame
+    size_t buffered_samples();
+    void ResetState();
+
+private:
+    std::mutex mutex_;
+    OpusEncoder* encoder_ = nullptr;
+    BootSlot slot_ = kBootSlotNone;     // Where encoder_ is held, kBootSlotNone for the heap
+    OpusEncoderProfile profile_;
+    int sample_rate_;
+    int channels_;
+    int duration_ms_;
+    int frame_size_;
+    std::vector<int16_t> in_buffer_;
+    std::vector<uint8_t> out_buffer_;  // Scratch for opus_encode, packets are copied out at their real size
+
+    // Encodes every full frame in in_buffer_, the mutex must be held
+    void EncodeFrames(const std::function<void(AudioPayload&& opus)>& handler);
+};
+
+class OpusStreamDecoder {
+public:
+    // The state is allocated once for up to `max_channels`, 0 for `channels`, from `slot` of the boot arena
+    // when it was reserved
+    OpusStreamDecoder(int sample_rate, int channels, int duration_ms, int max_channels = 0,
+        BootSlot slot = kBootSlotNone);
+    ~OpusStreamDecoder();
+
+    // Reinitializes the state in place for another stream format, nothing is reallocated
+    bool Configure(int sample_rate, int channels, int duration_ms);
+
+    inline int sample_rate() const { return sample_rate_; }
+    inline int channels() const { return channels_; }
+    inline int duration_ms() const { return duration_ms_; }
+
+    // Decode a packet in place, e.g. a network payload or a frame of a flash-mapped sound asset.
+    // An empty packet runs packet loss concealment for one frame
+    bool Decode(const uint8_t* opus, size_t size, std::vector<int16_t>& pcm);
+    // Recover the frame lost before `next_opus` from its in-band FEC data
+    bool DecodeFec(const uint8_t* next_opus, size_t size, std::vector<int16_t>& pcm);
+    void ResetState();
+
+private:
+    std::mutex mutex_;
+    OpusDecoder* decoder_ = nullptr;
+    BootSlot slot_ = kBootSlotNone;
+    int max_channels_;
+    bool configured_ = false;
+    int sample_rate_ = 0;
+    int channels_ = 0;
+    int duration_ms_ = 0;
+    int frame_size_ = 0;
+
+    bool DecodeInternal(const uint8_t* opus, size_t size, std::vector<int16_t>& pcm, int decode_fec);
+};
+
+#endif // OPUS_STREAM_H
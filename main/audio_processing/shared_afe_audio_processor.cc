@@ -0,0 +1,48 @@
+#include "shared_afe_audio_processor.h"
+#include <esp_log.h>
+
+#define TAG "SharedAfeAudioProcessor"
+
+// The wake word detector creates the AFE instance when it is initialized
+void SharedAfeAudioProcessor::Initialize(AudioCodec* codec) {
+}
+
+void SharedAfeAudioProcessor::Feed(const int16_t* data, size_t samples) {
+    afe_.Feed(data, samples);
+}
+
+void SharedAfeAudioProcessor::Start() {
+    afe_.StartOutput();
+}
+
+void SharedAfeAudioProcessor::Stop() {
+    afe_.StopOutput();
+}
+
+bool SharedAfeAudioProcessor::IsRunning() {
+    return afe_.IsOutputRunning();
+}
+
+void SharedAfeAudioProcessor::OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) {
+    afe_.OnOutput(callback);
+}
+
+void SharedAfeAudioProcessor::OnVadStateChange(std::function<void(bool speaking)> callback) {
+    afe_.OnVadStateChange(callback);
+}
+
+size_t SharedAfeAudioProcessor::GetFeedSize() {
+    return afe_.GetFeedSize();
+}
+
+// AEC stays on whenever the codec has a reference channel, wake word detection needs it as well.
+// Only the VAD follows the mode, as in the separate VC pipeline.
+void SharedAfeAudioProcessor::EnableDeviceAec(bool enable) {
+#if !CONFIG_USE_DEVICE_AEC
+    if (enable) {
+        ESP_LOGE(TAG, "Device AEC is not supported");
+        return;
+    }
+#endif
+    afe_.EnableVad(!enable);
+}
@@ -0,0 +1,37 @@
+#ifndef SHARED_AFE_AUDIO_PROCESSOR_H
+#define SHARED_AFE_AUDIO_PROCESSOR_H
+
+#include <vector>
+#include <functional>
+
+#include "audio_processor.h"
+#include "audio_codec.h"
+#include "afe_wake_word.h"
+
+/*
+ * Voice uplink taken from the AFE instance of the wake word detector.
+ * AEC and noise suppression run once, their output goes to the encoder and
+ * to WakeNet at the same time. Switching between listening and wake word
+ * detection only flips which consumers are running, and the wake word can
+ * interrupt a reply without a second pipeline.
+ */
+class SharedAfeAudioProcessor : public AudioProcessor {
+public:
+    explicit SharedAfeAudioProcessor(AfeWakeWord& afe) : afe_(afe) {}
+    ~SharedAfeAudioProcessor() = default;
+
+    void Initialize(AudioCodec* codec) override;
+    void Feed(const int16_t* data, size_t samples) override;
+    void Start() override;
+    void Stop() override;
+    bool IsRunning() override;
+    void OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) override;
+    void OnVadStateChange(std::function<void(bool speaking)> callback) override;
+    size_t GetFeedSize() override;
+    void EnableDeviceAec(bool enable) override;
+
+private:
+    AfeWakeWord& afe_;
+};
+
+#endif // SHARED_AFE_AUDIO_PROCESSOR_H
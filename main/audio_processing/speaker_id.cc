@@ -0,0 +1,301 @@
+#include "speaker_id.h"
+#include "settings.h"
+
+#include <esp_log.h>
+#include <cJSON.h>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <algorithm>
+
+#define TAG "SpeakerId"
+
+static float HzToMel(float hz) {
+    return 2595.0f * log10f(1.0f + hz / 700.0f);
+}
+
+static float MelToHz(float mel) {
+    return 700.0f * (powf(10.0f, mel / 2595.0f) - 1.0f);
+}
+
+SpeakerFeatures::SpeakerFeatures()
+    : frames_(SPEAKER_MAX_FRAMES), window_(SPEAKER_FRAME_SAMPLES), cos_(SPEAKER_FRAME_SAMPLES / 2),
+      sin_(SPEAKER_FRAME_SAMPLES / 2), mel_bins_(SPEAKER_MEL_BANDS + 2), dct_(SPEAKER_CEPSTRA * SPEAKER_MEL_BANDS),
+      re_(SPEAKER_FRAME_SAMPLES), im_(SPEAKER_FRAME_SAMPLES) {
+    pending_.reserve(SPEAKER_FRAME_SAMPLES);
+    for (int i = 0; i < SPEAKER_FRAME_SAMPLES; i++) {
+        window_[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / (SPEAKER_FRAME_SAMPLES - 1));
+    }
+    for (int i = 0; i < SPEAKER_FRAME_SAMPLES / 2; i++) {
+        cos_[i] = cosf(2 * M_PI * i / SPEAKER_FRAME_SAMPLES);
+        sin_[i] = -sinf(2 * M_PI * i / SPEAKER_FRAME_SAMPLES);
+    }
+    // Triangular bands evenly spaced in mel from 100 Hz to 7 kHz, voice has little above
+    float low = HzToMel(100), high = HzToMel(7000);
+    for (int i = 0; i < SPEAKER_MEL_BANDS + 2; i++) {
+        float hz = MelToHz(low + (high - low) * i / (SPEAKER_MEL_BANDS + 1));
+        mel_bins_[i] = lroundf(hz * SPEAKER_FRAME_SAMPLES / 16000);
+    }
+    // DCT-II rows 1..N, row 0 is the overall level
+    for (int k = 0; k < SPEAKER_CEPSTRA; k++) {
+        for (int m = 0; m < SPEAKER_MEL_BANDS; m++) {
+            dct_[k * SPEAKER_MEL_BANDS + m] = cosf(M_PI * (k + 1) * (m + 0.5f) / SPEAKER_MEL_BANDS);
+        }
+    }
+}
+
+void SpeakerFeatures::Reset() {
+    reset_ = true;
+    std::lock_guard<std::mutex> lock(mutex_);
+    head_ = 0;
+    count_ = 0;
+}
+
+void SpeakerFeatures::Push(const int16_t* data, size_t samples) {
+    if (reset_.exchange(false)) {
+        pending_.clear();
+    }
+    while (samples > 0) {
+        size_t count = std::min(samples, SPEAKER_FRAME_SAMPLES - pending_.size());
+        pending_.insert(pending_.end(), data, data + count);
+        data += count;
+        samples -= count;
+        if (pending_.size() < SPEAKER_FRAME_SAMPLES) {
+            break;
+        }
+
+        Frame frame;
+        AnalyzeFrame(pending_.data(), frame);
+        pending_.clear();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        frames_[(head_ + count_) % frames_.size()] = frame;
+        if (count_ == frames_.size()) {
+            head_ = (head_ + 1) % frames_.size();
+        } else {
+            count_++;
+        }
+    }
+}
+
+void SpeakerFeatures::Fft() {
+    const int n = SPEAKER_FRAME_SAMPLES;
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(re_[i], re_[j]);
+            std::swap(im_[i], im_[j]);
+        }
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        int step = n / len;
+        for (int i = 0; i < n; i += len) {
+            for (int k = 0; k < len / 2; k++) {
+                float wr = cos_[k * step], wi = sin_[k * step];
+                int a = i + k, b = i + k + len / 2;
+                float tr = re_[b] * wr - im_[b] * wi;
+                float ti = re_[b] * wi + im_[b] * wr;
+                re_[b] = re_[a] - tr;
+                im_[b] = im_[a] - ti;
+                re_[a] += tr;
+                im_[a] += ti;
+            }
+        }
+    }
+}
+
+void SpeakerFeatures::AnalyzeFrame(const int16_t* data, Frame& frame) {
+    float energy = 0;
+    float previous = data[0];
+    for (int i = 0; i < SPEAKER_FRAME_SAMPLES; i++) {
+        // Pre-emphasis lifts the upper formants, they carry most of the speaker
+        float sample = data[i] - 0.97f * previous;
+        previous = data[i];
+        re_[i] = sample * window_[i];
+        im_[i] = 0;
+        energy += (float)data[i] * data[i];
+    }
+    frame.energy = logf(energy + 1.0f);
+    Fft();
+
+    float log_mel[SPEAKER_MEL_BANDS];
+    for (int m = 0; m < SPEAKER_MEL_BANDS; m++) {
+        int lo = mel_bins_[m], center = mel_bins_[m + 1], hi = mel_bins_[m + 2];
+        float sum = 0;
+        for (int k = lo; k < hi; k++) {
+            float weight = k < center ? (float)(k - lo) / std::max(1, center - lo)
+                                      : (float)(hi - k) / std::max(1, hi - center);
+            sum += weight * (re_[k] * re_[k] + im_[k] * im_[k]);
+        }
+        log_mel[m] = logf(sum + 1.0f);
+    }
+    for (int k = 0; k < SPEAKER_CEPSTRA; k++) {
+        float c = 0;
+        for (int m = 0; m < SPEAKER_MEL_BANDS; m++) {
+            c += dct_[k * SPEAKER_MEL_BANDS + m] * log_mel[m];
+        }
+        frame.cepstra[k] = c * sqrtf(2.0f / SPEAKER_MEL_BANDS);
+    }
+}
+
+bool SpeakerFeatures::GetEmbedding(std::vector<float>& embedding) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    float loudest = 0;
+    for (size_t i = 0; i < count_; i++) {
+        loudest = std::max(loudest, frames_[(head_ + i) % frames_.size()].energy);
+    }
+
+    embedding.assign(SPEAKER_CEPSTRA * 2, 0);
+    int voiced = 0;
+    for (size_t i = 0; i < count_; i++) {
+        auto& frame = frames_[(head_ + i) % frames_.size()];
+        if (frame.energy < loudest - SPEAKER_VOICED_RANGE) {
+            continue;
+        }
+        voiced++;
+        for (int k = 0; k < SPEAKER_CEPSTRA; k++) {
+            embedding[k] += frame.cepstra[k];
+            embedding[SPEAKER_CEPSTRA + k] += frame.cepstra[k] * frame.cepstra[k];
+        }
+    }
+    if (voiced < SPEAKER_MIN_VOICED_FRAMES) {
+        ESP_LOGW(TAG, "Only %d voiced frames, no embedding", voiced);
+        embedding.clear();
+        return false;
+    }
+    for (int k = 0; k < SPEAKER_CEPSTRA; k++) {
+        float mean = embedding[k] / voiced;
+        float variance = embedding[SPEAKER_CEPSTRA + k] / voiced - mean * mean;
+        embedding[k] = mean;
+        embedding[SPEAKER_CEPSTRA + k] = sqrtf(std::max(0.0f, variance));
+    }
+    return true;
+}
+
+SpeakerProfiles::SpeakerProfiles() {
+    Load();
+}
+
+// One profile per line: name, enrollment count, then the embedding
+void SpeakerProfiles::Load() {
+    Settings settings("speaker");
+    std::stringstream lines(settings.GetString("profiles"));
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::stringstream ss(line);
+        Profile profile;
+        if (!std::getline(ss, profile.name, ',') || !(ss >> profile.count)) {
+            continue;
+        }
+        float value;
+        char comma;
+        while (ss >> comma >> value) {
+            profile.embedding.push_back(value);
+        }
+        if (profile.embedding.size() == SPEAKER_CEPSTRA * 2) {
+            profiles_.push_back(std::move(profile));
+        }
+    }
+    ESP_LOGI(TAG, "%u speaker profiles", (unsigned)profiles_.size());
+}
+
+void SpeakerProfiles::Save() {
+    std::string value;
+    char number[16];
+    for (auto& profile : profiles_) {
+        value += profile.name + "," + std::to_string(profile.count);
+        for (float v : profile.embedding) {
+            snprintf(number, sizeof(number), ",%.3f", v);
+            value += number;
+        }
+        value += "\n";
+    }
+    Settings settings("speaker", true);
+    settings.SetString("profiles", value);
+}
+
+std::string SpeakerProfiles::Match(const std::vector<float>& embedding, float max_distance, float* distance) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Profile* best = nullptr;
+    float best_distance = INFINITY;
+    for (auto& profile : profiles_) {
+        float sum = 0;
+        for (size_t i = 0; i < embedding.size(); i++) {
+            float d = embedding[i] - profile.embedding[i];
+            sum += d * d;
+        }
+        float rms = sqrtf(sum / embedding.size());
+        if (rms < best_distance) {
+            best_distance = rms;
+            best = &profile;
+        }
+    }
+    if (distance != nullptr) {
+        *distance = best_distance;
+    }
+    if (best == nullptr || best_distance > max_distance) {
+        return "";
+    }
+    return best->name;
+}
+
+bool SpeakerProfiles::Enroll(const std::string& name, const std::vector<float>& embedding) {
+    // Names are stored between commas and newlines
+    if (name.empty() || name.find_first_of(",\n") != std::string::npos || embedding.size() != SPEAKER_CEPSTRA * 2) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find_if(profiles_.begin(), profiles_.end(), [&name](const Profile& p) { return p.name == name; });
+    if (it == profiles_.end()) {
+        if (profiles_.size() >= SPEAKER_MAX_PROFILES) {
+            ESP_LOGW(TAG, "Speaker profiles are full");
+            return false;
+        }
+        profiles_.push_back(Profile{name, 1, embedding});
+    } else {
+        // Running mean over the enrollments, capped so the profile keeps following the voice
+        it->count = std::min(it->count + 1, 10);
+        for (size_t i = 0; i < embedding.size(); i++) {
+            it->embedding[i] += (embedding[i] - it->embedding[i]) / it->count;
+        }
+    }
+    Save();
+    ESP_LOGI(TAG, "Enrolled speaker %s", name.c_str());
+    return true;
+}
+
+bool SpeakerProfiles::Remove(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find_if(profiles_.begin(), profiles_.end(), [&name](const Profile& p) { return p.name == name; });
+    if (it == profiles_.end()) {
+        return false;
+    }
+    profiles_.erase(it);
+    Save();
+    return true;
+}
+
+bool SpeakerProfiles::empty() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return profiles_.empty();
+}
+
+std::string SpeakerProfiles::GetJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cJSON* json = cJSON_CreateArray();
+    for (auto& profile : profiles_) {
+        auto item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "name", profile.name.c_str());
+        cJSON_AddNumberToObject(item, "enrollments", profile.count);
+        cJSON_AddItemToArray(json, item);
+    }
+    auto str = cJSON_PrintUnformatted(json);
+    std::string result(str);
+    cJSON_free(str);
+    cJSON_Delete(json);
+    return result;
+}
@@ -0,0 +1,101 @@
+#ifndef SPEAKER_ID_H
+#define SPEAKER_ID_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// Analysis frames of 32 ms at 16 kHz without overlap, the FFT size as well
+#define SPEAKER_FRAME_SAMPLES 512
+#define SPEAKER_MEL_BANDS 24
+#define SPEAKER_CEPSTRA 12
+// About the 2 seconds of wake word pre-roll
+#define SPEAKER_MAX_FRAMES 64
+// Frames more than ~13 dB below the loudest one are pauses or noise and left out
+#define SPEAKER_VOICED_RANGE 3.0f
+// An embedding needs about 0.3 s of voice, shorter wake words are not identified
+#define SPEAKER_MIN_VOICED_FRAMES 10
+#define SPEAKER_MAX_PROFILES 8
+
+/*
+ * A voice signature of the wake word, cheap enough to compute on every chunk
+ * of the pre-roll.
+ *
+ * Every frame is reduced to its mel cepstrum. When the wake word fires, the
+ * mean and spread of the cepstra over the voiced frames make the embedding:
+ * they describe the timbre of the voice, the first cepstrum (loudness) is
+ * left out. All speakers say the same words, which is what makes this simple
+ * statistic usable. It tells apart voices that sound different, it is not a
+ * security feature and a recording of the enrolled speaker passes.
+ *
+ * Push() runs on the audio encode task, GetEmbedding() on the main loop.
+ */
+class SpeakerFeatures {
+public:
+    SpeakerFeatures();
+
+    void Reset();
+    void Push(const int16_t* data, size_t samples);
+    bool GetEmbedding(std::vector<float>& embedding);
+
+private:
+    struct Frame {
+        float energy;
+        float cepstra[SPEAKER_CEPSTRA];
+    };
+
+    std::mutex mutex_;
+    // Set by Reset, the partial frame belongs to the task that pushes
+    std::atomic<bool> reset_ = false;
+    std::vector<int16_t> pending_;
+    std::vector<Frame> frames_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+
+    // Computed once, the frame analysis only multiplies and adds
+    std::vector<float> window_;
+    std::vector<float> cos_;
+    std::vector<float> sin_;
+    std::vector<uint16_t> mel_bins_;
+    std::vector<float> dct_;
+    std::vector<float> re_;
+    std::vector<float> im_;
+
+    void AnalyzeFrame(const int16_t* data, Frame& frame);
+    void Fft();
+};
+
+/*
+ * Enrolled speakers, kept in the "speaker" settings namespace. Enrolling the
+ * same name again averages the new embedding into the profile, a few wake
+ * words in different rooms make a steadier one. Embeddings are compared by
+ * the RMS of their difference, in cepstral units.
+ */
+class SpeakerProfiles {
+public:
+    SpeakerProfiles();
+
+    // The closest name, or empty when nobody is within max_distance
+    std::string Match(const std::vector<float>& embedding, float max_distance, float* distance = nullptr);
+    bool Enroll(const std::string& name, const std::vector<float>& embedding);
+    bool Remove(const std::string& name);
+    bool empty();
+    std::string GetJson();
+
+private:
+    struct Profile {
+        std::string name;
+        int count;
+        std::vector<float> embedding;
+    };
+
+    std::mutex mutex_;
+    std::vector<Profile> profiles_;
+
+    void Load();
+    void Save();
+};
+
+#endif // SPEAKER_ID_H
@@ -0,0 +1,80 @@
+#include "sr_model_registry.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cstring>
+#include <sstream>
+
+#define TAG "SrModelRegistry"
+
+srmodel_list_t* SrModelRegistry::Load() {
+    if (loaded_) {
+        return models_;
+    }
+    // Only tried once, a missing partition does not get better by mapping it again
+    loaded_ = true;
+    int64_t start_us = esp_timer_get_time();
+    models_ = esp_srmodel_init("model");
+    if (models_ == nullptr || models_->num <= 0) {
+        ESP_LOGE(TAG, "No models found in the model partition");
+        models_ = nullptr;
+        return nullptr;
+    }
+    for (int i = 0; i < models_->num; i++) {
+        ESP_LOGI(TAG, "Model %d: %s", i, models_->model_name[i]);
+    }
+    ESP_LOGI(TAG, "Loaded %d models in %lld ms", models_->num, (esp_timer_get_time() - start_us) / 1000);
+    return models_;
+}
+
+srmodel_list_t* SrModelRegistry::models() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return Load();
+}
+
+char* SrModelRegistry::Find(const char* prefix, const char* keyword) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string key = std::string(prefix) + '/' + (keyword != nullptr ? keyword : "");
+    auto it = filtered_.find(key);
+    if (it != filtered_.end()) {
+        return it->second;
+    }
+    auto models = Load();
+    char* name = models != nullptr ? esp_srmodel_filter(models, prefix, keyword) : nullptr;
+    filtered_[key] = name;
+    return name;
+}
+
+std::vector<char*> SrModelRegistry::FindAll(const char* prefix) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<char*> names;
+    auto models = Load();
+    if (models == nullptr) {
+        return names;
+    }
+    for (int i = 0; i < models->num; i++) {
+        if (strstr(models->model_name[i], prefix) != nullptr) {
+            names.push_back(models->model_name[i]);
+        }
+    }
+    return names;
+}
+
+const std::vector<std::string>& SrModelRegistry::GetWakeWords(const char* model_name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = wake_words_.find(model_name);
+    if (it != wake_words_.end()) {
+        return it->second;
+    }
+    auto& words = wake_words_[model_name];
+    auto models = Load();
+    char* list = models != nullptr ? esp_srmodel_get_wake_words(models, (char*)model_name) : nullptr;
+    if (list != nullptr) {
+        std::stringstream ss(list);
+        std::string word;
+        while (std::getline(ss, word, ';')) {
+            words.push_back(word);
+        }
+    }
+    return words;
+}
@@ -0,0 +1,52 @@
+#ifndef SR_MODEL_REGISTRY_H
+#define SR_MODEL_REGISTRY_H
+
+#include <model_path.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * The models in the "model" partition, shared by every esp-sr user.
+ *
+ * esp_srmodel_init() maps the whole partition and walks its index, and the
+ * wake word, the audio processor and the command words each used to do that
+ * on their own. The registry maps it once on first use and keeps it mapped
+ * for the lifetime of the firmware, the AFE and WakeNet instances point into
+ * the mapping. Filter results and wake word lists are cached, the returned
+ * names stay valid as long as the mapping does.
+ */
+class SrModelRegistry {
+public:
+    static SrModelRegistry& GetInstance() {
+        static SrModelRegistry instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    SrModelRegistry(const SrModelRegistry&) = delete;
+    SrModelRegistry& operator=(const SrModelRegistry&) = delete;
+
+    // nullptr when the partition is missing or holds no models
+    srmodel_list_t* models();
+    // The first model whose name has the prefix and keyword, like esp_srmodel_filter()
+    char* Find(const char* prefix, const char* keyword = nullptr);
+    // Every model whose name has the prefix, in partition order
+    std::vector<char*> FindAll(const char* prefix);
+    // The wake words of a WakeNet model, split at ';'
+    const std::vector<std::string>& GetWakeWords(const char* model_name);
+
+private:
+    SrModelRegistry() = default;
+
+    std::mutex mutex_;
+    bool loaded_ = false;
+    srmodel_list_t* models_ = nullptr;
+    std::map<std::string, char*> filtered_;
+    std::map<std::string, std::vector<std::string>> wake_words_;
+
+    srmodel_list_t* Load();
+};
+
+#endif // SR_MODEL_REGISTRY_H
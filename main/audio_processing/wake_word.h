@@ -4,8 +4,43 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <cmath>
+#include <algorithm>
 
 #include "audio_codec.h"
+#include "audio_payload.h"
+
+// A command phrase recognized on the device, acted on without a server round trip
+struct CommandWord {
+    int id;                 // Index of the phrase passed to SetCommandWords
+    std::string phrase;
+    float confidence;       // MultiNet probability, 0 to 1
+    int64_t timestamp_us;   // esp_timer time of the chunk that completed the phrase
+};
+
+// Speech level around the wake word: the mean square of the loudest chunk, decaying by about 14 dB
+// a second, so at the detection it covers the word that was just said
+class WakeWordLevelMeter {
+public:
+    void Feed(const int16_t* data, size_t samples) {
+        if (samples == 0) {
+            return;
+        }
+        float sum = 0;
+        for (size_t i = 0; i < samples; i++) {
+            sum += (float)data[i] * data[i];
+        }
+        peak_ = std::max(sum / samples, peak_ * 0.9f);
+    }
+    void Reset() { peak_ = 0; }
+    // dBFS, -100 for silence
+    float level_db() const {
+        return peak_ > 0 ? 10.0f * std::log10(peak_ / (32768.0f * 32768.0f)) : -100.0f;
+    }
+
+private:
+    float peak_ = 0;
+};
 
 class WakeWord {
 public:
@@ -19,8 +54,16 @@ public:
     virtual bool IsDetectionRunning() = 0;
     virtual size_t GetFeedSize() = 0;
     virtual void EncodeWakeWordData() = 0;
-    virtual bool GetWakeWordOpus(std::vector<uint8_t>& opus) = 0;
+    virtual bool GetWakeWordOpus(AudioPayload& opus) = 0;
     virtual const std::string& GetLastDetectedWakeWord() const = 0;
+
+    // Command words are only recognized by detectors that run MultiNet, the others ignore them
+    virtual bool SetCommandWords(const std::vector<std::string>& phrases) { return false; }
+    virtual void OnCommandDetected(std::function<void(const CommandWord& command)> callback) {}
+    // Voice signature of the last wake word, from detectors that keep a pre-roll (CONFIG_USE_SPEAKER_ID)
+    virtual bool GetSpeakerEmbedding(std::vector<float>& embedding) { return false; }
+    // Speech level of the last wake word in dBFS, from detectors that measure it (CONFIG_USE_WAKE_ARBITRATION)
+    virtual bool GetWakeWordLevel(float& level_db) { return false; }
 };
 
 #endif
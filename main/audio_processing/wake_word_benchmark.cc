@@ -0,0 +1,223 @@
+#include "wake_word_benchmark.h"
+#include "protocol.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <arpa/inet.h>
+#include <cJSON.h>
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#define TAG "WakeWordBenchmark"
+
+WakeWordBenchmark::WakeWordBenchmark(WakeWord& detector, int channels)
+    : detector_(detector), channels_(channels), feed_times_(WAKE_WORD_BENCHMARK_FEED_BUCKET_US, WAKE_WORD_BENCHMARK_FEED_BUCKETS) {
+}
+
+void WakeWordBenchmark::OnDetected(const std::string& wake_word) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        detections_.push_back(Detection{fed_samples_, wake_word});
+    }
+    // Detectors stop themselves on a detection, the corpus may hold more words
+    detector_.StartDetection();
+}
+
+bool WakeWordBenchmark::ReadSamples(FILE* p3, WavReader& wav, int16_t* out, size_t samples) {
+    if (p3 == nullptr) {
+        return wav.Read(out, samples) == samples;
+    }
+    std::vector<uint8_t> opus;
+    while (samples > 0) {
+        if (decoded_offset_ == decoded_.size()) {
+            BinaryProtocol3 header;
+            if (fread(&header, sizeof(header), 1, p3) != 1) {
+                return false;
+            }
+            opus.resize(ntohs(header.payload_size));
+            if (fread(opus.data(), 1, opus.size(), p3) != opus.size() ||
+                !decoder_->Decode(opus.data(), opus.size(), decoded_)) {
+                return false;
+            }
+            decoded_offset_ = 0;
+        }
+        size_t count = std::min(samples, decoded_.size() - decoded_offset_);
+        memcpy(out, decoded_.data() + decoded_offset_, count * sizeof(int16_t));
+        decoded_offset_ += count;
+        out += count;
+        samples -= count;
+    }
+    return true;
+}
+
+bool WakeWordBenchmark::RunFile(const std::string& path, const std::vector<int>& word_ends_ms, int speed) {
+    // P3 assets are read from the file here, WAV files through the reader
+    FILE* p3 = nullptr;
+    WavReader wav;
+    if (path.size() > 3 && path.compare(path.size() - 3, 3, ".p3") == 0) {
+        p3 = fopen(path.c_str(), "rb");
+        if (p3 == nullptr) {
+            ESP_LOGE(TAG, "Failed to open %s", path.c_str());
+            return false;
+        }
+        decoded_.clear();
+        decoded_offset_ = 0;
+        decoder_->ResetState();
+    } else if (!wav.Open(path) || wav.sample_rate() != 16000 || wav.channels() != 1) {
+        ESP_LOGE(TAG, "%s is not a 16 kHz mono 16-bit WAV file", path.c_str());
+        return false;
+    }
+
+    // The microphone goes into the first channel, reference channels stay silent
+    size_t feed_size = detector_.GetFeedSize();
+    size_t chunk = feed_size / channels_;
+    std::vector<int16_t> mono(chunk);
+    std::vector<int16_t> frame(feed_size, 0);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        detections_.clear();
+    }
+    uint64_t start_sample = fed_samples_;
+    uint64_t file_samples = 0;
+    size_t tail_chunks = WAKE_WORD_BENCHMARK_LATE_MS * 16 / chunk + 1;
+    int64_t start_us = esp_timer_get_time();
+
+    // Silence after the file flushes the detector, late detections are still attributed to this file
+    bool reading = true;
+    while (reading || tail_chunks > 0) {
+        if (reading && ReadSamples(p3, wav, mono.data(), chunk)) {
+            for (size_t i = 0; i < chunk; i++) {
+                frame[i * channels_] = mono[i];
+            }
+            file_samples += chunk;
+        } else {
+            reading = false;
+            std::fill(frame.begin(), frame.end(), 0);
+            tail_chunks--;
+        }
+
+        int64_t feed_start_us = esp_timer_get_time();
+        detector_.Feed(frame);
+        feed_times_.Add(esp_timer_get_time() - feed_start_us);
+        fed_samples_ += chunk;
+
+        if (speed > 0) {
+            int64_t due_us = start_us + (int64_t)(fed_samples_ - start_sample) * 1000 / 16 / speed;
+            int64_t wait_us = due_us - esp_timer_get_time();
+            if (wait_us >= 1000) {
+                vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+            }
+        }
+    }
+    if (p3 != nullptr) {
+        fclose(p3);
+    }
+
+    // Match each detection with the first unclaimed word end around it, the rest are false accepts
+    std::vector<bool> claimed(word_ends_ms.size(), false);
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& detection : detections_) {
+        int at_ms = (detection.sample - start_sample) / 16;
+        bool hit = false;
+        for (size_t i = 0; i < word_ends_ms.size(); i++) {
+            if (!claimed[i] && at_ms >= word_ends_ms[i] - WAKE_WORD_BENCHMARK_EARLY_MS &&
+                at_ms <= word_ends_ms[i] + WAKE_WORD_BENCHMARK_LATE_MS) {
+                claimed[i] = true;
+                latencies_ms_.push_back(at_ms - word_ends_ms[i]);
+                hit = true;
+                break;
+            }
+        }
+        if (!hit) {
+            ESP_LOGI(TAG, "False accept in %s at %d ms: %s", path.c_str(), at_ms, detection.word.c_str());
+            false_accepts_++;
+        }
+    }
+    uint32_t file_hits = std::count(claimed.begin(), claimed.end(), true);
+    for (size_t i = 0; i < word_ends_ms.size(); i++) {
+        if (!claimed[i]) {
+            ESP_LOGI(TAG, "False reject in %s, word ending at %d ms", path.c_str(), word_ends_ms[i]);
+        }
+    }
+    files_++;
+    positives_ += word_ends_ms.size();
+    hits_ += file_hits;
+    total_samples_ += file_samples;
+    if (word_ends_ms.empty()) {
+        negative_samples_ += file_samples;
+    }
+    ESP_LOGI(TAG, "%s: %lu ms, %lu/%u detected", path.c_str(), (unsigned long)(file_samples / 16),
+        (unsigned long)file_hits, (unsigned)word_ends_ms.size());
+    return true;
+}
+
+std::string WakeWordBenchmark::Run(const std::string& manifest_path, int speed) {
+    FILE* manifest = fopen(manifest_path.c_str(), "r");
+    if (manifest == nullptr) {
+        ESP_LOGE(TAG, "Failed to open manifest %s", manifest_path.c_str());
+        return "{\"error\":\"Failed to open manifest\"}";
+    }
+    std::string base = manifest_path.substr(0, manifest_path.find_last_of('/') + 1);
+    decoder_ = std::make_unique<OpusStreamDecoder>(16000, 1, WAKE_WORD_BENCHMARK_P3_FRAME_MS);
+    detector_.StartDetection();
+
+    int64_t start_us = esp_timer_get_time();
+    char line[256];
+    while (fgets(line, sizeof(line), manifest) != nullptr) {
+        std::istringstream ss(line);
+        std::string path;
+        if (!(ss >> path) || path[0] == '#') {
+            continue;
+        }
+        std::vector<int> word_ends_ms;
+        int end_ms;
+        while (ss >> end_ms) {
+            word_ends_ms.push_back(end_ms);
+        }
+        RunFile(path[0] == '/' ? path : base + path, word_ends_ms, speed);
+    }
+    fclose(manifest);
+    detector_.StopDetection();
+    decoder_.reset();
+    return Report(esp_timer_get_time() - start_us);
+}
+
+std::string WakeWordBenchmark::Report(int64_t wall_us) {
+    double hours = total_samples_ / 16000.0 / 3600.0;
+    std::sort(latencies_ms_.begin(), latencies_ms_.end());
+
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "files", files_);
+    cJSON_AddNumberToObject(json, "audio_seconds", total_samples_ / 16000);
+    cJSON_AddNumberToObject(json, "negative_seconds", negative_samples_ / 16000);
+    cJSON_AddNumberToObject(json, "realtime_factor", wall_us > 0 ? total_samples_ * 1000.0 / 16 / wall_us : 0);
+    cJSON_AddNumberToObject(json, "words", positives_);
+    cJSON_AddNumberToObject(json, "detected", hits_);
+    cJSON_AddNumberToObject(json, "false_reject_percent", positives_ > 0 ? (positives_ - hits_) * 100.0 / positives_ : 0);
+    cJSON_AddNumberToObject(json, "false_accepts", false_accepts_);
+    cJSON_AddNumberToObject(json, "false_accepts_per_hour", hours > 0 ? false_accepts_ / hours : 0);
+    if (!latencies_ms_.empty()) {
+        auto latency = cJSON_CreateObject();
+        cJSON_AddNumberToObject(latency, "p50", latencies_ms_[latencies_ms_.size() / 2]);
+        cJSON_AddNumberToObject(latency, "p90", latencies_ms_[latencies_ms_.size() * 9 / 10]);
+        cJSON_AddNumberToObject(latency, "max", latencies_ms_.back());
+        cJSON_AddItemToObject(json, "latency_ms", latency);
+    }
+    auto feed = cJSON_CreateObject();
+    cJSON_AddNumberToObject(feed, "chunks", feed_times_.count());
+    cJSON_AddNumberToObject(feed, "mean", feed_times_.mean_us());
+    cJSON_AddNumberToObject(feed, "p50", feed_times_.Percentile(50));
+    cJSON_AddNumberToObject(feed, "p99", feed_times_.Percentile(99));
+    cJSON_AddNumberToObject(feed, "max", feed_times_.max_us());
+    cJSON_AddItemToObject(json, "feed_us", feed);
+
+    auto str = cJSON_PrintUnformatted(json);
+    std::string result(str);
+    cJSON_free(str);
+    cJSON_Delete(json);
+    ESP_LOGI(TAG, "Benchmark: %s", result.c_str());
+    return result;
+}
@@ -0,0 +1,88 @@
+#ifndef WAKE_WORD_BENCHMARK_H
+#define WAKE_WORD_BENCHMARK_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+#include <cstdio>
+
+#include "wake_word.h"
+#include "opus_stream.h"
+#include "timing_histogram.h"
+#include "wav_file.h"
+
+// A detection up to this long before or after a labeled word end counts as a hit
+#define WAKE_WORD_BENCHMARK_EARLY_MS 1500
+#define WAKE_WORD_BENCHMARK_LATE_MS 1000
+// P3 assets are 60 ms Opus frames at 16 kHz, as produced by the sound asset scripts
+#define WAKE_WORD_BENCHMARK_P3_FRAME_MS 60
+// Feed times go into a histogram of 50 us buckets, the last one collects everything slower
+#define WAKE_WORD_BENCHMARK_FEED_BUCKET_US 50
+#define WAKE_WORD_BENCHMARK_FEED_BUCKETS 256
+
+/*
+ * Replays a labeled corpus through WakeWord::Feed to measure false accepts,
+ * false rejects, detection latency and the cost of each feed.
+ *
+ * The corpus is described by a manifest, one file per line, with the end of
+ * each wake word in the file in milliseconds. A file without times is
+ * negative audio, everything detected in it is a false accept:
+ *
+ *     # path relative to the manifest     word ends (ms)
+ *     positive/alice_01.wav               1820
+ *     positive/two_words.p3               1500 6200
+ *     negative/tv_news.wav
+ *
+ * WAV files must be 16 kHz mono 16-bit PCM, P3 files are the Opus assets
+ * the firmware plays. Audio is fed at `speed` times realtime. Detectors that
+ * process on their own task, like the AFE one, fall behind and drop audio
+ * if fed faster than they run, keep the speed low enough for them.
+ *
+ * The caller pauses live audio and routes the detector's callback to
+ * OnDetected() while Run() is active.
+ */
+class WakeWordBenchmark {
+public:
+    WakeWordBenchmark(WakeWord& detector, int channels);
+
+    // Blocks until the corpus is done, returns the report as JSON
+    std::string Run(const std::string& manifest_path, int speed);
+    void OnDetected(const std::string& wake_word);
+
+private:
+    struct Detection {
+        uint64_t sample;        // Samples fed when the detection was reported
+        std::string word;
+    };
+
+    WakeWord& detector_;
+    int channels_;
+    std::unique_ptr<OpusStreamDecoder> decoder_;
+    std::atomic<uint64_t> fed_samples_{0};
+    std::mutex mutex_;
+    std::vector<Detection> detections_;
+
+    // Results over the whole corpus
+    uint32_t files_ = 0;
+    uint32_t positives_ = 0;
+    uint32_t hits_ = 0;
+    uint32_t false_accepts_ = 0;
+    uint64_t total_samples_ = 0;
+    uint64_t negative_samples_ = 0;
+    std::vector<int> latencies_ms_;
+    TimingHistogram feed_times_;
+
+    // Files are streamed, an hour of negative audio does not fit in memory
+    std::vector<int16_t> decoded_;
+    size_t decoded_offset_ = 0;
+
+    // From the P3 file when there is one, else from the WAV reader
+    bool ReadSamples(FILE* p3, WavReader& wav, int16_t* out, size_t samples);
+    bool RunFile(const std::string& path, const std::vector<int>& word_ends_ms, int speed);
+    std::string Report(int64_t wall_us);
+};
+
+#endif // WAKE_WORD_BENCHMARK_H
@@ -0,0 +1,141 @@
+#include "wav_file.h"
+
+#include <esp_log.h>
+
+#include <algorithm>
+#include <cstring>
+
+#define TAG "WavFile"
+
+// WAV is little endian, and so are the hosts this builds on
+static uint32_t ReadU32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t ReadU16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+WavReader::~WavReader() {
+    if (file_ != nullptr) {
+        fclose(file_);
+    }
+}
+
+bool WavReader::Open(const std::string& path) {
+    file_ = fopen(path.c_str(), "rb");
+    if (file_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to open %s", path.c_str());
+        return false;
+    }
+    uint8_t header[12];
+    if (fread(header, 1, sizeof(header), file_) != sizeof(header) ||
+        memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+        ESP_LOGE(TAG, "%s is not a WAV file", path.c_str());
+        return false;
+    }
+
+    int format = 0;
+    int bits = 0;
+    uint8_t chunk[8];
+    while (fread(chunk, 1, sizeof(chunk), file_) == sizeof(chunk)) {
+        uint32_t size = ReadU32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            uint8_t fmt[16];
+            if (size < sizeof(fmt) || fread(fmt, 1, sizeof(fmt), file_) != sizeof(fmt)) {
+                break;
+            }
+            format = ReadU16(fmt);
+            channels_ = ReadU16(fmt + 2);
+            sample_rate_ = ReadU32(fmt + 4);
+            bits = ReadU16(fmt + 14);
+            fseek(file_, size - sizeof(fmt) + (size & 1), SEEK_CUR);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            // Extensible is PCM too when it has 16 bits
+            if ((format != 1 && format != 0xFFFE) || bits != 16 || channels_ <= 0) {
+                ESP_LOGE(TAG, "%s: only 16-bit PCM is supported", path.c_str());
+                return false;
+            }
+            // Whatever follows the data chunk, like a LIST chunk, is not audio
+            remaining_bytes_ = size;
+            return true;
+        } else {
+            fseek(file_, size + (size & 1), SEEK_CUR);
+        }
+    }
+    ESP_LOGE(TAG, "%s has no audio data", path.c_str());
+    return false;
+}
+
+size_t WavReader::Read(int16_t* data, size_t frames) {
+    size_t frame_bytes = channels_ * sizeof(int16_t);
+    size_t bytes = std::min(frames * frame_bytes, remaining_bytes_ / frame_bytes * frame_bytes);
+    if (file_ == nullptr || bytes == 0) {
+        return 0;
+    }
+    size_t read = fread(data, 1, bytes, file_) / frame_bytes;
+    remaining_bytes_ -= read * frame_bytes;
+    return read;
+}
+
+WavWriter::~WavWriter() {
+    Close();
+}
+
+bool WavWriter::Open(const std::string& path, int sample_rate, int channels) {
+    file_ = fopen(path.c_str(), "wb");
+    if (file_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create %s", path.c_str());
+        return false;
+    }
+    channels_ = channels;
+    data_bytes_ = 0;
+
+    uint8_t header[44] = {};
+    auto put32 = [&header](int offset, uint32_t value) {
+        for (int i = 0; i < 4; i++) {
+            header[offset + i] = value >> (i * 8);
+        }
+    };
+    auto put16 = [&header](int offset, uint16_t value) {
+        header[offset] = value & 0xff;
+        header[offset + 1] = value >> 8;
+    };
+    memcpy(header, "RIFF", 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put32(16, 16);
+    put16(20, 1);
+    put16(22, channels);
+    put32(24, sample_rate);
+    put32(28, sample_rate * channels * sizeof(int16_t));
+    put16(32, channels * sizeof(int16_t));
+    put16(34, 16);
+    memcpy(header + 36, "data", 4);
+    fwrite(header, 1, sizeof(header), file_);
+    return true;
+}
+
+void WavWriter::Write(const int16_t* data, size_t frames) {
+    if (file_ == nullptr) {
+        return;
+    }
+    data_bytes_ += fwrite(data, 1, frames * channels_ * sizeof(int16_t), file_);
+}
+
+void WavWriter::Close() {
+    if (file_ == nullptr) {
+        return;
+    }
+    auto put32 = [this](long offset, uint32_t value) {
+        uint8_t bytes[4];
+        for (int i = 0; i < 4; i++) {
+            bytes[i] = value >> (i * 8);
+        }
+        fseek(file_, offset, SEEK_SET);
+        fwrite(bytes, 1, sizeof(bytes), file_);
+    };
+    put32(4, data_bytes_ + 36);
+    put32(40, data_bytes_);
+    fclose(file_);
+    file_ = nullptr;
+}
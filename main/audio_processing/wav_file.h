@@ -0,0 +1,47 @@
+#ifndef WAV_FILE_H
+#define WAV_FILE_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+/*
+ * 16-bit PCM WAV files: the recorded audio of the benchmarks and the soak
+ * test on the device, the mock microphone and speaker of the host build.
+ * The reader skips chunks it does not know and stops at the end of the data
+ * chunk, the writer fixes the sizes in the header when it is closed.
+ */
+class WavReader {
+public:
+    ~WavReader();
+
+    bool Open(const std::string& path);
+    // Reads up to `frames` frames of all channels, interleaved, returns the frames read
+    size_t Read(int16_t* data, size_t frames);
+
+    inline int sample_rate() const { return sample_rate_; }
+    inline int channels() const { return channels_; }
+
+private:
+    FILE* file_ = nullptr;
+    int sample_rate_ = 0;
+    int channels_ = 0;
+    size_t remaining_bytes_ = 0;
+};
+
+class WavWriter {
+public:
+    ~WavWriter();
+
+    bool Open(const std::string& path, int sample_rate, int channels);
+    void Write(const int16_t* data, size_t frames);
+    void Close();
+
+private:
+    FILE* file_ = nullptr;
+    int channels_ = 0;
+    uint32_t data_bytes_ = 0;
+};
+
+#endif // WAV_FILE_H
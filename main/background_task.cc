@@ -1,70 +1,193 @@
 #include "background_task.h"
+#include "deferred_log.h"
 
 #include <esp_log.h>
 #include <esp_task_wdt.h>
+#include <esp_heap_caps.h>
 
 #define TAG "BackgroundTask"
 
-BackgroundTask::BackgroundTask(uint32_t stack_size) {
-    xTaskCreate([](void* arg) {
-        BackgroundTask* task = (BackgroundTask*)arg;
-        task->BackgroundTaskLoop();
-    }, "background_task", stack_size, this, 2, &background_task_handle_);
+#define TOKEN_DONE_BIT BIT0
+
+void BackgroundTaskToken::Bind() {
+    event_group_.reset(xEventGroupCreate(), [](EventGroupHandle_t group) {
+        if (group != nullptr) {
+            vEventGroupDelete(group);
+        }
+    });
+}
+
+void BackgroundTaskToken::Complete() const {
+    if (event_group_) {
+        xEventGroupSetBits(event_group_.get(), TOKEN_DONE_BIT);
+    }
+}
+
+bool BackgroundTaskToken::IsDone() const {
+    return event_group_ && (xEventGroupGetBits(event_group_.get()) & TOKEN_DONE_BIT);
+}
+
+bool BackgroundTaskToken::Wait(TickType_t timeout) const {
+    if (!event_group_) {
+        return false;
+    }
+    auto bits = xEventGroupWaitBits(event_group_.get(), TOKEN_DONE_BIT, pdFALSE, pdTRUE, timeout);
+    return bits & TOKEN_DONE_BIT;
+}
+
+BackgroundTask::BackgroundTask() {
+    auto config = TaskTopology::GetInstance().Get(kTaskBackground);
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        char name[16];
+        snprintf(name, sizeof(name), "background_%d", core);
+        config.core = portNUM_PROCESSORS > 1 ? core : tskNO_AFFINITY;
+        StartWorker(name, config);
+    }
+}
+
+BackgroundTask::BackgroundTask(TaskRole role, int max_tasks)
+    : max_tasks_(max_tasks) {
+    StartWorker(TaskTopology::GetRoleName(role), TaskTopology::GetInstance().Get(role));
 }
 
 BackgroundTask::~BackgroundTask() {
-    if (background_task_handle_ != nullptr) {
-        vTaskDelete(background_task_handle_);
+    for (auto& worker : workers_) {
+        if (worker->handle != nullptr) {
+            TaskTopology::DeleteTask(worker->config, worker->handle);
+        }
     }
 }
 
-bool BackgroundTask::Schedule(std::function<void()> callback) {
+void BackgroundTask::StartWorker(const char* name, const TaskConfig& config) {
+    auto worker = std::make_unique<Worker>();
+    worker->owner = this;
+    worker->index = workers_.size();
+    worker->config = config;
+    auto ptr = worker.get();
+    workers_.push_back(std::move(worker));
+    TaskTopology::CreateTask(config, name, [](void* arg) {
+        Worker* worker = (Worker*)arg;
+        worker->owner->WorkerLoop(*worker);
+    }, ptr, &ptr->handle);
+}
+
+BackgroundTask::Worker& BackgroundTask::SelectWorker() {
+    if (workers_.size() == 1) {
+        return *workers_[0];
+    }
+    // Keep the work on the caller's core, an idle worker on the other core steals it when needed
+    BaseType_t core_id = xPortGetCoreID();
+    for (auto& worker : workers_) {
+        if (worker->config.core == core_id) {
+            return *worker;
+        }
+    }
+    next_worker_ = (next_worker_ + 1) % workers_.size();
+    return *workers_[next_worker_];
+}
+
+bool BackgroundTask::Schedule(TaskCallback callback, BackgroundTaskPriority priority, BackgroundTaskToken* token) {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (waiting_for_completion_ > 0) {
+    if (max_tasks_ > 0 && active_tasks_ >= max_tasks_) {
         return false;
     }
-    if (active_tasks_ >= 30) {
+    if (priority == kBackgroundTaskPriorityNormal && queued_normal_tasks_ >= BACKGROUND_TASK_SOFT_LIMIT) {
         int free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
         if (free_sram < 10000) {
-            ESP_LOGW(TAG, "active_tasks_ == %d, free_sram == %u", active_tasks_, free_sram);
+            DEFERRED_LOGW(TAG, "queued_normal_tasks_ == %d, free_sram == %u", queued_normal_tasks_, free_sram);
             return false;
         }
     }
+
+    Job job;
+    job.sequence = next_sequence_++;
+    job.callback = std::move(callback);
+    if (token != nullptr) {
+        token->Bind();
+        job.token = *token;
+    }
+
+    SelectWorker().lanes[priority].push_back(std::move(job));
     active_tasks_++;
-    background_tasks_.emplace_back([this, cb = std::move(callback)]() {
-        cb();
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            active_tasks_--;
-            if (background_tasks_.empty() && active_tasks_ == 0) {
-                condition_variable_.notify_all();
-            }
-        }
-    });
+    queued_tasks_++;
+    if (priority == kBackgroundTaskPriorityNormal) {
+        queued_normal_tasks_++;
+    }
     condition_variable_.notify_all();
     return true;
 }
 
+void BackgroundTask::TakeJob(Worker& self, Job& job) {
+    // Called with mutex_ held. Own queue first, then steal from the others,
+    // a high priority task anywhere goes before any normal one.
+    for (int lane = kBackgroundTaskPriorityCount - 1; lane >= 0; lane--) {
+        for (size_t i = 0; i < workers_.size(); i++) {
+            auto& queue = workers_[(self.index + i) % workers_.size()]->lanes[lane];
+            if (!queue.empty()) {
+                job = std::move(queue.front());
+                queue.pop_front();
+                if (lane == kBackgroundTaskPriorityNormal) {
+                    queued_normal_tasks_--;
+                }
+                return;
+            }
+        }
+    }
+}
+
+bool BackgroundTask::HasPendingBefore(uint64_t sequence) {
+    // Called with mutex_ held
+    for (auto& worker : workers_) {
+        if (worker->running_sequence != 0 && worker->running_sequence <= sequence) {
+            return true;
+        }
+        for (auto& queue : worker->lanes) {
+            for (auto& job : queue) {
+                if (job.sequence <= sequence) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
 void BackgroundTask::WaitForCompletion() {
     std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t last_sequence = next_sequence_ - 1;
     waiting_for_completion_++;
-    condition_variable_.wait(lock, [this]() {
-        return background_tasks_.empty() && active_tasks_ == 0;
+    condition_variable_.wait(lock, [this, last_sequence]() {
+        return active_tasks_ == 0 || !HasPendingBefore(last_sequence);
     });
     waiting_for_completion_--;
 }
 
-void BackgroundTask::BackgroundTaskLoop() {
-    ESP_LOGI(TAG, "background_task started");
+bool BackgroundTask::IsFull() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_tasks_ > 0 && active_tasks_ >= max_tasks_;
+}
+
+void BackgroundTask::WorkerLoop(Worker& self) {
+    ESP_LOGI(TAG, "%s started", pcTaskGetName(NULL));
     while (true) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        condition_variable_.wait(lock, [this]() { return !background_tasks_.empty(); });
-        
-        std::list<std::function<void()>> tasks = std::move(background_tasks_);
-        lock.unlock();
-
-        for (auto& task : tasks) {
-            task();
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_variable_.wait(lock, [this]() { return queued_tasks_ > 0; });
+            queued_tasks_--;
+            TakeJob(self, job);
+            self.running_sequence = job.sequence;
+        }
+
+        job.callback();
+        job.callback = nullptr;
+        job.token.Complete();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        self.running_sequence = 0;
+        active_tasks_--;
+        if (waiting_for_completion_ > 0) {
+            condition_variable_.notify_all();
         }
     }
 }
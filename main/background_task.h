@@ -3,28 +3,100 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/event_groups.h>
 #include <mutex>
-#include <list>
+#include <deque>
+#include <vector>
+#include <memory>
 #include <condition_variable>
 #include <atomic>
 
+#include "task_callback.h"
+#include "task_topology.h"
+
+// Above this many pending normal priority tasks, scheduling checks for free internal RAM
+#define BACKGROUND_TASK_SOFT_LIMIT 30
+
+enum BackgroundTaskPriority {
+    kBackgroundTaskPriorityNormal = 0,
+    kBackgroundTaskPriorityHigh,     // Audio critical, always taken before normal tasks
+    kBackgroundTaskPriorityCount
+};
+
+// Completion handle of a single scheduled task, can be copied and outlive the executor
+class BackgroundTaskToken {
+public:
+    BackgroundTaskToken() = default;
+
+    inline bool valid() const { return event_group_ != nullptr; }
+    bool IsDone() const;
+    // Returns false on timeout or if the token was never bound to a task
+    bool Wait(TickType_t timeout = portMAX_DELAY) const;
+
+private:
+    friend class BackgroundTask;
+    std::shared_ptr<std::remove_pointer_t<EventGroupHandle_t>> event_group_;
+
+    void Bind();
+    void Complete() const;
+};
+
+/*
+ * Executor for work that must not run on the caller's thread.
+ *
+ * Each worker owns a queue with one lane per priority. Schedule() puts the task
+ * on the queue of the worker pinned to the caller's core when there is one,
+ * and an idle worker steals from the other queues, high priority lanes first.
+ * A single worker executor runs its tasks in order within a lane, which the
+ * audio encode/decode workers rely on for the codec state.
+ */
 class BackgroundTask {
 public:
-    BackgroundTask(uint32_t stack_size = 4096 * 2);
+    // One worker per core with the kTaskBackground row of the task topology
+    BackgroundTask();
+    // A single worker with the row of `role`; max_tasks bounds the number of pending callbacks, 0 means unbounded
+    BackgroundTask(TaskRole role, int max_tasks = 0);
     ~BackgroundTask();
 
-    bool Schedule(std::function<void()> callback);
+    bool Schedule(TaskCallback callback, BackgroundTaskPriority priority = kBackgroundTaskPriorityNormal,
+        BackgroundTaskToken* token = nullptr);
+    // Wait for the tasks scheduled before this call, tasks scheduled meanwhile are not waited for
     void WaitForCompletion();
+    bool IsFull();
 
 private:
+    struct Job {
+        uint64_t sequence;
+        TaskCallback callback;
+        BackgroundTaskToken token;
+    };
+
+    // Queues are guarded by mutex_, the critical sections only move a job in or out
+    struct Worker {
+        BackgroundTask* owner = nullptr;
+        size_t index = 0;
+        std::deque<Job> lanes[kBackgroundTaskPriorityCount];
+        TaskHandle_t handle = nullptr;
+        TaskConfig config = {};
+        uint64_t running_sequence = 0;  // 0 when idle
+    };
+
     std::mutex mutex_;
-    std::list<std::function<void()>> background_tasks_;
     std::condition_variable condition_variable_;
-    TaskHandle_t background_task_handle_ = nullptr;
-    int active_tasks_ = 0;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    uint64_t next_sequence_ = 1;
+    size_t next_worker_ = 0;
+    int queued_tasks_ = 0;     // Not yet taken by a worker
+    int active_tasks_ = 0;     // Queued or running
+    int queued_normal_tasks_ = 0;
+    int max_tasks_ = 0;
     int waiting_for_completion_ = 0;
 
-    void BackgroundTaskLoop();
+    void StartWorker(const char* name, const TaskConfig& config);
+    Worker& SelectWorker();
+    void TakeJob(Worker& self, Job& job);
+    bool HasPendingBefore(uint64_t sequence);
+    void WorkerLoop(Worker& self);
 };
 
 #endif
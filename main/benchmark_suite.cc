@@ -0,0 +1,89 @@
+#include "benchmark_suite.h"
+#include "application.h"
+#include "board.h"
+#include "display.h"
+#include "codec_benchmark.h"
+#include "link_benchmark.h"
+
+#include <esp_log.h>
+#include <esp_app_desc.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+
+#define TAG "BenchmarkSuite"
+
+void BenchmarkSuite::OnBootPhase(const char* phase, int64_t time_ms) {
+    if (boot_phase_count_ < BENCHMARK_SUITE_MAX_BOOT_PHASES) {
+        boot_phases_[boot_phase_count_++] = {phase, time_ms};
+    }
+}
+
+void BenchmarkSuite::AddReport(cJSON* root, const char* name, const std::string& json) {
+    auto report = cJSON_Parse(json.c_str());
+    if (report == nullptr) {
+        report = cJSON_CreateString(json.c_str());
+    }
+    cJSON_AddItemToObject(root, name, report);
+}
+
+std::string BenchmarkSuite::Run() {
+    auto& app = Application::GetInstance();
+    if (app.GetDeviceState() != kDeviceStateIdle) {
+        return "{\"error\":\"The device must be idle\"}";
+    }
+    int64_t start_us = esp_timer_get_time();
+    ESP_LOGI(TAG, "Running the benchmark suite");
+
+    auto root = cJSON_CreateObject();
+    auto app_desc = esp_app_get_description();
+    cJSON_AddStringToObject(root, "board", BOARD_NAME);
+    cJSON_AddStringToObject(root, "target", CONFIG_IDF_TARGET);
+    cJSON_AddStringToObject(root, "version", app_desc->version);
+    cJSON_AddStringToObject(root, "idf", app_desc->idf_ver);
+
+    auto boot = cJSON_CreateObject();
+    for (int i = 0; i < boot_phase_count_; i++) {
+        cJSON_AddNumberToObject(boot, boot_phases_[i].name, boot_phases_[i].time_ms);
+    }
+    cJSON_AddItemToObject(root, "boot_ms", boot);
+
+    // Measured before the benchmarks allocate anything
+    auto memory = cJSON_CreateObject();
+    cJSON_AddNumberToObject(memory, "free_internal", heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    cJSON_AddNumberToObject(memory, "min_free_internal", heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+    cJSON_AddNumberToObject(memory, "free_psram", heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+    cJSON_AddItemToObject(root, "memory", memory);
+
+#if CONFIG_USE_AUDIO_LOOPBACK_BENCHMARK
+    AddReport(root, "codec_io", app.RunAudioLoopbackBenchmark(BENCHMARK_SUITE_LOOPBACK_SECONDS, false));
+#endif
+#if CONFIG_USE_CODEC_BENCHMARK
+    {
+        CodecBenchmark benchmark;
+        AddReport(root, "opus", benchmark.Run(BENCHMARK_SUITE_CODEC_FRAMES));
+    }
+#endif
+    // The CPU share of a profile is known once it has run, e.g. in a conversation before the suite
+    AddReport(root, "audio_processing", app.GetAudioProcessor()->GetProfilesJson());
+#if CONFIG_USE_DISPLAY_BENCHMARK
+    auto display = Board::GetInstance().GetDisplay();
+    if (display != nullptr) {
+        AddReport(root, "display", display->RunRenderBenchmark(BENCHMARK_SUITE_DISPLAY_FRAMES));
+    }
+#endif
+#if CONFIG_USE_LINK_BENCHMARK
+    if (CONFIG_BENCHMARK_SUITE_DOWNLOAD_URL[0] != '\0') {
+        LinkBenchmark benchmark;
+        AddReport(root, "network", benchmark.Run(CONFIG_BENCHMARK_SUITE_DOWNLOAD_URL, "", BENCHMARK_SUITE_LINK_SECONDS, 0));
+    }
+#endif
+    cJSON_AddNumberToObject(root, "suite_ms", (esp_timer_get_time() - start_us) / 1000);
+
+    auto json = cJSON_PrintUnformatted(root);
+    std::string result(json);
+    cJSON_free(json);
+    cJSON_Delete(root);
+    ESP_LOGI(TAG, BENCHMARK_SUITE_REPORT_TAG " %s", result.c_str());
+    return result;
+}
@@ -0,0 +1,61 @@
+#ifndef BENCHMARK_SUITE_H
+#define BENCHMARK_SUITE_H
+
+#include <string>
+#include <cstdint>
+
+struct cJSON;
+
+#define BENCHMARK_SUITE_MAX_BOOT_PHASES 12
+// Kept short so a whole board matrix runs in reasonable time, the single benchmarks take longer runs
+#define BENCHMARK_SUITE_LOOPBACK_SECONDS 5
+#define BENCHMARK_SUITE_CODEC_FRAMES 50
+#define BENCHMARK_SUITE_DISPLAY_FRAMES 30
+#define BENCHMARK_SUITE_LINK_SECONDS 10
+// Starts the serial line of the report, scripts/benchmark_matrix.py looks for it
+#define BENCHMARK_SUITE_REPORT_TAG "BENCHMARK_REPORT"
+
+/*
+ * One report of the whole pipeline of this board, so boards can be put side
+ * by side (CONFIG_USE_BENCHMARK_SUITE).
+ *
+ * Run() goes through the benchmarks the build has enabled, the same ones the
+ * MCP tools run on their own: codec I/O (the audio loopback benchmark), Opus
+ * and the resampler, the load of the audio processing profiles, display FPS
+ * and network throughput. The boot phases and the free memory are added. A
+ * benchmark that is not built in is left out of the report, not failed.
+ *
+ * The report is also printed on one line of the serial log, from which
+ * scripts/benchmark_matrix.py builds the matrix of all boards.
+ */
+
+class BenchmarkSuite {
+public:
+    static BenchmarkSuite& GetInstance() {
+        static BenchmarkSuite instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    BenchmarkSuite(const BenchmarkSuite&) = delete;
+    BenchmarkSuite& operator=(const BenchmarkSuite&) = delete;
+
+    // Main task, during boot. `phase` must be a literal
+    void OnBootPhase(const char* phase, int64_t time_ms);
+    // Blocks for about a minute, the device must be idle. Returns the report as JSON
+    std::string Run();
+
+private:
+    BenchmarkSuite() = default;
+
+    struct BootPhase {
+        const char* name;
+        int64_t time_ms;
+    };
+    BootPhase boot_phases_[BENCHMARK_SUITE_MAX_BOOT_PHASES];
+    int boot_phase_count_ = 0;
+
+    // Adds `json`, a report of one benchmark, as `name`. An error report is kept as it is
+    static void AddReport(cJSON* root, const char* name, const std::string& json);
+};
+
+#endif // BENCHMARK_SUITE_H
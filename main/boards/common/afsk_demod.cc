@@ -15,10 +15,17 @@ namespace audio_wifi_config
                                        WifiConfigurationAp *wifi_ap)
     {
         const int kInputSampleRate = 16000;                                    // Input sampling rate
-        const float kDownsampleStep = static_cast<float>(kInputSampleRate) / static_cast<float>(kAudioSampleRate); // Downsampling step
         std::vector<int16_t> audio_data;
+        // Reused for every read, the loop does not allocate once they have grown
+        std::vector<float> downsampled_data;
+        std::vector<float> probabilities;
         AudioSignalProcessor signal_processor(kAudioSampleRate, kMarkFrequency, kSpaceFrequency, kBitRate, kWindowSize);
         AudioDataBuffer data_buffer;
+        // Input position within one second, and the partial output sample it belongs to
+        size_t input_position = 0;
+        size_t output_index = 0;
+        float output_sum = 0.0f;
+        size_t output_count = 0;
 
         while (true)
         {
@@ -36,34 +43,27 @@ namespace audio_wifi_config
                 continue;
             }
             
-            // Downsample the audio data
-            std::vector<float> downsampled_data;
-            size_t last_index = 0;
-
-            if (kDownsampleStep > 1.0f)
-            {
-                downsampled_data.reserve(audio_data.size() / static_cast<size_t>(kDownsampleStep));
-                for (size_t i = 0; i < audio_data.size(); ++i)
-                {
-                    size_t sample_index = static_cast<size_t>(i / kDownsampleStep);
-                    if ((sample_index + 1) > last_index)
-                    {
-                        downsampled_data.push_back(static_cast<float>(audio_data[i]));
-                        last_index = sample_index + 1;
-                    }
-                }
-            }
-            else
+            // Downsample the audio data, each output sample is the mean of the input samples it
+            // covers, so noise above the new Nyquist frequency folds back weaker than with plain decimation
+            downsampled_data.clear();
+            for (int16_t sample : audio_data)
             {
-                downsampled_data.reserve(audio_data.size());
-                for (int16_t sample : audio_data)
+                size_t index = input_position * kAudioSampleRate / kInputSampleRate;
+                if (index != output_index && output_count > 0)
                 {
-                    downsampled_data.push_back(static_cast<float>(sample));
+                    downsampled_data.push_back(output_sum / output_count);
+                    output_sum = 0.0f;
+                    output_count = 0;
                 }
+                output_index = index;
+                output_sum += sample;
+                output_count++;
+                input_position = (input_position + 1) % kInputSampleRate;
             }
             
             // Process audio samples to get probability data
-            auto probabilities = signal_processor.ProcessAudioSamples(downsampled_data);
+            probabilities.clear();
+            signal_processor.ProcessAudioSamples(downsampled_data.data(), downsampled_data.size(), probabilities);
             
             // Feed probability data to the data buffer
             if (data_buffer.ProcessProbabilityData(probabilities, 0.5f))
@@ -115,55 +115,46 @@ namespace audio_wifi_config
 
     // FrequencyDetector implementation
     FrequencyDetector::FrequencyDetector(float frequency, size_t window_size)
-        : frequency_(frequency), window_size_(window_size)
+        : window_size_(window_size)
     {
-        frequency_bin_ = std::floor(frequency_ * static_cast<float>(window_size_));
-        angular_frequency_ = 2.0f * M_PI * frequency_;
-        cos_coefficient_ = std::cos(angular_frequency_);
-        sin_coefficient_ = std::sin(angular_frequency_);
+        float angular_frequency = 2.0f * M_PI * frequency;
+        cos_coefficient_ = std::cos(angular_frequency);
+        sin_coefficient_ = std::sin(angular_frequency);
         filter_coefficient_ = 2.0f * cos_coefficient_;
-
-        // Initialize state buffer
-        state_buffer_.push_back(0.0f);
-        state_buffer_.push_back(0.0f);
     }
 
     void FrequencyDetector::Reset()
     {
-        state_buffer_.clear();
-        state_buffer_.push_back(0.0f);
-        state_buffer_.push_back(0.0f);
+        s_minus_1_ = 0.0f;
+        s_minus_2_ = 0.0f;
     }
 
     void FrequencyDetector::ProcessSample(float sample)
     {
-        if (state_buffer_.size() < 2)
-        {
-            return;
-        }
-
-        float s_minus_2 = state_buffer_.front();  // S[-2]
-        state_buffer_.pop_front();
-        float s_minus_1 = state_buffer_.front();  // S[-1]
-        state_buffer_.pop_front();
-
-        float s_current = sample + filter_coefficient_ * s_minus_1 - s_minus_2;
-
-        state_buffer_.push_back(s_minus_1);  // Put S[-1] back
-        state_buffer_.push_back(s_current);  // Add new S[0]
+        float s_current = sample + filter_coefficient_ * s_minus_1_ - s_minus_2_;
+        s_minus_2_ = s_minus_1_;
+        s_minus_1_ = s_current;
     }
 
-    float FrequencyDetector::GetAmplitude() const
+    void FrequencyDetector::ProcessBlock(const float *samples, size_t count)
     {
-        if (state_buffer_.size() < 2)
+        float s_minus_1 = s_minus_1_;
+        float s_minus_2 = s_minus_2_;
+        const float coefficient = filter_coefficient_;
+        for (size_t i = 0; i < count; ++i)
         {
-            return 0.0f;
+            float s_current = samples[i] + coefficient * s_minus_1 - s_minus_2;
+            s_minus_2 = s_minus_1;
+            s_minus_1 = s_current;
         }
+        s_minus_1_ = s_minus_1;
+        s_minus_2_ = s_minus_2;
+    }
 
-        float s_minus_1 = state_buffer_[1];                      // S[-1]
-        float s_minus_2 = state_buffer_[0];                      // S[-2]
-        float real_part = cos_coefficient_ * s_minus_1 - s_minus_2;  // Real part
-        float imaginary_part = sin_coefficient_ * s_minus_1;         // Imaginary part
+    float FrequencyDetector::GetAmplitude() const
+    {
+        float real_part = cos_coefficient_ * s_minus_1_ - s_minus_2_;  // Real part
+        float imaginary_part = sin_coefficient_ * s_minus_1_;          // Imaginary part
 
         return std::sqrt(real_part * real_part + imaginary_part * imaginary_part) / 
                (static_cast<float>(window_size_) / 2.0f);
@@ -172,66 +163,59 @@ namespace audio_wifi_config
     // AudioSignalProcessor implementation
     AudioSignalProcessor::AudioSignalProcessor(size_t sample_rate, size_t mark_frequency, size_t space_frequency,
                                              size_t bit_rate, size_t window_size)
-        : input_buffer_size_(window_size), output_sample_count_(0)
+        : window_size_(window_size), samples_per_bit_(sample_rate / bit_rate), bit_sample_count_(0),
+          mark_detector_(static_cast<float>(mark_frequency) / static_cast<float>(sample_rate), window_size),
+          space_detector_(static_cast<float>(space_frequency) / static_cast<float>(sample_rate), window_size)
     {
         if (sample_rate % bit_rate != 0)
         {
             // On ESP32 we can continue execution, but log the error
             ESP_LOGW(kLogTag, "Sample rate %zu is not divisible by bit rate %zu", sample_rate, bit_rate);
         }
-
-        float normalized_mark_freq = static_cast<float>(mark_frequency) / static_cast<float>(sample_rate);
-        float normalized_space_freq = static_cast<float>(space_frequency) / static_cast<float>(sample_rate);
-
-        mark_detector_ = std::make_unique<FrequencyDetector>(normalized_mark_freq, window_size);
-        space_detector_ = std::make_unique<FrequencyDetector>(normalized_space_freq, window_size);
-
-        samples_per_bit_ = sample_rate / bit_rate;  // Number of samples per bit
+        if (window_size_ > samples_per_bit_)
+        {
+            ESP_LOGW(kLogTag, "Window size %zu is longer than a bit, using %zu", window_size_, samples_per_bit_);
+            window_size_ = samples_per_bit_;
+        }
     }
 
-    std::vector<float> AudioSignalProcessor::ProcessAudioSamples(const std::vector<float> &samples)
+    void AudioSignalProcessor::ProcessAudioSamples(const float *samples, size_t count, std::vector<float> &probabilities)
     {
-        std::vector<float> result;
-
-        for (float sample : samples)
+        const size_t window_start = samples_per_bit_ - window_size_;
+        while (count > 0)
         {
-            if (input_buffer_.size() < input_buffer_size_)
+            size_t block;
+            if (bit_sample_count_ < window_start)
             {
-                input_buffer_.push_back(sample);  // Just add, don't process yet
+                // Samples before the window only move the bit position
+                block = std::min(count, window_start - bit_sample_count_);
             }
             else
             {
-                // Input buffer is full, process the data
-                input_buffer_.pop_front();   // Remove oldest sample
-                input_buffer_.push_back(sample);  // Add new sample
-                output_sample_count_++;
-
-                if (output_sample_count_ >= samples_per_bit_)
-                {
-                    // Process all samples in the window using Goertzel algorithm
-                    for (float window_sample : input_buffer_)
-                    {
-                        mark_detector_->ProcessSample(window_sample);
-                        space_detector_->ProcessSample(window_sample);
-                    }
-
-                    float mark_amplitude = mark_detector_->GetAmplitude();   // Mark amplitude
-                    float space_amplitude = space_detector_->GetAmplitude(); // Space amplitude
-
-                    // Avoid division by zero
-                    float mark_probability = mark_amplitude / 
-                                           (space_amplitude + mark_amplitude + std::numeric_limits<float>::epsilon());
-                    result.push_back(mark_probability);
+                block = std::min(count, samples_per_bit_ - bit_sample_count_);
+                mark_detector_.ProcessBlock(samples, block);
+                space_detector_.ProcessBlock(samples, block);
+            }
+            samples += block;
+            count -= block;
+            bit_sample_count_ += block;
 
-                    // Reset detector windows
-                    mark_detector_->Reset();
-                    space_detector_->Reset();
-                    output_sample_count_ = 0;  // Reset output counter
-                }
+            if (bit_sample_count_ == samples_per_bit_)
+            {
+                float mark_amplitude = mark_detector_.GetAmplitude();   // Mark amplitude
+                float space_amplitude = space_detector_.GetAmplitude(); // Space amplitude
+
+                // Avoid division by zero
+                float mark_probability = mark_amplitude / 
+                                       (space_amplitude + mark_amplitude + std::numeric_limits<float>::epsilon());
+                probabilities.push_back(mark_probability);
+
+                // Reset detector windows
+                mark_detector_.Reset();
+                space_detector_.Reset();
+                bit_sample_count_ = 0;
             }
         }
-
-        return result;
     }
 
     // AudioDataBuffer implementation
@@ -242,6 +226,9 @@ namespace audio_wifi_config
           enable_checksum_validation_(true)
     {
         identifier_buffer_size_ = std::max(start_of_transmission_.size(), end_of_transmission_.size());
+        start_bits_ = PackIdentifier(start_of_transmission_);
+        end_bits_ = PackIdentifier(end_of_transmission_);
+        ClearBuffers();
         max_bit_buffer_size_ = 776;  // Preset bit buffer size, 776 bits = (32 + 1 + 63 + 1) * 8 = 776
 
         bit_buffer_.reserve(max_bit_buffer_size_);
@@ -255,6 +242,9 @@ namespace audio_wifi_config
           enable_checksum_validation_(enable_checksum)
     {
         identifier_buffer_size_ = std::max(start_of_transmission_.size(), end_of_transmission_.size());
+        start_bits_ = PackIdentifier(start_of_transmission_);
+        end_bits_ = PackIdentifier(end_of_transmission_);
+        ClearBuffers();
         max_bit_buffer_size_ = max_byte_size * 8;  // Bit buffer size in bytes
 
         bit_buffer_.reserve(max_bit_buffer_size_);
@@ -270,9 +260,35 @@ namespace audio_wifi_config
         return checksum;
     }
 
+    uint32_t AudioDataBuffer::PackIdentifier(const std::vector<uint8_t> &pattern)
+    {
+        if (pattern.size() > 32)
+        {
+            ESP_LOGE(kLogTag, "Identifier longer than 32 bits: %zu", pattern.size());
+        }
+        uint32_t bits = 0;
+        for (uint8_t bit : pattern)
+        {
+            bits = (bits << 1) | (bit & 1);
+        }
+        return bits;
+    }
+
+    bool AudioDataBuffer::MatchIdentifier(uint32_t bits, size_t size) const
+    {
+        // Like comparing the whole identifier buffer with the pattern, so both must fill it
+        if (identifier_bit_count_ < identifier_buffer_size_ || size != identifier_buffer_size_)
+        {
+            return false;
+        }
+        uint32_t mask = size >= 32 ? UINT32_MAX : (1u << size) - 1;
+        return (identifier_bits_ & mask) == bits;
+    }
+
     void AudioDataBuffer::ClearBuffers()
     {
-        identifier_buffer_.clear();
+        identifier_bits_ = 0;
+        identifier_bit_count_ = 0;
         bit_buffer_.clear();
     }
 
@@ -282,17 +298,17 @@ namespace audio_wifi_config
         {
             uint8_t bit = (probability > threshold) ? 1 : 0;
 
-            if (identifier_buffer_.size() >= identifier_buffer_size_)
+            identifier_bits_ = (identifier_bits_ << 1) | bit;
+            if (identifier_bit_count_ < identifier_buffer_size_)
             {
-                identifier_buffer_.pop_front();  // Maintain buffer size
+                identifier_bit_count_++;
             }
-            identifier_buffer_.push_back(bit);
 
             // Process received bit based on state machine
             switch (current_state_)
             {
             case DataReceptionState::kInactive:
-                if (identifier_buffer_.size() >= start_of_transmission_.size())
+                if (identifier_bit_count_ >= start_of_transmission_.size())
                 {
                     current_state_ = DataReceptionState::kWaiting;  // Enter waiting state
                     ESP_LOGI(kLogTag, "Entering Waiting state");
@@ -301,24 +317,19 @@ namespace audio_wifi_config
 
             case DataReceptionState::kWaiting:
                 // Waiting state, possibly waiting for transmission end
-                if (identifier_buffer_.size() >= start_of_transmission_.size())
+                if (MatchIdentifier(start_bits_, start_of_transmission_.size()))
                 {
-                    std::vector<uint8_t> identifier_snapshot(identifier_buffer_.begin(), identifier_buffer_.end());
-                    if (identifier_snapshot == start_of_transmission_)
-                    {
-                        ClearBuffers();                                // Clear buffers
-                        current_state_ = DataReceptionState::kReceiving;  // Enter receiving state
-                        ESP_LOGI(kLogTag, "Entering Receiving state");
-                    }
+                    ClearBuffers();                                // Clear buffers
+                    current_state_ = DataReceptionState::kReceiving;  // Enter receiving state
+                    ESP_LOGI(kLogTag, "Entering Receiving state");
                 }
                 break;
 
             case DataReceptionState::kReceiving:
                 bit_buffer_.push_back(bit);
-                if (identifier_buffer_.size() >= end_of_transmission_.size())
+                if (identifier_bit_count_ >= end_of_transmission_.size())
                 {
-                    std::vector<uint8_t> identifier_snapshot(identifier_buffer_.begin(), identifier_buffer_.end());
-                    if (identifier_snapshot == end_of_transmission_)
+                    if (MatchIdentifier(end_bits_, end_of_transmission_.size()))
                     {
                         current_state_ = DataReceptionState::kInactive;  // Enter inactive state
 
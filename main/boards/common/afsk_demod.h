@@ -1,7 +1,7 @@
 #pragma once
 
 #include <vector>
-#include <deque>
+#include <cstdint>
 #include <string>
 #include <memory>
 #include <optional>
@@ -28,14 +28,12 @@ namespace audio_wifi_config
     class FrequencyDetector
     {
     private:
-        float frequency_;              // Target frequency (normalized, i.e., f / fs)
         size_t window_size_;           // Window size for analysis
-        float frequency_bin_;          // Frequency bin
-        float angular_frequency_;      // Angular frequency
         float cos_coefficient_;        // cos(w)
         float sin_coefficient_;        // sin(w)
         float filter_coefficient_;     // 2 * cos(w)
-        std::deque<float> state_buffer_;  // Circular buffer for storing S[-1] and S[-2]
+        float s_minus_1_ = 0.0f;       // S[-1]
+        float s_minus_2_ = 0.0f;       // S[-2]
 
     public:
         /**
@@ -56,6 +54,13 @@ namespace audio_wifi_config
          */
         void ProcessSample(float sample);
 
+        /**
+         * Process a block of audio samples, the state stays in registers for the whole block
+         * @param samples Input audio samples
+         * @param count Number of samples
+         */
+        void ProcessBlock(const float *samples, size_t count);
+
         /**
          * Calculate current amplitude
          * @return Amplitude value
@@ -66,16 +71,19 @@ namespace audio_wifi_config
     /**
      * Audio signal processor for Mark/Space frequency pair detection
      * Processes audio signals to extract digital data using AFSK demodulation
+     *
+     * Each bit period is decided from its last window_size samples, which run
+     * through both detectors as they arrive. Nothing is buffered, a window
+     * longer than a bit period is shortened to one bit period.
      */
     class AudioSignalProcessor
     {
     private:
-        std::deque<float> input_buffer_;             // Input sample buffer
-        size_t input_buffer_size_;                   // Input buffer size = window size
-        size_t output_sample_count_;                 // Output sample counter
-        size_t samples_per_bit_;                     // Samples per bit threshold
-        std::unique_ptr<FrequencyDetector> mark_detector_;   // Mark frequency detector
-        std::unique_ptr<FrequencyDetector> space_detector_;  // Space frequency detector
+        size_t window_size_;                         // Samples of each bit that are analyzed
+        size_t samples_per_bit_;                     // Samples per bit
+        size_t bit_sample_count_;                    // Samples of the current bit seen so far
+        FrequencyDetector mark_detector_;            // Mark frequency detector
+        FrequencyDetector space_detector_;           // Space frequency detector
 
     public:
         /**
@@ -91,10 +99,11 @@ namespace audio_wifi_config
 
         /**
          * Process input audio samples
-         * @param samples Input audio sample vector
-         * @return Vector of Mark probability values (0.0 to 1.0)
+         * @param samples Input audio samples
+         * @param count Number of samples
+         * @param probabilities Receives one Mark probability (0.0 to 1.0) per completed bit, appended
          */
-        std::vector<float> ProcessAudioSamples(const std::vector<float> &samples);
+        void ProcessAudioSamples(const float *samples, size_t count, std::vector<float> &probabilities);
     };
 
     /**
@@ -115,8 +124,11 @@ namespace audio_wifi_config
     {
     private:
         DataReceptionState current_state_;       // Current reception state
-        std::deque<uint8_t> identifier_buffer_;  // Buffer for start/end identifier detection
+        uint32_t identifier_bits_;               // The last received bits for start/end identifier detection, newest in bit 0
+        size_t identifier_bit_count_;            // Valid bits in identifier_bits_, up to identifier_buffer_size_
         size_t identifier_buffer_size_;          // Identifier buffer size
+        uint32_t start_bits_;                    // start_of_transmission_ packed like identifier_bits_
+        uint32_t end_bits_;                      // end_of_transmission_ packed like identifier_bits_
         std::vector<uint8_t> bit_buffer_;        // Buffer for storing bit stream
         size_t max_bit_buffer_size_;             // Maximum bit buffer size
         const std::vector<uint8_t> start_of_transmission_;  // Start-of-transmission identifier
@@ -157,6 +169,21 @@ namespace audio_wifi_config
         static uint8_t CalculateChecksum(const std::string &text);
 
     private:
+        /**
+         * Pack an identifier, at most 32 bits, with its last bit in bit 0
+         * @param pattern Identifier bits
+         * @return Packed identifier
+         */
+        static uint32_t PackIdentifier(const std::vector<uint8_t> &pattern);
+
+        /**
+         * Check whether the last received bits match an identifier
+         * @param bits Packed identifier
+         * @param size Identifier length in bits
+         * @return true if the identifier was just received
+         */
+        bool MatchIdentifier(uint32_t bits, size_t size) const;
+
         /**
          * Convert bit vector to byte vector
          * @param bits Input bit vector
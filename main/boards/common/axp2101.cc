@@ -1,6 +1,7 @@
 #include "axp2101.h"
 #include "board.h"
 #include "display.h"
+#include "settings.h"
 
 #include <esp_log.h>
 
@@ -35,7 +36,7 @@ float Axp2101::GetTemperature() {
 }
 
 void Axp2101::PowerOff() {
-    uint8_t value = ReadReg(0x10);
-    value = value | 0x01;
-    WriteReg(0x10, value);
+    // 断电前提交还在等待的设置
+    Settings::Flush();
+    UpdateReg(0x10, 0x01, 0x01);
 }
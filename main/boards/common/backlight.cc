@@ -1,8 +1,12 @@
 #include "backlight.h"
 #include "settings.h"
+#include "board.h"
+#include "display.h"
+#include "application.h"
 
 #include <esp_log.h>
 #include <driver/ledc.h>
+#include <cmath>
 
 #define TAG "Backlight"
 
@@ -20,6 +24,21 @@ Backlight::Backlight() {
         .skip_unhandled_events = true,
     };
     ESP_ERROR_CHECK(esp_timer_create(&timer_args, &transition_timer_));
+
+    const esp_timer_create_args_t save_timer_args = {
+        .callback = [](void* arg) {
+            auto self = static_cast<Backlight*>(arg);
+            // NVS 写入较慢，放到主循环里，不占用定时器任务
+            Application::GetInstance().Schedule([self]() {
+                self->SaveBrightness();
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "backlight_save",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&save_timer_args, &save_timer_));
 }
 
 Backlight::~Backlight() {
@@ -27,6 +46,10 @@ Backlight::~Backlight() {
         esp_timer_stop(transition_timer_);
         esp_timer_delete(transition_timer_);
     }
+    if (save_timer_ != nullptr) {
+        esp_timer_stop(save_timer_);
+        esp_timer_delete(save_timer_);
+    }
 }
 
 void Backlight::RestoreBrightness() {
@@ -53,35 +76,70 @@ void Backlight::SetBrightness(uint8_t brightness, bool permanent) {
     }
 
     if (permanent) {
-        Settings settings("display", true);
-        settings.SetInt("brightness", brightness);
+        saved_brightness_ = brightness;
+        esp_timer_stop(save_timer_);
+        esp_timer_start_once(save_timer_, BACKLIGHT_SAVE_DELAY_MS * 1000);
     }
 
     target_brightness_ = brightness;
-    step_ = (target_brightness_ > brightness_) ? 1 : -1;
-
-    if (transition_timer_ != nullptr) {
-        // 启动定时器，每 5ms 更新一次
-        esp_timer_start_periodic(transition_timer_, 5 * 1000);
+    int time_ms = abs(target_brightness_ - brightness_) * BACKLIGHT_STEP_MS;
+    if (FadeImpl(target_brightness_, time_ms)) {
+        // 硬件渐变，定时器只在结束时触发一次
+        hardware_fade_ = true;
+        esp_timer_stop(transition_timer_);
+        if (brightness_ == 0) {
+            Board::GetInstance().GetDisplay()->SetRefreshHint(kRefreshHintScreenOff, false);
+        }
+        brightness_ = target_brightness_;
+        if (brightness_ == 0) {
+            esp_timer_start_once(transition_timer_, time_ms * 1000);
+        }
+    } else {
+        step_ = (target_brightness_ > brightness_) ? 1 : -1;
+        if (transition_timer_ != nullptr) {
+            // 启动定时器，每 5ms 更新一次
+            esp_timer_stop(transition_timer_);
+            esp_timer_start_periodic(transition_timer_, BACKLIGHT_STEP_MS * 1000);
+        }
     }
     ESP_LOGI(TAG, "Set brightness to %d", brightness);
 }
 
+void Backlight::SaveBrightness() {
+    Settings settings("display", true);
+    settings.SetInt("brightness", saved_brightness_);
+}
+
 void Backlight::OnTransitionTimer() {
+    // The hardware fade to 0 has finished, LVGL can stop
+    if (hardware_fade_) {
+        if (brightness_ == 0) {
+            Board::GetInstance().GetDisplay()->SetRefreshHint(kRefreshHintScreenOff, true);
+        }
+        return;
+    }
+
     if (brightness_ == target_brightness_) {
         esp_timer_stop(transition_timer_);
         return;
     }
 
+    // LVGL runs again before the screen lights up, and stops once it is dark
+    if (brightness_ == 0) {
+        Board::GetInstance().GetDisplay()->SetRefreshHint(kRefreshHintScreenOff, false);
+    }
     brightness_ += step_;
     SetBrightnessImpl(brightness_);
+    if (brightness_ == 0) {
+        Board::GetInstance().GetDisplay()->SetRefreshHint(kRefreshHintScreenOff, true);
+    }
 
     if (brightness_ == target_brightness_) {
         esp_timer_stop(transition_timer_);
     }
 }
 
-PwmBacklight::PwmBacklight(gpio_num_t pin, bool output_invert) : Backlight() {
+PwmBacklight::PwmBacklight(gpio_num_t pin, bool output_invert, BacklightCurve curve) : Backlight(), curve_(curve) {
     const ledc_timer_config_t backlight_timer = {
         .speed_mode = LEDC_LOW_SPEED_MODE,
         .duty_resolution = LEDC_TIMER_10_BIT,
@@ -106,16 +164,53 @@ PwmBacklight::PwmBacklight(gpio_num_t pin, bool output_invert) : Backlight() {
         }
     };
     ESP_ERROR_CHECK(ledc_channel_config(&backlight_channel));
+
+    // The fade service may already be installed by another LEDC user
+    esp_err_t err = ledc_fade_func_install(0);
+    fade_installed_ = (err == ESP_OK || err == ESP_ERR_INVALID_STATE);
+    if (!fade_installed_) {
+        ESP_LOGW(TAG, "LEDC fade is not available, stepping the brightness: %s", esp_err_to_name(err));
+    }
 }
 
 PwmBacklight::~PwmBacklight() {
     ledc_stop(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, 0);
 }
 
-void PwmBacklight::SetBrightnessImpl(uint8_t brightness) {
+// 人眼对亮度的感知接近对数，Gamma 和指数曲线让低亮度的调节更细
+uint32_t PwmBacklight::BrightnessToDuty(uint8_t brightness) {
     // LEDC resolution set to 10bits, thus: 100% = 1023
-    uint32_t duty_cycle = (1023 * brightness) / 100;
-    ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, duty_cycle);
+    float level = brightness / 100.0f;
+    switch (curve_) {
+        case kBacklightCurveGamma:
+            level = powf(level, BACKLIGHT_GAMMA);
+            break;
+        case kBacklightCurveExponential:
+            level = (exp2f(level * BACKLIGHT_EXPONENTIAL_RANGE) - 1.0f) / (exp2f(BACKLIGHT_EXPONENTIAL_RANGE) - 1.0f);
+            break;
+        default:
+            break;
+    }
+    uint32_t duty_cycle = lroundf(1023 * level);
+    // 非零亮度不能变成全黑
+    if (brightness > 0 && duty_cycle == 0) {
+        duty_cycle = 1;
+    }
+    return duty_cycle;
+}
+
+void PwmBacklight::SetBrightnessImpl(uint8_t brightness) {
+    ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, BrightnessToDuty(brightness));
     ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
 }
 
+bool PwmBacklight::FadeImpl(uint8_t brightness, int time_ms) {
+    if (!fade_installed_) {
+        return false;
+    }
+    ledc_fade_stop(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
+    if (ledc_set_fade_with_time(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, BrightnessToDuty(brightness), time_ms) != ESP_OK) {
+        return false;
+    }
+    return ledc_fade_start(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, LEDC_FADE_NO_WAIT) == ESP_OK;
+}
@@ -6,6 +6,19 @@
 #include <driver/gpio.h>
 #include <esp_timer.h>
 
+// 亮度每变化 1% 的渐变时间
+#define BACKLIGHT_STEP_MS 5
+// 最后一次修改亮度后等这么久再写入 NVS，拖动滑块时只写一次
+#define BACKLIGHT_SAVE_DELAY_MS 1000
+#define BACKLIGHT_GAMMA 2.2f
+// 指数曲线的动态范围，2 的这么多次方
+#define BACKLIGHT_EXPONENTIAL_RANGE 8.0f
+
+enum BacklightCurve {
+    kBacklightCurveLinear,
+    kBacklightCurveGamma,
+    kBacklightCurveExponential,
+};
 
 class Backlight {
 public:
@@ -18,19 +31,32 @@ public:
 
 protected:
     void OnTransitionTimer();
+    void SaveBrightness();
     virtual void SetBrightnessImpl(uint8_t brightness) = 0;
+    // Fades to the brightness in hardware, returns false to step it with the timer instead
+    virtual bool FadeImpl(uint8_t brightness, int time_ms) { return false; }
 
     esp_timer_handle_t transition_timer_ = nullptr;
+    esp_timer_handle_t save_timer_ = nullptr;
     uint8_t brightness_ = 0;
     uint8_t target_brightness_ = 0;
+    uint8_t saved_brightness_ = 0;
     uint8_t step_ = 1;
+    bool hardware_fade_ = false;
 };
 
 
 class PwmBacklight : public Backlight {
 public:
-    PwmBacklight(gpio_num_t pin, bool output_invert = false);
+    PwmBacklight(gpio_num_t pin, bool output_invert = false, BacklightCurve curve = kBacklightCurveLinear);
     ~PwmBacklight();
 
     void SetBrightnessImpl(uint8_t brightness) override;
+    bool FadeImpl(uint8_t brightness, int time_ms) override;
+
+private:
+    BacklightCurve curve_;
+    bool fade_installed_ = false;
+
+    uint32_t BrightnessToDuty(uint8_t brightness);
 };
@@ -12,7 +12,6 @@
 #include "camera.h"
 
 #include <memory>
-#include "AudioRecorder.h"
 
 void* create_board();
 class AudioCodec;
@@ -22,8 +21,6 @@ private:
     Board(const Board&) = delete; // 禁用拷贝构造函数
     Board& operator=(const Board&) = delete; // 禁用赋值操作
 
-    std::unique_ptr<ESP32AudioRecorder> audio_recorder_;
-
 protected:
     Board();
     std::string GenerateUuid();
@@ -47,19 +44,25 @@ public:
     virtual Display* GetDisplay();
     virtual Camera* GetCamera();
     virtual Http* CreateHttp() = 0;
+    // For short request/response exchanges to the same server, e.g. the version check and the activation
+    // polling. The board may hand out a kept-alive connection, the body must be set with SetContent()
+    virtual Http* CreateKeepAliveHttp() { return CreateHttp(); }
     virtual WebSocket* CreateWebSocket() = 0;
     virtual Mqtt* CreateMqtt() = 0;
     virtual Udp* CreateUdp() = 0;
     virtual void StartNetwork() = 0;
     virtual const char* GetNetworkStateIcon() = 0;
+    // Link strength mapped to 0-100 from RSSI or CSQ, -1 if unknown
+    virtual int GetSignalQuality() { return -1; }
+    // Counters of the network interface for self.system.get_metrics, a JSON object or empty if there are none
+    virtual std::string GetNetworkMetricsJson() { return ""; }
+    // Whether the last attempt to reach the server worked, boards with a second network fail over on it
+    virtual void OnServerConnection(bool connected) {}
     virtual bool GetBatteryLevel(int &level, bool& charging, bool& discharging);
     virtual std::string GetJson();
     virtual void SetPowerSaveMode(bool enabled) = 0;
     virtual std::string GetBoardJson() = 0;
     virtual std::string GetDeviceStatusJson() = 0;
-
-    ESP32AudioRecorder* GetAudioRecorder() { return audio_recorder_.get(); }
-    
 };
 
 #define DECLARE_BOARD(BOARD_CLASS_NAME) \
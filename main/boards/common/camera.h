@@ -2,14 +2,34 @@
 #define CAMERA_H
 
 #include <string>
+#include <vector>
+#include <cstdint>
 
 class Camera {
 public:
-    virtual void SetExplainUrl(const std::string& url, const std::string& token) = 0;
+    virtual ~Camera() = default;
+
+    virtual void SetExplainUrl(const std::string& url, const std::string& token) {
+        explain_url_ = url;
+        explain_token_ = token;
+    }
     virtual bool Capture() = 0;
     virtual bool SetHMirror(bool enabled) = 0;
     virtual bool SetVFlip(bool enabled) = 0;
+    // Takes a fresh frame for the scene change detector and writes the mean brightness of each of
+    // width x height cells to luma. Does not touch the last capture or the preview on cameras that
+    // can avoid it. False if the camera cannot do this
+    virtual bool CaptureLuma(uint8_t* luma, int width, int height) { return false; }
+    // Takes a fresh frame for the video stream and encodes it at quality (1-100) when the sensor
+    // does not output JPEG. Does not touch the last capture on cameras that can avoid it. False if
+    // the camera cannot do this
+    virtual bool CaptureJpeg(std::vector<uint8_t>& jpeg, int quality) { return false; }
+    // Uploads the last capture with an ExplainRequest and returns the server's JSON reply
     virtual std::string Explain(const std::string& question) = 0;
+
+protected:
+    std::string explain_url_;
+    std::string explain_token_;
 };
 
 #endif // CAMERA_H
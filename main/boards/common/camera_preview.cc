@@ -0,0 +1,286 @@
+#include "camera_preview.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <img_converters.h>
+#include <algorithm>
+#include <cstring>
+
+#if CONFIG_SOC_PPA_SUPPORTED
+#include <esp_cache.h>
+#endif
+
+#define TAG "CameraPreview"
+
+CameraPreview::CameraPreview() {
+    image_.header.magic = LV_IMAGE_HEADER_MAGIC;
+    image_.header.cf = LV_COLOR_FORMAT_RGB565;
+    image_.header.flags = LV_IMAGE_FLAGS_ALLOCATED | LV_IMAGE_FLAGS_MODIFIABLE;
+
+#if CONFIG_SOC_PPA_SUPPORTED
+    ppa_client_config_t ppa_config = {};
+    ppa_config.oper_type = PPA_OPERATION_SRM;
+    ppa_config.max_pending_trans_num = 1;
+    if (ppa_register_client(&ppa_config, &ppa_client_) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to register PPA client, scaling in software");
+        ppa_client_ = nullptr;
+    }
+#endif
+#if CONFIG_SOC_JPEG_CODEC_SUPPORTED
+    jpeg_decode_engine_cfg_t engine_config = {};
+    engine_config.intr_priority = 0;
+    engine_config.timeout_ms = 100;
+    if (jpeg_new_decoder_engine(&engine_config, &jpeg_decoder_) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to create JPEG decoder, decoding in software");
+        jpeg_decoder_ = nullptr;
+    }
+#endif
+}
+
+CameraPreview::~CameraPreview() {
+#if CONFIG_SOC_PPA_SUPPORTED
+    if (ppa_client_ != nullptr) {
+        ppa_unregister_client(ppa_client_);
+    }
+#endif
+#if CONFIG_SOC_JPEG_CODEC_SUPPORTED
+    if (jpeg_decoder_ != nullptr) {
+        jpeg_del_decoder_engine(jpeg_decoder_);
+    }
+    if (jpeg_input_ != nullptr) {
+        heap_caps_free(jpeg_input_);
+    }
+    if (jpeg_output_ != nullptr) {
+        heap_caps_free(jpeg_output_);
+    }
+#endif
+    if (scratch_ != nullptr) {
+        heap_caps_free(scratch_);
+    }
+    if (image_.data != nullptr) {
+        heap_caps_free((void*)image_.data);
+    }
+}
+
+const lv_img_dsc_t* CameraPreview::Render(const camera_fb_t* fb, int max_width, int max_height) {
+    if (fb == nullptr || fb->width == 0 || fb->height == 0 || max_width <= 0 || max_height <= 0) {
+        return nullptr;
+    }
+
+    const uint8_t* src = fb->buf;
+    int width = fb->width;
+    int height = fb->height;
+    int stride = fb->width;
+    // The sensor and jpg2rgb565 both produce big endian RGB565
+    bool swap = true;
+
+    if (fb->format == PIXFORMAT_JPEG) {
+        bool decoded = false;
+#if CONFIG_SOC_JPEG_CODEC_SUPPORTED
+        decoded = DecodeWithJpegCodec(fb, width, height, stride);
+        if (decoded) {
+            src = jpeg_output_;
+            swap = false;
+        }
+#endif
+        if (!decoded) {
+            size_t size = fb->width * fb->height * 2;
+            if (scratch_capacity_ < size) {
+                if (scratch_ != nullptr) {
+                    heap_caps_free(scratch_);
+                }
+                scratch_ = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+                scratch_capacity_ = scratch_ != nullptr ? size : 0;
+            }
+            if (scratch_ == nullptr || !jpg2rgb565(fb->buf, fb->len, scratch_, JPG_SCALE_NONE)) {
+                ESP_LOGE(TAG, "Failed to decode JPEG frame");
+                return nullptr;
+            }
+            src = scratch_;
+            width = fb->width;
+            height = fb->height;
+            stride = fb->width;
+        }
+    } else if (fb->format != PIXFORMAT_RGB565) {
+        ESP_LOGW(TAG, "Unsupported pixel format: %d", fb->format);
+        return nullptr;
+    }
+
+#if CONFIG_SOC_PPA_SUPPORTED
+    if (ScaleWithPpa(src, width, height, stride, swap, max_width, max_height)) {
+        return &image_;
+    }
+#endif
+
+    float scale = std::min((float)max_width / width, (float)max_height / height);
+    if (!AllocateImage(std::max(1, (int)(width * scale)), std::max(1, (int)(height * scale)))) {
+        return nullptr;
+    }
+    ScaleInSoftware(src, width, height, stride, swap);
+    return &image_;
+}
+
+bool CameraPreview::AllocateImage(int width, int height) {
+    size_t size = width * height * 2;
+    if (image_capacity_ < size) {
+        if (image_.data != nullptr) {
+            heap_caps_free((void*)image_.data);
+            image_.data = nullptr;
+            image_capacity_ = 0;
+        }
+        size_t alignment = 16;
+#if CONFIG_SOC_PPA_SUPPORTED
+        // The PPA writes whole cache lines of the output
+        esp_cache_get_alignment(MALLOC_CAP_SPIRAM, &alignment);
+        alignment = std::max<size_t>(alignment, 16);
+        size = (size + alignment - 1) / alignment * alignment;
+#endif
+        image_.data = (uint8_t*)heap_caps_aligned_calloc(alignment, 1, size, MALLOC_CAP_SPIRAM);
+        if (image_.data == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate memory for preview image");
+            return false;
+        }
+        image_capacity_ = size;
+    }
+    image_.header.w = width;
+    image_.header.h = height;
+    image_.header.stride = width * 2;
+    image_.data_size = width * height * 2;
+    return true;
+}
+
+void CameraPreview::ScaleInSoftware(const uint8_t* src, int width, int height, int stride, bool swap) {
+    auto pixels = (const uint16_t*)src;
+    auto dst = (uint16_t*)image_.data;
+    int dst_width = image_.header.w;
+    int dst_height = image_.header.h;
+    if (dst_width == width && dst_height == height && !swap) {
+        // Same size and byte order, the rows are copied as they are
+        for (int y = 0; y < dst_height; y++) {
+            memcpy(dst + y * dst_width, pixels + y * stride, dst_width * 2);
+        }
+        return;
+    }
+    // 16.16 fixed point steps through the source, nearest neighbour
+    uint32_t step_x = ((uint32_t)width << 16) / dst_width;
+    uint32_t step_y = ((uint32_t)height << 16) / dst_height;
+    for (int y = 0; y < dst_height; y++) {
+        auto row = pixels + ((y * step_y) >> 16) * stride;
+        uint32_t sx = 0;
+        if (swap) {
+            for (int x = 0; x < dst_width; x++, sx += step_x) {
+                *dst++ = __builtin_bswap16(row[sx >> 16]);
+            }
+        } else {
+            for (int x = 0; x < dst_width; x++, sx += step_x) {
+                *dst++ = row[sx >> 16];
+            }
+        }
+    }
+}
+
+#if CONFIG_SOC_PPA_SUPPORTED
+bool CameraPreview::ScaleWithPpa(const uint8_t* src, int width, int height, int stride, bool swap,
+    int max_width, int max_height) {
+    if (ppa_client_ == nullptr) {
+        return false;
+    }
+
+    // The PPA scales in steps of 1/16, round down so the result still fits
+    float scale = std::min((float)max_width / width, (float)max_height / height);
+    scale = std::max(1, (int)(scale * 16)) / 16.0f;
+    int dst_width = width * scale;
+    int dst_height = height * scale;
+    if (dst_width > max_width || dst_height > max_height || !AllocateImage(dst_width, dst_height)) {
+        return false;
+    }
+
+    ppa_srm_oper_config_t config = {};
+    config.in.buffer = src;
+    config.in.pic_w = stride;
+    config.in.pic_h = height;
+    config.in.block_w = width;
+    config.in.block_h = height;
+    config.in.srm_cm = PPA_SRM_COLOR_MODE_RGB565;
+    config.out.buffer = (void*)image_.data;
+    config.out.buffer_size = image_capacity_;
+    config.out.pic_w = dst_width;
+    config.out.pic_h = dst_height;
+    config.out.srm_cm = PPA_SRM_COLOR_MODE_RGB565;
+    config.rotation_angle = PPA_SRM_ROTATION_ANGLE_0;
+    config.scale_x = scale;
+    config.scale_y = scale;
+    config.byte_swap = swap;
+    config.mode = PPA_TRANS_MODE_BLOCKING;
+    esp_err_t err = ppa_do_scale_rotate_mirror(ppa_client_, &config);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "PPA scaling failed (%s), scaling in software", esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+#endif
+
+#if CONFIG_SOC_JPEG_CODEC_SUPPORTED
+bool CameraPreview::DecodeWithJpegCodec(const camera_fb_t* fb, int& width, int& height, int& stride) {
+    if (jpeg_decoder_ == nullptr) {
+        return false;
+    }
+
+    jpeg_decode_picture_info_t info;
+    if (jpeg_decoder_get_info(fb->buf, fb->len, &info) != ESP_OK) {
+        return false;
+    }
+    // The decoder writes whole MCUs, so rows are padded to the MCU width
+    int mcu_width = (info.sample_method == JPEG_DOWN_SAMPLING_YUV444 ||
+                     info.sample_method == JPEG_DOWN_SAMPLING_GRAY) ? 8 : 16;
+    int mcu_height = info.sample_method == JPEG_DOWN_SAMPLING_YUV420 ? 16 : 8;
+    int padded_width = (info.width + mcu_width - 1) / mcu_width * mcu_width;
+    int padded_height = (info.height + mcu_height - 1) / mcu_height * mcu_height;
+
+    // Both buffers have to come from jpeg_alloc_decoder_mem for the DMA alignment
+    if (jpeg_input_capacity_ < fb->len) {
+        if (jpeg_input_ != nullptr) {
+            heap_caps_free(jpeg_input_);
+        }
+        jpeg_decode_memory_alloc_cfg_t alloc_config = {};
+        alloc_config.buffer_direction = JPEG_DEC_ALLOC_INPUT_BUFFER;
+        jpeg_input_ = (uint8_t*)jpeg_alloc_decoder_mem(fb->len, &alloc_config, &jpeg_input_capacity_);
+        if (jpeg_input_ == nullptr) {
+            jpeg_input_capacity_ = 0;
+            return false;
+        }
+    }
+    size_t output_size = padded_width * padded_height * 2;
+    if (jpeg_output_capacity_ < output_size) {
+        if (jpeg_output_ != nullptr) {
+            heap_caps_free(jpeg_output_);
+        }
+        jpeg_decode_memory_alloc_cfg_t alloc_config = {};
+        alloc_config.buffer_direction = JPEG_DEC_ALLOC_OUTPUT_BUFFER;
+        jpeg_output_ = (uint8_t*)jpeg_alloc_decoder_mem(output_size, &alloc_config, &jpeg_output_capacity_);
+        if (jpeg_output_ == nullptr) {
+            jpeg_output_capacity_ = 0;
+            return false;
+        }
+    }
+    memcpy(jpeg_input_, fb->buf, fb->len);
+
+    jpeg_decode_cfg_t decode_config = {};
+    decode_config.output_format = JPEG_DECODE_OUT_FORMAT_RGB565;
+    decode_config.rgb_order = JPEG_DEC_RGB_ELEMENT_ORDER_BGR;  // Little endian, as LVGL expects
+    decode_config.conv_std = JPEG_YUV_RGB_CONV_STD_BT601;
+    uint32_t decoded_size = 0;
+    esp_err_t err = jpeg_decoder_process(jpeg_decoder_, &decode_config, jpeg_input_, fb->len,
+        jpeg_output_, jpeg_output_capacity_, &decoded_size);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "JPEG decoding failed (%s), decoding in software", esp_err_to_name(err));
+        return false;
+    }
+
+    width = info.width;
+    height = info.height;
+    stride = padded_width;
+    return true;
+}
+#endif
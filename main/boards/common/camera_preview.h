@@ -0,0 +1,60 @@
+#ifndef CAMERA_PREVIEW_H
+#define CAMERA_PREVIEW_H
+
+#include <esp_camera.h>
+#include <lvgl.h>
+
+#include <cstdint>
+
+#if CONFIG_SOC_PPA_SUPPORTED
+#include <driver/ppa.h>
+#endif
+#if CONFIG_SOC_JPEG_CODEC_SUPPORTED
+#include <driver/jpeg_decode.h>
+#endif
+
+/*
+ * Turns camera frames into the RGB565 image the display shows.
+ *
+ * The frame is scaled to the size it is drawn at, so LVGL copies it to the
+ * panel as is instead of transforming it on every refresh with the display
+ * lock held. JPEG frames are decoded first. On chips with a JPEG codec and a
+ * PPA (ESP32-P4) both steps run in hardware and the PPA also swaps the bytes
+ * of sensor RGB565. Elsewhere, or when the hardware refuses a frame, a nearest
+ * neighbour scaler does the same in one pass.
+ *
+ * The image is reused by every Render call, it stays valid until the next one.
+ */
+class CameraPreview {
+public:
+    CameraPreview();
+    ~CameraPreview();
+
+    // Returns the frame scaled to fit max_width x max_height, or nullptr if it cannot be shown
+    const lv_img_dsc_t* Render(const camera_fb_t* fb, int max_width, int max_height);
+
+private:
+    lv_img_dsc_t image_ = {};
+    size_t image_capacity_ = 0;
+    uint8_t* scratch_ = nullptr;    // Software JPEG output, big endian like the sensor
+    size_t scratch_capacity_ = 0;
+
+#if CONFIG_SOC_PPA_SUPPORTED
+    ppa_client_handle_t ppa_client_ = nullptr;
+    bool ScaleWithPpa(const uint8_t* src, int width, int height, int stride, bool swap,
+        int max_width, int max_height);
+#endif
+#if CONFIG_SOC_JPEG_CODEC_SUPPORTED
+    jpeg_decoder_handle_t jpeg_decoder_ = nullptr;
+    uint8_t* jpeg_input_ = nullptr;
+    size_t jpeg_input_capacity_ = 0;
+    uint8_t* jpeg_output_ = nullptr;
+    size_t jpeg_output_capacity_ = 0;
+    bool DecodeWithJpegCodec(const camera_fb_t* fb, int& width, int& height, int& stride);
+#endif
+
+    bool AllocateImage(int width, int height);
+    void ScaleInSoftware(const uint8_t* src, int width, int height, int stride, bool swap);
+};
+
+#endif // CAMERA_PREVIEW_H
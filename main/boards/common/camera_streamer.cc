@@ -0,0 +1,120 @@
+#include "camera_streamer.h"
+#include "application.h"
+#include "task_topology.h"
+
+#include <esp_log.h>
+#include <cJSON.h>
+
+#include <algorithm>
+
+#define TAG "CameraStreamer"
+
+CameraStreamer::CameraStreamer(Camera* camera) : camera_(camera) {
+}
+
+CameraStreamer::~CameraStreamer() {
+    Stop();
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (task_ == nullptr) {
+                break;
+            }
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+void CameraStreamer::Start(int fps) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fps_ = std::max(1, std::min(fps, CAMERA_STREAM_MAX_FPS));
+    running_ = true;
+    if (task_ != nullptr) {
+        xTaskNotifyGive(task_);
+        return;
+    }
+
+    TaskTopology::GetInstance().CreateTask(kTaskCameraStream, [](void* arg) {
+        static_cast<CameraStreamer*>(arg)->Loop();
+    }, this, &task_);
+    ESP_LOGI(TAG, "Streaming at %d fps", fps_);
+}
+
+void CameraStreamer::Stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        running_ = false;
+        ESP_LOGI(TAG, "Stopped after %lu frames sent and %lu dropped", sent_, dropped_);
+    }
+    if (task_ != nullptr) {
+        xTaskNotifyGive(task_);
+    }
+}
+
+std::string CameraStreamer::GetStatusJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "running", running_);
+    if (running_) {
+        cJSON_AddNumberToObject(root, "fps", fps_);
+    }
+    cJSON_AddBoolToObject(root, "server_accepts_video", Application::GetInstance().CanSendVideo());
+    cJSON_AddNumberToObject(root, "sent", sent_);
+    cJSON_AddNumberToObject(root, "dropped", dropped_);
+    cJSON_AddNumberToObject(root, "sent_bytes", sent_bytes_);
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
+
+void CameraStreamer::Loop() {
+    auto last_wake = xTaskGetTickCount();
+    while (true) {
+        int fps;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!running_) {
+                task_ = nullptr;
+                break;
+            }
+            fps = fps_;
+        }
+        // The period does not stretch by the capture time
+        auto period = pdMS_TO_TICKS(1000 / fps);
+        auto elapsed = xTaskGetTickCount() - last_wake;
+        if (ulTaskNotifyTake(pdTRUE, elapsed < period ? period - elapsed : 0) != 0) {
+            last_wake = xTaskGetTickCount();
+            continue;
+        }
+        last_wake = xTaskGetTickCount();
+        if (running_) {
+            SendFrame();
+        }
+    }
+    TaskTopology::ExitTask();
+}
+
+void CameraStreamer::SendFrame() {
+    auto& app = Application::GetInstance();
+    // 通道没打开时不拍，省下采集和编码
+    if (!app.CanSendVideo()) {
+        return;
+    }
+    if (!camera_->CaptureJpeg(jpeg_, CAMERA_STREAM_JPEG_QUALITY)) {
+        ESP_LOGW(TAG, "Failed to capture a frame");
+        return;
+    }
+    auto size = jpeg_.size();
+    bool sent = app.SendVideoFrame(std::move(jpeg_));
+    jpeg_.clear();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (sent) {
+        sent_++;
+        sent_bytes_ += size;
+    } else {
+        dropped_++;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef CAMERA_STREAMER_H
+#define CAMERA_STREAMER_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+
+#define CAMERA_STREAM_MAX_FPS 5
+// 视频帧比拍照小很多，画质也可以低一些
+#define CAMERA_STREAM_JPEG_QUALITY 40
+
+/*
+ * Sends camera frames to the server at a low frame rate while the audio
+ * channel is open, for servers that announced the "video" feature.
+ *
+ * Each frame is captured as JPEG and handed to Application::SendVideoFrame,
+ * which puts it on the WebSocket binary channel from the main loop. Audio
+ * keeps priority: a frame is dropped when the previous one has not gone out
+ * yet or the uplink audio queue is backing up, and no frame is captured at
+ * all while the channel is closed or the server does not take video.
+ */
+class CameraStreamer {
+public:
+    explicit CameraStreamer(Camera* camera);
+    ~CameraStreamer();
+
+    void Start(int fps);
+    void Stop();
+    std::string GetStatusJson();
+
+private:
+    Camera* camera_;
+    std::mutex mutex_;
+    TaskHandle_t task_ = nullptr;
+    std::atomic<bool> running_ = false;
+    int fps_ = 0;
+    std::vector<uint8_t> jpeg_;
+    uint32_t sent_ = 0;
+    uint32_t dropped_ = 0;
+    uint32_t sent_bytes_ = 0;
+
+    void Loop();
+    void SendFrame();
+};
+
+#endif // CAMERA_STREAMER_H
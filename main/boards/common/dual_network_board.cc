@@ -15,6 +15,7 @@ DualNetworkBoard::DualNetworkBoard(gpio_num_t ml307_tx_pin, gpio_num_t ml307_rx_
     
     // 从Settings加载网络类型
     network_type_ = LoadNetworkTypeFromSettings(default_net_type);
+    preferred_type_ = network_type_;
     
     // 只初始化当前网络类型对应的板卡
     InitializeCurrentBoard();
@@ -32,23 +33,56 @@ void DualNetworkBoard::SaveNetworkTypeToSettings(NetworkType type) {
     settings.SetInt("type", network_type);
 }
 
+DualNetworkBoard::~DualNetworkBoard() {
+    if (failover_timer_ != nullptr) {
+        esp_timer_stop(failover_timer_);
+        esp_timer_delete(failover_timer_);
+    }
+}
+
 void DualNetworkBoard::InitializeCurrentBoard() {
+#if CONFIG_DUAL_NETWORK_FAILOVER
+    // Both are created up front, the standby network comes up while the other one is in use
+    ESP_LOGI(TAG, "Initialize WiFi and ML307 boards");
+    wifi_board_ = std::make_unique<WifiBoard>();
+    ml307_board_ = std::make_unique<Ml307Board>(ml307_tx_pin_, ml307_rx_pin_, ml307_rx_buffer_size_);
+#else
     if (network_type_ == NetworkType::ML307) {
         ESP_LOGI(TAG, "Initialize ML307 board");
-        current_board_ = std::make_unique<Ml307Board>(ml307_tx_pin_, ml307_rx_pin_, ml307_rx_buffer_size_);
+        ml307_board_ = std::make_unique<Ml307Board>(ml307_tx_pin_, ml307_rx_pin_, ml307_rx_buffer_size_);
     } else {
         ESP_LOGI(TAG, "Initialize WiFi board");
-        current_board_ = std::make_unique<WifiBoard>();
+        wifi_board_ = std::make_unique<WifiBoard>();
+    }
+#endif
+    current_board_ = GetBoard(network_type_);
+}
+
+Board* DualNetworkBoard::GetBoard(NetworkType type) const {
+    if (type == NetworkType::ML307) {
+        return ml307_board_.get();
     }
+    return wifi_board_.get();
 }
 
 void DualNetworkBoard::SwitchNetworkType() {
+    NetworkType target = network_type_ == NetworkType::WIFI ? NetworkType::ML307 : NetworkType::WIFI;
+    SaveNetworkTypeToSettings(target);
+#if CONFIG_DUAL_NETWORK_FAILOVER
+    // No reboot needed if the other network is already up
+    if (standby_started_ && GetBoard(target)->GetSignalQuality() >= 0) {
+        preferred_type_ = target;
+        Application::GetInstance().Schedule([this, target]() {
+            SwitchTo(target);
+        });
+        return;
+    }
+#endif
+
     auto display = GetDisplay();
-    if (network_type_ == NetworkType::WIFI) {    
-        SaveNetworkTypeToSettings(NetworkType::ML307);
+    if (target == NetworkType::ML307) {
         display->ShowNotification(Lang::Strings::SWITCH_TO_4G_NETWORK);
     } else {
-        SaveNetworkTypeToSettings(NetworkType::WIFI);
         display->ShowNotification(Lang::Strings::SWITCH_TO_WIFI_NETWORK);
     }
     vTaskDelay(pdMS_TO_TICKS(1000));
@@ -56,9 +90,95 @@ void DualNetworkBoard::SwitchNetworkType() {
     app.Reboot();
 }
 
+void DualNetworkBoard::StartStandbyNetwork() {
+    if (network_type_ == NetworkType::ML307) {
+        standby_started_ = wifi_board_->StartStandby();
+    } else {
+        // Registration can take a minute, it must not hold up the start
+        xTaskCreate([](void* arg) {
+            static_cast<Ml307Board*>(arg)->StartStandby();
+            vTaskDelete(NULL);
+        }, "ml307_standby", 4096, ml307_board_.get(), 2, nullptr);
+        standby_started_ = true;
+    }
+    if (!standby_started_) {
+        return;
+    }
+
+    esp_timer_create_args_t failover_timer_args = {
+        .callback = [](void* arg) {
+            auto board = (DualNetworkBoard*)arg;
+            Application::GetInstance().Schedule([board]() {
+                board->CheckFailover();
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "net_failover",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&failover_timer_args, &failover_timer_);
+    esp_timer_start_periodic(failover_timer_, DUAL_NETWORK_CHECK_INTERVAL_MS * 1000);
+}
+
+// Runs in the main loop
+void DualNetworkBoard::CheckFailover() {
+    NetworkType other = network_type_ == NetworkType::WIFI ? NetworkType::ML307 : NetworkType::WIFI;
+    int quality = GetCurrentBoard().GetSignalQuality();
+    int other_quality = GetBoard(other)->GetSignalQuality();
+    bool idle = Application::GetInstance().GetDeviceState() == kDeviceStateIdle;
+
+    // Back to the preferred network once it has been good for a while, between turns only
+    if (network_type_ != preferred_type_) {
+        recover_checks_ = other_quality >= CONFIG_DUAL_NETWORK_GOOD_SIGNAL ? recover_checks_ + 1 : 0;
+        if (recover_checks_ >= DUAL_NETWORK_RECOVER_CHECKS && idle) {
+            SwitchTo(other);
+            return;
+        }
+    }
+
+    // A link that is gone or keeps failing is left right away, a weak one that still works
+    // is left at the end of the turn
+    poor_checks_ = quality < CONFIG_DUAL_NETWORK_POOR_SIGNAL ? poor_checks_ + 1 : 0;
+    bool weak = poor_checks_ >= DUAL_NETWORK_POOR_CHECKS;
+    bool failing = server_failures_ >= DUAL_NETWORK_MAX_SERVER_FAILURES;
+    if ((weak || failing) && other_quality >= CONFIG_DUAL_NETWORK_POOR_SIGNAL && (idle || failing || quality < 0)) {
+        SwitchTo(other);
+    }
+}
+
+// Runs in the main loop. Nothing is persisted, the preferred network stays the one in settings.
+void DualNetworkBoard::SwitchTo(NetworkType type) {
+    if (type == network_type_) {
+        return;
+    }
+    ESP_LOGI(TAG, "Switching to %s without reboot", type == NetworkType::ML307 ? "ML307" : "WiFi");
+    network_type_ = type;
+    current_board_ = GetBoard(type);
+    poor_checks_ = 0;
+    recover_checks_ = 0;
+    server_failures_ = 0;
+
+    auto display = GetDisplay();
+    if (type == NetworkType::ML307) {
+        display->ShowNotification(Lang::Strings::SWITCH_TO_4G_NETWORK);
+    } else {
+        display->ShowNotification(Lang::Strings::SWITCH_TO_WIFI_NETWORK);
+    }
+    Application::GetInstance().OnNetworkChanged();
+}
+
+void DualNetworkBoard::OnServerConnection(bool connected) {
+    if (connected) {
+        server_failures_ = 0;
+    } else {
+        server_failures_++;
+    }
+}
+
  
 std::string DualNetworkBoard::GetBoardType() {
-    return current_board_->GetBoardType();
+    return GetCurrentBoard().GetBoardType();
 }
 
 void DualNetworkBoard::StartNetwork() {
@@ -69,37 +189,52 @@ void DualNetworkBoard::StartNetwork() {
     } else {
         display->SetStatus(Lang::Strings::DETECTING_MODULE);
     }
-    current_board_->StartNetwork();
+    GetCurrentBoard().StartNetwork();
+#if CONFIG_DUAL_NETWORK_FAILOVER
+    StartStandbyNetwork();
+#endif
 }
 
 Http* DualNetworkBoard::CreateHttp() {
-    return current_board_->CreateHttp();
+    return GetCurrentBoard().CreateHttp();
+}
+
+Http* DualNetworkBoard::CreateKeepAliveHttp() {
+    return GetCurrentBoard().CreateKeepAliveHttp();
 }
 
 WebSocket* DualNetworkBoard::CreateWebSocket() {
-    return current_board_->CreateWebSocket();
+    return GetCurrentBoard().CreateWebSocket();
 }
 
 Mqtt* DualNetworkBoard::CreateMqtt() {
-    return current_board_->CreateMqtt();
+    return GetCurrentBoard().CreateMqtt();
 }
 
 Udp* DualNetworkBoard::CreateUdp() {
-    return current_board_->CreateUdp();
+    return GetCurrentBoard().CreateUdp();
 }
 
 const char* DualNetworkBoard::GetNetworkStateIcon() {
-    return current_board_->GetNetworkStateIcon();
+    return GetCurrentBoard().GetNetworkStateIcon();
+}
+
+int DualNetworkBoard::GetSignalQuality() {
+    return GetCurrentBoard().GetSignalQuality();
+}
+
+std::string DualNetworkBoard::GetNetworkMetricsJson() {
+    return GetCurrentBoard().GetNetworkMetricsJson();
 }
 
 void DualNetworkBoard::SetPowerSaveMode(bool enabled) {
-    current_board_->SetPowerSaveMode(enabled);
+    GetCurrentBoard().SetPowerSaveMode(enabled);
 }
 
 std::string DualNetworkBoard::GetBoardJson() {   
-    return current_board_->GetBoardJson();
+    return GetCurrentBoard().GetBoardJson();
 }
 
 std::string DualNetworkBoard::GetDeviceStatusJson() {
-    return current_board_->GetDeviceStatusJson();
+    return GetCurrentBoard().GetDeviceStatusJson();
 }
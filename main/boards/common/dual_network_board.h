@@ -4,7 +4,15 @@
 #include "board.h"
 #include "wifi_board.h"
 #include "ml307_board.h"
+#include <esp_timer.h>
 #include <memory>
+#include <atomic>
+
+// Live failover: how often the links are checked, and how many checks in a row make a decision
+#define DUAL_NETWORK_CHECK_INTERVAL_MS 5000
+#define DUAL_NETWORK_POOR_CHECKS 3
+#define DUAL_NETWORK_RECOVER_CHECKS 6
+#define DUAL_NETWORK_MAX_SERVER_FAILURES 2
 
 //enum NetworkType
 enum class NetworkType {
@@ -15,9 +23,19 @@ enum class NetworkType {
 // 双网络板卡类，可以在WiFi和ML307之间切换
 class DualNetworkBoard : public Board {
 private:
-    // 使用基类指针存储当前活动的板卡
-    std::unique_ptr<Board> current_board_;
+    // 使用基类指针存储当前活动的板卡，开启热切换时两个板卡同时存在
+    std::unique_ptr<WifiBoard> wifi_board_;
+    std::unique_ptr<Ml307Board> ml307_board_;
+    std::atomic<Board*> current_board_ = nullptr;
     NetworkType network_type_ = NetworkType::ML307;  // Default to ML307
+    // The network saved in settings, failover returns to it once it recovers
+    NetworkType preferred_type_ = NetworkType::ML307;
+
+    esp_timer_handle_t failover_timer_ = nullptr;
+    bool standby_started_ = false;
+    int poor_checks_ = 0;
+    int recover_checks_ = 0;
+    std::atomic<int> server_failures_ = 0;
 
     // ML307的引脚配置
     gpio_num_t ml307_tx_pin_;
@@ -32,10 +50,15 @@ private:
 
     // 初始化当前网络类型对应的板卡
     void InitializeCurrentBoard();
+
+    Board* GetBoard(NetworkType type) const;
+    void StartStandbyNetwork();
+    void CheckFailover();
+    void SwitchTo(NetworkType type);
  
 public:
     DualNetworkBoard(gpio_num_t ml307_tx_pin, gpio_num_t ml307_rx_pin, size_t ml307_rx_buffer_size = 4096, int32_t default_net_type = 1);
-    virtual ~DualNetworkBoard() = default;
+    virtual ~DualNetworkBoard();
  
     // 切换网络类型
     void SwitchNetworkType();
@@ -44,16 +67,20 @@ public:
     NetworkType GetNetworkType() const { return network_type_; }
     
     // 获取当前活动的板卡引用
-    Board& GetCurrentBoard() const { return *current_board_; }
+    Board& GetCurrentBoard() const { return *current_board_.load(); }
     
     // 重写Board接口
     virtual std::string GetBoardType() override;
     virtual void StartNetwork() override;
     virtual Http* CreateHttp() override;
+    virtual Http* CreateKeepAliveHttp() override;
     virtual WebSocket* CreateWebSocket() override;
     virtual Mqtt* CreateMqtt() override;
     virtual Udp* CreateUdp() override;
     virtual const char* GetNetworkStateIcon() override;
+    virtual int GetSignalQuality() override;
+    virtual std::string GetNetworkMetricsJson() override;
+    virtual void OnServerConnection(bool connected) override;
     virtual void SetPowerSaveMode(bool enabled) override;
     virtual std::string GetBoardJson() override;
     virtual std::string GetDeviceStatusJson() override;
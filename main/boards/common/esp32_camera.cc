@@ -1,17 +1,20 @@
 #include "esp32_camera.h"
-#include "mcp_server.h"
+#include "explain_request.h"
 #include "display.h"
 #include "board.h"
-#include "system_info.h"
+#include "memory_accounting.h"
+#include "scene_change_detector.h"
 
 #include <esp_log.h>
 #include <esp_heap_caps.h>
+#include <esp_timer.h>
 #include <img_converters.h>
 #include <cstring>
+#include <algorithm>
 
 #define TAG "Esp32Camera"
 
-Esp32Camera::Esp32Camera(const camera_config_t& config) {
+Esp32Camera::Esp32Camera(const camera_config_t& config) : max_frame_size_(config.frame_size) {
     // camera init
     esp_err_t err = esp_camera_init(&config); // 配置上面定义的参数
     if (err != ESP_OK) {
@@ -23,74 +26,48 @@ Esp32Camera::Esp32Camera(const camera_config_t& config) {
     if (s->id.PID == GC0308_PID) {
         s->set_hmirror(s, 0);  // 这里控制摄像头镜像 写1镜像 写0不镜像
     }
-
-    // 初始化预览图片的内存
-    memset(&preview_image_, 0, sizeof(preview_image_));
-    preview_image_.header.magic = LV_IMAGE_HEADER_MAGIC;
-    preview_image_.header.cf = LV_COLOR_FORMAT_RGB565;
-    preview_image_.header.flags = LV_IMAGE_FLAGS_ALLOCATED | LV_IMAGE_FLAGS_MODIFIABLE;
-
-    switch (config.frame_size) {
-        case FRAMESIZE_SVGA:
-            preview_image_.header.w = 800;
-            preview_image_.header.h = 600;
-            break;
-        case FRAMESIZE_VGA:
-            preview_image_.header.w = 640;
-            preview_image_.header.h = 480;
-            break;
-        case FRAMESIZE_QVGA:
-            preview_image_.header.w = 320;
-            preview_image_.header.h = 240;
-            break;
-        case FRAMESIZE_128X128:
-            preview_image_.header.w = 128;
-            preview_image_.header.h = 128;
-            break;
-        case FRAMESIZE_240X240:
-            preview_image_.header.w = 240;
-            preview_image_.header.h = 240;
-            break;
-        default:
-            ESP_LOGE(TAG, "Unsupported frame size: %d, image preview will not be shown", config.frame_size);
-            preview_image_.data_size = 0;
-            preview_image_.data = nullptr;
-            return;
-    }
-
-    preview_image_.header.stride = preview_image_.header.w * 2;
-    preview_image_.data_size = preview_image_.header.w * preview_image_.header.h * 2;
-    preview_image_.data = (uint8_t*)heap_caps_malloc(preview_image_.data_size, MALLOC_CAP_SPIRAM);
-    if (preview_image_.data == nullptr) {
-        ESP_LOGE(TAG, "Failed to allocate memory for preview image");
-        return;
-    }
 }
 
 Esp32Camera::~Esp32Camera() {
+    if (encoder_thread_.joinable()) {
+        encoder_thread_.join();
+    }
+    if (chunk_pool_ != nullptr) {
+        vQueueDelete(jpeg_queue_);
+        vQueueDelete(free_chunks_);
+        heap_caps_free(chunk_pool_);
+    }
     if (fb_) {
         esp_camera_fb_return(fb_);
         fb_ = nullptr;
     }
-    if (preview_image_.data) {
-        heap_caps_free((void*)preview_image_.data);
-        preview_image_.data = nullptr;
-    }
     esp_camera_deinit();
 }
 
-void Esp32Camera::SetExplainUrl(const std::string& url, const std::string& token) {
-    explain_url_ = url;
-    explain_token_ = token;
-}
-
 bool Esp32Camera::Capture() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    MemoryTagScope tag(kMemoryTagCamera);
     if (encoder_thread_.joinable()) {
         encoder_thread_.join();
     }
 
     int frames_to_get = 2;
-    // Try to get a stable frame
+    bool size_changed = false;
+    auto frame_size = SelectFrameSize();
+    sensor_t* s = esp_camera_sensor_get();
+    if (s != nullptr && s->status.framesize != frame_size) {
+        if (s->set_framesize(s, frame_size) == 0) {
+            ESP_LOGI(TAG, "Frame size set to %dx%d", resolution[frame_size].width, resolution[frame_size].height);
+            // The first frame after the switch may still be exposed for the old size
+            frames_to_get++;
+            size_changed = true;
+        } else {
+            ESP_LOGE(TAG, "Failed to set frame size %d", frame_size);
+        }
+    }
+
+    // Try to get a stable frame. Frames stamped before this point may show the scene before the request
+    int64_t request_us = esp_timer_get_time();
     for (int i = 0; i < frames_to_get; i++) {
         if (fb_ != nullptr) {
             esp_camera_fb_return(fb_);
@@ -100,32 +77,131 @@ bool Esp32Camera::Capture() {
             ESP_LOGE(TAG, "Camera capture failed");
             return false;
         }
+        // 传感器一直在出图，曝光已经稳定，请求之后拍的第一帧就可以直接用
+        int64_t captured_us = (int64_t)fb_->timestamp.tv_sec * 1000000 + fb_->timestamp.tv_usec;
+        if (warmed_up_ && !size_changed && captured_us >= request_us) {
+            break;
+        }
     }
+    warmed_up_ = true;
 
-    // 如果预览图片 buffer 为空，则跳过预览
-    // 但仍返回 true，因为此时图像可以上传至服务器
-    if (preview_image_.data_size == 0) {
-        ESP_LOGW(TAG, "Skip preview because of unsupported frame size");
-        return true;
-    }
-    if (preview_image_.data == nullptr) {
-        ESP_LOGE(TAG, "Preview image data is not initialized");
-        return true;
-    }
-    // 显示预览图片
+    // 显示预览图片，缩放到 LcdDisplay 预览区域（半个屏幕）的大小
+    // 即使预览失败也返回 true，因为此时图像可以上传至服务器
     auto display = Board::GetInstance().GetDisplay();
-    if (display != nullptr) {
-        auto src = (uint16_t*)fb_->buf;
-        auto dst = (uint16_t*)preview_image_.data;
-        size_t pixel_count = fb_->len / 2;
-        for (size_t i = 0; i < pixel_count; i++) {
-            // 交换每个16位字内的字节
-            dst[i] = __builtin_bswap16(src[i]);
+    if (display != nullptr && display->width() > 0 && display->height() > 0) {
+        auto image = preview_.Render(fb_, display->width() / 2, display->height() / 2);
+        if (image != nullptr) {
+            display->SetPreviewImage(image);
         }
-        display->SetPreviewImage(&preview_image_);
     }
     return true;
 }
+
+bool Esp32Camera::CaptureLuma(uint8_t* luma, int width, int height) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    MemoryTagScope tag(kMemoryTagCamera);
+    if (encoder_thread_.joinable()) {
+        encoder_thread_.join();
+    }
+    // 只有一个帧缓冲时，拿着上一张照片就拍不到新的一帧
+    if (fb_ != nullptr) {
+        esp_camera_fb_return(fb_);
+        fb_ = nullptr;
+    }
+    camera_fb_t* fb = esp_camera_fb_get();
+    if (fb == nullptr) {
+        ESP_LOGE(TAG, "Camera capture failed");
+        return false;
+    }
+
+    bool ok = true;
+    if (fb->format == PIXFORMAT_RGB565) {
+        SceneChangeDetector::DownsampleRgb565(fb->buf, fb->width, fb->height, true, luma, width, height);
+    } else if (fb->format == PIXFORMAT_JPEG) {
+        // Decoding at 1/8 scale skips most of the IDCT work
+        int scaled_width = fb->width / 8;
+        int scaled_height = fb->height / 8;
+        luma_scratch_.resize((scaled_width + 1) * (scaled_height + 1) * 2);
+        ok = jpg2rgb565(fb->buf, fb->len, luma_scratch_.data(), JPG_SCALE_8X);
+        if (ok) {
+            SceneChangeDetector::DownsampleRgb565(luma_scratch_.data(), scaled_width, scaled_height, true, luma, width, height);
+        }
+    } else {
+        ESP_LOGW(TAG, "Unsupported pixel format: %d", fb->format);
+        ok = false;
+    }
+    esp_camera_fb_return(fb);
+    return ok;
+}
+
+bool Esp32Camera::CaptureJpeg(std::vector<uint8_t>& jpeg, int quality) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    MemoryTagScope tag(kMemoryTagCamera);
+    if (encoder_thread_.joinable()) {
+        encoder_thread_.join();
+    }
+    if (fb_ != nullptr) {
+        esp_camera_fb_return(fb_);
+        fb_ = nullptr;
+    }
+    camera_fb_t* fb = esp_camera_fb_get();
+    if (fb == nullptr) {
+        ESP_LOGE(TAG, "Camera capture failed");
+        return false;
+    }
+
+    bool ok = true;
+    if (fb->format == PIXFORMAT_JPEG) {
+        jpeg.assign(fb->buf, fb->buf + fb->len);
+    } else {
+        uint8_t* out = nullptr;
+        size_t out_len = 0;
+        ok = frame2jpg(fb, quality, &out, &out_len);
+        if (ok) {
+            jpeg.assign(out, out + out_len);
+            free(out);
+        } else {
+            ESP_LOGE(TAG, "Failed to encode the frame to JPEG");
+        }
+    }
+    esp_camera_fb_return(fb);
+    return ok;
+}
+
+/*
+ * Picks the largest frame size up to the board's whose JPEG should upload
+ * within CAMERA_UPLOAD_BUDGET_MS at the measured upload speed, and lowers
+ * the quality when even the smallest one would not. The size estimate is
+ * rough, about 1.5 bits per pixel at CAMERA_JPEG_QUALITY and 0.8 at
+ * CAMERA_JPEG_LOW_QUALITY. Until an upload has been measured the board's
+ * frame size and the normal quality are used.
+ */
+framesize_t Esp32Camera::SelectFrameSize() {
+    jpeg_quality_ = CAMERA_JPEG_QUALITY;
+    if (upload_bytes_per_second_ == 0) {
+        return max_frame_size_;
+    }
+
+    size_t budget = (size_t)upload_bytes_per_second_ * CAMERA_UPLOAD_BUDGET_MS / 1000;
+    size_t max_pixels = resolution[max_frame_size_].width * resolution[max_frame_size_].height;
+    for (int quality : {CAMERA_JPEG_QUALITY, CAMERA_JPEG_LOW_QUALITY}) {
+        size_t bits_per_64_pixels = quality >= CAMERA_JPEG_QUALITY ? 96 : 51;
+        for (int i = max_frame_size_; i >= CAMERA_MIN_FRAME_SIZE; i--) {
+            size_t pixels = resolution[i].width * resolution[i].height;
+            // The enum is not strictly ordered by area
+            if (pixels > max_pixels) {
+                continue;
+            }
+            if (pixels * bits_per_64_pixels / 64 / 8 <= budget) {
+                jpeg_quality_ = quality;
+                return (framesize_t)i;
+            }
+        }
+    }
+    jpeg_quality_ = CAMERA_JPEG_LOW_QUALITY;
+    return max_frame_size_ < CAMERA_MIN_FRAME_SIZE ? max_frame_size_ : CAMERA_MIN_FRAME_SIZE;
+}
+
 bool Esp32Camera::SetHMirror(bool enabled) {
     sensor_t *s = esp_camera_sensor_get();
     if (s == nullptr) {
@@ -160,6 +236,86 @@ bool Esp32Camera::SetVFlip(bool enabled) {
     return true;
 }
 
+bool Esp32Camera::InitializeChunkPool() {
+    if (chunk_pool_ != nullptr) {
+        return true;
+    }
+    MemoryTagScope tag(kMemoryTagCamera);
+    chunk_pool_ = (uint8_t*)heap_caps_aligned_alloc(16, CAMERA_JPEG_CHUNK_SIZE * CAMERA_JPEG_CHUNK_COUNT, MALLOC_CAP_SPIRAM);
+    if (chunk_pool_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the JPEG chunk pool");
+        return false;
+    }
+    free_chunks_ = xQueueCreate(CAMERA_JPEG_CHUNK_COUNT, sizeof(uint8_t*));
+    // One more slot for the end marker
+    jpeg_queue_ = xQueueCreate(CAMERA_JPEG_CHUNK_COUNT + 1, sizeof(JpegChunk));
+    for (int i = 0; i < CAMERA_JPEG_CHUNK_COUNT; i++) {
+        uint8_t* buffer = chunk_pool_ + i * CAMERA_JPEG_CHUNK_SIZE;
+        xQueueSend(free_chunks_, &buffer, 0);
+    }
+    return true;
+}
+
+// Chunks that point into the frame buffer are not from the pool and need no release
+void Esp32Camera::ReleaseChunk(const JpegChunk& chunk) {
+    if (chunk.data >= chunk_pool_ && chunk.data < chunk_pool_ + CAMERA_JPEG_CHUNK_SIZE * CAMERA_JPEG_CHUNK_COUNT) {
+        xQueueSend(free_chunks_, &chunk.data, portMAX_DELAY);
+    }
+}
+
+// Copies the encoder output into pool buffers and queues each one as it fills up.
+// Waits for the uploader to free a buffer when all of them are queued
+void Esp32Camera::WriteJpeg(const uint8_t* data, size_t len) {
+    while (len > 0) {
+        if (pending_chunk_.data == nullptr) {
+            xQueueReceive(free_chunks_, &pending_chunk_.data, portMAX_DELAY);
+            pending_chunk_.len = 0;
+        }
+        size_t size = std::min(len, CAMERA_JPEG_CHUNK_SIZE - pending_chunk_.len);
+        memcpy(pending_chunk_.data + pending_chunk_.len, data, size);
+        pending_chunk_.len += size;
+        data += size;
+        len -= size;
+        if (pending_chunk_.len == CAMERA_JPEG_CHUNK_SIZE) {
+            xQueueSend(jpeg_queue_, &pending_chunk_, portMAX_DELAY);
+            pending_chunk_.data = nullptr;
+        }
+    }
+}
+
+// Runs on encoder_thread_, always ends the image with a nullptr chunk
+void Esp32Camera::EncodeJpeg() {
+    if (fb_->format == PIXFORMAT_JPEG) {
+        // 传感器直接输出 JPEG，按块引用帧缓冲区，不编码也不拷贝
+        for (size_t offset = 0; offset < fb_->len; offset += CAMERA_JPEG_CHUNK_SIZE) {
+            JpegChunk chunk = {
+                .data = fb_->buf + offset,
+                .len = std::min((size_t)CAMERA_JPEG_CHUNK_SIZE, fb_->len - offset)
+            };
+            xQueueSend(jpeg_queue_, &chunk, portMAX_DELAY);
+        }
+    } else {
+        pending_chunk_ = {};
+        bool ok = frame2jpg_cb(fb_, jpeg_quality_, [](void* arg, size_t index, const void* data, size_t len) -> unsigned int {
+            static_cast<Esp32Camera*>(arg)->WriteJpeg((const uint8_t*)data, len);
+            return len;
+        }, this);
+        if (!ok) {
+            ESP_LOGE(TAG, "Failed to encode the frame to JPEG");
+        }
+        if (pending_chunk_.data != nullptr) {
+            if (pending_chunk_.len > 0) {
+                xQueueSend(jpeg_queue_, &pending_chunk_, portMAX_DELAY);
+            } else {
+                ReleaseChunk(pending_chunk_);
+            }
+            pending_chunk_.data = nullptr;
+        }
+    }
+    JpegChunk end = { .data = nullptr, .len = 0 };
+    xQueueSend(jpeg_queue_, &end, portMAX_DELAY);
+}
+
 /**
  * @brief 将摄像头捕获的图像发送到远程服务器进行AI分析和解释
  * 
@@ -168,9 +324,10 @@ bool Esp32Camera::SetVFlip(bool enabled) {
  * 问题对图像进行AI分析并返回结果。
  * 
  * 实现特点：
- * - 使用独立线程编码JPEG，与主线程分离
+ * - 使用独立线程编码JPEG，与主线程分离，连接服务器的同时开始编码
+ * - 传感器直接输出JPEG时跳过编码，直接上传帧缓冲区
  * - 采用分块传输编码(chunked transfer encoding)优化内存使用
- * - 通过队列机制实现编码线程和发送线程的数据同步
+ * - 编码线程和发送线程通过队列交换固定的块缓冲区，不再为每块分配内存
  * - 支持设备ID、客户端ID和认证令牌的HTTP头部配置
  * 
  * @param question 要向AI提出的关于图像的问题，将作为表单字段发送
@@ -184,114 +341,62 @@ bool Esp32Camera::SetVFlip(bool enabled) {
  * @warning 如果摄像头缓冲区为空或网络连接失败，将返回错误信息
  */
 std::string Esp32Camera::Explain(const std::string& question) {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (explain_url_.empty()) {
-        return "{\"success\": false, \"message\": \"Image explain URL or token is not set\"}";
+        return ExplainRequest::Error("Image explain URL or token is not set");
     }
 
-    // 创建局部的 JPEG 队列, 40 entries is about to store 512 * 40 = 20480 bytes of JPEG data
-    QueueHandle_t jpeg_queue = xQueueCreate(40, sizeof(JpegChunk));
-    if (jpeg_queue == nullptr) {
-        ESP_LOGE(TAG, "Failed to create JPEG queue");
-        return "{\"success\": false, \"message\": \"Failed to create JPEG queue\"}";
+    if (fb_ == nullptr) {
+        return ExplainRequest::Error("No photo captured");
+    }
+    if (!InitializeChunkPool()) {
+        return ExplainRequest::Error("Failed to allocate JPEG buffers");
     }
 
     // We spawn a thread to encode the image to JPEG
-    encoder_thread_ = std::thread([this, jpeg_queue]() {
-        frame2jpg_cb(fb_, 80, [](void* arg, size_t index, const void* data, size_t len) -> unsigned int {
-            auto jpeg_queue = (QueueHandle_t)arg;
-            JpegChunk chunk = {
-                .data = (uint8_t*)heap_caps_aligned_alloc(16, len, MALLOC_CAP_SPIRAM),
-                .len = len
-            };
-            memcpy(chunk.data, data, len);
-            xQueueSend(jpeg_queue, &chunk, portMAX_DELAY);
-            return len;
-        }, jpeg_queue);
+    encoder_thread_ = std::thread([this]() {
+        EncodeJpeg();
     });
 
-    auto http = Board::GetInstance().CreateHttp();
-    // 构造multipart/form-data请求体
-    std::string boundary = "----ESP32_CAMERA_BOUNDARY";
-
-    // 配置HTTP客户端，使用分块传输编码
-    http->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
-    http->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
-    if (!explain_token_.empty()) {
-        http->SetHeader("Authorization", "Bearer " + explain_token_);
-    }
-    http->SetHeader("Content-Type", "multipart/form-data; boundary=" + boundary);
-    http->SetHeader("Transfer-Encoding", "chunked");
-    if (!http->Open("POST", explain_url_)) {
-        ESP_LOGE(TAG, "Failed to connect to explain URL");
-        // Clear the queue
-        encoder_thread_.join();
+    ExplainRequest request(explain_url_, explain_token_);
+    if (!request.Open(question)) {
+        // Drain the queue so the encoder can finish
         JpegChunk chunk;
-        while (xQueueReceive(jpeg_queue, &chunk, portMAX_DELAY) == pdPASS) {
-            if (chunk.data != nullptr) {
-                heap_caps_free(chunk.data);
-            } else {
-                break;
-            }
+        while (xQueueReceive(jpeg_queue_, &chunk, portMAX_DELAY) == pdPASS && chunk.data != nullptr) {
+            ReleaseChunk(chunk);
         }
-        vQueueDelete(jpeg_queue);
-        return "{\"success\": false, \"message\": \"Failed to connect to explain URL\"}";
-    }
-    
-    {
-        // 第一块：question字段
-        std::string question_field;
-        question_field += "--" + boundary + "\r\n";
-        question_field += "Content-Disposition: form-data; name=\"question\"\r\n";
-        question_field += "\r\n";
-        question_field += question + "\r\n";
-        http->Write(question_field.c_str(), question_field.size());
-    }
-    {
-        // 第二块：文件字段头部
-        std::string file_header;
-        file_header += "--" + boundary + "\r\n";
-        file_header += "Content-Disposition: form-data; name=\"file\"; filename=\"camera.jpg\"\r\n";
-        file_header += "Content-Type: image/jpeg\r\n";
-        file_header += "\r\n";
-        http->Write(file_header.c_str(), file_header.size());
+        encoder_thread_.join();
+        return ExplainRequest::Error("Failed to connect to explain URL");
     }
 
-    // 第三块：JPEG数据
+    // 第三块：JPEG数据，只统计写入的时间，不算等待编码的时间
     size_t total_sent = 0;
+    int64_t write_us = 0;
     while (true) {
         JpegChunk chunk;
-        if (xQueueReceive(jpeg_queue, &chunk, portMAX_DELAY) != pdPASS) {
+        if (xQueueReceive(jpeg_queue_, &chunk, portMAX_DELAY) != pdPASS) {
             ESP_LOGE(TAG, "Failed to receive JPEG chunk");
             break;
         }
         if (chunk.data == nullptr) {
             break; // The last chunk
         }
-        http->Write((const char*)chunk.data, chunk.len);
+        auto start_us = esp_timer_get_time();
+        request.Write(chunk.data, chunk.len);
+        write_us += esp_timer_get_time() - start_us;
         total_sent += chunk.len;
-        heap_caps_free(chunk.data);
+        ReleaseChunk(chunk);
     }
     // Wait for the encoder thread to finish
     encoder_thread_.join();
-    // 清理队列
-    vQueueDelete(jpeg_queue);
-
-    {
-        // 第四块：multipart尾部
-        std::string multipart_footer;
-        multipart_footer += "\r\n--" + boundary + "--\r\n";
-        http->Write(multipart_footer.c_str(), multipart_footer.size());
-    }
-    // 结束块
-    http->Write("", 0);
-
-    if (http->GetStatusCode() != 200) {
-        ESP_LOGE(TAG, "Failed to upload photo, status code: %d", http->GetStatusCode());
-        return "{\"success\": false, \"message\": \"Failed to upload photo\"}";
+    if (write_us > 0 && total_sent > 0) {
+        uint32_t bytes_per_second = total_sent * 1000000LL / write_us;
+        upload_bytes_per_second_ = upload_bytes_per_second_ == 0 ? bytes_per_second
+            : (upload_bytes_per_second_ + bytes_per_second) / 2;
+        ESP_LOGI(TAG, "Uploaded %u bytes at %lu B/s, average %lu B/s", total_sent, bytes_per_second, upload_bytes_per_second_);
     }
 
-    std::string result = http->ReadAll();
-    http->Close();
+    std::string result = request.Finish();
 
     // Get remain task stack size
     size_t remain_stack_size = uxTaskGetStackHighWaterMark(nullptr);
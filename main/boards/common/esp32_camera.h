@@ -5,31 +5,67 @@
 #include <lvgl.h>
 #include <thread>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 
 #include "camera.h"
+#include "camera_preview.h"
+
+// JPEG 按块上传，块缓冲区在第一次 Explain 时分配，之后一直复用
+#define CAMERA_JPEG_CHUNK_SIZE 4096
+#define CAMERA_JPEG_CHUNK_COUNT 6
+#define CAMERA_JPEG_QUALITY 80
+#define CAMERA_JPEG_LOW_QUALITY 50
+// Explain 上传图片的时间预算，按之前测得的上传速度选择分辨率和质量
+#define CAMERA_UPLOAD_BUDGET_MS 1500
+// 不会降到比这更小的分辨率
+#define CAMERA_MIN_FRAME_SIZE FRAMESIZE_QQVGA
 
 struct JpegChunk {
-    uint8_t* data;
+    uint8_t* data;  // nullptr marks the end of the image
     size_t len;
 };
 
 class Esp32Camera : public Camera {
 private:
     camera_fb_t* fb_ = nullptr;
-    lv_img_dsc_t preview_image_;
-    std::string explain_url_;
-    std::string explain_token_;
+    CameraPreview preview_;
     std::thread encoder_thread_;
+    // Capture, Explain, CaptureLuma and CaptureJpeg may run on the MCP tool workers and the camera tasks at once
+    std::mutex mutex_;
+    // Output of the 1/8 scale JPEG decode for CaptureLuma
+    std::vector<uint8_t> luma_scratch_;
+    // Set after the first capture, the sensor keeps streaming and adjusting its exposure from then on
+    bool warmed_up_ = false;
+    // The board's frame size is the largest Capture uses
+    framesize_t max_frame_size_;
+    int jpeg_quality_ = CAMERA_JPEG_QUALITY;
+    // Averaged over the uploads so far, 0 until the first one
+    uint32_t upload_bytes_per_second_ = 0;
+
+    // Pool buffers cycle between the encoder thread and the uploader through these queues
+    uint8_t* chunk_pool_ = nullptr;
+    QueueHandle_t free_chunks_ = nullptr;
+    QueueHandle_t jpeg_queue_ = nullptr;
+    // The pool buffer the encoder is filling
+    JpegChunk pending_chunk_ = {};
+
+    framesize_t SelectFrameSize();
+    bool InitializeChunkPool();
+    void EncodeJpeg();
+    void WriteJpeg(const uint8_t* data, size_t len);
+    void ReleaseChunk(const JpegChunk& chunk);
 
 public:
     Esp32Camera(const camera_config_t& config);
     ~Esp32Camera();
 
-    virtual void SetExplainUrl(const std::string& url, const std::string& token);
     virtual bool Capture();
+    virtual bool CaptureLuma(uint8_t* luma, int width, int height) override;
+    virtual bool CaptureJpeg(std::vector<uint8_t>& jpeg, int quality) override;
     // 翻转控制函数
     virtual bool SetHMirror(bool enabled) override;
     virtual bool SetVFlip(bool enabled) override;
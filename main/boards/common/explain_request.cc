@@ -0,0 +1,90 @@
+#include "explain_request.h"
+#include "mcp_server.h"
+#include "board.h"
+#include "system_info.h"
+
+#include <esp_log.h>
+
+#define TAG "ExplainRequest"
+
+ExplainRequest::ExplainRequest(const std::string& url, const std::string& token) : url_(url), token_(token) {
+}
+
+ExplainRequest::~ExplainRequest() {
+    if (http_) {
+        http_->Close();
+    }
+}
+
+std::string ExplainRequest::Error(const char* message) {
+    return std::string("{\"success\": false, \"message\": \"") + message + "\"}";
+}
+
+bool ExplainRequest::Open(const std::string& question) {
+    http_.reset(Board::GetInstance().CreateHttp());
+    // 配置HTTP客户端，使用分块传输编码
+    http_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+    http_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
+    if (!token_.empty()) {
+        http_->SetHeader("Authorization", "Bearer " + token_);
+    }
+    http_->SetHeader("Content-Type", MULTIPART_CONTENT_TYPE);
+    http_->SetHeader("Transfer-Encoding", "chunked");
+    if (!http_->Open("POST", url_)) {
+        ESP_LOGE(TAG, "Failed to connect to explain URL");
+        http_.reset();
+        return false;
+    }
+    McpServer::GetInstance().ReportProgress(1, 3, "Uploading photo");
+
+    writer_ = std::make_unique<MultipartWriter>(http_.get());
+    writer_->AddField("question", question);
+    writer_->BeginFile("file", "camera.jpg", "image/jpeg");
+    return true;
+}
+
+void ExplainRequest::Write(const void* data, size_t len) {
+    writer_->Write(data, len);
+}
+
+std::string ExplainRequest::Finish() {
+    writer_->Finish();
+    McpServer::GetInstance().ReportProgress(2, 3, "Waiting for the explanation");
+
+    int status_code = http_->GetStatusCode();
+    if (status_code != 200) {
+        ESP_LOGE(TAG, "Failed to upload photo, status code: %d", status_code);
+        return Error("Failed to upload photo");
+    }
+    std::string response;
+    if (!ReadResponse(response)) {
+        return Error("Invalid response from explain server");
+    }
+    return response;
+}
+
+bool ExplainRequest::ReadResponse(std::string& response) {
+    size_t length = http_->GetBodyLength();
+    if (length > EXPLAIN_MAX_RESPONSE_SIZE) {
+        ESP_LOGE(TAG, "Response too large: %u bytes", length);
+        return false;
+    }
+    response.reserve(length > 0 ? length : 512);
+    char buffer[256];
+    while (true) {
+        int ret = http_->Read(buffer, sizeof(buffer));
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to read response: %d", ret);
+            return false;
+        }
+        if (ret == 0) {
+            break;
+        }
+        if (response.size() + ret > EXPLAIN_MAX_RESPONSE_SIZE) {
+            ESP_LOGE(TAG, "Response too large");
+            return false;
+        }
+        response.append(buffer, ret);
+    }
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef EXPLAIN_REQUEST_H
+#define EXPLAIN_REQUEST_H
+
+#include <http.h>
+
+#include "multipart_writer.h"
+
+#include <memory>
+#include <string>
+
+// 服务器的回答超过这个长度就当作出错，不再继续读
+#define EXPLAIN_MAX_RESPONSE_SIZE 8192
+
+/*
+ * The upload every camera sends to the image explain server: a
+ * multipart/form-data POST with a "question" field and a "file" field
+ * holding the JPEG. The body uses chunked transfer encoding, so the image
+ * can be written while it is still being encoded.
+ *
+ * Open() sends the headers and the question, Write() the image data as it
+ * comes, and Finish() ends the body and returns the server's JSON reply.
+ * The body goes out through a MultipartWriter, so the only heap it takes is
+ * the reply, which is read into a string sized from Content-Length.
+ * Failures come back as {"success": false, "message": "..."}, the same form
+ * the tool passes on to the client.
+ */
+class ExplainRequest {
+public:
+    ExplainRequest(const std::string& url, const std::string& token);
+    ~ExplainRequest();
+
+    bool Open(const std::string& question);
+    void Write(const void* data, size_t len);
+    std::string Finish();
+
+    static std::string Error(const char* message);
+
+private:
+    std::string url_;
+    std::string token_;
+    std::unique_ptr<Http> http_;
+    std::unique_ptr<MultipartWriter> writer_;
+
+    bool ReadResponse(std::string& response);
+};
+
+#endif // EXPLAIN_REQUEST_H
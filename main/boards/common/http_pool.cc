@@ -0,0 +1,316 @@
+#include "http_pool.h"
+
+#include <esp_log.h>
+#include <esp_crt_bundle.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#define TAG "HttpPool"
+
+static std::string ToLower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+    return text;
+}
+
+HttpPool::HttpPool(int idle_timeout_ms) : idle_timeout_ms_(idle_timeout_ms) {
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            ((HttpPool*)arg)->CloseExpired();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "http_pool",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&timer_args, &timer_);
+}
+
+HttpPool::~HttpPool() {
+    if (timer_ != nullptr) {
+        esp_timer_stop(timer_);
+        esp_timer_delete(timer_);
+    }
+    Clear();
+}
+
+std::string HttpPool::GetOrigin(const std::string& url) {
+    auto scheme_end = url.find("://");
+    if (scheme_end == std::string::npos) {
+        return url;
+    }
+    auto scheme = ToLower(url.substr(0, scheme_end));
+    auto host_start = scheme_end + 3;
+    auto host_end = url.find_first_of("/?#", host_start);
+    auto host = ToLower(url.substr(host_start, host_end == std::string::npos ? std::string::npos : host_end - host_start));
+    auto at = host.rfind('@');
+    if (at != std::string::npos) {
+        host = host.substr(at + 1);
+    }
+    if (host.find(':') == std::string::npos) {
+        host += scheme == "https" ? ":443" : ":80";
+    }
+    return scheme + "://" + host;
+}
+
+esp_http_client_handle_t HttpPool::Acquire(const std::string& url, http_event_handle_cb event_handler,
+    std::vector<std::string>& headers, bool& reused) {
+    auto origin = GetOrigin(url);
+    reused = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // The most recently used one first, its connection is the least likely to have been dropped
+        for (auto it = idle_.rbegin(); it != idle_.rend(); ++it) {
+            if (it->origin == origin) {
+                auto client = it->client;
+                headers = std::move(it->headers);
+                idle_.erase(std::next(it).base());
+                if (esp_http_client_set_url(client, url.c_str()) == ESP_OK) {
+                    reused = true;
+                    return client;
+                }
+                esp_http_client_cleanup(client);
+                break;
+            }
+        }
+    }
+
+    headers.clear();
+    esp_http_client_config_t config = {};
+    config.url = url.c_str();
+    config.timeout_ms = HTTP_POOL_DEFAULT_TIMEOUT_MS;
+    config.crt_bundle_attach = esp_crt_bundle_attach;
+    config.event_handler = event_handler;
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    config.save_client_session = true;
+#endif
+    auto client = esp_http_client_init(&config);
+    if (client == nullptr) {
+        ESP_LOGE(TAG, "Failed to create a client for %s", origin.c_str());
+    }
+    return client;
+}
+
+void HttpPool::Release(const std::string& url, esp_http_client_handle_t client, std::vector<std::string>&& headers,
+    bool reusable) {
+    if (!reusable) {
+        esp_http_client_cleanup(client);
+        return;
+    }
+    esp_http_client_handle_t evicted = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (idle_.size() >= HTTP_POOL_MAX_IDLE) {
+            evicted = idle_.front().client;
+            idle_.erase(idle_.begin());
+        }
+        idle_.push_back({GetOrigin(url), client, std::move(headers), esp_timer_get_time()});
+        if (timer_ != nullptr && !esp_timer_is_active(timer_)) {
+            esp_timer_start_once(timer_, (uint64_t)idle_timeout_ms_ * 1000);
+        }
+    }
+    if (evicted != nullptr) {
+        esp_http_client_cleanup(evicted);
+    }
+}
+
+void HttpPool::Clear() {
+    std::vector<IdleClient> idle;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle.swap(idle_);
+    }
+    for (auto& entry : idle) {
+        esp_http_client_cleanup(entry.client);
+    }
+}
+
+void HttpPool::CloseExpired() {
+    std::vector<esp_http_client_handle_t> expired;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int64_t now = esp_timer_get_time();
+        int64_t next_us = -1;
+        for (auto it = idle_.begin(); it != idle_.end();) {
+            int64_t idle_us = now - it->released_us;
+            if (idle_us >= (int64_t)idle_timeout_ms_ * 1000) {
+                expired.push_back(it->client);
+                it = idle_.erase(it);
+            } else {
+                int64_t remaining_us = (int64_t)idle_timeout_ms_ * 1000 - idle_us;
+                next_us = next_us < 0 ? remaining_us : std::min(next_us, remaining_us);
+                ++it;
+            }
+        }
+        if (next_us >= 0) {
+            esp_timer_start_once(timer_, next_us);
+        }
+    }
+    for (auto client : expired) {
+        esp_http_client_cleanup(client);
+    }
+    if (!expired.empty()) {
+        ESP_LOGD(TAG, "Closed %u idle connections", expired.size());
+    }
+}
+
+PooledHttp::PooledHttp(HttpPool& pool) : pool_(pool) {
+}
+
+PooledHttp::~PooledHttp() {
+    Close();
+}
+
+void PooledHttp::SetTimeout(int timeout_ms) {
+    timeout_ms_ = timeout_ms;
+}
+
+void PooledHttp::SetHeader(const std::string& key, const std::string& value) {
+    headers_[key] = value;
+}
+
+void PooledHttp::SetContent(std::string&& content) {
+    content_ = std::move(content);
+    has_content_ = true;
+}
+
+esp_err_t PooledHttp::OnEvent(esp_http_client_event_t* event) {
+    auto self = (PooledHttp*)event->user_data;
+    if (self == nullptr) {
+        return ESP_OK;
+    }
+    switch (event->event_id) {
+        case HTTP_EVENT_ON_HEADER:
+            self->response_headers_[ToLower(event->header_key)] = event->header_value;
+            break;
+        case HTTP_EVENT_ON_DATA:
+            if (self->body_.size() + event->data_len > HTTP_POOL_MAX_RESPONSE_SIZE) {
+                self->overflow_ = true;
+            } else {
+                self->body_.append((const char*)event->data, event->data_len);
+            }
+            break;
+        case HTTP_EVENT_REDIRECT:
+            // The body and headers of the redirect response are not the answer
+            self->response_headers_.clear();
+            self->body_.clear();
+            break;
+        default:
+            break;
+    }
+    return ESP_OK;
+}
+
+bool PooledHttp::Open(const std::string& method, const std::string& url) {
+    static const std::pair<const char*, esp_http_client_method_t> kMethods[] = {
+        {"GET", HTTP_METHOD_GET}, {"POST", HTTP_METHOD_POST}, {"PUT", HTTP_METHOD_PUT},
+        {"PATCH", HTTP_METHOD_PATCH}, {"DELETE", HTTP_METHOD_DELETE}, {"HEAD", HTTP_METHOD_HEAD},
+    };
+    auto entry = std::find_if(std::begin(kMethods), std::end(kMethods), [&method](const auto& entry) {
+        return method == entry.first;
+    });
+    if (entry == std::end(kMethods)) {
+        ESP_LOGE(TAG, "Unsupported method %s", method.c_str());
+        return false;
+    }
+
+    Close();
+    url_ = url;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused;
+        esp_err_t err = Perform(entry->second, reused);
+        if (err == ESP_OK) {
+            return true;
+        }
+        if (!reused || overflow_ || attempt > 0) {
+            ESP_LOGE(TAG, "Request to %s failed: %s", url.c_str(), overflow_ ? "response too large" : esp_err_to_name(err));
+            return false;
+        }
+        ESP_LOGW(TAG, "Kept-alive connection to %s failed, reconnecting", HttpPool::GetOrigin(url).c_str());
+    }
+    return false;
+}
+
+esp_err_t PooledHttp::Perform(esp_http_client_method_t method, bool& reused) {
+    std::vector<std::string> stale_headers;
+    client_ = pool_.Acquire(url_, OnEvent, stale_headers, reused);
+    if (client_ == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (auto& key : stale_headers) {
+        if (headers_.find(key) == headers_.end()) {
+            esp_http_client_delete_header(client_, key.c_str());
+        }
+    }
+    for (auto& [key, value] : headers_) {
+        esp_http_client_set_header(client_, key.c_str(), value.c_str());
+    }
+    esp_http_client_set_user_data(client_, this);
+    esp_http_client_set_method(client_, method);
+    esp_http_client_set_timeout_ms(client_, timeout_ms_);
+    esp_http_client_set_post_field(client_, has_content_ ? content_.data() : nullptr, has_content_ ? content_.size() : 0);
+
+    status_code_ = -1;
+    response_headers_.clear();
+    body_.clear();
+    read_offset_ = 0;
+    overflow_ = false;
+    esp_err_t err = esp_http_client_perform(client_);
+    if (err == ESP_OK && overflow_) {
+        err = ESP_ERR_NO_MEM;
+    }
+    if (err != ESP_OK) {
+        esp_http_client_set_user_data(client_, nullptr);
+        pool_.Release(url_, client_, {}, false);
+        client_ = nullptr;
+        return err;
+    }
+    status_code_ = esp_http_client_get_status_code(client_);
+    return ESP_OK;
+}
+
+void PooledHttp::Close() {
+    if (client_ == nullptr) {
+        return;
+    }
+    esp_http_client_set_user_data(client_, nullptr);
+    std::vector<std::string> headers;
+    for (auto& [key, value] : headers_) {
+        headers.push_back(key);
+    }
+    // perform() read the whole response, the connection is ready for the next request or already closed
+    pool_.Release(url_, client_, std::move(headers), true);
+    client_ = nullptr;
+}
+
+int PooledHttp::Read(char* buffer, size_t buffer_size) {
+    size_t length = std::min(buffer_size, body_.size() - read_offset_);
+    memcpy(buffer, body_.data() + read_offset_, length);
+    read_offset_ += length;
+    return length;
+}
+
+int PooledHttp::Write(const char* buffer, size_t buffer_size) {
+    ESP_LOGE(TAG, "Write is not supported, set the body with SetContent");
+    return -1;
+}
+
+int PooledHttp::GetStatusCode() {
+    return status_code_;
+}
+
+std::string PooledHttp::GetResponseHeader(const std::string& key) const {
+    auto it = response_headers_.find(ToLower(key));
+    return it != response_headers_.end() ? it->second : "";
+}
+
+size_t PooledHttp::GetBodyLength() {
+    return body_.size();
+}
+
+std::string PooledHttp::ReadAll() {
+    auto body = body_.substr(read_offset_);
+    read_offset_ = body_.size();
+    return body;
+}
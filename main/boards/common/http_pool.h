@@ -0,0 +1,118 @@
+#ifndef HTTP_POOL_H
+#define HTTP_POOL_H
+
+#include <http.h>
+#include <esp_http_client.h>
+#include <esp_timer.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+// Idle clients kept at once, each may hold a TLS connection and its buffers
+#define HTTP_POOL_MAX_IDLE 2
+// A response larger than this is an error, the pooled requests are small JSON exchanges
+#define HTTP_POOL_MAX_RESPONSE_SIZE (16 * 1024)
+#define HTTP_POOL_DEFAULT_TIMEOUT_MS 30000
+
+/*
+ * Keep-alive esp_http_client handles, one list per scheme, host and port.
+ *
+ * A handle that finished its request goes back to the pool with its
+ * connection still open when the server allowed keep-alive, so the next
+ * request to the same host skips DNS, TCP and TLS. If the server closed
+ * the connection, the handle still keeps its TLS session ticket
+ * (CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS) and the reconnect is an
+ * abbreviated handshake. Handles idle longer than the timeout are closed
+ * from a timer, so an idle device does not hold a TLS connection.
+ *
+ * A request that fails on an idle handle is tried once more on a new one,
+ * the server may have closed the connection without the client noticing.
+ */
+class HttpPool {
+public:
+    explicit HttpPool(int idle_timeout_ms);
+    ~HttpPool();
+    HttpPool(const HttpPool&) = delete;
+    HttpPool& operator=(const HttpPool&) = delete;
+
+    // "scheme://host:port" of `url`, the key of the pool
+    static std::string GetOrigin(const std::string& url);
+
+    // An idle handle for the origin of `url`, or a new one, null if out of memory. `headers` gets
+    // the request headers the last user set on it, they stay on the handle until deleted.
+    // `reused` tells whether it is an idle one, whose connection the server may have dropped meanwhile
+    esp_http_client_handle_t Acquire(const std::string& url, http_event_handle_cb event_handler,
+        std::vector<std::string>& headers, bool& reused);
+    // `reusable` is false after an error, the handle is cleaned up instead
+    void Release(const std::string& url, esp_http_client_handle_t client, std::vector<std::string>&& headers,
+        bool reusable);
+    // Closes every idle handle, e.g. when the network changes
+    void Clear();
+
+private:
+    struct IdleClient {
+        std::string origin;
+        esp_http_client_handle_t client;
+        std::vector<std::string> headers;
+        int64_t released_us;
+    };
+
+    std::mutex mutex_;
+    std::vector<IdleClient> idle_;
+    int idle_timeout_ms_;
+    esp_timer_handle_t timer_ = nullptr;
+
+    void CloseExpired();
+};
+
+/*
+ * Http of the short request/response exchanges, the version check and
+ * the activation, on a handle borrowed from an HttpPool.
+ *
+ * The request runs as a whole in Open() through esp_http_client_perform,
+ * which is what lets esp_http_client keep the connection, and the response
+ * is buffered for Read() and ReadAll(). The body is set with SetContent(),
+ * Write() is not supported: streaming uploads and downloads use the Http
+ * of Board::CreateHttp().
+ */
+class PooledHttp : public Http {
+public:
+    explicit PooledHttp(HttpPool& pool);
+    ~PooledHttp();
+
+    void SetTimeout(int timeout_ms) override;
+    void SetHeader(const std::string& key, const std::string& value) override;
+    void SetContent(std::string&& content) override;
+    bool Open(const std::string& method, const std::string& url) override;
+    void Close() override;
+    int Read(char* buffer, size_t buffer_size) override;
+    int Write(const char* buffer, size_t buffer_size) override;
+    int GetStatusCode() override;
+    std::string GetResponseHeader(const std::string& key) const override;
+    size_t GetBodyLength() override;
+    std::string ReadAll() override;
+
+private:
+    HttpPool& pool_;
+    esp_http_client_handle_t client_ = nullptr;
+    std::string url_;
+    int timeout_ms_ = HTTP_POOL_DEFAULT_TIMEOUT_MS;
+    std::map<std::string, std::string> headers_;
+    std::string content_;
+    bool has_content_ = false;
+
+    int status_code_ = -1;
+    std::map<std::string, std::string> response_headers_;
+    std::string body_;
+    size_t read_offset_ = 0;
+    bool overflow_ = false;
+
+    // One attempt on a handle from the pool, released again on failure
+    esp_err_t Perform(esp_http_client_method_t method, bool& reused);
+    static esp_err_t OnEvent(esp_http_client_event_t* event);
+};
+
+#endif // HTTP_POOL_H
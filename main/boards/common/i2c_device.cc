@@ -1,11 +1,76 @@
 #include "i2c_device.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+
+#include <cstring>
+#include <mutex>
 
 #define TAG "I2cDevice"
 
+// 连续写入时放在栈上的缓冲区大小
+#define I2C_DEVICE_MAX_BURST_WRITE 32
+
+static std::mutex buses_mutex;
+static std::vector<I2cBus*> buses;
+
+I2cBus& I2cBus::GetInstance(i2c_master_bus_handle_t handle) {
+    std::lock_guard<std::mutex> lock(buses_mutex);
+    for (auto bus : buses) {
+        if (bus->handle_ == handle) {
+            return *bus;
+        }
+    }
+    auto bus = new I2cBus(handle);
+    buses.push_back(bus);
+    return *bus;
+}
+
+std::vector<I2cBus*> I2cBus::GetAll() {
+    std::lock_guard<std::mutex> lock(buses_mutex);
+    return buses;
+}
+
+I2cBus::I2cBus(i2c_master_bus_handle_t handle) : handle_(handle) {
+    mutex_ = xSemaphoreCreateRecursiveMutex();
+    assert(mutex_ != nullptr);
+}
+
+void I2cBus::Lock() {
+    int64_t start = esp_timer_get_time();
+    xSemaphoreTakeRecursive(mutex_, portMAX_DELAY);
+    int64_t wait_us = esp_timer_get_time() - start;
+
+    portENTER_CRITICAL(&stats_lock_);
+    stats_.wait_us += wait_us;
+    if (wait_us > stats_.max_wait_us) {
+        stats_.max_wait_us = wait_us;
+    }
+    portEXIT_CRITICAL(&stats_lock_);
+}
+
+void I2cBus::Unlock() {
+    xSemaphoreGiveRecursive(mutex_);
+}
+
+void I2cBus::Record(int64_t busy_us, esp_err_t err) {
+    portENTER_CRITICAL(&stats_lock_);
+    stats_.transactions++;
+    stats_.busy_us += busy_us;
+    if (err != ESP_OK) {
+        stats_.errors++;
+    }
+    portEXIT_CRITICAL(&stats_lock_);
+}
+
+I2cBusStats I2cBus::GetStats() {
+    portENTER_CRITICAL(&stats_lock_);
+    auto stats = stats_;
+    portEXIT_CRITICAL(&stats_lock_);
+    return stats;
+}
 
-I2cDevice::I2cDevice(i2c_master_bus_handle_t i2c_bus, uint8_t addr) {
+I2cDevice::I2cDevice(i2c_master_bus_handle_t i2c_bus, uint8_t addr) : bus_(I2cBus::GetInstance(i2c_bus)) {
     i2c_device_config_t i2c_device_cfg = {
         .dev_addr_length = I2C_ADDR_BIT_LEN_7,
         .device_address = addr,
@@ -21,15 +86,43 @@ I2cDevice::I2cDevice(i2c_master_bus_handle_t i2c_bus, uint8_t addr) {
 
 void I2cDevice::WriteReg(uint8_t reg, uint8_t value) {
     uint8_t buffer[2] = {reg, value};
-    ESP_ERROR_CHECK(i2c_master_transmit(i2c_device_, buffer, 2, 100));
+    Transaction transaction(*this);
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = i2c_master_transmit(i2c_device_, buffer, 2, 100);
+    bus_.Record(esp_timer_get_time() - start, err);
+    ESP_ERROR_CHECK(err);
+}
+
+// 寄存器地址自动递增的设备，一次传输写入连续的多个寄存器
+void I2cDevice::WriteRegs(uint8_t reg, const uint8_t* buffer, size_t length) {
+    assert(length < I2C_DEVICE_MAX_BURST_WRITE);
+    uint8_t data[I2C_DEVICE_MAX_BURST_WRITE];
+    data[0] = reg;
+    memcpy(data + 1, buffer, length);
+    Transaction transaction(*this);
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = i2c_master_transmit(i2c_device_, data, length + 1, 100);
+    bus_.Record(esp_timer_get_time() - start, err);
+    ESP_ERROR_CHECK(err);
+}
+
+// 读-改-写期间其他设备不能插入
+void I2cDevice::UpdateReg(uint8_t reg, uint8_t mask, uint8_t value) {
+    Transaction transaction(*this);
+    uint8_t current = ReadReg(reg);
+    WriteReg(reg, (current & ~mask) | (value & mask));
 }
 
 uint8_t I2cDevice::ReadReg(uint8_t reg) {
     uint8_t buffer[1];
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(i2c_device_, &reg, 1, buffer, 1, 100));
+    ReadRegs(reg, buffer, 1);
     return buffer[0];
 }
 
 void I2cDevice::ReadRegs(uint8_t reg, uint8_t* buffer, size_t length) {
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(i2c_device_, &reg, 1, buffer, length, 100));
-}
\ No newline at end of file
+    Transaction transaction(*this);
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = i2c_master_transmit_receive(i2c_device_, &reg, 1, buffer, length, 100);
+    bus_.Record(esp_timer_get_time() - start, err);
+    ESP_ERROR_CHECK(err);
+}
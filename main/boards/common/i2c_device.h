@@ -2,15 +2,75 @@
 #define I2C_DEVICE_H
 
 #include <driver/i2c_master.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <vector>
+
+struct I2cBusStats {
+    uint32_t transactions = 0;
+    uint32_t errors = 0;
+    int64_t busy_us = 0;      // 总线上传输的时间
+    int64_t wait_us = 0;      // 等待其他设备释放总线的时间
+    int64_t max_wait_us = 0;
+};
+
+/*
+ * One per I2C master bus, shared by every I2cDevice on it. Each register
+ * access holds the bus lock, and I2cDevice::Transaction holds it across
+ * several accesses so a read-modify-write or a multi-register update is not
+ * interleaved with another device.
+ *
+ * The lock is a FreeRTOS mutex: waiters get the bus in task priority order
+ * and a low priority poller holding it is boosted, so touch and codec
+ * control tasks do not queue behind background polling.
+ */
+class I2cBus {
+public:
+    static I2cBus& GetInstance(i2c_master_bus_handle_t handle);
+    static std::vector<I2cBus*> GetAll();
+
+    I2cBus(const I2cBus&) = delete;
+    I2cBus& operator=(const I2cBus&) = delete;
+
+    void Lock();
+    void Unlock();
+    void Record(int64_t busy_us, esp_err_t err);
+    I2cBusStats GetStats();
+    i2c_master_bus_handle_t handle() const { return handle_; }
+
+private:
+    I2cBus(i2c_master_bus_handle_t handle);
+
+    i2c_master_bus_handle_t handle_;
+    SemaphoreHandle_t mutex_;
+    portMUX_TYPE stats_lock_ = portMUX_INITIALIZER_UNLOCKED;
+    I2cBusStats stats_;
+};
 
 class I2cDevice {
 public:
     I2cDevice(i2c_master_bus_handle_t i2c_bus, uint8_t addr);
 
+    // 在作用域内独占总线
+    class Transaction {
+    public:
+        Transaction(I2cDevice& device) : bus_(device.bus_) { bus_.Lock(); }
+        ~Transaction() { bus_.Unlock(); }
+        Transaction(const Transaction&) = delete;
+        Transaction& operator=(const Transaction&) = delete;
+
+    private:
+        I2cBus& bus_;
+    };
+
 protected:
     i2c_master_dev_handle_t i2c_device_;
+    I2cBus& bus_;
 
     void WriteReg(uint8_t reg, uint8_t value);
+    void WriteRegs(uint8_t reg, const uint8_t* buffer, size_t length);
+    void UpdateReg(uint8_t reg, uint8_t mask, uint8_t value);
     uint8_t ReadReg(uint8_t reg);
     void ReadRegs(uint8_t reg, uint8_t* buffer, size_t length);
 };
@@ -28,10 +28,25 @@ Knob::Knob(gpio_num_t pin_a, gpio_num_t pin_b) {
         return;
     }
 
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            static_cast<Knob*>(arg)->OnUpdateTimer();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "knob_update",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &update_timer_));
+
     ESP_LOGI(TAG, "Knob initialized with pins A:%d B:%d", pin_a, pin_b);
 }
 
 Knob::~Knob() {
+    if (update_timer_ != nullptr) {
+        esp_timer_stop(update_timer_);
+        esp_timer_delete(update_timer_);
+    }
     if (knob_handle_ != NULL) {
         iot_knob_delete(knob_handle_);
         knob_handle_ = NULL;
@@ -42,11 +57,61 @@ void Knob::OnRotate(std::function<void(bool)> callback) {
     on_rotate_ = callback;
 }
 
+void Knob::OnRotateSteps(std::function<void(int steps)> callback) {
+    on_rotate_steps_ = callback;
+}
+
+void Knob::OnRotateEnd(std::function<void()> callback) {
+    on_rotate_end_ = callback;
+}
+
 void Knob::knob_callback(void* arg, void* data) {
     Knob* knob = static_cast<Knob*>(data);
     knob_event_t event = iot_knob_get_event(arg);
-    
-    if (knob->on_rotate_) {
-        knob->on_rotate_(event == KNOB_RIGHT);
+    knob->OnDetent(event == KNOB_RIGHT);
+}
+
+void Knob::OnDetent(bool clockwise) {
+    if (on_rotate_) {
+        on_rotate_(clockwise);
+    }
+    if (!on_rotate_steps_ && !on_rotate_end_) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    int64_t interval_ms = (now - last_detent_us_) / 1000;
+    last_detent_us_ = now;
+    int steps = 1;
+    if (rotating_ && interval_ms < KNOB_VERY_FAST_DETENT_MS) {
+        steps = 4;
+    } else if (rotating_ && interval_ms < KNOB_FAST_DETENT_MS) {
+        steps = 2;
+    }
+    pending_steps_ += clockwise ? steps : -steps;
+
+    if (!rotating_) {
+        // The first detent applies at once, the ones after it wait for the next update
+        rotating_ = true;
+        OnUpdateTimer();
+        esp_timer_start_periodic(update_timer_, KNOB_UPDATE_INTERVAL_MS * 1000);
+    }
+}
+
+void Knob::OnUpdateTimer() {
+    if (pending_steps_ != 0) {
+        int steps = pending_steps_;
+        pending_steps_ = 0;
+        if (on_rotate_steps_) {
+            on_rotate_steps_(steps);
+        }
+        return;
+    }
+    if (esp_timer_get_time() - last_detent_us_ >= KNOB_IDLE_MS * 1000) {
+        esp_timer_stop(update_timer_);
+        rotating_ = false;
+        if (on_rotate_end_) {
+            on_rotate_end_();
+        }
     }
 }
\ No newline at end of file
@@ -4,22 +4,55 @@
 #include <driver/gpio.h>
 #include <functional>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <iot_knob.h>
 
+// Accumulated steps are handed out at most this often while the knob turns
+#define KNOB_UPDATE_INTERVAL_MS 50
+// No detent for this long ends the rotation
+#define KNOB_IDLE_MS 400
+// Detents closer together than these count double and four times
+#define KNOB_FAST_DETENT_MS 60
+#define KNOB_VERY_FAST_DETENT_MS 25
+
+/*
+ * Rotary encoder. OnRotate() gets every detent as it comes.
+ *
+ * OnRotateSteps() gets the detents added up instead, at most every
+ * KNOB_UPDATE_INTERVAL_MS, so a target that is costly to update, like the
+ * codec volume with its notification on the display, changes at a bounded
+ * rate however fast the knob spins. Fast detents count more, a quick spin
+ * covers the whole range without dozens of turns. OnRotateEnd() runs once
+ * the knob has been still for KNOB_IDLE_MS, to commit the final value.
+ *
+ * Both callbacks run on the esp_timer task, as does the iot_knob one.
+ */
 class Knob {
 public:
     Knob(gpio_num_t pin_a, gpio_num_t pin_b);
     ~Knob();
 
     void OnRotate(std::function<void(bool)> callback);
+    // `steps` is positive clockwise, scaled by the acceleration
+    void OnRotateSteps(std::function<void(int steps)> callback);
+    void OnRotateEnd(std::function<void()> callback);
 
 private:
     static void knob_callback(void* arg, void* data);
+    void OnDetent(bool clockwise);
+    void OnUpdateTimer();
 
     knob_handle_t knob_handle_;
     gpio_num_t pin_a_;
     gpio_num_t pin_b_;
     std::function<void(bool)> on_rotate_;
+    std::function<void(int steps)> on_rotate_steps_;
+    std::function<void()> on_rotate_end_;
+
+    esp_timer_handle_t update_timer_ = nullptr;
+    int pending_steps_ = 0;
+    int64_t last_detent_us_ = 0;
+    bool rotating_ = false;
 };
 
-#endif // KNOB_H_
\ No newline at end of file
+#endif // KNOB_H_
@@ -13,10 +13,14 @@
 #include <ml307_mqtt.h>
 #include <ml307_udp.h>
 #include <opus_encoder.h>
+#include <cJSON.h>
+
+#include <algorithm>
 
 static const char *TAG = "Ml307Board";
 
-Ml307Board::Ml307Board(gpio_num_t tx_pin, gpio_num_t rx_pin, size_t rx_buffer_size) : modem_(tx_pin, rx_pin, rx_buffer_size) {
+Ml307Board::Ml307Board(gpio_num_t tx_pin, gpio_num_t rx_pin, size_t rx_buffer_size)
+    : modem_(tx_pin, rx_pin, rx_buffer_size), rx_buffer_size_(rx_buffer_size) {
 }
 
 std::string Ml307Board::GetBoardType() {
@@ -27,7 +31,7 @@ void Ml307Board::StartNetwork() {
     auto display = Board::GetInstance().GetDisplay();
     display->SetStatus(Lang::Strings::DETECTING_MODULE);
     modem_.SetDebug(false);
-    modem_.SetBaudRate(921600);
+    modem_.SetBaudRate(ML307_BAUD_RATE);
 
     auto& application = Application::GetInstance();
     // If low power, the material ready event will be triggered by the modem because of a reset
@@ -59,6 +63,13 @@ void Ml307Board::WaitForNetworkReady() {
         vTaskDelay(pdMS_TO_TICKS(10000));
     }
 
+    // The carrier may differ after a new registration, the signal has to be read again anyway
+    {
+        std::lock_guard<std::mutex> lock(status_mutex_);
+        carrier_name_.clear();
+        csq_time_us_ = 0;
+    }
+
     // Print the ML307 modem information
     std::string module_name = modem_.GetModuleName();
     std::string imei = modem_.GetImei();
@@ -74,6 +85,18 @@ void Ml307Board::WaitForNetworkReady() {
     modem_.SetSleepMode(true, 30);
 }
 
+void Ml307Board::StartStandby() {
+    modem_.SetDebug(false);
+    modem_.SetBaudRate(ML307_BAUD_RATE);
+    while (modem_.WaitForNetworkReady() < 0) {
+        ESP_LOGW(TAG, "ML307 standby registration failed, retrying");
+        vTaskDelay(pdMS_TO_TICKS(10000));
+    }
+    ESP_LOGI(TAG, "ML307 standby network ready");
+    modem_.ResetConnections();
+    modem_.SetSleepMode(true, 30);
+}
+
 Http* Ml307Board::CreateHttp() {
     return new Ml307Http(modem_);
 }
@@ -90,11 +113,43 @@ Udp* Ml307Board::CreateUdp() {
     return new Ml307Udp(modem_, 0);
 }
 
+void Ml307Board::RecordRoundTrip(int64_t start_us) {
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    at_queries_++;
+    at_total_us_ += elapsed_us;
+    at_max_us_ = std::max(at_max_us_, elapsed_us);
+}
+
+int Ml307Board::GetCsq() {
+    std::lock_guard<std::mutex> lock(status_mutex_);
+    int64_t now = esp_timer_get_time();
+    if (csq_time_us_ != 0 && now - csq_time_us_ < ML307_STATUS_CACHE_MS * 1000LL) {
+        at_cached_++;
+        return csq_;
+    }
+    csq_ = modem_.GetCsq();
+    RecordRoundTrip(now);
+    csq_time_us_ = esp_timer_get_time();
+    return csq_;
+}
+
+std::string Ml307Board::GetCarrierName() {
+    std::lock_guard<std::mutex> lock(status_mutex_);
+    if (!carrier_name_.empty()) {
+        at_cached_++;
+        return carrier_name_;
+    }
+    int64_t start_us = esp_timer_get_time();
+    carrier_name_ = modem_.GetCarrierName();
+    RecordRoundTrip(start_us);
+    return carrier_name_;
+}
+
 const char* Ml307Board::GetNetworkStateIcon() {
     if (!modem_.network_ready()) {
         return FONT_AWESOME_SIGNAL_OFF;
     }
-    int csq = modem_.GetCsq();
+    int csq = GetCsq();
     if (csq == -1) {
         return FONT_AWESOME_SIGNAL_OFF;
     } else if (csq >= 0 && csq <= 14) {
@@ -111,13 +166,24 @@ const char* Ml307Board::GetNetworkStateIcon() {
     return FONT_AWESOME_SIGNAL_OFF;
 }
 
+int Ml307Board::GetSignalQuality() {
+    if (!modem_.network_ready()) {
+        return -1;
+    }
+    int csq = GetCsq();
+    if (csq < 0 || csq > 31) {
+        return -1;
+    }
+    return csq * 100 / 31;
+}
+
 std::string Ml307Board::GetBoardJson() {
     // Set the board type for OTA
     std::string board_json = std::string("{\"type\":\"" BOARD_TYPE "\",");
     board_json += "\"name\":\"" BOARD_NAME "\",";
     board_json += "\"revision\":\"" + modem_.GetModuleName() + "\",";
-    board_json += "\"carrier\":\"" + modem_.GetCarrierName() + "\",";
-    board_json += "\"csq\":\"" + std::to_string(modem_.GetCsq()) + "\",";
+    board_json += "\"carrier\":\"" + GetCarrierName() + "\",";
+    board_json += "\"csq\":\"" + std::to_string(GetCsq()) + "\",";
     board_json += "\"imei\":\"" + modem_.GetImei() + "\",";
     board_json += "\"iccid\":\"" + modem_.GetIccid() + "\",";
     board_json += "\"cereg\":" + modem_.GetRegistrationState().ToString() + "}";
@@ -189,8 +255,8 @@ std::string Ml307Board::GetDeviceStatusJson() {
     // Network
     auto network = cJSON_CreateObject();
     cJSON_AddStringToObject(network, "type", "cellular");
-    cJSON_AddStringToObject(network, "carrier", modem_.GetCarrierName().c_str());
-    int csq = modem_.GetCsq();
+    cJSON_AddStringToObject(network, "carrier", GetCarrierName().c_str());
+    int csq = GetCsq();
     if (csq == -1) {
         cJSON_AddStringToObject(network, "signal", "unknown");
     } else if (csq >= 0 && csq <= 14) {
@@ -210,3 +276,22 @@ std::string Ml307Board::GetDeviceStatusJson() {
     cJSON_Delete(root);
     return json;
 }
+
+std::string Ml307Board::GetNetworkMetricsJson() {
+    std::lock_guard<std::mutex> lock(status_mutex_);
+    auto root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "type", "cellular");
+    cJSON_AddNumberToObject(root, "baud_rate", ML307_BAUD_RATE);
+    cJSON_AddNumberToObject(root, "rx_buffer_size", rx_buffer_size_);
+    cJSON_AddNumberToObject(root, "csq", csq_);
+    cJSON_AddNumberToObject(root, "at_queries", at_queries_);
+    cJSON_AddNumberToObject(root, "at_cached", at_cached_);
+    cJSON_AddNumberToObject(root, "at_avg_us", at_queries_ > 0 ? at_total_us_ / at_queries_ : 0);
+    cJSON_AddNumberToObject(root, "at_max_us", at_max_us_);
+
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
@@ -4,11 +4,21 @@
 #include "board.h"
 #include <ml307_at_modem.h>
 
+#include <mutex>
+
+#define ML307_BAUD_RATE 921600
+// Signal and carrier are read at most this often. The display, the link quality and the status
+// report all ask for them, and every query is a UART round trip in front of the audio socket data
+#define ML307_STATUS_CACHE_MS 5000
+
 class Ml307Board : public Board {
 protected:
     Ml307AtModem modem_;
     virtual std::string GetBoardJson() override;
     void WaitForNetworkReady();
+    // Cached, concurrent callers wait for the one query in flight instead of sending their own
+    int GetCsq();
+    std::string GetCarrierName();
 
 public:
     Ml307Board(gpio_num_t tx_pin, gpio_num_t rx_pin, size_t rx_buffer_size = 4096);
@@ -19,9 +29,28 @@ public:
     virtual Mqtt* CreateMqtt() override;
     virtual Udp* CreateUdp() override;
     virtual const char* GetNetworkStateIcon() override;
+    virtual int GetSignalQuality() override;
     virtual void SetPowerSaveMode(bool enabled) override;
     virtual AudioCodec* GetAudioCodec() override { return nullptr; }
     virtual std::string GetDeviceStatusJson() override;
+    virtual std::string GetNetworkMetricsJson() override;
+    // Registers to the network without alerts or status updates, blocks until registered
+    void StartStandby();
+
+private:
+    size_t rx_buffer_size_;
+    std::mutex status_mutex_;
+    int csq_ = -1;
+    int64_t csq_time_us_ = 0;
+    // Read once per registration
+    std::string carrier_name_;
+    // Round trips of the status queries, and the queries answered from the cache
+    uint32_t at_queries_ = 0;
+    uint32_t at_cached_ = 0;
+    int64_t at_total_us_ = 0;
+    int64_t at_max_us_ = 0;
+
+    void RecordRoundTrip(int64_t start_us);
 };
 
 #endif // ML307_BOARD_H
@@ -0,0 +1,68 @@
+#include "multipart_writer.h"
+
+#include <cstring>
+
+MultipartWriter::MultipartWriter(Http* http) : http_(http) {
+}
+
+void MultipartWriter::Flush() {
+    if (length_ > 0) {
+        http_->Write(buffer_, length_);
+        length_ = 0;
+    }
+}
+
+void MultipartWriter::Write(const void* data, size_t len) {
+    auto bytes = (const char*)data;
+    if (length_ + len <= sizeof(buffer_)) {
+        memcpy(buffer_ + length_, bytes, len);
+        length_ += len;
+        return;
+    }
+    Flush();
+    if (len >= sizeof(buffer_)) {
+        http_->Write(bytes, len);
+    } else {
+        memcpy(buffer_, bytes, len);
+        length_ = len;
+    }
+}
+
+void MultipartWriter::Append(const char* text) {
+    Write(text, strlen(text));
+}
+
+void MultipartWriter::BeginPart(const char* name, const char* filename, const char* content_type) {
+    // 上一部分的内容以 CRLF 结束
+    Append(in_part_ ? "\r\n--" MULTIPART_BOUNDARY "\r\n" : "--" MULTIPART_BOUNDARY "\r\n");
+    Append("Content-Disposition: form-data; name=\"");
+    Append(name);
+    if (filename != nullptr) {
+        Append("\"; filename=\"");
+        Append(filename);
+    }
+    Append("\"\r\n");
+    if (content_type != nullptr) {
+        Append("Content-Type: ");
+        Append(content_type);
+        Append("\r\n");
+    }
+    Append("\r\n");
+    in_part_ = true;
+}
+
+void MultipartWriter::AddField(const char* name, const std::string& value) {
+    BeginPart(name, nullptr, nullptr);
+    Write(value.data(), value.size());
+}
+
+void MultipartWriter::BeginFile(const char* name, const char* filename, const char* content_type) {
+    BeginPart(name, filename, content_type);
+}
+
+void MultipartWriter::Finish() {
+    Append("\r\n--" MULTIPART_BOUNDARY "--\r\n");
+    Flush();
+    // 结束块
+    http_->Write("", 0);
+}
@@ -0,0 +1,43 @@
+#ifndef MULTIPART_WRITER_H
+#define MULTIPART_WRITER_H
+
+#include <http.h>
+
+#include <string>
+
+#define MULTIPART_BOUNDARY "----ESP32_CAMERA_BOUNDARY"
+#define MULTIPART_CONTENT_TYPE "multipart/form-data; boundary=" MULTIPART_BOUNDARY
+// 小段内容先攒在这里，凑成一个 HTTP chunk 再发
+#define MULTIPART_BUFFER_SIZE 256
+
+/*
+ * Writes a multipart/form-data body straight into an Http that was opened
+ * with Transfer-Encoding: chunked and MULTIPART_CONTENT_TYPE.
+ *
+ * Boundaries, part headers and field values go through a small fixed buffer,
+ * so they cost neither heap nor one chunk each. File data of a buffer or more
+ * is passed to the Http as it is, without a copy.
+ */
+class MultipartWriter {
+public:
+    explicit MultipartWriter(Http* http);
+
+    void AddField(const char* name, const std::string& value);
+    // Starts a file part, its content follows with Write()
+    void BeginFile(const char* name, const char* filename, const char* content_type);
+    void Write(const void* data, size_t len);
+    // Ends the last part and the chunked body
+    void Finish();
+
+private:
+    Http* http_;
+    char buffer_[MULTIPART_BUFFER_SIZE];
+    size_t length_ = 0;
+    bool in_part_ = false;
+
+    void BeginPart(const char* name, const char* filename, const char* content_type);
+    void Append(const char* text);
+    void Flush();
+};
+
+#endif // MULTIPART_WRITER_H
@@ -0,0 +1,93 @@
+#include "power_monitor.h"
+
+#include <esp_log.h>
+
+#define TAG "PowerMonitor"
+
+PowerMonitor::PowerMonitor(ReadCallback read_callback) : read_callback_(read_callback) {
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            auto self = static_cast<PowerMonitor*>(arg);
+            self->Poll();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "power_monitor",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer_));
+
+    // 先读一次，保证第一次 GetState 就有数据
+    Poll();
+}
+
+PowerMonitor::~PowerMonitor() {
+    esp_timer_stop(timer_);
+    esp_timer_delete(timer_);
+}
+
+PowerState PowerMonitor::GetState() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return state_;
+}
+
+void PowerMonitor::OnChanged(std::function<void(const PowerState&)> callback) {
+    on_changed_ = callback;
+    // 让新的回调拿到当前状态
+    if (on_changed_) {
+        on_changed_(GetState());
+    }
+}
+
+void PowerMonitor::Refresh() {
+    esp_timer_stop(timer_);
+    esp_timer_start_once(timer_, 0);
+}
+
+void PowerMonitor::Poll() {
+    PowerState sample;
+    bool changed = false;
+    PowerState state;
+
+    if (read_callback_(sample)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool direction_changed = !valid_ || sample.charging != state_.charging || sample.discharging != state_.discharging;
+        int level = sample.level;
+        if (!direction_changed) {
+            // 电量计的读数会来回跳动，充电时只升不降，放电时只降不升
+            if (sample.charging && level < state_.level) {
+                level = state_.level;
+            } else if (sample.discharging && level > state_.level) {
+                level = state_.level;
+            }
+        }
+        if (direction_changed || level != state_.level) {
+            changed = true;
+            settle_polls_ = POWER_MONITOR_SETTLE_POLLS;
+        }
+        state_.level = level;
+        state_.charging = sample.charging;
+        state_.discharging = sample.discharging;
+        valid_ = true;
+        state = state_;
+    } else {
+        ESP_LOGW(TAG, "Failed to read the power state");
+        state = GetState();
+    }
+
+    if (changed) {
+        ESP_LOGI(TAG, "Battery level: %d, charging: %d, discharging: %d", state.level, state.charging, state.discharging);
+        if (on_changed_) {
+            on_changed_(state);
+        }
+    }
+
+    int interval_ms = POWER_MONITOR_SLOW_INTERVAL_MS;
+    if (settle_polls_ > 0) {
+        settle_polls_--;
+        interval_ms = POWER_MONITOR_FAST_INTERVAL_MS;
+    } else if (state.charging || state.level < POWER_MONITOR_LOW_LEVEL) {
+        interval_ms = POWER_MONITOR_FAST_INTERVAL_MS;
+    }
+    esp_timer_start_once(timer_, interval_ms * 1000);
+}
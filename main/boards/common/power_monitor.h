@@ -0,0 +1,57 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+
+#include <esp_timer.h>
+
+// 充电、低电量或状态刚变化时的查询间隔
+#define POWER_MONITOR_FAST_INTERVAL_MS 2000
+// 电池状态稳定时的查询间隔
+#define POWER_MONITOR_SLOW_INTERVAL_MS 10000
+// 低于这个电量时按快速间隔查询
+#define POWER_MONITOR_LOW_LEVEL 20
+// 状态变化后保持快速查询的次数
+#define POWER_MONITOR_SETTLE_POLLS 5
+
+struct PowerState {
+    int level = 0;
+    bool charging = false;
+    bool discharging = false;
+};
+
+/*
+ * Reads the PMIC on behalf of everything that shows the battery state.
+ * Display, the Battery thing and the MCP device status all go through
+ * Board::GetBatteryLevel, which returns the cached state instead of touching
+ * the I2C bus.
+ *
+ * The PMIC is read rarely while the state is stable and more often while
+ * charging, when the battery is low or just after a change. The level is
+ * filtered once here: while charging it never goes down and while
+ * discharging it never goes up, so the gauge jitter does not flicker the
+ * icon. Refresh() reads the PMIC right away, for boards that get an event
+ * such as a PMIC interrupt.
+ */
+class PowerMonitor {
+public:
+    typedef std::function<bool(PowerState&)> ReadCallback;
+
+    PowerMonitor(ReadCallback read_callback);
+    ~PowerMonitor();
+
+    PowerState GetState();
+    void OnChanged(std::function<void(const PowerState&)> callback);
+    void Refresh();
+
+private:
+    void Poll();
+
+    esp_timer_handle_t timer_ = nullptr;
+    ReadCallback read_callback_;
+    std::function<void(const PowerState&)> on_changed_;
+    std::mutex mutex_;
+    PowerState state_;
+    bool valid_ = false;
+    int settle_polls_ = 0;
+};
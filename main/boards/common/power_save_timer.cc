@@ -1,7 +1,15 @@
 #include "power_save_timer.h"
 #include "application.h"
+#include "board.h"
+#include "display.h"
+#if CONFIG_USE_POWER_GOVERNOR
+#include "power_governor.h"
+#endif
 
 #include <esp_log.h>
+#include <esp_sleep.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
 
 #define TAG "PowerSaveTimer"
 
@@ -19,11 +27,32 @@ PowerSaveTimer::PowerSaveTimer(int cpu_max_freq, int seconds_to_sleep, int secon
         .skip_unhandled_events = true,
     };
     ESP_ERROR_CHECK(esp_timer_create(&timer_args, &power_save_timer_));
+
+    esp_timer_create_args_t voice_timer_args = {
+        .callback = [](void* arg) {
+            auto self = static_cast<PowerSaveTimer*>(arg);
+            self->OnVoiceActivity();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "voice_wake_timer",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&voice_timer_args, &voice_wake_timer_));
+#if CONFIG_USE_POWER_GOVERNOR
+    ConfigureAwake();
+#endif
 }
 
 PowerSaveTimer::~PowerSaveTimer() {
     esp_timer_stop(power_save_timer_);
     esp_timer_delete(power_save_timer_);
+    if (voice_wake_gpio_ != GPIO_NUM_NC) {
+        DisarmVoiceWake();
+        gpio_isr_handler_remove(voice_wake_gpio_);
+    }
+    esp_timer_stop(voice_wake_timer_);
+    esp_timer_delete(voice_wake_timer_);
 }
 
 void PowerSaveTimer::SetEnabled(bool enabled) {
@@ -52,6 +81,73 @@ void PowerSaveTimer::OnShutdownRequest(std::function<void()> callback) {
     on_shutdown_request_ = callback;
 }
 
+void PowerSaveTimer::SetVoiceWakeGpio(gpio_num_t gpio, int active_level) {
+    voice_wake_gpio_ = gpio;
+    voice_wake_level_ = active_level;
+
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << gpio,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    ESP_ERROR_CHECK(gpio_config(&io_conf));
+
+    // 按键驱动可能已经安装了中断服务
+    auto ret = gpio_install_isr_service(0);
+    if (ret != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(ret);
+    }
+    // The pin is level triggered, the handler masks it until the board goes back to sleep
+    ESP_ERROR_CHECK(gpio_isr_handler_add(gpio, [](void* arg) {
+        auto self = static_cast<PowerSaveTimer*>(arg);
+        gpio_intr_disable(self->voice_wake_gpio_);
+        BaseType_t higher_priority_task_woken = pdFALSE;
+        xTimerPendFunctionCallFromISR([](void* arg, uint32_t) {
+            auto self = static_cast<PowerSaveTimer*>(arg);
+            esp_timer_start_once(self->voice_wake_timer_, 0);
+        }, self, 0, &higher_priority_task_woken);
+        portYIELD_FROM_ISR(higher_priority_task_woken);
+    }, this));
+    ESP_ERROR_CHECK(esp_sleep_enable_gpio_wakeup());
+    ESP_LOGI(TAG, "Voice wake on GPIO %d, active level %d", gpio, active_level);
+}
+
+void PowerSaveTimer::ArmVoiceWake() {
+    if (voice_wake_gpio_ == GPIO_NUM_NC || voice_wake_armed_) {
+        return;
+    }
+    auto type = voice_wake_level_ ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL;
+    gpio_wakeup_enable(voice_wake_gpio_, type);
+    gpio_set_intr_type(voice_wake_gpio_, type);
+    gpio_intr_enable(voice_wake_gpio_);
+    voice_wake_armed_ = true;
+}
+
+void PowerSaveTimer::DisarmVoiceWake() {
+    if (!voice_wake_armed_) {
+        return;
+    }
+    gpio_intr_disable(voice_wake_gpio_);
+    gpio_wakeup_disable(voice_wake_gpio_);
+    voice_wake_armed_ = false;
+}
+
+void PowerSaveTimer::OnVoiceActivity() {
+    if (!in_sleep_mode_ || !voice_wake_armed_) {
+        return;
+    }
+    // The handler already masked the pin, keep it masked while listening
+    gpio_wakeup_disable(voice_wake_gpio_);
+    voice_wake_armed_ = false;
+
+    ESP_LOGI(TAG, "Voice activity, listening for the wake word");
+    voice_listen_ticks_ = POWER_SAVE_VOICE_LISTEN_SECONDS;
+    auto codec = Board::GetInstance().GetAudioCodec();
+    codec->EnableInput(true);
+}
+
 void PowerSaveTimer::PowerSaveCheck() {
     auto& app = Application::GetInstance();
     if (!in_sleep_mode_ && !app.CanEnterSleepMode()) {
@@ -60,9 +156,17 @@ void PowerSaveTimer::PowerSaveCheck() {
     }
 
     ticks_++;
+    // 唤醒词之后设备不再空闲，等对话结束再计时
+    if (voice_listen_ticks_ > 0 && app.CanEnterSleepMode() && --voice_listen_ticks_ == 0) {
+        ESP_LOGI(TAG, "No wake word, back to sleep");
+        auto codec = Board::GetInstance().GetAudioCodec();
+        codec->EnableInput(false);
+        ArmVoiceWake();
+    }
     if (seconds_to_sleep_ != -1 && ticks_ >= seconds_to_sleep_) {
         if (!in_sleep_mode_) {
             in_sleep_mode_ = true;
+            Board::GetInstance().GetDisplay()->SetRefreshHint(kRefreshHintSleep, true);
             if (on_enter_sleep_mode_) {
                 on_enter_sleep_mode_();
             }
@@ -75,6 +179,7 @@ void PowerSaveTimer::PowerSaveCheck() {
                 };
                 esp_pm_configure(&pm_config);
             }
+            ArmVoiceWake();
         }
     }
     if (seconds_to_shutdown_ != -1 && ticks_ >= seconds_to_shutdown_ && on_shutdown_request_) {
@@ -86,18 +191,31 @@ void PowerSaveTimer::WakeUp() {
     ticks_ = 0;
     if (in_sleep_mode_) {
         in_sleep_mode_ = false;
+        DisarmVoiceWake();
+        voice_listen_ticks_ = 0;
+        Board::GetInstance().GetDisplay()->SetRefreshHint(kRefreshHintSleep, false);
 
-        if (cpu_max_freq_ != -1) {
-            esp_pm_config_t pm_config = {
-                .max_freq_mhz = cpu_max_freq_,
-                .min_freq_mhz = cpu_max_freq_,
-                .light_sleep_enable = false,
-            };
-            esp_pm_configure(&pm_config);
-        }
+        ConfigureAwake();
 
         if (on_exit_sleep_mode_) {
             on_exit_sleep_mode_();
         }
     }
 }
+
+void PowerSaveTimer::ConfigureAwake() {
+    if (cpu_max_freq_ == -1) {
+        return;
+    }
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = cpu_max_freq_,
+#if CONFIG_USE_POWER_GOVERNOR
+        // The pipeline stages hold the clock up while they run, see PowerGovernor
+        .min_freq_mhz = POWER_GOVERNOR_MIN_FREQ_MHZ,
+#else
+        .min_freq_mhz = cpu_max_freq_,
+#endif
+        .light_sleep_enable = false,
+    };
+    esp_pm_configure(&pm_config);
+}
@@ -4,6 +4,25 @@
 
 #include <esp_timer.h>
 #include <esp_pm.h>
+#include <driver/gpio.h>
+
+// 语音唤醒后只打开麦克风这么久，没有唤醒词就重新进入睡眠
+#define POWER_SAVE_VOICE_LISTEN_SECONDS 5
+
+/*
+ * Counts idle seconds and puts the board into sleep mode (lower CPU clock,
+ * automatic light sleep) and eventually asks it to shut down.
+ *
+ * Boards usually turn the microphone off in their sleep callback, because a
+ * running I2S channel keeps the chip out of light sleep. A board whose codec
+ * drives a voice activity pin can pass it to SetVoiceWakeGpio: while asleep
+ * the pin wakes the chip from light sleep, the microphone is switched back on
+ * and the wake word detector runs for POWER_SAVE_VOICE_LISTEN_SECONDS with
+ * the display still asleep. A wake word opens the audio channel, which wakes
+ * the board fully; otherwise the microphone goes off again. RAM, the audio
+ * front end and the Wi-Fi association all survive light sleep, so nothing
+ * has to be restored.
+ */
 
 class PowerSaveTimer {
 public:
@@ -14,15 +33,29 @@ public:
     void OnEnterSleepMode(std::function<void()> callback);
     void OnExitSleepMode(std::function<void()> callback);
     void OnShutdownRequest(std::function<void()> callback);
+    // active_level is the level of the pin while the codec hears voice
+    void SetVoiceWakeGpio(gpio_num_t gpio, int active_level);
     void WakeUp();
 
 private:
     void PowerSaveCheck();
+    void OnVoiceActivity();
+    void ArmVoiceWake();
+    void DisarmVoiceWake();
+    // The clock range while awake: fixed at the maximum, or scaled by the governor
+    void ConfigureAwake();
 
     esp_timer_handle_t power_save_timer_ = nullptr;
+    // Runs OnVoiceActivity on the timer task, next to PowerSaveCheck
+    esp_timer_handle_t voice_wake_timer_ = nullptr;
     bool enabled_ = false;
     bool in_sleep_mode_ = false;
     int ticks_ = 0;
+    gpio_num_t voice_wake_gpio_ = GPIO_NUM_NC;
+    int voice_wake_level_ = 1;
+    bool voice_wake_armed_ = false;
+    // Seconds left of listening after a voice wake, 0 when not listening
+    int voice_listen_ticks_ = 0;
     int cpu_max_freq_;
     int seconds_to_sleep_;
     int seconds_to_shutdown_;
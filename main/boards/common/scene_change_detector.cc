@@ -0,0 +1,203 @@
+#include "scene_change_detector.h"
+#include "application.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#define TAG "SceneChange"
+
+SceneChangeDetector::SceneChangeDetector(Camera* camera) : camera_(camera) {
+}
+
+SceneChangeDetector::~SceneChangeDetector() {
+    Stop();
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (task_ == nullptr) {
+                break;
+            }
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+void SceneChangeDetector::Start(int interval_seconds, int sensitivity, const std::string& question) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    interval_seconds_ = interval_seconds;
+    sensitivity_ = sensitivity;
+    question_ = question;
+    running_ = true;
+    if (task_ != nullptr) {
+        // 已经在运行，新的间隔从现在开始
+        xTaskNotifyGive(task_);
+        return;
+    }
+
+    has_reference_ = false;
+    xTaskCreate([](void* arg) {
+        static_cast<SceneChangeDetector*>(arg)->Loop();
+    }, "scene_change", SCENE_TASK_STACK_SIZE, this, 2, &task_);
+    ESP_LOGI(TAG, "Watching every %d s, sensitivity %d%%", interval_seconds, sensitivity);
+}
+
+void SceneChangeDetector::Stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        running_ = false;
+        ESP_LOGI(TAG, "Stopped after %lu checks and %lu uploads", checks_, uploads_);
+    }
+    if (task_ != nullptr) {
+        xTaskNotifyGive(task_);
+    }
+}
+
+std::string SceneChangeDetector::GetStatusJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "running", running_);
+    if (running_) {
+        cJSON_AddNumberToObject(root, "interval", interval_seconds_);
+        cJSON_AddNumberToObject(root, "sensitivity", sensitivity_);
+    }
+    cJSON_AddNumberToObject(root, "checks", checks_);
+    cJSON_AddNumberToObject(root, "uploads", uploads_);
+    cJSON_AddNumberToObject(root, "last_changed_percent", last_changed_percent_);
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
+
+void SceneChangeDetector::Loop() {
+    while (true) {
+        int interval_seconds;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!running_) {
+                // Start() 在这之后会重新创建任务
+                task_ = nullptr;
+                break;
+            }
+            interval_seconds = interval_seconds_;
+        }
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(interval_seconds * 1000)) != 0) {
+            // Stopped, or restarted with new settings
+            continue;
+        }
+        if (running_) {
+            Check();
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+void SceneChangeDetector::Check() {
+    if (!camera_->CaptureLuma(current_, SCENE_GRID_WIDTH, SCENE_GRID_HEIGHT)) {
+        ESP_LOGW(TAG, "Failed to capture a frame");
+        return;
+    }
+
+    int changed_percent = 0;
+    bool upload = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        checks_++;
+        if (!has_reference_) {
+            memcpy(reference_, current_, sizeof(reference_));
+            has_reference_ = true;
+            return;
+        }
+
+        changed_percent = GetChangedPercent();
+        last_changed_percent_ = changed_percent;
+        auto now = esp_timer_get_time();
+        bool cooling_down = last_upload_us_ != 0 && now - last_upload_us_ < SCENE_MIN_UPLOAD_INTERVAL_SECONDS * 1000000LL;
+        if (changed_percent >= sensitivity_ && !cooling_down) {
+            memcpy(reference_, current_, sizeof(reference_));
+            last_upload_us_ = now;
+            uploads_++;
+            upload = true;
+        } else {
+            // 跟着缓慢的光线变化走，每次靠近当前画面四分之一
+            for (size_t i = 0; i < sizeof(reference_); i++) {
+                reference_[i] = (reference_[i] * 3 + current_[i]) / 4;
+            }
+        }
+    }
+    if (upload) {
+        Upload(changed_percent);
+    }
+}
+
+int SceneChangeDetector::GetChangedPercent() const {
+    int changed = 0;
+    for (size_t i = 0; i < sizeof(reference_); i++) {
+        if (std::abs(current_[i] - reference_[i]) > SCENE_CELL_THRESHOLD) {
+            changed++;
+        }
+    }
+    return changed * 100 / (int)sizeof(reference_);
+}
+
+void SceneChangeDetector::Upload(int changed_percent) {
+    std::string question;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        question = question_;
+    }
+    ESP_LOGI(TAG, "Scene changed by %d%%, uploading", changed_percent);
+    if (!camera_->Capture()) {
+        ESP_LOGE(TAG, "Failed to capture photo");
+        return;
+    }
+    auto explanation = camera_->Explain(question);
+
+    auto root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "jsonrpc", "2.0");
+    cJSON_AddStringToObject(root, "method", "notifications/scene_changed");
+    auto params = cJSON_CreateObject();
+    cJSON_AddNumberToObject(params, "changed_percent", changed_percent);
+    cJSON_AddStringToObject(params, "question", question.c_str());
+    cJSON_AddStringToObject(params, "explanation", explanation.c_str());
+    cJSON_AddItemToObject(root, "params", params);
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string payload(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    Application::GetInstance().SendMcpMessage(std::move(payload));
+}
+
+void SceneChangeDetector::DownsampleRgb565(const uint8_t* src, int src_width, int src_height, bool big_endian,
+    uint8_t* luma, int width, int height) {
+    auto pixels = (const uint16_t*)src;
+    for (int cy = 0; cy < height; cy++) {
+        int y0 = cy * src_height / height;
+        int y1 = std::max(y0 + 1, (cy + 1) * src_height / height);
+        for (int cx = 0; cx < width; cx++) {
+            int x0 = cx * src_width / width;
+            int x1 = std::max(x0 + 1, (cx + 1) * src_width / width);
+            uint32_t sum = 0;
+            uint32_t count = 0;
+            // Every other pixel each way is plenty for a mean
+            for (int y = y0; y < y1; y += 2) {
+                auto row = pixels + y * src_width;
+                for (int x = x0; x < x1; x += 2) {
+                    uint16_t pixel = big_endian ? __builtin_bswap16(row[x]) : row[x];
+                    int r = (pixel >> 8) & 0xf8;
+                    int g = (pixel >> 3) & 0xfc;
+                    int b = (pixel << 3) & 0xf8;
+                    sum += (r * 77 + g * 150 + b * 29) >> 8;
+                    count++;
+                }
+            }
+            *luma++ = sum / count;
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef SCENE_CHANGE_DETECTOR_H
+#define SCENE_CHANGE_DETECTOR_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "camera.h"
+
+// 每帧缩成这么多格的亮度图再比较
+#define SCENE_GRID_WIDTH 32
+#define SCENE_GRID_HEIGHT 24
+// A cell counts as changed when its mean brightness (0-255) moves by more than this
+#define SCENE_CELL_THRESHOLD 20
+// 两次上传之间至少间隔这么久，画面一直在动也不会连续上传
+#define SCENE_MIN_UPLOAD_INTERVAL_SECONDS 30
+#define SCENE_TASK_STACK_SIZE 6144
+
+/*
+ * Watches the camera at a low cadence and only asks the explain server
+ * about the scene when it changes.
+ *
+ * Each check shrinks one frame to a SCENE_GRID_WIDTH x SCENE_GRID_HEIGHT
+ * brightness grid and compares it with a reference grid. When at least
+ * `sensitivity` percent of the cells changed, the camera takes a photo,
+ * Explain() runs with the configured question, and the answer goes to the
+ * server as a notifications/scene_changed MCP message. The reference then
+ * jumps to the new scene. Otherwise the reference slowly follows the current
+ * frame, so gradual light changes never add up to a trigger. A quiet scene
+ * costs one capture and about a thousand pixel reads per interval, and no
+ * network traffic at all.
+ */
+class SceneChangeDetector {
+public:
+    explicit SceneChangeDetector(Camera* camera);
+    ~SceneChangeDetector();
+
+    // sensitivity is the percentage of the cells that must change
+    void Start(int interval_seconds, int sensitivity, const std::string& question);
+    void Stop();
+    std::string GetStatusJson();
+
+    // Mean brightness of each cell of an RGB565 image, sensors send big endian pixels
+    static void DownsampleRgb565(const uint8_t* src, int src_width, int src_height, bool big_endian,
+        uint8_t* luma, int width, int height);
+
+private:
+    Camera* camera_;
+    std::mutex mutex_;
+    TaskHandle_t task_ = nullptr;
+    std::atomic<bool> running_ = false;
+    int interval_seconds_ = 0;
+    int sensitivity_ = 0;
+    std::string question_;
+
+    uint8_t reference_[SCENE_GRID_WIDTH * SCENE_GRID_HEIGHT];
+    uint8_t current_[SCENE_GRID_WIDTH * SCENE_GRID_HEIGHT];
+    bool has_reference_ = false;
+    int last_changed_percent_ = 0;
+    uint32_t checks_ = 0;
+    uint32_t uploads_ = 0;
+    int64_t last_upload_us_ = 0;
+
+    void Loop();
+    void Check();
+    int GetChangedPercent() const;
+    void Upload(int changed_percent);
+};
+
+#endif // SCENE_CHANGE_DETECTOR_H
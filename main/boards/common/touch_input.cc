@@ -0,0 +1,143 @@
+#include "touch_input.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cstdlib>
+
+#define TAG "TouchInput"
+
+TouchInput::TouchInput(esp_lcd_touch_handle_t touch) : touch_(touch) {
+    has_interrupt_ = touch_->config.int_gpio_num != GPIO_NUM_NC;
+    Start();
+}
+
+TouchInput::TouchInput(std::function<bool(uint16_t& x, uint16_t& y)> read) : read_(read) {
+    Start();
+}
+
+TouchInput::~TouchInput() {
+    if (has_interrupt_) {
+        esp_lcd_touch_register_interrupt_callback(touch_, nullptr);
+    }
+    if (task_ != nullptr) {
+        vTaskDelete(task_);
+    }
+}
+
+void TouchInput::OnTap(std::function<void()> callback) {
+    on_tap_ = callback;
+}
+
+void TouchInput::OnLongPress(std::function<void()> callback) {
+    on_long_press_ = callback;
+}
+
+void TouchInput::OnSwipe(std::function<void(TouchSwipe)> callback) {
+    on_swipe_ = callback;
+}
+
+void TouchInput::Start() {
+    xTaskCreate([](void* arg) {
+        ((TouchInput*)arg)->Run();
+    }, "touch_input", 4096, this, 5, &task_);
+
+    if (has_interrupt_) {
+        // The INT pin only wakes the task, the controller is read over I2C outside the ISR
+        auto on_interrupt = [](esp_lcd_touch_handle_t tp) {
+            auto self = (TouchInput*)tp->config.user_data;
+            BaseType_t woken = pdFALSE;
+            vTaskNotifyGiveFromISR(self->task_, &woken);
+            portYIELD_FROM_ISR(woken);
+        };
+        if (esp_lcd_touch_register_interrupt_callback_with_data(touch_, on_interrupt, this) != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to register the touch interrupt, polling instead");
+            has_interrupt_ = false;
+        }
+    }
+    ESP_LOGI(TAG, "Touch input started, %s", has_interrupt_ ? "interrupt driven" : "polling");
+}
+
+void TouchInput::Run() {
+    while (true) {
+        if (pressed_) {
+            vTaskDelay(pdMS_TO_TICKS(TOUCH_INPUT_POLL_MS));
+        } else if (has_interrupt_) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        } else {
+            vTaskDelay(pdMS_TO_TICKS(TOUCH_INPUT_IDLE_POLL_MS));
+        }
+
+        uint16_t x = 0;
+        uint16_t y = 0;
+        bool touched = Read(x, y);
+        OnSample(touched, x, y, esp_timer_get_time() / 1000);
+    }
+}
+
+bool TouchInput::Read(uint16_t& x, uint16_t& y) {
+    if (read_) {
+        return read_(x, y);
+    }
+    if (esp_lcd_touch_read_data(touch_) != ESP_OK) {
+        return false;
+    }
+    uint8_t points = 0;
+    return esp_lcd_touch_get_coordinates(touch_, &x, &y, nullptr, &points, 1) && points > 0;
+}
+
+void TouchInput::OnSample(bool touched, uint16_t x, uint16_t y, int64_t now_ms) {
+    if (touched) {
+        if (!pressed_) {
+            pressed_ = true;
+            long_pressed_ = false;
+            start_x_ = x;
+            start_y_ = y;
+            press_time_ms_ = now_ms;
+        }
+        last_x_ = x;
+        last_y_ = y;
+        release_time_ms_ = 0;
+
+        // A long press fires while the finger is still down, as Button does
+        bool moved = abs(x - start_x_) > TOUCH_INPUT_TAP_SLOP || abs(y - start_y_) > TOUCH_INPUT_TAP_SLOP;
+        if (!long_pressed_ && !moved && now_ms - press_time_ms_ >= TOUCH_INPUT_LONG_PRESS_MS) {
+            long_pressed_ = true;
+            if (on_long_press_) {
+                on_long_press_();
+            }
+        }
+        return;
+    }
+
+    if (!pressed_) {
+        return;
+    }
+    if (release_time_ms_ == 0) {
+        release_time_ms_ = now_ms;
+    }
+    if (now_ms - release_time_ms_ >= TOUCH_INPUT_RELEASE_MS) {
+        pressed_ = false;
+        OnRelease();
+    }
+}
+
+void TouchInput::OnRelease() {
+    if (long_pressed_) {
+        return;
+    }
+    int dx = last_x_ - start_x_;
+    int dy = last_y_ - start_y_;
+    if (abs(dx) >= TOUCH_INPUT_SWIPE_DISTANCE || abs(dy) >= TOUCH_INPUT_SWIPE_DISTANCE) {
+        if (on_swipe_) {
+            if (abs(dy) >= abs(dx)) {
+                on_swipe_(dy < 0 ? kTouchSwipeUp : kTouchSwipeDown);
+            } else {
+                on_swipe_(dx < 0 ? kTouchSwipeLeft : kTouchSwipeRight);
+            }
+        }
+    } else if (abs(dx) <= TOUCH_INPUT_TAP_SLOP && abs(dy) <= TOUCH_INPUT_TAP_SLOP) {
+        if (on_tap_) {
+            on_tap_();
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef TOUCH_INPUT_H_
+#define TOUCH_INPUT_H_
+
+#include <esp_lcd_touch.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <functional>
+
+// Sampling period while a finger is down, and while idle on controllers without an INT pin
+#define TOUCH_INPUT_POLL_MS 10
+#define TOUCH_INPUT_IDLE_POLL_MS 20
+// A release shorter than this is contact bounce and continues the same touch
+#define TOUCH_INPUT_RELEASE_MS 30
+#define TOUCH_INPUT_LONG_PRESS_MS 800
+// Movement in pixels: below the slop a touch is still a tap, from the swipe distance on it is a swipe
+#define TOUCH_INPUT_TAP_SLOP 20
+#define TOUCH_INPUT_SWIPE_DISTANCE 60
+
+enum TouchSwipe {
+    kTouchSwipeUp,
+    kTouchSwipeDown,
+    kTouchSwipeLeft,
+    kTouchSwipeRight,
+};
+
+/*
+ * Turns touch panel samples into taps, long presses and swipes for the board,
+ * the same way Button does for keys. The controller is read by a task of its
+ * own, not through an LVGL input device, so a tap reaches Application without
+ * waiting for the LVGL timer.
+ *
+ * With an INT pin in the esp_lcd_touch config the task sleeps until the
+ * controller signals a touch and samples every TOUCH_INPUT_POLL_MS only while
+ * the finger is down. Without one, or for a controller read by a function, it
+ * polls every TOUCH_INPUT_IDLE_POLL_MS. The panel must not also be added to
+ * LVGL with lvgl_port_add_touch, both would consume the same samples.
+ *
+ * Callbacks run on the touch task.
+ */
+class TouchInput {
+public:
+    TouchInput(esp_lcd_touch_handle_t touch);
+    // For controllers without an esp_lcd_touch driver, returns whether a finger is down and where
+    TouchInput(std::function<bool(uint16_t& x, uint16_t& y)> read);
+    ~TouchInput();
+
+    void OnTap(std::function<void()> callback);
+    void OnLongPress(std::function<void()> callback);
+    void OnSwipe(std::function<void(TouchSwipe)> callback);
+
+private:
+    esp_lcd_touch_handle_t touch_ = nullptr;
+    std::function<bool(uint16_t& x, uint16_t& y)> read_;
+    bool has_interrupt_ = false;
+    TaskHandle_t task_ = nullptr;
+
+    std::function<void()> on_tap_;
+    std::function<void()> on_long_press_;
+    std::function<void(TouchSwipe)> on_swipe_;
+
+    // The touch in progress
+    bool pressed_ = false;
+    bool long_pressed_ = false;
+    uint16_t start_x_ = 0;
+    uint16_t start_y_ = 0;
+    uint16_t last_x_ = 0;
+    uint16_t last_y_ = 0;
+    int64_t press_time_ms_ = 0;
+    int64_t release_time_ms_ = 0;
+
+    void Start();
+    void Run();
+    bool Read(uint16_t& x, uint16_t& y);
+    void OnSample(bool touched, uint16_t x, uint16_t y, int64_t now_ms);
+    void OnRelease();
+};
+
+#endif // TOUCH_INPUT_H_
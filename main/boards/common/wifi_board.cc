@@ -21,6 +21,11 @@
 #include <wifi_configuration_ap.h>
 #include <ssid_manager.h>
 #include "afsk_demod.h"
+#include "reconnect_backoff.h"
+#include "network_monitor.h"
+
+#include <algorithm>
+#include <cJSON.h>
 
 static const char *TAG = "WifiBoard";
 
@@ -98,6 +103,17 @@ void WifiBoard::StartNetwork() {
         display->ShowNotification(notification.c_str(), 30000);
     });
     wifi_station.OnConnected([this](const std::string& ssid) {
+        // Connections that failed while the link was down are tried again now instead of after their backoff
+        ReconnectBackoff::OnNetworkUp();
+        NetworkMonitor::GetInstance().Refresh();
+#if CONFIG_USE_HTTP_KEEP_ALIVE
+        // Kept-alive connections did not survive the link going down
+        http_pool_.Clear();
+#endif
+#if CONFIG_USE_WIFI_POWER_POLICY
+        WifiPowerPolicy::GetInstance().OnConnected();
+#endif
+
         auto display = Board::GetInstance().GetDisplay();
         std::string notification = Lang::Strings::CONNECTED_TO;
         notification += ssid;
@@ -112,12 +128,32 @@ void WifiBoard::StartNetwork() {
         EnterWifiConfigMode();
         return;
     }
+#if CONFIG_USE_WIFI_POWER_POLICY
+    WifiPowerPolicy::GetInstance().Start();
+#endif
+}
+
+bool WifiBoard::StartStandby() {
+    auto& ssid_manager = SsidManager::GetInstance();
+    if (ssid_manager.GetSsidList().empty()) {
+        ESP_LOGW(TAG, "No WiFi SSID saved, no standby network");
+        return false;
+    }
+    // The station keeps reconnecting on its own, there is nothing to wait for here
+    WifiStation::GetInstance().Start();
+    return true;
 }
 
 Http* WifiBoard::CreateHttp() {
     return new EspHttp();
 }
 
+#if CONFIG_USE_HTTP_KEEP_ALIVE
+Http* WifiBoard::CreateKeepAliveHttp() {
+    return new PooledHttp(http_pool_);
+}
+#endif
+
 WebSocket* WifiBoard::CreateWebSocket() {
     Settings settings("websocket", false);
     std::string url = settings.GetString("url");
@@ -155,6 +191,16 @@ const char* WifiBoard::GetNetworkStateIcon() {
     }
 }
 
+int WifiBoard::GetSignalQuality() {
+    auto& wifi_station = WifiStation::GetInstance();
+    if (wifi_config_mode_ || !wifi_station.IsConnected()) {
+        return -1;
+    }
+    // -90 dBm is about where a link stops working, -50 dBm and above is as good as it gets
+    int rssi = wifi_station.GetRssi();
+    return std::clamp((rssi + 90) * 100 / 40, 0, 100);
+}
+
 std::string WifiBoard::GetBoardJson() {
     // Set the board type for OTA
     auto& wifi_station = WifiStation::GetInstance();
@@ -173,9 +219,30 @@ std::string WifiBoard::GetBoardJson() {
 }
 
 void WifiBoard::SetPowerSaveMode(bool enabled) {
+#if CONFIG_USE_WIFI_POWER_POLICY
+    // The policy owns the modem power save, the device state refines it further
+    WifiPowerPolicy::GetInstance().SetLevel(enabled ? kWifiPowerIdle : kWifiPowerLatency);
+#else
     auto& wifi_station = WifiStation::GetInstance();
     wifi_station.SetPowerSaveMode(enabled);
+#endif
+}
+
+#if CONFIG_USE_WIFI_POWER_POLICY
+std::string WifiBoard::GetNetworkMetricsJson() {
+    auto root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "type", "wifi");
+    auto power = cJSON_Parse(WifiPowerPolicy::GetInstance().GetMetricsJson().c_str());
+    if (power != nullptr) {
+        cJSON_AddItemToObject(root, "power", power);
+    }
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
 }
+#endif
 
 void WifiBoard::ResetWifiConfiguration() {
     // Set a flag and reboot the device to enter the network configuration mode
@@ -2,10 +2,19 @@
 #define WIFI_BOARD_H
 
 #include "board.h"
+#if CONFIG_USE_HTTP_KEEP_ALIVE
+#include "http_pool.h"
+#endif
+#if CONFIG_USE_WIFI_POWER_POLICY
+#include "wifi_power_policy.h"
+#endif
 
 class WifiBoard : public Board {
 protected:
     bool wifi_config_mode_ = false;
+#if CONFIG_USE_HTTP_KEEP_ALIVE
+    HttpPool http_pool_{CONFIG_HTTP_KEEP_ALIVE_IDLE_SECONDS * 1000};
+#endif
     void EnterWifiConfigMode();
     virtual std::string GetBoardJson() override;
 
@@ -14,12 +23,21 @@ public:
     virtual std::string GetBoardType() override;
     virtual void StartNetwork() override;
     virtual Http* CreateHttp() override;
+#if CONFIG_USE_HTTP_KEEP_ALIVE
+    virtual Http* CreateKeepAliveHttp() override;
+#endif
     virtual WebSocket* CreateWebSocket() override;
     virtual Mqtt* CreateMqtt() override;
     virtual Udp* CreateUdp() override;
     virtual const char* GetNetworkStateIcon() override;
+    virtual int GetSignalQuality() override;
     virtual void SetPowerSaveMode(bool enabled) override;
+#if CONFIG_USE_WIFI_POWER_POLICY
+    virtual std::string GetNetworkMetricsJson() override;
+#endif
     virtual void ResetWifiConfiguration();
+    // Connects in the background without entering configuration mode, false if no SSID is saved
+    bool StartStandby();
     virtual AudioCodec* GetAudioCodec() override { return nullptr; }
     virtual std::string GetDeviceStatusJson() override;
 };
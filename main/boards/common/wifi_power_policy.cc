@@ -0,0 +1,189 @@
+#include "wifi_power_policy.h"
+#include "event_bus.h"
+
+#include <esp_log.h>
+#include <esp_wifi.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+#if CONFIG_SOC_WIFI_HE_SUPPORT
+#include <esp_wifi_he.h>
+#endif
+
+#define TAG "WifiPowerPolicy"
+
+static const char* GetLevelName(WifiPowerLevel level) {
+    switch (level) {
+        case kWifiPowerLatency:
+            return "latency";
+        case kWifiPowerIdle:
+            return "idle";
+        default:
+            return "unset";
+    }
+}
+
+void WifiPowerPolicy::Start() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (started_) {
+            return;
+        }
+        started_ = true;
+    }
+#if CONFIG_SOC_WIFI_HE_SUPPORT
+    esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_ITWT_SETUP, OnWifiEvent, this, nullptr);
+    esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_ITWT_TEARDOWN, OnWifiEvent, this, nullptr);
+#endif
+    EventBus::GetInstance().Subscribe("wifi_power", EVENT_MASK(kEventDeviceStateChanged), [this](const Event& event) {
+        switch (event.state) {
+            case kDeviceStateIdle:
+                SetLevel(kWifiPowerIdle);
+                break;
+            case kDeviceStateConnecting:
+            case kDeviceStateListening:
+            case kDeviceStateSpeaking:
+            case kDeviceStateUpgrading:
+            case kDeviceStateAudioTesting:
+                SetLevel(kWifiPowerLatency);
+                break;
+            default:
+                break;
+        }
+    });
+}
+
+void WifiPowerPolicy::SetLevel(WifiPowerLevel level) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (level == level_) {
+        return;
+    }
+    level_ = level;
+    Apply(level);
+}
+
+void WifiPowerPolicy::OnConnected() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    twt_active_ = false;
+    twt_pending_ = false;
+    twt_rejected_ = false;
+    wake_start_us_ = 0;
+    // The station may have reset the power save mode while associating
+    if (level_ != kWifiPowerUnset) {
+        Apply(level_);
+    }
+}
+
+void WifiPowerPolicy::Apply(WifiPowerLevel level) {
+    if (level == kWifiPowerLatency) {
+        wake_start_us_ = esp_timer_get_time();
+        bool teardown = false;
+#if CONFIG_SOC_WIFI_HE_SUPPORT
+        if (twt_active_ || twt_pending_) {
+            // The wake completes with the teardown event
+            teardown = esp_wifi_sta_itwt_teardown(WIFI_POWER_TWT_FLOW_ID) == ESP_OK && twt_active_;
+            twt_active_ = false;
+            twt_pending_ = false;
+        }
+#endif
+        esp_wifi_set_ps(WIFI_PS_NONE);
+        if (!teardown) {
+            RecordWake();
+        }
+    } else {
+        esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
+        SetupTwt();
+    }
+    ESP_LOGI(TAG, "Power level %s", GetLevelName(level));
+}
+
+void WifiPowerPolicy::SetupTwt() {
+#if CONFIG_SOC_WIFI_HE_SUPPORT
+    if (twt_active_ || twt_pending_ || twt_rejected_) {
+        return;
+    }
+    // Wake interval = mantissa * 2^exponent microseconds, the mantissa is 16 bits
+    uint32_t interval_us = WIFI_POWER_TWT_INTERVAL_MS * 1000;
+    int exponent = 0;
+    while ((interval_us >> exponent) > UINT16_MAX) {
+        exponent++;
+    }
+    wifi_itwt_setup_config_t config = {};
+    config.setup_cmd = TWT_REQUEST;
+    config.flow_id = WIFI_POWER_TWT_FLOW_ID;
+    config.flow_type = 1;   // Unannounced, the station needs no trigger frame to send
+    config.trigger = 0;
+    config.wake_invl_expn = exponent;
+    config.wake_invl_mant = interval_us >> exponent;
+    config.wake_duration_unit = 0;
+    config.min_wake_dura = WIFI_POWER_TWT_MIN_WAKE_DURATION;
+    config.timeout_time_ms = WIFI_POWER_TWT_SETUP_TIMEOUT_MS;
+    esp_err_t err = esp_wifi_sta_itwt_setup(&config);
+    if (err != ESP_OK) {
+        // Not a Wi-Fi 6 link, or the access point does not support TWT
+        ESP_LOGI(TAG, "TWT not available: %s", esp_err_to_name(err));
+        twt_rejected_ = true;
+        return;
+    }
+    twt_pending_ = true;
+#endif
+}
+
+void WifiPowerPolicy::RecordWake() {
+    if (wake_start_us_ == 0) {
+        return;
+    }
+    last_wake_us_ = esp_timer_get_time() - wake_start_us_;
+    wake_start_us_ = 0;
+    wakes_++;
+    if (last_wake_us_ > max_wake_us_) {
+        max_wake_us_ = last_wake_us_;
+    }
+    ESP_LOGI(TAG, "Radio awake in %lld us", last_wake_us_);
+}
+
+void WifiPowerPolicy::OnWifiEvent(void* arg, esp_event_base_t base, int32_t id, void* data) {
+#if CONFIG_SOC_WIFI_HE_SUPPORT
+    auto this_ = static_cast<WifiPowerPolicy*>(arg);
+    std::lock_guard<std::mutex> lock(this_->mutex_);
+    if (id == WIFI_EVENT_ITWT_SETUP) {
+        auto event = static_cast<wifi_event_sta_itwt_setup_t*>(data);
+        bool accepted = event->config.setup_cmd == TWT_ACCEPT;
+        if (!this_->twt_pending_) {
+            // Torn down while the request was out, the latency level does not want it
+            if (accepted) {
+                esp_wifi_sta_itwt_teardown(event->config.flow_id);
+            }
+            return;
+        }
+        this_->twt_pending_ = false;
+        if (accepted) {
+            this_->twt_active_ = true;
+            this_->twt_setups_++;
+            ESP_LOGI(TAG, "TWT agreed, wake interval %lu us", (unsigned long)event->config.wake_invl_mant <<
+                event->config.wake_invl_expn);
+        } else {
+            this_->twt_rejected_ = true;
+            ESP_LOGI(TAG, "TWT rejected by the access point, staying with modem sleep");
+        }
+    } else if (id == WIFI_EVENT_ITWT_TEARDOWN) {
+        this_->RecordWake();
+    }
+#endif
+}
+
+std::string WifiPowerPolicy::GetMetricsJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "level", GetLevelName(level_));
+    cJSON_AddBoolToObject(root, "twt_active", twt_active_);
+    cJSON_AddBoolToObject(root, "twt_rejected", twt_rejected_);
+    cJSON_AddNumberToObject(root, "twt_setups", twt_setups_);
+    cJSON_AddNumberToObject(root, "wakes", wakes_);
+    cJSON_AddNumberToObject(root, "last_wake_us", last_wake_us_);
+    cJSON_AddNumberToObject(root, "max_wake_us", max_wake_us_);
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
@@ -0,0 +1,78 @@
+#ifndef WIFI_POWER_POLICY_H
+#define WIFI_POWER_POLICY_H
+
+#include <esp_event.h>
+
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+// Service period of the idle TWT agreement, the station sleeps in between (Wi-Fi 6 access points)
+#define WIFI_POWER_TWT_INTERVAL_MS 1000
+// Minimum awake time per service period, in units of 256 us
+#define WIFI_POWER_TWT_MIN_WAKE_DURATION 255
+#define WIFI_POWER_TWT_FLOW_ID 0
+#define WIFI_POWER_TWT_SETUP_TIMEOUT_MS 5000
+
+enum WifiPowerLevel {
+    kWifiPowerUnset,
+    kWifiPowerLatency,      // WIFI_PS_NONE, the receiver is always on
+    kWifiPowerIdle,         // WIFI_PS_MAX_MODEM, TWT when the access point offers it
+};
+
+/*
+ * Wi-Fi power save that follows the device state, instead of the on/off
+ * switch of the audio channel.
+ *
+ * Idle, the station sleeps as deep as the link allows: maximum modem sleep
+ * wakes for a beacon only every listen interval, skipping DTIMs, and on
+ * chips with Wi-Fi 6 (ESP32-C6) an individual Target Wake Time agreement
+ * lets it sleep through whole service periods. From the moment the device
+ * starts connecting for a conversation the agreement is torn down and power
+ * save is off, so the turn pays no wake-up delay on the radio.
+ *
+ * The time the switch to the latency level takes, up to the teardown of the
+ * TWT agreement, is measured and reported with the network metrics. An
+ * access point that rejects TWT is not asked again until the next connection.
+ */
+class WifiPowerPolicy {
+public:
+    static WifiPowerPolicy& GetInstance() {
+        static WifiPowerPolicy instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    WifiPowerPolicy(const WifiPowerPolicy&) = delete;
+    WifiPowerPolicy& operator=(const WifiPowerPolicy&) = delete;
+
+    // After the station connected the first time, subscribes to the device state
+    void Start();
+    // Any task
+    void SetLevel(WifiPowerLevel level);
+    // The station (re)associated, agreements with the previous access point are gone
+    void OnConnected();
+    std::string GetMetricsJson();
+
+private:
+    WifiPowerPolicy() = default;
+
+    std::mutex mutex_;
+    bool started_ = false;
+    WifiPowerLevel level_ = kWifiPowerUnset;
+    bool twt_active_ = false;
+    bool twt_pending_ = false;
+    bool twt_rejected_ = false;
+    uint32_t twt_setups_ = 0;
+    // Switches to the latency level and how long they took
+    int64_t wake_start_us_ = 0;
+    uint32_t wakes_ = 0;
+    int64_t last_wake_us_ = 0;
+    int64_t max_wake_us_ = 0;
+
+    void Apply(WifiPowerLevel level);
+    void SetupTwt();
+    void RecordWake();
+    static void OnWifiEvent(void* arg, esp_event_base_t base, int32_t id, void* data);
+};
+
+#endif // WIFI_POWER_POLICY_H
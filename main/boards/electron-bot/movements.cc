@@ -1,6 +1,7 @@
 #include "movements.h"
 
 #include <algorithm>
+#include <cmath>
 #include <cstring>
 
 #include "oscillator.h"
@@ -77,35 +78,29 @@ void Otto::SetTrims(int right_pitch, int right_roll, int left_pitch, int left_ro
 ///////////////////////////////////////////////////////////////////
 //-- BASIC MOTION FUNCTIONS -------------------------------------//
 ///////////////////////////////////////////////////////////////////
+// 轨迹按经过的时间计算，系统负载造成的延迟不会累积成误差
 void Otto::MoveServos(int time, int servo_target[]) {
     if (GetRestState() == true) {
         SetRestState(false);
     }
 
-    final_time_ = millis() + time;
-    if (time > 10) {
-        for (int i = 0; i < SERVO_COUNT; i++) {
-            if (servo_pins_[i] != -1) {
-                increment_[i] = (servo_target[i] - servo_[i].GetPosition()) / (time / 10.0);
-            }
-        }
+    int start[SERVO_COUNT];
+    for (int i = 0; i < SERVO_COUNT; i++) {
+        start[i] = servo_[i].GetPosition();
+    }
 
-        for (int iteration = 1; millis() < final_time_; iteration++) {
-            partial_time_ = millis() + 10;
-            for (int i = 0; i < SERVO_COUNT; i++) {
-                if (servo_pins_[i] != -1) {
-                    servo_[i].SetPosition(servo_[i].GetPosition() + increment_[i]);
-                }
-            }
-            vTaskDelay(pdMS_TO_TICKS(10));
-        }
-    } else {
+    unsigned long start_time = millis();
+    TickType_t last_wake = xTaskGetTickCount();
+    for (unsigned long elapsed = 0; elapsed < (unsigned long)time; elapsed = millis() - start_time) {
+        // smoothstep: 起止速度为零，前后动作衔接时不会突然加速
+        float t = (float)elapsed / time;
+        float eased = t * t * (3 - 2 * t);
         for (int i = 0; i < SERVO_COUNT; i++) {
             if (servo_pins_[i] != -1) {
-                servo_[i].SetPosition(servo_target[i]);
+                servo_[i].SetPosition(start[i] + std::lround((servo_target[i] - start[i]) * eased));
             }
         }
-        vTaskDelay(pdMS_TO_TICKS(time));
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(MOTION_TICK_MS));
     }
 
     // final adjustment to the target.
@@ -157,18 +152,28 @@ void Otto::OscillateServos(int amplitude[SERVO_COUNT], int offset[SERVO_COUNT],
         }
     }
 
-    double ref = millis();
-    double end_time = period * cycle + ref;
+    int start[SERVO_COUNT];
+    for (int i = 0; i < SERVO_COUNT; i++) {
+        start[i] = servo_[i].GetPosition();
+    }
 
-    while (millis() < end_time) {
+    unsigned long duration = period * cycle;
+    unsigned long blend = std::min<unsigned long>(MOTION_BLEND_MS, duration / 2);
+    unsigned long start_time = millis();
+    TickType_t last_wake = xTaskGetTickCount();
+    for (unsigned long elapsed = 0; elapsed < duration; elapsed = millis() - start_time) {
         for (int i = 0; i < SERVO_COUNT; i++) {
             if (servo_pins_[i] != -1) {
-                servo_[i].Refresh();
+                int position = servo_[i].SampleAt(elapsed);
+                // 开始时从当前姿态混合到振荡轨迹，避免舵机跳变
+                if (elapsed < blend) {
+                    position = start[i] + (position - start[i]) * (long)elapsed / (long)blend;
+                }
+                servo_[i].SetPosition(position);
             }
         }
-        vTaskDelay(5);
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(MOTION_TICK_MS));
     }
-    vTaskDelay(pdMS_TO_TICKS(10));
 }
 
 void Otto::Execute(int amplitude[SERVO_COUNT], int offset[SERVO_COUNT], int period,
@@ -177,16 +182,8 @@ void Otto::Execute(int amplitude[SERVO_COUNT], int offset[SERVO_COUNT], int peri
         SetRestState(false);
     }
 
-    int cycles = (int)steps;
-
-    //-- Execute complete cycles
-    if (cycles >= 1)
-        for (int i = 0; i < cycles; i++)
-            OscillateServos(amplitude, offset, period, phase_diff);
-
-    //-- Execute the final not complete cycle
-    OscillateServos(amplitude, offset, period, phase_diff, (float)steps - cycles);
-    vTaskDelay(pdMS_TO_TICKS(10));
+    //-- All cycles, including the final not complete one, on one time base
+    OscillateServos(amplitude, offset, period, phase_diff, steps);
 }
 
 ///////////////////////////////////////////////////////////////////
@@ -21,6 +21,11 @@
 // -- Servo delta limit default. degree / sec
 #define SERVO_LIMIT_DEFAULT 240
 
+// -- 所有舵机在同一个节拍里更新 (ms)
+#define MOTION_TICK_MS 10
+// -- 振荡开始时从当前姿态过渡到振荡轨迹的时间 (ms)
+#define MOTION_BLEND_MS 200
+
 // -- Servo indexes for easy access
 #define RIGHT_PITCH 0
 #define RIGHT_ROLL 1
@@ -76,9 +81,6 @@ private:
     int servo_trim_[SERVO_COUNT];
     int servo_initial_[SERVO_COUNT] = {180, 180, 0, 0, 90, 90};
 
-    unsigned long final_time_;
-    unsigned long partial_time_;
-    float increment_[SERVO_COUNT];
 
     bool is_otto_resting_;
 
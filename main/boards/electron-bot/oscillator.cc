@@ -124,6 +124,18 @@ void Oscillator::Refresh() {
     }
 }
 
+// 振荡开始后 elapsed_ms 时刻的位置，只取决于时间，与刷新的时机无关
+int Oscillator::SampleAt(long elapsed_ms) {
+    if (stop_) {
+        return pos_;
+    }
+    double phase = 2 * M_PI * elapsed_ms / period_ + phase0_;
+    int pos = std::round(amplitude_ * std::sin(phase) + offset_);
+    if (rev_)
+        pos = -pos;
+    return pos + 90;
+}
+
 void Oscillator::Write(int position) {
     if (!is_attached_)
         return;
@@ -7,6 +7,8 @@
 #define AUDIO_OUTPUT_SAMPLE_RATE 24000
 
 #define AUDIO_INPUT_REFERENCE    true
+// ES7210 slots with a microphone, listing both mics of the array (e.g. {0, 2}) lets the AFE beamform
+#define AUDIO_INPUT_MIC_SLOTS    {0}
 
 #define AUDIO_I2S_GPIO_MCLK GPIO_NUM_2
 #define AUDIO_I2S_GPIO_WS GPIO_NUM_45
@@ -140,6 +140,7 @@ void AdcPdmAudioCodec::EnableInput(bool enable) {
             .mclk_multiple = 0,
         };
         ESP_ERROR_CHECK(esp_codec_dev_open(input_dev_, &fs));
+        dc_filter_.Reset();
     } else {
         ESP_ERROR_CHECK(esp_codec_dev_close(input_dev_));
     }
@@ -174,9 +175,14 @@ void AdcPdmAudioCodec::EnableOutput(bool enable) {
     AudioCodec::EnableOutput(enable);
 }
 
+// The ADC driver converts straight into the caller's buffer, the offset is removed there in place
 int AdcPdmAudioCodec::Read(int16_t* dest, int samples) {
     if (input_enabled_) {
-        ESP_ERROR_CHECK_WITHOUT_ABORT(esp_codec_dev_read(input_dev_, (void*)dest, samples * sizeof(int16_t)));
+        if (esp_codec_dev_read(input_dev_, (void*)dest, samples * sizeof(int16_t)) != ESP_CODEC_DEV_OK) {
+            ESP_LOGE(TAG, "Read failed");
+            return samples;
+        }
+        dc_filter_.Process(dest, samples);
     }
     return samples;
 }
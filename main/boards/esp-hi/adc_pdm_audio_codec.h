@@ -2,6 +2,7 @@
 #define _BOX_AUDIO_CODEC_H
 
 #include "audio_codec.h"
+#include "sample_format.h"
 
 #include <esp_codec_dev.h>
 #include <esp_codec_dev_defaults.h>
@@ -11,6 +12,8 @@ private:
     esp_codec_dev_handle_t output_dev_ = nullptr;
     esp_codec_dev_handle_t input_dev_ = nullptr;
     gpio_num_t pa_ctrl_pin_ = GPIO_NUM_NC;
+    // The ADC microphone rides on its bias voltage, the AFE expects audio around zero
+    DcFilter dc_filter_;
 
     virtual int Read(int16_t* dest, int samples) override;
     virtual int Write(const int16_t* data, int samples) override;
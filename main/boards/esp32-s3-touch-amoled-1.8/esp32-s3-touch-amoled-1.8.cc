@@ -9,7 +9,10 @@
 #include "led/single_led.h"
 #include "mcp_server.h"
 #include "config.h"
+#include "touch_input.h"
+#include "assets/lang_config.h"
 #include "power_save_timer.h"
+#include "power_monitor.h"
 #include "axp2101.h"
 #include "i2c_device.h"
 #include <wifi_station.h>
@@ -127,10 +130,24 @@ private:
     i2c_master_bus_handle_t codec_i2c_bus_;
     Pmic* pmic_ = nullptr;
     Button boot_button_;
+    TouchInput* touch_input_ = nullptr;
     CustomLcdDisplay* display_;
     CustomBacklight* backlight_;
     esp_io_expander_handle_t io_expander = NULL;
     PowerSaveTimer* power_save_timer_;
+    PowerMonitor* power_monitor_ = nullptr;
+
+    void InitializePowerMonitor() {
+        power_monitor_ = new PowerMonitor([this](PowerState& state) {
+            state.charging = pmic_->IsCharging();
+            state.discharging = pmic_->IsDischarging();
+            state.level = pmic_->GetBatteryLevel();
+            return true;
+        });
+        power_monitor_->OnChanged([this](const PowerState& state) {
+            power_save_timer_->SetEnabled(state.discharging);
+        });
+    }
 
     void InitializePowerSaveTimer() {
         power_save_timer_ = new PowerSaveTimer(-1, 60, 300);
@@ -280,11 +297,29 @@ private:
         ESP_ERROR_CHECK(esp_lcd_new_panel_io_i2c(codec_i2c_bus_, &tp_io_config, &tp_io_handle));
         ESP_LOGI(TAG, "Initialize touch controller");
         ESP_ERROR_CHECK(esp_lcd_touch_new_i2c_ft5x06(tp_io_handle, &tp_cfg, &tp));
-        const lvgl_port_touch_cfg_t touch_cfg = {
-            .disp = lv_display_get_default(), 
-            .handle = tp,
-        };
-        lvgl_port_add_touch(&touch_cfg);
+        // 触摸不经过 LVGL，由 TouchInput 直接识别手势
+        touch_input_ = new TouchInput(tp);
+        touch_input_->OnTap([this]() {
+            auto& app = Application::GetInstance();
+            if (app.GetDeviceState() == kDeviceStateStarting && !WifiStation::GetInstance().IsConnected()) {
+                ResetWifiConfiguration();
+            }
+            app.ToggleChatState();
+        });
+        touch_input_->OnSwipe([this](TouchSwipe swipe) {
+            if (swipe != kTouchSwipeUp && swipe != kTouchSwipeDown) {
+                return;
+            }
+            auto codec = GetAudioCodec();
+            auto volume = codec->output_volume() + (swipe == kTouchSwipeUp ? 10 : -10);
+            if (volume > 100) {
+                volume = 100;
+            } else if (volume < 0) {
+                volume = 0;
+            }
+            codec->SetOutputVolume(volume);
+            GetDisplay()->QueueNotification(Lang::Strings::VOLUME + std::to_string(volume));
+        });
         ESP_LOGI(TAG, "Touch panel initialized successfully");
     }
 
@@ -307,6 +342,7 @@ public:
         InitializeCodecI2c();
         InitializeTca9554();
         InitializeAxp2101();
+        InitializePowerMonitor();
         InitializeSpi();
         InitializeSH8601Display();
         InitializeTouch();
@@ -330,15 +366,10 @@ public:
     }
 
     virtual bool GetBatteryLevel(int &level, bool& charging, bool& discharging) override {
-        static bool last_discharging = false;
-        charging = pmic_->IsCharging();
-        discharging = pmic_->IsDischarging();
-        if (discharging != last_discharging) {
-            power_save_timer_->SetEnabled(discharging);
-            last_discharging = discharging;
-        }
-
-        level = pmic_->GetBatteryLevel();
+        auto state = power_monitor_->GetState();
+        level = state.level;
+        charging = state.charging;
+        discharging = state.discharging;
         return true;
     }
 
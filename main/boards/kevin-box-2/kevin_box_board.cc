@@ -7,6 +7,7 @@
 #include "iot/thing_manager.h"
 #include "config.h"
 #include "power_save_timer.h"
+#include "power_monitor.h"
 #include "axp2101.h"
 #include "assets/lang_config.h"
 
@@ -64,6 +65,19 @@ private:
     Button volume_up_button_;
     Button volume_down_button_;
     PowerSaveTimer* power_save_timer_;
+    PowerMonitor* power_monitor_ = nullptr;
+
+    void InitializePowerMonitor() {
+        power_monitor_ = new PowerMonitor([this](PowerState& state) {
+            state.charging = pmic_->IsCharging();
+            state.discharging = pmic_->IsDischarging();
+            state.level = pmic_->GetBatteryLevel();
+            return true;
+        });
+        power_monitor_->OnChanged([this](const PowerState& state) {
+            power_save_timer_->SetEnabled(state.discharging);
+        });
+    }
 
     void InitializePowerSaveTimer() {
         power_save_timer_ = new PowerSaveTimer(-1, -1, 600);
@@ -250,6 +264,7 @@ public:
 
         InitializeButtons();
         InitializePowerSaveTimer();
+        InitializePowerMonitor();
         InitializeIot();
     }
 
@@ -270,15 +285,10 @@ public:
     }
 
     virtual bool GetBatteryLevel(int &level, bool& charging, bool& discharging) override {
-        static bool last_discharging = false;
-        charging = pmic_->IsCharging();
-        discharging = pmic_->IsDischarging();
-        if (discharging != last_discharging) {
-            power_save_timer_->SetEnabled(discharging);
-            last_discharging = discharging;
-        }
-
-        level = pmic_->GetBatteryLevel();
+        auto state = power_monitor_->GetState();
+        level = state.level;
+        charging = state.charging;
+        discharging = state.discharging;
         return true;
     }
 };
@@ -5,6 +5,7 @@
 #include "button.h"
 #include "config.h"
 #include "power_save_timer.h"
+#include "power_monitor.h"
 #include "i2c_device.h"
 #include "iot/thing_manager.h"
 #include "sy6970.h"
@@ -78,8 +79,21 @@ private:
     Button boot_button_;
     Button key1_button_;
     PowerSaveTimer* power_save_timer_;
+    PowerMonitor* power_monitor_ = nullptr;
     Esp32Camera* camera_;
 
+    void InitializePowerMonitor() {
+        power_monitor_ = new PowerMonitor([this](PowerState& state) {
+            state.charging = pmic_->IsCharging();
+            state.discharging = !state.charging && pmic_->IsPowerGood();
+            state.level = pmic_->GetBatteryLevel();
+            return true;
+        });
+        power_monitor_->OnChanged([this](const PowerState& state) {
+            power_save_timer_->SetEnabled(state.discharging);
+        });
+    }
+
     void InitializePowerSaveTimer() {
         power_save_timer_ = new PowerSaveTimer(-1, 60, -1);
         power_save_timer_->OnEnterSleepMode([this]() {
@@ -282,6 +296,7 @@ public:
         InitializePowerSaveTimer();
         InitI2c();
         InitSy6970();
+        InitializePowerMonitor();
         InitCst816d();
         I2cDetect();
         InitSpi();
@@ -318,16 +333,10 @@ public:
     }
 
     virtual bool GetBatteryLevel(int &level, bool& charging, bool& discharging) override {
-        static bool last_discharging = false;
-        charging = pmic_->IsCharging();
-        bool is_power_good = pmic_->IsPowerGood();
-        discharging = !charging && is_power_good;
-        if (discharging != last_discharging) {
-            power_save_timer_->SetEnabled(discharging);
-            last_discharging = discharging;
-        }
-
-        level = pmic_->GetBatteryLevel();
+        auto state = power_monitor_->GetState();
+        level = state.level;
+        charging = state.charging;
+        discharging = state.discharging;
         return true;
     }
 
@@ -4,9 +4,12 @@
 #include "application.h"
 #include "config.h"
 #include "power_save_timer.h"
+#include "power_monitor.h"
 #include "i2c_device.h"
 #include "iot/thing_manager.h"
 #include "axp2101.h"
+#include "touch_input.h"
+#include "assets/lang_config.h"
 
 #include <esp_log.h>
 #include <driver/i2c_master.h>
@@ -14,7 +17,6 @@
 #include <esp_lcd_panel_io.h>
 #include <esp_lcd_panel_ops.h>
 #include <esp_lcd_ili9341.h>
-#include <esp_timer.h>
 #include "esp32_camera.h"
 
 
@@ -133,8 +135,21 @@ private:
     Ft6336* ft6336_;
     LcdDisplay* display_;
     Esp32Camera* camera_;
-    esp_timer_handle_t touchpad_timer_;
+    TouchInput* touch_input_;
     PowerSaveTimer* power_save_timer_;
+    PowerMonitor* power_monitor_ = nullptr;
+
+    void InitializePowerMonitor() {
+        power_monitor_ = new PowerMonitor([this](PowerState& state) {
+            state.charging = pmic_->IsCharging();
+            state.discharging = pmic_->IsDischarging();
+            state.level = pmic_->GetBatteryLevel();
+            return true;
+        });
+        power_monitor_->OnChanged([this](const PowerState& state) {
+            power_save_timer_->SetEnabled(state.discharging);
+        });
+    }
 
     void InitializePowerSaveTimer() {
         power_save_timer_ = new PowerSaveTimer(-1, 60, 300);
@@ -206,54 +221,40 @@ private:
         vTaskDelay(pdMS_TO_TICKS(50));
     }
 
-    void PollTouchpad() {
-        static bool was_touched = false;
-        static int64_t touch_start_time = 0;
-        const int64_t TOUCH_THRESHOLD_MS = 500;  // 触摸时长阈值，超过500ms视为长按
-        
-        ft6336_->UpdateTouchPoint();
-        auto& touch_point = ft6336_->GetTouchPoint();
-        
-        // 检测触摸开始
-        if (touch_point.num > 0 && !was_touched) {
-            was_touched = true;
-            touch_start_time = esp_timer_get_time() / 1000; // 转换为毫秒
-        } 
-        // 检测触摸释放
-        else if (touch_point.num == 0 && was_touched) {
-            was_touched = false;
-            int64_t touch_duration = (esp_timer_get_time() / 1000) - touch_start_time;
-            
-            // 只有短触才触发
-            if (touch_duration < TOUCH_THRESHOLD_MS) {
-                auto& app = Application::GetInstance();
-                if (app.GetDeviceState() == kDeviceStateStarting && 
-                    !WifiStation::GetInstance().IsConnected()) {
-                    ResetWifiConfiguration();
-                }
-                app.ToggleChatState();
-            }
-        }
-    }
-
     void InitializeFt6336TouchPad() {
         ESP_LOGI(TAG, "Init FT6336");
         ft6336_ = new Ft6336(i2c_bus_, 0x38);
-        
-        // 创建定时器，20ms 间隔
-        esp_timer_create_args_t timer_args = {
-            .callback = [](void* arg) {
-                M5StackCoreS3Board* board = (M5StackCoreS3Board*)arg;
-                board->PollTouchpad();
-            },
-            .arg = this,
-            .dispatch_method = ESP_TIMER_TASK,
-            .name = "touchpad_timer",
-            .skip_unhandled_events = true,
-        };
-        
-        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &touchpad_timer_));
-        ESP_ERROR_CHECK(esp_timer_start_periodic(touchpad_timer_, 20 * 1000));
+
+        // FT6336 的 INT 脚没有接到 ESP32，由 TouchInput 轮询
+        touch_input_ = new TouchInput([this](uint16_t& x, uint16_t& y) {
+            ft6336_->UpdateTouchPoint();
+            auto& touch_point = ft6336_->GetTouchPoint();
+            x = touch_point.x;
+            y = touch_point.y;
+            return touch_point.num > 0;
+        });
+        touch_input_->OnTap([this]() {
+            auto& app = Application::GetInstance();
+            if (app.GetDeviceState() == kDeviceStateStarting &&
+                !WifiStation::GetInstance().IsConnected()) {
+                ResetWifiConfiguration();
+            }
+            app.ToggleChatState();
+        });
+        touch_input_->OnSwipe([this](TouchSwipe swipe) {
+            if (swipe != kTouchSwipeUp && swipe != kTouchSwipeDown) {
+                return;
+            }
+            auto codec = GetAudioCodec();
+            auto volume = codec->output_volume() + (swipe == kTouchSwipeUp ? 10 : -10);
+            if (volume > 100) {
+                volume = 100;
+            } else if (volume < 0) {
+                volume = 0;
+            }
+            codec->SetOutputVolume(volume);
+            GetDisplay()->QueueNotification(Lang::Strings::VOLUME + std::to_string(volume));
+        });
     }
 
     void InitializeSpi() {
@@ -355,6 +356,7 @@ public:
         InitializePowerSaveTimer();
         InitializeI2c();
         InitializeAxp2101();
+        InitializePowerMonitor();
         InitializeAw9523();
         I2cDetect();
         InitializeSpi();
@@ -389,15 +391,10 @@ public:
     }
 
     virtual bool GetBatteryLevel(int &level, bool& charging, bool& discharging) override {
-        static bool last_discharging = false;
-        charging = pmic_->IsCharging();
-        discharging = pmic_->IsDischarging();
-        if (discharging != last_discharging) {
-            power_save_timer_->SetEnabled(discharging);
-            last_discharging = discharging;
-        }
-
-        level = pmic_->GetBatteryLevel();
+        auto state = power_monitor_->GetState();
+        level = state.level;
+        charging = state.charging;
+        discharging = state.discharging;
         return true;
     }
 
@@ -8,6 +8,8 @@
 #include "button.h"
 #include "config.h"
 #include "iot/thing_manager.h"
+#include "touch_input.h"
+#include "assets/lang_config.h"
 
 #include <esp_log.h>
 #include "esp_lcd_mipi_dsi.h"
@@ -85,6 +87,7 @@ private:
     Pi4ioe1* pi4ioe1_;
     Pi4ioe2* pi4ioe2_;
     esp_lcd_touch_handle_t touch_ = nullptr;
+    TouchInput* touch_input_ = nullptr;
 
     void InitializeI2c()
     {
@@ -171,15 +174,29 @@ private:
         esp_lcd_new_panel_io_i2c(i2c_bus_, &tp_io_config, &tp_io_handle);
         esp_lcd_touch_new_i2c_gt911(tp_io_handle, &tp_cfg, &touch_);
 
-        // 检测不到触摸？待更换设备测试
-        // /* read data test */ 
-        // for (uint8_t i = 0; i < 50; i++) {
-        //     esp_lcd_touch_read_data(touch_);
-        //     if (touch_->data.points > 0) {
-        //         printf("\ntouch: %d, %d\n", touch_->data.coords[0].x, touch_->data.coords[0].y);
-        //     }
-        //     vTaskDelay(pdMS_TO_TICKS(100));
-        // }
+        if (touch_ == nullptr) {
+            ESP_LOGE(TAG, "GT911 not found");
+            return;
+        }
+
+        touch_input_ = new TouchInput(touch_);
+        touch_input_->OnTap([this]() {
+            Application::GetInstance().ToggleChatState();
+        });
+        touch_input_->OnSwipe([this](TouchSwipe swipe) {
+            if (swipe != kTouchSwipeUp && swipe != kTouchSwipeDown) {
+                return;
+            }
+            auto codec = GetAudioCodec();
+            auto volume = codec->output_volume() + (swipe == kTouchSwipeUp ? 10 : -10);
+            if (volume > 100) {
+                volume = 100;
+            } else if (volume < 0) {
+                volume = 0;
+            }
+            codec->SetOutputVolume(volume);
+            GetDisplay()->QueueNotification(Lang::Strings::VOLUME + std::to_string(volume));
+        });
     }
 
     void InitializeSpi() {
@@ -39,6 +39,7 @@ public:
     void Play() { stop_ = false; };
     void Reset() { phase_ = 0; };
     void Refresh();
+    int SampleAt(long elapsed_ms);
     int GetPosition() { return pos_; }
 
 private:
@@ -53,8 +53,7 @@ OttoEmojiDisplay::OttoEmojiDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_p
                                    int width, int height, int offset_x, int offset_y, bool mirror_x,
                                    bool mirror_y, bool swap_xy, DisplayFonts fonts)
     : SpiLcdDisplay(panel_io, panel, width, height, offset_x, offset_y, mirror_x, mirror_y, swap_xy,
-                    fonts),
-      emotion_gif_(nullptr) {
+                    fonts) {
     SetupGifContainer();
 };
 
@@ -86,13 +85,17 @@ void OttoEmojiDisplay::SetupGifContainer() {
     lv_obj_set_style_border_width(emotion_label_, 0, 0);
     lv_obj_add_flag(emotion_label_, LV_OBJ_FLAG_HIDDEN);
 
-    emotion_gif_ = lv_gif_create(content_);
+    // 透明像素在解码时与深色主题的黑色背景混合
+    emotion_animation_ = std::make_unique<EmojiAnimation>(content_, lv_color_black());
+    auto emotion_image = emotion_animation_->object();
     int gif_size = LV_HOR_RES;
-    lv_obj_set_size(emotion_gif_, gif_size, gif_size);
-    lv_obj_set_style_border_width(emotion_gif_, 0, 0);
-    lv_obj_set_style_bg_opa(emotion_gif_, LV_OPA_TRANSP, 0);
-    lv_obj_center(emotion_gif_);
-    lv_gif_set_src(emotion_gif_, &staticstate);
+    lv_obj_set_size(emotion_image, gif_size, gif_size);
+    lv_obj_set_style_border_width(emotion_image, 0, 0);
+    lv_obj_set_style_bg_opa(emotion_image, LV_OPA_TRANSP, 0);
+    lv_obj_center(emotion_image);
+    emotion_animation_->SetSource(&staticstate);
+    // 表情一直在播放，空闲时也保持高帧率
+    SetRefreshHint(kRefreshHintAnimation, true);
 
     chat_message_label_ = lv_label_create(content_);
     lv_label_set_text(chat_message_label_, "");
@@ -112,7 +115,7 @@ void OttoEmojiDisplay::SetupGifContainer() {
 }
 
 void OttoEmojiDisplay::SetEmotion(const char* emotion) {
-    if (!emotion || !emotion_gif_) {
+    if (!emotion || !emotion_animation_) {
         return;
     }
 
@@ -120,13 +123,13 @@ void OttoEmojiDisplay::SetEmotion(const char* emotion) {
 
     for (const auto& map : emotion_maps_) {
         if (map.name && strcmp(map.name, emotion) == 0) {
-            lv_gif_set_src(emotion_gif_, map.gif);
+            emotion_animation_->SetSource(map.gif);
             ESP_LOGI(TAG, "设置表情: %s", emotion);
             return;
         }
     }
 
-    lv_gif_set_src(emotion_gif_, &staticstate);
+    emotion_animation_->SetSource(&staticstate);
     ESP_LOGI(TAG, "未知表情'%s'，使用默认", emotion);
 }
 
@@ -1,8 +1,9 @@
 #pragma once
 
-#include <libs/gif/lv_gif.h>
+#include <memory>
 
 #include "display/lcd_display.h"
+#include "display/emoji_animation.h"
 #include "otto_emoji_gif.h"
 
 /**
@@ -32,7 +33,7 @@ public:
 private:
     void SetupGifContainer();
 
-    lv_obj_t* emotion_gif_;  ///< GIF表情组件
+    std::unique_ptr<EmojiAnimation> emotion_animation_;  ///< GIF表情组件，帧缓存在PSRAM
 
     // 表情映射
     struct EmotionMap {
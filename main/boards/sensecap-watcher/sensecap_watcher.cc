@@ -11,6 +11,7 @@
 #include "iot/thing_manager.h"
 #include "power_save_timer.h"
 #include "sscma_camera.h"
+#include "mcp_server.h"
 
 #include <esp_log.h>
 #include "esp_check.h"
@@ -198,10 +199,11 @@ private:
         assert(ret == ESP_OK);
     }
 
-    void OnKnobRotate(bool clockwise) {
+    // Steps come added up and accelerated, at most every KNOB_UPDATE_INTERVAL_MS
+    void OnKnobRotate(int steps) {
         auto codec = GetAudioCodec();
         int current_volume = codec->output_volume();
-        int new_volume = current_volume + (clockwise ? -5 : 5); 
+        int new_volume = current_volume - steps * 5;
 
         // 确保音量在有效范围内
         if (new_volume > 100) {
@@ -226,9 +228,9 @@ private:
 
     void InitializeKnob() {
         knob_ = std::make_unique<Knob>(BSP_KNOB_A_PIN, BSP_KNOB_B_PIN);
-        knob_->OnRotate([this](bool clockwise) {
-            ESP_LOGD(TAG, "Knob rotation detected. Clockwise:%s", clockwise ? "true" : "false");
-            OnKnobRotate(clockwise);
+        knob_->OnRotateSteps([this](int steps) {
+            ESP_LOGD(TAG, "Knob rotated by %d steps", steps);
+            OnKnobRotate(steps);
         });
         ESP_LOGI(TAG, "Knob initialized with pins A:%d B:%d", BSP_KNOB_A_PIN, BSP_KNOB_B_PIN);
     }
@@ -537,6 +539,35 @@ private:
         camera_ = new SscmaCamera(io_exp_handle);
     }
 
+    void InitializeTools() {
+        auto& mcp_server = McpServer::GetInstance();
+        mcp_server.AddTool("self.camera.detect",
+            "Run an object detection model on the camera module itself, instead of uploading photos. While "
+            "enabled the device sends a notifications/vision_detected message with the classes, scores and boxes "
+            "of what it sees whenever that changes, no image is uploaded. Take a photo only when the detections "
+            "are not enough to answer.\n"
+            "Args:\n"
+            "  `enabled`: Start or stop detection\n"
+            "  `model`: Model slot on the camera module\n"
+            "  `min_score`: Lowest confidence in percent that is reported\n"
+            "Return:\n"
+            "  The detection state, the classes of the model and how many reports were sent.",
+            PropertyList({
+                Property("enabled", kPropertyTypeBoolean),
+                Property("model", kPropertyTypeInteger, 1, 0, 4),
+                Property("min_score", kPropertyTypeInteger, 50, 1, 100)
+            }), [this](const PropertyList& properties) -> ReturnValue {
+                if (properties["enabled"].value<bool>()) {
+                    if (!camera_->StartDetection(properties["model"].value<int>(), properties["min_score"].value<int>())) {
+                        return "{\"success\": false, \"message\": \"Failed to start the model\"}";
+                    }
+                } else {
+                    camera_->StopDetection();
+                }
+                return camera_->GetDetectionStatusJson();
+            });
+    }
+
 public:
     SensecapWatcher() {
         ESP_LOGI(TAG, "Initialize Sensecap Watcher");
@@ -550,6 +581,7 @@ public:
         Initializespd2010Display();
         GetBacklight()->RestoreBrightness();  // 对于不带摄像头的版本，InitializeCamera需要3s, 所以先恢复背光亮度
         InitializeCamera();
+        InitializeTools();
         InitializeIot();
     }
 
@@ -1,13 +1,17 @@
 #include "sscma_camera.h"
-#include "mcp_server.h"
+#include "explain_request.h"
+#include "scene_change_detector.h"
 #include "display.h"
 #include "board.h"
-#include "system_info.h"
+#include "application.h"
 #include "config.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_heap_caps.h>
 #include <img_converters.h>
+#include <cJSON.h>
+#include <algorithm>
 #include <cstring>
 
 #define TAG "SscmaCamera"
@@ -50,6 +54,9 @@ SscmaCamera::SscmaCamera(esp_io_expander_handle_t io_exp_handle) {
     callback.on_event = [](sscma_client_handle_t client, const sscma_client_reply_t *reply, void *user_ctx) {
         SscmaCamera* self = static_cast<SscmaCamera*>(user_ctx);
         if (!self) return;
+        if (self->detecting_ && !self->paused_) {
+            self->OnDetection(reply);
+        }
         char *img = NULL;
         int img_size = 0;
         if (sscma_utils_fetch_image_from_reply(reply, &img, &img_size) == ESP_OK)
@@ -178,17 +185,30 @@ SscmaCamera::~SscmaCamera() {
     }
 }
 
-void SscmaCamera::SetExplainUrl(const std::string& url, const std::string& token) {
-    explain_url_ = url;
-    explain_token_ = token;
+// Fetches the newest JPEG from the Himax and decodes it into preview_image_. decoded is false when
+// only the JPEG is usable
+bool SscmaCamera::FetchImage(bool& decoded) {
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    bool paused = detecting_;
+    if (paused) {
+        paused_ = true;
+        sscma_client_break(sscma_client_handle_);
+    }
+    bool success = SampleImage(decoded);
+    if (paused) {
+        paused_ = false;
+        Invoke();
+    }
+    return success;
 }
 
-bool SscmaCamera::Capture() {
+bool SscmaCamera::SampleImage(bool& decoded) {
 
     SscmaData data;
     size_t output_len = 0;
     int ret = 0;
-    
+    decoded = false;
+
     if (sscma_client_handle_ == nullptr) {
         ESP_LOGE(TAG, "SSCMA client handle is not initialized");
         return false;
@@ -241,14 +261,44 @@ bool SscmaCamera::Capture() {
         ESP_LOGE(TAG, "Failed to decode JPEG image, ret: %d", ret);
         return true;
     }
+    decoded = true;
+    return true;
+}
+
+bool SscmaCamera::Capture() {
+    bool decoded;
+    if (!FetchImage(decoded)) {
+        return false;
+    }
 
     // 显示预览图片
     auto display = Board::GetInstance().GetDisplay();
-    if (display != nullptr) {
+    if (decoded && display != nullptr) {
         display->SetPreviewImage(&preview_image_);
     }
     return true;
 }
+
+bool SscmaCamera::CaptureLuma(uint8_t* luma, int width, int height) {
+    bool decoded;
+    if (!FetchImage(decoded) || !decoded) {
+        return false;
+    }
+    SceneChangeDetector::DownsampleRgb565((const uint8_t*)preview_image_.data, jpeg_out_->width, jpeg_out_->height,
+        false, luma, width, height);
+    return true;
+}
+
+// The Himax encodes the JPEG itself, quality is its own
+bool SscmaCamera::CaptureJpeg(std::vector<uint8_t>& jpeg, int quality) {
+    bool decoded;
+    if (!FetchImage(decoded)) {
+        return false;
+    }
+    jpeg.assign(jpeg_data_.buf, jpeg_data_.buf + jpeg_data_.len);
+    return true;
+}
+
 bool SscmaCamera::SetHMirror(bool enabled) {
     return false;
 }
@@ -276,67 +326,176 @@ bool SscmaCamera::SetVFlip(bool enabled) {
  */
 std::string SscmaCamera::Explain(const std::string& question) {
     if (explain_url_.empty()) {
-        return "{\"success\": false, \"message\": \"Image explain URL or token is not set\"}";
-    }
-
-    auto http = Board::GetInstance().CreateHttp();
-    // 构造multipart/form-data请求体
-    std::string boundary = "----ESP32_CAMERA_BOUNDARY";
-    
-    // 构造question字段
-    std::string question_field;
-    question_field += "--" + boundary + "\r\n";
-    question_field += "Content-Disposition: form-data; name=\"question\"\r\n";
-    question_field += "\r\n";
-    question_field += question + "\r\n";
-    
-    // 构造文件字段头部
-    std::string file_header;
-    file_header += "--" + boundary + "\r\n";
-    file_header += "Content-Disposition: form-data; name=\"file\"; filename=\"camera.jpg\"\r\n";
-    file_header += "Content-Type: image/jpeg\r\n";
-    file_header += "\r\n";
-    
-    // 构造尾部
-    std::string multipart_footer;
-    multipart_footer += "\r\n--" + boundary + "--\r\n";
-
-    // 配置HTTP客户端，使用分块传输编码
-    http->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
-    http->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
-    if (!explain_token_.empty()) {
-        http->SetHeader("Authorization", "Bearer " + explain_token_);
-    }
-    http->SetHeader("Content-Type", "multipart/form-data; boundary=" + boundary);
-    http->SetHeader("Transfer-Encoding", "chunked");
-    if (!http->Open("POST", explain_url_)) {
-        ESP_LOGE(TAG, "Failed to connect to explain URL");
-        return "{\"success\": false, \"message\": \"Failed to connect to explain URL\"}";
-    }
-    
-    // 第一块：question字段
-    http->Write(question_field.c_str(), question_field.size());
-    
-    // 第二块：文件字段头部
-    http->Write(file_header.c_str(), file_header.size());
-    
-    // 第三块：JPEG数据
-    http->Write((const char*)jpeg_data_.buf, jpeg_data_.len);
-
-    // 第四块：multipart尾部
-    http->Write(multipart_footer.c_str(), multipart_footer.size());
-    
-    // 结束块
-    http->Write("", 0);
-
-    if (http->GetStatusCode() != 200) {
-        ESP_LOGE(TAG, "Failed to upload photo, status code: %d", http->GetStatusCode());
-        return "{\"success\": false, \"message\": \"Failed to upload photo\"}";
-    }
-
-    std::string result = http->ReadAll();
-    http->Close();
+        return ExplainRequest::Error("Image explain URL or token is not set");
+    }
+
+    ExplainRequest request(explain_url_, explain_token_);
+    if (!request.Open(question)) {
+        return ExplainRequest::Error("Failed to connect to explain URL");
+    }
+    request.Write(jpeg_data_.buf, jpeg_data_.len);
+    std::string result = request.Finish();
 
     ESP_LOGI(TAG, "Explain image size=%d, question=%s\n%s", jpeg_data_.len, question.c_str(), result.c_str());
     return result;
 }
+
+bool SscmaCamera::Invoke() {
+    // Continuous, results only: without show the module sends no image with them
+    if (sscma_client_invoke(sscma_client_handle_, -1, false, false) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to invoke model %d", detection_model_);
+        return false;
+    }
+    return true;
+}
+
+bool SscmaCamera::StartDetection(int model, int min_score) {
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    if (sscma_client_handle_ == nullptr) {
+        return false;
+    }
+    if (detecting_) {
+        detecting_ = false;
+        sscma_client_break(sscma_client_handle_);
+    }
+    if (sscma_client_set_model(sscma_client_handle_, model) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to select model %d", model);
+        return false;
+    }
+
+    std::vector<std::string> class_names;
+    sscma_client_model_t* info = nullptr;
+    if (sscma_client_get_model(sscma_client_handle_, &info, false) == ESP_OK && info != nullptr) {
+        for (size_t i = 0; i < sizeof(info->classes) / sizeof(info->classes[0]) && info->classes[i] != nullptr; i++) {
+            class_names.push_back(info->classes[i]);
+        }
+        ESP_LOGI(TAG, "Model %d: %s, %u classes", model, info->name ? info->name : "unknown", class_names.size());
+    }
+    {
+        std::lock_guard<std::mutex> lock(detection_mutex_);
+        detection_model_ = model;
+        detection_min_score_ = min_score;
+        class_names_ = std::move(class_names);
+        last_detection_key_.clear();
+        last_report_us_ = 0;
+    }
+    detecting_ = true;
+    if (!Invoke()) {
+        detecting_ = false;
+        return false;
+    }
+    return true;
+}
+
+void SscmaCamera::StopDetection() {
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    if (!detecting_) {
+        return;
+    }
+    detecting_ = false;
+    sscma_client_break(sscma_client_handle_);
+}
+
+std::string SscmaCamera::GetClassName(int target) {
+    if (target >= 0 && target < (int)class_names_.size()) {
+        return class_names_[target];
+    }
+    return std::to_string(target);
+}
+
+// On the SSCMA process task, for every reply while detection runs
+void SscmaCamera::OnDetection(const sscma_client_reply_t* reply) {
+    sscma_client_box_t* boxes = nullptr;
+    int box_count = 0;
+    sscma_client_class_t* classes = nullptr;
+    int class_count = 0;
+    bool has_boxes = sscma_utils_fetch_boxes_from_reply(reply, &boxes, &box_count) == ESP_OK;
+    bool has_classes = !has_boxes && sscma_utils_fetch_classes_from_reply(reply, &classes, &class_count) == ESP_OK;
+    if (!has_boxes && !has_classes) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(detection_mutex_);
+    detection_results_++;
+    auto objects = cJSON_CreateArray();
+    // Classes of the objects found, sorted, to tell a changed scene from the same one detected again
+    std::vector<int> targets;
+    for (int i = 0; i < box_count && cJSON_GetArraySize(objects) < SSCMA_DETECTION_MAX_OBJECTS; i++) {
+        if (boxes[i].score < detection_min_score_) {
+            continue;
+        }
+        auto object = cJSON_CreateObject();
+        cJSON_AddStringToObject(object, "class", GetClassName(boxes[i].target).c_str());
+        cJSON_AddNumberToObject(object, "score", boxes[i].score);
+        // Center and size in pixels of the 640x480 frame
+        int box[] = { boxes[i].x, boxes[i].y, boxes[i].w, boxes[i].h };
+        cJSON_AddItemToObject(object, "box", cJSON_CreateIntArray(box, 4));
+        cJSON_AddItemToArray(objects, object);
+        targets.push_back(boxes[i].target);
+    }
+    for (int i = 0; i < class_count && cJSON_GetArraySize(objects) < SSCMA_DETECTION_MAX_OBJECTS; i++) {
+        if (classes[i].score < detection_min_score_) {
+            continue;
+        }
+        auto object = cJSON_CreateObject();
+        cJSON_AddStringToObject(object, "class", GetClassName(classes[i].target).c_str());
+        cJSON_AddNumberToObject(object, "score", classes[i].score);
+        cJSON_AddItemToArray(objects, object);
+        targets.push_back(classes[i].target);
+    }
+    if (boxes != nullptr) {
+        free(boxes);
+    }
+    if (classes != nullptr) {
+        free(classes);
+    }
+
+    std::sort(targets.begin(), targets.end());
+    std::string key;
+    for (auto target : targets) {
+        key += std::to_string(target) + ",";
+    }
+    int64_t now = esp_timer_get_time();
+    if (key == last_detection_key_ || now - last_report_us_ < SSCMA_DETECTION_MIN_INTERVAL_MS * 1000LL) {
+        cJSON_Delete(objects);
+        return;
+    }
+    last_detection_key_ = key;
+    last_report_us_ = now;
+
+    auto root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "jsonrpc", "2.0");
+    cJSON_AddStringToObject(root, "method", "notifications/vision_detected");
+    auto params = cJSON_CreateObject();
+    cJSON_AddNumberToObject(params, "model", detection_model_);
+    cJSON_AddItemToObject(params, "objects", objects);
+    cJSON_AddItemToObject(root, "params", params);
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string payload(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    detection_reports_++;
+    detection_bytes_ += payload.size();
+    Application::GetInstance().SendMcpMessage(std::move(payload));
+}
+
+std::string SscmaCamera::GetDetectionStatusJson() {
+    std::lock_guard<std::mutex> lock(detection_mutex_);
+    auto root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "detecting", detecting_);
+    cJSON_AddNumberToObject(root, "model", detection_model_);
+    cJSON_AddNumberToObject(root, "min_score", detection_min_score_);
+    auto classes = cJSON_CreateArray();
+    for (auto& name : class_names_) {
+        cJSON_AddItemToArray(classes, cJSON_CreateString(name.c_str()));
+    }
+    cJSON_AddItemToObject(root, "classes", classes);
+    cJSON_AddNumberToObject(root, "results", detection_results_);
+    cJSON_AddNumberToObject(root, "reports", detection_reports_);
+    cJSON_AddNumberToObject(root, "report_bytes", detection_bytes_);
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
@@ -4,6 +4,10 @@
 #include <lvgl.h>
 #include <thread>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
@@ -14,6 +18,10 @@
 #include "sscma_client.h"
 #include "camera.h"
 
+// Local inference: results go to the server when they change, at most this often
+#define SSCMA_DETECTION_MIN_INTERVAL_MS 1000
+#define SSCMA_DETECTION_MAX_OBJECTS 10
+
 struct SscmaData {
     uint8_t* img;
     size_t len;
@@ -23,11 +31,20 @@ struct JpegData {
     size_t len;
 };
 
+/*
+ * Camera of the SenseCAP Watcher, a Himax module running SSCMA.
+ *
+ * Besides JPEG captures for explanation, the module can run a detection
+ * model itself. While detection runs, the module invokes the model
+ * continuously and replies with boxes or classes only, no image; the
+ * results above min_score are sent to the server as a few hundred bytes of
+ * notifications/vision_detected, and only when the set of detected classes
+ * changed. A photo is still taken when the server asks for one, detection
+ * pauses for the capture.
+ */
 class SscmaCamera : public Camera {
 private:
     lv_img_dsc_t preview_image_;
-    std::string explain_url_;
-    std::string explain_token_;
     sscma_client_io_handle_t sscma_client_io_handle_;
     sscma_client_handle_t sscma_client_handle_;
     QueueHandle_t sscma_data_queue_;
@@ -35,16 +52,42 @@ private:
     jpeg_dec_handle_t *jpeg_dec_;
     jpeg_dec_io_t *jpeg_io_;
     jpeg_dec_header_info_t *jpeg_out_;
+
+    // Local inference. The module runs one command at a time
+    std::mutex command_mutex_;
+    std::mutex detection_mutex_;
+    std::atomic<bool> detecting_ = false;
+    std::atomic<bool> paused_ = false;
+    int detection_model_ = 0;
+    int detection_min_score_ = 0;
+    std::vector<std::string> class_names_;
+    std::string last_detection_key_;
+    int64_t last_report_us_ = 0;
+    uint32_t detection_results_ = 0;
+    uint32_t detection_reports_ = 0;
+    uint64_t detection_bytes_ = 0;
+
+    bool FetchImage(bool& decoded);
+    bool SampleImage(bool& decoded);
+    bool Invoke();
+    void OnDetection(const sscma_client_reply_t* reply);
+    std::string GetClassName(int target);
 public:
     SscmaCamera(esp_io_expander_handle_t io_exp_handle);
     ~SscmaCamera();
 
-    virtual void SetExplainUrl(const std::string& url, const std::string& token);
     virtual bool Capture();
+    virtual bool CaptureLuma(uint8_t* luma, int width, int height) override;
+    virtual bool CaptureJpeg(std::vector<uint8_t>& jpeg, int quality) override;
     // 翻转控制函数
     virtual bool SetHMirror(bool enabled) override;
     virtual bool SetVFlip(bool enabled) override;
     virtual std::string Explain(const std::string& question);
+
+    // Runs model (the slot on the module) locally and reports what it finds
+    bool StartDetection(int model, int min_score);
+    void StopDetection();
+    std::string GetDetectionStatusJson();
 };
 
 #endif // ESP32_CAMERA_H
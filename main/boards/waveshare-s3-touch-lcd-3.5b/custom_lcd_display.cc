@@ -100,10 +100,6 @@ void CustomLcdDisplay::lvgl_port_flush_callback(lv_display_t *drv, const lv_area
     esp_lcd_panel_handle_t panel_handle = (esp_lcd_panel_handle_t)lv_display_get_driver_data(drv);
     assert(panel_handle != NULL);
 
-
-    size_t len = lv_area_get_size(area);
-    lv_draw_sw_rgb565_swap(color_map, len);
-
     const int x_start = area->x1;
     const int x_end = area->x2;
     const int y_start = area->y1;
@@ -141,6 +137,8 @@ void CustomLcdDisplay::lvgl_port_flush_callback(lv_display_t *drv, const lv_area
         int max_height = 0;
         int trans_height = 0;
 
+        // AXS15231B 在 QSPI 模式下不能交换 XY，90/270 度只能在这里转置。
+        // 字节交换放在拷贝里一起做，PSRAM 里的帧只读一遍
         if (LV_DISPLAY_ROTATION_270 == rotate || LV_DISPLAY_ROTATION_90 == rotate) {
             max_width = ((DISPLAY_TRANS_SIZE / height) > width) ? (width) : (DISPLAY_TRANS_SIZE / height);
             trans_count = width / max_width + (width % max_width ? (1) : (0));
@@ -178,7 +176,7 @@ void CustomLcdDisplay::lvgl_port_flush_callback(lv_display_t *drv, const lv_area
             case LV_DISPLAY_ROTATION_90:
                 for (int y = 0; y < height; y++) {
                     for (int x = 0; x < trans_width; x++) {
-                        *(to + x * height + (height - y - 1)) = *(from + y * width + x_start_tmp + x);
+                        *(to + x * height + (height - y - 1)) = __builtin_bswap16(*(from + y * width + x_start_tmp + x));
                     }
                 }
                 x_draw_start = ver_res - y_end - 1;
@@ -189,7 +187,7 @@ void CustomLcdDisplay::lvgl_port_flush_callback(lv_display_t *drv, const lv_area
             case LV_DISPLAY_ROTATION_270:
                 for (int y = 0; y < height; y++) {
                     for (int x = 0; x < trans_width; x++) {
-                        *(to + (trans_width - x - 1) * height + y) = *(from + y * width + x_start_tmp + x);
+                        *(to + (trans_width - x - 1) * height + y) = __builtin_bswap16(*(from + y * width + x_start_tmp + x));
                     }
                 }
                 x_draw_start = y_start;
@@ -200,7 +198,7 @@ void CustomLcdDisplay::lvgl_port_flush_callback(lv_display_t *drv, const lv_area
             case LV_DISPLAY_ROTATION_180:
                 for (int y = 0; y < trans_height; y++) {
                     for (int x = 0; x < width; x++) {
-                        *(to + (trans_height - y - 1)*width + (width - x - 1)) = *(from + y_start_tmp * width + y * (width) + x);
+                        *(to + (trans_height - y - 1)*width + (width - x - 1)) = __builtin_bswap16(*(from + y_start_tmp * width + y * (width) + x));
                     }
                 }
                 x_draw_start = hor_res - x_end - 1;
@@ -211,7 +209,7 @@ void CustomLcdDisplay::lvgl_port_flush_callback(lv_display_t *drv, const lv_area
             case LV_DISPLAY_ROTATION_0:
                 for (int y = 0; y < trans_height; y++) {
                     for (int x = 0; x < width; x++) {
-                        *(to + y * (width) + x) = *(from + y_start_tmp * width + y * (width) + x);
+                        *(to + y * (width) + x) = __builtin_bswap16(*(from + y_start_tmp * width + y * (width) + x));
                     }
                 }
                 x_draw_start = x_start;
@@ -245,6 +243,7 @@ void CustomLcdDisplay::lvgl_port_flush_callback(lv_display_t *drv, const lv_area
             }
         }
     } else {
+        lv_draw_sw_rgb565_swap(color_map, lv_area_get_size(area));
         esp_lcd_panel_draw_bitmap(panel_handle, x_start, y_start, x_end + 1, y_end + 1, color_map);
     }
     lv_disp_flush_ready(drv);
@@ -272,8 +271,7 @@ CustomLcdDisplay::CustomLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_p
     lv_init();
 
     ESP_LOGI(TAG, "Initialize LVGL port");
-    lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
-    port_cfg.task_priority = 1;
+    lvgl_port_cfg_t port_cfg = GetPortConfig();
     port_cfg.timer_period_ms = 50;
     lvgl_port_init(&port_cfg);
     trans_done_sem = xSemaphoreCreateCounting(1, 0);
@@ -333,6 +331,11 @@ CustomLcdDisplay::CustomLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_p
 
     esp_lcd_panel_disp_on_off(panel_, false);
 
+    // 镜像和其他板子一样交给面板完成，软件只负责转置
+    if (mirror_x || mirror_y) {
+        esp_lcd_panel_mirror(panel_, mirror_x, mirror_y);
+    }
+
     if (display_ == nullptr) {
         ESP_LOGE(TAG, "Failed to add display");
         return;
@@ -0,0 +1,118 @@
+#include "boot_arena.h"
+
+#include <esp_log.h>
+#include <esp_attr.h>
+
+#define TAG "BootArena"
+
+static const char* const kSlotNames[kBootSlotCount] = {
+    "none",
+    "uplink_encoder",
+    "wake_encoder",
+    "downlink_decoder",
+    "downlink_decoder_2",
+    "prompt_decoder",
+    "json_arena",
+};
+
+#if CONFIG_USE_BOOT_ARENA
+// In .bss, so it counts in the RAM budget of the build. Boards that allow .bss in PSRAM put it there,
+// where the heap would have put blocks of this size too
+#if CONFIG_SPIRAM_ALLOW_BSS_SEG_EXTERNAL_MEMORY
+EXT_RAM_BSS_ATTR
+#endif
+static uint8_t s_boot_arena[CONFIG_BOOT_ARENA_SIZE] __attribute__((aligned(BOOT_ARENA_ALIGNMENT)));
+#endif
+
+bool BootArena::IsEnabled() const {
+#if CONFIG_USE_BOOT_ARENA
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool BootArena::Reserve(BootSlot slot, size_t size) {
+#if CONFIG_USE_BOOT_ARENA
+    if (slot == kBootSlotNone || slot >= kBootSlotCount || slots_[slot].size > 0) {
+        return false;
+    }
+    size = (size + BOOT_ARENA_ALIGNMENT - 1) & ~(size_t)(BOOT_ARENA_ALIGNMENT - 1);
+    if (size > sizeof(s_boot_arena) - used_) {
+        ESP_LOGW(TAG, "No room for %s (%u bytes), it stays on the heap", kSlotNames[slot], size);
+        overflow_ += size;
+        return false;
+    }
+    slots_[slot].offset = used_;
+    slots_[slot].size = size;
+    used_ += size;
+    return true;
+#else
+    (void)slot;
+    (void)size;
+    return false;
+#endif
+}
+
+void* BootArena::Acquire(BootSlot slot, size_t size) {
+#if CONFIG_USE_BOOT_ARENA
+    if (slot == kBootSlotNone || slot >= kBootSlotCount || slots_[slot].size < size) {
+        return nullptr;
+    }
+    bool expected = false;
+    if (!slots_[slot].held.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+        ESP_LOGW(TAG, "Slot %s is held already", kSlotNames[slot]);
+        return nullptr;
+    }
+    return s_boot_arena + slots_[slot].offset;
+#else
+    (void)slot;
+    (void)size;
+    return nullptr;
+#endif
+}
+
+void BootArena::Release(BootSlot slot) {
+    if (slot != kBootSlotNone && slot < kBootSlotCount) {
+        slots_[slot].held.store(false, std::memory_order_release);
+    }
+}
+
+void BootArena::PrintLayout() {
+#if CONFIG_USE_BOOT_ARENA
+    for (int i = kBootSlotNone + 1; i < kBootSlotCount; i++) {
+        if (slots_[i].size > 0) {
+            ESP_LOGI(TAG, "%-16s at %6u, %6u bytes", kSlotNames[i], slots_[i].offset, slots_[i].size);
+        }
+    }
+    ESP_LOGI(TAG, "Used %u of %u bytes", used_, sizeof(s_boot_arena));
+    if (overflow_ > 0) {
+        ESP_LOGW(TAG, "%u bytes did not fit, raise CONFIG_BOOT_ARENA_SIZE to at least %u", overflow_,
+            used_ + overflow_);
+    }
+#endif
+}
+
+void BootArena::AddJson(cJSON* root) {
+#if CONFIG_USE_BOOT_ARENA
+    auto arena = cJSON_CreateObject();
+    cJSON_AddNumberToObject(arena, "size", sizeof(s_boot_arena));
+    cJSON_AddNumberToObject(arena, "used", used_);
+    cJSON_AddNumberToObject(arena, "overflow", overflow_);
+    auto slots = cJSON_CreateObject();
+    for (int i = kBootSlotNone + 1; i < kBootSlotCount; i++) {
+        if (slots_[i].size == 0) {
+            continue;
+        }
+        auto item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "offset", slots_[i].offset);
+        cJSON_AddNumberToObject(item, "size", slots_[i].size);
+        cJSON_AddBoolToObject(item, "held", slots_[i].held.load(std::memory_order_relaxed));
+        cJSON_AddItemToObject(slots, kSlotNames[i], item);
+    }
+    cJSON_AddItemToObject(arena, "slots", slots);
+    cJSON_AddItemToObject(root, "boot_arena", arena);
+#else
+    (void)root;
+#endif
+}
@@ -0,0 +1,72 @@
+#ifndef BOOT_ARENA_H
+#define BOOT_ARENA_H
+
+#include <sdkconfig.h>
+#include <cJSON.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#define BOOT_ARENA_ALIGNMENT 16
+
+enum BootSlot : uint8_t {
+    kBootSlotNone,              // Not in the arena, from the heap
+    kBootSlotUplinkEncoder,
+    kBootSlotWakeEncoder,       // Wake word pre-roll
+    kBootSlotDownlinkDecoder,
+    kBootSlotDownlinkDecoder2,  // Second format of the decoder cache
+    kBootSlotPromptDecoder,
+    kBootSlotJsonArena,
+    kBootSlotCount,
+};
+
+/*
+ * One static block for the buffers that live as long as the firmware: the
+ * Opus states of the uplink, the wake word pre-roll, the downlink and the
+ * prompts, and the JSON arena of the protocol (CONFIG_USE_BOOT_ARENA).
+ *
+ * Application::Start reserves every slot once, in a fixed order, so the
+ * layout is the same on every boot and the block shows in the RAM budget of
+ * the build instead of being taken from the heap at whatever time each
+ * object is first created. An owner acquires its slot and releases it when
+ * destroyed, a new owner of the same slot gets the same bytes back. A slot
+ * that was not reserved, is too small or is held already leaves the caller
+ * on the heap as before.
+ */
+class BootArena {
+public:
+    static BootArena& GetInstance() {
+        static BootArena instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    BootArena(const BootArena&) = delete;
+    BootArena& operator=(const BootArena&) = delete;
+
+    // Boot only, from one task: carves the slot at the next offset. False when it does not fit
+    bool Reserve(BootSlot slot, size_t size);
+    // The slot's bytes, or nullptr when the caller has to use the heap
+    void* Acquire(BootSlot slot, size_t size);
+    void Release(BootSlot slot);
+
+    bool IsEnabled() const;
+    // The layout after the reservations, and the bytes that did not fit
+    void PrintLayout();
+    void AddJson(cJSON* root);
+
+private:
+    BootArena() = default;
+
+    struct Slot {
+        size_t offset = 0;
+        size_t size = 0;                    // 0 when not reserved
+        std::atomic<bool> held = false;
+    };
+
+    Slot slots_[kBootSlotCount];
+    size_t used_ = 0;
+    size_t overflow_ = 0;                   // Reservations that did not fit
+};
+
+#endif // BOOT_ARENA_H
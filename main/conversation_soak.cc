@@ -0,0 +1,402 @@
+#include "conversation_soak.h"
+#include "application.h"
+#include "board.h"
+#include "audio_codec.h"
+#include "event_bus.h"
+#include "wav_file.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <esp_console.h>
+#include <cJSON.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define TAG "ConversationSoak"
+
+static const char* const kPhaseNames[] = {
+    "wake",
+    "connect",
+    "response",
+    "speak",
+    "close",
+};
+
+static const char* const kFailureNames[] = {
+    "wake_missed",
+    "connect",
+    "no_response",
+    "speak_timeout",
+    "dropped",
+    "close",
+};
+
+void ConversationSoak::Initialize() {
+    static_assert(sizeof(kPhaseNames) / sizeof(kPhaseNames[0]) == kPhaseCount, "Missing phase name");
+    static_assert(sizeof(kFailureNames) / sizeof(kFailureNames[0]) == kFailureCount, "Missing failure name");
+    if (states_ != nullptr) {
+        return;
+    }
+    states_ = xQueueCreate(EVENT_BUS_QUEUE_SIZE, sizeof(StateChange));
+
+    auto codec = Board::GetInstance().GetAudioCodec();
+    input_channels_ = codec->input_channels();
+    auto channel_map = codec->input_channel_map();
+    microphone_mask_ = 0;
+    for (size_t i = 0; i < channel_map.size() && i < 32; i++) {
+        if (channel_map[i] == 'M') {
+            microphone_mask_ |= 1u << i;
+        }
+    }
+
+    EventBus::GetInstance().Subscribe("soak", EVENT_MASK(kEventDeviceStateChanged), [this](const Event& event) {
+        if (!running_) {
+            return;
+        }
+        StateChange change = { event.state, event.time_us };
+        xQueueSend(states_, &change, 0);
+    });
+
+    // Only works on boards that started a REPL, the others have no console to type into
+    const esp_console_cmd_t cmd = {
+        .command = "soak",
+        .help = "Loop conversations with a recorded utterance. soak <wav> <iterations>, soak stop, or soak for the report",
+        .hint = nullptr,
+        .func = [](int argc, char** argv) -> int {
+            auto& soak = ConversationSoak::GetInstance();
+            if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+                soak.Stop();
+            } else if (argc == 3) {
+                std::string error;
+                if (!soak.Start(argv[1], atoi(argv[2]), error)) {
+                    printf("%s\n", error.c_str());
+                    return 1;
+                }
+            } else {
+                printf("%s\n", soak.GetReportJson().c_str());
+            }
+            return 0;
+        },
+        .argtable = nullptr
+    };
+    if (esp_console_cmd_register(&cmd) != ESP_OK) {
+        ESP_LOGD(TAG, "No console, the soak command is not available");
+    }
+}
+
+bool ConversationSoak::LoadUtterance(const std::string& path, std::string& error) {
+    WavReader wav;
+    if (!wav.Open(path) || wav.sample_rate() != SOAK_SAMPLE_RATE || wav.channels() != 1) {
+        error = path + " is not a 16 kHz mono 16-bit WAV file";
+        return false;
+    }
+    utterance_.resize(SOAK_MAX_UTTERANCE_MS * SOAK_SAMPLE_RATE / 1000);
+    utterance_.resize(wav.Read(utterance_.data(), utterance_.size()));
+    utterance_.shrink_to_fit();
+    if (utterance_.empty()) {
+        error = path + " has no audio";
+        return false;
+    }
+    return true;
+}
+
+bool ConversationSoak::Start(const std::string& wav_path, int iterations, std::string& error) {
+    if (states_ == nullptr) {
+        error = "Not initialized";
+        return false;
+    }
+    if (running_ || task_ != nullptr) {
+        error = "A soak run is in progress";
+        return false;
+    }
+    if (iterations <= 0) {
+        error = "Invalid number of iterations";
+        return false;
+    }
+    if (!LoadUtterance(wav_path, error)) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        path_ = wav_path;
+        iterations_ = iterations;
+        completed_ = 0;
+        for (auto& phase : phases_ms_) {
+            phase.clear();
+        }
+        memset(failures_, 0, sizeof(failures_));
+        sram_free_.clear();
+        psram_free_.clear();
+        start_us_ = esp_timer_get_time();
+    }
+    stop_ = false;
+    playing_ = false;
+    restart_ = false;
+    xQueueReset(states_);
+    running_ = true;
+    if (xTaskCreate([](void* arg) {
+        auto soak = static_cast<ConversationSoak*>(arg);
+        soak->Run();
+        soak->task_ = nullptr;
+        vTaskDelete(NULL);
+    }, "conversation_soak", SOAK_STACK_SIZE, this, 2, &task_) != pdPASS) {
+        running_ = false;
+        error = "Failed to create the soak task";
+        return false;
+    }
+    ESP_LOGI(TAG, "Soak started: %d iterations of %s, %u ms", iterations, wav_path.c_str(),
+        (unsigned)(utterance_.size() * 1000 / SOAK_SAMPLE_RATE));
+    return true;
+}
+
+void ConversationSoak::Stop() {
+    stop_ = true;
+}
+
+void ConversationSoak::FillInput(std::vector<int16_t>& data) {
+    if (!running_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    // Only the audio loop moves the position, Play() asks for a restart
+    if (restart_.exchange(false, std::memory_order_acquire)) {
+        play_position_ = 0;
+        playing_.store(true, std::memory_order_relaxed);
+    }
+    bool playing = playing_.load(std::memory_order_relaxed);
+    size_t frames = data.size() / input_channels_;
+    for (size_t i = 0; i < frames; i++) {
+        int16_t sample = 0;
+        if (playing && play_position_ < utterance_.size()) {
+            sample = utterance_[play_position_++];
+        }
+        int16_t* frame = data.data() + i * input_channels_;
+        for (int c = 0; c < input_channels_; c++) {
+            if (microphone_mask_ & (1u << c)) {
+                frame[c] = sample;
+            }
+        }
+    }
+    if (playing && play_position_ >= utterance_.size()) {
+        playing_.store(false, std::memory_order_relaxed);
+        play_end_us_.store(esp_timer_get_time(), std::memory_order_release);
+    }
+}
+
+void ConversationSoak::Play() {
+    play_end_us_ = 0;
+    restart_.store(true, std::memory_order_release);
+}
+
+// The first of `states` to come in, kDeviceStateUnknown on a timeout or a stop
+DeviceState ConversationSoak::WaitFor(std::initializer_list<DeviceState> states, int timeout_ms, int64_t& time_us) {
+    int64_t deadline_us = esp_timer_get_time() + timeout_ms * 1000LL;
+    StateChange change;
+    while (!stop_) {
+        int64_t left_us = deadline_us - esp_timer_get_time();
+        if (left_us <= 0) {
+            break;
+        }
+        // Wakes up now and then to notice a stop
+        if (xQueueReceive(states_, &change, pdMS_TO_TICKS(std::min<int64_t>(left_us / 1000 + 1, 500))) != pdTRUE) {
+            continue;
+        }
+        for (auto state : states) {
+            if (change.state == state) {
+                time_us = change.time_us;
+                return state;
+            }
+        }
+    }
+    return kDeviceStateUnknown;
+}
+
+// Closes the channel the way the button does, a reply still playing is aborted first
+bool ConversationSoak::CloseConversation(int64_t& time_us) {
+    auto& app = Application::GetInstance();
+    for (int attempt = 0; attempt < 3 && !stop_; attempt++) {
+        if (app.GetDeviceState() == kDeviceStateIdle) {
+            time_us = esp_timer_get_time();
+            return true;
+        }
+        app.ToggleChatState();
+        if (WaitFor({kDeviceStateIdle}, SOAK_CLOSE_TIMEOUT_MS, time_us) == kDeviceStateIdle) {
+            return true;
+        }
+    }
+    return app.GetDeviceState() == kDeviceStateIdle;
+}
+
+void ConversationSoak::RecordPhase(Phase phase, int64_t duration_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    phases_ms_[phase].push_back(std::max<int64_t>(duration_us, 0) / 1000);
+}
+
+void ConversationSoak::RecordFailure(Failure failure) {
+    if (stop_) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    failures_[failure]++;
+    ESP_LOGW(TAG, "Iteration failed: %s", kFailureNames[failure]);
+}
+
+void ConversationSoak::Run() {
+    for (int i = 0; i < iterations_ && !stop_; i++) {
+        bool success = RunIteration();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (success) {
+            completed_++;
+        }
+        ESP_LOGI(TAG, "Iteration %d/%d %s, %d completed, SRAM free %lu", i + 1, iterations_,
+            success ? "done" : "failed", completed_, sram_free_.empty() ? 0UL : (unsigned long)sram_free_.back());
+    }
+    playing_ = false;
+    running_ = false;
+    ESP_LOGI(TAG, "Soak finished: %s", GetReportJson().c_str());
+}
+
+bool ConversationSoak::RunIteration() {
+    auto& app = Application::GetInstance();
+    int64_t time_us = 0;
+    if (app.GetDeviceState() != kDeviceStateIdle && !CloseConversation(time_us)) {
+        RecordFailure(kFailureClose);
+        return false;
+    }
+    vTaskDelay(pdMS_TO_TICKS(SOAK_GAP_MS));
+    if (stop_ || app.GetDeviceState() != kDeviceStateIdle) {
+        return false;
+    }
+    xQueueReset(states_);
+    {
+        // Back in idle, what a conversation left behind shows here
+        std::lock_guard<std::mutex> lock(mutex_);
+        sram_free_.push_back(heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+        psram_free_.push_back(heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+    }
+
+    int utterance_ms = utterance_.size() * 1000 / SOAK_SAMPLE_RATE;
+    int64_t start_us = esp_timer_get_time();
+    Play();
+    auto state = WaitFor({kDeviceStateConnecting, kDeviceStateListening}, utterance_ms + SOAK_WAKE_TIMEOUT_MS, time_us);
+    bool woken = state != kDeviceStateUnknown;
+    if (woken) {
+        RecordPhase(kPhaseWake, time_us - start_us);
+    } else {
+        if (stop_) {
+            return false;
+        }
+        // Opened by hand, the utterance is played again once the channel is open
+        RecordFailure(kFailureWakeMissed);
+        app.ToggleChatState();
+        state = WaitFor({kDeviceStateConnecting, kDeviceStateListening}, SOAK_CONNECT_TIMEOUT_MS, time_us);
+    }
+    int64_t connecting_us = time_us;
+    if (state == kDeviceStateConnecting) {
+        state = WaitFor({kDeviceStateListening, kDeviceStateIdle}, SOAK_CONNECT_TIMEOUT_MS, time_us);
+    }
+    if (state != kDeviceStateListening) {
+        RecordFailure(kFailureConnect);
+        CloseConversation(time_us);
+        return false;
+    }
+    RecordPhase(kPhaseConnect, time_us - connecting_us);
+    if (!woken) {
+        Play();
+    }
+
+    state = WaitFor({kDeviceStateSpeaking, kDeviceStateIdle}, utterance_ms + SOAK_RESPONSE_TIMEOUT_MS, time_us);
+    if (state != kDeviceStateSpeaking) {
+        RecordFailure(state == kDeviceStateIdle ? kFailureDropped : kFailureNoResponse);
+        CloseConversation(time_us);
+        return false;
+    }
+    // A reply that starts before the end of the utterance counts as immediate
+    int64_t end_us = play_end_us_.load(std::memory_order_acquire);
+    RecordPhase(kPhaseResponse, end_us != 0 ? time_us - end_us : 0);
+
+    int64_t speaking_us = time_us;
+    state = WaitFor({kDeviceStateListening, kDeviceStateIdle}, SOAK_SPEAK_TIMEOUT_MS, time_us);
+    if (state == kDeviceStateUnknown) {
+        RecordFailure(kFailureSpeakTimeout);
+        CloseConversation(time_us);
+        return false;
+    }
+    RecordPhase(kPhaseSpeak, time_us - speaking_us);
+
+    if (state == kDeviceStateListening) {
+        int64_t close_us = esp_timer_get_time();
+        if (!CloseConversation(time_us)) {
+            RecordFailure(kFailureClose);
+            return false;
+        }
+        RecordPhase(kPhaseClose, time_us - close_us);
+    }
+    return !stop_;
+}
+
+std::string ConversationSoak::GetReportJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "running", running_.load());
+    cJSON_AddStringToObject(root, "path", path_.c_str());
+    cJSON_AddNumberToObject(root, "iterations", iterations_);
+    cJSON_AddNumberToObject(root, "completed", completed_);
+    cJSON_AddNumberToObject(root, "elapsed_s", start_us_ != 0 ? (esp_timer_get_time() - start_us_) / 1000000 : 0);
+
+    auto failures = cJSON_CreateObject();
+    for (int i = 0; i < kFailureCount; i++) {
+        cJSON_AddNumberToObject(failures, kFailureNames[i], failures_[i]);
+    }
+    cJSON_AddItemToObject(root, "failures", failures);
+
+    // Drift: the mean of the last SOAK_DRIFT_WINDOW iterations against the first ones
+    auto mean = [](const std::vector<uint32_t>& values, size_t first, size_t count) {
+        uint64_t sum = 0;
+        for (size_t i = first; i < first + count; i++) {
+            sum += values[i];
+        }
+        return count > 0 ? (uint32_t)(sum / count) : 0;
+    };
+    auto phases = cJSON_CreateObject();
+    for (int i = 0; i < kPhaseCount; i++) {
+        auto& values = phases_ms_[i];
+        auto item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "count", values.size());
+        if (!values.empty()) {
+            auto sorted = values;
+            std::sort(sorted.begin(), sorted.end());
+            size_t window = std::min<size_t>(values.size(), SOAK_DRIFT_WINDOW);
+            cJSON_AddNumberToObject(item, "p50_ms", sorted[sorted.size() / 2]);
+            cJSON_AddNumberToObject(item, "p90_ms", sorted[sorted.size() * 9 / 10]);
+            cJSON_AddNumberToObject(item, "max_ms", sorted.back());
+            cJSON_AddNumberToObject(item, "first_mean_ms", mean(values, 0, window));
+            cJSON_AddNumberToObject(item, "last_mean_ms", mean(values, values.size() - window, window));
+        }
+        cJSON_AddItemToObject(phases, kPhaseNames[i], item);
+    }
+    cJSON_AddItemToObject(root, "phases", phases);
+
+    auto memory = cJSON_CreateObject();
+    if (!sram_free_.empty()) {
+        cJSON_AddNumberToObject(memory, "sram_free_first", sram_free_.front());
+        cJSON_AddNumberToObject(memory, "sram_free_last", sram_free_.back());
+        cJSON_AddNumberToObject(memory, "sram_free_lowest", *std::min_element(sram_free_.begin(), sram_free_.end()));
+        cJSON_AddNumberToObject(memory, "psram_free_first", psram_free_.front());
+        cJSON_AddNumberToObject(memory, "psram_free_last", psram_free_.back());
+    }
+    // The lowest since boot, conversations included
+    cJSON_AddNumberToObject(memory, "sram_min_free", heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+    cJSON_AddNumberToObject(memory, "sram_largest", heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+    cJSON_AddNumberToObject(memory, "psram_min_free", heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+    cJSON_AddItemToObject(root, "memory", memory);
+
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
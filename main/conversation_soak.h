@@ -0,0 +1,132 @@
+#ifndef CONVERSATION_SOAK_H
+#define CONVERSATION_SOAK_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <initializer_list>
+#include <cstdint>
+
+#include "device_state.h"
+
+// The utterance is held in memory, 16 kHz mono 16-bit
+#define SOAK_MAX_UTTERANCE_MS 15000
+#define SOAK_SAMPLE_RATE 16000
+// Idle time between two conversations
+#define SOAK_GAP_MS 3000
+// After the end of the utterance, for the wake word to be detected
+#define SOAK_WAKE_TIMEOUT_MS 2000
+#define SOAK_CONNECT_TIMEOUT_MS 10000
+// From the end of the utterance to the first audio of the reply
+#define SOAK_RESPONSE_TIMEOUT_MS 20000
+#define SOAK_SPEAK_TIMEOUT_MS 60000
+#define SOAK_CLOSE_TIMEOUT_MS 5000
+// Drift compares the mean of the first and of the last this many iterations
+#define SOAK_DRIFT_WINDOW 10
+#define SOAK_STACK_SIZE 4096
+
+/*
+ * Runs full conversations without a person, for soak runs before a release:
+ * memory that leaks per conversation and latencies that drift over hours.
+ *
+ * A recorded utterance, a WAV file that starts with the wake word, is fed
+ * into the microphone channels in place of the captured audio, through
+ * Application::ReadAudio, so the wake word, the audio processor, the encoder
+ * and the protocol see it as if it was spoken. The reference channels keep
+ * the captured playback for the AEC. Each iteration waits for the device to
+ * be idle, plays the utterance, waits for the wake, the channel, the reply
+ * and its end, and closes the channel as the button does. A missed wake is
+ * counted and the conversation is opened by hand, then the utterance is
+ * played again.
+ *
+ * Every phase is timed per iteration from the state changes on the event
+ * bus: wake (start of the utterance to connecting), connect, response (end
+ * of the utterance to speaking), speak and close. The free heap is sampled
+ * in idle before every iteration. The report compares the first and the last
+ * iterations, a growing difference is a leak or a drift.
+ */
+class ConversationSoak {
+public:
+    static ConversationSoak& GetInstance() {
+        static ConversationSoak instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    ConversationSoak(const ConversationSoak&) = delete;
+    ConversationSoak& operator=(const ConversationSoak&) = delete;
+
+    // At boot, after the codec is up: subscribes to the state changes and adds the soak console command
+    void Initialize();
+    // Returns at once, the iterations run on their own task. False with `error` if it cannot start
+    bool Start(const std::string& wav_path, int iterations, std::string& error);
+    void Stop();
+    std::string GetReportJson();
+
+    // Audio loop, from ReadAudio with 16 kHz input: replaces the microphone channels while running
+    void FillInput(std::vector<int16_t>& data);
+
+private:
+    ConversationSoak() = default;
+
+    enum Phase {
+        kPhaseWake,
+        kPhaseConnect,
+        kPhaseResponse,
+        kPhaseSpeak,
+        kPhaseClose,
+        kPhaseCount
+    };
+    enum Failure {
+        kFailureWakeMissed,     // Not a lost iteration, the conversation is opened by hand
+        kFailureConnect,
+        kFailureNoResponse,
+        kFailureSpeakTimeout,
+        kFailureDropped,        // Back to idle in the middle of the conversation
+        kFailureClose,
+        kFailureCount
+    };
+    struct StateChange {
+        DeviceState state;
+        int64_t time_us;
+    };
+
+    QueueHandle_t states_ = nullptr;
+    TaskHandle_t task_ = nullptr;
+    std::atomic<bool> running_ = false;
+    std::atomic<bool> stop_ = false;
+
+    // Written before a run, read by the audio loop while it runs
+    std::vector<int16_t> utterance_;
+    int input_channels_ = 1;
+    uint32_t microphone_mask_ = 1;
+    std::atomic<bool> restart_ = false;
+    std::atomic<bool> playing_ = false;
+    size_t play_position_ = 0;              // Audio loop only
+    std::atomic<int64_t> play_end_us_ = 0;
+
+    std::mutex mutex_;
+    std::string path_;
+    int iterations_ = 0;
+    int completed_ = 0;
+    std::vector<uint32_t> phases_ms_[kPhaseCount];
+    uint32_t failures_[kFailureCount] = {};
+    std::vector<uint32_t> sram_free_;
+    std::vector<uint32_t> psram_free_;
+    int64_t start_us_ = 0;
+
+    bool LoadUtterance(const std::string& path, std::string& error);
+    void Run();
+    bool RunIteration();
+    void Play();
+    DeviceState WaitFor(std::initializer_list<DeviceState> states, int timeout_ms, int64_t& time_us);
+    bool CloseConversation(int64_t& time_us);
+    void RecordPhase(Phase phase, int64_t duration_us);
+    void RecordFailure(Failure failure);
+};
+
+#endif // CONVERSATION_SOAK_H
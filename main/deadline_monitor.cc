@@ -0,0 +1,253 @@
+#include "deadline_monitor.h"
+#include "application.h"
+#include "board.h"
+#include "audio_codec.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cJSON.h>
+
+#include <algorithm>
+#include <cstring>
+
+#define TAG "DeadlineMonitor"
+
+const char* DeadlineMonitor::GetStageName(DeadlineStage stage) {
+    static const char* const names[] = {
+        "input",
+        "output",
+    };
+    static_assert(sizeof(names) / sizeof(names[0]) == kDeadlineStageCount, "Missing deadline stage name");
+    return names[stage];
+}
+
+void DeadlineMonitor::Start() {
+    if (baseline_timer_ != nullptr) {
+        return;
+    }
+    esp_timer_create_args_t baseline_args = {
+        .callback = [](void* arg) {
+            static_cast<DeadlineMonitor*>(arg)->TakeBaseline();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "deadline_base",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&baseline_args, &baseline_timer_);
+    esp_timer_create_args_t capture_args = {
+        .callback = [](void* arg) {
+            static_cast<DeadlineMonitor*>(arg)->Capture();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "deadline_miss",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&capture_args, &capture_timer_);
+    esp_timer_start_periodic(baseline_timer_, DEADLINE_MONITOR_BASELINE_MS * 1000);
+    ESP_LOGI(TAG, "Watching audio frames, misses beyond %d%% of a frame are captured", DEADLINE_MONITOR_TOLERANCE_PERCENT);
+}
+
+void DeadlineMonitor::OnFrame(DeadlineStage stage, int64_t frame_us) {
+    auto& state = stages_[stage];
+    int64_t now = esp_timer_get_time();
+    int64_t cycle_us = now - state.last_frame_us;
+    int64_t budget_us = state.last_duration_us * DEADLINE_MONITOR_TOLERANCE_PERCENT / 100;
+    state.last_frame_us = now;
+    state.last_duration_us = frame_us;
+    last_activity_us_.store(now, std::memory_order_relaxed);
+    state.frames.fetch_add(1, std::memory_order_relaxed);
+
+    // The first frame after a pause has nothing to be late against
+    if (budget_us == 0 || cycle_us > DEADLINE_MONITOR_IDLE_MS * 1000LL || cycle_us <= budget_us) {
+        return;
+    }
+    state.misses.fetch_add(1, std::memory_order_relaxed);
+    uint32_t late_us = cycle_us - budget_us;
+    if (late_us > state.max_late_us.load(std::memory_order_relaxed)) {
+        state.max_late_us.store(late_us, std::memory_order_relaxed);
+    }
+    // One capture at a time, a miss during a capture is only counted
+    if (capture_timer_ == nullptr || capture_pending_.exchange(true)) {
+        return;
+    }
+    pending_.time_us = now;
+    pending_.stage = stage;
+    pending_.cycle_us = cycle_us;
+    pending_.budget_us = budget_us;
+    esp_timer_start_once(capture_timer_, 0);
+}
+
+// esp_timer task
+void DeadlineMonitor::TakeBaseline() {
+    // Nothing to compare with while no audio runs
+    if (esp_timer_get_time() - last_activity_us_.load(std::memory_order_relaxed) > DEADLINE_MONITOR_IDLE_MS * 1000LL) {
+        return;
+    }
+    int index = (newest_baseline_ + 1) % 2;
+    auto& baseline = baselines_[index];
+    configRUN_TIME_COUNTER_TYPE total_run_time;
+    baseline.count = uxTaskGetSystemState(baseline.tasks, DEADLINE_MONITOR_MAX_TASKS, &total_run_time);
+    if (baseline.count == 0) {
+        return;
+    }
+    baseline.total_run_time = total_run_time;
+    baseline.time_us = esp_timer_get_time();
+    newest_baseline_ = index;
+}
+
+// esp_timer task, right after a miss
+void DeadlineMonitor::Capture() {
+    Miss miss = pending_;
+    configRUN_TIME_COUNTER_TYPE total_run_time;
+    UBaseType_t count = uxTaskGetSystemState(capture_tasks_, DEADLINE_MONITOR_MAX_TASKS, &total_run_time);
+
+    // The newest baseline from before the late cycle started, so the window covers all of it
+    const Baseline* baseline = nullptr;
+    int64_t cycle_start_us = miss.time_us - miss.cycle_us;
+    for (int i = 0; i < 2 && newest_baseline_ >= 0; i++) {
+        auto& candidate = baselines_[(newest_baseline_ + 2 - i) % 2];
+        if (candidate.count > 0 && candidate.time_us <= cycle_start_us) {
+            baseline = &candidate;
+            break;
+        }
+    }
+    if (baseline == nullptr && newest_baseline_ >= 0) {
+        // The cycle was longer than the baselines reach back, the older one covers most of it
+        baseline = &baselines_[(newest_baseline_ + 1) % 2];
+        if (baseline->count == 0) {
+            baseline = &baselines_[newest_baseline_];
+        }
+    }
+
+    if (count > 0 && baseline != nullptr) {
+        uint32_t elapsed = (uint32_t)total_run_time - baseline->total_run_time;
+        miss.window_us = esp_timer_get_time() - baseline->time_us;
+        // Keep the busiest tasks, a short insertion into a sorted array of DEADLINE_MONITOR_TOP_TASKS
+        uint32_t run_times[DEADLINE_MONITOR_TOP_TASKS] = {};
+        for (UBaseType_t i = 0; i < count; i++) {
+            auto& task = capture_tasks_[i];
+            uint32_t start = 0;
+            for (UBaseType_t j = 0; j < baseline->count; j++) {
+                if (baseline->tasks[j].xHandle == task.xHandle) {
+                    start = baseline->tasks[j].ulRunTimeCounter;
+                    break;
+                }
+            }
+            uint32_t run_time = (uint32_t)task.ulRunTimeCounter - start;
+            if (run_time == 0) {
+                continue;
+            }
+            int position = miss.task_count;
+            while (position > 0 && run_times[position - 1] < run_time) {
+                position--;
+            }
+            if (position >= DEADLINE_MONITOR_TOP_TASKS) {
+                continue;
+            }
+            int last = std::min(miss.task_count, DEADLINE_MONITOR_TOP_TASKS - 1);
+            for (int k = last; k > position; k--) {
+                run_times[k] = run_times[k - 1];
+                miss.tasks[k] = miss.tasks[k - 1];
+            }
+            run_times[position] = run_time;
+            auto& usage = miss.tasks[position];
+            strncpy(usage.name, task.pcTaskName, sizeof(usage.name) - 1);
+            usage.name[sizeof(usage.name) - 1] = '\0';
+            usage.percent = elapsed > 0 ? std::min<uint64_t>((uint64_t)run_time * 100 /
+                ((uint64_t)elapsed * CONFIG_FREERTOS_NUMBER_OF_CORES), 100) : 0;
+            usage.priority = task.uxCurrentPriority;
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+            usage.core = task.xCoreID == tskNO_AFFINITY ? -1 : task.xCoreID;
+#else
+            usage.core = -1;
+#endif
+            miss.task_count = std::min(miss.task_count + 1, DEADLINE_MONITOR_TOP_TASKS);
+        }
+    }
+
+    auto& app = Application::GetInstance();
+    miss.uplink_depth = app.GetUplinkQueueStats().depth;
+    auto downlink = app.GetJitterBufferStats();
+    miss.downlink_depth = downlink.depth;
+    miss.downlink_target_depth = downlink.target_depth;
+#if CONFIG_USE_ASYNC_AUDIO_OUTPUT
+    miss.playout_buffered_ms = Board::GetInstance().GetAudioCodec()->output_buffered_ms();
+#endif
+    miss.sram_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    miss.sram_largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+    miss.sram_min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ring_[captured_ % DEADLINE_MONITOR_RING_SIZE] = miss;
+        captured_++;
+    }
+    capture_pending_ = false;
+    ESP_LOGW(TAG, "%s frame late: %lu us cycle, %lu us budget, busiest task %s",
+        GetStageName(miss.stage), (unsigned long)miss.cycle_us, (unsigned long)miss.budget_us,
+        miss.task_count > 0 ? miss.tasks[0].name : "unknown");
+}
+
+std::string DeadlineMonitor::GetReportJson() {
+    auto root = cJSON_CreateObject();
+    auto stages = cJSON_CreateObject();
+    for (int i = 0; i < kDeadlineStageCount; i++) {
+        auto& state = stages_[i];
+        auto item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "frames", state.frames.load(std::memory_order_relaxed));
+        cJSON_AddNumberToObject(item, "misses", state.misses.load(std::memory_order_relaxed));
+        cJSON_AddNumberToObject(item, "max_late_us", state.max_late_us.load(std::memory_order_relaxed));
+        cJSON_AddItemToObject(stages, GetStageName((DeadlineStage)i), item);
+    }
+    cJSON_AddItemToObject(root, "stages", stages);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = esp_timer_get_time();
+    auto misses = cJSON_CreateArray();
+    uint32_t first = captured_ > DEADLINE_MONITOR_RING_SIZE ? captured_ - DEADLINE_MONITOR_RING_SIZE : 0;
+    // Newest first
+    for (uint32_t n = captured_; n > first; n--) {
+        auto& miss = ring_[(n - 1) % DEADLINE_MONITOR_RING_SIZE];
+        auto item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "stage", GetStageName(miss.stage));
+        cJSON_AddNumberToObject(item, "age_ms", (now - miss.time_us) / 1000);
+        cJSON_AddNumberToObject(item, "cycle_us", miss.cycle_us);
+        cJSON_AddNumberToObject(item, "budget_us", miss.budget_us);
+        cJSON_AddNumberToObject(item, "window_ms", miss.window_us / 1000);
+        auto tasks = cJSON_CreateArray();
+        for (int i = 0; i < miss.task_count; i++) {
+            auto& usage = miss.tasks[i];
+            auto task = cJSON_CreateObject();
+            cJSON_AddStringToObject(task, "name", usage.name);
+            cJSON_AddNumberToObject(task, "cpu_percent", usage.percent);
+            cJSON_AddNumberToObject(task, "priority", usage.priority);
+            cJSON_AddNumberToObject(task, "core", usage.core);
+            cJSON_AddItemToArray(tasks, task);
+        }
+        cJSON_AddItemToObject(item, "tasks", tasks);
+        auto queues = cJSON_CreateObject();
+        cJSON_AddNumberToObject(queues, "uplink", miss.uplink_depth);
+        cJSON_AddNumberToObject(queues, "downlink", miss.downlink_depth);
+        cJSON_AddNumberToObject(queues, "downlink_target", miss.downlink_target_depth);
+        if (miss.playout_buffered_ms >= 0) {
+            cJSON_AddNumberToObject(queues, "playout_buffered_ms", miss.playout_buffered_ms);
+        }
+        cJSON_AddItemToObject(item, "queues", queues);
+        auto heap = cJSON_CreateObject();
+        cJSON_AddNumberToObject(heap, "sram_free", miss.sram_free);
+        cJSON_AddNumberToObject(heap, "sram_largest", miss.sram_largest);
+        cJSON_AddNumberToObject(heap, "sram_min_free", miss.sram_min_free);
+        cJSON_AddItemToObject(item, "heap", heap);
+        cJSON_AddItemToArray(misses, item);
+    }
+    cJSON_AddItemToObject(root, "misses", misses);
+    cJSON_AddNumberToObject(root, "captured", captured_);
+
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
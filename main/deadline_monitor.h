@@ -0,0 +1,128 @@
+#ifndef DEADLINE_MONITOR_H
+#define DEADLINE_MONITOR_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+// A frame that goes through this much later than its duration is a miss, in percent of the frame
+#define DEADLINE_MONITOR_TOLERANCE_PERCENT 150
+// A longer gap is a pause of the stream, not a miss
+#define DEADLINE_MONITOR_IDLE_MS 1000
+// Run time counters of all tasks are kept this often while audio runs, a miss is compared with them
+#define DEADLINE_MONITOR_BASELINE_MS 50
+#define DEADLINE_MONITOR_MAX_TASKS 48
+// Tasks with the most run time around a miss that are kept with it
+#define DEADLINE_MONITOR_TOP_TASKS 5
+// Misses kept with their snapshot, older ones are overwritten
+#define DEADLINE_MONITOR_RING_SIZE 8
+
+enum DeadlineStage {
+    kDeadlineStageInput,    // Frames read from the microphone by the audio loop
+    kDeadlineStageOutput,   // Frames written to the speaker by the decode task
+    kDeadlineStageCount
+};
+
+/*
+ * Checks every audio frame against its deadline and keeps a snapshot of
+ * the device for the misses, to find the cause of a glitch after the fact.
+ *
+ * Each stage reports the frames that went through it. The time since the
+ * previous frame of the stage is its cycle, and a cycle longer than the
+ * previous frame by DEADLINE_MONITOR_TOLERANCE_PERCENT is a miss: the DMA
+ * buffer ran that far ahead of the loop, or the speaker ran out. This costs
+ * a timestamp and a few compares per frame on the audio tasks.
+ *
+ * The snapshot is taken on the esp_timer task right after a miss, never on
+ * the audio tasks: the run time of every task since the last baseline from
+ * before the miss, of which the busiest DEADLINE_MONITOR_TOP_TASKS are kept,
+ * the audio queue depths and the internal heap. Baselines are only taken
+ * while audio runs. Nothing is allocated, the last DEADLINE_MONITOR_RING_SIZE
+ * misses are kept in a fixed ring and reported with self.system.get_metrics.
+ */
+class DeadlineMonitor {
+public:
+    static DeadlineMonitor& GetInstance() {
+        static DeadlineMonitor instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    DeadlineMonitor(const DeadlineMonitor&) = delete;
+    DeadlineMonitor& operator=(const DeadlineMonitor&) = delete;
+
+    void Start();
+    // From the task of the stage, after a frame of frame_us went through it
+    void OnFrame(DeadlineStage stage, int64_t frame_us);
+    std::string GetReportJson();
+
+    static const char* GetStageName(DeadlineStage stage);
+
+private:
+    DeadlineMonitor() = default;
+
+    struct Stage {
+        // Only the task of the stage touches these
+        int64_t last_frame_us = 0;
+        int64_t last_duration_us = 0;
+        // Read by the report
+        std::atomic<uint32_t> frames = 0;
+        std::atomic<uint32_t> misses = 0;
+        std::atomic<uint32_t> max_late_us = 0;
+    };
+    struct Baseline {
+        int64_t time_us = 0;
+        uint32_t total_run_time = 0;
+        UBaseType_t count = 0;
+        TaskStatus_t tasks[DEADLINE_MONITOR_MAX_TASKS];
+    };
+    struct TaskUsage {
+        char name[configMAX_TASK_NAME_LEN];
+        uint8_t percent;        // Of all cores over the window
+        uint8_t priority;
+        int8_t core;            // -1 for no affinity, or not known without CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+    };
+    struct Miss {
+        int64_t time_us = 0;
+        DeadlineStage stage = kDeadlineStageInput;
+        uint32_t cycle_us = 0;
+        uint32_t budget_us = 0;
+        uint32_t window_us = 0;     // Since the baseline the tasks are compared with
+        int task_count = 0;
+        TaskUsage tasks[DEADLINE_MONITOR_TOP_TASKS];
+        uint32_t uplink_depth = 0;
+        uint32_t downlink_depth = 0;
+        uint32_t downlink_target_depth = 0;
+        int playout_buffered_ms = -1;
+        uint32_t sram_free = 0;
+        uint32_t sram_largest = 0;
+        uint32_t sram_min_free = 0;
+    };
+
+    Stage stages_[kDeadlineStageCount];
+    std::atomic<int64_t> last_activity_us_ = 0;
+
+    esp_timer_handle_t baseline_timer_ = nullptr;
+    esp_timer_handle_t capture_timer_ = nullptr;
+    // Both timers run on the esp_timer task, only that task touches the baselines
+    Baseline baselines_[2];
+    int newest_baseline_ = -1;
+    TaskStatus_t capture_tasks_[DEADLINE_MONITOR_MAX_TASKS];
+
+    // The audio task fills pending_ and arms the capture, the capture clears capture_pending_
+    std::atomic<bool> capture_pending_ = false;
+    Miss pending_;
+
+    std::mutex mutex_;
+    Miss ring_[DEADLINE_MONITOR_RING_SIZE];
+    uint32_t captured_ = 0;
+
+    void TakeBaseline();
+    void Capture();
+};
+
+#endif // DEADLINE_MONITOR_H
@@ -0,0 +1,107 @@
+#include "deferred_log.h"
+
+#include <esp_timer.h>
+
+#include <cstdio>
+#include <cstring>
+
+#define TAG "DeferredLog"
+
+DeferredLog::DeferredLog() {
+    for (uint32_t i = 0; i < DEFERRED_LOG_RING_SIZE; i++) {
+        ring_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+void DeferredLog::Start() {
+    if (task_ != nullptr) {
+        return;
+    }
+    xTaskCreate([](void* arg) {
+        static_cast<DeferredLog*>(arg)->LogLoop();
+    }, "deferred_log", DEFERRED_LOG_STACK_SIZE, this, 1, &task_);
+}
+
+// Any task, never waits: a full ring drops the entry
+void DeferredLog::Push(DeferredLogSite* site, const uint32_t* args) {
+    uint32_t position = head_.load(std::memory_order_relaxed);
+    Entry* entry;
+    while (true) {
+        entry = &ring_[position % DEFERRED_LOG_RING_SIZE];
+        int32_t diff = (int32_t)(entry->sequence.load(std::memory_order_acquire) - position);
+        if (diff == 0) {
+            if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            position = head_.load(std::memory_order_relaxed);
+        }
+    }
+    entry->site = site;
+    memcpy(entry->args, args, sizeof(entry->args));
+    entry->sequence.store(position + 1, std::memory_order_release);
+}
+
+void DeferredLog::LogLoop() {
+    uint32_t reported_drops = 0;
+    while (true) {
+        int64_t now = esp_timer_get_time();
+        while (true) {
+            auto& entry = ring_[tail_ % DEFERRED_LOG_RING_SIZE];
+            if (entry.sequence.load(std::memory_order_acquire) != tail_ + 1) {
+                break;
+            }
+            auto site = entry.site;
+            uint32_t args[DEFERRED_LOG_MAX_ARGS];
+            memcpy(args, entry.args, sizeof(args));
+            entry.sequence.store(tail_ + DEFERRED_LOG_RING_SIZE, std::memory_order_release);
+            tail_++;
+
+            if (!site->listed) {
+                site->listed = true;
+                sites_.push_back(site);
+            }
+            if (site->last_print_us != 0 && now - site->last_print_us < DEFERRED_LOG_INTERVAL_MS * 1000LL) {
+                // Kept for the summary when the interval is over
+                site->suppressed++;
+                memcpy(site->last_args, args, sizeof(args));
+                continue;
+            }
+            Print(site, args, site->suppressed);
+            site->suppressed = 0;
+            site->last_print_us = now;
+        }
+
+        // A site that went quiet still reports what it held back
+        for (auto site : sites_) {
+            if (site->suppressed > 0 && now - site->last_print_us >= DEFERRED_LOG_INTERVAL_MS * 1000LL) {
+                Print(site, site->last_args, site->suppressed - 1);
+                site->suppressed = 0;
+                site->last_print_us = now;
+            }
+        }
+
+        uint32_t dropped = dropped_.load(std::memory_order_relaxed);
+        if (dropped != reported_drops) {
+            ESP_LOGW(TAG, "Dropped %lu log entries, the ring was full", (unsigned long)(dropped - reported_drops));
+            reported_drops = dropped;
+        }
+        vTaskDelay(pdMS_TO_TICKS(DEFERRED_LOG_POLL_MS));
+    }
+}
+
+// `repeated` calls of the site since its last line are folded into this one
+void DeferredLog::Print(DeferredLogSite* site, const uint32_t* args, uint32_t repeated) {
+    char message[160];
+    // Unused arguments are ignored by the format
+    snprintf(message, sizeof(message), site->format, args[0], args[1], args[2], args[3]);
+    if (repeated > 0) {
+        ESP_LOG_LEVEL(site->level, site->tag, "%s (%lu more in %d ms)", message, (unsigned long)repeated,
+            DEFERRED_LOG_INTERVAL_MS);
+    } else {
+        ESP_LOG_LEVEL(site->level, site->tag, "%s", message);
+    }
+}
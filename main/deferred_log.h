@@ -0,0 +1,111 @@
+#ifndef DEFERRED_LOG_H
+#define DEFERRED_LOG_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include "sdkconfig.h"
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <type_traits>
+
+#define DEFERRED_LOG_MAX_ARGS 4
+// Entries waiting for the log task, when it is full new ones are dropped and counted
+#define DEFERRED_LOG_RING_SIZE 64
+#define DEFERRED_LOG_POLL_MS 100
+// A call site prints at most once in this interval, the calls in between are counted
+#define DEFERRED_LOG_INTERVAL_MS 1000
+#define DEFERRED_LOG_STACK_SIZE 3072
+
+// One per call site, created by the DEFERRED_LOG* macros. The format string is its ID
+struct DeferredLogSite {
+    esp_log_level_t level;
+    const char* tag;
+    const char* format;
+    // Only the log task touches these
+    bool listed = false;
+    int64_t last_print_us = 0;
+    uint32_t suppressed = 0;
+    uint32_t last_args[DEFERRED_LOG_MAX_ARGS] = {};
+};
+
+/*
+ * Logging for hot paths: the receive tasks under packet loss, the audio
+ * tasks, the scheduler when SRAM runs low. ESP_LOG formats on the calling
+ * task and waits for the UART, so a flood of warnings slows down the very
+ * path that is struggling.
+ *
+ * A call stores the address of its static site and up to
+ * DEFERRED_LOG_MAX_ARGS integer arguments into a lock-free ring, nothing is
+ * formatted and nothing waits. A low priority task formats the entries and
+ * rate limits every site to one line per DEFERRED_LOG_INTERVAL_MS: the
+ * repeats in between are counted and reported with the latest arguments.
+ * Strings are not accepted, the pointer may be gone before the line is
+ * formatted; the format string holds the constant text.
+ *
+ * Without CONFIG_USE_DEFERRED_LOG the macros are plain ESP_LOG calls.
+ */
+class DeferredLog {
+public:
+    static DeferredLog& GetInstance() {
+        static DeferredLog instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    DeferredLog(const DeferredLog&) = delete;
+    DeferredLog& operator=(const DeferredLog&) = delete;
+
+    // Entries written before this wait in the ring
+    void Start();
+
+    template <typename... Args>
+    inline void Write(DeferredLogSite* site, Args... args) {
+        static_assert(sizeof...(Args) <= DEFERRED_LOG_MAX_ARGS, "Too many arguments for a deferred log");
+        static_assert(((std::is_integral_v<Args> || std::is_enum_v<Args>) && ...),
+            "Only integers can be logged deferred");
+        uint32_t values[DEFERRED_LOG_MAX_ARGS] = { (uint32_t)args... };
+        Push(site, values);
+    }
+
+private:
+    DeferredLog();
+
+    struct Entry {
+        std::atomic<uint32_t> sequence;
+        DeferredLogSite* site;
+        uint32_t args[DEFERRED_LOG_MAX_ARGS];
+    };
+
+    // Bounded multi-producer queue: a slot is free for position p when its sequence is p,
+    // and holds the entry of position p when it is p + 1
+    Entry ring_[DEFERRED_LOG_RING_SIZE];
+    std::atomic<uint32_t> head_ = 0;
+    uint32_t tail_ = 0;
+    std::atomic<uint32_t> dropped_ = 0;
+    TaskHandle_t task_ = nullptr;
+
+    // Sites that printed, to report their repeats when they go quiet
+    std::vector<DeferredLogSite*> sites_;
+
+    void Push(DeferredLogSite* site, const uint32_t* args);
+    void LogLoop();
+    void Print(DeferredLogSite* site, const uint32_t* args, uint32_t repeated);
+};
+
+#if CONFIG_USE_DEFERRED_LOG
+#define DEFERRED_LOG_LEVEL(level, tag, format, ...) do { \
+        static DeferredLogSite deferred_log_site = { level, tag, format }; \
+        DeferredLog::GetInstance().Write(&deferred_log_site, ##__VA_ARGS__); \
+    } while (0)
+#define DEFERRED_LOGE(tag, format, ...) DEFERRED_LOG_LEVEL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define DEFERRED_LOGW(tag, format, ...) DEFERRED_LOG_LEVEL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define DEFERRED_LOGI(tag, format, ...) DEFERRED_LOG_LEVEL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#else
+#define DEFERRED_LOGE(tag, format, ...) ESP_LOGE(tag, format, ##__VA_ARGS__)
+#define DEFERRED_LOGW(tag, format, ...) ESP_LOGW(tag, format, ##__VA_ARGS__)
+#define DEFERRED_LOGI(tag, format, ...) ESP_LOGI(tag, format, ##__VA_ARGS__)
+#endif
+
+#endif // DEFERRED_LOG_H
@@ -0,0 +1,18 @@
+#ifndef DEVICE_STATE_H
+#define DEVICE_STATE_H
+
+enum DeviceState {
+    kDeviceStateUnknown,
+    kDeviceStateStarting,
+    kDeviceStateWifiConfiguring,
+    kDeviceStateIdle,
+    kDeviceStateConnecting,
+    kDeviceStateListening,
+    kDeviceStateSpeaking,
+    kDeviceStateUpgrading,
+    kDeviceStateActivating,
+    kDeviceStateAudioTesting,
+    kDeviceStateFatalError
+};
+
+#endif // DEVICE_STATE_H
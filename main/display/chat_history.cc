@@ -0,0 +1,121 @@
+#include "chat_history.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#define TAG "ChatHistory"
+
+static void* AllocatePreferPsram(size_t size) {
+    void* ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (ptr == nullptr) {
+        ptr = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    }
+    return ptr;
+}
+
+ChatHistory::ChatHistory(size_t capacity) : capacity_(capacity & ~(size_t)3) {
+    max_records_ = capacity_ / CHAT_HISTORY_BYTES_PER_RECORD;
+    data_ = (uint8_t*)AllocatePreferPsram(capacity_);
+    offsets_ = (uint32_t*)AllocatePreferPsram(max_records_ * sizeof(uint32_t));
+    if (data_ == nullptr || offsets_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes, the chat keeps no history", capacity_);
+        heap_caps_free(data_);
+        heap_caps_free(offsets_);
+        data_ = nullptr;
+        offsets_ = nullptr;
+    }
+}
+
+ChatHistory::~ChatHistory() {
+    heap_caps_free(data_);
+    heap_caps_free(offsets_);
+}
+
+uint32_t ChatHistory::Append(ChatRole role, const char* text) {
+    if (data_ == nullptr) {
+        // Nothing is kept, every sequence number is gone at once
+        first_ = ++next_;
+        return next_ - 1;
+    }
+    size_t full_length = strlen(text);
+    size_t length = std::min(full_length, std::min(capacity_ / 4, (size_t)UINT16_MAX));
+    // Cut on a UTF-8 character boundary
+    while (length > 0 && length < full_length && ((uint8_t)text[length] & 0xC0) == 0x80) {
+        length--;
+    }
+    size_t size = RecordSize(length);
+
+    if (empty()) {
+        tail_ = 0;
+    }
+    size_t position = tail_;
+    bool wrap = position + size > capacity_;
+    if (wrap) {
+        position = 0;
+    }
+    // The oldest records lie right after the tail, then from the start of the ring on.
+    // A wrap gives up the space after the tail, and everything still there
+    while (!empty()) {
+        size_t offset = offsets_[first_ % max_records_];
+        size_t end = offset + RecordSize(At(first_)->length);
+        bool overlaps = offset < position + size && end > position;
+        if (overlaps || (wrap && offset >= tail_) || next_ - first_ >= max_records_) {
+            first_++;
+        } else {
+            break;
+        }
+    }
+
+    auto record = (Record*)(data_ + position);
+    record->length = length;
+    record->role = role;
+    record->reserved = 0;
+    char* record_text = (char*)(record + 1);
+    memcpy(record_text, text, length);
+    record_text[length] = '\0';
+    offsets_[next_ % max_records_] = position;
+    tail_ = position + size;
+    return next_++;
+}
+
+bool ChatHistory::AppendToLast(ChatRole role, const char* text, size_t max_length) {
+    if (empty() || data_ == nullptr) {
+        return false;
+    }
+    auto record = At(next_ - 1);
+    size_t addition = strlen(text);
+    if (record->role != role || record->length + addition > max_length) {
+        return false;
+    }
+    // Rewritten as a new record, the ring takes care of the room it needs
+    std::string combined((const char*)(record + 1), record->length);
+    combined += text;
+    RemoveLast();
+    Append(role, combined.c_str());
+    return true;
+}
+
+void ChatHistory::RemoveLast() {
+    if (empty()) {
+        return;
+    }
+    next_--;
+    if (data_ != nullptr) {
+        tail_ = offsets_[next_ % max_records_];
+    }
+}
+
+const char* ChatHistory::Get(uint32_t sequence, ChatRole* role) const {
+    if (data_ == nullptr || !Contains(sequence)) {
+        return nullptr;
+    }
+    auto record = At(sequence);
+    if (role != nullptr) {
+        *role = (ChatRole)record->role;
+    }
+    return (const char*)(record + 1);
+}
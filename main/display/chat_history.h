@@ -0,0 +1,74 @@
+#ifndef CHAT_HISTORY_H
+#define CHAT_HISTORY_H
+
+#include <cstddef>
+#include <cstdint>
+
+// The index has one entry per this many bytes of the ring, a run of shorter messages is
+// limited by the index instead of the ring
+#define CHAT_HISTORY_BYTES_PER_RECORD 32
+
+enum ChatRole : uint8_t {
+    kChatRoleUser,
+    kChatRoleAssistant,
+    kChatRoleSystem,
+};
+
+/*
+ * The text of the chat, as compact records in one ring in PSRAM, internal RAM
+ * on boards without it.
+ *
+ * A record is a 4-byte header and the NUL-terminated text, addressed by a
+ * sequence number that grows with every message. A new record that finds no
+ * room evicts the oldest ones, so a session of any length keeps the same
+ * memory and the latest messages. The display only creates LVGL objects for
+ * the messages on screen and reads the others from here when scrolled to.
+ *
+ * Not thread safe, used under the display lock.
+ */
+class ChatHistory {
+public:
+    explicit ChatHistory(size_t capacity);
+    ~ChatHistory();
+    ChatHistory(const ChatHistory&) = delete;
+    ChatHistory& operator=(const ChatHistory&) = delete;
+
+    // Returns the sequence number of the message, text longer than a quarter of the ring is cut
+    uint32_t Append(ChatRole role, const char* text);
+    // Adds `text` to the last message if it has `role` and stays within `max_length`
+    bool AppendToLast(ChatRole role, const char* text, size_t max_length);
+    // Drops the newest message, the next one takes its sequence number
+    void RemoveLast();
+
+    // The text stays valid until the next change
+    const char* Get(uint32_t sequence, ChatRole* role) const;
+    inline bool Contains(uint32_t sequence) const { return sequence >= first_ && sequence < next_; }
+    inline bool empty() const { return first_ == next_; }
+    inline uint32_t first() const { return first_; }
+    inline uint32_t next() const { return next_; }
+
+private:
+    struct Record {
+        uint16_t length;    // Text bytes without the NUL
+        uint8_t role;
+        uint8_t reserved;
+    };
+
+    uint8_t* data_ = nullptr;
+    size_t capacity_ = 0;
+    // Offset of every live record, by sequence number modulo max_records_
+    uint32_t* offsets_ = nullptr;
+    uint32_t max_records_ = 0;
+    size_t tail_ = 0;           // Where the next record goes
+    uint32_t first_ = 0;        // Oldest live record
+    uint32_t next_ = 0;         // One past the newest
+
+    static inline size_t RecordSize(size_t length) {
+        return (sizeof(Record) + length + 1 + 3) & ~(size_t)3;
+    }
+    inline Record* At(uint32_t sequence) const {
+        return (Record*)(data_ + offsets_[sequence % max_records_]);
+    }
+};
+
+#endif // CHAT_HISTORY_H
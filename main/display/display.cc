@@ -1,8 +1,12 @@
 #include <esp_log.h>
 #include <esp_err.h>
+#include <esp_heap_caps.h>
 #include <string>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
+#include <cJSON.h>
+#include <esp_lvgl_port.h>
 
 #include "display.h"
 #include "board.h"
@@ -10,7 +14,15 @@
 #include "font_awesome_symbols.h"
 #include "audio_codec.h"
 #include "settings.h"
+#include "task_topology.h"
+#include "network_monitor.h"
 #include "assets/lang_config.h"
+#if CONFIG_USE_POWER_GOVERNOR
+#include "power_governor.h"
+#endif
+#if CONFIG_USE_PIPELINE_TRACE
+#include "pipeline_trace.h"
+#endif
 
 #define TAG "Display"
 
@@ -29,14 +41,6 @@ Display::Display() {
         .skip_unhandled_events = false,
     };
     ESP_ERROR_CHECK(esp_timer_create(&notification_timer_args, &notification_timer_));
-
-    // Create a power management lock
-    auto ret = esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "display_update", &pm_lock_);
-    if (ret == ESP_ERR_NOT_SUPPORTED) {
-        ESP_LOGI(TAG, "Power management not supported");
-    } else {
-        ESP_ERROR_CHECK(ret);
-    }
 }
 
 Display::~Display() {
@@ -56,8 +60,8 @@ Display::~Display() {
     if( low_battery_popup_ != nullptr ) {
         lv_obj_del(low_battery_popup_);
     }
-    if (pm_lock_ != nullptr) {
-        esp_pm_lock_delete(pm_lock_);
+    if (command_timer_ != nullptr) {
+        lv_timer_delete(command_timer_);
     }
 }
 
@@ -66,9 +70,15 @@ void Display::SetStatus(const char* status) {
     if (status_label_ == nullptr) {
         return;
     }
-    lv_label_set_text(status_label_, status);
-    lv_obj_clear_flag(status_label_, LV_OBJ_FLAG_HIDDEN);
-    lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
+    // The same text, or showing a label that is already shown, would still invalidate it. The clock is
+    // queued every 10 seconds and a state often repeats, so only an actual change is redrawn
+    if (strcmp(lv_label_get_text(status_label_), status) != 0) {
+        lv_label_set_text(status_label_, status);
+    }
+    if (lv_obj_has_flag(status_label_, LV_OBJ_FLAG_HIDDEN)) {
+        lv_obj_clear_flag(status_label_, LV_OBJ_FLAG_HIDDEN);
+        lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
+    }
 }
 
 void Display::ShowNotification(const std::string &notification, int duration_ms) {
@@ -92,23 +102,19 @@ void Display::UpdateStatusBar(bool update_all) {
     auto& board = Board::GetInstance();
     auto codec = board.GetAudioCodec();
 
-    {
-        DisplayLockGuard lock(this);
-        if (mute_label_ == nullptr) {
-            return;
-        }
+    // The values are gathered here, only the label changes go to the LVGL task
+    if (mute_label_ == nullptr) {
+        return;
+    }
 
-        // 如果静音状态改变，则更新图标
-        if (codec->output_volume() == 0 && !muted_) {
-            muted_ = true;
-            lv_label_set_text(mute_label_, FONT_AWESOME_VOLUME_MUTE);
-        } else if (codec->output_volume() > 0 && muted_) {
-            muted_ = false;
-            lv_label_set_text(mute_label_, "");
-        }
+    // 如果静音状态改变，则更新图标
+    if ((codec->output_volume() == 0) != muted_) {
+        muted_ = !muted_;
+        PostCommand(kDisplayCommandMuteIcon, [this, muted = muted_]() {
+            lv_label_set_text(mute_label_, muted ? FONT_AWESOME_VOLUME_MUTE : "");
+        });
     }
 
-    esp_pm_lock_acquire(pm_lock_);
     // 更新电池图标
     int battery_level;
     bool charging, discharging;
@@ -127,53 +133,185 @@ void Display::UpdateStatusBar(bool update_all) {
             };
             icon = levels[battery_level / 20];
         }
-        DisplayLockGuard lock(this);
         if (battery_label_ != nullptr && battery_icon_ != icon) {
             battery_icon_ = icon;
-            lv_label_set_text(battery_label_, battery_icon_);
+            PostCommand(kDisplayCommandBatteryIcon, [this, icon]() {
+                lv_label_set_text(battery_label_, icon);
+            });
         }
 
         if (low_battery_popup_ != nullptr) {
-            if (strcmp(icon, FONT_AWESOME_BATTERY_EMPTY) == 0 && discharging) {
-                if (lv_obj_has_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN)) { // 如果低电量提示框隐藏，则显示
-                    lv_obj_clear_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
+            bool low_battery = strcmp(icon, FONT_AWESOME_BATTERY_EMPTY) == 0 && discharging;
+            if (low_battery != low_battery_shown_) {
+                low_battery_shown_ = low_battery;
+                if (low_battery) { // 如果低电量提示框隐藏，则显示
                     auto& app = Application::GetInstance();
                     app.PlaySound(Lang::Sounds::P3_LOW_BATTERY);
                 }
-            } else {
-                // Hide the low battery popup when the battery is not empty
-                if (!lv_obj_has_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN)) { // 如果低电量提示框显示，则隐藏
-                    lv_obj_add_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
-                }
+                PostCommand(kDisplayCommandLowBattery, [this, low_battery]() {
+                    if (low_battery) {
+                        lv_obj_clear_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
+                    } else {
+                        lv_obj_add_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
+                    }
+                });
             }
         }
     }
 
-    // 每 10 秒更新一次网络图标
-    static int seconds_counter = 0;
-    if (update_all || seconds_counter++ % 10 == 0) {
-        // 升级固件时，不读取 4G 网络状态，避免占用 UART 资源
-        auto device_state = Application::GetInstance().GetDeviceState();
-        static const std::vector<DeviceState> allowed_states = {
-            kDeviceStateIdle,
-            kDeviceStateStarting,
-            kDeviceStateWifiConfiguring,
-            kDeviceStateListening,
-            kDeviceStateActivating,
-        };
-        if (std::find(allowed_states.begin(), allowed_states.end(), device_state) != allowed_states.end()) {
-            icon = board.GetNetworkStateIcon();
-            if (network_label_ != nullptr && icon != nullptr && network_icon_ != icon) {
-                DisplayLockGuard lock(this);
-                network_icon_ = icon;
-                lv_label_set_text(network_label_, network_icon_);
+    // 网络图标由 NetworkMonitor 在后台采样，这里只读取缓存
+    icon = NetworkMonitor::GetInstance().GetNetworkStateIcon();
+    if (network_label_ != nullptr && icon != nullptr && network_icon_ != icon) {
+        network_icon_ = icon;
+        PostCommand(kDisplayCommandNetworkIcon, [this, icon]() {
+            lv_label_set_text(network_label_, icon);
+        });
+    }
+}
+
+void Display::QueueStatus(std::string status) {
+    PostCommand(kDisplayCommandStatus, [this, status = std::move(status)]() {
+        SetStatus(status.c_str());
+    });
+}
+
+void Display::QueueEmotion(std::string emotion) {
+    PostCommand(kDisplayCommandEmotion, [this, emotion = std::move(emotion)]() {
+        SetEmotion(emotion.c_str());
+    });
+}
+
+void Display::QueueIcon(const char* icon) {
+    PostCommand(kDisplayCommandEmotion, [this, icon]() {
+        SetIcon(icon);
+    });
+}
+
+void Display::QueueNotification(std::string notification, int duration_ms) {
+    PostCommand(kDisplayCommandNotification, [this, notification = std::move(notification), duration_ms]() {
+        ShowNotification(notification.c_str(), duration_ms);
+    });
+}
+
+void Display::QueueChatMessage(const char* role, std::string content) {
+    PostCommand(kDisplayCommandChatMessage, [this, role, content = std::move(content)]() {
+        SetChatMessage(role, content.c_str());
+    });
+}
+
+lvgl_port_cfg_t Display::GetPortConfig() {
+    auto& topology = TaskTopology::GetInstance();
+    auto& task = topology.Get(kTaskDisplay);
+    lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
+    port_cfg.task_priority = task.priority;
+    port_cfg.task_stack = task.stack_size;
+    port_cfg.task_affinity = task.core == tskNO_AFFINITY ? -1 : task.core;
+    port_cfg.task_stack_caps = topology.GetStackCaps(kTaskDisplay);
+    return port_cfg;
+}
+
+void Display::PostCommand(DisplayCommand kind, std::function<void()> command) {
+    // Without LVGL there is no task to hand over to, and nothing to wait for
+    if (display_ == nullptr) {
+        command();
+        return;
+    }
+
+    if (command_timer_ == nullptr) {
+        // Once, the first update after the UI is set up waits for the lock to create the timer
+        DisplayLockGuard lock(this);
+        if (command_timer_ == nullptr) {
+            command_timer_ = lv_timer_create([](lv_timer_t* timer) {
+                static_cast<Display*>(lv_timer_get_user_data(timer))->RunCommands();
+            }, refresh_period_ms_, this);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    if (kind != kDisplayCommandChatMessage) {
+        for (auto& pending : pending_commands_) {
+            if (pending.first == kind) {
+                pending.second = std::move(command);
+                return;
             }
         }
     }
+    pending_commands_.emplace_back(kind, std::move(command));
+}
 
-    esp_pm_lock_release(pm_lock_);
+// On the LVGL task with the display lock held, so the setters take it again without waiting
+void Display::RunCommands() {
+    MemoryTagScope tag(kMemoryTagDisplay);
+    std::vector<std::pair<DisplayCommand, std::function<void()>>> commands;
+    {
+        std::lock_guard<std::mutex> lock(command_mutex_);
+        if (pending_commands_.empty()) {
+            return;
+        }
+        commands.swap(pending_commands_);
+    }
+    for (auto& [kind, command] : commands) {
+        command();
+    }
 }
 
+void Display::SetRefreshHint(DisplayRefreshHint hint, bool enabled) {
+    if (display_ == nullptr) {
+        return;
+    }
+    DisplayLockGuard lock(this);
+    uint8_t hints = enabled ? (refresh_hints_ | hint) : (refresh_hints_ & ~hint);
+    if (hints == refresh_hints_ && port_tick_stopped_) {
+        return;
+    }
+    refresh_hints_ = hints;
+    ApplyRefreshHints();
+}
+
+// With the display lock held
+void Display::ApplyRefreshHints() {
+    if (!port_tick_stopped_) {
+        // LVGL reads the clock itself, so the port's periodic tick would only wake the CPU. Stopping the
+        // port also disables the LVGL timers, they come back below
+        lv_tick_set_cb([]() { return (uint32_t)(esp_timer_get_time() / 1000); });
+        lvgl_port_stop();
+        port_tick_stopped_ = true;
+    }
+
+    bool screen_off = refresh_hints_ & kRefreshHintScreenOff;
+#if CONFIG_USE_POWER_GOVERNOR
+    // An animation draws every frame, the rest of the screen updates fine at the minimum clock
+    PowerGovernor::GetInstance().SetDemand(kPowerDemandDisplay, (refresh_hints_ & kRefreshHintAnimation) &&
+        !(refresh_hints_ & (kRefreshHintScreenOff | kRefreshHintSleep)));
+#endif
+    lv_timer_enable(!screen_off);
+    if (screen_off) {
+        ESP_LOGI(TAG, "Screen off, LVGL stopped");
+        return;
+    }
+
+    uint32_t period = DISPLAY_REFRESH_IDLE_MS;
+    if (refresh_hints_ & kRefreshHintActive) {
+        period = DISPLAY_REFRESH_ACTIVE_MS;
+    } else if (refresh_hints_ & kRefreshHintSleep) {
+        period = DISPLAY_REFRESH_SLEEP_MS;
+    } else if (refresh_hints_ & kRefreshHintAnimation) {
+        period = DISPLAY_REFRESH_ACTIVE_MS;
+    }
+    if (period == refresh_period_ms_) {
+        return;
+    }
+    refresh_period_ms_ = period;
+    lv_timer_t* refresh_timer = lv_display_get_refr_timer(display_);
+    if (refresh_timer != nullptr) {
+        lv_timer_set_period(refresh_timer, period);
+    }
+    // A queued update is drawn on the next refresh anyway, looking for it more often gains nothing
+    if (command_timer_ != nullptr) {
+        lv_timer_set_period(command_timer_, period);
+    }
+    ESP_LOGI(TAG, "Refresh period %lu ms", (unsigned long)period);
+}
 
 void Display::SetEmotion(const char* emotion) {
     struct Emotion {
@@ -248,3 +386,181 @@ void Display::SetTheme(const std::string& theme_name) {
     Settings settings("display", true);
     settings.SetString("theme", theme_name);
 }
+
+#if CONFIG_USE_PIPELINE_TRACE
+void Display::EnablePipelineTrace() {
+    if (display_ == nullptr) {
+        return;
+    }
+    DisplayLockGuard lock(this);
+    lv_display_add_event_cb(display_, [](lv_event_t* e) {
+        auto& trace = PipelineTrace::GetInstance();
+        switch (lv_event_get_code(e)) {
+            case LV_EVENT_FLUSH_START:
+                trace.Emit(kPipelineEventDisplayFlush, kPipelinePhaseBegin);
+                break;
+            case LV_EVENT_FLUSH_FINISH:
+                trace.Emit(kPipelineEventDisplayFlush, kPipelinePhaseEnd);
+                break;
+            case LV_EVENT_FLUSH_WAIT_START:
+                trace.Emit(kPipelineEventDisplayWait, kPipelinePhaseBegin);
+                break;
+            case LV_EVENT_FLUSH_WAIT_FINISH:
+                trace.Emit(kPipelineEventDisplayWait, kPipelinePhaseEnd);
+                break;
+            default:
+                break;
+        }
+    }, LV_EVENT_ALL, nullptr);
+}
+#endif
+
+#if CONFIG_USE_DISPLAY_BENCHMARK
+// A wait for the previous strip shorter than this is the usual end-of-frame check, not a stall
+#define BENCHMARK_STALL_US 100
+
+struct BenchmarkCounters {
+    uint32_t flushes = 0;
+    uint32_t stalls = 0;
+    int64_t flush_us = 0;
+    int64_t wait_us = 0;
+    int64_t event_start_us = 0;
+};
+
+// flush_cb only starts the transfer. Waiting for the bus to hand a buffer back is the stall
+static void CountBenchmarkEvent(lv_event_t* e) {
+    auto counters = (BenchmarkCounters*)lv_event_get_user_data(e);
+    int64_t now_us = esp_timer_get_time();
+    switch (lv_event_get_code(e)) {
+        case LV_EVENT_FLUSH_START:
+            counters->flushes++;
+            counters->event_start_us = now_us;
+            break;
+        case LV_EVENT_FLUSH_FINISH:
+            counters->flush_us += now_us - counters->event_start_us;
+            break;
+        case LV_EVENT_FLUSH_WAIT_START:
+            counters->event_start_us = now_us;
+            break;
+        case LV_EVENT_FLUSH_WAIT_FINISH:
+            counters->wait_us += now_us - counters->event_start_us;
+            if (now_us - counters->event_start_us >= BENCHMARK_STALL_US) {
+                counters->stalls++;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// The frame time covers the widget update, rendering and the bus transfer, as the panel sees it.
+// The CPU load is the share of it not spent waiting for the bus
+static cJSON* RunBenchmarkScene(lv_display_t* display, BenchmarkCounters& counters, int frames,
+    const std::function<void(int)>& update) {
+    counters = BenchmarkCounters();
+    int64_t total_us = 0;
+    int64_t max_us = 0;
+    for (int i = 0; i < frames; i++) {
+        int64_t start_us = esp_timer_get_time();
+        update(i);
+        lv_refr_now(display);
+        int64_t frame_us = esp_timer_get_time() - start_us;
+        total_us += frame_us;
+        max_us = std::max(max_us, frame_us);
+    }
+
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "fps", total_us > 0 ? frames * 1000000.0 / total_us : 0);
+    cJSON_AddNumberToObject(json, "mean_frame_ms", total_us / 1000.0 / frames);
+    cJSON_AddNumberToObject(json, "max_frame_ms", max_us / 1000.0);
+    cJSON_AddNumberToObject(json, "flushes_per_frame", (double)counters.flushes / frames);
+    cJSON_AddNumberToObject(json, "flush_ms_per_frame", counters.flush_us / 1000.0 / frames);
+    cJSON_AddNumberToObject(json, "wait_ms_per_frame", counters.wait_us / 1000.0 / frames);
+    cJSON_AddNumberToObject(json, "stalls", counters.stalls);
+    cJSON_AddNumberToObject(json, "cpu_load", total_us > 0 ? (double)(total_us - counters.wait_us) / total_us : 0);
+    return json;
+}
+
+std::string Display::RunRenderBenchmark(int frames) {
+    if (display_ == nullptr) {
+        return "{\"error\":\"No LVGL display\"}";
+    }
+    frames = std::max(frames, 1);
+    DisplayLockGuard lock(this);
+    BenchmarkCounters counters;
+    lv_display_add_event_cb(display_, CountBenchmarkEvent, LV_EVENT_ALL, &counters);
+
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "board", BOARD_NAME);
+    cJSON_AddNumberToObject(json, "width", width_);
+    cJSON_AddNumberToObject(json, "height", height_);
+    cJSON_AddNumberToObject(json, "frames", frames);
+    cJSON* scenes = cJSON_AddObjectToObject(json, "scenes");
+
+    cJSON_AddItemToObject(scenes, "fill", RunBenchmarkScene(display_, counters, frames, [](int) {
+        lv_obj_invalidate(lv_screen_active());
+    }));
+
+    static const char* const chat_lines[] = {
+        "The quick brown fox jumps over the lazy dog.",
+        "今天天气很好，我们一起出去走走吧！",
+        "A longer reply wraps over several lines, so the chat area has to lay out and redraw more text than a short one does.",
+    };
+    cJSON_AddItemToObject(scenes, "chat_scroll", RunBenchmarkScene(display_, counters, frames, [this](int i) {
+        SetChatMessage(i % 2 ? "user" : "assistant", chat_lines[i % 3]);
+    }));
+
+    static const char* const emotions[] = {"happy", "sad", "angry", "surprised", "thinking", "neutral"};
+    cJSON_AddItemToObject(scenes, "emoji", RunBenchmarkScene(display_, counters, frames, [this](int i) {
+        SetEmotion(emotions[i % 6]);
+    }));
+
+    // Two gradients at the size of the camera preview, alternated so every frame changes the image.
+    // The display may keep pointing at them after the run, so they stay allocated for the next one
+    static lv_img_dsc_t images[2] = {};
+    int image_width = std::max(width_ / 2, 1);
+    int image_height = std::max(height_ / 2, 1);
+    for (int k = 0; k < 2 && images[k].data == nullptr; k++) {
+        size_t size = image_width * image_height * 2;
+        auto pixels = (uint16_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (pixels == nullptr) {
+            pixels = (uint16_t*)heap_caps_malloc(size, MALLOC_CAP_8BIT);
+        }
+        if (pixels == nullptr) {
+            break;
+        }
+        for (int y = 0; y < image_height; y++) {
+            for (int x = 0; x < image_width; x++) {
+                pixels[y * image_width + x] = lv_color_to_u16(
+                    lv_color_make(x * 255 / image_width, y * 255 / image_height, k * 255));
+            }
+        }
+        images[k].header.magic = LV_IMAGE_HEADER_MAGIC;
+        images[k].header.cf = LV_COLOR_FORMAT_RGB565;
+        images[k].header.w = image_width;
+        images[k].header.h = image_height;
+        images[k].header.stride = image_width * 2;
+        images[k].data_size = size;
+        images[k].data = (const uint8_t*)pixels;
+    }
+    if (images[0].data != nullptr && images[1].data != nullptr) {
+        cJSON_AddItemToObject(scenes, "preview_image", RunBenchmarkScene(display_, counters, frames, [this](int i) {
+            SetPreviewImage(&images[i % 2]);
+        }));
+    } else {
+        ESP_LOGW(TAG, "Failed to allocate the preview images, skipping that scene");
+    }
+
+    lv_display_remove_event_cb_with_user_data(display_, CountBenchmarkEvent, &counters);
+    SetPreviewImage(nullptr);
+    SetEmotion("neutral");
+    SetChatMessage("system", "");
+
+    auto str = cJSON_PrintUnformatted(json);
+    std::string result(str);
+    cJSON_free(str);
+    cJSON_Delete(json);
+    ESP_LOGI(TAG, "Render benchmark: %s", result.c_str());
+    return result;
+}
+#endif
@@ -2,11 +2,33 @@
 #define DISPLAY_H
 
 #include <lvgl.h>
+#include <esp_lvgl_port.h>
 #include <esp_timer.h>
 #include <esp_log.h>
 #include <esp_pm.h>
 
+#include "memory_accounting.h"
+
 #include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <functional>
+
+// How often the LVGL task looks for queued updates, about one refresh period
+#define DISPLAY_COMMAND_PERIOD_MS 30
+// Refresh periods of the frame-rate governor, while something moves, while idle and in sleep mode
+#define DISPLAY_REFRESH_ACTIVE_MS 33
+#define DISPLAY_REFRESH_IDLE_MS 100
+#define DISPLAY_REFRESH_SLEEP_MS 500
+
+// What the refresh rate follows. Each source sets or clears only its own hint
+enum DisplayRefreshHint {
+    kRefreshHintActive = 1 << 0,        // A conversation is going on
+    kRefreshHintAnimation = 1 << 1,     // The screen shows an animation even while idle
+    kRefreshHintSleep = 1 << 2,         // The power save timer put the device to sleep
+    kRefreshHintScreenOff = 1 << 3,     // The backlight is off, nothing drawn would be seen
+};
 
 struct DisplayFonts {
     const lv_font_t* text_font = nullptr;
@@ -29,6 +51,26 @@ public:
     virtual void SetTheme(const std::string& theme_name);
     virtual std::string GetTheme() { return current_theme_name_; }
     virtual void UpdateStatusBar(bool update_all = false);
+    // A conversation refreshes at DISPLAY_REFRESH_ACTIVE_MS, sleep slows down to DISPLAY_REFRESH_SLEEP_MS
+    // and a dark screen stops LVGL until the backlight comes back
+    void SetRefreshHint(DisplayRefreshHint hint, bool enabled);
+
+    // Callable from any task without waiting for a flush: the update is drawn by the LVGL task, and a
+    // status or emotion still waiting there is replaced by the newer one
+    void QueueStatus(std::string status);
+    void QueueEmotion(std::string emotion);
+    void QueueIcon(const char* icon);
+    void QueueNotification(std::string notification, int duration_ms = 3000);
+    void QueueChatMessage(const char* role, std::string content);
+#if CONFIG_USE_DISPLAY_BENCHMARK
+    // Runs each scene (full-screen fill, chat scroll, emoji, preview image) for `frames` frames and returns
+    // FPS, frame and flush times, bus stalls and CPU load per scene as JSON
+    std::string RunRenderBenchmark(int frames);
+#endif
+#if CONFIG_USE_PIPELINE_TRACE
+    // Flushes and waits for the panel become spans of the pipeline trace
+    void EnablePipelineTrace();
+#endif
 
     inline int width() const { return width_; }
     inline int height() const { return height_; }
@@ -37,7 +79,6 @@ protected:
     int width_ = 0;
     int height_ = 0;
     
-    esp_pm_lock_handle_t pm_lock_ = nullptr;
     lv_display_t *display_ = nullptr;
 
     lv_obj_t *emotion_label_ = nullptr;
@@ -57,9 +98,38 @@ protected:
 
     esp_timer_handle_t notification_timer_ = nullptr;
 
+    // Display updates for the LVGL task. Commands of the same kind replace each other, except chat messages.
+    // An icon goes to the emotion label, so it is an emotion command
+    enum DisplayCommand {
+        kDisplayCommandStatus,
+        kDisplayCommandNotification,
+        kDisplayCommandEmotion,
+        kDisplayCommandChatMessage,
+        kDisplayCommandMuteIcon,
+        kDisplayCommandBatteryIcon,
+        kDisplayCommandNetworkIcon,
+        kDisplayCommandLowBattery,
+    };
+    void PostCommand(DisplayCommand kind, std::function<void()> command);
+    // esp_lvgl_port settings with the LVGL task placed by the kTaskDisplay row of the task topology
+    static lvgl_port_cfg_t GetPortConfig();
+
     friend class DisplayLockGuard;
     virtual bool Lock(int timeout_ms = 0) = 0;
     virtual void Unlock() = 0;
+
+private:
+    // Only held to move commands in and out, never while drawing
+    std::mutex command_mutex_;
+    std::vector<std::pair<DisplayCommand, std::function<void()>>> pending_commands_;
+    std::atomic<lv_timer_t*> command_timer_ = nullptr;
+    bool low_battery_shown_ = false;
+    uint8_t refresh_hints_ = 0;
+    uint32_t refresh_period_ms_ = DISPLAY_COMMAND_PERIOD_MS;
+    bool port_tick_stopped_ = false;
+
+    void RunCommands();
+    void ApplyRefreshHints();
 };
 
 
@@ -76,6 +146,8 @@ public:
 
 private:
     Display *display_;
+    // LVGL objects created while the display is locked are display memory
+    MemoryTagScope tag_{kMemoryTagDisplay};
 };
 
 class NoDisplay : public Display {
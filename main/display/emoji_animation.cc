@@ -0,0 +1,222 @@
+#include "emoji_animation.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+
+#define TAG "EmojiAnimation"
+
+EmojiAnimation::EmojiAnimation(lv_obj_t* parent, lv_color_t background) : background_(background) {
+    image_ = lv_image_create(parent);
+    timer_ = lv_timer_create([](lv_timer_t* timer) {
+        static_cast<EmojiAnimation*>(lv_timer_get_user_data(timer))->OnTick();
+    }, EMOJI_ANIMATION_TICK_MS, this);
+}
+
+EmojiAnimation::~EmojiAnimation() {
+    lv_timer_delete(timer_);
+    lv_obj_delete(image_);
+    if (gif_ != nullptr) {
+        gd_close_gif(gif_);
+    }
+    for (auto& clip : clips_) {
+        Uncache(clip);
+    }
+    heap_caps_free(scratch_);
+}
+
+void EmojiAnimation::SetSource(const lv_image_dsc_t* gif) {
+    if (clip_ != nullptr && clip_->source == gif) {
+        return;
+    }
+
+    // A clip left half decoded starts over next time, only complete clips stay in the cache
+    if (gif_ != nullptr) {
+        gd_close_gif(gif_);
+        gif_ = nullptr;
+    }
+    if (clip_ != nullptr && !clip_->complete) {
+        Uncache(*clip_);
+        clips_.pop_front();
+    }
+    heap_caps_free(scratch_);
+    scratch_ = nullptr;
+    clip_ = nullptr;
+    frame_start_ms_ = lv_tick_get();
+    if (gif == nullptr) {
+        Clear();
+        return;
+    }
+
+    auto it = std::find_if(clips_.begin(), clips_.end(), [gif](const Clip& clip) { return clip.source == gif; });
+    if (it != clips_.end()) {
+        clips_.splice(clips_.begin(), clips_, it);
+        clip_ = &clips_.front();
+        frame_index_ = 0;
+        frame_delay_ms_ = clip_->delays_ms[0];
+        ShowFrame(clip_->frames[0]);
+        return;
+    }
+
+    gif_ = gd_open_gif_data(gif->data);
+    if (gif_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to open the GIF");
+        Clear();
+        return;
+    }
+    clips_.push_front(Clip{gif, gif_->width, gif_->height});
+    clip_ = &clips_.front();
+    // Known not to fit, so it does not push the other clips out again
+    clip_->cached = std::find(oversized_.begin(), oversized_.end(), gif) == oversized_.end();
+    if (!DecodeFrame()) {
+        gd_close_gif(gif_);
+        gif_ = nullptr;
+        clips_.pop_front();
+        clip_ = nullptr;
+        Clear();
+    }
+}
+
+void EmojiAnimation::OnTick() {
+    if (clip_ == nullptr) {
+        return;
+    }
+    uint32_t elapsed = lv_tick_elaps(frame_start_ms_);
+    if (elapsed < frame_delay_ms_) {
+        return;
+    }
+
+    if (!clip_->complete) {
+        // Every frame has to go through the decoder, a late one is only shown late
+        frame_start_ms_ = lv_tick_get();
+        if (!DecodeFrame()) {
+            SetSource(nullptr);
+        }
+        return;
+    }
+
+    // Step over the frames that are already past, only the one due now is drawn
+    size_t count = clip_->frames.size();
+    while (elapsed >= frame_delay_ms_) {
+        elapsed -= frame_delay_ms_;
+        frame_index_ = (frame_index_ + 1) % count;
+        frame_delay_ms_ = clip_->delays_ms[frame_index_];
+    }
+    frame_start_ms_ = lv_tick_get() - elapsed;
+    ShowFrame(clip_->frames[frame_index_]);
+}
+
+bool EmojiAnimation::DecodeFrame() {
+    int ret = gd_get_frame(gif_);
+    if (ret == 0 && clip_->cached && !clip_->frames.empty()) {
+        gd_close_gif(gif_);
+        gif_ = nullptr;
+        clip_->complete = true;
+        ESP_LOGI(TAG, "Cached %u frames of %ux%u, %u KB in total", (unsigned)clip_->frames.size(),
+            clip_->width, clip_->height, (unsigned)(cached_bytes_ / 1024));
+        frame_index_ = 0;
+        frame_delay_ms_ = clip_->delays_ms[0];
+        ShowFrame(clip_->frames[0]);
+        return true;
+    }
+    if (ret == 0 && !clip_->cached) {
+        gd_rewind(gif_);
+        ret = gd_get_frame(gif_);
+    }
+    if (ret <= 0) {
+        ESP_LOGE(TAG, "Failed to decode a GIF frame");
+        return false;
+    }
+    gd_render_frame(gif_, gif_->canvas);
+
+    uint16_t* pixels = clip_->cached ? AllocateFrame() : scratch_;
+    if (pixels == nullptr) {
+        if (clip_->cached) {
+            ESP_LOGW(TAG, "A %ux%u clip does not fit the cache, decoding every loop", clip_->width, clip_->height);
+            Uncache(*clip_);
+            clip_->cached = false;
+            oversized_.push_back(clip_->source);
+        }
+        size_t bytes = clip_->width * clip_->height * sizeof(uint16_t);
+        scratch_ = (uint16_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (scratch_ == nullptr) {
+            scratch_ = (uint16_t*)heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+        }
+        if (scratch_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate a frame");
+            return false;
+        }
+        pixels = scratch_;
+    }
+
+    // The canvas is ARGB8888 in memory order B, G, R, A, pixels left transparent take the background
+    const uint8_t* canvas = gif_->canvas;
+    size_t count = clip_->width * clip_->height;
+    for (size_t i = 0; i < count; i++, canvas += 4) {
+        lv_color_t color = lv_color_make(canvas[2], canvas[1], canvas[0]);
+        if (canvas[3] != LV_OPA_COVER) {
+            color = lv_color_mix(color, background_, canvas[3]);
+        }
+        pixels[i] = lv_color_to_u16(color);
+    }
+
+    frame_delay_ms_ = std::max<uint16_t>(gif_->gce.delay * 10, EMOJI_ANIMATION_TICK_MS);
+    if (clip_->cached) {
+        clip_->frames.push_back(pixels);
+        clip_->delays_ms.push_back(frame_delay_ms_);
+    }
+    ShowFrame(pixels);
+    return true;
+}
+
+// Makes room by dropping the clips shown least recently, never the one being decoded
+uint16_t* EmojiAnimation::AllocateFrame() {
+    size_t bytes = clip_->width * clip_->height * sizeof(uint16_t);
+    while (cached_bytes_ + bytes > EMOJI_ANIMATION_CACHE_BYTES && &clips_.back() != clip_) {
+        Uncache(clips_.back());
+        clips_.pop_back();
+    }
+    if (cached_bytes_ + bytes > EMOJI_ANIMATION_CACHE_BYTES) {
+        return nullptr;
+    }
+    auto pixels = (uint16_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (pixels != nullptr) {
+        cached_bytes_ += bytes;
+    }
+    return pixels;
+}
+
+void EmojiAnimation::Uncache(Clip& clip) {
+    for (auto pixels : clip.frames) {
+        heap_caps_free(pixels);
+        cached_bytes_ -= clip.width * clip.height * sizeof(uint16_t);
+    }
+    clip.frames.clear();
+    clip.delays_ms.clear();
+    clip.complete = false;
+}
+
+// The buffers of the last frame may be gone, nothing is drawn until the next clip
+void EmojiAnimation::Clear() {
+    lv_image_set_src(image_, nullptr);
+    frame_dsc_.header.w = 0;
+    frame_dsc_.header.h = 0;
+}
+
+// The descriptor is reused for every frame, so LVGL is told its data changed
+void EmojiAnimation::ShowFrame(const uint16_t* pixels) {
+    bool resized = frame_dsc_.header.w != clip_->width || frame_dsc_.header.h != clip_->height;
+    frame_dsc_.header.magic = LV_IMAGE_HEADER_MAGIC;
+    frame_dsc_.header.cf = LV_COLOR_FORMAT_RGB565;
+    frame_dsc_.header.w = clip_->width;
+    frame_dsc_.header.h = clip_->height;
+    frame_dsc_.header.stride = clip_->width * sizeof(uint16_t);
+    frame_dsc_.data_size = clip_->width * clip_->height * sizeof(uint16_t);
+    frame_dsc_.data = (const uint8_t*)pixels;
+    lv_image_cache_drop(&frame_dsc_);
+    if (resized) {
+        lv_image_set_src(image_, &frame_dsc_);
+    } else {
+        lv_obj_invalidate(image_);
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef EMOJI_ANIMATION_H
+#define EMOJI_ANIMATION_H
+
+#include <lvgl.h>
+#include <libs/gif/gifdec.h>
+
+#include <list>
+#include <vector>
+#include <cstdint>
+
+// The decoded frames of all clips together stay below this, in PSRAM
+#ifdef CONFIG_EMOJI_ANIMATION_CACHE_KB
+#define EMOJI_ANIMATION_CACHE_BYTES (CONFIG_EMOJI_ANIMATION_CACHE_KB * 1024)
+#else
+#define EMOJI_ANIMATION_CACHE_BYTES 0
+#endif
+// How often the player looks for a due frame, GIF delays come in 10 ms steps
+#define EMOJI_ANIMATION_TICK_MS 10
+
+/*
+ * Plays GIF emotions from a cache of decoded frames.
+ *
+ * lv_gif runs the LZW decoder and converts the palette for every frame of
+ * every loop. Here the first loop of a clip is decoded while it plays, and each
+ * frame is kept in PSRAM as RGB565, already blended over the background. Later
+ * loops only point the image at the next buffer, which LVGL copies straight to
+ * the panel. When a new clip does not fit, the clips shown least recently make
+ * room. A clip that can never fit is decoded every loop, as lv_gif does.
+ *
+ * The frame drawn is the one due by the clock. If the LVGL task falls behind,
+ * the frames in between are skipped so the animation does not slow down.
+ * Every call is made with the display lock held.
+ */
+class EmojiAnimation {
+public:
+    EmojiAnimation(lv_obj_t* parent, lv_color_t background);
+    ~EmojiAnimation();
+
+    lv_obj_t* object() const { return image_; }
+    // A descriptor holding GIF data, as lv_gif_set_src takes it, or nullptr to stop
+    void SetSource(const lv_image_dsc_t* gif);
+
+private:
+    struct Clip {
+        const lv_image_dsc_t* source;
+        uint16_t width;
+        uint16_t height;
+        std::vector<uint16_t*> frames;
+        std::vector<uint16_t> delays_ms;
+        bool complete = false;  // Every frame is in the cache
+        bool cached = true;     // False once the clip did not fit, it keeps decoding into scratch_
+    };
+
+    lv_obj_t* image_ = nullptr;
+    lv_timer_t* timer_ = nullptr;
+    lv_color_t background_;
+    lv_image_dsc_t frame_dsc_ = {};
+    std::list<Clip> clips_;         // The most recently shown first
+    std::vector<const lv_image_dsc_t*> oversized_;
+    Clip* clip_ = nullptr;
+    gd_GIF* gif_ = nullptr;         // Open while the current clip is being decoded
+    uint16_t* scratch_ = nullptr;   // The one frame of a clip that is not cached
+    size_t cached_bytes_ = 0;
+    size_t frame_index_ = 0;
+    uint16_t frame_delay_ms_ = 0;
+    uint32_t frame_start_ms_ = 0;
+
+    void OnTick();
+    bool DecodeFrame();
+    uint16_t* AllocateFrame();
+    void Uncache(Clip& clip);
+    void Clear();
+    void ShowFrame(const uint16_t* pixels);
+};
+
+#endif // EMOJI_ANIMATION_H
@@ -1,44 +1,142 @@
 #include "esplog_display.h"
 
-#include "esp_log.h"
+#include <esp_log.h>
+#include <cstdio>
 
 #define TAG "EspLogDisplay"
 
 
-EspLogDisplay::EspLogDisplay()
-{}
+EspLogDisplay::EspLogDisplay() {
+    xTaskCreate([](void* arg) {
+        auto display = static_cast<EspLogDisplay*>(arg);
+        while (true) {
+            vTaskDelay(pdMS_TO_TICKS(1000 / CONFIG_ESPLOG_DISPLAY_RATE_HZ));
+            display->Flush();
+        }
+    }, "esplog_display", 3072, this, 1, &task_);
+}
 
-EspLogDisplay::~EspLogDisplay()
-{}
+EspLogDisplay::~EspLogDisplay() {
+    if (task_ != nullptr) {
+        vTaskDelete(task_);
+    }
+}
 
-void EspLogDisplay::SetStatus(const char* status)
-{
-    ESP_LOGW(TAG, "SetStatus: %s", status);
+void EspLogDisplay::Set(FrameType type, std::string& field, const char* value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    field = value;
+    dirty_ |= 1 << type;
 }
 
-void EspLogDisplay::ShowNotification(const char* notification, int duration_ms)
-{
-    ESP_LOGW(TAG, "ShowNotification: %s", notification);
+void EspLogDisplay::SetStatus(const char* status) {
+    Set(kFrameStatus, status_, status);
 }
-void EspLogDisplay::ShowNotification(const std::string &notification, int duration_ms) 
-{ 
-    ShowNotification(notification.c_str(), duration_ms); 
+
+void EspLogDisplay::ShowNotification(const char* notification, int duration_ms) {
+    Set(kFrameNotification, notification_, notification);
 }
 
+void EspLogDisplay::ShowNotification(const std::string &notification, int duration_ms) {
+    ShowNotification(notification.c_str(), duration_ms);
+}
 
-void EspLogDisplay::SetEmotion(const char* emotion)
-{
-    ESP_LOGW(TAG, "SetEmotion: %s", emotion);
+void EspLogDisplay::SetEmotion(const char* emotion) {
+    Set(kFrameEmotion, emotion_, emotion);
 }
 
-void EspLogDisplay::SetIcon(const char* icon)
-{
-    ESP_LOGW(TAG, "SetIcon: %s", icon);
+void EspLogDisplay::SetIcon(const char* icon) {
+    Set(kFrameIcon, icon_, icon);
 }
 
-void EspLogDisplay::SetChatMessage(const char* role, const char* content)
-{
-    ESP_LOGW(TAG, "Role:%s", role);
-    ESP_LOGW(TAG, "     %s", content);
+void EspLogDisplay::SetChatMessage(const char* role, const char* content) {
+    // An empty message clears the screen, there is nothing to log for it
+    if (content == nullptr || content[0] == '\0') {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (messages_.size() >= ESPLOG_DISPLAY_MAX_MESSAGES) {
+        messages_.erase(messages_.begin());
+        dropped_messages_++;
+    }
+    messages_.emplace_back(role, content);
 }
 
+void EspLogDisplay::AppendFrame(std::string& out, FrameType type, const std::string& payload) {
+    size_t length = payload.size() > UINT16_MAX ? UINT16_MAX : payload.size();
+    uint8_t checksum = 0;
+    for (size_t i = 0; i < length; i++) {
+        checksum ^= static_cast<uint8_t>(payload[i]);
+    }
+    out.push_back(static_cast<char>(0xA5));
+    out.push_back(static_cast<char>(0x5A));
+    out.push_back(static_cast<char>(type));
+    out.push_back(static_cast<char>(length & 0xFF));
+    out.push_back(static_cast<char>(length >> 8));
+    out.append(payload, 0, length);
+    out.push_back(static_cast<char>(checksum));
+}
+
+// On the display task, the UART write happens without the mutex held
+void EspLogDisplay::Flush() {
+    uint8_t dirty;
+    std::string status, notification, emotion, icon;
+    std::vector<std::pair<std::string, std::string>> messages;
+    int dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (dirty_ == 0 && messages_.empty()) {
+            return;
+        }
+        dirty = dirty_;
+        status = status_;
+        notification = notification_;
+        emotion = emotion_;
+        icon = icon_;
+        messages.swap(messages_);
+        dropped = dropped_messages_;
+        dirty_ = 0;
+        dropped_messages_ = 0;
+    }
+
+    if (dropped > 0) {
+        ESP_LOGW(TAG, "%d chat messages dropped", dropped);
+    }
+
+#if CONFIG_ESPLOG_DISPLAY_BINARY
+    // One write for the whole batch
+    std::string out;
+    if (dirty & (1 << kFrameStatus)) {
+        AppendFrame(out, kFrameStatus, status);
+    }
+    if (dirty & (1 << kFrameNotification)) {
+        AppendFrame(out, kFrameNotification, notification);
+    }
+    if (dirty & (1 << kFrameEmotion)) {
+        AppendFrame(out, kFrameEmotion, emotion);
+    }
+    if (dirty & (1 << kFrameIcon)) {
+        AppendFrame(out, kFrameIcon, icon);
+    }
+    for (auto& [role, content] : messages) {
+        AppendFrame(out, kFrameChatMessage, role + '\0' + content);
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+    fflush(stdout);
+#else
+    if (dirty & (1 << kFrameStatus)) {
+        ESP_LOGI(TAG, "Status: %s", status.c_str());
+    }
+    if (dirty & (1 << kFrameNotification)) {
+        ESP_LOGI(TAG, "Notification: %s", notification.c_str());
+    }
+    if (dirty & (1 << kFrameEmotion)) {
+        ESP_LOGI(TAG, "Emotion: %s", emotion.c_str());
+    }
+    if (dirty & (1 << kFrameIcon)) {
+        ESP_LOGI(TAG, "Icon: %s", icon.c_str());
+    }
+    for (auto& [role, content] : messages) {
+        ESP_LOGI(TAG, "%s: %s", role.c_str(), content.c_str());
+    }
+#endif
+}
@@ -3,26 +3,72 @@
 
 #include "display.h"
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
 #include <string>
+#include <vector>
+#include <mutex>
+
+// Chat messages kept between two writes, older ones are dropped and counted
+#define ESPLOG_DISPLAY_MAX_MESSAGES 16
 
-class EspLogDisplay : public Display { 
+/*
+ * Display for boards without a screen: updates go to the console instead.
+ *
+ * The setters only record the update, a low priority task writes them out at
+ * CONFIG_ESPLOG_DISPLAY_RATE_HZ. Between two writes a newer status, emotion,
+ * icon or notification replaces the older one, chat messages are kept in
+ * order. The caller never waits for the UART.
+ *
+ * With CONFIG_ESPLOG_DISPLAY_BINARY the updates are written as frames for a
+ * host monitor instead of log lines:
+ *   0xA5 0x5A | type | length (uint16, little endian) | payload | xor of payload
+ * The payload of a chat message is the role, a zero byte and the content.
+ */
+class EspLogDisplay : public Display {
 public:
+    enum FrameType : uint8_t {
+        kFrameStatus = 1,
+        kFrameNotification = 2,
+        kFrameEmotion = 3,
+        kFrameIcon = 4,
+        kFrameChatMessage = 5,
+    };
+
     EspLogDisplay();
     ~EspLogDisplay();
 
-    virtual void SetStatus(const char* status);
-    virtual void ShowNotification(const char* notification, int duration_ms = 3000);
-    virtual void ShowNotification(const std::string &notification, int duration_ms = 3000);
+    virtual void SetStatus(const char* status) override;
+    virtual void ShowNotification(const char* notification, int duration_ms = 3000) override;
+    virtual void ShowNotification(const std::string &notification, int duration_ms = 3000) override;
     virtual void SetEmotion(const char* emotion) override;
-    virtual void SetChatMessage(const char* role, const char* content) override; 
+    virtual void SetChatMessage(const char* role, const char* content) override;
     virtual void SetIcon(const char* icon) override;
     virtual inline void SetPreviewImage(const lv_img_dsc_t* image) override {}
     virtual inline void SetTheme(const std::string& theme_name) override {}
-    virtual inline void UpdateStatusBAR(bool update_all = false) override {}
+    virtual inline void UpdateStatusBar(bool update_all = false) override {}
 
 protected:
-    virtual inline bool Lock(int timeout_ms = 0) override { return true; } 
+    virtual inline bool Lock(int timeout_ms = 0) override { return true; }
     virtual inline void Unlock() override {}
+
+private:
+    // Updates not written yet
+    std::mutex mutex_;
+    uint8_t dirty_ = 0;     // Bit (1 << FrameType) for each field below that changed
+    std::string status_;
+    std::string notification_;
+    std::string emotion_;
+    std::string icon_;
+    std::vector<std::pair<std::string, std::string>> messages_;
+    int dropped_messages_ = 0;
+
+    TaskHandle_t task_ = nullptr;
+
+    void Set(FrameType type, std::string& field, const char* value);
+    void Flush();
+    void AppendFrame(std::string& out, FrameType type, const std::string& payload);
 };
 
 #endif
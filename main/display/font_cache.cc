@@ -0,0 +1,100 @@
+#include "font_cache.h"
+
+#include <esp_log.h>
+#include <cstring>
+
+#if CONFIG_USE_FONT_PARTITION
+#include <esp_partition.h>
+#endif
+
+#define TAG "FontCache"
+
+GlyphCacheFont::GlyphCacheFont(const lv_font_t* base, size_t capacity_bytes)
+    : font_(*base), base_(base), capacity_(capacity_bytes) {
+    font_.get_glyph_dsc = GetGlyphDsc;
+    font_.get_glyph_bitmap = GetGlyphBitmap;
+    font_.release_glyph = nullptr;
+    font_.user_data = this;
+}
+
+// lv_font_get_glyph_dsc walks the fallback chain itself and marks this font as the one that
+// resolved the glyph, so its bitmap is asked from here
+bool GlyphCacheFont::GetGlyphDsc(const lv_font_t* font, lv_font_glyph_dsc_t* dsc, uint32_t letter, uint32_t letter_next) {
+    auto self = static_cast<GlyphCacheFont*>(font->user_data);
+    return self->base_->get_glyph_dsc(self->base_, dsc, letter, letter_next);
+}
+
+const void* GlyphCacheFont::GetGlyphBitmap(lv_font_glyph_dsc_t* dsc, lv_draw_buf_t* draw_buf) {
+    auto self = static_cast<GlyphCacheFont*>(dsc->resolved_font->user_data);
+    uint32_t id = dsc->gid.index;
+    // The caller has shaped the buffer for this glyph, so the same glyph always takes the same bytes
+    size_t size = draw_buf->header.stride * dsc->box_h;
+
+    auto it = self->index_.find(id);
+    if (it != self->index_.end() && it->second->bitmap.size() == size) {
+        self->glyphs_.splice(self->glyphs_.begin(), self->glyphs_, it->second);
+        memcpy(draw_buf->data, it->second->bitmap.data(), size);
+        self->hits_++;
+        return draw_buf;
+    }
+
+    // The base font reads its own glyph data through the resolved font
+    dsc->resolved_font = self->base_;
+    const void* result = self->base_->get_glyph_bitmap(dsc, draw_buf);
+    dsc->resolved_font = &self->font_;
+    // Only glyphs rendered into the buffer can be copied back into it later
+    if (result != draw_buf || size == 0 || size > self->capacity_) {
+        return result;
+    }
+
+    self->misses_++;
+    if (it != self->index_.end()) {
+        self->used_ -= it->second->bitmap.size();
+        self->glyphs_.erase(it->second);
+        self->index_.erase(it);
+    }
+    while (self->used_ + size > self->capacity_ && !self->glyphs_.empty()) {
+        auto& oldest = self->glyphs_.back();
+        self->used_ -= oldest.bitmap.size();
+        self->index_.erase(oldest.id);
+        self->glyphs_.pop_back();
+    }
+    self->glyphs_.push_front(Glyph{id, std::vector<uint8_t>(draw_buf->data, draw_buf->data + size)});
+    self->index_[id] = self->glyphs_.begin();
+    self->used_ += size;
+    if (self->misses_ % 256 == 0) {
+        ESP_LOGD(TAG, "%u glyphs cached, %u hits, %u misses", (unsigned)self->glyphs_.size(),
+            (unsigned)self->hits_, (unsigned)self->misses_);
+    }
+    return result;
+}
+
+#if CONFIG_USE_FONT_PARTITION
+lv_font_t* LoadPartitionFont() {
+    auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, FONT_PARTITION_LABEL);
+    if (partition == nullptr) {
+        return nullptr;
+    }
+
+    const void* data = nullptr;
+    esp_partition_mmap_handle_t handle;
+    if (esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &data, &handle) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map the font partition");
+        return nullptr;
+    }
+
+    // A binary font starts with the length and tag of its head table, erased flash does not
+    lv_font_t* font = nullptr;
+    if (memcmp((const uint8_t*)data + 4, "head", 4) == 0) {
+        font = lv_binfont_create_from_buffer((void*)data, partition->size);
+    }
+    // The loader has copied the tables it needs, the mapping can go
+    esp_partition_munmap(handle);
+    if (font == nullptr) {
+        ESP_LOGW(TAG, "No font in the font partition");
+        return nullptr;
+    }
+    ESP_LOGI(TAG, "Loaded the partition font, line height %d", (int)font->line_height);
+    return font;
+}
+#endif
@@ -0,0 +1,57 @@
+#ifndef FONT_CACHE_H
+#define FONT_CACHE_H
+
+#include <lvgl.h>
+
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// Glyph bitmaps kept per font, about 200 glyphs of a 16 px CJK font
+#define FONT_GLYPH_CACHE_BYTES (48 * 1024)
+// The data partition an external font is loaded from
+#define FONT_PARTITION_LABEL "font"
+
+/*
+ * Wraps a font and keeps the bitmaps of the glyphs drawn last.
+ *
+ * The fonts built with lv_font_conv store their glyphs compressed, and LVGL
+ * decompresses each glyph every time a label is drawn. Chat text repeats
+ * the same few hundred characters, and a scrolling label redraws them on
+ * every frame. With this cache only the first draw of a glyph reaches the
+ * base font. The metrics and fallback chain stay those of the base font.
+ *
+ * Only used from the LVGL task, like every font.
+ */
+class GlyphCacheFont {
+public:
+    GlyphCacheFont(const lv_font_t* base, size_t capacity_bytes = FONT_GLYPH_CACHE_BYTES);
+
+    const lv_font_t* font() const { return &font_; }
+
+private:
+    struct Glyph {
+        uint32_t id;
+        std::vector<uint8_t> bitmap;
+    };
+
+    lv_font_t font_;
+    const lv_font_t* base_;
+    size_t capacity_;
+    size_t used_ = 0;
+    std::list<Glyph> glyphs_;   // The most recently drawn first
+    std::unordered_map<uint32_t, std::list<Glyph>::iterator> index_;
+    uint32_t hits_ = 0;
+    uint32_t misses_ = 0;
+
+    static bool GetGlyphDsc(const lv_font_t* font, lv_font_glyph_dsc_t* dsc, uint32_t letter, uint32_t letter_next);
+    static const void* GetGlyphBitmap(lv_font_glyph_dsc_t* dsc, lv_draw_buf_t* draw_buf);
+};
+
+#if CONFIG_USE_FONT_PARTITION
+// Loads the lv_font_conv binary font flashed to FONT_PARTITION_LABEL, nullptr if there is none
+lv_font_t* LoadPartitionFont();
+#endif
+
+#endif // FONT_CACHE_H
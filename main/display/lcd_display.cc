@@ -15,53 +15,33 @@
 
 #define TAG "LcdDisplay"
 
-// Color definitions for dark theme
-#define DARK_BACKGROUND_COLOR       lv_color_hex(0x121212)     // Dark background
-#define DARK_TEXT_COLOR             lv_color_white()           // White text
-#define DARK_CHAT_BACKGROUND_COLOR  lv_color_hex(0x1E1E1E)     // Slightly lighter than background
-#define DARK_USER_BUBBLE_COLOR      lv_color_hex(0x1A6C37)     // Dark green
-#define DARK_ASSISTANT_BUBBLE_COLOR lv_color_hex(0x333333)     // Dark gray
-#define DARK_SYSTEM_BUBBLE_COLOR    lv_color_hex(0x2A2A2A)     // Medium gray
-#define DARK_SYSTEM_TEXT_COLOR      lv_color_hex(0xAAAAAA)     // Light gray text
-#define DARK_BORDER_COLOR           lv_color_hex(0x333333)     // Dark gray border
-#define DARK_LOW_BATTERY_COLOR      lv_color_hex(0xFF0000)     // Red for dark mode
-
-// Color definitions for light theme
-#define LIGHT_BACKGROUND_COLOR       lv_color_white()           // White background
-#define LIGHT_TEXT_COLOR             lv_color_black()           // Black text
-#define LIGHT_CHAT_BACKGROUND_COLOR  lv_color_hex(0xE0E0E0)     // Light gray background
-#define LIGHT_USER_BUBBLE_COLOR      lv_color_hex(0x95EC69)     // WeChat green
-#define LIGHT_ASSISTANT_BUBBLE_COLOR lv_color_white()           // White
-#define LIGHT_SYSTEM_BUBBLE_COLOR    lv_color_hex(0xE0E0E0)     // Light gray
-#define LIGHT_SYSTEM_TEXT_COLOR      lv_color_hex(0x666666)     // Dark gray text
-#define LIGHT_BORDER_COLOR           lv_color_hex(0xE0E0E0)     // Light gray border
-#define LIGHT_LOW_BATTERY_COLOR      lv_color_black()           // Black for light mode
-
-
-// Define dark theme colors
-const ThemeColors DARK_THEME = {
-    .background = DARK_BACKGROUND_COLOR,
-    .text = DARK_TEXT_COLOR,
-    .chat_background = DARK_CHAT_BACKGROUND_COLOR,
-    .user_bubble = DARK_USER_BUBBLE_COLOR,
-    .assistant_bubble = DARK_ASSISTANT_BUBBLE_COLOR,
-    .system_bubble = DARK_SYSTEM_BUBBLE_COLOR,
-    .system_text = DARK_SYSTEM_TEXT_COLOR,
-    .border = DARK_BORDER_COLOR,
-    .low_battery = DARK_LOW_BATTERY_COLOR
+// lv_color_hex is not constexpr, this lets the theme tables be built at compile time
+static constexpr lv_color_t ThemeColor(uint32_t hex) {
+    return {.blue = uint8_t(hex & 0xFF), .green = uint8_t((hex >> 8) & 0xFF), .red = uint8_t((hex >> 16) & 0xFF)};
+}
+
+static constexpr ThemeColors DARK_THEME = {
+    .background = ThemeColor(0x121212),         // Dark background
+    .text = ThemeColor(0xFFFFFF),               // White text
+    .chat_background = ThemeColor(0x1E1E1E),    // Slightly lighter than background
+    .user_bubble = ThemeColor(0x1A6C37),        // Dark green
+    .assistant_bubble = ThemeColor(0x333333),   // Dark gray
+    .system_bubble = ThemeColor(0x2A2A2A),      // Medium gray
+    .system_text = ThemeColor(0xAAAAAA),        // Light gray text
+    .border = ThemeColor(0x333333),             // Dark gray border
+    .low_battery = ThemeColor(0xFF0000),        // Red for dark mode
 };
 
-// Define light theme colors
-const ThemeColors LIGHT_THEME = {
-    .background = LIGHT_BACKGROUND_COLOR,
-    .text = LIGHT_TEXT_COLOR,
-    .chat_background = LIGHT_CHAT_BACKGROUND_COLOR,
-    .user_bubble = LIGHT_USER_BUBBLE_COLOR,
-    .assistant_bubble = LIGHT_ASSISTANT_BUBBLE_COLOR,
-    .system_bubble = LIGHT_SYSTEM_BUBBLE_COLOR,
-    .system_text = LIGHT_SYSTEM_TEXT_COLOR,
-    .border = LIGHT_BORDER_COLOR,
-    .low_battery = LIGHT_LOW_BATTERY_COLOR
+static constexpr ThemeColors LIGHT_THEME = {
+    .background = ThemeColor(0xFFFFFF),         // White background
+    .text = ThemeColor(0x000000),               // Black text
+    .chat_background = ThemeColor(0xE0E0E0),    // Light gray background
+    .user_bubble = ThemeColor(0x95EC69),        // WeChat green
+    .assistant_bubble = ThemeColor(0xFFFFFF),   // White
+    .system_bubble = ThemeColor(0xE0E0E0),      // Light gray
+    .system_text = ThemeColor(0x666666),        // Dark gray text
+    .border = ThemeColor(0xE0E0E0),             // Light gray border
+    .low_battery = ThemeColor(0x000000),        // Black for light mode
 };
 
 
@@ -84,9 +64,114 @@ LcdDisplay::LcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_
     }
 }
 
+void LcdDisplay::LoadFonts() {
+#if CONFIG_USE_FONT_PARTITION
+    // The built-in font covers what the partition font leaves out
+    auto partition_font = LoadPartitionFont();
+    if (partition_font != nullptr) {
+        partition_font->fallback = fonts_.text_font;
+        fonts_.text_font = partition_font;
+    }
+#endif
+#if CONFIG_USE_FONT_GLYPH_CACHE
+    if (text_font_cache_ == nullptr) {
+        text_font_cache_ = std::make_unique<GlyphCacheFont>(fonts_.text_font);
+        fonts_.text_font = text_font_cache_->font();
+    }
+#endif
+}
+
+void LcdDisplay::InitThemeStyles() {
+    if (theme_styles_ready_) {
+        return;
+    }
+    for (auto style : {&screen_style_, &panel_style_, &content_style_, &bubble_style_, &user_bubble_style_,
+                       &assistant_bubble_style_, &system_bubble_style_, &chat_row_style_, &low_battery_style_}) {
+        lv_style_init(style);
+    }
+    lv_style_set_radius(&bubble_style_, 8);
+    lv_style_set_border_width(&bubble_style_, 1);
+    lv_style_set_pad_all(&bubble_style_, 8);
+    lv_style_set_text_font(&bubble_style_, fonts_.text_font);
+    lv_style_set_bg_opa(&chat_row_style_, LV_OPA_TRANSP);
+    lv_style_set_border_width(&chat_row_style_, 0);
+    lv_style_set_pad_all(&chat_row_style_, 0);
+    lv_style_set_radius(&low_battery_style_, 10);
+    theme_styles_ready_ = true;
+    ApplyThemeStyles();
+}
+
+void LcdDisplay::ApplyThemeStyles() {
+    const auto& theme = current_theme_;
+    lv_style_set_bg_color(&screen_style_, theme.background);
+    lv_style_set_text_color(&screen_style_, theme.text);
+    lv_style_set_bg_color(&panel_style_, theme.background);
+    lv_style_set_border_color(&panel_style_, theme.border);
+    lv_style_set_text_color(&panel_style_, theme.text);
+    lv_style_set_bg_color(&content_style_, theme.chat_background);
+    lv_style_set_border_color(&content_style_, theme.border);
+    lv_style_set_text_color(&content_style_, theme.text);
+    lv_style_set_border_color(&bubble_style_, theme.border);
+    lv_style_set_bg_color(&user_bubble_style_, theme.user_bubble);
+    lv_style_set_text_color(&user_bubble_style_, theme.text);
+    lv_style_set_bg_color(&assistant_bubble_style_, theme.assistant_bubble);
+    lv_style_set_text_color(&assistant_bubble_style_, theme.text);
+    lv_style_set_bg_color(&system_bubble_style_, theme.system_bubble);
+    lv_style_set_text_color(&system_bubble_style_, theme.system_text);
+    lv_style_set_bg_color(&low_battery_style_, theme.low_battery);
+
+    // Only the objects using a changed style are refreshed, the labels inherit their text color
+    for (auto style : {&screen_style_, &panel_style_, &content_style_, &bubble_style_, &user_bubble_style_,
+                       &assistant_bubble_style_, &system_bubble_style_, &low_battery_style_}) {
+        lv_obj_report_style_change(style);
+    }
+}
+
+LcdBufferConfig LcdDisplay::LoadBufferConfig(LcdBufferConfig config) {
+    Settings settings("display", false);
+    int lines = settings.GetInt("buffer_lines", -1);
+    if (lines > 0) {
+        config.lines = lines;
+    }
+    int double_buffer = settings.GetInt("double_buffer", -1);
+    if (double_buffer >= 0) {
+        config.double_buffer = double_buffer != 0;
+    }
+    int spiram = settings.GetInt("buffer_psram", -1);
+    if (spiram >= 0) {
+        config.spiram = spiram != 0;
+    }
+    auto mode = settings.GetString("render_mode");
+    if (mode == "partial") {
+        config.mode = kLcdRenderPartial;
+    } else if (mode == "direct") {
+        config.mode = kLcdRenderDirect;
+    } else if (mode == "full") {
+        config.mode = kLcdRenderFull;
+    }
+
+    // Direct and full rendering draw the screen as one area, the buffers must hold all of it
+    if (config.mode != kLcdRenderPartial) {
+        config.lines = height_;
+    }
+    config.lines = std::clamp(config.lines, 1, height_);
+    if (config.spiram && heap_caps_get_total_size(MALLOC_CAP_SPIRAM) == 0) {
+        ESP_LOGW(TAG, "No PSRAM, draw buffers stay in internal memory");
+        config.spiram = false;
+    }
+    static const char* const mode_names[] = {"partial", "direct", "full"};
+    ESP_LOGI(TAG, "Draw buffers: %d lines%s in %s, %s rendering", config.lines,
+        config.double_buffer ? " x2" : "", config.spiram ? "PSRAM" : "internal RAM", mode_names[config.mode]);
+    return config;
+}
+
+uint32_t LcdDisplay::GetBufferSize(const LcdBufferConfig& config) const {
+    return static_cast<uint32_t>(width_ * config.lines);
+}
+
 SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                            int width, int height, int offset_x, int offset_y, bool mirror_x, bool mirror_y, bool swap_xy,
-                           DisplayFonts fonts)
+                           DisplayFonts fonts, const LcdBufferConfig& buffer_config)
     : LcdDisplay(panel_io, panel, fonts, width, height) {
 
     // draw white
@@ -103,19 +188,20 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
     lv_init();
 
     ESP_LOGI(TAG, "Initialize LVGL port");
-    lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
-    port_cfg.task_priority = 1;
+    lvgl_port_cfg_t port_cfg = GetPortConfig();
     port_cfg.timer_period_ms = 50;
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD display");
+    auto buffer_cfg = LoadBufferConfig(buffer_config);
+    // The SPI DMA reads PSRAM buffers through a strip of internal memory
     const lvgl_port_display_cfg_t display_cfg = {
         .io_handle = panel_io_,
         .panel_handle = panel_,
         .control_handle = nullptr,
-        .buffer_size = static_cast<uint32_t>(width_ * 20),
-        .double_buffer = false,
-        .trans_size = 0,
+        .buffer_size = GetBufferSize(buffer_cfg),
+        .double_buffer = buffer_cfg.double_buffer,
+        .trans_size = buffer_cfg.spiram ? static_cast<uint32_t>(width_ * LCD_BOUNCE_BUFFER_LINES) : 0,
         .hres = static_cast<uint32_t>(width_),
         .vres = static_cast<uint32_t>(height_),
         .monochrome = false,
@@ -126,12 +212,12 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
         },
         .color_format = LV_COLOR_FORMAT_RGB565,
         .flags = {
-            .buff_dma = 1,
-            .buff_spiram = 0,
+            .buff_dma = !buffer_cfg.spiram,
+            .buff_spiram = buffer_cfg.spiram,
             .sw_rotate = 0,
             .swap_bytes = 1,
-            .full_refresh = 0,
-            .direct_mode = 0,
+            .full_refresh = buffer_cfg.mode == kLcdRenderFull,
+            .direct_mode = buffer_cfg.mode == kLcdRenderDirect,
         },
     };
 
@@ -152,7 +238,7 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
 RgbLcdDisplay::RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                            int width, int height, int offset_x, int offset_y,
                            bool mirror_x, bool mirror_y, bool swap_xy,
-                           DisplayFonts fonts)
+                           DisplayFonts fonts, const LcdBufferConfig& buffer_config)
     : LcdDisplay(panel_io, panel, fonts, width, height) {
 
     // draw white
@@ -165,17 +251,19 @@ RgbLcdDisplay::RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
     lv_init();
 
     ESP_LOGI(TAG, "Initialize LVGL port");
-    lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
-    port_cfg.task_priority = 1;
+    lvgl_port_cfg_t port_cfg = GetPortConfig();
     port_cfg.timer_period_ms = 50;
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD display");
+    // Direct and full rendering draw into the panel's own frame buffers and swap them on vsync,
+    // partial rendering copies strips from LVGL buffers into the frame buffer
+    auto buffer_cfg = LoadBufferConfig(buffer_config);
     const lvgl_port_display_cfg_t display_cfg = {
         .io_handle = panel_io_,
         .panel_handle = panel_,
-        .buffer_size = static_cast<uint32_t>(width_ * 20),
-        .double_buffer = true,
+        .buffer_size = GetBufferSize(buffer_cfg),
+        .double_buffer = buffer_cfg.double_buffer,
         .hres = static_cast<uint32_t>(width_),
         .vres = static_cast<uint32_t>(height_),
         .rotation = {
@@ -184,17 +272,18 @@ RgbLcdDisplay::RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
             .mirror_y = mirror_y,
         },
         .flags = {
-            .buff_dma = 1,
+            .buff_dma = !buffer_cfg.spiram,
+            .buff_spiram = buffer_cfg.spiram,
             .swap_bytes = 0,
-            .full_refresh = 1,
-            .direct_mode = 1,
+            .full_refresh = buffer_cfg.mode == kLcdRenderFull,
+            .direct_mode = buffer_cfg.mode != kLcdRenderPartial,
         },
     };
 
     const lvgl_port_display_rgb_cfg_t rgb_cfg = {
         .flags = {
             .bb_mode = true,
-            .avoid_tearing = true,
+            .avoid_tearing = buffer_cfg.mode != kLcdRenderPartial,
         }
     };
     
@@ -214,7 +303,7 @@ RgbLcdDisplay::RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
 MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                             int width, int height,  int offset_x, int offset_y,
                             bool mirror_x, bool mirror_y, bool swap_xy,
-                            DisplayFonts fonts)
+                            DisplayFonts fonts, const LcdBufferConfig& buffer_config)
     : LcdDisplay(panel_io, panel, fonts, width, height) {
 
     // Set the display to on
@@ -225,16 +314,17 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
     lv_init();
 
     ESP_LOGI(TAG, "Initialize LVGL port");
-    lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
+    lvgl_port_cfg_t port_cfg = GetPortConfig();
     lvgl_port_init(&port_cfg);
 
     ESP_LOGI(TAG, "Adding LCD display");
+    auto buffer_cfg = LoadBufferConfig(buffer_config);
     const lvgl_port_display_cfg_t disp_cfg = {
             .io_handle = panel_io,
             .panel_handle = panel,
             .control_handle = nullptr,
-            .buffer_size = static_cast<uint32_t>(width_ * 50),
-            .double_buffer = false,
+            .buffer_size = GetBufferSize(buffer_cfg),
+            .double_buffer = buffer_cfg.double_buffer,
             .hres = static_cast<uint32_t>(width_),
             .vres = static_cast<uint32_t>(height_),
             .monochrome = false,
@@ -245,9 +335,11 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
             .mirror_y = mirror_y,
         },
         .flags = {
-            .buff_dma = true,
-            .buff_spiram =false,
+            .buff_dma = !buffer_cfg.spiram,
+            .buff_spiram = buffer_cfg.spiram,
             .sw_rotate = false,
+            .full_refresh = buffer_cfg.mode == kLcdRenderFull,
+            .direct_mode = buffer_cfg.mode == kLcdRenderDirect,
         },
     };
 
@@ -306,11 +398,12 @@ void LcdDisplay::Unlock() {
 #if CONFIG_USE_WECHAT_MESSAGE_STYLE
 void LcdDisplay::SetupUI() {
     DisplayLockGuard lock(this);
+    LoadFonts();
+    InitThemeStyles();
 
     auto screen = lv_screen_active();
     lv_obj_set_style_text_font(screen, fonts_.text_font, 0);
-    lv_obj_set_style_text_color(screen, current_theme_.text, 0);
-    lv_obj_set_style_bg_color(screen, current_theme_.background, 0);
+    lv_obj_add_style(screen, &screen_style_, 0);
 
     /* Container */
     container_ = lv_obj_create(screen);
@@ -319,15 +412,13 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_style_pad_all(container_, 0, 0);
     lv_obj_set_style_border_width(container_, 0, 0);
     lv_obj_set_style_pad_row(container_, 0, 0);
-    lv_obj_set_style_bg_color(container_, current_theme_.background, 0);
-    lv_obj_set_style_border_color(container_, current_theme_.border, 0);
+    lv_obj_add_style(container_, &panel_style_, 0);
 
     /* Status bar */
     status_bar_ = lv_obj_create(container_);
     lv_obj_set_size(status_bar_, LV_HOR_RES, LV_SIZE_CONTENT);
     lv_obj_set_style_radius(status_bar_, 0, 0);
-    lv_obj_set_style_bg_color(status_bar_, current_theme_.background, 0);
-    lv_obj_set_style_text_color(status_bar_, current_theme_.text, 0);
+    lv_obj_add_style(status_bar_, &panel_style_, 0);
     
     /* Content - Chat area */
     content_ = lv_obj_create(container_);
@@ -335,8 +426,7 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_width(content_, LV_HOR_RES);
     lv_obj_set_flex_grow(content_, 1);
     lv_obj_set_style_pad_all(content_, 10, 0);
-    lv_obj_set_style_bg_color(content_, current_theme_.chat_background, 0); // Background for chat area
-    lv_obj_set_style_border_color(content_, current_theme_.border, 0); // Border color for chat area
+    lv_obj_add_style(content_, &content_style_, 0);
 
     // Enable scrolling for chat content
     lv_obj_set_scrollbar_mode(content_, LV_SCROLLBAR_MODE_OFF);
@@ -349,6 +439,12 @@ void LcdDisplay::SetupUI() {
 
     // We'll create chat messages dynamically in SetChatMessage
     chat_message_label_ = nullptr;
+#if CONFIG_USE_CHAT_HISTORY
+    chat_history_ = std::make_unique<ChatHistory>(CONFIG_CHAT_HISTORY_SIZE);
+    lv_obj_add_event_cb(content_, [](lv_event_t* e) {
+        static_cast<LcdDisplay*>(lv_event_get_user_data(e))->OnChatScrollEnd();
+    }, LV_EVENT_SCROLL_END, this);
+#endif
 
     /* Status bar */
     lv_obj_set_flex_flow(status_bar_, LV_FLEX_FLOW_ROW);
@@ -366,14 +462,12 @@ void LcdDisplay::SetupUI() {
     // 创建emotion_label_在状态栏最左侧
     emotion_label_ = lv_label_create(status_bar_);
     lv_obj_set_style_text_font(emotion_label_, &font_awesome_30_4, 0);
-    lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
     lv_label_set_text(emotion_label_, FONT_AWESOME_AI_CHIP);
     lv_obj_set_style_margin_right(emotion_label_, 5, 0); // 添加右边距，与后面的元素分隔
 
     notification_label_ = lv_label_create(status_bar_);
     lv_obj_set_flex_grow(notification_label_, 1);
     lv_obj_set_style_text_align(notification_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(notification_label_, current_theme_.text, 0);
     lv_label_set_text(notification_label_, "");
     lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
 
@@ -381,43 +475,323 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_flex_grow(status_label_, 1);
     lv_label_set_long_mode(status_label_, LV_LABEL_LONG_SCROLL_CIRCULAR);
     lv_obj_set_style_text_align(status_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(status_label_, current_theme_.text, 0);
     lv_label_set_text(status_label_, Lang::Strings::INITIALIZING);
     
     mute_label_ = lv_label_create(status_bar_);
     lv_label_set_text(mute_label_, "");
     lv_obj_set_style_text_font(mute_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(mute_label_, current_theme_.text, 0);
 
     network_label_ = lv_label_create(status_bar_);
     lv_label_set_text(network_label_, "");
     lv_obj_set_style_text_font(network_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(network_label_, current_theme_.text, 0);
     lv_obj_set_style_margin_left(network_label_, 5, 0); // 添加左边距，与前面的元素分隔
 
     battery_label_ = lv_label_create(status_bar_);
     lv_label_set_text(battery_label_, "");
     lv_obj_set_style_text_font(battery_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(battery_label_, current_theme_.text, 0);
     lv_obj_set_style_margin_left(battery_label_, 5, 0); // 添加左边距，与前面的元素分隔
 
     low_battery_popup_ = lv_obj_create(screen);
     lv_obj_set_scrollbar_mode(low_battery_popup_, LV_SCROLLBAR_MODE_OFF);
     lv_obj_set_size(low_battery_popup_, LV_HOR_RES * 0.9, fonts_.text_font->line_height * 2);
     lv_obj_align(low_battery_popup_, LV_ALIGN_BOTTOM_MID, 0, 0);
-    lv_obj_set_style_bg_color(low_battery_popup_, current_theme_.low_battery, 0);
-    lv_obj_set_style_radius(low_battery_popup_, 10, 0);
+    lv_obj_add_style(low_battery_popup_, &low_battery_style_, 0);
     low_battery_label_ = lv_label_create(low_battery_popup_);
     lv_label_set_text(low_battery_label_, Lang::Strings::BATTERY_NEED_CHARGE);
     lv_obj_set_style_text_color(low_battery_label_, lv_color_white(), 0);
     lv_obj_center(low_battery_label_);
     lv_obj_add_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
 }
+#if CONFIG_USE_CHAT_HISTORY
+// Messages with LVGL objects, more than a screen so there is something to scroll to
+#if CONFIG_IDF_TARGET_ESP32P4
+#define CHAT_WINDOW_ROWS 24
+#else
+#define CHAT_WINDOW_ROWS 12
+#endif
+// Rows recycled at once when the list is scrolled to one of its ends
+#define CHAT_PAGE_ROWS 4
+#define CHAT_PAGE_THRESHOLD 20
+#else
 #if CONFIG_IDF_TARGET_ESP32P4
 #define  MAX_MESSAGES 40
 #else
 #define  MAX_MESSAGES 20
 #endif
+#endif
+// The sentences of a reply stream into its bubble until it holds this many bytes
+#define MAX_BUBBLE_TEXT 320
+
+// Bubbles shrink to their text up to 85% of the screen, longer text wraps at that width
+void LcdDisplay::FitChatBubble(lv_obj_t* msg_text, const char* text) {
+    lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;
+    if (lv_obj_get_style_width(msg_text, 0) == max_width) {
+        // Already wrapping, more text only makes it taller
+        return;
+    }
+    lv_coord_t text_width = lv_txt_get_width(text, strlen(text), fonts_.text_font, 0);
+    lv_obj_set_width(msg_text, std::clamp<lv_coord_t>(text_width, 20, max_width));
+}
+
+#if CONFIG_USE_CHAT_HISTORY
+static ChatRole ParseChatRole(const char* role) {
+    if (strcmp(role, "user") == 0) {
+        return kChatRoleUser;
+    } else if (strcmp(role, "assistant") == 0) {
+        return kChatRoleAssistant;
+    }
+    return kChatRoleSystem;
+}
+
+// Every message sits in a full-width row, so user and system bubbles can be aligned right or
+// centered and any row can show a message of any role
+lv_obj_t* LcdDisplay::CreateChatRow() {
+    lv_obj_t* row = lv_obj_create(content_);
+    lv_obj_set_width(row, LV_HOR_RES);
+    lv_obj_set_height(row, LV_SIZE_CONTENT);
+    lv_obj_add_style(row, &chat_row_style_, 0);
+
+    lv_obj_t* bubble = lv_obj_create(row);
+    lv_obj_set_scrollbar_mode(bubble, LV_SCROLLBAR_MODE_OFF);
+    lv_obj_add_style(bubble, &bubble_style_, 0);
+    lv_obj_set_size(bubble, LV_SIZE_CONTENT, LV_SIZE_CONTENT);
+
+    lv_obj_t* text = lv_label_create(bubble);
+    lv_label_set_long_mode(text, LV_LABEL_LONG_WRAP);
+    return row;
+}
+
+void LcdDisplay::BindChatRow(lv_obj_t* row, uint32_t sequence) {
+    ChatRole role = kChatRoleSystem;
+    const char* content = chat_history_->Get(sequence, &role);
+    if (content == nullptr) {
+        // Evicted from the ring while its row was on screen
+        content = "";
+    }
+    // 0 marks the objects that are not rows, like the preview images
+    lv_obj_set_user_data(row, (void*)(uintptr_t)(sequence + 1));
+
+    lv_obj_t* bubble = lv_obj_get_child(row, 0);
+    lv_obj_t* msg_text = lv_obj_get_child(bubble, 0);
+    lv_obj_set_width(msg_text, LV_SIZE_CONTENT);
+    lv_label_set_text(msg_text, content);
+    FitChatBubble(msg_text, content);
+
+    lv_obj_remove_style(bubble, &user_bubble_style_, 0);
+    lv_obj_remove_style(bubble, &assistant_bubble_style_, 0);
+    lv_obj_remove_style(bubble, &system_bubble_style_, 0);
+    if (role == kChatRoleUser) {
+        lv_obj_add_style(bubble, &user_bubble_style_, 0);
+        lv_obj_set_user_data(bubble, (void*)"user");
+        lv_obj_align(bubble, LV_ALIGN_RIGHT_MID, -25, 0);
+    } else if (role == kChatRoleAssistant) {
+        lv_obj_add_style(bubble, &assistant_bubble_style_, 0);
+        lv_obj_set_user_data(bubble, (void*)"assistant");
+        lv_obj_align(bubble, LV_ALIGN_LEFT_MID, 0, 0);
+    } else {
+        lv_obj_add_style(bubble, &system_bubble_style_, 0);
+        lv_obj_set_user_data(bubble, (void*)"system");
+        lv_obj_align(bubble, LV_ALIGN_CENTER, 0, 0);
+    }
+}
+
+lv_obj_t* LcdDisplay::FindChatRow(uint32_t sequence) {
+    for (int32_t i = lv_obj_get_child_cnt(content_) - 1; i >= 0; i--) {
+        lv_obj_t* row = lv_obj_get_child(content_, i);
+        if ((uintptr_t)lv_obj_get_user_data(row) == sequence + 1) {
+            return row;
+        }
+    }
+    return nullptr;
+}
+
+lv_obj_t* LcdDisplay::TakeChatRow(bool top) {
+    while (true) {
+        uint32_t count = lv_obj_get_child_cnt(content_);
+        if (count == 0) {
+            return nullptr;
+        }
+        lv_obj_t* row = lv_obj_get_child(content_, top ? 0 : count - 1);
+        if (lv_obj_get_user_data(row) != nullptr) {
+            return row;
+        }
+        // A preview image leaves with the rows around it, it is not kept in the history
+        lv_obj_del(row);
+    }
+}
+
+// Rebinds the rows to the newest messages, after the user scrolled back and a new one came in
+void LcdDisplay::ShowLatestChat() {
+    uint32_t next = chat_history_->next();
+    uint32_t count = std::min<uint32_t>(next - chat_history_->first(), CHAT_WINDOW_ROWS);
+    for (int32_t i = lv_obj_get_child_cnt(content_) - 1; i >= 0; i--) {
+        lv_obj_t* child = lv_obj_get_child(content_, i);
+        if (lv_obj_get_user_data(child) == nullptr) {
+            lv_obj_del(child);
+        }
+    }
+    while (lv_obj_get_child_cnt(content_) > count) {
+        lv_obj_del(lv_obj_get_child(content_, 0));
+    }
+    while (lv_obj_get_child_cnt(content_) < count) {
+        CreateChatRow();
+    }
+    chat_window_first_ = next - count;
+    chat_window_next_ = next;
+    for (uint32_t i = 0; i < count; i++) {
+        BindChatRow(lv_obj_get_child(content_, i), chat_window_first_ + i);
+    }
+    if (count > 0) {
+        lv_obj_t* last = lv_obj_get_child(content_, -1);
+        lv_obj_scroll_to_view_recursive(last, LV_ANIM_OFF);
+        chat_message_label_ = lv_obj_get_child(lv_obj_get_child(last, 0), 0);
+    }
+}
+
+// At either end of the list, rows from the other end move over to show the next older or newer
+// messages. The scroll position follows the rows that stay, so the text on screen does not jump
+void LcdDisplay::OnChatScrollEnd() {
+    if (chat_paging_ || lv_obj_get_child_cnt(content_) == 0) {
+        return;
+    }
+    chat_paging_ = true;
+    if (lv_obj_get_scroll_top(content_) <= CHAT_PAGE_THRESHOLD && lv_obj_get_scroll_bottom(content_) > 0 &&
+            chat_window_first_ > chat_history_->first()) {
+        lv_obj_t* anchor = lv_obj_get_child(content_, 0);
+        lv_coord_t before = lv_obj_get_y(anchor);
+        for (int i = 0; i < CHAT_PAGE_ROWS && chat_window_first_ > chat_history_->first(); i++) {
+            lv_obj_t* row = nullptr;
+            if (chat_window_next_ - chat_window_first_ >= CHAT_WINDOW_ROWS && (row = TakeChatRow(false)) != nullptr) {
+                chat_window_next_--;
+            } else {
+                row = CreateChatRow();
+            }
+            lv_obj_move_to_index(row, 0);
+            BindChatRow(row, --chat_window_first_);
+        }
+        lv_obj_update_layout(content_);
+        lv_obj_scroll_to_y(content_, lv_obj_get_scroll_y(content_) + lv_obj_get_y(anchor) - before, LV_ANIM_OFF);
+    } else if (lv_obj_get_scroll_bottom(content_) <= CHAT_PAGE_THRESHOLD &&
+            chat_window_next_ < chat_history_->next()) {
+        lv_obj_t* anchor = lv_obj_get_child(content_, -1);
+        lv_coord_t before = lv_obj_get_y(anchor);
+        for (int i = 0; i < CHAT_PAGE_ROWS && chat_window_next_ < chat_history_->next(); i++) {
+            lv_obj_t* row = nullptr;
+            if (chat_window_next_ - chat_window_first_ >= CHAT_WINDOW_ROWS && (row = TakeChatRow(true)) != nullptr) {
+                chat_window_first_++;
+            } else {
+                row = CreateChatRow();
+            }
+            lv_obj_move_to_index(row, -1);
+            BindChatRow(row, chat_window_next_++);
+        }
+        lv_obj_update_layout(content_);
+        lv_obj_scroll_to_y(content_, lv_obj_get_scroll_y(content_) + lv_obj_get_y(anchor) - before, LV_ANIM_OFF);
+    }
+    chat_paging_ = false;
+}
+
+// The text goes into the history, the rows on screen only follow it while they show the newest messages
+void LcdDisplay::SetChatMessage(const char* role, const char* content) {
+    DisplayLockGuard lock(this);
+    if (content_ == nullptr || chat_history_ == nullptr) {
+        return;
+    }
+    //避免出现空的消息框
+    if (strlen(content) == 0) {
+        return;
+    }
+    ChatRole chat_role = ParseChatRole(role);
+    bool at_latest = chat_window_next_ == chat_history_->next();
+    ChatRole last_role = kChatRoleSystem;
+    const char* last = chat_history_->empty() ? nullptr : chat_history_->Get(chat_history_->next() - 1, &last_role);
+
+    if (chat_role == kChatRoleAssistant && last != nullptr && last_role == kChatRoleAssistant) {
+        // Latin sentences need a space between them, CJK punctuation does not
+        std::string addition;
+        size_t length = strlen(last);
+        if (length > 0 && (unsigned char)last[length - 1] < 0x80 && last[length - 1] != ' ') {
+            addition = " ";
+        }
+        addition += content;
+        if (chat_history_->AppendToLast(kChatRoleAssistant, addition.c_str(), MAX_BUBBLE_TEXT)) {
+            lv_obj_t* row = at_latest ? FindChatRow(chat_history_->next() - 1) : nullptr;
+            if (row == nullptr) {
+                ShowLatestChat();
+                return;
+            }
+            // Only the last bubble grows, the redraw covers that bubble instead of the whole list
+            lv_obj_t* msg_text = lv_obj_get_child(lv_obj_get_child(row, 0), 0);
+            lv_label_ins_text(msg_text, LV_LABEL_POS_LAST, addition.c_str());
+            FitChatBubble(msg_text, lv_label_get_text(msg_text));
+            // Sentences arrive faster than a scroll animation runs, each frame of one would redraw the list
+            lv_obj_scroll_to_view_recursive(row, LV_ANIM_OFF);
+            chat_message_label_ = msg_text;
+            return;
+        }
+    }
+
+    // 折叠系统消息：新的系统消息替换上一条，沿用它的序号和行
+    if (chat_role == kChatRoleSystem && last != nullptr && last_role == kChatRoleSystem) {
+        chat_history_->RemoveLast();
+    }
+    uint32_t sequence = chat_history_->Append(chat_role, content);
+    if (!at_latest) {
+        ShowLatestChat();
+        return;
+    }
+
+    lv_obj_t* row = FindChatRow(sequence);
+    if (row == nullptr) {
+        if (chat_window_next_ - chat_window_first_ >= CHAT_WINDOW_ROWS && (row = TakeChatRow(true)) != nullptr) {
+            // The oldest row on screen shows the new message
+            lv_obj_move_to_index(row, -1);
+            chat_window_first_++;
+        } else {
+            row = CreateChatRow();
+        }
+    }
+    BindChatRow(row, sequence);
+    chat_window_next_ = sequence + 1;
+
+    // Auto-scroll to the new message
+    lv_obj_scroll_to_view_recursive(row, LV_ANIM_ON);
+    chat_message_label_ = lv_obj_get_child(lv_obj_get_child(row, 0), 0);
+}
+#else
+// Only the last bubble grows, so the layout of the messages above it stays as it is and the
+// redraw covers that bubble instead of the whole list
+bool LcdDisplay::AppendChatMessage(const char* content) {
+    lv_obj_t* msg_bubble = lv_obj_get_child(content_, -1);
+    if (msg_bubble == nullptr || lv_obj_get_child_cnt(msg_bubble) == 0) {
+        return false;
+    }
+    auto bubble_type = (const char*)lv_obj_get_user_data(msg_bubble);
+    if (bubble_type == nullptr || strcmp(bubble_type, "assistant") != 0) {
+        return false;
+    }
+    lv_obj_t* msg_text = lv_obj_get_child(msg_bubble, 0);
+    const char* text = lv_label_get_text(msg_text);
+    size_t length = strlen(text);
+    if (length + strlen(content) + 1 > MAX_BUBBLE_TEXT) {
+        return false;
+    }
+
+    // Latin sentences need a space between them, CJK punctuation does not
+    std::string addition;
+    if (length > 0 && (unsigned char)text[length - 1] < 0x80 && text[length - 1] != ' ') {
+        addition = " ";
+    }
+    addition += content;
+    lv_label_ins_text(msg_text, LV_LABEL_POS_LAST, addition.c_str());
+    FitChatBubble(msg_text, lv_label_get_text(msg_text));
+
+    // Sentences arrive faster than a scroll animation runs, each frame of one would redraw the list
+    lv_obj_scroll_to_view_recursive(msg_bubble, LV_ANIM_OFF);
+    chat_message_label_ = msg_text;
+    return true;
+}
+
 void LcdDisplay::SetChatMessage(const char* role, const char* content) {
     DisplayLockGuard lock(this);
     if (content_ == nullptr) {
@@ -426,21 +800,16 @@ void LcdDisplay::SetChatMessage(const char* role, const char* content) {
     
     //避免出现空的消息框
     if(strlen(content) == 0) return;
+
+    if (strcmp(role, "assistant") == 0 && AppendChatMessage(content)) {
+        return;
+    }
     
-    // 检查消息数量是否超过限制
-    uint32_t child_count = lv_obj_get_child_cnt(content_);
-    if (child_count >= MAX_MESSAGES) {
-        // 删除最早的消息（第一个子对象）
-        lv_obj_t* first_child = lv_obj_get_child(content_, 0);
-        lv_obj_t* last_child = lv_obj_get_child(content_, child_count - 1);
-        if (first_child != nullptr) {
-            lv_obj_del(first_child);
-        }
-        // Scroll to the last message immediately
-        if (last_child != nullptr) {
-            lv_obj_scroll_to_view_recursive(last_child, LV_ANIM_OFF);
-        }
+    // 检查消息数量是否超过限制，删除最早的消息
+    while (lv_obj_get_child_cnt(content_) >= MAX_MESSAGES) {
+        lv_obj_del(lv_obj_get_child(content_, 0));
     }
+    uint32_t child_count = lv_obj_get_child_cnt(content_);
     
     // 折叠系统消息（如果是系统消息，检查最后一个消息是否也是系统消息）
     if (strcmp(role, "system") == 0 && child_count > 0) {
@@ -462,144 +831,64 @@ void LcdDisplay::SetChatMessage(const char* role, const char* content) {
     
     // Create a message bubble
     lv_obj_t* msg_bubble = lv_obj_create(content_);
-    lv_obj_set_style_radius(msg_bubble, 8, 0);
     lv_obj_set_scrollbar_mode(msg_bubble, LV_SCROLLBAR_MODE_OFF);
-    lv_obj_set_style_border_width(msg_bubble, 1, 0);
-    lv_obj_set_style_border_color(msg_bubble, current_theme_.border, 0);
-    lv_obj_set_style_pad_all(msg_bubble, 8, 0);
+    lv_obj_add_style(msg_bubble, &bubble_style_, 0);
 
-    // Create the message text
+    // Create the message text, the bubble takes the size of its text
     lv_obj_t* msg_text = lv_label_create(msg_bubble);
-    lv_label_set_text(msg_text, content);
-    
-    // 计算文本实际宽度
-    lv_coord_t text_width = lv_txt_get_width(content, strlen(content), fonts_.text_font, 0);
-
-    // 计算气泡宽度
-    lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;  // 屏幕宽度的85%
-    lv_coord_t min_width = 20;  
-    lv_coord_t bubble_width;
-    
-    // 确保文本宽度不小于最小宽度
-    if (text_width < min_width) {
-        text_width = min_width;
-    }
-
-    // 如果文本宽度小于最大宽度，使用文本宽度
-    if (text_width < max_width) {
-        bubble_width = text_width; 
-    } else {
-        bubble_width = max_width;
-    }
-    
-    // 设置消息文本的宽度
-    lv_obj_set_width(msg_text, bubble_width);  // 减去padding
     lv_label_set_long_mode(msg_text, LV_LABEL_LONG_WRAP);
-    lv_obj_set_style_text_font(msg_text, fonts_.text_font, 0);
-
-    // 设置气泡宽度
-    lv_obj_set_width(msg_bubble, bubble_width);
-    lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
+    lv_label_set_text(msg_text, content);
+    FitChatBubble(msg_text, content);
+    lv_obj_set_size(msg_bubble, LV_SIZE_CONTENT, LV_SIZE_CONTENT);
+    // Don't grow
+    lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
 
     // Set alignment and style based on message role
     if (strcmp(role, "user") == 0) {
         // User messages are right-aligned with green background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.user_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.text, 0);
-        
+        lv_obj_add_style(msg_bubble, &user_bubble_style_, 0);
         // 设置自定义属性标记气泡类型
         lv_obj_set_user_data(msg_bubble, (void*)"user");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
     } else if (strcmp(role, "assistant") == 0) {
         // Assistant messages are left-aligned with white background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.assistant_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.text, 0);
-        
-        // 设置自定义属性标记气泡类型
+        lv_obj_add_style(msg_bubble, &assistant_bubble_style_, 0);
         lv_obj_set_user_data(msg_bubble, (void*)"assistant");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
     } else if (strcmp(role, "system") == 0) {
         // System messages are center-aligned with light gray background
-        lv_obj_set_style_bg_color(msg_bubble, current_theme_.system_bubble, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, current_theme_.system_text, 0);
-        
-        // 设置自定义属性标记气泡类型
+        lv_obj_add_style(msg_bubble, &system_bubble_style_, 0);
         lv_obj_set_user_data(msg_bubble, (void*)"system");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
     }
     
-    // Create a full-width container for user messages to ensure right alignment
-    if (strcmp(role, "user") == 0) {
-        // Create a full-width container
+    // User and system messages sit in a full-width container, so they can be aligned right or centered
+    lv_obj_t* scroll_target = msg_bubble;
+    if (strcmp(role, "user") == 0 || strcmp(role, "system") == 0) {
         lv_obj_t* container = lv_obj_create(content_);
         lv_obj_set_width(container, LV_HOR_RES);
         lv_obj_set_height(container, LV_SIZE_CONTENT);
         
         // Make container transparent and borderless
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
+        lv_obj_add_style(container, &chat_row_style_, 0);
         
         // Move the message bubble into this container
         lv_obj_set_parent(msg_bubble, container);
-        
-        // Right align the bubble in the container
-        lv_obj_align(msg_bubble, LV_ALIGN_RIGHT_MID, -25, 0);
-        
-        // Auto-scroll to this container
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
-    } else if (strcmp(role, "system") == 0) {
-        // 为系统消息创建全宽容器以确保居中对齐
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        // 使容器透明且无边框
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        // 将消息气泡移入此容器
-        lv_obj_set_parent(msg_bubble, container);
-        
-        // 将气泡居中对齐在容器中
-        lv_obj_align(msg_bubble, LV_ALIGN_CENTER, 0, 0);
-        
-        // 自动滚动底部
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
+        if (strcmp(role, "user") == 0) {
+            lv_obj_align(msg_bubble, LV_ALIGN_RIGHT_MID, -25, 0);
+        } else {
+            lv_obj_align(msg_bubble, LV_ALIGN_CENTER, 0, 0);
+        }
+        scroll_target = container;
     } else {
-        // For assistant messages
         // Left align assistant messages
         lv_obj_align(msg_bubble, LV_ALIGN_LEFT_MID, 0, 0);
-
-        // Auto-scroll to the message bubble
-        lv_obj_scroll_to_view_recursive(msg_bubble, LV_ANIM_ON);
     }
+
+    // Auto-scroll to the new message
+    lv_obj_scroll_to_view_recursive(scroll_target, LV_ANIM_ON);
     
     // Store reference to the latest message label
     chat_message_label_ = msg_text;
 }
+#endif
 
 void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
     DisplayLockGuard lock(this);
@@ -610,14 +899,11 @@ void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
     if (img_dsc != nullptr) {
         // Create a message bubble for image preview
         lv_obj_t* img_bubble = lv_obj_create(content_);
-        lv_obj_set_style_radius(img_bubble, 8, 0);
         lv_obj_set_scrollbar_mode(img_bubble, LV_SCROLLBAR_MODE_OFF);
-        lv_obj_set_style_border_width(img_bubble, 1, 0);
-        lv_obj_set_style_border_color(img_bubble, current_theme_.border, 0);
-        lv_obj_set_style_pad_all(img_bubble, 8, 0);
+        lv_obj_add_style(img_bubble, &bubble_style_, 0);
         
-        // Set image bubble background color (similar to system message)
-        lv_obj_set_style_bg_color(img_bubble, current_theme_.assistant_bubble, 0);
+        // Image bubbles look like assistant messages
+        lv_obj_add_style(img_bubble, &assistant_bubble_style_, 0);
         
         // 设置自定义属性标记气泡类型
         lv_obj_set_user_data(img_bubble, (void*)"image");
@@ -705,11 +991,12 @@ void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
 #else
 void LcdDisplay::SetupUI() {
     DisplayLockGuard lock(this);
+    LoadFonts();
+    InitThemeStyles();
 
     auto screen = lv_screen_active();
     lv_obj_set_style_text_font(screen, fonts_.text_font, 0);
-    lv_obj_set_style_text_color(screen, current_theme_.text, 0);
-    lv_obj_set_style_bg_color(screen, current_theme_.background, 0);
+    lv_obj_add_style(screen, &screen_style_, 0);
 
     /* Container */
     container_ = lv_obj_create(screen);
@@ -718,15 +1005,13 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_style_pad_all(container_, 0, 0);
     lv_obj_set_style_border_width(container_, 0, 0);
     lv_obj_set_style_pad_row(container_, 0, 0);
-    lv_obj_set_style_bg_color(container_, current_theme_.background, 0);
-    lv_obj_set_style_border_color(container_, current_theme_.border, 0);
+    lv_obj_add_style(container_, &panel_style_, 0);
 
     /* Status bar */
     status_bar_ = lv_obj_create(container_);
     lv_obj_set_size(status_bar_, LV_HOR_RES, fonts_.text_font->line_height);
     lv_obj_set_style_radius(status_bar_, 0, 0);
-    lv_obj_set_style_bg_color(status_bar_, current_theme_.background, 0);
-    lv_obj_set_style_text_color(status_bar_, current_theme_.text, 0);
+    lv_obj_add_style(status_bar_, &panel_style_, 0);
     
     /* Content */
     content_ = lv_obj_create(container_);
@@ -735,15 +1020,13 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_width(content_, LV_HOR_RES);
     lv_obj_set_flex_grow(content_, 1);
     lv_obj_set_style_pad_all(content_, 5, 0);
-    lv_obj_set_style_bg_color(content_, current_theme_.chat_background, 0);
-    lv_obj_set_style_border_color(content_, current_theme_.border, 0); // Border color for content
+    lv_obj_add_style(content_, &content_style_, 0);
 
     lv_obj_set_flex_flow(content_, LV_FLEX_FLOW_COLUMN); // 垂直布局（从上到下）
     lv_obj_set_flex_align(content_, LV_FLEX_ALIGN_CENTER, LV_FLEX_ALIGN_CENTER, LV_FLEX_ALIGN_SPACE_EVENLY); // 子对象居中对齐，等距分布
 
     emotion_label_ = lv_label_create(content_);
     lv_obj_set_style_text_font(emotion_label_, &font_awesome_30_4, 0);
-    lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
     lv_label_set_text(emotion_label_, FONT_AWESOME_AI_CHIP);
 
     preview_image_ = lv_image_create(content_);
@@ -756,7 +1039,6 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_width(chat_message_label_, LV_HOR_RES * 0.9); // 限制宽度为屏幕宽度的 90%
     lv_label_set_long_mode(chat_message_label_, LV_LABEL_LONG_WRAP); // 设置为自动换行模式
     lv_obj_set_style_text_align(chat_message_label_, LV_TEXT_ALIGN_CENTER, 0); // 设置文本居中对齐
-    lv_obj_set_style_text_color(chat_message_label_, current_theme_.text, 0);
 
     /* Status bar */
     lv_obj_set_flex_flow(status_bar_, LV_FLEX_FLOW_ROW);
@@ -769,12 +1051,10 @@ void LcdDisplay::SetupUI() {
     network_label_ = lv_label_create(status_bar_);
     lv_label_set_text(network_label_, "");
     lv_obj_set_style_text_font(network_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(network_label_, current_theme_.text, 0);
 
     notification_label_ = lv_label_create(status_bar_);
     lv_obj_set_flex_grow(notification_label_, 1);
     lv_obj_set_style_text_align(notification_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(notification_label_, current_theme_.text, 0);
     lv_label_set_text(notification_label_, "");
     lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
 
@@ -782,24 +1062,20 @@ void LcdDisplay::SetupUI() {
     lv_obj_set_flex_grow(status_label_, 1);
     lv_label_set_long_mode(status_label_, LV_LABEL_LONG_SCROLL_CIRCULAR);
     lv_obj_set_style_text_align(status_label_, LV_TEXT_ALIGN_CENTER, 0);
-    lv_obj_set_style_text_color(status_label_, current_theme_.text, 0);
     lv_label_set_text(status_label_, Lang::Strings::INITIALIZING);
     mute_label_ = lv_label_create(status_bar_);
     lv_label_set_text(mute_label_, "");
     lv_obj_set_style_text_font(mute_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(mute_label_, current_theme_.text, 0);
 
     battery_label_ = lv_label_create(status_bar_);
     lv_label_set_text(battery_label_, "");
     lv_obj_set_style_text_font(battery_label_, fonts_.icon_font, 0);
-    lv_obj_set_style_text_color(battery_label_, current_theme_.text, 0);
 
     low_battery_popup_ = lv_obj_create(screen);
     lv_obj_set_scrollbar_mode(low_battery_popup_, LV_SCROLLBAR_MODE_OFF);
     lv_obj_set_size(low_battery_popup_, LV_HOR_RES * 0.9, fonts_.text_font->line_height * 2);
     lv_obj_align(low_battery_popup_, LV_ALIGN_BOTTOM_MID, 0, 0);
-    lv_obj_set_style_bg_color(low_battery_popup_, current_theme_.low_battery, 0);
-    lv_obj_set_style_radius(low_battery_popup_, 10, 0);
+    lv_obj_add_style(low_battery_popup_, &low_battery_style_, 0);
     low_battery_label_ = lv_label_create(low_battery_popup_);
     lv_label_set_text(low_battery_label_, Lang::Strings::BATTERY_NEED_CHARGE);
     lv_obj_set_style_text_color(low_battery_label_, lv_color_white(), 0);
@@ -814,8 +1090,10 @@ void LcdDisplay::SetPreviewImage(const lv_img_dsc_t* img_dsc) {
     }
     
     if (img_dsc != nullptr) {
-        // zoom factor 0.5
-        lv_image_set_scale(preview_image_, 128 * width_ / img_dsc->header.w);
+        // 预览区域为半个屏幕；摄像头已按此大小缩放，只有更大的图片才由 LVGL 缩小
+        int zoom_w = 128 * width_ / img_dsc->header.w;
+        int zoom_h = 128 * height_ / img_dsc->header.h;
+        lv_image_set_scale(preview_image_, std::min({zoom_w, zoom_h, 256}));
         // 设置图片源并显示预览图片
         lv_image_set_src(preview_image_, img_dsc);
         lv_obj_clear_flag(preview_image_, LV_OBJ_FLAG_HIDDEN);
@@ -919,183 +1197,10 @@ void LcdDisplay::SetTheme(const std::string& theme_name) {
         ESP_LOGE(TAG, "Invalid theme name: %s", theme_name.c_str());
         return;
     }
-    
-    // Get the active screen
-    lv_obj_t* screen = lv_screen_active();
-    
-    // Update the screen colors
-    lv_obj_set_style_bg_color(screen, current_theme_.background, 0);
-    lv_obj_set_style_text_color(screen, current_theme_.text, 0);
-    
-    // Update container colors
-    if (container_ != nullptr) {
-        lv_obj_set_style_bg_color(container_, current_theme_.background, 0);
-        lv_obj_set_style_border_color(container_, current_theme_.border, 0);
-    }
-    
-    // Update status bar colors
-    if (status_bar_ != nullptr) {
-        lv_obj_set_style_bg_color(status_bar_, current_theme_.background, 0);
-        lv_obj_set_style_text_color(status_bar_, current_theme_.text, 0);
-        
-        // Update status bar elements
-        if (network_label_ != nullptr) {
-            lv_obj_set_style_text_color(network_label_, current_theme_.text, 0);
-        }
-        if (status_label_ != nullptr) {
-            lv_obj_set_style_text_color(status_label_, current_theme_.text, 0);
-        }
-        if (notification_label_ != nullptr) {
-            lv_obj_set_style_text_color(notification_label_, current_theme_.text, 0);
-        }
-        if (mute_label_ != nullptr) {
-            lv_obj_set_style_text_color(mute_label_, current_theme_.text, 0);
-        }
-        if (battery_label_ != nullptr) {
-            lv_obj_set_style_text_color(battery_label_, current_theme_.text, 0);
-        }
-        if (emotion_label_ != nullptr) {
-            lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
-        }
-    }
-    
-    // Update content area colors
-    if (content_ != nullptr) {
-        lv_obj_set_style_bg_color(content_, current_theme_.chat_background, 0);
-        lv_obj_set_style_border_color(content_, current_theme_.border, 0);
-        
-        // If we have the chat message style, update all message bubbles
-#if CONFIG_USE_WECHAT_MESSAGE_STYLE
-        // Iterate through all children of content (message containers or bubbles)
-        uint32_t child_count = lv_obj_get_child_cnt(content_);
-        for (uint32_t i = 0; i < child_count; i++) {
-            lv_obj_t* obj = lv_obj_get_child(content_, i);
-            if (obj == nullptr) continue;
-            
-            lv_obj_t* bubble = nullptr;
-            
-            // 检查这个对象是容器还是气泡
-            // 如果是容器（用户或系统消息），则获取其子对象作为气泡
-            // 如果是气泡（助手消息），则直接使用
-            if (lv_obj_get_child_cnt(obj) > 0) {
-                // 可能是容器，检查它是否为用户或系统消息容器
-                // 用户和系统消息容器是透明的
-                lv_opa_t bg_opa = lv_obj_get_style_bg_opa(obj, 0);
-                if (bg_opa == LV_OPA_TRANSP) {
-                    // 这是用户或系统消息的容器
-                    bubble = lv_obj_get_child(obj, 0);
-                } else {
-                    // 这可能是助手消息的气泡自身
-                    bubble = obj;
-                }
-            } else {
-                // 没有子元素，可能是其他UI元素，跳过
-                continue;
-            }
-            
-            if (bubble == nullptr) continue;
-            
-            // 使用保存的用户数据来识别气泡类型
-            void* bubble_type_ptr = lv_obj_get_user_data(bubble);
-            if (bubble_type_ptr != nullptr) {
-                const char* bubble_type = static_cast<const char*>(bubble_type_ptr);
-                
-                // 根据气泡类型应用正确的颜色
-                if (strcmp(bubble_type, "user") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.user_bubble, 0);
-                } else if (strcmp(bubble_type, "assistant") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.assistant_bubble, 0); 
-                } else if (strcmp(bubble_type, "system") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.system_bubble, 0);
-                } else if (strcmp(bubble_type, "image") == 0) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.system_bubble, 0);
-                }
-                
-                // Update border color
-                lv_obj_set_style_border_color(bubble, current_theme_.border, 0);
-                
-                // Update text color for the message
-                if (lv_obj_get_child_cnt(bubble) > 0) {
-                    lv_obj_t* text = lv_obj_get_child(bubble, 0);
-                    if (text != nullptr) {
-                        // 根据气泡类型设置文本颜色
-                        if (strcmp(bubble_type, "system") == 0) {
-                            lv_obj_set_style_text_color(text, current_theme_.system_text, 0);
-                        } else {
-                            lv_obj_set_style_text_color(text, current_theme_.text, 0);
-                        }
-                    }
-                }
-            } else {
-                // 如果没有标记，回退到之前的逻辑（颜色比较）
-                // ...保留原有的回退逻辑...
-                lv_color_t bg_color = lv_obj_get_style_bg_color(bubble, 0);
-            
-                // 改进bubble类型检测逻辑，不仅使用颜色比较
-                bool is_user_bubble = false;
-                bool is_assistant_bubble = false;
-                bool is_system_bubble = false;
-            
-                // 检查用户bubble
-                if (lv_color_eq(bg_color, DARK_USER_BUBBLE_COLOR) || 
-                    lv_color_eq(bg_color, LIGHT_USER_BUBBLE_COLOR) ||
-                    lv_color_eq(bg_color, current_theme_.user_bubble)) {
-                    is_user_bubble = true;
-                }
-                // 检查系统bubble
-                else if (lv_color_eq(bg_color, DARK_SYSTEM_BUBBLE_COLOR) || 
-                         lv_color_eq(bg_color, LIGHT_SYSTEM_BUBBLE_COLOR) ||
-                         lv_color_eq(bg_color, current_theme_.system_bubble)) {
-                    is_system_bubble = true;
-                }
-                // 剩余的都当作助手bubble处理
-                else {
-                    is_assistant_bubble = true;
-                }
-            
-                // 根据bubble类型应用正确的颜色
-                if (is_user_bubble) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.user_bubble, 0);
-                } else if (is_assistant_bubble) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.assistant_bubble, 0);
-                } else if (is_system_bubble) {
-                    lv_obj_set_style_bg_color(bubble, current_theme_.system_bubble, 0);
-                }
-                
-                // Update border color
-                lv_obj_set_style_border_color(bubble, current_theme_.border, 0);
-                
-                // Update text color for the message
-                if (lv_obj_get_child_cnt(bubble) > 0) {
-                    lv_obj_t* text = lv_obj_get_child(bubble, 0);
-                    if (text != nullptr) {
-                        // 回退到颜色检测逻辑
-                        if (lv_color_eq(bg_color, current_theme_.system_bubble) ||
-                            lv_color_eq(bg_color, DARK_SYSTEM_BUBBLE_COLOR) || 
-                            lv_color_eq(bg_color, LIGHT_SYSTEM_BUBBLE_COLOR)) {
-                            lv_obj_set_style_text_color(text, current_theme_.system_text, 0);
-                        } else {
-                            lv_obj_set_style_text_color(text, current_theme_.text, 0);
-                        }
-                    }
-                }
-            }
-        }
-#else
-        // Simple UI mode - just update the main chat message
-        if (chat_message_label_ != nullptr) {
-            lv_obj_set_style_text_color(chat_message_label_, current_theme_.text, 0);
-        }
-        
-        if (emotion_label_ != nullptr) {
-            lv_obj_set_style_text_color(emotion_label_, current_theme_.text, 0);
-        }
-#endif
-    }
-    
-    // Update low battery popup
-    if (low_battery_popup_ != nullptr) {
-        lv_obj_set_style_bg_color(low_battery_popup_, current_theme_.low_battery, 0);
+
+    // Every themed object, chat bubbles included, takes its colors from the shared styles
+    if (theme_styles_ready_) {
+        ApplyThemeStyles();
     }
 
     // No errors occurred. Save theme to settings
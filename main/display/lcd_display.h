@@ -8,6 +8,14 @@
 #include <font_emoji.h>
 
 #include <atomic>
+#include <memory>
+
+#if CONFIG_USE_FONT_GLYPH_CACHE || CONFIG_USE_FONT_PARTITION
+#include "font_cache.h"
+#endif
+#if CONFIG_USE_CHAT_HISTORY
+#include "chat_history.h"
+#endif
 
 // Theme color structure
 struct ThemeColors {
@@ -22,6 +30,28 @@ struct ThemeColors {
     lv_color_t low_battery;
 };
 
+enum LcdRenderMode {
+    kLcdRenderPartial,  // LVGL redraws the dirty areas into strips of `lines` lines
+    kLcdRenderDirect,   // Screen sized buffers, only dirty areas are redrawn and sent
+    kLcdRenderFull,     // Screen sized buffers, the whole screen is redrawn and sent
+};
+
+// Lines of internal DMA memory that copy PSRAM draw buffers out to the panel bus
+#define LCD_BOUNCE_BUFFER_LINES 10
+
+/*
+ * How LVGL renders into the panel. Each panel type has a default, and a board
+ * can pass its own policy from config.h. The "display" settings override it
+ * at boot so a board can be tuned without a rebuild: buffer_lines,
+ * double_buffer (0/1), buffer_psram (0/1) and render_mode
+ * (partial/direct/full). PSRAM buffers leave the internal DMA memory to audio.
+ */
+struct LcdBufferConfig {
+    int lines;
+    bool double_buffer;
+    bool spiram;
+    LcdRenderMode mode;
+};
 
 class LcdDisplay : public Display {
 protected:
@@ -37,8 +67,53 @@ protected:
 
     DisplayFonts fonts_;
     ThemeColors current_theme_;
+    // Objects take their theme colors from these shared styles instead of local ones, so
+    // switching the theme rewrites the styles once and LVGL restyles every object using them
+    lv_style_t screen_style_;           // Screen background and text
+    lv_style_t panel_style_;            // Container and status bar
+    lv_style_t content_style_;          // Chat area
+    lv_style_t bubble_style_;           // Shape and border shared by every chat bubble
+    lv_style_t user_bubble_style_;
+    lv_style_t assistant_bubble_style_;
+    lv_style_t system_bubble_style_;
+    lv_style_t chat_row_style_;         // Transparent full width row around user and system bubbles
+    lv_style_t low_battery_style_;
+    bool theme_styles_ready_ = false;
+#if CONFIG_USE_FONT_GLYPH_CACHE
+    std::unique_ptr<GlyphCacheFont> text_font_cache_;
+#endif
 
     void SetupUI();
+    // Creates the shared styles on first use, LVGL has to be running
+    void InitThemeStyles();
+    // Writes current_theme_ into the shared styles and redraws what uses them
+    void ApplyThemeStyles();
+    // Swaps in the partition font and the glyph cache, LVGL has to be running
+    void LoadFonts();
+    // The board's policy with the settings applied, clamped to what the panel can use
+    LcdBufferConfig LoadBufferConfig(LcdBufferConfig config);
+    uint32_t GetBufferSize(const LcdBufferConfig& config) const;
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+    void FitChatBubble(lv_obj_t* msg_text, const char* text);
+#if CONFIG_USE_CHAT_HISTORY
+    std::unique_ptr<ChatHistory> chat_history_;
+    // Sequence numbers of the messages the rows of content_ show, in order: [first, next)
+    uint32_t chat_window_first_ = 0;
+    uint32_t chat_window_next_ = 0;
+    bool chat_paging_ = false;
+
+    lv_obj_t* CreateChatRow();
+    void BindChatRow(lv_obj_t* row, uint32_t sequence);
+    lv_obj_t* FindChatRow(uint32_t sequence);
+    // The first or last row of the list to show another message, preview images on the way are deleted
+    lv_obj_t* TakeChatRow(bool top);
+    void ShowLatestChat();
+    void OnChatScrollEnd();
+#else
+    // Continues the reply in the last bubble, false if that is not one to continue
+    bool AppendChatMessage(const char* content);
+#endif
+#endif
     virtual bool Lock(int timeout_ms = 0) override;
     virtual void Unlock() override;
 
@@ -62,28 +137,34 @@ public:
 // RGB LCD显示器
 class RgbLcdDisplay : public LcdDisplay {
 public:
+    static constexpr LcdBufferConfig kDefaultBuffer = {20, true, false, kLcdRenderFull};
+
     RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                   int width, int height, int offset_x, int offset_y,
                   bool mirror_x, bool mirror_y, bool swap_xy,
-                  DisplayFonts fonts);
+                  DisplayFonts fonts, const LcdBufferConfig& buffer = kDefaultBuffer);
 };
 
 // MIPI LCD显示器
 class MipiLcdDisplay : public LcdDisplay {
 public:
+    static constexpr LcdBufferConfig kDefaultBuffer = {50, false, false, kLcdRenderPartial};
+
     MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                    int width, int height, int offset_x, int offset_y,
                    bool mirror_x, bool mirror_y, bool swap_xy,
-                   DisplayFonts fonts);
+                   DisplayFonts fonts, const LcdBufferConfig& buffer = kDefaultBuffer);
 };
 
 // // SPI LCD显示器
 class SpiLcdDisplay : public LcdDisplay {
 public:
+    static constexpr LcdBufferConfig kDefaultBuffer = {20, false, false, kLcdRenderPartial};
+
     SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                   int width, int height, int offset_x, int offset_y,
                   bool mirror_x, bool mirror_y, bool swap_xy,
-                  DisplayFonts fonts);
+                  DisplayFonts fonts, const LcdBufferConfig& buffer = kDefaultBuffer);
 };
 
 // QSPI LCD显示器
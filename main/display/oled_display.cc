@@ -8,9 +8,13 @@
 #include <esp_log.h>
 #include <esp_err.h>
 #include <esp_lvgl_port.h>
+#include <esp_heap_caps.h>
 
 #define TAG "OledDisplay"
 
+// The display's user data belongs to esp_lvgl_port, and there is only one OLED
+static OledDisplay* native_display = nullptr;
+
 LV_FONT_DECLARE(font_awesome_30_1);
 
 OledDisplay::OledDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
@@ -20,17 +24,22 @@ OledDisplay::OledDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handl
     height_ = height;
 
     ESP_LOGI(TAG, "Initialize LVGL");
-    lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
-    port_cfg.task_priority = 1;
+    lvgl_port_cfg_t port_cfg = GetPortConfig();
     port_cfg.timer_period_ms = 50;
     lvgl_port_init(&port_cfg);
 
+    // The native buffers replace the port's RGB565 one, which then only needs to exist
+    size_t page_bytes = width_ * height_ / OLED_PAGE_HEIGHT;
+    render_buffer_ = (uint8_t*)heap_caps_malloc(page_bytes + 8, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    panel_pages_ = (uint8_t*)heap_caps_calloc(1, page_bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    bool native = render_buffer_ != nullptr && panel_pages_ != nullptr;
+
     ESP_LOGI(TAG, "Adding OLED display");
     const lvgl_port_display_cfg_t display_cfg = {
         .io_handle = panel_io_,
         .panel_handle = panel_,
         .control_handle = nullptr,
-        .buffer_size = static_cast<uint32_t>(width_ * height_),
+        .buffer_size = static_cast<uint32_t>(native ? width_ * OLED_PAGE_HEIGHT : width_ * height_),
         .double_buffer = false,
         .trans_size = 0,
         .hres = static_cast<uint32_t>(width_),
@@ -55,6 +64,9 @@ OledDisplay::OledDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handl
         ESP_LOGE(TAG, "Failed to add display");
         return;
     }
+    if (!native || !SetupNativeRendering()) {
+        ESP_LOGW(TAG, "Falling back to the port's monochrome conversion");
+    }
 
     if (height_ == 64) {
         SetupUI_128x64();
@@ -84,6 +96,69 @@ OledDisplay::~OledDisplay() {
         esp_lcd_panel_io_del(panel_io_);
     }
     lvgl_port_deinit();
+    native_display = nullptr;
+    heap_caps_free(render_buffer_);
+    heap_caps_free(panel_pages_);
+}
+
+bool OledDisplay::SetupNativeRendering() {
+    DisplayLockGuard lock(this);
+    // Start from a known panel, the copy says it is dark
+    if (esp_lcd_panel_draw_bitmap(panel_, 0, 0, width_, height_, panel_pages_) != ESP_OK) {
+        return false;
+    }
+
+    lv_display_set_color_format(display_, LV_COLOR_FORMAT_I1);
+    lv_display_set_buffers(display_, render_buffer_, nullptr, width_ * height_ / OLED_PAGE_HEIGHT + 8,
+        LV_DISPLAY_RENDER_MODE_PARTIAL);
+    native_display = this;
+    lv_display_set_flush_cb(display_, [](lv_display_t* disp, const lv_area_t* area, uint8_t* px_map) {
+        native_display->Flush(area, px_map);
+        lv_display_flush_ready(disp);
+    });
+    // Whole pages, and whole bytes of an I1 row, so an area always maps onto complete panel bytes
+    lv_display_add_event_cb(display_, [](lv_event_t* e) {
+        auto area = static_cast<lv_area_t*>(lv_event_get_param(e));
+        area->x1 &= ~7;
+        area->x2 |= 7;
+        area->y1 &= ~(OLED_PAGE_HEIGHT - 1);
+        area->y2 |= OLED_PAGE_HEIGHT - 1;
+    }, LV_EVENT_INVALIDATE_AREA, nullptr);
+    lv_obj_invalidate(lv_screen_active());
+    return true;
+}
+
+// LVGL's black is a lit pixel, the theme draws dark text on a light screen
+void OledDisplay::Flush(const lv_area_t* area, uint8_t* px_map) {
+    px_map += 8;
+    int w = lv_area_get_width(area);
+    uint32_t stride = lv_draw_buf_width_to_stride(w, LV_COLOR_FORMAT_I1);
+    for (int page_y = area->y1; page_y <= area->y2; page_y += OLED_PAGE_HEIGHT) {
+        uint8_t* page = panel_pages_ + (page_y / OLED_PAGE_HEIGHT) * width_;
+        int first = -1;
+        int last = -1;
+        for (int x = area->x1; x <= area->x2; x++) {
+            int bx = x - area->x1;
+            const uint8_t* column = px_map + (page_y - area->y1) * stride + bx / 8;
+            uint8_t mask = 0x80 >> (bx % 8);
+            uint8_t value = 0;
+            for (int row = 0; row < OLED_PAGE_HEIGHT; row++, column += stride) {
+                if (!(*column & mask)) {
+                    value |= 1 << row;
+                }
+            }
+            if (page[x] != value) {
+                page[x] = value;
+                if (first < 0) {
+                    first = x;
+                }
+                last = x;
+            }
+        }
+        if (first >= 0) {
+            esp_lcd_panel_draw_bitmap(panel_, first, page_y, last + 1, page_y + OLED_PAGE_HEIGHT, page + first);
+        }
+    }
 }
 
 bool OledDisplay::Lock(int timeout_ms) {
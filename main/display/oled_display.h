@@ -6,6 +6,15 @@
 #include <esp_lcd_panel_io.h>
 #include <esp_lcd_panel_ops.h>
 
+// The panel is written in pages of 8 rows, one byte per column and page
+#define OLED_PAGE_HEIGHT 8
+
+/*
+ * LVGL renders straight into 1 bit per pixel (I1) here, and the flush packs the rows
+ * into the pages of the SSD1306/SH1106. A copy of the panel memory is kept, so only the
+ * columns that really changed in each page go over I2C. A minute tick of the clock then
+ * costs a few dozen bytes instead of the whole frame.
+ */
 class OledDisplay : public Display {
 private:
     esp_lcd_panel_io_handle_t panel_io_ = nullptr;
@@ -20,6 +29,12 @@ private:
 
     DisplayFonts fonts_;
 
+    uint8_t* render_buffer_ = nullptr;  // I1, with the two palette entries LVGL puts in front
+    uint8_t* panel_pages_ = nullptr;    // What the panel shows, in its own page layout
+
+    bool SetupNativeRendering();
+    void Flush(const lv_area_t* area, uint8_t* px_map);
+
     virtual bool Lock(int timeout_ms = 0) override;
     virtual void Unlock() override;
 
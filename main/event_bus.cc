@@ -0,0 +1,65 @@
+#include "event_bus.h"
+#include "task_topology.h"
+
+#include <esp_log.h>
+
+#define TAG "EventBus"
+
+EventBus::EventBus() {
+    TaskTopology::GetInstance().CreateTask(kTaskEventBus, [](void* arg) {
+        ((EventBus*)arg)->Run();
+        TaskTopology::ExitTask();
+    }, this, &task_handle_);
+}
+
+bool EventBus::Subscribe(const char* name, uint32_t types, std::function<void(const Event&)> handler) {
+    std::lock_guard<std::mutex> lock(subscribe_mutex_);
+    int index = subscriber_count_.load(std::memory_order_relaxed);
+    if (index == EVENT_BUS_MAX_SUBSCRIBERS) {
+        ESP_LOGE(TAG, "No slot left for %s", name);
+        return false;
+    }
+    auto& subscriber = subscribers_[index];
+    subscriber.name = name;
+    subscriber.types = types;
+    subscriber.handler = std::move(handler);
+    subscriber.queue = std::make_unique<MpscRingBuffer<Event>>(EVENT_BUS_QUEUE_SIZE);
+    subscriber_count_.store(index + 1, std::memory_order_release);
+    return true;
+}
+
+void EventBus::Publish(const Event& event) {
+    int count = subscriber_count_.load(std::memory_order_acquire);
+    bool queued = false;
+    for (int i = 0; i < count; i++) {
+        auto& subscriber = subscribers_[i];
+        if (!(subscriber.types & EVENT_MASK(event.type))) {
+            continue;
+        }
+        Event copy = event;
+        if (subscriber.queue->Push(std::move(copy))) {
+            queued = true;
+        } else {
+            dropped_++;
+            ESP_LOGW(TAG, "%s is behind, event %d dropped", subscriber.name, event.type);
+        }
+    }
+    if (queued && task_handle_ != nullptr) {
+        xTaskNotifyGive(task_handle_);
+    }
+}
+
+void EventBus::Run() {
+    Event event;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // An event published while the queues are drained notifies again, the next take returns at once
+        int count = subscriber_count_.load(std::memory_order_acquire);
+        for (int i = 0; i < count; i++) {
+            auto& subscriber = subscribers_[i];
+            while (subscriber.queue->Pop(event)) {
+                subscriber.handler(event);
+            }
+        }
+    }
+}
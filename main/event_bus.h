@@ -0,0 +1,89 @@
+#ifndef EVENT_BUS_H
+#define EVENT_BUS_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+#include "device_state.h"
+#include "mpsc_ring_buffer.h"
+
+#define EVENT_BUS_MAX_SUBSCRIBERS 8
+// Events a subscriber may fall behind by before new ones are dropped for it
+#define EVENT_BUS_QUEUE_SIZE 16
+
+enum EventType : uint8_t {
+    kEventDeviceStateChanged = 0,   // state, previous_state
+    kEventVoiceDetected,            // flag is true while the user speaks
+    kEventTypeCount
+};
+
+#define EVENT_MASK(type) (1u << (type))
+
+// Fixed size and trivially copyable, events are copied into the subscriber queues
+struct Event {
+    EventType type = kEventTypeCount;
+    DeviceState state = kDeviceStateUnknown;
+    DeviceState previous_state = kDeviceStateUnknown;
+    bool flag = false;
+    int64_t time_us = 0;
+};
+
+/*
+ * Typed publish/subscribe between the application and the subsystems that
+ * only react to it, the LEDs and the display.
+ *
+ * Each subscriber gets a lock-free queue of its own, so Publish() copies the
+ * event into the queues of the subscribers of its type and returns, from any
+ * task, without allocating or waiting on a handler. The handlers run one
+ * after the other on the event bus task, in publish order per subscriber. A
+ * subscriber that falls EVENT_BUS_QUEUE_SIZE events behind loses the new
+ * ones, counted in dropped(); a state handler should read the current state
+ * rather than rely on seeing every step.
+ *
+ * Subscribers are added at boot and stay, the queues and the task are
+ * allocated then.
+ */
+class EventBus {
+public:
+    static EventBus& GetInstance() {
+        static EventBus instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    EventBus(const EventBus&) = delete;
+    EventBus& operator=(const EventBus&) = delete;
+
+    // `types` is a mask of EVENT_MASK bits. False when all slots are taken
+    bool Subscribe(const char* name, uint32_t types, std::function<void(const Event&)> handler);
+    // Any task
+    void Publish(const Event& event);
+    // Events lost by all subscribers together
+    uint32_t dropped() const { return dropped_; }
+
+private:
+    EventBus();
+
+    struct Subscriber {
+        const char* name = nullptr;
+        uint32_t types = 0;
+        std::function<void(const Event&)> handler;
+        std::unique_ptr<MpscRingBuffer<Event>> queue;
+    };
+
+    Subscriber subscribers_[EVENT_BUS_MAX_SUBSCRIBERS];
+    // Slots below this are complete, Publish() never looks further
+    std::atomic<int> subscriber_count_ = 0;
+    std::atomic<uint32_t> dropped_ = 0;
+    std::mutex subscribe_mutex_;
+    TaskHandle_t task_handle_ = nullptr;
+
+    void Run();
+};
+
+#endif // EVENT_BUS_H
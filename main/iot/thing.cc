@@ -8,32 +8,55 @@
 
 namespace iot {
 
-#if CONFIG_IOT_PROTOCOL_XIAOZHI
 static std::map<std::string, std::function<Thing*()>>* thing_creators = nullptr;
-#endif
 
 void RegisterThing(const std::string& type, std::function<Thing*()> creator) {
-#if CONFIG_IOT_PROTOCOL_XIAOZHI
     if (thing_creators == nullptr) {
         thing_creators = new std::map<std::string, std::function<Thing*()>>();
     }
     (*thing_creators)[type] = creator;
-#endif
 }
 
 Thing* CreateThing(const std::string& type) {
-#if CONFIG_IOT_PROTOCOL_XIAOZHI
-    auto creator = thing_creators->find(type);
-    if (creator == thing_creators->end()) {
-        ESP_LOGE(TAG, "Thing type not found: %s", type.c_str());
+    // Legacy things are not registered with MCP, the common tools cover them
+    if (thing_creators == nullptr || thing_creators->find(type) == thing_creators->end()) {
+        ESP_LOGD(TAG, "Thing type not found: %s", type.c_str());
         return nullptr;
     }
-    return creator->second();
-#else
-    return nullptr;
+    return (*thing_creators)[type]();
+}
+
+Thing::Thing(const std::string& name, const std::string& description, bool slow_methods) :
+    name_(name), description_(description) {
+    if (slow_methods) {
+        std::string task_name = "thing_" + name;
+        worker_ = std::make_unique<BackgroundTask>(task_name.c_str(), THING_METHOD_STACK_SIZE, 2, tskNO_AFFINITY,
+            THING_METHOD_QUEUE_DEPTH);
+    }
+}
+
+Thing::~Thing() = default;
+
+bool Thing::InvokeMethod(Method& method, const ParameterList& parameters, BackgroundTaskToken* token) {
+    if (!worker_) {
+        Application::GetInstance().Schedule([&method, parameters]() {
+            method.Invoke(parameters);
+        });
+        return true;
+    }
+    return worker_->Schedule([&method, parameters]() {
+        method.Invoke(parameters);
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
+        // Report the result now instead of at the next listen start
+        auto& app = Application::GetInstance();
+        app.Schedule([&app]() {
+            app.UpdateIotStates();
+        });
 #endif
+    }, kBackgroundTaskPriorityNormal, token);
 }
 
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
 std::string Thing::GetDescriptorJson() {
     std::string json_str = "{";
     json_str += "\"name\":\"" + name_ + "\",";
@@ -43,22 +66,29 @@ std::string Thing::GetDescriptorJson() {
     json_str += "}";
     return json_str;
 }
+#endif
 
-std::string Thing::GetStateJson() {
-    std::string json_str = "{";
-    json_str += "\"name\":\"" + name_ + "\",";
-    json_str += "\"state\":" + properties_.GetStateJson();
-    json_str += "}";
-    return json_str;
+bool Thing::AppendStateJson(std::string& json, bool delta) {
+    size_t start = json.size();
+    json += "{\"name\":\"" + name_ + "\",\"state\":{";
+    if (!properties_.AppendStateJson(json, delta) && delta) {
+        json.resize(start);
+        return false;
+    }
+    json += "}}";
+    return true;
 }
 
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
 void Thing::Invoke(const cJSON* command) {
     auto method_name = cJSON_GetObjectItem(command, "method");
     auto input_params = cJSON_GetObjectItem(command, "parameters");
 
     try {
         auto& method = methods_[method_name->valuestring];
-        for (auto& param : method.parameters()) {
+        // A copy, the method may be invoked again before this call runs
+        ParameterList parameters = method.parameters();
+        for (auto& param : parameters) {
             auto input_param = cJSON_GetObjectItem(input_params, param.name().c_str());
             if (param.required() && input_param == nullptr) {
                 throw std::runtime_error("Parameter " + param.name() + " is required");
@@ -79,14 +109,15 @@ void Thing::Invoke(const cJSON* command) {
             }
         }
 
-        Application::GetInstance().Schedule([&method]() {
-            method.Invoke();
-        });
+        if (!InvokeMethod(method, parameters)) {
+            ESP_LOGW(TAG, "%s.%s dropped, too many calls waiting", name_.c_str(), method.name().c_str());
+        }
     } catch (const std::runtime_error& e) {
         ESP_LOGE(TAG, "Method not found: %s", method_name->valuestring);
         return;
     }
 }
+#endif
 
 
 } // namespace iot
@@ -6,7 +6,15 @@
 #include <functional>
 #include <vector>
 #include <stdexcept>
+#include <memory>
 #include <cJSON.h>
+#include <sdkconfig.h>
+
+#include "background_task.h"
+
+// Slow methods of a thing run in order on a worker of its own, calls beyond the depth are dropped
+#define THING_METHOD_QUEUE_DEPTH 4
+#define THING_METHOD_STACK_SIZE 4096
 
 namespace iot {
 
@@ -24,6 +32,11 @@ private:
     std::function<bool()> boolean_getter_;
     std::function<int()> number_getter_;
     std::function<std::string()> string_getter_;
+    // Value at the last Update(), compared as is so an unchanged property is never serialized
+    bool read_ = false;
+    bool last_boolean_ = false;
+    int last_number_ = 0;
+    std::string last_string_;
 
 public:
     Property(const std::string& name, const std::string& description, std::function<bool()> getter) :
@@ -55,15 +68,40 @@ public:
         return json_str;
     }
 
-    std::string GetStateJson() {
+    // Reads the getter, returns whether the value differs from the previous read
+    bool Update() {
+        bool changed = !read_;
+        read_ = true;
         if (type_ == kValueTypeBoolean) {
-            return boolean_getter_() ? "true" : "false";
+            bool value = boolean_getter_();
+            changed |= value != last_boolean_;
+            last_boolean_ = value;
         } else if (type_ == kValueTypeNumber) {
-            return std::to_string(number_getter_());
+            int value = number_getter_();
+            changed |= value != last_number_;
+            last_number_ = value;
         } else if (type_ == kValueTypeString) {
-            return "\"" + string_getter_() + "\"";
+            std::string value = string_getter_();
+            if (value != last_string_) {
+                changed = true;
+                last_string_ = std::move(value);
+            }
+        }
+        return changed;
+    }
+
+    // "name":value as of the last Update()
+    void AppendStateJson(std::string& json) const {
+        json += "\"" + name_ + "\":";
+        if (type_ == kValueTypeBoolean) {
+            json += last_boolean_ ? "true" : "false";
+        } else if (type_ == kValueTypeNumber) {
+            json += std::to_string(last_number_);
+        } else if (type_ == kValueTypeString) {
+            json += "\"" + last_string_ + "\"";
+        } else {
+            json += "null";
         }
-        return "null";
     }
 };
 
@@ -94,6 +132,11 @@ public:
         throw std::runtime_error("Property not found: " + name);
     }
 
+    // iterator
+    auto begin() { return properties_.begin(); }
+    auto end() { return properties_.end(); }
+    bool empty() const { return properties_.empty(); }
+
     std::string GetDescriptorJson() {
         std::string json_str = "{";
         for (auto& property : properties_) {
@@ -106,16 +149,21 @@ public:
         return json_str;
     }
 
-    std::string GetStateJson() {
-        std::string json_str = "{";
+    // Appends the properties separated by commas, with delta only those changed since the previous call.
+    // Returns whether any was appended
+    bool AppendStateJson(std::string& json, bool delta) {
+        bool appended = false;
         for (auto& property : properties_) {
-            json_str += "\"" + property.name() + "\":" + property.GetStateJson() + ",";
-        }
-        if (json_str.back() == ',') {
-            json_str.pop_back();
+            if (!property.Update() && delta) {
+                continue;
+            }
+            if (appended) {
+                json += ",";
+            }
+            property.AppendStateJson(json);
+            appended = true;
         }
-        json_str += "}";
-        return json_str;
+        return appended;
     }
 };
 
@@ -224,6 +272,11 @@ public:
     void Invoke() {
         callback_(parameters_);
     }
+
+    // With a copy of the parameters, for callers that may run concurrently
+    void Invoke(const ParameterList& parameters) {
+        callback_(parameters);
+    }
 };
 
 class MethodList {
@@ -247,6 +300,10 @@ public:
         throw std::runtime_error("Method not found: " + name);
     }
 
+    // iterator
+    auto begin() { return methods_.begin(); }
+    auto end() { return methods_.end(); }
+
     std::string GetDescriptorJson() {
         std::string json_str = "{";
         for (auto& method : methods_) {
@@ -262,16 +319,29 @@ public:
 
 class Thing {
 public:
-    Thing(const std::string& name, const std::string& description) :
-        name_(name), description_(description) {}
-    virtual ~Thing() = default;
+    // A thing whose methods wait on hardware (fades, servos, slow buses) sets slow_methods, so they
+    // never block the main loop
+    Thing(const std::string& name, const std::string& description, bool slow_methods = false);
+    virtual ~Thing();
 
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
     virtual std::string GetDescriptorJson();
-    virtual std::string GetStateJson();
     virtual void Invoke(const cJSON* command);
+#endif
+    // Appends {"name":...,"state":{...}}, with delta only if a property changed and only the changed ones.
+    // Returns whether anything was appended
+    virtual bool AppendStateJson(std::string& json, bool delta);
 
     const std::string& name() const { return name_; }
     const std::string& description() const { return description_; }
+    // For the MCP bridge in ThingManager
+    PropertyList& properties() { return properties_; }
+    MethodList& methods() { return methods_; }
+    bool slow_methods() const { return worker_ != nullptr; }
+
+    // Fast methods are scheduled on the main loop. Slow ones are queued on the thing's worker, the token
+    // completes when the method returned. False if the queue is full
+    bool InvokeMethod(Method& method, const ParameterList& parameters, BackgroundTaskToken* token = nullptr);
 
 protected:
     PropertyList properties_;
@@ -280,6 +350,7 @@ protected:
 private:
     std::string name_;
     std::string description_;
+    std::unique_ptr<BackgroundTask> worker_;
 };
 
 
@@ -295,6 +366,14 @@ Thing* CreateThing(const std::string& type);
         return true; \
     }();
 
+// For things the common MCP tools already cover (volume, brightness, battery). They only exist with the
+// Xiaozhi IoT protocol, with MCP CreateThing returns nullptr for them and nothing is allocated
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
+#define DECLARE_LEGACY_THING(TypeName) DECLARE_THING(TypeName)
+#else
+#define DECLARE_LEGACY_THING(TypeName)
+#endif
+
 } // namespace iot
 
 #endif // THING_H
@@ -1,50 +1,160 @@
 #include "thing_manager.h"
+#include "application.h"
+#if CONFIG_IOT_PROTOCOL_MCP
+#include "mcp_server.h"
+#endif
 
 #include <esp_log.h>
+#include <cctype>
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
+#include <mbedtls/sha256.h>
+#endif
 
 #define TAG "ThingManager"
 
 namespace iot {
 
 void ThingManager::AddThing(Thing* thing) {
+    // CreateThing returns nullptr for unknown and, with MCP, legacy things
+    if (thing == nullptr) {
+        return;
+    }
     things_.push_back(thing);
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
+    descriptors_.clear();
+    descriptors_hash_.clear();
+#endif
+#if CONFIG_IOT_PROTOCOL_MCP
+    RegisterMcpTools(thing);
+#endif
 }
 
-std::string ThingManager::GetDescriptorsJson() {
-    std::string json_str = "[";
-    for (auto& thing : things_) {
-        json_str += thing->GetDescriptorJson() + ",";
+#if CONFIG_IOT_PROTOCOL_MCP
+// BoardControl -> board_control, SetVolume -> set_volume, to match the names of the common tools
+static std::string ToSnakeCase(const std::string& name) {
+    std::string result;
+    for (size_t i = 0; i < name.size(); i++) {
+        char c = name[i];
+        if (isupper((unsigned char)c)) {
+            if (i > 0 && name[i - 1] != '_') {
+                result += '_';
+            }
+            c = tolower((unsigned char)c);
+        }
+        result += c;
+    }
+    return result;
+}
+
+// self.<thing>.get_state returns the properties, self.<thing>.<method> invokes a method like the
+// Xiaozhi IoT protocol does, a slow method is answered when it returned. The schemas are built once here, no IoT descriptors are sent
+void ThingManager::RegisterMcpTools(Thing* thing) {
+    auto& mcp_server = McpServer::GetInstance();
+    std::string prefix = "self." + ToSnakeCase(thing->name()) + ".";
+
+    if (!thing->properties().empty()) {
+        std::string description = thing->description() + ". Provides the current state:";
+        for (auto& property : thing->properties()) {
+            description += "\n  " + property.name() + ": " + property.description();
+        }
+        mcp_server.AddTool(prefix + "get_state", description, ::PropertyList(),
+            [thing](const ::PropertyList&) -> ReturnValue {
+                std::string json = "{";
+                thing->properties().AppendStateJson(json, false);
+                json += "}";
+                return json;
+            });
     }
-    if (json_str.back() == ',') {
-        json_str.pop_back();
+
+    for (auto& method : thing->methods()) {
+        std::string description = thing->description() + ". " + method.description();
+        ::PropertyList properties;
+        for (auto& parameter : method.parameters()) {
+            description += "\n  " + parameter.name() + ": " + parameter.description();
+            if (parameter.type() == kValueTypeBoolean) {
+                properties.AddProperty(parameter.required() ? ::Property(parameter.name(), kPropertyTypeBoolean)
+                    : ::Property(parameter.name(), kPropertyTypeBoolean, false));
+            } else if (parameter.type() == kValueTypeNumber) {
+                properties.AddProperty(parameter.required() ? ::Property(parameter.name(), kPropertyTypeInteger)
+                    : ::Property(parameter.name(), kPropertyTypeInteger, 0));
+            } else {
+                properties.AddProperty(parameter.required() ? ::Property(parameter.name(), kPropertyTypeString)
+                    : ::Property(parameter.name(), kPropertyTypeString, std::string()));
+            }
+        }
+        mcp_server.AddTool(prefix + ToSnakeCase(method.name()), description, properties,
+            [thing, &method](const ::PropertyList& arguments) -> ReturnValue {
+                // A copy, the tool may be called again before the main loop runs this one
+                ParameterList parameters = method.parameters();
+                for (auto& parameter : parameters) {
+                    if (parameter.type() == kValueTypeBoolean) {
+                        parameter.set_boolean(arguments[parameter.name()].value<bool>());
+                    } else if (parameter.type() == kValueTypeNumber) {
+                        parameter.set_number(arguments[parameter.name()].value<int>());
+                    } else {
+                        parameter.set_string(arguments[parameter.name()].value<std::string>());
+                    }
+                }
+                BackgroundTaskToken done;
+                if (!thing->InvokeMethod(method, parameters, &done)) {
+                    throw std::runtime_error("Too many calls waiting for " + thing->name());
+                }
+                // Only the tool worker waits, the tool timeout answers if the hardware hangs
+                if (thing->slow_methods()) {
+                    done.Wait();
+                }
+                return true;
+            });
     }
-    json_str += "]";
-    return json_str;
 }
+#endif
 
-bool ThingManager::GetStatesJson(std::string& json, bool delta) {
-    if (!delta) {
-        last_states_.clear();
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
+const std::vector<std::string>& ThingManager::GetDescriptors() {
+    if (descriptors_.empty() && !things_.empty()) {
+        descriptors_.reserve(things_.size());
+        for (auto& thing : things_) {
+            descriptors_.push_back(thing->GetDescriptorJson());
+        }
     }
+    return descriptors_;
+}
+
+const std::string& ThingManager::GetDescriptorsHash() {
+    if (descriptors_hash_.empty() && !things_.empty()) {
+        mbedtls_sha256_context context;
+        mbedtls_sha256_init(&context);
+        mbedtls_sha256_starts(&context, 0);
+        for (auto& descriptor : GetDescriptors()) {
+            mbedtls_sha256_update(&context, (const unsigned char*)descriptor.data(), descriptor.size());
+        }
+        uint8_t hash[32];
+        mbedtls_sha256_finish(&context, hash);
+        mbedtls_sha256_free(&context);
+
+        for (size_t i = 0; i < sizeof(hash); i++) {
+            char buffer[3];
+            sprintf(buffer, "%02x", hash[i]);
+            descriptors_hash_ += buffer;
+        }
+    }
+    return descriptors_hash_;
+}
+
+bool ThingManager::GetStatesJson(std::string& json, bool delta) {
     bool changed = false;
     json = "[";
-    // 枚举thing，获取每个thing的state，如果发生变化，则更新，保存到last_states_
-    // 如果delta为true，则只返回变化的部分
+    // 枚举thing，每个属性与上次读取的值比较
+    // 如果delta为true，则只返回发生变化的属性，没有变化时不做任何序列化
     for (auto& thing : things_) {
-        std::string state = thing->GetStateJson();
-        if (delta) {
-            // 如果delta为true，则只返回变化的部分
-            auto it = last_states_.find(thing->name());
-            if (it != last_states_.end() && it->second == state) {
-                continue;
-            }
+        if (changed) {
+            json += ",";
+        }
+        if (thing->AppendStateJson(json, delta)) {
             changed = true;
-            last_states_[thing->name()] = state;
+        } else if (changed) {
+            json.pop_back();
         }
-        json += state + ",";
-    }
-    if (json.back() == ',') {
-        json.pop_back();
     }
     json += "]";
     return changed;
@@ -60,4 +170,6 @@ void ThingManager::Invoke(const cJSON* command) {
     }
 }
 
+#endif
+
 } // namespace iot
@@ -22,18 +22,31 @@ public:
     ThingManager(const ThingManager&) = delete;
     ThingManager& operator=(const ThingManager&) = delete;
 
+    // With MCP the thing's properties and methods become MCP tools, see RegisterMcpTools
     void AddThing(Thing* thing);
 
-    std::string GetDescriptorsJson();
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
+    // One descriptor JSON per thing, serialized on the first call after a thing was added
+    const std::vector<std::string>& GetDescriptors();
+    // SHA-256 of the descriptors in hex, sent in the hello so a server that kept them can skip them
+    const std::string& GetDescriptorsHash();
     bool GetStatesJson(std::string& json, bool delta = false);
     void Invoke(const cJSON* command);
+#endif
 
 private:
     ThingManager() = default;
     ~ThingManager() = default;
 
     std::vector<Thing*> things_;
-    std::map<std::string, std::string> last_states_;
+#if CONFIG_IOT_PROTOCOL_XIAOZHI
+    std::vector<std::string> descriptors_;
+    std::string descriptors_hash_;
+#endif
+
+#if CONFIG_IOT_PROTOCOL_MCP
+    void RegisterMcpTools(Thing* thing);
+#endif
 };
 
 
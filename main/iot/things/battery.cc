@@ -32,4 +32,4 @@ public:
 
 } // namespace iot
 
-DECLARE_THING(Battery);
\ No newline at end of file
+DECLARE_LEGACY_THING(Battery);
\ No newline at end of file
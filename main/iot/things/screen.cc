@@ -51,4 +51,4 @@ public:
 
 } // namespace iot
 
-DECLARE_THING(Screen);
\ No newline at end of file
+DECLARE_LEGACY_THING(Screen);
\ No newline at end of file
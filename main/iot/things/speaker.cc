@@ -30,4 +30,4 @@ public:
 
 } // namespace iot
 
-DECLARE_THING(Speaker);
+DECLARE_LEGACY_THING(Speaker);
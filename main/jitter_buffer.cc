@@ -0,0 +1,161 @@
+#include "jitter_buffer.h"
+#include "latency_tracer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+
+#define TAG "JitterBuffer"
+
+JitterBuffer::JitterBuffer(size_t capacity, int min_delay_ms, int max_delay_ms)
+    : slots_(capacity), min_delay_ms_(min_delay_ms), max_delay_ms_(max_delay_ms) {
+}
+
+size_t JitterBuffer::GetTargetDepth() const {
+    if (last_frame_duration_ <= 0) {
+        return 1;
+    }
+    // The limits are in milliseconds so they hold for any frame duration the server picks
+    size_t min_depth = std::max(1, (min_delay_ms_ + last_frame_duration_ - 1) / last_frame_duration_);
+    size_t max_depth = std::min(std::max<size_t>(min_depth, max_delay_ms_ / last_frame_duration_), slots_.size());
+    // Keep about twice the measured jitter buffered, rounded up to whole frames
+    int64_t frame_us = last_frame_duration_ * 1000;
+    size_t depth = min_depth + (2 * jitter_us_ + frame_us - 1) / frame_us;
+    return std::min(depth, max_depth);
+}
+
+void JitterBuffer::Put(AudioStreamPacket&& packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = esp_timer_get_time();
+
+    last_sample_rate_ = packet.sample_rate;
+    last_frame_duration_ = packet.frame_duration;
+    if (last_arrival_us_ != 0) {
+        int64_t deviation = (now - last_arrival_us_) - packet.frame_duration * 1000;
+        if (deviation < 0) {
+            deviation = -deviation;
+        }
+        jitter_us_ += (deviation - jitter_us_) / 16;
+    }
+    last_arrival_us_ = now;
+
+    // Transports without sequence numbers (websocket) are ordered by arrival
+    uint32_t sequence = packet.sequence != 0 ? packet.sequence : ++arrival_sequence_;
+    if (!has_base_sequence_ || (count_ == 0 && !playing_)) {
+        has_base_sequence_ = true;
+        next_sequence_ = sequence;
+        highest_sequence_ = sequence;
+    }
+
+    int32_t offset = (int32_t)(sequence - next_sequence_);
+    if (offset < 0) {
+        stats_.late_drops++;
+        return;
+    }
+    if ((size_t)offset >= slots_.size()) {
+        if (count_ != 0) {
+            stats_.overflow_drops++;
+            return;
+        }
+        // The sender restarted its sequence space while we were drained
+        next_sequence_ = sequence;
+        highest_sequence_ = sequence;
+    }
+
+    auto& slot = slots_[sequence % slots_.size()];
+    if (slot.used) {
+        return; // duplicate
+    }
+    if ((int32_t)(sequence - highest_sequence_) < 0) {
+        stats_.reordered_packets++;
+    } else {
+        highest_sequence_ = sequence;
+    }
+    if (count_ == 0) {
+        first_arrival_us_ = now;
+    }
+    slot.used = true;
+    slot.sequence = sequence;
+    slot.arrival_us = now;
+    slot.packet = std::move(packet);
+    count_++;
+}
+
+bool JitterBuffer::Get(AudioStreamPacket& packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (count_ == 0) {
+        if (playing_) {
+            playing_ = false;
+            stats_.underruns++;
+        }
+        return false;
+    }
+
+    if (!playing_) {
+        // Prebuffer until the target depth is reached, or the oldest packet has waited as long as
+        // the target depth would take to play, so the tail of a stream is never held back
+        size_t target = GetTargetDepth();
+        int64_t waited_us = esp_timer_get_time() - first_arrival_us_;
+        if (count_ < target && waited_us < (int64_t)target * last_frame_duration_ * 1000) {
+            return false;
+        }
+        playing_ = true;
+    }
+
+    auto& slot = slots_[next_sequence_ % slots_.size()];
+    if (slot.used && slot.sequence == next_sequence_) {
+        std::swap(packet, slot.packet);
+        packet.fec = false;
+        LatencyTracer::GetInstance().Record(kLatencyStageJitterBuffer, esp_timer_get_time() - slot.arrival_us);
+        slot.used = false;
+        count_--;
+    } else {
+        // Missing frame with later frames already buffered. If the next packet is here its
+        // in-band FEC data can rebuild this frame, otherwise let the decoder conceal it.
+        auto& next = slots_[(next_sequence_ + 1) % slots_.size()];
+        packet.sample_rate = last_sample_rate_;
+        packet.frame_duration = last_frame_duration_;
+        packet.timestamp = 0;
+        if (next.used && next.sequence == next_sequence_ + 1) {
+            packet.payload = next.packet.payload;
+            packet.fec = true;
+        } else {
+            packet.payload.clear();
+            packet.fec = false;
+        }
+        stats_.lost_packets++;
+    }
+    packet.sequence = next_sequence_++;
+    return true;
+}
+
+void JitterBuffer::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& slot : slots_) {
+        slot.used = false;
+    }
+    count_ = 0;
+    playing_ = false;
+    has_base_sequence_ = false;
+    last_arrival_us_ = 0;
+}
+
+void JitterBuffer::SetDelayRange(int min_delay_ms, int max_delay_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    min_delay_ms_ = min_delay_ms;
+    max_delay_ms_ = max_delay_ms;
+}
+
+bool JitterBuffer::Empty() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_ == 0;
+}
+
+JitterBufferStats JitterBuffer::GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    JitterBufferStats stats = stats_;
+    stats.depth = count_;
+    stats.target_depth = GetTargetDepth();
+    stats.jitter_ms = jitter_us_ / 1000;
+    return stats;
+}
@@ -0,0 +1,74 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#include "protocol.h"
+
+struct JitterBufferStats {
+    size_t depth = 0;
+    size_t target_depth = 0;
+    uint32_t jitter_ms = 0;
+    uint32_t underruns = 0;
+    uint32_t late_drops = 0;
+    uint32_t overflow_drops = 0;
+    uint32_t lost_packets = 0;
+    uint32_t reordered_packets = 0;
+};
+
+/*
+ * Adaptive jitter buffer for downlink audio.
+ *
+ * Packets are stored in preallocated slots indexed by sequence number, so
+ * out-of-order packets are played back in order. The inter-arrival jitter is
+ * estimated as in RFC 3550 and the prebuffer depth follows it between
+ * min_delay_ms and max_delay_ms, counted in frames of the incoming stream. A packet that is still missing when its
+ * turn comes is rebuilt from the next packet's in-band FEC data when that
+ * packet is already buffered, otherwise it is returned with an empty payload
+ * so the Opus decoder runs packet loss concealment for that frame.
+ *
+ * Put() is called by the network task and Get() by the audio loop.
+ */
+class JitterBuffer {
+public:
+    JitterBuffer(size_t capacity, int min_delay_ms, int max_delay_ms);
+
+    void Put(AudioStreamPacket&& packet);
+    bool Get(AudioStreamPacket& packet);
+    void Reset();
+    // Takes effect from the next prebuffer, e.g. realtime mode keeps the buffer short
+    void SetDelayRange(int min_delay_ms, int max_delay_ms);
+    bool Empty();
+    JitterBufferStats GetStats();
+
+private:
+    struct Slot {
+        bool used = false;
+        uint32_t sequence = 0;
+        int64_t arrival_us = 0;
+        AudioStreamPacket packet;
+    };
+
+    std::mutex mutex_;
+    std::vector<Slot> slots_;
+    int min_delay_ms_;
+    int max_delay_ms_;
+    size_t count_ = 0;
+    bool playing_ = false;
+    bool has_base_sequence_ = false;
+    uint32_t next_sequence_ = 0;
+    uint32_t highest_sequence_ = 0;
+    uint32_t arrival_sequence_ = 0;
+    int64_t last_arrival_us_ = 0;
+    int64_t first_arrival_us_ = 0;
+    int64_t jitter_us_ = 0;
+    int last_sample_rate_ = 0;
+    int last_frame_duration_ = 0;
+    JitterBufferStats stats_;
+
+    size_t GetTargetDepth() const;
+};
+
+#endif // JITTER_BUFFER_H
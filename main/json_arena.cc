@@ -0,0 +1,146 @@
+#include "json_arena.h"
+#include "memory_accounting.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+#include <mutex>
+#include <vector>
+#include <cstdlib>
+
+#define TAG "JsonArena"
+
+// cJSON nodes hold a double
+#define JSON_ARENA_ALIGNMENT 8
+
+#if CONFIG_USE_JSON_ARENA
+static thread_local JsonArena* current_arena = nullptr;
+static std::atomic<JsonArena*> arenas[JSON_ARENA_MAX_ARENAS];
+
+struct JsonArenaHooks {
+    static void* Malloc(size_t size) {
+        JsonArena* arena = current_arena;
+        if (arena != nullptr) {
+            void* ptr = arena->Allocate(size);
+            if (ptr != nullptr) {
+                return ptr;
+            }
+        }
+        return malloc(size);
+    }
+
+    static void Free(void* ptr) {
+        for (auto& slot : arenas) {
+            JsonArena* arena = slot.load(std::memory_order_acquire);
+            if (arena != nullptr && arena->Owns(ptr)) {
+                arena->live_.fetch_sub(1, std::memory_order_release);
+                return;
+            }
+        }
+        free(ptr);
+    }
+};
+#endif
+
+void JsonArena::Initialize() {
+#if CONFIG_USE_JSON_ARENA
+    cJSON_Hooks hooks = {
+        .malloc_fn = JsonArenaHooks::Malloc,
+        .free_fn = JsonArenaHooks::Free,
+    };
+    cJSON_InitHooks(&hooks);
+#endif
+}
+
+JsonArena::JsonArena(size_t capacity) : capacity_(capacity) {
+#if CONFIG_USE_JSON_ARENA
+    for (auto& slot : arenas) {
+        JsonArena* expected = nullptr;
+        if (slot.compare_exchange_strong(expected, this)) {
+            return;
+        }
+    }
+    // Without a slot its frees could not be recognized, so it never allocates
+    ESP_LOGE(TAG, "More than %d arenas", JSON_ARENA_MAX_ARENAS);
+    capacity_ = 0;
+#endif
+}
+
+JsonArena::~JsonArena() {
+#if CONFIG_USE_JSON_ARENA
+    if (live_ > 0) {
+        ESP_LOGE(TAG, "%d allocations outlive the arena", live_.load());
+    }
+    for (auto& slot : arenas) {
+        JsonArena* expected = this;
+        slot.compare_exchange_strong(expected, nullptr);
+    }
+#endif
+    if (boot_slot_ != kBootSlotNone) {
+        BootArena::GetInstance().Release(boot_slot_);
+    } else {
+        heap_caps_free(block_);
+    }
+}
+
+void* JsonArena::Allocate(size_t size) {
+    size = (size + JSON_ARENA_ALIGNMENT - 1) & ~(size_t)(JSON_ARENA_ALIGNMENT - 1);
+    if (block_ == nullptr || capacity_ - offset_ < size) {
+        return nullptr;
+    }
+    void* ptr = block_ + offset_;
+    offset_ += size;
+    live_.fetch_add(1, std::memory_order_relaxed);
+    return ptr;
+}
+
+#if CONFIG_USE_JSON_ARENA
+JsonArenaScope::JsonArenaScope(JsonArena& arena) : previous_(current_arena) {
+    if (arena.block_ == nullptr && arena.capacity_ > 0) {
+        MemoryTagScope tag(kMemoryTagProtocol);
+        arena.block_ = (uint8_t*)BootArena::GetInstance().Acquire(kBootSlotJsonArena, arena.capacity_);
+        arena.boot_slot_ = arena.block_ != nullptr ? kBootSlotJsonArena : kBootSlotNone;
+        if (arena.block_ == nullptr) {
+            arena.block_ = (uint8_t*)heap_caps_malloc(arena.capacity_, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        }
+        if (arena.block_ == nullptr) {
+            ESP_LOGW(TAG, "Failed to allocate %u bytes, messages are parsed on the heap", arena.capacity_);
+            arena.capacity_ = 0;
+        }
+    }
+    // Only the owning task allocates, so once nothing is alive the block can start over
+    if (arena.live_.load(std::memory_order_acquire) == 0) {
+        arena.offset_ = 0;
+    }
+    current_arena = &arena;
+}
+
+JsonArenaScope::~JsonArenaScope() {
+    JsonArena* arena = current_arena;
+    if (arena->offset_ > arena->peak_) {
+        arena->peak_ = arena->offset_;
+        ESP_LOGD(TAG, "Peak %u of %u bytes", arena->peak_, arena->capacity_);
+    }
+    current_arena = previous_;
+}
+#endif
+
+std::string PrintJson(const cJSON* json) {
+    static std::mutex mutex;
+    static std::vector<char> buffer;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (buffer.empty()) {
+        buffer.resize(1024);
+    }
+    // cJSON reserves 5 bytes for number formatting at the end of the buffer
+    while (!cJSON_PrintPreallocated((cJSON*)json, buffer.data(), buffer.size(), false)) {
+        if (buffer.size() * 2 > JSON_PRINT_BUFFER_MAX_SIZE) {
+            char* str = cJSON_PrintUnformatted(json);
+            std::string result(str != nullptr ? str : "");
+            cJSON_free(str);
+            return result;
+        }
+        buffer.resize(buffer.size() * 2);
+    }
+    return std::string(buffer.data());
+}
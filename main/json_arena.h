@@ -0,0 +1,78 @@
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <sdkconfig.h>
+#include <cJSON.h>
+
+#include "boot_arena.h"
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Arenas the free hook checks a pointer against
+#define JSON_ARENA_MAX_ARENAS 4
+// The shared print buffer grows up to this size, larger documents are printed on the heap
+#define JSON_PRINT_BUFFER_MAX_SIZE 8192
+
+/*
+ * Bump allocator for the cJSON trees of one incoming message at a time.
+ *
+ * Every cJSON node and string is a separate heap allocation, and a control
+ * message is parsed, dispatched and deleted again within one callback. With
+ * CONFIG_USE_JSON_ARENA the cJSON hooks are installed at boot: while a
+ * JsonArenaScope is active on a task, allocations are carved from that
+ * arena's block and frees of them only count down. The block starts over at
+ * the next scope once nothing in it is alive any more, so a tree that a
+ * handler kept longer only delays the reset. Allocations that do not fit,
+ * and those of tasks without a scope, go to the heap as before.
+ *
+ * An arena belongs to the task that receives the messages, its block is
+ * allocated at the first scope.
+ */
+class JsonArena {
+public:
+    explicit JsonArena(size_t capacity);
+    ~JsonArena();
+    JsonArena(const JsonArena&) = delete;
+    JsonArena& operator=(const JsonArena&) = delete;
+
+    // Call once, early in app_main, before any cJSON tree is built
+    static void Initialize();
+
+private:
+    friend class JsonArenaScope;
+    friend struct JsonArenaHooks;
+
+    uint8_t* block_ = nullptr;
+    BootSlot boot_slot_ = kBootSlotNone;    // Where block_ is held, kBootSlotNone for the heap
+    size_t capacity_;
+    size_t offset_ = 0;
+    // Allocations not freed yet, any task may free them
+    std::atomic<int> live_{0};
+    size_t peak_ = 0;
+
+    void* Allocate(size_t size);
+    inline bool Owns(const void* ptr) const {
+        return block_ != nullptr && ptr >= block_ && ptr < block_ + capacity_;
+    }
+};
+
+// cJSON allocations of the calling task come from `arena` until the scope ends
+class JsonArenaScope {
+public:
+    explicit JsonArenaScope(JsonArena& arena);
+    ~JsonArenaScope();
+    JsonArenaScope(const JsonArenaScope&) = delete;
+    JsonArenaScope& operator=(const JsonArenaScope&) = delete;
+
+private:
+    JsonArena* previous_;
+};
+
+// Prints an outgoing message into a buffer shared by all tasks that keeps its size,
+// so only the returned string is allocated
+std::string PrintJson(const cJSON* json);
+
+#endif // JSON_ARENA_H
@@ -0,0 +1,77 @@
+#include "latency_tracer.h"
+
+#include <esp_log.h>
+#include <cJSON.h>
+#include <algorithm>
+
+#define TAG "LatencyTracer"
+
+const char* LatencyTracer::GetStageName(LatencyStage stage) {
+    static const char* const names[] = {
+        "i2s_read",
+        "afe",
+        "encode",
+        "send",
+        "jitter_buffer",
+        "decode",
+        "resample",
+        "output",
+        "response",
+        "push_to_talk",
+    };
+    static_assert(sizeof(names) / sizeof(names[0]) == kLatencyStageCount, "Missing latency stage name");
+    return names[stage];
+}
+
+LatencyStats LatencyTracer::GetStats(LatencyStage stage) {
+    auto& ring = rings_[stage];
+    LatencyStats stats;
+    stats.count = ring.count.load(std::memory_order_relaxed);
+
+    size_t n = std::min<size_t>(stats.count, LATENCY_TRACER_SAMPLES);
+    if (n == 0) {
+        return stats;
+    }
+    uint32_t sorted[LATENCY_TRACER_SAMPLES];
+    std::copy(ring.samples, ring.samples + n, sorted);
+    std::sort(sorted, sorted + n);
+    stats.p50_us = sorted[(n - 1) / 2];
+    stats.p99_us = sorted[(n - 1) * 99 / 100];
+    stats.max_us = sorted[n - 1];
+    return stats;
+}
+
+std::string LatencyTracer::GetReportJson() {
+    auto root = cJSON_CreateObject();
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        auto stage = (LatencyStage)i;
+        auto stats = GetStats(stage);
+        auto item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "count", stats.count);
+        cJSON_AddNumberToObject(item, "p50_us", stats.p50_us);
+        cJSON_AddNumberToObject(item, "p99_us", stats.p99_us);
+        cJSON_AddNumberToObject(item, "max_us", stats.max_us);
+        cJSON_AddItemToObject(root, GetStageName(stage), item);
+    }
+
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
+
+void LatencyTracer::LogReport() {
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        auto stage = (LatencyStage)i;
+        auto stats = GetStats(stage);
+        ESP_LOGI(TAG, "%-13s count %6lu  p50 %6lu us  p99 %6lu us  max %6lu us", GetStageName(stage),
+            stats.count, stats.p50_us, stats.p99_us, stats.max_us);
+    }
+}
+
+void LatencyTracer::Reset() {
+    for (auto& ring : rings_) {
+        ring.count.store(0, std::memory_order_relaxed);
+    }
+}
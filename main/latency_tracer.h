@@ -0,0 +1,104 @@
+#ifndef LATENCY_TRACER_H
+#define LATENCY_TRACER_H
+
+#include <esp_timer.h>
+#include "sdkconfig.h"
+#if CONFIG_USE_PIPELINE_TRACE
+#include "pipeline_trace.h"
+#endif
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#define LATENCY_TRACER_SAMPLES 64
+
+enum LatencyStage {
+    // Uplink
+    kLatencyStageI2sRead,
+    kLatencyStageAfe,
+    kLatencyStageEncode,
+    kLatencyStageSend,
+    // Downlink
+    kLatencyStageJitterBuffer,
+    kLatencyStageDecode,
+    kLatencyStageResample,
+    kLatencyStageOutput,
+    // Conversation: from the VAD reporting the end of the user's speech to the first frame of the
+    // reply written to the speaker. The VAD hangover and the output DMA come on top of it
+    kLatencyStageResponse,
+    // Push-to-talk: from the button press to the first uplink frame handed to the protocol
+    kLatencyStagePushToTalk,
+    kLatencyStageCount
+};
+
+struct LatencyStats {
+    uint32_t count = 0;
+    uint32_t p50_us = 0;
+    uint32_t p99_us = 0;
+    uint32_t max_us = 0;
+};
+
+/*
+ * Per-stage latency of the audio pipeline. Every stage keeps the durations of
+ * its last LATENCY_TRACER_SAMPLES frames in a fixed ring, so recording costs a
+ * timer read and a store. Percentiles are computed only when a report is
+ * requested, through the MCP tool or LogReport() on the serial console.
+ *
+ * Each stage is recorded by a single task, so no lock is needed.
+ */
+class LatencyTracer {
+public:
+    static LatencyTracer& GetInstance() {
+        static LatencyTracer instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    LatencyTracer(const LatencyTracer&) = delete;
+    LatencyTracer& operator=(const LatencyTracer&) = delete;
+
+    inline void Record(LatencyStage stage, int64_t duration_us) {
+        auto& ring = rings_[stage];
+        uint32_t index = ring.count.fetch_add(1, std::memory_order_relaxed);
+        ring.samples[index % LATENCY_TRACER_SAMPLES] = duration_us > 0 ? (uint32_t)duration_us : 0;
+    }
+
+    LatencyStats GetStats(LatencyStage stage);
+    std::string GetReportJson();
+    void LogReport();
+    void Reset();
+
+    static const char* GetStageName(LatencyStage stage);
+
+private:
+    LatencyTracer() = default;
+
+    struct Ring {
+        std::atomic<uint32_t> count{0};
+        uint32_t samples[LATENCY_TRACER_SAMPLES] = {};
+    };
+    Ring rings_[kLatencyStageCount];
+};
+
+// Records the time until the end of the enclosing scope, and the scope as a span of the pipeline trace
+class LatencyScope {
+public:
+    explicit LatencyScope(LatencyStage stage) : stage_(stage), start_us_(esp_timer_get_time()) {
+#if CONFIG_USE_PIPELINE_TRACE
+        PipelineTrace::GetInstance().Emit(stage, kPipelinePhaseBegin);
+#endif
+    }
+    ~LatencyScope() {
+        LatencyTracer::GetInstance().Record(stage_, esp_timer_get_time() - start_us_);
+#if CONFIG_USE_PIPELINE_TRACE
+        PipelineTrace::GetInstance().Emit(stage_, kPipelinePhaseEnd);
+#endif
+    }
+
+private:
+    LatencyStage stage_;
+    int64_t start_us_;
+};
+
+#endif // LATENCY_TRACER_H
@@ -1,16 +1,42 @@
 #include "circular_strip.h"
 #include "application.h"
 #include <esp_log.h>
+#include <soc/soc_caps.h>
+#include <cmath>
 
 #define TAG "CircularStrip"
 
-#define BLINK_INFINITE -1
+// 呼吸灯亮度曲线，0 到 255 再回到 0
+static uint8_t breathe_curve[STRIP_BREATHE_KEYFRAMES];
+
+static bool operator!=(const StripColor& a, const StripColor& b) {
+    return a.red != b.red || a.green != b.green || a.blue != b.blue;
+}
+
+static StripColor Mix(StripColor from, StripColor to, int alpha) {
+    StripColor color;
+    color.red = from.red + (to.red - from.red) * alpha / 255;
+    color.green = from.green + (to.green - from.green) * alpha / 255;
+    color.blue = from.blue + (to.blue - from.blue) * alpha / 255;
+    return color;
+}
 
 CircularStrip::CircularStrip(gpio_num_t gpio, uint8_t max_leds) : max_leds_(max_leds) {
     // If the gpio is not connected, you should use NoLed class
     assert(gpio != GPIO_NUM_NC);
 
-    colors_.resize(max_leds_);
+    // 所有缓冲区在这里一次分配，切换动画时不再分配内存
+    pending_colors_.resize(max_leds_);
+    static_colors_.resize(max_leds_);
+    from_.resize(max_leds_);
+    frame_.resize(max_leds_);
+    shown_.resize(max_leds_);
+
+    if (breathe_curve[STRIP_BREATHE_KEYFRAMES / 2] == 0) {
+        for (int i = 0; i < STRIP_BREATHE_KEYFRAMES; i++) {
+            breathe_curve[i] = (1.0f - cosf(2.0f * M_PI * i / STRIP_BREATHE_KEYFRAMES)) / 2.0f * 255.0f + 0.5f;
+        }
+    }
 
     led_strip_config_t strip_config = {};
     strip_config.strip_gpio_num = gpio;
@@ -20,6 +46,10 @@ CircularStrip::CircularStrip(gpio_num_t gpio, uint8_t max_leds) : max_leds_(max_
 
     led_strip_rmt_config_t rmt_config = {};
     rmt_config.resolution_hz = 10 * 1000 * 1000; // 10MHz
+#if SOC_RMT_SUPPORT_DMA
+    // 长灯带用 DMA 发送，刷新时不需要 CPU 填充 RMT 内存
+    rmt_config.flags.with_dma = max_leds_ >= STRIP_DMA_MIN_LEDS;
+#endif
 
     ESP_ERROR_CHECK(led_strip_new_rmt_device(&strip_config, &rmt_config, &led_strip_));
     led_strip_clear(led_strip_);
@@ -27,21 +57,19 @@ CircularStrip::CircularStrip(gpio_num_t gpio, uint8_t max_leds) : max_leds_(max_
     esp_timer_create_args_t strip_timer_args = {
         .callback = [](void *arg) {
             auto strip = static_cast<CircularStrip*>(arg);
-            std::lock_guard<std::mutex> lock(strip->mutex_);
-            if (strip->strip_callback_ != nullptr) {
-                strip->strip_callback_();
-            }
+            strip->OnTimer();
         },
         .arg = this,
         .dispatch_method = ESP_TIMER_TASK,
         .name = "strip_timer",
-        .skip_unhandled_events = false,
+        .skip_unhandled_events = true,
     };
     ESP_ERROR_CHECK(esp_timer_create(&strip_timer_args, &strip_timer_));
 }
 
 CircularStrip::~CircularStrip() {
     esp_timer_stop(strip_timer_);
+    esp_timer_delete(strip_timer_);
     if (led_strip_ != nullptr) {
         led_strip_del(led_strip_);
     }
@@ -49,131 +77,175 @@ CircularStrip::~CircularStrip() {
 
 
 void CircularStrip::SetAllColor(StripColor color) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(strip_timer_);
+    Animation animation;
+    animation.type = kAnimationStatic;
+    portENTER_CRITICAL(&pending_lock_);
     for (int i = 0; i < max_leds_; i++) {
-        colors_[i] = color;
-        led_strip_set_pixel(led_strip_, i, color.red, color.green, color.blue);
+        pending_colors_[i] = color;
     }
-    led_strip_refresh(led_strip_);
+    portEXIT_CRITICAL(&pending_lock_);
+    Start(animation);
 }
 
 void CircularStrip::SetSingleColor(uint8_t index, StripColor color) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(strip_timer_);
-    colors_[index] = color;
-    led_strip_set_pixel(led_strip_, index, color.red, color.green, color.blue);
-    led_strip_refresh(led_strip_);
+    Animation animation;
+    animation.type = kAnimationStatic;
+    portENTER_CRITICAL(&pending_lock_);
+    pending_colors_[index] = color;
+    portEXIT_CRITICAL(&pending_lock_);
+    Start(animation);
 }
 
 void CircularStrip::Blink(StripColor color, int interval_ms) {
-    for (int i = 0; i < max_leds_; i++) {
-        colors_[i] = color;
-    }
-    StartStripTask(interval_ms, [this]() {
-        static bool on = true;
-        if (on) {
-            for (int i = 0; i < max_leds_; i++) {
-                led_strip_set_pixel(led_strip_, i, colors_[i].red, colors_[i].green, colors_[i].blue);
-            }
-            led_strip_refresh(led_strip_);
-        } else {
-            led_strip_clear(led_strip_);
-        }
-        on = !on;
-    });
+    Animation animation;
+    animation.type = kAnimationBlink;
+    animation.high = color;
+    animation.interval_ms = interval_ms;
+    Start(animation);
 }
 
 void CircularStrip::FadeOut(int interval_ms) {
-    StartStripTask(interval_ms, [this]() {
-        bool all_off = true;
-        for (int i = 0; i < max_leds_; i++) {
-            colors_[i].red /= 2;
-            colors_[i].green /= 2;
-            colors_[i].blue /= 2;
-            if (colors_[i].red != 0 || colors_[i].green != 0 || colors_[i].blue != 0) {
-                all_off = false;
-            }
-            led_strip_set_pixel(led_strip_, i, colors_[i].red, colors_[i].green, colors_[i].blue);
-        }
-        if (all_off) {
-            led_strip_clear(led_strip_);
-            esp_timer_stop(strip_timer_);
-        } else {
-            led_strip_refresh(led_strip_);
-        }
-    });
+    Animation animation;
+    animation.type = kAnimationFadeOut;
+    animation.interval_ms = interval_ms;
+    Start(animation);
 }
 
+// interval_ms is the time of each keyframe
 void CircularStrip::Breathe(StripColor low, StripColor high, int interval_ms) {
-    StartStripTask(interval_ms, [this, low, high]() {
-        static bool increase = true;
-        static StripColor color = low;
-        if (increase) {
-            if (color.red < high.red) {
-                color.red++;
-            }
-            if (color.green < high.green) {
-                color.green++;
-            }
-            if (color.blue < high.blue) {
-                color.blue++;
-            }
-            if (color.red == high.red && color.green == high.green && color.blue == high.blue) {
-                increase = false;
-            }
-        } else {
-            if (color.red > low.red) {
-                color.red--;
-            }
-            if (color.green > low.green) {
-                color.green--;
-            }
-            if (color.blue > low.blue) {
-                color.blue--;
-            }
-            if (color.red == low.red && color.green == low.green && color.blue == low.blue) {
-                increase = true;
-            }
-        }
-        for (int i = 0; i < max_leds_; i++) {
-            led_strip_set_pixel(led_strip_, i, color.red, color.green, color.blue);
-        }
-        led_strip_refresh(led_strip_);
-    });
+    Animation animation;
+    animation.type = kAnimationBreathe;
+    animation.low = low;
+    animation.high = high;
+    animation.interval_ms = interval_ms;
+    Start(animation);
 }
 
 void CircularStrip::Scroll(StripColor low, StripColor high, int length, int interval_ms) {
-    for (int i = 0; i < max_leds_; i++) {
-        colors_[i] = low;
+    Animation animation;
+    animation.type = kAnimationScroll;
+    animation.low = low;
+    animation.high = high;
+    animation.length = length;
+    animation.interval_ms = interval_ms;
+    Start(animation);
+}
+
+void CircularStrip::Start(const Animation& animation) {
+    if (led_strip_ == nullptr) {
+        return;
     }
-    StartStripTask(interval_ms, [this, low, high, length]() {
-        static int offset = 0;
-        for (int i = 0; i < max_leds_; i++) {
-            colors_[i] = low;
-        }
-        for (int j = 0; j < length; j++) {
-            int i = (offset + j) % max_leds_;
-            colors_[i] = high;
+
+    portENTER_CRITICAL(&pending_lock_);
+    pending_ = animation;
+    has_pending_ = true;
+    portEXIT_CRITICAL(&pending_lock_);
+
+    // 由定时器取走新的动画，调用者不等待刷新
+    esp_timer_stop(strip_timer_);
+    esp_timer_start_once(strip_timer_, 0);
+}
+
+void CircularStrip::OnTimer() {
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&pending_lock_);
+    bool changed = has_pending_;
+    if (changed) {
+        animation_ = pending_;
+        // Same size, copies without allocating
+        static_colors_ = pending_colors_;
+        has_pending_ = false;
+    }
+    portEXIT_CRITICAL(&pending_lock_);
+
+    if (changed) {
+        start_time_us_ = now;
+        from_ = shown_;
+        if (animation_.type == kAnimationFadeOut) {
+            crossfade_ms_ = animation_.interval_ms * STRIP_FADE_OUT_STEPS;
+        } else {
+            crossfade_ms_ = STRIP_CROSSFADE_MS;
         }
+    }
+
+    int64_t elapsed_ms = (now - start_time_us_) / 1000;
+    RenderFrame(elapsed_ms);
+
+    bool fading = elapsed_ms < crossfade_ms_;
+    if (fading) {
+        int alpha = elapsed_ms * 255 / crossfade_ms_;
         for (int i = 0; i < max_leds_; i++) {
-            led_strip_set_pixel(led_strip_, i, colors_[i].red, colors_[i].green, colors_[i].blue);
+            frame_[i] = Mix(from_[i], frame_[i], alpha);
+        }
+    }
+
+    bool dirty = false;
+    for (int i = 0; i < max_leds_; i++) {
+        if (frame_[i] != shown_[i]) {
+            shown_[i] = frame_[i];
+            led_strip_set_pixel(led_strip_, i, frame_[i].red, frame_[i].green, frame_[i].blue);
+            dirty = true;
         }
+    }
+    if (dirty) {
         led_strip_refresh(led_strip_);
-        offset = (offset + 1) % max_leds_;
-    });
-}
+    }
 
-void CircularStrip::StartStripTask(int interval_ms, std::function<void()> cb) {
-    if (led_strip_ == nullptr) {
-        return;
+    // 静态画面渐变结束后定时器停止
+    int64_t next_ms = -1;
+    bool animated = animation_.type == kAnimationBlink || animation_.type == kAnimationBreathe ||
+        animation_.type == kAnimationScroll;
+    if (animated && animation_.interval_ms > 0) {
+        next_ms = animation_.interval_ms - elapsed_ms % animation_.interval_ms;
+    }
+    if (fading && (next_ms < 0 || next_ms > STRIP_FRAME_MS)) {
+        next_ms = STRIP_FRAME_MS;
     }
+    if (next_ms >= 0) {
+        esp_timer_start_once(strip_timer_, next_ms * 1000);
+    }
+}
 
-    std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(strip_timer_);
-    
-    strip_callback_ = cb;
-    esp_timer_start_periodic(strip_timer_, interval_ms * 1000);
+// Target frame of the current animation, without the crossfade
+void CircularStrip::RenderFrame(int64_t elapsed_ms) {
+    int64_t step = animation_.interval_ms > 0 ? elapsed_ms / animation_.interval_ms : 0;
+    switch (animation_.type) {
+        case kAnimationStatic:
+            for (int i = 0; i < max_leds_; i++) {
+                frame_[i] = static_colors_[i];
+            }
+            break;
+        case kAnimationBlink: {
+            StripColor color = (step % 2 == 0) ? animation_.high : StripColor();
+            for (int i = 0; i < max_leds_; i++) {
+                frame_[i] = color;
+            }
+            break;
+        }
+        case kAnimationBreathe: {
+            StripColor color = Mix(animation_.low, animation_.high, breathe_curve[step % STRIP_BREATHE_KEYFRAMES]);
+            for (int i = 0; i < max_leds_; i++) {
+                frame_[i] = color;
+            }
+            break;
+        }
+        case kAnimationScroll: {
+            int offset = step % max_leds_;
+            for (int i = 0; i < max_leds_; i++) {
+                frame_[i] = animation_.low;
+            }
+            for (int j = 0; j < animation_.length; j++) {
+                frame_[(offset + j) % max_leds_] = animation_.high;
+            }
+            break;
+        }
+        case kAnimationFadeOut:
+            for (int i = 0; i < max_leds_; i++) {
+                frame_[i] = StripColor();
+            }
+            break;
+    }
 }
 
 void CircularStrip::SetBrightness(uint8_t default_brightness, uint8_t low_brightness) {
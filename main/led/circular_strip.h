@@ -5,17 +5,35 @@
 #include <driver/gpio.h>
 #include <led_strip.h>
 #include <esp_timer.h>
-#include <atomic>
-#include <mutex>
+#include <freertos/FreeRTOS.h>
 #include <vector>
 
 #define DEFAULT_BRIGHTNESS 32
 #define LOW_BRIGHTNESS 4
 
+// 切换动画时从当前画面渐变到新动画的时间
+#define STRIP_CROSSFADE_MS 200
+// 渐变期间的刷新间隔
+#define STRIP_FRAME_MS 20
+// 呼吸灯一个周期的关键帧数
+#define STRIP_BREATHE_KEYFRAMES 64
+// 灯珠数量达到这个值才使用 RMT DMA
+#define STRIP_DMA_MIN_LEDS 16
+// 熄灭动画的时长是刷新间隔的这么多倍
+#define STRIP_FADE_OUT_STEPS 8
+
 struct StripColor {
     uint8_t red = 0, green = 0, blue = 0;
 };
 
+/*
+ * Animations are plain descriptions: a caller only copies one into a pending
+ * slot under a spinlock and kicks the strip timer, it never waits for a
+ * frame to be rendered. Frames are computed on the timer from the elapsed
+ * time and precomputed keyframe tables, so changing the animation does not
+ * allocate, and the first STRIP_CROSSFADE_MS of a new animation are blended
+ * with whatever the strip showed before.
+ */
 class CircularStrip : public Led {
 public:
     CircularStrip(gpio_num_t gpio, uint8_t max_leds);
@@ -30,21 +48,47 @@ public:
     void Scroll(StripColor low, StripColor high, int length, int interval_ms);
 
 private:
-    std::mutex mutex_;
-    TaskHandle_t blink_task_ = nullptr;
+    enum AnimationType {
+        kAnimationStatic,
+        kAnimationBlink,
+        kAnimationBreathe,
+        kAnimationScroll,
+        kAnimationFadeOut,
+    };
+
+    struct Animation {
+        AnimationType type = kAnimationStatic;
+        StripColor low;
+        StripColor high;
+        int length = 0;
+        int interval_ms = 0;
+    };
+
     led_strip_handle_t led_strip_ = nullptr;
     int max_leds_ = 0;
-    std::vector<StripColor> colors_;
-    int blink_counter_ = 0;
-    int blink_interval_ms_ = 0;
     esp_timer_handle_t strip_timer_ = nullptr;
-    std::function<void()> strip_callback_ = nullptr;
+
+    // Written by callers, taken by the timer
+    portMUX_TYPE pending_lock_ = portMUX_INITIALIZER_UNLOCKED;
+    Animation pending_;
+    std::vector<StripColor> pending_colors_;
+    bool has_pending_ = false;
+
+    // Owned by the timer
+    Animation animation_;
+    int64_t start_time_us_ = 0;
+    int crossfade_ms_ = 0;
+    std::vector<StripColor> static_colors_;
+    std::vector<StripColor> from_;
+    std::vector<StripColor> frame_;
+    std::vector<StripColor> shown_;
 
     uint8_t default_brightness_ = DEFAULT_BRIGHTNESS;
     uint8_t low_brightness_ = LOW_BRIGHTNESS;
 
-    void StartStripTask(int interval_ms, std::function<void()> cb);
-    void Rainbow(StripColor low, StripColor high, int interval_ms);
+    void Start(const Animation& animation);
+    void OnTimer();
+    void RenderFrame(int64_t elapsed_ms);
     void FadeOut(int interval_ms);
 };
 
@@ -1,6 +1,7 @@
 #include "gpio_led.h"
 #include "application.h"
 #include <esp_log.h>
+#include <cmath>
 
 #define TAG "GpioLed"
 
@@ -24,6 +25,9 @@
 #define LEDC_FADE_TIME    (1000)
 // GPIO_LED
 
+// 呼吸灯亮度曲线，0 到 255 再回到 0
+static uint8_t breathe_curve[GPIO_LED_BREATHE_KEYFRAMES];
+
 GpioLed::GpioLed(gpio_num_t gpio)
         : GpioLed(gpio, 0, LEDC_LS_TIMER, LEDC_LS_CH0_CHANNEL) {
 }
@@ -63,12 +67,6 @@ GpioLed::GpioLed(gpio_num_t gpio, int output_invert, ledc_timer_t timer_num, led
     // Initialize fade service.
     ledc_fade_func_install(0);
 
-    // When the callback registered by ledc_cb_degister is called, run led ->OnFadeEnd()
-    ledc_cbs_t ledc_callbacks = {
-        .fade_cb = FadeCallback
-    };
-    ledc_cb_register(ledc_channel_.speed_mode, ledc_channel_.channel, &ledc_callbacks, this);
-
     esp_timer_create_args_t blink_timer_args = {
         .callback = [](void *arg) {
             auto led = static_cast<GpioLed*>(arg);
@@ -77,15 +75,22 @@ GpioLed::GpioLed(gpio_num_t gpio, int output_invert, ledc_timer_t timer_num, led
         .arg = this,
         .dispatch_method = ESP_TIMER_TASK,
         .name = "Blink Timer",
-        .skip_unhandled_events = false,
+        .skip_unhandled_events = true,
     };
     ESP_ERROR_CHECK(esp_timer_create(&blink_timer_args, &blink_timer_));
 
+    if (breathe_curve[GPIO_LED_BREATHE_KEYFRAMES / 2] == 0) {
+        for (int i = 0; i < GPIO_LED_BREATHE_KEYFRAMES; i++) {
+            breathe_curve[i] = (1.0f - cosf(2.0f * M_PI * i / GPIO_LED_BREATHE_KEYFRAMES)) / 2.0f * 255.0f + 0.5f;
+        }
+    }
+
     ledc_initialized_ = true;
 }
 
 GpioLed::~GpioLed() {
     esp_timer_stop(blink_timer_);
+    esp_timer_delete(blink_timer_);
     if (ledc_initialized_) {
         ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
         ledc_fade_func_uninstall();
@@ -102,27 +107,17 @@ void GpioLed::SetBrightness(uint8_t brightness) {
 }
 
 void GpioLed::TurnOn() {
-    if (!ledc_initialized_) {
-        return;
-    }
-
-    std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(blink_timer_);
-    ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
-    ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, duty_);
-    ledc_update_duty(ledc_channel_.speed_mode, ledc_channel_.channel);
+    Animation animation;
+    animation.type = kAnimationStatic;
+    animation.duty = duty_;
+    Start(animation);
 }
 
 void GpioLed::TurnOff() {
-    if (!ledc_initialized_) {
-        return;
-    }
-
-    std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(blink_timer_);
-    ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
-    ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, 0);
-    ledc_update_duty(ledc_channel_.speed_mode, ledc_channel_.channel);
+    Animation animation;
+    animation.type = kAnimationStatic;
+    animation.duty = 0;
+    Start(animation);
 }
 
 void GpioLed::BlinkOnce() {
@@ -130,72 +125,89 @@ void GpioLed::BlinkOnce() {
 }
 
 void GpioLed::Blink(int times, int interval_ms) {
-    StartBlinkTask(times, interval_ms);
+    Animation animation;
+    animation.type = kAnimationBlink;
+    animation.duty = duty_;
+    animation.times = times;
+    animation.interval_ms = interval_ms;
+    Start(animation);
 }
 
 void GpioLed::StartContinuousBlink(int interval_ms) {
-    StartBlinkTask(BLINK_INFINITE, interval_ms);
+    Blink(BLINK_INFINITE, interval_ms);
 }
 
-void GpioLed::StartBlinkTask(int times, int interval_ms) {
+// 在 0 和当前亮度之间呼吸，一个周期 2 * LEDC_FADE_TIME
+void GpioLed::StartFadeTask() {
+    Animation animation;
+    animation.type = kAnimationBreathe;
+    animation.duty = duty_;
+    animation.interval_ms = 2 * LEDC_FADE_TIME / GPIO_LED_BREATHE_KEYFRAMES;
+    Start(animation);
+}
+
+void GpioLed::Start(const Animation& animation) {
     if (!ledc_initialized_) {
         return;
     }
 
-    std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(blink_timer_);
-    ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
+    portENTER_CRITICAL(&pending_lock_);
+    pending_ = animation;
+    has_pending_ = true;
+    portEXIT_CRITICAL(&pending_lock_);
 
-    blink_counter_ = times * 2;
-    blink_interval_ms_ = interval_ms;
-    esp_timer_start_periodic(blink_timer_, interval_ms * 1000);
+    // 由定时器取走新的动画，调用者不等待 LEDC
+    esp_timer_stop(blink_timer_);
+    esp_timer_start_once(blink_timer_, 0);
 }
 
-void GpioLed::OnBlinkTimer() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    blink_counter_--;
-    if (blink_counter_ & 1) {
-        ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, duty_);
-    } else {
-        ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, 0);
-
-        if (blink_counter_ == 0) {
-            esp_timer_stop(blink_timer_);
-        }
+void GpioLed::FadeTo(uint32_t duty, int time_ms) {
+    ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
+    if (time_ms <= 0) {
+        ledc_set_duty(ledc_channel_.speed_mode, ledc_channel_.channel, duty);
+        ledc_update_duty(ledc_channel_.speed_mode, ledc_channel_.channel);
+        return;
     }
-    ledc_update_duty(ledc_channel_.speed_mode, ledc_channel_.channel);
+    ledc_set_fade_with_time(ledc_channel_.speed_mode, ledc_channel_.channel, duty, time_ms);
+    ledc_fade_start(ledc_channel_.speed_mode, ledc_channel_.channel, LEDC_FADE_NO_WAIT);
 }
 
-void GpioLed::StartFadeTask() {
-    if (!ledc_initialized_) {
-        return;
+void GpioLed::OnBlinkTimer() {
+    portENTER_CRITICAL(&pending_lock_);
+    bool changed = has_pending_;
+    if (changed) {
+        animation_ = pending_;
+        has_pending_ = false;
     }
+    portEXIT_CRITICAL(&pending_lock_);
 
-    std::lock_guard<std::mutex> lock(mutex_);
-    esp_timer_stop(blink_timer_);
-    ledc_fade_stop(ledc_channel_.speed_mode, ledc_channel_.channel);
-    fade_up_ = true;
-    ledc_set_fade_with_time(ledc_channel_.speed_mode,
-                            ledc_channel_.channel, LEDC_DUTY, LEDC_FADE_TIME);
-    ledc_fade_start(ledc_channel_.speed_mode,
-                    ledc_channel_.channel, LEDC_FADE_NO_WAIT);
-}
-
-void GpioLed::OnFadeEnd() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    fade_up_ = !fade_up_;
-    ledc_set_fade_with_time(ledc_channel_.speed_mode,
-                            ledc_channel_.channel, fade_up_ ? LEDC_DUTY : 0, LEDC_FADE_TIME);
-    ledc_fade_start(ledc_channel_.speed_mode,
-                    ledc_channel_.channel, LEDC_FADE_NO_WAIT);
-}
+    if (changed) {
+        step_ = 0;
+    }
 
-bool IRAM_ATTR GpioLed::FadeCallback(const ledc_cb_param_t *param, void *user_arg) {
-    if (param->event == LEDC_FADE_END_EVT) {
-        auto led = static_cast<GpioLed*>(user_arg);
-        led->OnFadeEnd();
+    switch (animation_.type) {
+        case kAnimationStatic:
+            // 只有切换时渐变一次，之后定时器停止
+            if (changed) {
+                FadeTo(animation_.duty, GPIO_LED_CROSSFADE_MS);
+            }
+            return;
+        case kAnimationBlink:
+            // 闪烁保持清晰的开关，不渐变
+            FadeTo((step_ % 2 == 0) ? animation_.duty : 0, 0);
+            step_++;
+            if (animation_.times != BLINK_INFINITE && step_ >= animation_.times * 2) {
+                return;
+            }
+            break;
+        case kAnimationBreathe: {
+            // 从当前亮度渐变到下一个关键帧
+            step_ = (step_ + 1) % GPIO_LED_BREATHE_KEYFRAMES;
+            FadeTo(animation_.duty * breathe_curve[step_] / 255, animation_.interval_ms);
+            break;
+        }
     }
-    return true;
+    esp_timer_start_once(blink_timer_, animation_.interval_ms * 1000);
 }
 
 void GpioLed::OnStateChanged() {
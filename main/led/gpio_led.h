@@ -7,9 +7,17 @@
 #include <driver/gpio.h>
 #include <driver/ledc.h>
 #include <esp_timer.h>
-#include <atomic>
-#include <mutex>
 
+// 切换亮度时的渐变时间
+#define GPIO_LED_CROSSFADE_MS 200
+// 呼吸灯一个周期的关键帧数，关键帧之间由 LEDC 硬件渐变
+#define GPIO_LED_BREATHE_KEYFRAMES 16
+
+/*
+ * Like CircularStrip, callers only post a small animation description and
+ * kick the timer. The timer applies it with LEDC hardware fades, so no
+ * caller waits for the LED and nothing runs from the LEDC interrupt.
+ */
 class GpioLed : public Led {
  public:
     GpioLed(gpio_num_t gpio);
@@ -23,25 +31,41 @@ class GpioLed : public Led {
     void SetBrightness(uint8_t brightness);
 
  private:
-    std::mutex mutex_;
-    TaskHandle_t blink_task_ = nullptr;
+    enum AnimationType {
+        kAnimationStatic,
+        kAnimationBlink,
+        kAnimationBreathe,
+    };
+
+    struct Animation {
+        AnimationType type = kAnimationStatic;
+        uint32_t duty = 0;
+        int times = 0;
+        int interval_ms = 0;
+    };
+
     ledc_channel_config_t ledc_channel_ = {0};
     bool ledc_initialized_ = false;
     uint32_t duty_ = 0;
-    int blink_counter_ = 0;
-    int blink_interval_ms_ = 0;
     esp_timer_handle_t blink_timer_ = nullptr;
-    bool fade_up_ = true;
 
-    void StartBlinkTask(int times, int interval_ms);
+    // Written by callers, taken by the timer
+    portMUX_TYPE pending_lock_ = portMUX_INITIALIZER_UNLOCKED;
+    Animation pending_;
+    bool has_pending_ = false;
+
+    // Owned by the timer
+    Animation animation_;
+    int step_ = 0;
+
+    void Start(const Animation& animation);
     void OnBlinkTimer();
+    void FadeTo(uint32_t duty, int time_ms);
 
     void BlinkOnce();
     void Blink(int times, int interval_ms);
     void StartContinuousBlink(int interval_ms);
     void StartFadeTask();
-    void OnFadeEnd();
-    static bool IRAM_ATTR FadeCallback(const ledc_cb_param_t *param, void *user_arg);
 };
 
 #endif  // _GPIO_LED_H_
@@ -0,0 +1,249 @@
+#include "link_benchmark.h"
+#include "board.h"
+#include "system_info.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_netif.h>
+#include <ping/ping_sock.h>
+#include <cJSON.h>
+
+#include <algorithm>
+#include <memory>
+
+#define TAG "LinkBenchmark"
+
+void LinkBenchmark::Transfer::OnCall(int64_t call_us) {
+    if (call_us > max_call_us) {
+        max_call_us = call_us;
+    }
+    if (call_us > LINK_BENCHMARK_STALL_MS * 1000) {
+        stalls++;
+    }
+}
+
+cJSON* LinkBenchmark::Transfer::ToJson() const {
+    auto json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "bytes", bytes);
+    cJSON_AddNumberToObject(json, "open_ms", open_us / 1000);
+    cJSON_AddNumberToObject(json, "transfer_ms", transfer_us / 1000);
+    double kbps = transfer_us > 0 ? bytes * 8.0 * 1000.0 / transfer_us : 0;
+    cJSON_AddNumberToObject(json, "kbps", (int)kbps);
+    cJSON_AddNumberToObject(json, "stalls", stalls);
+    cJSON_AddNumberToObject(json, "max_call_ms", max_call_us / 1000);
+    return json;
+}
+
+std::string LinkBenchmark::Run(const std::string& download_url, const std::string& upload_url, int seconds, int upload_kb) {
+    auto root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "target", CONFIG_IDF_TARGET);
+    cJSON_AddItemToObject(root, "transport", GetTransportJson());
+
+    Ping(root);
+
+    std::string error;
+    if (!download_url.empty()) {
+        Transfer transfer;
+        if (Download(download_url, seconds, transfer, error)) {
+            cJSON_AddItemToObject(root, "download", transfer.ToJson());
+        } else {
+            cJSON_AddStringToObject(root, "download_error", error.c_str());
+        }
+    }
+    if (!upload_url.empty()) {
+        Transfer transfer;
+        if (Upload(upload_url, upload_kb, transfer, error)) {
+            cJSON_AddItemToObject(root, "upload", transfer.ToJson());
+        } else {
+            cJSON_AddStringToObject(root, "upload_error", error.c_str());
+        }
+    }
+
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    ESP_LOGI(TAG, "%s", json.c_str());
+    return json;
+}
+
+void LinkBenchmark::Ping(cJSON* root) {
+    esp_netif_ip_info_t ip_info = {};
+    auto netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    if (netif == nullptr || esp_netif_get_ip_info(netif, &ip_info) != ESP_OK || ip_info.gw.addr == 0) {
+        cJSON_AddStringToObject(root, "ping_error", "No Wi-Fi gateway");
+        return;
+    }
+
+    ping_rtts_ms_.clear();
+    ping_timeouts_ = 0;
+
+    esp_ping_config_t config = ESP_PING_DEFAULT_CONFIG();
+    config.count = LINK_BENCHMARK_PING_COUNT;
+    config.interval_ms = LINK_BENCHMARK_PING_INTERVAL_MS;
+    config.timeout_ms = LINK_BENCHMARK_PING_TIMEOUT_MS;
+    config.target_addr.type = IPADDR_TYPE_V4;
+    ip_2_ip4(&config.target_addr)->addr = ip_info.gw.addr;
+
+    esp_ping_callbacks_t callbacks = {};
+    callbacks.cb_args = this;
+    callbacks.on_ping_success = [](esp_ping_handle_t handle, void* args) {
+        auto this_ = static_cast<LinkBenchmark*>(args);
+        uint32_t elapsed_ms = 0;
+        esp_ping_get_profile(handle, ESP_PING_PROF_TIMEGAP, &elapsed_ms, sizeof(elapsed_ms));
+        this_->ping_rtts_ms_.push_back(elapsed_ms);
+    };
+    callbacks.on_ping_timeout = [](esp_ping_handle_t handle, void* args) {
+        static_cast<LinkBenchmark*>(args)->ping_timeouts_++;
+    };
+    callbacks.on_ping_end = [](esp_ping_handle_t handle, void* args) {
+        xSemaphoreGive(static_cast<LinkBenchmark*>(args)->ping_done_);
+    };
+
+    ping_done_ = xSemaphoreCreateBinary();
+    esp_ping_handle_t session = nullptr;
+    if (esp_ping_new_session(&config, &callbacks, &session) != ESP_OK) {
+        vSemaphoreDelete(ping_done_);
+        cJSON_AddStringToObject(root, "ping_error", "Failed to create the ping session");
+        return;
+    }
+    esp_ping_start(session);
+    // The session ends after the last echo timed out at the latest
+    int wait_ms = LINK_BENCHMARK_PING_COUNT * LINK_BENCHMARK_PING_INTERVAL_MS + LINK_BENCHMARK_PING_TIMEOUT_MS;
+    if (xSemaphoreTake(ping_done_, pdMS_TO_TICKS(wait_ms * 2)) != pdTRUE) {
+        esp_ping_stop(session);
+        xSemaphoreTake(ping_done_, pdMS_TO_TICKS(LINK_BENCHMARK_PING_TIMEOUT_MS));
+    }
+    esp_ping_delete_session(session);
+    vSemaphoreDelete(ping_done_);
+    ping_done_ = nullptr;
+
+    auto ping = cJSON_CreateObject();
+    char gateway[16];
+    snprintf(gateway, sizeof(gateway), IPSTR, IP2STR(&ip_info.gw));
+    cJSON_AddStringToObject(ping, "gateway", gateway);
+    cJSON_AddNumberToObject(ping, "sent", ping_rtts_ms_.size() + ping_timeouts_);
+    cJSON_AddNumberToObject(ping, "lost", ping_timeouts_);
+    if (!ping_rtts_ms_.empty()) {
+        auto rtts = ping_rtts_ms_;
+        std::sort(rtts.begin(), rtts.end());
+        cJSON_AddNumberToObject(ping, "min_ms", rtts.front());
+        cJSON_AddNumberToObject(ping, "p50_ms", rtts[rtts.size() / 2]);
+        cJSON_AddNumberToObject(ping, "p90_ms", rtts[rtts.size() * 9 / 10]);
+        cJSON_AddNumberToObject(ping, "max_ms", rtts.back());
+    }
+    cJSON_AddItemToObject(root, "ping", ping);
+}
+
+bool LinkBenchmark::Download(const std::string& url, int seconds, Transfer& transfer, std::string& error) {
+    std::unique_ptr<Http> http(Board::GetInstance().CreateHttp());
+    int64_t start_us = esp_timer_get_time();
+    if (!http->Open("GET", url)) {
+        error = "Failed to open the download URL";
+        return false;
+    }
+    int status_code = http->GetStatusCode();
+    if (status_code != 200) {
+        http->Close();
+        error = "Download status code " + std::to_string(status_code);
+        return false;
+    }
+    int64_t now_us = esp_timer_get_time();
+    transfer.open_us = now_us - start_us;
+
+    std::vector<char> buffer(LINK_BENCHMARK_CHUNK_SIZE);
+    int64_t transfer_start_us = now_us;
+    int64_t deadline_us = transfer_start_us + seconds * 1000000LL;
+    while (now_us < deadline_us) {
+        int64_t call_start_us = now_us;
+        int ret = http->Read(buffer.data(), buffer.size());
+        now_us = esp_timer_get_time();
+        if (ret < 0) {
+            http->Close();
+            error = "Download failed after " + std::to_string(transfer.bytes) + " bytes";
+            return false;
+        }
+        if (ret == 0) {
+            break;
+        }
+        transfer.OnCall(now_us - call_start_us);
+        transfer.bytes += ret;
+    }
+    transfer.transfer_us = now_us - transfer_start_us;
+    http->Close();
+    return true;
+}
+
+bool LinkBenchmark::Upload(const std::string& url, int upload_kb, Transfer& transfer, std::string& error) {
+    std::unique_ptr<Http> http(Board::GetInstance().CreateHttp());
+    http->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+    http->SetHeader("Content-Type", "application/octet-stream");
+    http->SetHeader("Transfer-Encoding", "chunked");
+    int64_t start_us = esp_timer_get_time();
+    if (!http->Open("POST", url)) {
+        error = "Failed to open the upload URL";
+        return false;
+    }
+    int64_t now_us = esp_timer_get_time();
+    transfer.open_us = now_us - start_us;
+
+    // Not compressible, like the JPEG of a photo
+    std::vector<char> buffer(LINK_BENCHMARK_CHUNK_SIZE);
+    uint32_t seed = (uint32_t)now_us;
+    for (auto& byte : buffer) {
+        seed = seed * 1664525 + 1013904223;
+        byte = seed >> 24;
+    }
+    int64_t transfer_start_us = now_us;
+    size_t total = (size_t)upload_kb * 1024;
+    while (transfer.bytes < total) {
+        size_t length = std::min(buffer.size(), (size_t)(total - transfer.bytes));
+        int64_t call_start_us = now_us;
+        http->Write(buffer.data(), length);
+        now_us = esp_timer_get_time();
+        transfer.OnCall(now_us - call_start_us);
+        transfer.bytes += length;
+    }
+    http->Write("", 0);
+    // The upload is done when the server answered, the last chunks may still be queued on the device
+    int status_code = http->GetStatusCode();
+    transfer.transfer_us = esp_timer_get_time() - transfer_start_us;
+    http->Close();
+    if (status_code < 200 || status_code >= 300) {
+        error = "Upload status code " + std::to_string(status_code);
+        return false;
+    }
+    return true;
+}
+
+cJSON* LinkBenchmark::GetTransportJson() {
+    auto json = cJSON_CreateObject();
+#if CONFIG_ESP_HOSTED_ENABLED
+    cJSON_AddStringToObject(json, "type", "esp_hosted");
+#if CONFIG_ESP_HOSTED_SDIO_HOST_INTERFACE
+    cJSON_AddStringToObject(json, "bus", "sdio");
+    cJSON_AddNumberToObject(json, "sdio_clock_khz", CONFIG_ESP_HOSTED_SDIO_CLOCK_FREQ_KHZ);
+    cJSON_AddNumberToObject(json, "sdio_bus_width", CONFIG_ESP_HOSTED_SDIO_BUS_WIDTH);
+    cJSON_AddNumberToObject(json, "sdio_tx_queue", CONFIG_ESP_HOSTED_SDIO_TX_Q_SIZE);
+    cJSON_AddNumberToObject(json, "sdio_rx_queue", CONFIG_ESP_HOSTED_SDIO_RX_Q_SIZE);
+#if CONFIG_ESP_HOSTED_SDIO_OPTIMIZATION_RX_STREAMING_MODE
+    cJSON_AddStringToObject(json, "sdio_rx", "streaming");
+#elif CONFIG_ESP_HOSTED_SDIO_OPTIMIZATION_RX_MAX_SIZE
+    cJSON_AddStringToObject(json, "sdio_rx", "max_size");
+#else
+    cJSON_AddStringToObject(json, "sdio_rx", "none");
+#endif
+#endif
+#if CONFIG_WIFI_RMT_AMPDU_TX_ENABLED
+    cJSON_AddNumberToObject(json, "tx_ba_window", CONFIG_WIFI_RMT_TX_BA_WIN);
+#endif
+#if CONFIG_WIFI_RMT_AMPDU_RX_ENABLED
+    cJSON_AddNumberToObject(json, "rx_ba_window", CONFIG_WIFI_RMT_RX_BA_WIN);
+#endif
+#else
+    cJSON_AddStringToObject(json, "type", "native");
+#endif
+    cJSON_AddNumberToObject(json, "tcp_wnd", CONFIG_LWIP_TCP_WND_DEFAULT);
+    cJSON_AddNumberToObject(json, "tcp_snd_buf", CONFIG_LWIP_TCP_SND_BUF_DEFAULT);
+    return json;
+}
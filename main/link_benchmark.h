@@ -0,0 +1,62 @@
+#ifndef LINK_BENCHMARK_H
+#define LINK_BENCHMARK_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct cJSON;
+
+// Round trips to the gateway, one ICMP echo every interval
+#define LINK_BENCHMARK_PING_COUNT 20
+#define LINK_BENCHMARK_PING_INTERVAL_MS 100
+#define LINK_BENCHMARK_PING_TIMEOUT_MS 1000
+// Reads and writes of this size, as the OTA download does
+#define LINK_BENCHMARK_CHUNK_SIZE 4096
+// A read or write slower than this counts as a stall of the link
+#define LINK_BENCHMARK_STALL_MS 100
+
+/*
+ * Measures the network path the way the firmware uses it, to compare boards
+ * and transport settings with numbers.
+ *
+ * On ESP32-P4 boards every packet also crosses the esp_hosted link to the
+ * ESP32-C6 (SDIO), so the same access point and server give the cost of
+ * that link against an S3 board: the gateway round trip is the link plus
+ * one hop of air, the HTTP download is what the OTA gets, and the chunked
+ * HTTP upload is what a camera photo gets. Stalls, single reads or writes
+ * slower than LINK_BENCHMARK_STALL_MS, show queues of the link running dry
+ * or full. The report carries the transport settings of the build, so runs
+ * with different sdkconfig values can be told apart.
+ */
+class LinkBenchmark {
+public:
+    // Blocks until all phases are done, returns the report as JSON. Empty URLs skip their phase
+    std::string Run(const std::string& download_url, const std::string& upload_url, int seconds, int upload_kb);
+
+private:
+    struct Transfer {
+        uint64_t bytes = 0;
+        int64_t open_us = 0;        // Connection and request until the status line
+        int64_t transfer_us = 0;
+        uint32_t stalls = 0;
+        uint32_t max_call_us = 0;
+
+        void OnCall(int64_t call_us);
+        cJSON* ToJson() const;
+    };
+
+    std::vector<uint32_t> ping_rtts_ms_;
+    uint32_t ping_timeouts_ = 0;
+    SemaphoreHandle_t ping_done_ = nullptr;
+
+    void Ping(cJSON* root);
+    bool Download(const std::string& url, int seconds, Transfer& transfer, std::string& error);
+    bool Upload(const std::string& url, int upload_kb, Transfer& transfer, std::string& error);
+    static cJSON* GetTransportJson();
+};
+
+#endif // LINK_BENCHMARK_H
@@ -7,11 +7,18 @@
 
 #include "application.h"
 #include "system_info.h"
+#include "memory_accounting.h"
+#include "json_arena.h"
 
 #define TAG "main"
 
 extern "C" void app_main(void)
 {
+    // Before anything worth accounting is allocated
+    MemoryAccounting::Initialize();
+    // Before the first cJSON tree, its nodes must be freed by the hooks that allocated them
+    JsonArena::Initialize();
+
     // Initialize the default event loop
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
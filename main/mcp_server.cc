@@ -8,19 +8,238 @@
 #include <esp_app_desc.h>
 #include <algorithm>
 #include <cstring>
-#include <esp_pthread.h>
 
 
 #include "application.h"
 #include "display.h"
 #include "board.h"
-#include "AudioRecorder.h"
-
+#include "latency_tracer.h"
+#include "system_metrics.h"
+#include "memory_accounting.h"
+#include "scene_change_detector.h"
+#include "camera_streamer.h"
+#include "codec_benchmark.h"
+#include "link_benchmark.h"
+#include "conversation_soak.h"
+#include "task_profiler.h"
+#include "settings.h"
+#include "task_topology.h"
+#include "pipeline_trace.h"
+#include "prompt_store.h"
+#include "benchmark_suite.h"
 
 #define TAG "MCP"
 
 #define DEFAULT_TOOLCALL_STACK_SIZE 6144
 
+// Arguments of the common tools
+struct VolumeArguments {
+    int volume;
+};
+
+struct MediaArguments {
+    std::string action;
+    int position_seconds;
+};
+
+struct BrightnessArguments {
+    int brightness;
+};
+
+struct ThemeArguments {
+    std::string theme;
+};
+
+struct RenderBenchmarkArguments {
+    int frames;
+};
+
+struct PhotoArguments {
+    std::string question;
+};
+
+struct CameraStreamArguments {
+    bool enabled;
+    int fps;
+};
+
+struct SceneWatchArguments {
+    bool enabled;
+    int interval;
+    int sensitivity;
+    std::string question;
+};
+
+struct WakeWordBenchmarkArguments {
+    std::string manifest;
+    int speed;
+};
+
+struct RecordingArguments {
+    std::string path;
+    int max_minutes;
+};
+
+struct LoopbackBenchmarkArguments {
+    int seconds;
+    bool flash_writes;
+};
+
+struct CodecBenchmarkArguments {
+    int frames;
+    bool save;
+};
+
+struct SpeakerArguments {
+    std::string name;
+};
+
+struct PromptArguments {
+    std::string name;
+};
+
+struct PromptUpdateArguments {
+    std::string url;
+    std::string version;
+};
+
+struct ProfileArguments {
+    std::string profile;
+};
+
+struct MetricsArguments {
+    bool delta;
+};
+
+struct TaskProfileArguments {
+    int seconds;
+};
+
+struct LinkBenchmarkArguments {
+    std::string download_url;
+    std::string upload_url;
+    int seconds;
+    int upload_kb;
+};
+
+struct ConversationSoakArguments {
+    std::string path;
+    int iterations;
+};
+
+McpTool::McpTool(const std::string& name, const std::string& description, const PropertyList& properties,
+    std::function<ReturnValue(const PropertyList&)> callback, int stack_size, int timeout_ms)
+    : name_(name), description_(description), json_(BuildJson(name, description, properties)),
+    stack_size_(stack_size), timeout_ms_(timeout_ms) {
+    // Each call gets its own copy of the list with the values filled in
+    binder_ = [properties, callback](const cJSON* tool_arguments, Invocation& invocation, std::string& error) {
+        PropertyList arguments = properties;
+        try {
+            for (auto& argument : arguments) {
+                bool found = false;
+                if (cJSON_IsObject(tool_arguments)) {
+                    auto value = cJSON_GetObjectItem(tool_arguments, argument.name().c_str());
+                    if (argument.type() == kPropertyTypeBoolean && cJSON_IsBool(value)) {
+                        argument.set_value<bool>(value->valueint == 1);
+                        found = true;
+                    } else if (argument.type() == kPropertyTypeInteger && cJSON_IsNumber(value)) {
+                        argument.set_value<int>(value->valueint);
+                        found = true;
+                    } else if (argument.type() == kPropertyTypeString && cJSON_IsString(value)) {
+                        argument.set_value<std::string>(value->valuestring);
+                        found = true;
+                    }
+                }
+
+                if (!argument.has_default_value() && !found) {
+                    error = "Missing valid argument: " + argument.name();
+                    return false;
+                }
+            }
+        } catch (const std::exception& e) {
+            error = e.what();
+            return false;
+        }
+        invocation = [callback, arguments = std::move(arguments)]() {
+            return callback(arguments);
+        };
+        return true;
+    };
+}
+
+McpTool::McpTool(const std::string& name, const std::string& description, const PropertyList& properties,
+    Binder binder, int stack_size, int timeout_ms)
+    : name_(name), description_(description), json_(BuildJson(name, description, properties)),
+    binder_(std::move(binder)), stack_size_(stack_size), timeout_ms_(timeout_ms) {
+}
+
+std::string McpTool::BuildJson(const std::string& name, const std::string& description, const PropertyList& properties) {
+    std::vector<std::string> required = properties.GetRequired();
+    
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "name", name.c_str());
+    cJSON_AddStringToObject(json, "description", description.c_str());
+    
+    cJSON *input_schema = cJSON_CreateObject();
+    cJSON_AddStringToObject(input_schema, "type", "object");
+    
+    cJSON *properties_json = cJSON_Parse(properties.to_json().c_str());
+    cJSON_AddItemToObject(input_schema, "properties", properties_json);
+    
+    if (!required.empty()) {
+        cJSON *required_array = cJSON_CreateArray();
+        for (const auto& property : required) {
+            cJSON_AddItemToArray(required_array, cJSON_CreateString(property.c_str()));
+        }
+        cJSON_AddItemToObject(input_schema, "required", required_array);
+    }
+    
+    cJSON_AddItemToObject(json, "inputSchema", input_schema);
+    
+    std::string result = PrintJson(json);
+    cJSON_Delete(json);
+    
+    return result;
+}
+
+// Escapes into the payload directly, a cJSON tree would hold the text twice more before it is printed
+static void AppendJsonString(std::string& out, const std::string& value) {
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    for (unsigned char c : value) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20) {
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xF];
+            } else {
+                out += (char)c;
+            }
+            break;
+        }
+    }
+    out += '"';
+}
+
+void McpTool::FormatResult(const ReturnValue& return_value, std::string& out) {
+    // 返回结果
+    out += "{\"content\":[{\"type\":\"text\",\"text\":";
+    if (std::holds_alternative<std::string>(return_value)) {
+        AppendJsonString(out, std::get<std::string>(return_value));
+    } else if (std::holds_alternative<bool>(return_value)) {
+        out += std::get<bool>(return_value) ? "\"true\"" : "\"false\"";
+    } else if (std::holds_alternative<int>(return_value)) {
+        out += "\"" + std::to_string(std::get<int>(return_value)) + "\"";
+    }
+    out += "}],\"isError\":false}";
+}
+
 McpServer::McpServer() {
 }
 
@@ -38,36 +257,55 @@ void McpServer::AddCommonTools() {
     auto original_tools = std::move(tools_);
     auto& board = Board::GetInstance();
 
-    AddTool("self.get_device_status",
+    AddTypedTool<McpNoArguments>("self.get_device_status",
         "Provides the real-time information of the device, including the current status of the audio speaker, screen, battery, network, etc.\n"
         "Use this tool for: \n"
         "1. Answering questions about current condition (e.g. what is the current volume of the audio speaker?)\n"
         "2. As the first step to control the device (e.g. turn up / down the volume of the audio speaker, etc.)",
-        PropertyList(),
-        [&board](const PropertyList& properties) -> ReturnValue {
+        {},
+        [&board](const McpNoArguments&) -> ReturnValue {
             return board.GetDeviceStatusJson();
         });
 
-    AddTool("self.audio_speaker.set_volume", 
+    AddTypedTool("self.audio_speaker.set_volume", 
         "Set the volume of the audio speaker. If the current volume is unknown, you must call `self.get_device_status` tool first and then call this tool.",
-        PropertyList({
-            Property("volume", kPropertyTypeInteger, 0, 100)
-        }), 
-        [&board](const PropertyList& properties) -> ReturnValue {
+        {
+            McpInteger<&VolumeArguments::volume, 0, 100>("volume")
+        },
+        [&board](const VolumeArguments& args) -> ReturnValue {
             auto codec = board.GetAudioCodec();
-            codec->SetOutputVolume(properties["volume"].value<int>());
+            codec->SetOutputVolume(args.volume);
             return true;
         });
+
+#if CONFIG_USE_MEDIA_PLAYBACK
+    AddTypedTool("self.media.control",
+        "Controls the music, podcast or other long audio the device is playing, e.g. when the user asks to "
+        "pause, continue, skip ahead or go back. Pause and resume act on the device at once, the audio "
+        "buffered so far is kept.\n"
+        "Args:\n"
+        "  action: One of pause, resume, seek, stop\n"
+        "  position_seconds: For seek, the position from the start of the stream\n"
+        "Return:\n"
+        "  The media status, including the current position in milliseconds.",
+        {
+            McpString<&MediaArguments::action>("action"),
+            McpOptionalInteger<&MediaArguments::position_seconds, 0, 0, 24 * 3600>("position_seconds")
+        },
+        [](const MediaArguments& args) -> ReturnValue {
+            return Application::GetInstance().ControlMedia(args.action, args.position_seconds * 1000);
+        });
+#endif
     
     auto backlight = board.GetBacklight();
     if (backlight) {
-        AddTool("self.screen.set_brightness",
+        AddTypedTool("self.screen.set_brightness",
             "Set the brightness of the screen.",
-            PropertyList({
-                Property("brightness", kPropertyTypeInteger, 0, 100)
-            }),
-            [backlight](const PropertyList& properties) -> ReturnValue {
-                uint8_t brightness = static_cast<uint8_t>(properties["brightness"].value<int>());
+            {
+                McpInteger<&BrightnessArguments::brightness, 0, 100>("brightness")
+            },
+            [backlight](const BrightnessArguments& args) -> ReturnValue {
+                uint8_t brightness = static_cast<uint8_t>(args.brightness);
                 backlight->SetBrightness(brightness, true);
                 return true;
             });
@@ -75,112 +313,434 @@ void McpServer::AddCommonTools() {
 
     auto display = board.GetDisplay();
     if (display && !display->GetTheme().empty()) {
-        AddTool("self.screen.set_theme",
+        AddTypedTool("self.screen.set_theme",
             "Set the theme of the screen. The theme can be `light` or `dark`.",
-            PropertyList({
-                Property("theme", kPropertyTypeString)
-            }),
-            [display](const PropertyList& properties) -> ReturnValue {
-                display->SetTheme(properties["theme"].value<std::string>().c_str());
+            {
+                McpString<&ThemeArguments::theme>("theme")
+            },
+            [display](const ThemeArguments& args) -> ReturnValue {
+                display->SetTheme(args.theme);
                 return true;
             });
     }
 
+#if CONFIG_USE_DISPLAY_BENCHMARK
+    if (display) {
+        AddTypedTool("self.screen.run_render_benchmark",
+            "Diagnostics only. Runs a fixed set of scenes (full screen fill, chat scroll, emoji, preview image) "
+            "and returns the FPS, frame and flush times, bus stalls and CPU load of each for this board. "
+            "Use this tool only when the user asks for it.\n"
+            "Args:\n"
+            "  frames: How many frames to time in each scene",
+            {
+                McpOptionalInteger<&RenderBenchmarkArguments::frames, 30, 1, 300>("frames")
+            },
+            [display](const RenderBenchmarkArguments& args) -> ReturnValue {
+                return display->RunRenderBenchmark(args.frames);
+            }, 0, 180 * 1000);
+    }
+#endif
+
     auto camera = board.GetCamera();
     if (camera) {
-        AddTool("self.camera.take_photo",
+        AddTypedTool("self.camera.take_photo",
             "Take a photo and explain it. Use this tool after the user asks you to see something.\n"
             "Args:\n"
             "  `question`: The question that you want to ask about the photo.\n"
             "Return:\n"
             "  A JSON object that provides the photo information.",
-            PropertyList({
-                Property("question", kPropertyTypeString)
-            }),
-            [camera](const PropertyList& properties) -> ReturnValue {
+            {
+                McpString<&PhotoArguments::question>("question")
+            },
+            [camera](const PhotoArguments& args) -> ReturnValue {
                 if (!camera->Capture()) {
                     return "{\"success\": false, \"message\": \"Failed to capture photo\"}";
                 }
-                auto question = properties["question"].value<std::string>();
-                return camera->Explain(question);
+                return camera->Explain(args.question);
+            }, 0, 60 * 1000);
+
+        auto detector = std::make_shared<SceneChangeDetector>(camera);
+        AddTypedTool("self.camera.watch_scene",
+            "Watch the camera and explain the scene only when it changes, for monitoring. While enabled the device "
+            "compares low resolution frames every `interval` seconds and, when at least `sensitivity` percent of "
+            "the picture changed, takes a photo, asks `question` about it and sends the answer in a "
+            "notifications/scene_changed message. Nothing is uploaded while the scene stays the same.\n"
+            "Args:\n"
+            "  `enabled`: Start or stop watching\n"
+            "  `interval`: Seconds between checks\n"
+            "  `sensitivity`: Percentage of the picture that must change\n"
+            "  `question`: What to ask about the changed scene\n"
+            "Return:\n"
+            "  The watcher state and how many checks and uploads it made.",
+            {
+                McpBoolean<&SceneWatchArguments::enabled>("enabled"),
+                McpOptionalInteger<&SceneWatchArguments::interval, 5, 1, 3600>("interval"),
+                McpOptionalInteger<&SceneWatchArguments::sensitivity, 10, 1, 100>("sensitivity"),
+                McpOptionalString<&SceneWatchArguments::question>("question", "What changed in the scene?")
+            },
+            [detector](const SceneWatchArguments& args) -> ReturnValue {
+                if (args.enabled) {
+                    detector->Start(args.interval, args.sensitivity, args.question);
+                } else {
+                    detector->Stop();
+                }
+                return detector->GetStatusJson();
+            });
+
+#if CONFIG_USE_CAMERA_STREAMING
+        auto streamer = std::make_shared<CameraStreamer>(camera);
+        AddTypedTool("self.camera.stream",
+            "Stream low frame rate video from the camera to the server while the conversation is open, so you can "
+            "follow what happens in front of the device. Frames are only sent if the server accepts video.\n"
+            "Args:\n"
+            "  `enabled`: Start or stop streaming\n"
+            "  `fps`: Frames per second\n"
+            "Return:\n"
+            "  The stream state and how many frames were sent and dropped.",
+            {
+                McpBoolean<&CameraStreamArguments::enabled>("enabled"),
+                McpOptionalInteger<&CameraStreamArguments::fps, 1, 1, CAMERA_STREAM_MAX_FPS>("fps")
+            },
+            [streamer](const CameraStreamArguments& args) -> ReturnValue {
+                if (args.enabled) {
+                    streamer->Start(args.fps);
+                } else {
+                    streamer->Stop();
+                }
+                return streamer->GetStatusJson();
             });
+#endif
     }
 
-    // Restore the original tools list to the end of the tools list
-    tools_.insert(tools_.end(), original_tools.begin(), original_tools.end());
-}
+    AddTypedTool<McpNoArguments>("self.audio.get_latency_stats",
+        "Diagnostics only. Provides the latency of each audio pipeline stage over the last frames, "
+        "and as response the time from the end of the user's speech to the first audio of the reply, "
+        "as p50 / p99 / max in microseconds. Use this tool only when the user asks about audio delay.",
+        {},
+        [](const McpNoArguments&) -> ReturnValue {
+            auto& tracer = LatencyTracer::GetInstance();
+            tracer.LogReport();
+            return tracer.GetReportJson();
+        });
+
+    AddTypedTool("self.system.get_metrics",
+        "Diagnostics only. Provides device health: CPU usage and free stack of each task, free and minimum "
+        "free SRAM and PSRAM, heap usage per subsystem if enabled, audio queue depths, downlink packet loss, I2C bus utilization, audio stage latencies, modem AT round trips and, if enabled, late audio frames with what ran around them. "
+        "Use this tool only when the user or the operator asks about device performance.\n"
+        "Args:\n"
+        "  delta: If true, CPU usage and counters cover the time since the previous delta query instead of "
+        "a one second window and the time since boot",
+        {
+            McpOptionalBoolean<&MetricsArguments::delta, false>("delta")
+        },
+        [](const MetricsArguments& args) -> ReturnValue {
+            return SystemMetrics::GetInstance().GetReportJson(args.delta);
+        });
 
-    // 假设 audio_recorder 是一个成员变量或以其他方式在调用之间保持活动状态
-    auto audio_recorder = board.GetAudioRecorder();
+#if CONFIG_USE_TASK_PROFILER
+    AddTypedTool("self.system.get_task_profile",
+        "Diagnostics only. Provides the CPU usage of each task now, on average and at its peak over the last "
+        "seconds, when the peak was, the free stack of each task and the lowest free heap of the window. "
+        "Use this tool only when the user or the operator asks why the device was slow or stuttered.\n"
+        "Args:\n"
+        "  seconds: Window to summarize",
+        {
+            McpOptionalInteger<&TaskProfileArguments::seconds, 60, 1, 600>("seconds")
+        },
+        [](const TaskProfileArguments& args) -> ReturnValue {
+            std::string json(TASK_PROFILER_REPORT_SIZE, '\0');
+            json.resize(TaskProfiler::GetInstance().FormatReport(json.data(), json.size(), args.seconds));
+            return json;
+        });
+#endif
+
+#if CONFIG_USE_BENCHMARK_SUITE
+    AddTypedTool<McpNoArguments>("self.system.run_benchmark_suite",
+        "Diagnostics only. Runs every benchmark built into this firmware one after the other (codec I/O, Opus, "
+        "display FPS, network throughput) and returns one report with the audio processing load, the boot "
+        "phases and the free memory, to compare this board with others. Takes about a minute, the device "
+        "must be idle. Use this tool only when the user asks for it.",
+        {},
+        [](const McpNoArguments&) -> ReturnValue {
+            return BenchmarkSuite::GetInstance().Run();
+        }, 0, 10 * 60 * 1000);
+#endif
 
+#if CONFIG_USE_WAKE_WORD_BENCHMARK
+    AddTypedTool("self.audio.run_wake_word_benchmark",
+        "Diagnostics only. Replays a labeled audio corpus from the SD card through the wake word detector "
+        "and returns false accept / reject rates, detection latency and feed cost. Takes as long as the "
+        "corpus divided by speed, the device must be idle. Use this tool only when the user asks for it.\n"
+        "Args:\n"
+        "  manifest: Path of the corpus manifest, e.g. /sdcard/kws/manifest.txt\n"
+        "  speed: Times realtime, 0 feeds as fast as possible",
+        {
+            McpString<&WakeWordBenchmarkArguments::manifest>("manifest"),
+            McpOptionalInteger<&WakeWordBenchmarkArguments::speed, 1, 0, 32>("speed")
+        },
+        [](const WakeWordBenchmarkArguments& args) -> ReturnValue {
+            return Application::GetInstance().RunWakeWordBenchmark(args.manifest, args.speed);
+        }, 0, 30 * 60 * 1000);
+#endif
+
+#if CONFIG_USE_AUDIO_RECORDER
+    auto audio_recorder = Application::GetInstance().GetAudioRecorder();
     if (audio_recorder) {
-        // 工具一：开始录音
-        AddTool("self.audio.start_recording",
-                "Starts recording audio, which will continue until 'stop_recording' is called.\n"
-                "This is non-blocking and returns immediately.\n"
-                "Args:\n"
-                "  filename: The filename to save on the SD card when recording stops (e.g. 'record.wav').\n"
-                "Return:\n"
-                "  A JSON object indicating whether the recording has started successfully.",
-                PropertyList({
-                    Property("filename", kPropertyTypeString)
-                }),
-                [audio_recorder](const PropertyList& properties) -> ReturnValue {
-                    std::string filename = properties["filename"].value<std::string>();
-
-                    // 调用底层的 StartRecording 方法
-                    // 我们假设这个方法现在是非阻塞的，并且如果已经在录音，它会返回 false
-                    if (!audio_recorder->StartRecording(filename)) {
-                        return "{\"success\": false, \"message\": \"Failed to start recording. Maybe a recording is already in progress or the filename is invalid.\"}";
-                    }
+        AddTypedTool("self.audio.start_recording",
+            "Starts recording the microphone to the SD card, e.g. for a meeting. Recording continues while the "
+            "device is used normally, until stop_recording is called. The audio is saved as Opus in files of "
+            "5 minutes named <path>_000.p3, <path>_001.p3, ...\n"
+            "Args:\n"
+            "  path: Path without extension, e.g. /sdcard/meeting\n"
+            "  max_minutes: Keep only the last this many minutes and delete older files, 0 keeps everything\n"
+            "Return:\n"
+            "  The recorder state.",
+            {
+                McpString<&RecordingArguments::path>("path"),
+                McpOptionalInteger<&RecordingArguments::max_minutes, 0, 0, 24 * 60>("max_minutes")
+            },
+            [audio_recorder](const RecordingArguments& args) -> ReturnValue {
+                int segment_minutes = AUDIO_RECORDER_SEGMENT_SECONDS / 60;
+                int max_segments = (args.max_minutes + segment_minutes - 1) / segment_minutes;
+                if (!audio_recorder->Start(args.path, max_segments)) {
+                    return "{\"success\": false, \"message\": \"Failed to start recording, a recording may already be in progress\"}";
+                }
+                return audio_recorder->GetStatusJson();
+            });
 
-                    return "{\"success\": true, \"message\": \"Recording started. Call stop_recording to save the file.\"}";
-                });
-
-        // 工具二：停止录音
-        AddTool("self.audio.stop_recording",
-                "Stops the current audio recording and saves it to the SD card.\n"
-                "Args: None.\n"
-                "Return:\n"
-                "  A JSON object that provides the recording status and file information.",
-                PropertyList({}), // 无参数
-                [audio_recorder](const PropertyList& properties) -> ReturnValue {
-                    // 调用底层的 StopRecording 方法
-                    // 假设这个方法会停止录音、将数据写入文件并返回一个包含文件信息的结构体或bool值
-                    // 为了简化，我们先假设它返回 bool
-                    if (!audio_recorder->StopRecording()) {
-                        return "{\"success\": false, \"message\": \"Failed to stop recording. Maybe no recording was active.\"}";
-                    }
+        AddTypedTool<McpNoArguments>("self.audio.stop_recording",
+            "Stops the current recording and saves the rest of it to the SD card.\n"
+            "Return:\n"
+            "  The files, duration and any frames lost while the card was busy.",
+            {},
+            [audio_recorder](const McpNoArguments&) -> ReturnValue {
+                if (!audio_recorder->Stop()) {
+                    return "{\"success\": false, \"message\": \"No recording is in progress\"}";
+                }
+                return audio_recorder->GetStatusJson();
+            });
+    }
+#endif
+
+#if CONFIG_USE_AUDIO_LOOPBACK_BENCHMARK
+    AddTypedTool("self.audio.run_loopback_benchmark",
+        "Diagnostics only. Measures the audio hardware: real input and output sample rates, DMA overflows "
+        "and underruns, read and write call times, and the speaker to microphone round trip from a chirp "
+        "played a few times. Takes the given seconds plus about two more, the device must be idle. "
+        "Use this tool only when the user asks for it.\n"
+        "Args:\n"
+        "  seconds: How long to measure the throughput\n"
+        "  flash_writes: Write settings to flash meanwhile, to see if audio survives them",
+        {
+            McpOptionalInteger<&LoopbackBenchmarkArguments::seconds, 5, 1, 60>("seconds"),
+            McpOptionalBoolean<&LoopbackBenchmarkArguments::flash_writes, false>("flash_writes")
+        },
+        [](const LoopbackBenchmarkArguments& args) -> ReturnValue {
+            return Application::GetInstance().RunAudioLoopbackBenchmark(args.seconds, args.flash_writes);
+        }, 0, 90 * 1000);
+#endif
+
+#if CONFIG_USE_CODEC_BENCHMARK
+    AddTypedTool("self.audio.run_codec_benchmark",
+        "Diagnostics only. Times Opus encoding over complexity, bitrate and frame duration, Opus decoding and "
+        "resampling on this chip, and recommends the highest uplink complexity it can afford. Takes up to a few "
+        "minutes, the device must be idle. Use this tool only when the user asks for it.\n"
+        "Args:\n"
+        "  frames: Frames timed per case\n"
+        "  save: Use the recommended complexity for the uplink from now on",
+        {
+            McpOptionalInteger<&CodecBenchmarkArguments::frames, 50, 10, 500>("frames"),
+            McpOptionalBoolean<&CodecBenchmarkArguments::save, false>("save")
+        },
+        [](const CodecBenchmarkArguments& args) -> ReturnValue {
+            if (Application::GetInstance().GetDeviceState() != kDeviceStateIdle) {
+                return "{\"error\":\"The device must be idle\"}";
+            }
+            CodecBenchmark benchmark;
+            auto report = benchmark.Run(args.frames);
+            if (args.save && benchmark.recommended_complexity() >= 0) {
+                // Read by Application when it configures the uplink encoder
+                Settings settings("audio", true);
+                settings.SetInt("opus_complexity", benchmark.recommended_complexity());
+            }
+            return report;
+        }, 0, 10 * 60 * 1000);
+#endif
+
+#if CONFIG_USE_LINK_BENCHMARK
+    AddTypedTool("self.network.run_link_benchmark",
+        "Diagnostics only. Measures the network link of the device: round trips to the Wi-Fi gateway, the "
+        "throughput of an HTTP download as the firmware upgrade reads it and of a chunked HTTP upload as a photo "
+        "is sent, with the number of stalls, and the transport settings of the build. The device must be idle. "
+        "Use this tool only when the user or the operator asks for it.\n"
+        "Args:\n"
+        "  download_url: File to download, e.g. the firmware URL, empty skips the download\n"
+        "  upload_url: URL that accepts a POST of random bytes, empty skips the upload\n"
+        "  seconds: Longest download time\n"
+        "  upload_kb: Kilobytes to upload",
+        {
+            McpOptionalString<&LinkBenchmarkArguments::download_url>("download_url", ""),
+            McpOptionalString<&LinkBenchmarkArguments::upload_url>("upload_url", ""),
+            McpOptionalInteger<&LinkBenchmarkArguments::seconds, 10, 1, 60>("seconds"),
+            McpOptionalInteger<&LinkBenchmarkArguments::upload_kb, 512, 16, 8192>("upload_kb")
+        },
+        [](const LinkBenchmarkArguments& args) -> ReturnValue {
+            if (Application::GetInstance().GetDeviceState() != kDeviceStateIdle) {
+                return "{\"error\":\"The device must be idle\"}";
+            }
+            LinkBenchmark benchmark;
+            return benchmark.Run(args.download_url, args.upload_url, args.seconds, args.upload_kb);
+        }, 0, 5 * 60 * 1000);
+#endif
 
-                    // 理想情况下，StopRecording() 会返回最终的文件名和时长
-                    // 这里我们先做一个简化实现
-                    // std::string final_filename = audio_recorder->GetLastFilename();
-                    // float duration_sec = audio_recorder->GetLastDuration();
-                    return "{\"success\": true, \"message\": \"Recording stopped and file saved.\"}";
-                    /* * 更完善的返回可以是:
-                    * return "{\"success\": true, "
-                    * "\"file\": \"" + final_filename + "\", "
-                    * "\"duration\": " + std::to_string(duration_sec) + "}";
-                    */
-                });
+#if CONFIG_USE_CONVERSATION_SOAK
+    AddTypedTool("self.system.run_conversation_soak",
+        "Diagnostics only. Starts a soak test in the background: the device plays a recorded utterance that "
+        "starts with the wake word into its own microphone input and goes through full conversations by itself, "
+        "timing every phase and sampling the free memory between them. The current conversation is closed "
+        "first, the microphone is replaced until the run ends. Use this tool only when the operator asks for it.\n"
+        "Args:\n"
+        "  path: 16 kHz mono WAV file on the SD card, e.g. /sdcard/soak/hello.wav\n"
+        "  iterations: Conversations to run, 0 stops a run in progress",
+        {
+            McpString<&ConversationSoakArguments::path>("path"),
+            McpOptionalInteger<&ConversationSoakArguments::iterations, 100, 0, 100000>("iterations")
+        },
+        [](const ConversationSoakArguments& args) -> ReturnValue {
+            auto& soak = ConversationSoak::GetInstance();
+            if (args.iterations == 0) {
+                soak.Stop();
+                return soak.GetReportJson();
+            }
+            std::string error;
+            if (!soak.Start(args.path, args.iterations, error)) {
+                throw std::runtime_error(error);
+            }
+            return true;
+        });
+
+    AddTypedTool("self.system.get_conversation_soak_report",
+        "Diagnostics only. Provides the progress of the conversation soak test: completed iterations, failures "
+        "per kind, p50 / p90 / max of each phase with the mean of the first and the last iterations to show "
+        "drift, and the free memory before the first and the last iteration to show leaks.",
+        {},
+        [](const McpNoArguments&) -> ReturnValue {
+            return ConversationSoak::GetInstance().GetReportJson();
+        });
+#endif
+
+#if CONFIG_USE_SPEAKER_ID
+    AddTypedTool("self.speaker.enroll",
+        "Remember the voice of the user in this conversation, taken from the wake word they started it with. "
+        "Enrolling the same name again refines the profile. Use this tool only when the user asks the device "
+        "to remember or recognize their voice.\n"
+        "Args:\n"
+        "  name: How the user wants to be called",
+        {
+            McpString<&SpeakerArguments::name>("name")
+        },
+        [](const SpeakerArguments& args) -> ReturnValue {
+            return Application::GetInstance().EnrollSpeaker(args.name);
+        });
+
+    AddTypedTool<McpNoArguments>("self.speaker.list",
+        "Lists the speakers whose voices the device recognizes.",
+        {},
+        [](const McpNoArguments&) -> ReturnValue {
+            return Application::GetInstance().GetSpeakerProfiles().GetJson();
+        });
+
+    AddTypedTool("self.speaker.remove",
+        "Forget the voice of an enrolled speaker.",
+        {
+            McpString<&SpeakerArguments::name>("name")
+        },
+        [](const SpeakerArguments& args) -> ReturnValue {
+            return Application::GetInstance().GetSpeakerProfiles().Remove(args.name);
+        });
+#endif
+
+#if CONFIG_USE_PROMPT_STORE
+    AddTypedTool("self.audio.play_prompt",
+        "Plays a custom prompt stored on the device, such as a greeting or a notification chime, by name. "
+        "It plays from flash at once, prefer it to speaking the same content.\n"
+        "Args:\n"
+        "  name: One of the names listed by self.audio.list_prompts",
+        {
+            McpString<&PromptArguments::name>("name")
+        },
+        [](const PromptArguments& args) -> ReturnValue {
+            return Application::GetInstance().PlayPrompt(args.name);
+        });
+
+    AddTypedTool<McpNoArguments>("self.audio.list_prompts",
+        "Lists the custom prompts stored on the device and the version of the set.",
+        {},
+        [](const McpNoArguments&) -> ReturnValue {
+            return PromptStore::GetInstance().GetJson();
+        });
+
+    AddTypedTool("self.audio.update_prompts",
+        "Replaces all the custom prompts stored on the device with a sound pack image made by "
+        "scripts/gen_sound_partition.py --dir. Use this tool only when the server asks for it.\n"
+        "Args:\n"
+        "  url: Where to download the image\n"
+        "  version: Recorded with the prompts, the version check skips a version already stored",
+        {
+            McpString<&PromptUpdateArguments::url>("url"),
+            McpString<&PromptUpdateArguments::version>("version")
+        },
+        [](const PromptUpdateArguments& args) -> ReturnValue {
+            return Application::GetInstance().UpdatePrompts(args.url, args.version);
+        }, 0, 120 * 1000);
+#endif
+
+    auto audio_processor = Application::GetInstance().GetAudioProcessor();
+    if (audio_processor->GetProfilesJson() != "[]") {
+        AddTypedTool<McpNoArguments>("self.audio.get_processing_profiles",
+            "Diagnostics only. Lists the audio processing profiles, which one is active, and the memory and CPU "
+            "each has been measured to use (cpu_percent is -1 if it was not measured yet).",
+            {},
+            [audio_processor](const McpNoArguments&) -> ReturnValue {
+                return audio_processor->GetProfilesJson();
+            });
+
+        AddTypedTool("self.audio.set_processing_profile",
+            "Switch the audio processing profile, the choice is kept across reboots. "
+            "`eco` uses less CPU and memory, `quality` suppresses noise and echo better.",
+            {
+                McpString<&ProfileArguments::profile>("profile")
+            },
+            [audio_processor](const ProfileArguments& args) -> ReturnValue {
+                return audio_processor->SetProfile(args.profile);
+            });
     }
 
+    // Restore the original tools list to the end of the tools list
+    tools_.insert(tools_.end(), original_tools.begin(), original_tools.end());
+    tools_list_pages_.clear();
+}
+
 void McpServer::AddTool(McpTool* tool) {
     // Prevent adding duplicate tools
-    if (std::find_if(tools_.begin(), tools_.end(), [tool](const McpTool* t) { return t->name() == tool->name(); }) != tools_.end()) {
+    if (tool_index_.find(tool->name()) != tool_index_.end()) {
         ESP_LOGW(TAG, "Tool %s already added", tool->name().c_str());
         return;
     }
 
     ESP_LOGI(TAG, "Add tool: %s", tool->name().c_str());
     tools_.push_back(tool);
+    tool_index_[tool->name()] = tool;
+    tools_list_pages_.clear();
 }
 
-void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
-    AddTool(new McpTool(name, description, properties, callback));
+void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback,
+    int stack_size, int timeout_ms) {
+    AddTool(new McpTool(name, description, properties, callback, stack_size, timeout_ms));
 }
 
 void McpServer::ParseMessage(const std::string& message) {
+    MemoryTagScope tag(kMemoryTagMcp);
     cJSON* json = cJSON_Parse(message.c_str());
     if (json == nullptr) {
         ESP_LOGE(TAG, "Failed to parse MCP message: %s", message.c_str());
@@ -209,7 +769,51 @@ void McpServer::ParseCapabilities(const cJSON* capabilities) {
     }
 }
 
+// Whether ParseMessage answers the message, notifications and malformed messages get no response
+static bool IsRequest(const cJSON* json) {
+    auto version = cJSON_GetObjectItem(json, "jsonrpc");
+    auto method = cJSON_GetObjectItem(json, "method");
+    auto id = cJSON_GetObjectItem(json, "id");
+    return cJSON_IsString(version) && strcmp(version->valuestring, "2.0") == 0 &&
+        cJSON_IsString(method) && strncmp(method->valuestring, "notifications", 13) != 0 &&
+        cJSON_IsNumber(id);
+}
+
+// The responses are collected and sent as one array once every request of the batch is answered,
+// tools/call requests in it still run on the workers side by side
+void McpServer::ParseBatch(const cJSON* json) {
+    auto batch = std::make_shared<Batch>();
+    cJSON* item;
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex_);
+        cJSON_ArrayForEach(item, json) {
+            if (!IsRequest(item)) {
+                continue;
+            }
+            int id = cJSON_GetObjectItem(item, "id")->valueint;
+            // A repeated id is answered on its own
+            if (batches_.emplace(id, batch).second) {
+                batch->pending++;
+            }
+        }
+    }
+    ESP_LOGI(TAG, "Batch of %d messages, %d requests", cJSON_GetArraySize(json), batch->pending);
+
+    cJSON_ArrayForEach(item, json) {
+        if (!cJSON_IsObject(item)) {
+            ESP_LOGE(TAG, "Invalid message in batch");
+            continue;
+        }
+        ParseMessage(item);
+    }
+}
+
 void McpServer::ParseMessage(const cJSON* json) {
+    if (cJSON_IsArray(json)) {
+        ParseBatch(json);
+        return;
+    }
+
     // Check JSONRPC version
     auto version = cJSON_GetObjectItem(json, "jsonrpc");
     if (version == nullptr || !cJSON_IsString(version) || strcmp(version->valuestring, "2.0") != 0) {
@@ -225,23 +829,32 @@ void McpServer::ParseMessage(const cJSON* json) {
     }
     
     auto method_str = std::string(method->valuestring);
-    if (method_str.find("notifications") == 0) {
+    if (method_str == "notifications/cancelled") {
+        auto params = cJSON_GetObjectItem(json, "params");
+        auto request_id = cJSON_GetObjectItem(params, "requestId");
+        if (cJSON_IsNumber(request_id)) {
+            CancelToolCall(request_id->valueint);
+        }
         return;
     }
-    
-    // Check params
-    auto params = cJSON_GetObjectItem(json, "params");
-    if (params != nullptr && !cJSON_IsObject(params)) {
-        ESP_LOGE(TAG, "Invalid params for method: %s", method_str.c_str());
+    if (method_str.find("notifications") == 0) {
         return;
     }
-
+    
     auto id = cJSON_GetObjectItem(json, "id");
     if (id == nullptr || !cJSON_IsNumber(id)) {
         ESP_LOGE(TAG, "Invalid id for method: %s", method_str.c_str());
         return;
     }
     auto id_int = id->valueint;
+
+    // Check params
+    auto params = cJSON_GetObjectItem(json, "params");
+    if (params != nullptr && !cJSON_IsObject(params)) {
+        ESP_LOGE(TAG, "Invalid params for method: %s", method_str.c_str());
+        ReplyError(id_int, "Invalid params");
+        return;
+    }
     
     if (method_str == "initialize") {
         if (cJSON_IsObject(params)) {
@@ -288,7 +901,17 @@ void McpServer::ParseMessage(const cJSON* json) {
             ReplyError(id_int, "Invalid stackSize");
             return;
         }
-        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments, stack_size ? stack_size->valueint : DEFAULT_TOOLCALL_STACK_SIZE);
+        // 带 progressToken 的调用，工具可以通过 ReportProgress 报告进度
+        std::string progress_token;
+        auto meta = cJSON_GetObjectItem(params, "_meta");
+        auto token = cJSON_IsObject(meta) ? cJSON_GetObjectItem(meta, "progressToken") : nullptr;
+        if (cJSON_IsString(token) || cJSON_IsNumber(token)) {
+            char* token_str = cJSON_PrintUnformatted(token);
+            progress_token = token_str;
+            cJSON_free(token_str);
+        }
+        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments,
+            stack_size ? stack_size->valueint : DEFAULT_TOOLCALL_STACK_SIZE, std::move(progress_token));
     } else {
         ESP_LOGE(TAG, "Method not implemented: %s", method_str.c_str());
         ReplyError(id_int, "Method not implemented: " + method_str);
@@ -300,126 +923,345 @@ void McpServer::ReplyResult(int id, const std::string& result) {
     payload += std::to_string(id) + ",\"result\":";
     payload += result;
     payload += "}";
-    Application::GetInstance().SendMcpMessage(payload);
+    SendReply(id, std::move(payload));
+}
+
+// The payload is the only copy of the result text, it is moved on to the protocol
+void McpServer::ReplyToolResult(int id, const ReturnValue& result) {
+    std::string payload;
+    if (std::holds_alternative<std::string>(result)) {
+        payload.reserve(std::get<std::string>(result).size() + 96);
+    }
+    payload += "{\"jsonrpc\":\"2.0\",\"id\":";
+    payload += std::to_string(id) + ",\"result\":";
+    McpTool::FormatResult(result, payload);
+    payload += "}";
+    SendReply(id, std::move(payload));
 }
 
 void McpServer::ReplyError(int id, const std::string& message) {
     std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
     payload += std::to_string(id);
-    payload += ",\"error\":{\"message\":\"";
-    payload += message;
-    payload += "\"}}";
-    Application::GetInstance().SendMcpMessage(payload);
+    payload += ",\"error\":{\"message\":";
+    AppendJsonString(payload, message);
+    payload += "}}";
+    SendReply(id, std::move(payload));
 }
 
-void McpServer::GetToolsList(int id, const std::string& cursor) {
-    const int max_payload_size = 8000;
-    std::string json = "{\"tools\":[";
-    
-    bool found_cursor = cursor.empty();
-    auto it = tools_.begin();
-    std::string next_cursor = "";
-    
-    while (it != tools_.end()) {
-        // 如果我们还没有找到起始位置，继续搜索
-        if (!found_cursor) {
-            if ((*it)->name() == cursor) {
-                found_cursor = true;
-            } else {
-                ++it;
-                continue;
+// Every request is settled here exactly once, an empty payload settles it without a response
+void McpServer::SendReply(int id, std::string payload) {
+    std::shared_ptr<Batch> batch;
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex_);
+        auto it = batches_.find(id);
+        if (it != batches_.end()) {
+            batch = std::move(it->second);
+            batches_.erase(it);
+            if (!payload.empty()) {
+                batch->responses += batch->responses.empty() ? '[' : ',';
+                batch->responses += payload;
+            }
+            if (--batch->pending > 0) {
+                return;
             }
         }
-        
-        // 添加tool前检查大小
-        std::string tool_json = (*it)->to_json() + ",";
-        if (json.length() + tool_json.length() + 30 > max_payload_size) {
-            // 如果添加这个tool会超出大小限制，设置next_cursor并退出循环
-            next_cursor = (*it)->name();
-            break;
+    }
+    if (batch) {
+        if (batch->responses.empty()) {
+            return;
         }
-        
-        json += tool_json;
-        ++it;
+        batch->responses += ']';
+        payload = std::move(batch->responses);
     }
-    
-    if (json.back() == ',') {
-        json.pop_back();
+    if (!payload.empty()) {
+        Application::GetInstance().SendMcpMessage(std::move(payload));
     }
-    
-    if (json.back() == '[' && !tools_.empty()) {
-        // 如果没有添加任何tool，返回错误
-        ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", next_cursor.c_str());
-        ReplyError(id, "Failed to add tool " + next_cursor + " because of payload size limit");
+}
+
+void McpServer::ReportProgress(int progress, int total, const std::string& message) {
+    std::string progress_token;
+    {
+        std::lock_guard<std::mutex> lock(tool_call_mutex_);
+        auto current = xTaskGetCurrentTaskHandle();
+        for (auto& worker : tool_workers_) {
+            if (worker->handle == current) {
+                // Nothing to report once the call is answered, or if the client did not ask for progress
+                if (worker->call && !worker->call->finished) {
+                    progress_token = worker->call->progress_token;
+                }
+                break;
+            }
+        }
+    }
+    if (progress_token.empty()) {
         return;
     }
 
-    if (next_cursor.empty()) {
-        json += "]}";
-    } else {
-        json += "],\"nextCursor\":\"" + next_cursor + "\"}";
+    std::string payload = "{\"jsonrpc\":\"2.0\",\"method\":\"notifications/progress\",\"params\":{\"progressToken\":";
+    payload += progress_token;
+    payload += ",\"progress\":" + std::to_string(progress);
+    if (total > 0) {
+        payload += ",\"total\":" + std::to_string(total);
     }
-    
-    ReplyResult(id, json);
+    if (!message.empty()) {
+        payload += ",\"message\":";
+        AppendJsonString(payload, message);
+    }
+    payload += "}}";
+    Application::GetInstance().SendMcpMessage(std::move(payload));
 }
 
-void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size) {
-    auto tool_iter = std::find_if(tools_.begin(), tools_.end(), 
-                                 [&tool_name](const McpTool* tool) { 
-                                     return tool->name() == tool_name; 
-                                 });
-    
-    if (tool_iter == tools_.end()) {
+void McpServer::GetToolsList(int id, const std::string& cursor) {
+    if (tools_list_pages_.empty()) {
+        BuildToolsListPages();
+    }
+
+    auto page = tools_list_pages_.find(cursor);
+    if (page == tools_list_pages_.end()) {
+        ESP_LOGE(TAG, "tools/list: Invalid cursor %s", cursor.c_str());
+        ReplyError(id, "Invalid cursor: " + cursor);
+        return;
+    }
+    if (page->second.empty()) {
+        ReplyError(id, "Failed to add tool " + cursor + " because of payload size limit");
+        return;
+    }
+    ReplyResult(id, page->second);
+}
+
+// Servers list the tools again on every reconnect, so the pages are serialized once and kept until a tool is added
+void McpServer::BuildToolsListPages() {
+    const int max_payload_size = 8000;
+    std::string cursor = "";
+    auto it = tools_.begin();
+
+    do {
+        std::string json = "{\"tools\":[";
+        std::string next_cursor = "";
+        while (it != tools_.end()) {
+            // 添加tool前检查大小
+            std::string tool_json = (*it)->to_json() + ",";
+            if (json.length() + tool_json.length() + 30 > max_payload_size) {
+                // 如果添加这个tool会超出大小限制，设置next_cursor并结束这一页
+                next_cursor = (*it)->name();
+                break;
+            }
+            json += tool_json;
+            ++it;
+        }
+
+        if (json.back() == ',') {
+            json.pop_back();
+        }
+
+        if (json.back() == '[' && !tools_.empty()) {
+            // 这一页一个tool都放不下，请求到这一页时返回错误
+            ESP_LOGE(TAG, "tools/list: Tool %s alone exceeds the payload size limit", next_cursor.c_str());
+            tools_list_pages_[cursor] = "";
+            break;
+        }
+
+        if (next_cursor.empty()) {
+            json += "]}";
+        } else {
+            json += "],\"nextCursor\":\"" + next_cursor + "\"}";
+        }
+        tools_list_pages_[cursor] = std::move(json);
+        cursor = next_cursor;
+    } while (!cursor.empty());
+}
+
+McpTool* McpServer::FindTool(const std::string& tool_name) {
+    auto it = tool_index_.find(tool_name);
+    return it == tool_index_.end() ? nullptr : it->second;
+}
+
+std::string McpServer::CallTool(const std::string& tool_name, const cJSON* tool_arguments) {
+    auto tool = FindTool(tool_name);
+    if (tool == nullptr) {
+        throw std::invalid_argument("Unknown tool: " + tool_name);
+    }
+    McpTool::Invocation invocation;
+    std::string error;
+    if (!tool->Bind(tool_arguments, invocation, error)) {
+        throw std::invalid_argument(error);
+    }
+    std::string result;
+    McpTool::FormatResult(invocation(), result);
+    return result;
+}
+
+void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size, std::string progress_token) {
+    auto tool = FindTool(tool_name);
+    if (tool == nullptr) {
         ESP_LOGE(TAG, "tools/call: Unknown tool: %s", tool_name.c_str());
         ReplyError(id, "Unknown tool: " + tool_name);
         return;
     }
 
-    PropertyList arguments = (*tool_iter)->properties();
-    try {
-        for (auto& argument : arguments) {
-            bool found = false;
-            if (cJSON_IsObject(tool_arguments)) {
-                auto value = cJSON_GetObjectItem(tool_arguments, argument.name().c_str());
-                if (argument.type() == kPropertyTypeBoolean && cJSON_IsBool(value)) {
-                    argument.set_value<bool>(value->valueint == 1);
-                    found = true;
-                } else if (argument.type() == kPropertyTypeInteger && cJSON_IsNumber(value)) {
-                    argument.set_value<int>(value->valueint);
-                    found = true;
-                } else if (argument.type() == kPropertyTypeString && cJSON_IsString(value)) {
-                    argument.set_value<std::string>(value->valuestring);
-                    found = true;
-                }
-            }
+    McpTool::Invocation invocation;
+    std::string error;
+    if (!tool->Bind(tool_arguments, invocation, error)) {
+        ESP_LOGE(TAG, "tools/call: %s", error.c_str());
+        ReplyError(id, error);
+        return;
+    }
 
-            if (!argument.has_default_value() && !found) {
-                ESP_LOGE(TAG, "tools/call: Missing valid argument: %s", argument.name().c_str());
-                ReplyError(id, "Missing valid argument: " + argument.name());
-                return;
-            }
+    if (tool_workers_.empty()) {
+        StartToolWorkers();
+    }
+    // The workers' stacks are allocated once, a call that needs more cannot run on them
+    if (std::max(stack_size, tool->stack_size()) > tool_stack_size_) {
+        ESP_LOGE(TAG, "tools/call: %s needs more than the %d bytes tool stack", tool_name.c_str(), tool_stack_size_);
+        ReplyError(id, "Stack size exceeds " + std::to_string(tool_stack_size_));
+        return;
+    }
+
+    auto call = std::make_shared<ToolCall>();
+    call->id = id;
+    call->tool = tool;
+    call->invocation = std::move(invocation);
+    call->progress_token = std::move(progress_token);
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(tool_call_mutex_);
+        full = tool_call_queue_.size() >= MCP_TOOL_QUEUE_DEPTH;
+        if (!full) {
+            tool_call_queue_.push_back(std::move(call));
         }
-    } catch (const std::exception& e) {
-        ESP_LOGE(TAG, "tools/call: %s", e.what());
-        ReplyError(id, e.what());
+    }
+    if (full) {
+        ESP_LOGW(TAG, "tools/call: %s refused, %d calls waiting", tool_name.c_str(), MCP_TOOL_QUEUE_DEPTH);
+        ReplyError(id, "Too many tool calls");
         return;
     }
+    tool_call_cv_.notify_one();
+}
+
+void McpServer::StartToolWorkers() {
+    // Sized once for the largest stack any tool asks for
+    auto config = TaskTopology::GetInstance().Get(kTaskToolCall);
+    tool_stack_size_ = std::max<int>(DEFAULT_TOOLCALL_STACK_SIZE, config.stack_size);
+    for (auto tool : tools_) {
+        tool_stack_size_ = std::max(tool_stack_size_, tool->stack_size());
+    }
+    config.stack_size = tool_stack_size_;
 
-    // Start a task to receive data with stack size
-    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
-    cfg.thread_name = "tool_call";
-    cfg.stack_size = stack_size;
-    cfg.prio = 1;
-    esp_pthread_set_cfg(&cfg);
+    for (int i = 0; i < MCP_TOOL_WORKERS; i++) {
+        auto worker = std::make_unique<ToolWorker>();
+        worker->owner = this;
+        esp_timer_create_args_t timer_args = {
+            .callback = [](void* arg) {
+                auto worker = static_cast<ToolWorker*>(arg);
+                worker->owner->OnToolCallTimeout(*worker);
+            },
+            .arg = worker.get(),
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "tool_call_timeout",
+            .skip_unhandled_events = true,
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &worker->timeout_timer));
 
-    // Use a thread to call the tool to avoid blocking the main thread
-    tool_call_thread_ = std::thread([this, id, tool_iter, arguments = std::move(arguments)]() {
+        char name[16];
+        snprintf(name, sizeof(name), "tool_call_%d", i);
+        TaskTopology::CreateTask(config, name, [](void* arg) {
+            auto worker = static_cast<ToolWorker*>(arg);
+            worker->owner->ToolWorkerLoop(*worker);
+        }, worker.get(), &worker->handle);
+        tool_workers_.push_back(std::move(worker));
+    }
+    ESP_LOGI(TAG, "Started %d tool workers, %d bytes stack each", MCP_TOOL_WORKERS, tool_stack_size_);
+}
+
+void McpServer::ToolWorkerLoop(ToolWorker& worker) {
+    while (true) {
+        std::shared_ptr<ToolCall> call;
+        {
+            std::unique_lock<std::mutex> lock(tool_call_mutex_);
+            tool_call_cv_.wait(lock, [this]() { return !tool_call_queue_.empty(); });
+            call = tool_call_queue_.front();
+            tool_call_queue_.pop_front();
+            call->deadline_us = esp_timer_get_time() + call->tool->timeout_ms() * 1000LL;
+            worker.call = call;
+        }
+        esp_timer_start_once(worker.timeout_timer, call->tool->timeout_ms() * 1000ULL);
+
+        // Kept as returned, the text is escaped straight into the reply
+        ReturnValue result;
+        std::string error;
+#if CONFIG_USE_PIPELINE_TRACE
+        PipelineTrace::GetInstance().Emit(kPipelineEventMcpCall, kPipelinePhaseBegin, call->id);
+#endif
         try {
-            ReplyResult(id, (*tool_iter)->Call(arguments));
+            result = call->invocation();
         } catch (const std::exception& e) {
-            ESP_LOGE(TAG, "tools/call: %s", e.what());
-            ReplyError(id, e.what());
+            error = e.what();
+        }
+#if CONFIG_USE_PIPELINE_TRACE
+        PipelineTrace::GetInstance().Emit(kPipelineEventMcpCall, kPipelinePhaseEnd, call->id);
+#endif
+        esp_timer_stop(worker.timeout_timer);
+
+        bool answered;
+        {
+            std::lock_guard<std::mutex> lock(tool_call_mutex_);
+            answered = call->finished;
+            call->finished = true;
+            worker.call.reset();
+        }
+        if (answered) {
+            ESP_LOGW(TAG, "tools/call: %s returned after it was cancelled or timed out", call->tool->name().c_str());
+        } else if (error.empty()) {
+            ReplyToolResult(call->id, result);
+        } else {
+            ESP_LOGE(TAG, "tools/call: %s", error.c_str());
+            ReplyError(call->id, error);
         }
-    });
-    tool_call_thread_.detach();
-}
\ No newline at end of file
+    }
+}
+
+// A tool cannot be stopped from outside, the server gets its answer now and the worker stays busy until it returns
+void McpServer::OnToolCallTimeout(ToolWorker& worker) {
+    int id;
+    std::string name;
+    {
+        std::lock_guard<std::mutex> lock(tool_call_mutex_);
+        auto& call = worker.call;
+        // The timer may fire just as the call ends and the worker takes the next one
+        if (!call || call->finished || esp_timer_get_time() < call->deadline_us) {
+            return;
+        }
+        call->finished = true;
+        id = call->id;
+        name = call->tool->name();
+    }
+    ESP_LOGW(TAG, "tools/call: %s timed out", name.c_str());
+    ReplyError(id, "Tool call timed out: " + name);
+}
+
+// The cancelled request gets no response. A waiting call is dropped, a running one finishes unanswered
+void McpServer::CancelToolCall(int id) {
+    bool cancelled = false;
+    {
+        std::lock_guard<std::mutex> lock(tool_call_mutex_);
+        for (auto it = tool_call_queue_.begin(); it != tool_call_queue_.end(); ++it) {
+            if ((*it)->id == id) {
+                ESP_LOGI(TAG, "tools/call %d cancelled before it started", id);
+                tool_call_queue_.erase(it);
+                cancelled = true;
+                break;
+            }
+        }
+        for (auto& worker : tool_workers_) {
+            if (!cancelled && worker->call && worker->call->id == id && !worker->call->finished) {
+                ESP_LOGI(TAG, "tools/call %d cancelled while running", id);
+                worker->call->finished = true;
+                cancelled = true;
+            }
+        }
+    }
+    if (cancelled) {
+        // A batch holding the request is sent without it
+        SendReply(id, "");
+    }
+}
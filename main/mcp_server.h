@@ -4,13 +4,30 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <functional>
 #include <variant>
 #include <optional>
 #include <stdexcept>
-#include <thread>
+#include <climits>
+#include <type_traits>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 
 #include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+
+#include "json_arena.h"
+
+// Tool calls run on a fixed pool of workers. Calls beyond the queue depth are refused, and a call
+// still running after its timeout is answered with an error, its late result is dropped
+#define MCP_TOOL_WORKERS 2
+#define MCP_TOOL_QUEUE_DEPTH 8
+#define MCP_TOOL_TIMEOUT_MS 30000
 
 // 添加类型别名
 using ReturnValue = std::variant<bool, int, std::string>;
@@ -112,9 +129,7 @@ public:
             }
         }
         
-        char *json_str = cJSON_PrintUnformatted(json);
-        std::string result(json_str);
-        cJSON_free(json_str);
+        std::string result = PrintJson(json);
         cJSON_Delete(json);
         
         return result;
@@ -162,91 +177,190 @@ public:
             cJSON_AddItemToObject(json, property.name().c_str(), prop_json);
         }
         
-        char *json_str = cJSON_PrintUnformatted(json);
-        std::string result(json_str);
-        cJSON_free(json_str);
+        std::string result = PrintJson(json);
         cJSON_Delete(json);
         
         return result;
     }
 };
 
-class McpTool {
-private:
-    std::string name_;
-    std::string description_;
-    PropertyList properties_;
-    std::function<ReturnValue(const PropertyList&)> callback_;
+// Typed tool arguments. A tool declares a struct for its arguments and describes each field once with
+// McpInteger, McpBoolean or McpString; the schema and the parser both come from that description.
+// A field of the wrong type, an empty range or a default outside it does not compile.
+template<typename Args>
+struct McpArgument {
+    const char* name;
+    PropertyType type;
+    bool Args::* boolean = nullptr;
+    int Args::* integer = nullptr;
+    std::string Args::* string = nullptr;
+    bool required = true;
+    bool default_boolean = false;
+    int default_integer = 0;
+    const char* default_string = "";
+    bool has_range = false;
+    int min_value = 0;
+    int max_value = 0;
+
+    // Sets the field from the call arguments, or from the default when the value is missing or of another type
+    bool Parse(const cJSON* arguments, Args& args, std::string& error) const {
+        auto value = cJSON_IsObject(arguments) ? cJSON_GetObjectItem(arguments, name) : nullptr;
+        if (type == kPropertyTypeBoolean && cJSON_IsBool(value)) {
+            args.*boolean = cJSON_IsTrue(value);
+            return true;
+        }
+        if (type == kPropertyTypeInteger && cJSON_IsNumber(value)) {
+            if (has_range && (value->valueint < min_value || value->valueint > max_value)) {
+                error = std::string("Value of ") + name + " must be between " + std::to_string(min_value) +
+                    " and " + std::to_string(max_value);
+                return false;
+            }
+            args.*integer = value->valueint;
+            return true;
+        }
+        if (type == kPropertyTypeString && cJSON_IsString(value)) {
+            args.*string = value->valuestring;
+            return true;
+        }
+        if (required) {
+            error = std::string("Missing valid argument: ") + name;
+            return false;
+        }
+        if (type == kPropertyTypeBoolean) {
+            args.*boolean = default_boolean;
+        } else if (type == kPropertyTypeInteger) {
+            args.*integer = default_integer;
+        } else {
+            args.*string = default_string;
+        }
+        return true;
+    }
 
+    Property ToProperty() const {
+        if (type == kPropertyTypeInteger && has_range) {
+            return required ? Property(name, type, min_value, max_value)
+                : Property(name, type, default_integer, min_value, max_value);
+        }
+        if (required) {
+            return Property(name, type);
+        }
+        if (type == kPropertyTypeBoolean) {
+            return Property(name, type, default_boolean);
+        } else if (type == kPropertyTypeInteger) {
+            return Property(name, type, default_integer);
+        }
+        return Property(name, type, std::string(default_string));
+    }
+};
+
+template<typename T> struct McpMember;
+template<typename C, typename T> struct McpMember<T C::*> {
+    using Args = C;
+    using Type = T;
+};
+
+struct McpNoArguments {};
+
+template<auto Member, int Min = INT_MIN, int Max = INT_MAX>
+constexpr auto McpInteger(const char* name) {
+    using M = McpMember<decltype(Member)>;
+    static_assert(std::is_same_v<typename M::Type, int>, "McpInteger needs an int member");
+    static_assert(Min <= Max, "Empty range");
+    McpArgument<typename M::Args> argument{name, kPropertyTypeInteger};
+    argument.integer = Member;
+    argument.has_range = Min != INT_MIN || Max != INT_MAX;
+    argument.min_value = Min;
+    argument.max_value = Max;
+    return argument;
+}
+
+template<auto Member, int Default, int Min = INT_MIN, int Max = INT_MAX>
+constexpr auto McpOptionalInteger(const char* name) {
+    static_assert(Default >= Min && Default <= Max, "Default outside the range");
+    auto argument = McpInteger<Member, Min, Max>(name);
+    argument.required = false;
+    argument.default_integer = Default;
+    return argument;
+}
+
+template<auto Member>
+constexpr auto McpBoolean(const char* name) {
+    using M = McpMember<decltype(Member)>;
+    static_assert(std::is_same_v<typename M::Type, bool>, "McpBoolean needs a bool member");
+    McpArgument<typename M::Args> argument{name, kPropertyTypeBoolean};
+    argument.boolean = Member;
+    return argument;
+}
+
+template<auto Member, bool Default>
+constexpr auto McpOptionalBoolean(const char* name) {
+    auto argument = McpBoolean<Member>(name);
+    argument.required = false;
+    argument.default_boolean = Default;
+    return argument;
+}
+
+template<auto Member>
+constexpr auto McpString(const char* name) {
+    using M = McpMember<decltype(Member)>;
+    static_assert(std::is_same_v<typename M::Type, std::string>, "McpString needs a std::string member");
+    McpArgument<typename M::Args> argument{name, kPropertyTypeString};
+    argument.string = Member;
+    return argument;
+}
+
+template<auto Member>
+constexpr auto McpOptionalString(const char* name, const char* default_value) {
+    auto argument = McpString<Member>(name);
+    argument.required = false;
+    argument.default_string = default_value;
+    return argument;
+}
+
+class McpTool {
 public:
+    // A call with its arguments parsed, ready to run on a tool worker
+    using Invocation = std::function<ReturnValue()>;
+    // Parses the arguments of a call, returns false with a message if they do not match the schema
+    using Binder = std::function<bool(const cJSON* arguments, Invocation& invocation, std::string& error)>;
+
+    // stack_size and timeout_ms are hints for the tool workers, 0 takes the defaults
     McpTool(const std::string& name, 
             const std::string& description, 
             const PropertyList& properties, 
-            std::function<ReturnValue(const PropertyList&)> callback)
-        : name_(name), 
-        description_(description), 
-        properties_(properties), 
-        callback_(callback) {}
+            std::function<ReturnValue(const PropertyList&)> callback,
+            int stack_size = 0,
+            int timeout_ms = 0);
+    // For typed tools, properties only describe the schema
+    McpTool(const std::string& name,
+            const std::string& description,
+            const PropertyList& properties,
+            Binder binder,
+            int stack_size = 0,
+            int timeout_ms = 0);
 
     inline const std::string& name() const { return name_; }
     inline const std::string& description() const { return description_; }
-    inline const PropertyList& properties() const { return properties_; }
+    inline int stack_size() const { return stack_size_; }
+    inline int timeout_ms() const { return timeout_ms_ > 0 ? timeout_ms_ : MCP_TOOL_TIMEOUT_MS; }
+    // Serialized once, the schema does not change after the tool is created
+    inline const std::string& to_json() const { return json_; }
 
-    std::string to_json() const {
-        std::vector<std::string> required = properties_.GetRequired();
-        
-        cJSON *json = cJSON_CreateObject();
-        cJSON_AddStringToObject(json, "name", name_.c_str());
-        cJSON_AddStringToObject(json, "description", description_.c_str());
-        
-        cJSON *input_schema = cJSON_CreateObject();
-        cJSON_AddStringToObject(input_schema, "type", "object");
-        
-        cJSON *properties = cJSON_Parse(properties_.to_json().c_str());
-        cJSON_AddItemToObject(input_schema, "properties", properties);
-        
-        if (!required.empty()) {
-            cJSON *required_array = cJSON_CreateArray();
-            for (const auto& property : required) {
-                cJSON_AddItemToArray(required_array, cJSON_CreateString(property.c_str()));
-            }
-            cJSON_AddItemToObject(input_schema, "required", required_array);
-        }
-        
-        cJSON_AddItemToObject(json, "inputSchema", input_schema);
-        
-        char *json_str = cJSON_PrintUnformatted(json);
-        std::string result(json_str);
-        cJSON_free(json_str);
-        cJSON_Delete(json);
-        
-        return result;
+    inline bool Bind(const cJSON* arguments, Invocation& invocation, std::string& error) const {
+        return binder_(arguments, invocation, error);
     }
+    // Appends the tools/call result object to out
+    static void FormatResult(const ReturnValue& return_value, std::string& out);
 
-    std::string Call(const PropertyList& properties) {
-        ReturnValue return_value = callback_(properties);
-        // 返回结果
-        cJSON* result = cJSON_CreateObject();
-        cJSON* content = cJSON_CreateArray();
-        cJSON* text = cJSON_CreateObject();
-        cJSON_AddStringToObject(text, "type", "text");
-        if (std::holds_alternative<std::string>(return_value)) {
-            cJSON_AddStringToObject(text, "text", std::get<std::string>(return_value).c_str());
-        } else if (std::holds_alternative<bool>(return_value)) {
-            cJSON_AddStringToObject(text, "text", std::get<bool>(return_value) ? "true" : "false");
-        } else if (std::holds_alternative<int>(return_value)) {
-            cJSON_AddStringToObject(text, "text", std::to_string(std::get<int>(return_value)).c_str());
-        }
-        cJSON_AddItemToArray(content, text);
-        cJSON_AddItemToObject(result, "content", content);
-        cJSON_AddBoolToObject(result, "isError", false);
-
-        auto json_str = cJSON_PrintUnformatted(result);
-        std::string result_str(json_str);
-        cJSON_free(json_str);
-        cJSON_Delete(result);
-        return result_str;
-    }
+private:
+    std::string name_;
+    std::string description_;
+    std::string json_;
+    Binder binder_;
+    int stack_size_;
+    int timeout_ms_;
+
+    static std::string BuildJson(const std::string& name, const std::string& description, const PropertyList& properties);
 };
 
 class McpServer {
@@ -258,9 +372,39 @@ public:
 
     void AddCommonTools();
     void AddTool(McpTool* tool);
-    void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
+    void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback,
+        int stack_size = 0, int timeout_ms = 0);
+    // Arguments are parsed into Args without exceptions or PropertyList copies, see McpArgument
+    template<typename Args, typename Callback>
+    void AddTypedTool(const std::string& name, const std::string& description,
+        std::initializer_list<McpArgument<Args>> arguments, Callback callback, int stack_size = 0, int timeout_ms = 0) {
+        PropertyList properties;
+        for (auto& argument : arguments) {
+            properties.AddProperty(argument.ToProperty());
+        }
+        auto binder = [arguments = std::vector<McpArgument<Args>>(arguments), callback]
+            (const cJSON* json, McpTool::Invocation& invocation, std::string& error) {
+            Args args{};
+            for (auto& argument : arguments) {
+                if (!argument.Parse(json, args, error)) {
+                    return false;
+                }
+            }
+            invocation = [callback, args = std::move(args)]() -> ReturnValue {
+                return callback(args);
+            };
+            return true;
+        };
+        AddTool(new McpTool(name, description, properties, McpTool::Binder(binder), stack_size, timeout_ms));
+    }
     void ParseMessage(const cJSON* json);
     void ParseMessage(const std::string& message);
+    // Runs a tool on the calling thread, for commands recognized on the device. Throws on
+    // unknown tools and invalid arguments, like the tool callbacks themselves.
+    std::string CallTool(const std::string& tool_name, const cJSON* tool_arguments);
+    // Called from a running tool. Sends notifications/progress if the client passed a progressToken
+    // with the call, otherwise does nothing. total <= 0 means unknown
+    void ReportProgress(int progress, int total, const std::string& message = "");
 
 private:
     McpServer();
@@ -269,13 +413,57 @@ private:
     void ParseCapabilities(const cJSON* capabilities);
 
     void ReplyResult(int id, const std::string& result);
+    void ReplyToolResult(int id, const ReturnValue& result);
+    void SendReply(int id, std::string payload);
+    void ParseBatch(const cJSON* json);
     void ReplyError(int id, const std::string& message);
 
     void GetToolsList(int id, const std::string& cursor);
-    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size);
+    void BuildToolsListPages();
+    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, int stack_size, std::string progress_token);
+    McpTool* FindTool(const std::string& tool_name);
 
     std::vector<McpTool*> tools_;
-    std::thread tool_call_thread_;
+    std::unordered_map<std::string, McpTool*> tool_index_;
+    // tools/list results keyed by cursor, "" for the first page. Built on the first request after a tool
+    // was added; an empty result means the tool at the cursor alone exceeds the payload limit
+    std::unordered_map<std::string, std::string> tools_list_pages_;
+
+    // A tools/call waiting for or running on a worker
+    struct ToolCall {
+        int id;
+        McpTool* tool;
+        McpTool::Invocation invocation;
+        std::string progress_token;     // Serialized _meta.progressToken, empty if the client asked for none
+        int64_t deadline_us = 0;
+        bool finished = false;  // Answered, cancelled or timed out, a later result is dropped
+    };
+    struct ToolWorker {
+        McpServer* owner = nullptr;
+        TaskHandle_t handle = nullptr;
+        esp_timer_handle_t timeout_timer = nullptr;
+        std::shared_ptr<ToolCall> call;
+    };
+
+    // Guards the queue and the calls the workers hold, never held while a tool runs
+    std::mutex tool_call_mutex_;
+    std::condition_variable tool_call_cv_;
+    std::deque<std::shared_ptr<ToolCall>> tool_call_queue_;
+    std::vector<std::unique_ptr<ToolWorker>> tool_workers_;
+    int tool_stack_size_ = 0;
+
+    // Responses of a JSON-RPC batch request not sent yet
+    struct Batch {
+        std::string responses;
+        int pending = 0;    // Requests of the batch not answered yet
+    };
+    std::mutex batch_mutex_;
+    std::unordered_map<int, std::shared_ptr<Batch>> batches_;  // Keyed by the id of each pending request
+
+    void StartToolWorkers();
+    void ToolWorkerLoop(ToolWorker& worker);
+    void OnToolCallTimeout(ToolWorker& worker);
+    void CancelToolCall(int id);
 };
 
 #endif // MCP_SERVER_H
@@ -0,0 +1,217 @@
+#include "media_buffer.h"
+#include "memory_accounting.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+#include <cstring>
+#include <algorithm>
+
+#define TAG "MediaBuffer"
+
+// Each frame is its 16-bit size and 16-bit duration followed by the Opus data
+#define MEDIA_BUFFER_FRAME_HEADER_SIZE 4
+
+MediaBuffer::MediaBuffer(size_t capacity, int prebuffer_ms, int low_watermark_ms, int high_watermark_ms)
+    : capacity_(capacity), prebuffer_ms_(prebuffer_ms), low_watermark_ms_(low_watermark_ms),
+      high_watermark_ms_(high_watermark_ms) {
+}
+
+void MediaBuffer::OnFlowControl(std::function<void(bool hold)> callback) {
+    on_flow_control_ = callback;
+}
+
+bool MediaBuffer::Start(uint32_t position_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ring_ == nullptr) {
+        // Only worth it in PSRAM, Kconfig requires it
+        MemoryTagScope tag(kMemoryTagAudio);
+        ring_ = {(uint8_t*)heap_caps_malloc(capacity_, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT), heap_caps_free};
+        if (ring_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %u bytes", capacity_);
+            return false;
+        }
+    }
+    Clear();
+    stats_ = {};
+    base_position_ms_ = position_ms;
+    played_ms_ = 0;
+    paused_ = false;
+    finished_ = false;
+    return true;
+}
+
+void MediaBuffer::Finish() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+    holding_ = false;
+}
+
+void MediaBuffer::Flush(uint32_t position_ms) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Clear();
+        base_position_ms_ = position_ms;
+        played_ms_ = 0;
+        finished_ = false;
+    }
+    ESP_LOGI(TAG, "Flushed, continuing at %lu ms", position_ms);
+}
+
+void MediaBuffer::Stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Clear();
+    paused_ = false;
+    finished_ = true;
+}
+
+void MediaBuffer::Clear() {
+    head_ = 0;
+    size_ = 0;
+    buffered_ms_ = 0;
+    playing_ = false;
+    holding_ = false;
+}
+
+void MediaBuffer::CopyIn(size_t offset, const uint8_t* data, size_t size) {
+    size_t first = std::min(size, capacity_ - offset);
+    memcpy(ring_.get() + offset, data, first);
+    memcpy(ring_.get(), data + first, size - first);
+}
+
+void MediaBuffer::CopyOut(size_t offset, uint8_t* data, size_t size) const {
+    size_t first = std::min(size, capacity_ - offset);
+    memcpy(data, ring_.get() + offset, first);
+    memcpy(data + first, ring_.get(), size - first);
+}
+
+bool MediaBuffer::Put(const AudioStreamPacket& packet) {
+    int flow;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (ring_ == nullptr || finished_) {
+            return false;
+        }
+        size_t size = packet.payload.size();
+        if (size > UINT16_MAX || capacity_ - size_ < MEDIA_BUFFER_FRAME_HEADER_SIZE + size) {
+            stats_.overflow_drops++;
+            return false;
+        }
+        uint16_t header[2] = {(uint16_t)size, (uint16_t)packet.frame_duration};
+        size_t tail = (head_ + size_) % capacity_;
+        CopyIn(tail, (const uint8_t*)header, MEDIA_BUFFER_FRAME_HEADER_SIZE);
+        CopyIn((tail + MEDIA_BUFFER_FRAME_HEADER_SIZE) % capacity_, packet.payload.data(), size);
+        size_ += MEDIA_BUFFER_FRAME_HEADER_SIZE + size;
+        buffered_ms_ += packet.frame_duration;
+        sample_rate_ = packet.sample_rate;
+        flow = UpdateFlow();
+    }
+    NotifyFlow(flow);
+    return true;
+}
+
+bool MediaBuffer::Get(AudioStreamPacket& packet) {
+    int flow;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (ring_ == nullptr || paused_) {
+            return false;
+        }
+        if (size_ == 0) {
+            if (playing_ && !finished_) {
+                playing_ = false;
+                stats_.underruns++;
+                ESP_LOGW(TAG, "Underrun at %lu ms", base_position_ms_ + played_ms_);
+            }
+            return false;
+        }
+        // A server that is held before the prebuffer is reached has sent all it will for now
+        if (!playing_ && buffered_ms_ < (uint32_t)prebuffer_ms_ && !finished_ && !holding_) {
+            return false;
+        }
+        playing_ = true;
+
+        uint16_t header[2];
+        CopyOut(head_, (uint8_t*)header, MEDIA_BUFFER_FRAME_HEADER_SIZE);
+        packet.payload.resize(header[0]);
+        CopyOut((head_ + MEDIA_BUFFER_FRAME_HEADER_SIZE) % capacity_, packet.payload.data(), header[0]);
+        packet.sample_rate = sample_rate_;
+        packet.frame_duration = header[1];
+        packet.timestamp = 0;
+        packet.sequence = 0;
+        packet.fec = false;
+        head_ = (head_ + MEDIA_BUFFER_FRAME_HEADER_SIZE + header[0]) % capacity_;
+        size_ -= MEDIA_BUFFER_FRAME_HEADER_SIZE + header[0];
+        buffered_ms_ -= header[1];
+        played_ms_ += header[1];
+        flow = UpdateFlow();
+    }
+    NotifyFlow(flow);
+    return true;
+}
+
+int MediaBuffer::UpdateFlow() {
+    if (finished_) {
+        return -1;
+    }
+    // Room for at least an eighth of the ring is kept for the frames already on their way
+    bool full = capacity_ - size_ < capacity_ / 8;
+    if (!holding_ && (buffered_ms_ >= (uint32_t)high_watermark_ms_ || full)) {
+        holding_ = true;
+        return 1;
+    }
+    if (holding_ && buffered_ms_ <= (uint32_t)low_watermark_ms_ && !full) {
+        holding_ = false;
+        return 0;
+    }
+    return -1;
+}
+
+void MediaBuffer::NotifyFlow(int flow) {
+    if (flow >= 0 && on_flow_control_) {
+        on_flow_control_(flow == 1);
+    }
+}
+
+void MediaBuffer::RefreshFlow() {
+    bool hold;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (ring_ == nullptr || finished_) {
+            return;
+        }
+        UpdateFlow();
+        hold = holding_;
+    }
+    if (on_flow_control_) {
+        on_flow_control_(hold);
+    }
+}
+
+void MediaBuffer::SetPaused(bool paused) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    paused_ = paused;
+}
+
+bool MediaBuffer::paused() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return paused_;
+}
+
+bool MediaBuffer::Drained() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return finished_ && size_ == 0;
+}
+
+MediaBufferStats MediaBuffer::GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    MediaBufferStats stats = stats_;
+    stats.buffered_ms = buffered_ms_;
+    stats.bytes = size_;
+    stats.capacity = ring_ != nullptr ? capacity_ : 0;
+    stats.position_ms = base_position_ms_ + played_ms_;
+    stats.paused = paused_;
+    stats.holding = holding_;
+    stats.finished = finished_;
+    return stats;
+}
@@ -0,0 +1,97 @@
+#ifndef MEDIA_BUFFER_H
+#define MEDIA_BUFFER_H
+
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+#include "protocol.h"
+
+struct MediaBufferStats {
+    uint32_t buffered_ms = 0;
+    size_t bytes = 0;
+    size_t capacity = 0;
+    uint32_t position_ms = 0;
+    uint32_t underruns = 0;
+    uint32_t overflow_drops = 0;
+    bool paused = false;
+    bool holding = false;
+    bool finished = false;
+};
+
+/*
+ * Deep buffer of the Opus frames of a long media stream, a podcast or music
+ * that an MCP tool asked the server to play.
+ *
+ * The jitter buffer is sized for TTS, a few seconds of packets in slots
+ * allocated up front. Media needs tens of seconds to ride out a network
+ * hiccup, so its frames are packed back to back into a byte ring in PSRAM,
+ * each one its 16-bit size and frame duration followed by the Opus data.
+ *
+ * Playback starts once the prebuffer is reached, or right away when the
+ * server ended the stream before that. The server is asked to hold once the
+ * buffer reaches the high watermark and to fill again at the low one, so it
+ * can send faster than real time without overrunning the ring.
+ *
+ * Put() is called by the network task, Get() by the audio loop. The flow
+ * callback runs on either of them, outside the lock.
+ */
+class MediaBuffer {
+public:
+    MediaBuffer(size_t capacity, int prebuffer_ms, int low_watermark_ms, int high_watermark_ms);
+
+    // `hold` is true when the server should stop sending, false when it should go on
+    void OnFlowControl(std::function<void(bool hold)> callback);
+
+    // A new stream at `position_ms`, the ring is allocated on the first one and kept
+    bool Start(uint32_t position_ms);
+    // The server sent all of it, the rest plays without waiting for the prebuffer
+    void Finish();
+    // Drops the buffered frames and prebuffers again, e.g. after a seek
+    void Flush(uint32_t position_ms);
+    void Stop();
+
+    // False when the ring is full, the frame is dropped
+    bool Put(const AudioStreamPacket& packet);
+    // False while prebuffering, paused or empty
+    bool Get(AudioStreamPacket& packet);
+    void SetPaused(bool paused);
+    bool paused();
+    // Finished and played out
+    bool Drained();
+    // Reports the flow state again, e.g. after the server was held for another reason
+    void RefreshFlow();
+    MediaBufferStats GetStats();
+
+private:
+    std::mutex mutex_;
+    std::unique_ptr<uint8_t, void (*)(void*)> ring_{nullptr, nullptr};
+    size_t capacity_;
+    int prebuffer_ms_;
+    int low_watermark_ms_;
+    int high_watermark_ms_;
+    std::function<void(bool hold)> on_flow_control_;
+
+    size_t head_ = 0;       // Next frame to play
+    size_t size_ = 0;
+    int sample_rate_ = 0;
+    uint32_t buffered_ms_ = 0;
+    uint32_t base_position_ms_ = 0;
+    uint32_t played_ms_ = 0;
+    bool playing_ = false;
+    bool paused_ = false;
+    bool holding_ = false;
+    bool finished_ = false;
+    MediaBufferStats stats_;
+
+    void CopyIn(size_t offset, const uint8_t* data, size_t size);
+    void CopyOut(size_t offset, uint8_t* data, size_t size) const;
+    void Clear();
+    // With the lock held. Returns 1 to hold, 0 to fill, -1 if nothing changed
+    int UpdateFlow();
+    void NotifyFlow(int flow);
+};
+
+#endif // MEDIA_BUFFER_H
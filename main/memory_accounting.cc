@@ -0,0 +1,189 @@
+#include "memory_accounting.h"
+
+#include <esp_log.h>
+#include <esp_attr.h>
+#include <esp_heap_caps.h>
+#include <esp_memory_utils.h>
+#include <freertos/FreeRTOS.h>
+
+#include <string>
+
+#define TAG "MemoryAccounting"
+
+static const char* const kTagNames[kMemoryTagCount] = {
+    "other",
+    "audio",
+    "display",
+    "protocol",
+    "mcp",
+    "camera",
+};
+
+const char* MemoryAccounting::GetTagName(MemoryTag tag) {
+    return tag < kMemoryTagCount ? kTagNames[tag] : "unknown";
+}
+
+#if CONFIG_USE_MEMORY_ACCOUNTING
+
+#define SLOT_SIZE_MASK 0x00FFFFFF
+#define SLOT_TAG_SHIFT 24
+#define SLOT_TAG_MASK 0x0F
+#define SLOT_PSRAM (1u << 28)
+
+// A live tagged allocation: size in the low 24 bits, then the tag and the PSRAM flag
+struct Slot {
+    void* ptr;
+    uint32_t info;
+};
+
+static thread_local MemoryTag current_tag = kMemoryTagOther;
+// Internal RAM, the hooks can run while the cache is disabled
+static Slot* slots = nullptr;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static MemoryTagStats stats[kMemoryTagCount];
+static uint32_t untracked = 0;
+
+static inline IRAM_ATTR size_t Home(const void* ptr) {
+    return ((uintptr_t)ptr >> 3) * 2654435761u % CONFIG_MEMORY_ACCOUNTING_SLOTS;
+}
+
+// Linear probing, a free slot ends every probe sequence
+extern "C" IRAM_ATTR void esp_heap_trace_alloc_hook(void* ptr, size_t size, uint32_t caps) {
+    MemoryTag tag = current_tag;
+    if (slots == nullptr || ptr == nullptr || tag == kMemoryTagOther) {
+        return;
+    }
+    bool psram = esp_ptr_external_ram(ptr);
+
+    portENTER_CRITICAL_SAFE(&lock);
+    size_t index = Home(ptr);
+    for (int i = 0; i < CONFIG_MEMORY_ACCOUNTING_SLOTS && slots[index].ptr != nullptr; i++) {
+        index = (index + 1) % CONFIG_MEMORY_ACCOUNTING_SLOTS;
+    }
+    if (slots[index].ptr != nullptr || size > SLOT_SIZE_MASK) {
+        untracked++;
+    } else {
+        slots[index].ptr = ptr;
+        slots[index].info = size | (tag << SLOT_TAG_SHIFT) | (psram ? SLOT_PSRAM : 0);
+        auto& tag_stats = stats[tag];
+        (psram ? tag_stats.psram : tag_stats.sram) += size;
+        tag_stats.allocations++;
+        if (tag_stats.sram + tag_stats.psram > tag_stats.peak) {
+            tag_stats.peak = tag_stats.sram + tag_stats.psram;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&lock);
+}
+
+extern "C" IRAM_ATTR void esp_heap_trace_free_hook(void* ptr) {
+    if (slots == nullptr || ptr == nullptr) {
+        return;
+    }
+
+    portENTER_CRITICAL_SAFE(&lock);
+    size_t index = Home(ptr);
+    while (slots[index].ptr != nullptr && slots[index].ptr != ptr) {
+        index = (index + 1) % CONFIG_MEMORY_ACCOUNTING_SLOTS;
+    }
+    if (slots[index].ptr == ptr) {
+        uint32_t info = slots[index].info;
+        auto& tag_stats = stats[(info >> SLOT_TAG_SHIFT) & SLOT_TAG_MASK];
+        ((info & SLOT_PSRAM) ? tag_stats.psram : tag_stats.sram) -= info & SLOT_SIZE_MASK;
+
+        // Backward shift deletion, moves later entries of the run into the hole
+        slots[index].ptr = nullptr;
+        size_t hole = index;
+        size_t next = index;
+        while (true) {
+            next = (next + 1) % CONFIG_MEMORY_ACCOUNTING_SLOTS;
+            if (slots[next].ptr == nullptr) {
+                break;
+            }
+            size_t home = Home(slots[next].ptr);
+            bool stays = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+            if (!stays) {
+                slots[hole] = slots[next];
+                slots[next].ptr = nullptr;
+                hole = next;
+            }
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&lock);
+}
+
+void MemoryAccounting::Initialize() {
+    // Allocated untagged, so the table does not account itself
+    auto table = (Slot*)heap_caps_calloc(CONFIG_MEMORY_ACCOUNTING_SLOTS, sizeof(Slot), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (table == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %d slots", CONFIG_MEMORY_ACCOUNTING_SLOTS);
+        return;
+    }
+    slots = table;
+}
+
+bool MemoryAccounting::IsEnabled() {
+    return slots != nullptr;
+}
+
+void MemoryAccounting::SetTaskTag(MemoryTag tag) {
+    current_tag = tag;
+}
+
+MemoryTag MemoryAccounting::GetTaskTag() {
+    return current_tag;
+}
+
+MemoryTagStats MemoryAccounting::GetStats(MemoryTag tag) {
+    portENTER_CRITICAL(&lock);
+    auto tag_stats = stats[tag];
+    portEXIT_CRITICAL(&lock);
+    return tag_stats;
+}
+
+uint32_t MemoryAccounting::GetUntracked() {
+    return untracked;
+}
+
+void MemoryAccounting::PrintStats() {
+    if (!IsEnabled()) {
+        return;
+    }
+    std::string line;
+    for (int i = kMemoryTagOther + 1; i < kMemoryTagCount; i++) {
+        auto tag = (MemoryTag)i;
+        auto tag_stats = GetStats(tag);
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), " %s %u/%u/%u", GetTagName(tag), tag_stats.sram, tag_stats.psram, tag_stats.peak);
+        line += buffer;
+    }
+    ESP_LOGI(TAG, "sram/psram/peak:%s, untracked %lu", line.c_str(), GetUntracked());
+}
+
+#else
+
+void MemoryAccounting::Initialize() {
+}
+
+bool MemoryAccounting::IsEnabled() {
+    return false;
+}
+
+void MemoryAccounting::SetTaskTag(MemoryTag tag) {
+}
+
+MemoryTag MemoryAccounting::GetTaskTag() {
+    return kMemoryTagOther;
+}
+
+MemoryTagStats MemoryAccounting::GetStats(MemoryTag tag) {
+    return {};
+}
+
+uint32_t MemoryAccounting::GetUntracked() {
+    return 0;
+}
+
+void MemoryAccounting::PrintStats() {
+}
+
+#endif
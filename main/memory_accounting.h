@@ -0,0 +1,73 @@
+#ifndef MEMORY_ACCOUNTING_H
+#define MEMORY_ACCOUNTING_H
+
+#include <sdkconfig.h>
+
+#include <cstddef>
+#include <cstdint>
+
+enum MemoryTag : uint8_t {
+    kMemoryTagOther,        // Not accounted
+    kMemoryTagAudio,
+    kMemoryTagDisplay,
+    kMemoryTagProtocol,
+    kMemoryTagMcp,
+    kMemoryTagCamera,
+    kMemoryTagCount,
+};
+
+struct MemoryTagStats {
+    size_t sram = 0;            // Bytes currently allocated in internal RAM
+    size_t psram = 0;           // Bytes currently allocated in PSRAM
+    size_t peak = 0;            // Highest sram + psram
+    uint32_t allocations = 0;   // Allocations since boot
+};
+
+/*
+ * Heap usage per subsystem, built on the heap allocation hooks
+ * (CONFIG_USE_MEMORY_ACCOUNTING).
+ *
+ * Each task has a current tag, set for the whole task with SetTaskTag() or
+ * for a block with MemoryTagScope. An allocation made under a tag other than
+ * kMemoryTagOther is remembered in a table of CONFIG_MEMORY_ACCOUNTING_SLOTS
+ * entries until it is freed, whichever task frees it. Allocations that find
+ * the table full are only counted as untracked.
+ */
+class MemoryAccounting {
+public:
+    // Call once, early in app_main, allocations before it are not accounted
+    static void Initialize();
+    static bool IsEnabled();
+
+    static void SetTaskTag(MemoryTag tag);
+    static MemoryTag GetTaskTag();
+
+    static MemoryTagStats GetStats(MemoryTag tag);
+    static uint32_t GetUntracked();
+    static const char* GetTagName(MemoryTag tag);
+    static void PrintStats();
+};
+
+#if CONFIG_USE_MEMORY_ACCOUNTING
+class MemoryTagScope {
+public:
+    explicit MemoryTagScope(MemoryTag tag) : previous_(MemoryAccounting::GetTaskTag()) {
+        MemoryAccounting::SetTaskTag(tag);
+    }
+    ~MemoryTagScope() {
+        MemoryAccounting::SetTaskTag(previous_);
+    }
+    MemoryTagScope(const MemoryTagScope&) = delete;
+    MemoryTagScope& operator=(const MemoryTagScope&) = delete;
+
+private:
+    MemoryTag previous_;
+};
+#else
+class MemoryTagScope {
+public:
+    explicit MemoryTagScope(MemoryTag) {}
+};
+#endif
+
+#endif // MEMORY_ACCOUNTING_H
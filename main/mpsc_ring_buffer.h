@@ -0,0 +1,77 @@
+#ifndef MPSC_RING_BUFFER_H
+#define MPSC_RING_BUFFER_H
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <cstddef>
+
+/*
+ * Fixed-capacity multi-producer / single-consumer ring buffer.
+ *
+ * Each slot carries a sequence number (bounded queue after D. Vyukov):
+ * producers claim a position by advancing tail_ with a CAS and publish the
+ * item by bumping the slot sequence, the consumer only reads slots whose
+ * sequence says they are published. No locks and no allocation after the
+ * constructor, so Push() is safe from any task. Push() fails when full,
+ * the caller decides what to do with the item.
+ */
+template <typename T>
+class MpscRingBuffer {
+public:
+    explicit MpscRingBuffer(size_t capacity) : slots_(new Slot[capacity]), capacity_(capacity) {
+        for (size_t i = 0; i < capacity; i++) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRingBuffer(const MpscRingBuffer&) = delete;
+    MpscRingBuffer& operator=(const MpscRingBuffer&) = delete;
+
+    // Any thread
+    bool Push(T&& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots_[tail % capacity_];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence == tail) {
+                if (tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) {
+                    slot.item = std::move(item);
+                    slot.sequence.store(tail + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (sequence < tail) {
+                return false;  // The consumer has not freed this slot yet
+            } else {
+                tail = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer side
+    bool Pop(T& item) {
+        Slot& slot = slots_[head_ % capacity_];
+        if (slot.sequence.load(std::memory_order_acquire) != head_ + 1) {
+            return false;
+        }
+        item = std::move(slot.item);
+        slot.sequence.store(head_ + capacity_, std::memory_order_release);
+        head_++;
+        return true;
+    }
+
+    inline size_t capacity() const { return capacity_; }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    const size_t capacity_;
+    std::atomic<size_t> tail_{0};
+    size_t head_ = 0;
+};
+
+#endif // MPSC_RING_BUFFER_H
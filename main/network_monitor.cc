@@ -0,0 +1,70 @@
+#include "network_monitor.h"
+#include "background_task.h"
+#include "board.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+#define TAG "NetworkMonitor"
+
+NetworkMonitor::NetworkMonitor() {
+    // The modem UART needs the APB clock held while a query is in flight
+    auto ret = esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "network_monitor", &pm_lock_);
+    if (ret != ESP_OK) {
+        pm_lock_ = nullptr;
+    }
+}
+
+NetworkMonitor::~NetworkMonitor() {
+    if (pm_lock_ != nullptr) {
+        esp_pm_lock_delete(pm_lock_);
+    }
+}
+
+void NetworkMonitor::OnClockTick(BackgroundTask* executor, bool can_sample) {
+    if (executor == nullptr || sampling_) {
+        return;
+    }
+    if (esp_timer_get_time() < next_sample_us_ || !can_sample) {
+        return;
+    }
+    sampling_ = true;
+    // Until the sample in flight sets the real one, so the idle clock does not wait on it
+    next_sample_us_ = esp_timer_get_time() + NETWORK_MONITOR_MIN_INTERVAL_SECONDS * 1000000LL;
+    if (!executor->Schedule([this]() { Sample(); })) {
+        sampling_ = false;
+    }
+}
+
+void NetworkMonitor::Refresh() {
+    interval_seconds_ = NETWORK_MONITOR_MIN_INTERVAL_SECONDS;
+    next_sample_us_ = 0;
+}
+
+void NetworkMonitor::Sample() {
+    auto& board = Board::GetInstance();
+    if (pm_lock_ != nullptr) {
+        esp_pm_lock_acquire(pm_lock_);
+    }
+    const char* icon = board.GetNetworkStateIcon();
+    int signal_quality = board.GetSignalQuality();
+    if (pm_lock_ != nullptr) {
+        esp_pm_lock_release(pm_lock_);
+    }
+
+    // Small signal swings are noise, they do not keep the rate up
+    int last_quality = signal_quality_.exchange(signal_quality);
+    bool changed = icon_.exchange(icon) != icon || (signal_quality < 0) != (last_quality < 0) ||
+        std::abs(signal_quality - last_quality) >= 10;
+    int interval = changed ? NETWORK_MONITOR_MIN_INTERVAL_SECONDS :
+        std::min(interval_seconds_ * 2, NETWORK_MONITOR_MAX_INTERVAL_SECONDS);
+    if (interval != interval_seconds_) {
+        ESP_LOGD(TAG, "Signal %d, next sample in %d s", signal_quality, interval);
+    }
+    interval_seconds_ = interval;
+    next_sample_us_ = esp_timer_get_time() + interval * 1000000LL;
+    sampling_ = false;
+}
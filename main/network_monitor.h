@@ -0,0 +1,62 @@
+#ifndef NETWORK_MONITOR_H
+#define NETWORK_MONITOR_H
+
+#include <esp_pm.h>
+
+#include <atomic>
+#include <cstdint>
+
+class BackgroundTask;
+
+// A changing link is sampled this often, a steady one less and less down to the maximum
+#define NETWORK_MONITOR_MIN_INTERVAL_SECONDS 10
+#define NETWORK_MONITOR_MAX_INTERVAL_SECONDS 60
+
+/*
+ * The network state icon and the signal quality, sampled on the background
+ * task and read from the cache by the status bar and the link quality update.
+ *
+ * On a cellular board every sample is an AT round trip that can take a good
+ * part of a second, which used to block the clock timer and with it every
+ * other esp_timer callback. Samples are skipped while the device is busy with
+ * audio or an upgrade, the modem UART is left to the sockets then. The
+ * interval doubles while the readings stay the same and drops back to the
+ * minimum when they change or the network does.
+ */
+class NetworkMonitor {
+public:
+    static NetworkMonitor& GetInstance() {
+        static NetworkMonitor instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    NetworkMonitor(const NetworkMonitor&) = delete;
+    NetworkMonitor& operator=(const NetworkMonitor&) = delete;
+
+    // Clock timer, every second or less often in idle. Samples when one is due, unless `can_sample`
+    // is false because the link is busy
+    void OnClockTick(BackgroundTask* executor, bool can_sample);
+    // The next tick samples, e.g. after the network changed
+    void Refresh();
+    // esp_timer time the next sample is due, the idle clock wakes up for it
+    int64_t GetNextSampleUs() const { return next_sample_us_.load(); }
+
+    // Nullptr before the first sample
+    const char* GetNetworkStateIcon() const { return icon_.load(); }
+    int GetSignalQuality() const { return signal_quality_.load(); }
+
+private:
+    NetworkMonitor();
+    ~NetworkMonitor();
+
+    std::atomic<const char*> icon_ = nullptr;
+    std::atomic<int> signal_quality_ = -1;
+    std::atomic<bool> sampling_ = false;
+    std::atomic<int> interval_seconds_ = NETWORK_MONITOR_MIN_INTERVAL_SECONDS;
+    std::atomic<int64_t> next_sample_us_ = 0;
+    esp_pm_lock_handle_t pm_lock_ = nullptr;
+
+    void Sample();
+};
+
+#endif // NETWORK_MONITOR_H
@@ -1,7 +1,11 @@
 #include "ota.h"
 #include "system_info.h"
 #include "settings.h"
+#include "task_topology.h"
 #include "assets/lang_config.h"
+#if CONFIG_USE_POWER_GOVERNOR
+#include "power_governor.h"
+#endif
 
 #include <cJSON.h>
 #include <esp_log.h>
@@ -10,14 +14,24 @@
 #include <esp_app_format.h>
 #include <esp_efuse.h>
 #include <esp_efuse_table.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <mbedtls/sha256.h>
+#include <esp_delta_ota.h>
+#include <rom/miniz.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 #ifdef SOC_HMAC_SUPPORTED
 #include <esp_hmac.h>
 #endif
 
 #include <cstring>
+#include <ctime>
 #include <vector>
 #include <sstream>
 #include <algorithm>
+#include <atomic>
 
 #define TAG "Ota"
 
@@ -53,7 +67,8 @@ Http* Ota::SetupHttp() {
     auto& board = Board::GetInstance();
     auto app_desc = esp_app_get_description();
 
-    auto http = board.CreateHttp();
+    // The activation polls the same server up to ten times, a kept-alive connection saves the handshakes
+    auto http = board.CreateKeepAliveHttp();
     http->SetHeader("Activation-Version", has_serial_number_ ? "2" : "1");
     http->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
     http->SetHeader("Client-Id", board.GetUuid());
@@ -70,6 +85,21 @@ Http* Ota::SetupHttp() {
 /* 
  * Specification: https://ccnphfhqs21z.feishu.cn/wiki/FjW6wZmisimNBBkov6OcmfvknVd
  */
+// The candidate endpoints of a section, e.g. "urls" of websocket, are stored comma separated
+static std::string JoinStringArray(const cJSON* array) {
+    std::string joined;
+    const cJSON* item = NULL;
+    cJSON_ArrayForEach(item, array) {
+        if (cJSON_IsString(item)) {
+            if (!joined.empty()) {
+                joined += ',';
+            }
+            joined += item->valuestring;
+        }
+    }
+    return joined;
+}
+
 bool Ota::CheckVersion() {
     auto& board = Board::GetInstance();
     auto app_desc = esp_app_get_description();
@@ -90,18 +120,36 @@ bool Ota::CheckVersion() {
     std::string method = data.length() > 0 ? "POST" : "GET";
     http->SetContent(std::move(data));
 
+    // 上次的响应是这个固件版本收到的，服务器没有变化时返回 304，不用再传一遍
+    std::string cached_data;
+    {
+        Settings settings("ota", false);
+        if (settings.GetString("check_version") == current_version_) {
+            cached_data = settings.GetString("check_body");
+            auto etag = settings.GetString("check_etag");
+            if (!cached_data.empty() && !etag.empty()) {
+                http->SetHeader("If-None-Match", etag);
+            }
+        }
+    }
+
     if (!http->Open(method, url)) {
         ESP_LOGE(TAG, "Failed to open HTTP connection");
         return false;
     }
 
     auto status_code = http->GetStatusCode();
-    if (status_code != 200) {
+    check_result_cached_ = (status_code == 304 && !cached_data.empty());
+    if (check_result_cached_) {
+        ESP_LOGI(TAG, "Check version response not modified, using the cached one");
+        data = std::move(cached_data);
+    } else if (status_code == 200) {
+        data = http->ReadAll();
+    } else {
         ESP_LOGE(TAG, "Failed to check version, status code: %d", status_code);
         return false;
     }
-
-    data = http->ReadAll();
+    auto etag = http->GetResponseHeader("ETag");
     http->Close();
 
     // Response: { "firmware": { "version": "1.0.0", "url": "http://" } }
@@ -136,6 +184,12 @@ bool Ota::CheckVersion() {
         if (cJSON_IsNumber(timeout_ms)) {
             activation_timeout_ms_ = timeout_ms->valueint;
         }
+        // The server holds an activation request until the code is entered or this much time has passed
+        activation_long_poll_ms_ = 0;
+        cJSON* long_poll_ms = cJSON_GetObjectItem(activation, "long_poll_ms");
+        if (cJSON_IsNumber(long_poll_ms) && long_poll_ms->valueint > 0) {
+            activation_long_poll_ms_ = std::min(long_poll_ms->valueint, OTA_ACTIVATION_MAX_LONG_POLL_MS);
+        }
     }
 
     has_mqtt_config_ = false;
@@ -152,6 +206,11 @@ bool Ota::CheckVersion() {
                 if (settings.GetInt(item->string) != item->valueint) {
                     settings.SetInt(item->string, item->valueint);
                 }
+            } else if (cJSON_IsArray(item)) {
+                std::string joined = JoinStringArray(item);
+                if (settings.GetString(item->string) != joined) {
+                    settings.SetString(item->string, joined);
+                }
             }
         }
         has_mqtt_config_ = true;
@@ -173,6 +232,11 @@ bool Ota::CheckVersion() {
                 if (settings.GetInt(item->string) != item->valueint) {
                     settings.SetInt(item->string, item->valueint);
                 }
+            } else if (cJSON_IsArray(item)) {
+                std::string joined = JoinStringArray(item);
+                if (settings.GetString(item->string) != joined) {
+                    settings.SetString(item->string, joined);
+                }
             }
         }
         has_websocket_config_ = true;
@@ -180,9 +244,29 @@ bool Ota::CheckVersion() {
         ESP_LOGI(TAG, "No websocket section found!");
     }
 
+    has_udp_config_ = false;
+    cJSON *udp = cJSON_GetObjectItem(root, "udp");
+    if (cJSON_IsObject(udp)) {
+        Settings settings("udp", true);
+        cJSON *item = NULL;
+        cJSON_ArrayForEach(item, udp) {
+            if (cJSON_IsString(item)) {
+                if (settings.GetString(item->string) != item->valuestring) {
+                    settings.SetString(item->string, item->valuestring);
+                }
+            } else if (cJSON_IsNumber(item)) {
+                if (settings.GetInt(item->string) != item->valueint) {
+                    settings.SetInt(item->string, item->valueint);
+                }
+            }
+        }
+        has_udp_config_ = true;
+    }
+
     has_server_time_ = false;
     cJSON *server_time = cJSON_GetObjectItem(root, "server_time");
-    if (cJSON_IsObject(server_time)) {
+    // The time in a cached response is stale
+    if (cJSON_IsObject(server_time) && !check_result_cached_) {
         cJSON *timestamp = cJSON_GetObjectItem(server_time, "timestamp");
         cJSON *timezone_offset = cJSON_GetObjectItem(server_time, "timezone_offset");
         
@@ -216,6 +300,19 @@ bool Ota::CheckVersion() {
         if (cJSON_IsString(url)) {
             firmware_url_ = url->valuestring;
         }
+        // Optional, hex SHA-256 of the whole image, checked after a download that may have resumed
+        cJSON *sha256 = cJSON_GetObjectItem(firmware, "sha256");
+        firmware_sha256_ = cJSON_IsString(sha256) ? sha256->valuestring : "";
+        // Optional, { "url": "http://", "from": "1.0.0" } a delta patch against the running version
+        firmware_patch_url_.clear();
+        cJSON *patch = cJSON_GetObjectItem(firmware, "patch");
+        if (cJSON_IsObject(patch)) {
+            cJSON *patch_url = cJSON_GetObjectItem(patch, "url");
+            cJSON *from = cJSON_GetObjectItem(patch, "from");
+            if (cJSON_IsString(patch_url) && cJSON_IsString(from) && current_version_ == from->valuestring) {
+                firmware_patch_url_ = patch_url->valuestring;
+            }
+        }
 
         if (cJSON_IsString(version) && cJSON_IsString(url)) {
             // Check if the version is newer, for example, 0.1.0 is newer than 0.0.1
@@ -235,10 +332,67 @@ bool Ota::CheckVersion() {
         ESP_LOGW(TAG, "No firmware section found!");
     }
 
+    // Optional, { "version": "1", "url": "http://" } the custom prompts image, downloaded when the version changes
+    prompts_url_.clear();
+    prompts_version_.clear();
+    cJSON *prompts = cJSON_GetObjectItem(root, "prompts");
+    if (cJSON_IsObject(prompts)) {
+        cJSON *version = cJSON_GetObjectItem(prompts, "version");
+        cJSON *url = cJSON_GetObjectItem(prompts, "url");
+        if (cJSON_IsString(version) && cJSON_IsString(url)) {
+            prompts_version_ = version->valuestring;
+            prompts_url_ = url->valuestring;
+        }
+    }
+
+    // 激活码只能用一次，要求激活的响应不缓存
+    if (!check_result_cached_ && !has_activation_code_ && !has_activation_challenge_) {
+        SaveCheckResult(data, etag);
+    }
+
     cJSON_Delete(root);
     return true;
 }
 
+void Ota::SaveCheckResult(const std::string& data, const std::string& etag) {
+    Settings settings("ota", true);
+    if (data.size() > OTA_CHECK_CACHE_MAX_SIZE) {
+        ESP_LOGW(TAG, "Check version response is too large to cache: %u", data.size());
+        settings.EraseKey("check_body");
+        return;
+    }
+    if (settings.GetString("check_body") != data) {
+        settings.SetString("check_body", data);
+    }
+    if (settings.GetString("check_etag") != etag) {
+        settings.SetString("check_etag", etag);
+    }
+    if (settings.GetString("check_version") != current_version_) {
+        settings.SetString("check_version", current_version_);
+    }
+    // 只有系统时间有效（服务器下发过时间）才记录，否则不会被当作新鲜的结果
+    int32_t check_time = has_server_time_ ? (int32_t)time(NULL) : 0;
+    if (settings.GetInt("check_time") != check_time) {
+        settings.SetInt("check_time", check_time);
+    }
+}
+
+/*
+ * The RTC keeps the system time across a software reset, so a reboot shortly
+ * after a check can skip the next one. The cache belongs to the firmware that
+ * stored it, a new firmware always checks and marks itself valid.
+ */
+bool Ota::IsCheckResultFresh() {
+    Settings settings("ota", false);
+    if (settings.GetString("check_version") != esp_app_get_description()->version ||
+        settings.GetString("check_body").empty()) {
+        return false;
+    }
+    int64_t check_time = settings.GetInt("check_time");
+    int64_t now = time(NULL);
+    return check_time > 0 && now >= check_time && now - check_time < OTA_CHECK_CACHE_TTL_SECONDS;
+}
+
 void Ota::MarkCurrentVersionValid() {
     auto partition = esp_ota_get_running_partition();
     if (strcmp(partition->label, "factory") == 0) {
@@ -247,129 +401,454 @@ void Ota::MarkCurrentVersionValid() {
     }
 
     ESP_LOGI(TAG, "Running partition: %s", partition->label);
-    esp_ota_img_states_t state;
-    if (esp_ota_get_state_partition(partition, &state) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to get state of partition");
-        return;
+    TaskTopology::RunOnInternalStack([partition]() {
+        esp_ota_img_states_t state;
+        if (esp_ota_get_state_partition(partition, &state) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to get state of partition");
+            return;
+        }
+
+        if (state == ESP_OTA_IMG_PENDING_VERIFY) {
+            ESP_LOGI(TAG, "Marking firmware as valid");
+            esp_ota_mark_app_valid_cancel_rollback();
+        }
+    });
+}
+
+struct OtaChunk {
+    char* data;
+    size_t length;
+};
+
+// State shared between the download loop and the flash write task
+struct OtaWriter {
+    esp_ota_handle_t handle = 0;
+    QueueHandle_t free_queue = nullptr;
+    QueueHandle_t full_queue = nullptr;
+    SemaphoreHandle_t done = nullptr;
+    std::atomic<esp_err_t> err = ESP_OK;
+    std::atomic<int64_t> network_stall_us = 0;
+    mbedtls_sha256_context sha256;
+    // 不为空时收到的是差分补丁，解出的新固件再写入分区
+    esp_delta_ota_handle_t patch = nullptr;
+    // 不为空时收到的是 zlib 压缩的固件，window 满了或解压结束时写入分区
+    tinfl_decompressor* inflator = nullptr;
+    uint8_t* window = nullptr;
+    size_t window_pos = 0;
+    bool inflated = false;
+    size_t image_size = 0;
+};
+
+// The app description follows the first segment header, reject the running version
+static bool OtaCheckImageHeader(const uint8_t* data, size_t length) {
+    if (length < sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
+        ESP_LOGE(TAG, "Firmware image is too small");
+        return false;
     }
+    esp_app_desc_t new_app_info;
+    memcpy(&new_app_info, data + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
+    ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
 
-    if (state == ESP_OTA_IMG_PENDING_VERIFY) {
-        ESP_LOGI(TAG, "Marking firmware as valid");
-        esp_ota_mark_app_valid_cancel_rollback();
+    auto current_version = esp_app_get_description()->version;
+    if (memcmp(new_app_info.version, current_version, sizeof(new_app_info.version)) == 0) {
+        ESP_LOGE(TAG, "Firmware version is the same, skipping upgrade");
+        return false;
     }
+    return true;
 }
 
-void Ota::Upgrade(const std::string& firmware_url) {
-    ESP_LOGI(TAG, "Upgrading firmware from %s", firmware_url.c_str());
-    esp_ota_handle_t update_handle = 0;
-    auto update_partition = esp_ota_get_next_update_partition(NULL);
-    if (update_partition == NULL) {
-        ESP_LOGE(TAG, "Failed to get update partition");
-        return;
+// zlib 头：CM 为 8 (deflate)，前两个字节是 31 的倍数
+static bool IsZlibStream(const uint8_t* data, size_t length) {
+    return length >= 2 && data[0] != ESP_IMAGE_HEADER_MAGIC && (data[0] & 0x0F) == 8 && ((data[0] << 8) | data[1]) % 31 == 0;
+}
+
+// 直接写入的固件和补丁、压缩包解出的固件都从这里写入分区，所以哈希的总是新固件
+static int OtaWriteImage(const uint8_t* data, size_t length, void* user_data) {
+    auto writer = static_cast<OtaWriter*>(user_data);
+    mbedtls_sha256_update(&writer->sha256, data, length);
+    writer->image_size += length;
+    return esp_ota_write(writer->handle, data, length);
+}
+
+static esp_err_t OtaInflate(OtaWriter* writer, const uint8_t* data, size_t length) {
+    while (!writer->inflated) {
+        size_t in_bytes = length;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - writer->window_pos;
+        auto status = tinfl_decompress(writer->inflator, data, &in_bytes, writer->window, writer->window + writer->window_pos,
+            &out_bytes, TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+        data += in_bytes;
+        length -= in_bytes;
+        writer->window_pos += out_bytes;
+        if (status < TINFL_STATUS_DONE) {
+            ESP_LOGE(TAG, "Failed to decompress firmware: %d", status);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+
+        writer->inflated = (status == TINFL_STATUS_DONE);
+        if (writer->window_pos == TINFL_LZ_DICT_SIZE || writer->inflated) {
+            // 压缩包的版本检查放在解出的第一段数据上
+            if (writer->image_size == 0 && !OtaCheckImageHeader(writer->window, writer->window_pos)) {
+                return ESP_ERR_INVALID_VERSION;
+            }
+            auto err = OtaWriteImage(writer->window, writer->window_pos, writer);
+            if (err != ESP_OK) {
+                return err;
+            }
+            writer->window_pos = 0;
+        }
+        if (status == TINFL_STATUS_NEEDS_MORE_INPUT && length == 0) {
+            break;
+        }
     }
+    return ESP_OK;
+}
 
-    ESP_LOGI(TAG, "Writing to partition %s at offset 0x%lx", update_partition->label, update_partition->address);
-    bool image_header_checked = false;
-    std::string image_header;
+// 补丁的源数据是正在运行的固件
+static int OtaReadSource(uint8_t* buffer, size_t size, int src_offset) {
+    return esp_partition_read(esp_ota_get_running_partition(), src_offset, buffer, size);
+}
 
+static void OtaWriteTask(void* arg) {
+    auto writer = static_cast<OtaWriter*>(arg);
+    while (true) {
+        OtaChunk chunk;
+        auto start_time = esp_timer_get_time();
+        xQueueReceive(writer->full_queue, &chunk, portMAX_DELAY);
+        writer->network_stall_us += esp_timer_get_time() - start_time;
+        if (chunk.data == nullptr) {
+            break;
+        }
+        // 顺序写入模式下 esp_ota_write 在写到新扇区时才擦除它，擦除和下载在两个任务里并行
+        if (writer->err == ESP_OK) {
+            if (writer->patch) {
+                writer->err = esp_delta_ota_feed_patch(writer->patch, (const uint8_t*)chunk.data, chunk.length);
+            } else if (writer->inflator) {
+                writer->err = OtaInflate(writer, (const uint8_t*)chunk.data, chunk.length);
+            } else {
+                writer->err = OtaWriteImage((const uint8_t*)chunk.data, chunk.length, writer);
+            }
+        }
+        // 出错后继续归还缓冲区，下载循环不会卡住
+        xQueueSend(writer->free_queue, &chunk.data, portMAX_DELAY);
+    }
+    xSemaphoreGive(writer->done);
+    vTaskDelete(NULL);
+}
+
+// offset 不为 0 时请求剩余的部分，服务器必须返回 206
+std::unique_ptr<Http> Ota::OpenFirmware(const std::string& firmware_url, size_t offset, size_t& content_length) {
     auto http = std::unique_ptr<Http>(Board::GetInstance().CreateHttp());
+    if (offset > 0) {
+        http->SetHeader("Range", "bytes=" + std::to_string(offset) + "-");
+    }
     if (!http->Open("GET", firmware_url)) {
         ESP_LOGE(TAG, "Failed to open HTTP connection");
-        return;
+        return nullptr;
     }
 
-    if (http->GetStatusCode() != 200) {
-        ESP_LOGE(TAG, "Failed to get firmware, status code: %d", http->GetStatusCode());
-        return;
+    auto status_code = http->GetStatusCode();
+    if (offset == 0) {
+        if (status_code != 200) {
+            ESP_LOGE(TAG, "Failed to get firmware, status code: %d", status_code);
+            return nullptr;
+        }
+        content_length = http->GetBodyLength();
+        if (content_length == 0) {
+            ESP_LOGE(TAG, "Failed to get content length");
+            return nullptr;
+        }
+    } else {
+        if (status_code != 206 || http->GetBodyLength() != content_length - offset) {
+            ESP_LOGE(TAG, "Failed to resume firmware at %u, status code: %d", offset, status_code);
+            return nullptr;
+        }
+        ESP_LOGI(TAG, "Resumed firmware download at %u/%u", offset, content_length);
     }
+    return http;
+}
 
-    size_t content_length = http->GetBodyLength();
-    if (content_length == 0) {
-        ESP_LOGE(TAG, "Failed to get content length");
-        return;
+/*
+ * Receives into one buffer while the write task flashes another, so network
+ * reads and flash erase/writes overlap instead of alternating. A dropped
+ * connection is reopened with a Range request for the rest of the image, the
+ * flash writes just carry on from where they were.
+ *
+ * With patch set the download is a delta patch against the running firmware,
+ * it is decoded in the write task as it streams in.
+ */
+bool Ota::Download(const std::string& firmware_url, bool patch, const esp_partition_t* update_partition, esp_ota_handle_t& update_handle) {
+    size_t content_length = 0;
+    auto http = OpenFirmware(firmware_url, 0, content_length);
+    if (!http) {
+        return false;
+    }
+
+    size_t buffer_size = OTA_BUFFER_SIZE;
+    int buffer_count = OTA_BUFFER_COUNT;
+    int caps = MALLOC_CAP_SPIRAM;
+    if (heap_caps_get_total_size(MALLOC_CAP_SPIRAM) == 0) {
+        buffer_size = OTA_BUFFER_SIZE_INTERNAL;
+        buffer_count = OTA_BUFFER_COUNT_INTERNAL;
+        caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    }
+
+    OtaWriter writer;
+    mbedtls_sha256_init(&writer.sha256);
+    mbedtls_sha256_starts(&writer.sha256, 0);
+    writer.free_queue = xQueueCreate(buffer_count, sizeof(char*));
+    writer.full_queue = xQueueCreate(buffer_count + 1, sizeof(OtaChunk));
+    writer.done = xSemaphoreCreateBinary();
+    std::vector<char*> buffers;
+    for (int i = 0; i < buffer_count; i++) {
+        auto buffer = (char*)heap_caps_malloc(buffer_size, caps);
+        if (buffer == nullptr) {
+            break;
+        }
+        buffers.push_back(buffer);
+        xQueueSend(writer.free_queue, &buffer, 0);
     }
 
-    char buffer[512];
+    bool writer_started = false;
+    bool success = false;
     size_t total_read = 0, recent_read = 0;
+    int64_t flash_stall_us = 0;
     auto last_calc_time = esp_timer_get_time();
-    while (true) {
-        int ret = http->Read(buffer, sizeof(buffer));
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
-            return;
+    while (!buffers.empty()) {
+        char* data;
+        auto start_time = esp_timer_get_time();
+        xQueueReceive(writer.free_queue, &data, portMAX_DELAY);
+        flash_stall_us += esp_timer_get_time() - start_time;
+        if (writer.err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(writer.err));
+            break;
         }
 
-        // Calculate speed and progress every second
-        recent_read += ret;
-        total_read += ret;
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || ret == 0) {
-            size_t progress = total_read * 100 / content_length;
-            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %uB/s", progress, total_read, content_length, recent_read);
-            if (upgrade_callback_) {
-                upgrade_callback_(progress, recent_read);
+        // 填满一个缓冲区再交给写入任务
+        size_t length = 0;
+        bool eof = false, failed = false;
+        int attempts = 0;
+        while (length < buffer_size) {
+            if (!http) {
+                if (++attempts > OTA_MAX_RESUME_ATTEMPTS) {
+                    ESP_LOGE(TAG, "Giving up the firmware download after %d attempts", OTA_MAX_RESUME_ATTEMPTS);
+                    failed = true;
+                    break;
+                }
+                vTaskDelay(pdMS_TO_TICKS(OTA_RESUME_DELAY_MS));
+                http = OpenFirmware(firmware_url, total_read, content_length);
+                continue;
+            }
+
+            int ret = http->Read(data + length, buffer_size - length);
+            // 数据没收完连接就结束了，也按断线处理
+            if (ret < 0 || (ret == 0 && total_read < content_length)) {
+                ESP_LOGW(TAG, "Firmware download interrupted at %u/%u, ret: %d", total_read, content_length, ret);
+                http.reset();
+                continue;
+            }
+            eof = (ret == 0);
+            length += ret;
+            if (ret > 0) {
+                attempts = 0;
             }
-            last_calc_time = esp_timer_get_time();
-            recent_read = 0;
-        }
 
-        if (ret == 0) {
+            // Calculate speed and progress every second
+            recent_read += ret;
+            total_read += ret;
+            if (esp_timer_get_time() - last_calc_time >= 1000000 || eof) {
+                OtaProgress progress = {
+                    .progress = (int)(total_read * 100 / content_length),
+                    .speed = recent_read,
+                    .network_stall_ms = writer.network_stall_us / 1000,
+                    .flash_stall_ms = flash_stall_us / 1000,
+                };
+                ESP_LOGI(TAG, "Progress: %d%% (%u/%u), Speed: %uB/s, Stall: network %lldms, flash %lldms",
+                    progress.progress, total_read, content_length, recent_read, progress.network_stall_ms, progress.flash_stall_ms);
+                if (upgrade_callback_) {
+                    upgrade_callback_(progress);
+                }
+                last_calc_time = esp_timer_get_time();
+                recent_read = 0;
+            }
+            if (eof) {
+                break;
+            }
+        }
+        if (failed) {
             break;
         }
 
-        if (!image_header_checked) {
-            image_header.append(buffer, ret);
-            if (image_header.size() >= sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
-                esp_app_desc_t new_app_info;
-                memcpy(&new_app_info, image_header.data() + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
-                ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
-
-                auto current_version = esp_app_get_description()->version;
-                if (memcmp(new_app_info.version, current_version, sizeof(new_app_info.version)) == 0) {
-                    ESP_LOGE(TAG, "Firmware version is the same, skipping upgrade");
-                    return;
+        if (!writer_started && length > 0) {
+            // 补丁不是固件镜像，版本由服务器按 from 字段匹配过
+            bool compressed = !patch && IsZlibStream((const uint8_t*)data, length);
+            if (!patch && !compressed && !OtaCheckImageHeader((const uint8_t*)data, length)) {
+                break;
+            }
+            if (compressed) {
+                writer.inflator = (tinfl_decompressor*)heap_caps_malloc(sizeof(tinfl_decompressor), caps);
+                writer.window = (uint8_t*)heap_caps_malloc(TINFL_LZ_DICT_SIZE, caps);
+                if (writer.inflator == nullptr || writer.window == nullptr) {
+                    ESP_LOGE(TAG, "Failed to allocate the decompressor");
+                    break;
                 }
+                tinfl_init(writer.inflator);
+                ESP_LOGI(TAG, "Firmware is zlib compressed");
+            }
 
-                if (esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle)) {
+            // The flash calls of the downloading task go through the internal stack, the write task has one
+            esp_err_t err;
+            TaskTopology::RunOnInternalStack([&]() {
+                err = esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle);
+                if (err != ESP_OK) {
                     esp_ota_abort(update_handle);
-                    ESP_LOGE(TAG, "Failed to begin OTA");
-                    return;
                 }
+            });
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to begin OTA");
+                break;
+            }
 
-                image_header_checked = true;
-                std::string().swap(image_header);
+            if (patch) {
+                esp_delta_ota_cfg_t cfg = {
+                    .user_data = &writer,
+                    .read_cb = OtaReadSource,
+                    .write_cb = OtaWriteImage,
+                };
+                writer.patch = esp_delta_ota_init(&cfg);
+                if (writer.patch == nullptr) {
+                    TaskTopology::RunOnInternalStack([&]() {
+                        esp_ota_abort(update_handle);
+                    });
+                    ESP_LOGE(TAG, "Failed to initialize delta OTA");
+                    break;
+                }
             }
+
+            writer.handle = update_handle;
+            xTaskCreate(OtaWriteTask, "ota_write", OTA_WRITE_TASK_STACK_SIZE, &writer, uxTaskPriorityGet(NULL), NULL);
+            writer_started = true;
         }
-        auto err = esp_ota_write(update_handle, buffer, ret);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
-            esp_ota_abort(update_handle);
-            return;
+
+        if (length > 0) {
+            OtaChunk chunk = { data, length };
+            xQueueSend(writer.full_queue, &chunk, portMAX_DELAY);
+        } else {
+            xQueueSend(writer.free_queue, &data, 0);
+        }
+        if (eof) {
+            success = true;
+            break;
         }
     }
-    http->Close();
 
-    esp_err_t err = esp_ota_end(update_handle);
-    if (err != ESP_OK) {
-        if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
-            ESP_LOGE(TAG, "Image validation failed, image is corrupted");
-        } else {
-            ESP_LOGE(TAG, "Failed to end OTA: %s", esp_err_to_name(err));
+    if (writer_started) {
+        // 等写入任务写完排队的数据
+        OtaChunk end = { nullptr, 0 };
+        xQueueSend(writer.full_queue, &end, portMAX_DELAY);
+        xSemaphoreTake(writer.done, portMAX_DELAY);
+        if (writer.patch) {
+            if (success && writer.err == ESP_OK) {
+                TaskTopology::RunOnInternalStack([&]() {
+                    writer.err = esp_delta_ota_finalize(writer.patch);
+                });
+            }
+            esp_delta_ota_deinit(writer.patch);
         }
+        if (success && writer.inflator && writer.err == ESP_OK && !writer.inflated) {
+            ESP_LOGE(TAG, "Compressed firmware is truncated");
+            success = false;
+        }
+        if (writer.err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(writer.err));
+            success = false;
+        }
+        if (success && !firmware_sha256_.empty()) {
+            unsigned char hash[32];
+            mbedtls_sha256_finish(&writer.sha256, hash);
+            char hex[65];
+            for (int i = 0; i < 32; i++) {
+                snprintf(hex + i * 2, 3, "%02x", hash[i]);
+            }
+            if (strcasecmp(hex, firmware_sha256_.c_str()) != 0) {
+                ESP_LOGE(TAG, "Firmware SHA-256 mismatch: %s", hex);
+                success = false;
+            }
+        }
+        if (!success) {
+            TaskTopology::RunOnInternalStack([&]() {
+                esp_ota_abort(update_handle);
+            });
+        }
+    } else if (buffers.empty()) {
+        ESP_LOGE(TAG, "Failed to allocate OTA buffers");
+    }
+
+    mbedtls_sha256_free(&writer.sha256);
+    heap_caps_free(writer.inflator);
+    heap_caps_free(writer.window);
+    for (auto buffer : buffers) {
+        heap_caps_free(buffer);
+    }
+    vQueueDelete(writer.free_queue);
+    vQueueDelete(writer.full_queue);
+    vSemaphoreDelete(writer.done);
+    return success && writer_started;
+}
+
+void Ota::Upgrade(const std::string& firmware_url) {
+    ESP_LOGI(TAG, "Upgrading firmware from %s", firmware_url.c_str());
+#if CONFIG_USE_POWER_GOVERNOR
+    // TLS, inflating and flash writes, the download would otherwise crawl at the minimum clock
+    PowerDemandScope power_demand(kPowerDemandOta);
+#endif
+    esp_ota_handle_t update_handle = 0;
+    auto update_partition = esp_ota_get_next_update_partition(NULL);
+    if (update_partition == NULL) {
+        ESP_LOGE(TAG, "Failed to get update partition");
+        return;
+    }
+
+    ESP_LOGI(TAG, "Writing to partition %s at offset 0x%lx", update_partition->label, update_partition->address);
+    // 补丁失败时退回下载完整固件
+    bool downloaded = false;
+    if (!firmware_patch_url_.empty()) {
+        ESP_LOGI(TAG, "Downloading delta patch from %s", firmware_patch_url_.c_str());
+        downloaded = Download(firmware_patch_url_, true, update_partition, update_handle);
+        if (!downloaded) {
+            ESP_LOGW(TAG, "Delta patch failed, downloading the full firmware");
+        }
+    }
+    if (!downloaded && !Download(firmware_url, false, update_partition, update_handle)) {
         return;
     }
 
-    err = esp_ota_set_boot_partition(update_partition);
+    esp_err_t err;
+    TaskTopology::RunOnInternalStack([&]() {
+        err = esp_ota_end(update_handle);
+        if (err == ESP_OK) {
+            err = esp_ota_set_boot_partition(update_partition);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to set boot partition: %s", esp_err_to_name(err));
+            }
+        } else if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
+            ESP_LOGE(TAG, "Image validation failed, image is corrupted");
+        } else {
+            ESP_LOGE(TAG, "Failed to end OTA: %s", esp_err_to_name(err));
+        }
+    });
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to set boot partition: %s", esp_err_to_name(err));
         return;
     }
 
     ESP_LOGI(TAG, "Firmware upgrade successful, rebooting in 3 seconds...");
     vTaskDelay(pdMS_TO_TICKS(3000));
-    esp_restart();
+    // The shutdown handlers commit the settings
+    TaskTopology::RunOnInternalStack([]() {
+        esp_restart();
+    });
 }
 
-void Ota::StartUpgrade(std::function<void(int progress, size_t speed)> callback) {
+void Ota::StartUpgrade(std::function<void(const OtaProgress& progress)> callback) {
     upgrade_callback_ = callback;
     Upgrade(firmware_url_);
 }
@@ -452,10 +931,17 @@ esp_err_t Ota::Activate() {
     }
 
     auto http = std::unique_ptr<Http>(SetupHttp());
+    if (activation_long_poll_ms_ > 0) {
+        // 服务器在用户输入验证码时立即响应，不再固定间隔轮询
+        http->SetHeader("Activation-Wait-Ms", std::to_string(activation_long_poll_ms_));
+        http->SetTimeout(activation_long_poll_ms_ + OTA_ACTIVATION_HTTP_MARGIN_MS);
+    }
 
     std::string data = GetActivationPayload();
     http->SetContent(std::move(data));
 
+    activation_long_polled_ = false;
+    int64_t start_us = esp_timer_get_time();
     if (!http->Open("POST", url)) {
         ESP_LOGE(TAG, "Failed to open HTTP connection");
         return ESP_FAIL;
@@ -463,6 +949,9 @@ esp_err_t Ota::Activate() {
     
     auto status_code = http->GetStatusCode();
     if (status_code == 202) {
+        // A server that ignored the header answers at once, the caller then waits before the next poll
+        int64_t waited_ms = (esp_timer_get_time() - start_us) / 1000;
+        activation_long_polled_ = activation_long_poll_ms_ > 0 && waited_ms >= activation_long_poll_ms_ / 2;
         return ESP_ERR_TIMEOUT;
     }
     if (status_code != 200) {
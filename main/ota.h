@@ -2,31 +2,65 @@
 #define _OTA_H
 
 #include <functional>
+#include <memory>
 #include <string>
 
 #include <esp_err.h>
+#include <esp_ota_ops.h>
 #include "board.h"
 
+// 下载缓冲区，有 PSRAM 时使用大缓冲区
+#define OTA_BUFFER_SIZE (32 * 1024)
+#define OTA_BUFFER_COUNT 3
+#define OTA_BUFFER_SIZE_INTERNAL (4 * 1024)
+#define OTA_BUFFER_COUNT_INTERNAL 2
+#define OTA_WRITE_TASK_STACK_SIZE 4096
+// 连接中断后用 Range 请求续传，连续失败这么多次才放弃
+#define OTA_MAX_RESUME_ATTEMPTS 5
+#define OTA_RESUME_DELAY_MS 3000
+// 检查版本的响应缓存在 NVS 中，系统时间有效时这段时间内不再请求服务器
+#define OTA_CHECK_CACHE_TTL_SECONDS (6 * 3600)
+#define OTA_CHECK_CACHE_MAX_SIZE 3072
+// 服务器支持长轮询时，激活请求最多挂起这么久，用户输入验证码后立即返回
+#define OTA_ACTIVATION_MAX_LONG_POLL_MS 60000
+// 超时时间在长轮询时长之外留给网络的余量
+#define OTA_ACTIVATION_HTTP_MARGIN_MS 10000
+
+struct OtaProgress {
+    int progress;               // 百分比
+    size_t speed;               // 最近一秒下载的字节数
+    int64_t network_stall_ms;   // 写入任务等待网络数据的总时间
+    int64_t flash_stall_ms;     // 下载等待 Flash 写入的总时间
+};
+
 class Ota {
 public:
     Ota();
     ~Ota();
 
     bool CheckVersion();
+    bool IsCheckResultFresh();
+    // ESP_ERR_TIMEOUT while the user has not entered the code yet
     esp_err_t Activate();
+    // The last Activate() waited on the server for the code, the next one may follow right away
+    bool ActivationLongPolled() { return activation_long_polled_; }
     bool HasActivationChallenge() { return has_activation_challenge_; }
     bool HasNewVersion() { return has_new_version_; }
     bool HasMqttConfig() { return has_mqtt_config_; }
     bool HasWebsocketConfig() { return has_websocket_config_; }
+    bool HasUdpConfig() { return has_udp_config_; }
     bool HasActivationCode() { return has_activation_code_; }
     bool HasServerTime() { return has_server_time_; }
-    void StartUpgrade(std::function<void(int progress, size_t speed)> callback);
+    void StartUpgrade(std::function<void(const OtaProgress& progress)> callback);
     void MarkCurrentVersionValid();
 
     const std::string& GetFirmwareVersion() const { return firmware_version_; }
     const std::string& GetCurrentVersion() const { return current_version_; }
     const std::string& GetActivationMessage() const { return activation_message_; }
     const std::string& GetActivationCode() const { return activation_code_; }
+    // The custom prompts image the server offers, empty if none
+    const std::string& GetPromptsUrl() const { return prompts_url_; }
+    const std::string& GetPromptsVersion() const { return prompts_version_; }
     std::string GetCheckVersionUrl();
 
 private:
@@ -35,19 +69,31 @@ private:
     bool has_new_version_ = false;
     bool has_mqtt_config_ = false;
     bool has_websocket_config_ = false;
+    bool has_udp_config_ = false;
     bool has_server_time_ = false;
     bool has_activation_code_ = false;
+    bool check_result_cached_ = false;
     bool has_serial_number_ = false;
     bool has_activation_challenge_ = false;
     std::string current_version_;
     std::string firmware_version_;
     std::string firmware_url_;
+    std::string firmware_sha256_;
+    std::string firmware_patch_url_;
+    std::string prompts_url_;
+    std::string prompts_version_;
     std::string activation_challenge_;
     std::string serial_number_;
     int activation_timeout_ms_ = 30000;
+    // 0 if the server answers the activation at once
+    int activation_long_poll_ms_ = 0;
+    bool activation_long_polled_ = false;
 
     void Upgrade(const std::string& firmware_url);
-    std::function<void(int progress, size_t speed)> upgrade_callback_;
+    void SaveCheckResult(const std::string& data, const std::string& etag);
+    bool Download(const std::string& firmware_url, bool patch, const esp_partition_t* update_partition, esp_ota_handle_t& update_handle);
+    std::unique_ptr<Http> OpenFirmware(const std::string& firmware_url, size_t offset, size_t& content_length);
+    std::function<void(const OtaProgress& progress)> upgrade_callback_;
     std::vector<int> ParseVersion(const std::string& version);
     bool IsNewVersionAvailable(const std::string& currentVersion, const std::string& newVersion);
     std::string GetActivationPayload();
@@ -0,0 +1,163 @@
+#include "pipeline_trace.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#define TAG "PipelineTrace"
+
+static void PutLe16(uint8_t* p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void PutLe32(uint8_t* p, uint32_t v) {
+    PutLe16(p, v & 0xffff);
+    PutLe16(p + 2, v >> 16);
+}
+
+void PipelineTrace::Start() {
+    if (running_) {
+        return;
+    }
+    // 解析配置的服务器地址 "IP:PORT"
+    std::string server_addr = CONFIG_PIPELINE_TRACE_UDP_SERVER;
+    size_t colon_pos = server_addr.find(':');
+    if (colon_pos == std::string::npos) {
+        ESP_LOGW(TAG, "Invalid server address: %s, should be IP:PORT", CONFIG_PIPELINE_TRACE_UDP_SERVER);
+        return;
+    }
+    server_addr_.sin_family = AF_INET;
+    server_addr_.sin_port = htons(std::stoi(server_addr.substr(colon_pos + 1)));
+    inet_pton(AF_INET, server_addr.substr(0, colon_pos).c_str(), &server_addr_.sin_addr);
+
+    sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd_ < 0) {
+        ESP_LOGW(TAG, "Failed to create UDP socket: %d", errno);
+        return;
+    }
+    ring_ = (Record*)heap_caps_malloc(PIPELINE_TRACE_RING_SIZE * sizeof(Record), MALLOC_CAP_SPIRAM);
+    if (ring_ == nullptr) {
+        ring_ = (Record*)heap_caps_malloc(PIPELINE_TRACE_RING_SIZE * sizeof(Record), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (ring_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the event ring");
+        close(sockfd_);
+        sockfd_ = -1;
+        return;
+    }
+    running_ = true;
+    xTaskCreate([](void* arg) {
+        static_cast<PipelineTrace*>(arg)->SenderLoop();
+    }, "pipeline_trace", PIPELINE_TRACE_SENDER_STACK_SIZE, this, 1, nullptr);
+    ESP_LOGI(TAG, "Sending pipeline events to %s", CONFIG_PIPELINE_TRACE_UDP_SERVER);
+}
+
+void PipelineTrace::Emit(uint8_t event, PipelinePhase phase, uint32_t arg) {
+    if (!running_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    Record record;
+    record.time_us = (uint32_t)esp_timer_get_time();
+    record.task = (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+    record.arg = arg;
+    record.event = event;
+    record.phase = phase;
+    record.core = xPortGetCoreID();
+    record.reserved = 0;
+
+    portENTER_CRITICAL(&lock_);
+    if (head_ - tail_ < PIPELINE_TRACE_RING_SIZE) {
+        ring_[head_ % PIPELINE_TRACE_RING_SIZE] = record;
+        head_++;
+    } else {
+        dropped_++;
+    }
+    portEXIT_CRITICAL(&lock_);
+}
+
+void PipelineTrace::SenderLoop() {
+    // Only this task sends, it owns datagram_ and the task table
+    auto tasks = (TaskStatus_t*)heap_caps_malloc(PIPELINE_TRACE_MAX_TASKS * sizeof(TaskStatus_t), MALLOC_CAP_SPIRAM);
+    if (tasks == nullptr) {
+        tasks = (TaskStatus_t*)malloc(PIPELINE_TRACE_MAX_TASKS * sizeof(TaskStatus_t));
+    }
+    int64_t last_names_us = 0;
+    while (true) {
+        int64_t now = esp_timer_get_time();
+        if (tasks != nullptr && now - last_names_us >= PIPELINE_TRACE_NAMES_MS * 1000LL) {
+            SendTaskNames(tasks);
+            last_names_us = now;
+        }
+        SendEvents();
+        vTaskDelay(pdMS_TO_TICKS(PIPELINE_TRACE_FLUSH_MS));
+    }
+}
+
+size_t PipelineTrace::PutHeader(uint8_t type, uint16_t count) {
+    uint64_t time_us = esp_timer_get_time();
+    uint32_t dropped;
+    portENTER_CRITICAL(&lock_);
+    dropped = dropped_;
+    portEXIT_CRITICAL(&lock_);
+    datagram_[0] = 'P';
+    datagram_[1] = 'T';
+    datagram_[2] = PIPELINE_TRACE_VERSION;
+    datagram_[3] = type;
+    PutLe32(datagram_ + 4, sequence_++);
+    PutLe32(datagram_ + 8, time_us & 0xffffffff);
+    PutLe32(datagram_ + 12, time_us >> 32);
+    PutLe32(datagram_ + 16, dropped);
+    PutLe16(datagram_ + 20, count);
+    PutLe16(datagram_ + 22, 0);
+    return PIPELINE_TRACE_HEADER_SIZE;
+}
+
+void PipelineTrace::SendEvents() {
+    const size_t max_records = (PIPELINE_TRACE_MAX_DATAGRAM - PIPELINE_TRACE_HEADER_SIZE) / PIPELINE_TRACE_RECORD_SIZE;
+    while (true) {
+        // Copied out under the lock in one go, the emitting tasks never wait for the socket
+        Record* records = (Record*)(datagram_ + PIPELINE_TRACE_HEADER_SIZE);
+        size_t count = 0;
+        portENTER_CRITICAL(&lock_);
+        while (count < max_records && tail_ != head_) {
+            records[count++] = ring_[tail_ % PIPELINE_TRACE_RING_SIZE];
+            tail_++;
+        }
+        portEXIT_CRITICAL(&lock_);
+        if (count == 0) {
+            return;
+        }
+        // The header comes last so its time is after every event in the datagram, the host unwraps the times with it
+        PutHeader(0, count);
+        size_t size = PIPELINE_TRACE_HEADER_SIZE + count * PIPELINE_TRACE_RECORD_SIZE;
+        if (sendto(sockfd_, datagram_, size, 0, (struct sockaddr*)&server_addr_, sizeof(server_addr_)) < 0) {
+            ESP_LOGD(TAG, "Failed to send events to %s: %d", CONFIG_PIPELINE_TRACE_UDP_SERVER, errno);
+        }
+    }
+}
+
+void PipelineTrace::SendTaskNames(TaskStatus_t* tasks) {
+    UBaseType_t count = uxTaskGetSystemState(tasks, PIPELINE_TRACE_MAX_TASKS, nullptr);
+    const size_t max_names = (PIPELINE_TRACE_MAX_DATAGRAM - PIPELINE_TRACE_HEADER_SIZE) / PIPELINE_TRACE_NAME_SIZE;
+    for (UBaseType_t first = 0; first < count; first += max_names) {
+        size_t n = std::min<size_t>(max_names, count - first);
+        uint8_t* entry = datagram_ + PIPELINE_TRACE_HEADER_SIZE;
+        for (size_t i = 0; i < n; i++, entry += PIPELINE_TRACE_NAME_SIZE) {
+            auto& task = tasks[first + i];
+            PutLe32(entry, (uint32_t)(uintptr_t)task.xHandle);
+            memset(entry + 4, 0, PIPELINE_TRACE_NAME_SIZE - 4);
+            strncpy((char*)entry + 4, task.pcTaskName, PIPELINE_TRACE_NAME_SIZE - 5);
+        }
+        PutHeader(1, n);
+        sendto(sockfd_, datagram_, PIPELINE_TRACE_HEADER_SIZE + n * PIPELINE_TRACE_NAME_SIZE, 0,
+            (struct sockaddr*)&server_addr_, sizeof(server_addr_));
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef PIPELINE_TRACE_H
+#define PIPELINE_TRACE_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define PIPELINE_TRACE_VERSION 1
+// Events waiting for the sender task, when it is full new ones are dropped and counted
+#define PIPELINE_TRACE_RING_SIZE 1024
+#define PIPELINE_TRACE_FLUSH_MS 50
+// The task names are sent this often, the host maps the task handles of the events with them
+#define PIPELINE_TRACE_NAMES_MS 2000
+#define PIPELINE_TRACE_MAX_TASKS 48
+#define PIPELINE_TRACE_MAX_DATAGRAM 1400
+#define PIPELINE_TRACE_HEADER_SIZE 24
+#define PIPELINE_TRACE_RECORD_SIZE 16
+#define PIPELINE_TRACE_NAME_SIZE 20
+#define PIPELINE_TRACE_SENDER_STACK_SIZE 4096
+
+// The latency stages are events too, with their LatencyStage number. These come after them
+enum PipelineEvent : uint8_t {
+    kPipelineEventAudioReceive = 32,    // arg: payload bytes
+    kPipelineEventJsonSend,             // arg: text bytes
+    kPipelineEventJsonReceive,
+    kPipelineEventDisplayFlush,         // flush_cb, the start of a transfer to the panel
+    kPipelineEventDisplayWait,          // LVGL waiting for the panel to hand a buffer back
+    kPipelineEventMcpCall,              // arg: JSON-RPC id of the tools/call
+};
+
+enum PipelinePhase : uint8_t {
+    kPipelinePhaseBegin,
+    kPipelinePhaseEnd,
+    kPipelinePhaseInstant,
+};
+
+/*
+ * Timeline of the pipeline for offline analysis, where the aggregated stats
+ * of LatencyTracer cannot show which subsystem got in the way of which.
+ *
+ * Every event is a 16 byte record: the low 32 bits of esp_timer, the task
+ * handle, the core, the event, begin/end/instant and an argument. Emit()
+ * takes a spinlock for the copy into a fixed ring and never waits, a low
+ * priority task sends the ring every PIPELINE_TRACE_FLUSH_MS over UDP and
+ * the task names every PIPELINE_TRACE_NAMES_MS. Datagrams start with 'PT',
+ * the version, the type (0 events, 1 task names), a sequence number, the
+ * full esp_timer time of the datagram, the events dropped so far and the
+ * number of entries. scripts/pipeline_trace.py receives them and writes a
+ * Chrome trace for Perfetto, one track per task.
+ *
+ * SEGGER SystemView over esp_app_trace needs JTAG attached to the board,
+ * this works over the same Wi-Fi as the audio debugger.
+ */
+class PipelineTrace {
+public:
+    static PipelineTrace& GetInstance() {
+        static PipelineTrace instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    PipelineTrace(const PipelineTrace&) = delete;
+    PipelineTrace& operator=(const PipelineTrace&) = delete;
+
+    void Start();
+    // Safe to call from any task, not from an ISR. Dropped before Start()
+    void Emit(uint8_t event, PipelinePhase phase, uint32_t arg = 0);
+
+private:
+    PipelineTrace() = default;
+
+    struct Record {
+        uint32_t time_us;
+        uint32_t task;
+        uint32_t arg;
+        uint8_t event;
+        uint8_t phase;
+        uint8_t core;
+        uint8_t reserved;
+    };
+    static_assert(sizeof(Record) == PIPELINE_TRACE_RECORD_SIZE, "Record is sent as is");
+
+    std::atomic<bool> running_ = false;
+    portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;
+    Record* ring_ = nullptr;
+    uint32_t head_ = 0;
+    uint32_t tail_ = 0;
+    uint32_t dropped_ = 0;
+
+    int sockfd_ = -1;
+    struct sockaddr_in server_addr_ = {};
+    uint32_t sequence_ = 0;
+    alignas(4) uint8_t datagram_[PIPELINE_TRACE_MAX_DATAGRAM];
+
+    void SenderLoop();
+    void SendEvents();
+    void SendTaskNames(TaskStatus_t* tasks);
+    size_t PutHeader(uint8_t type, uint16_t count);
+};
+
+#endif // PIPELINE_TRACE_H
@@ -0,0 +1,152 @@
+#include "playout_clock.h"
+#include "audio_codec.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+
+#define TAG "PlayoutClock"
+
+// A write taking longer than this waited for DMA space
+#define OUTPUT_BLOCKED_US 2000
+// Drift is only reported after this much continuous audio
+#define DRIFT_MIN_AUDIO_US 2000000
+
+void PlayoutClock::DriftMeter::Update(int64_t now, bool continuous) {
+    if (!continuous || run_start_us == 0) {
+        run_start_us = now;
+        run_audio_us = audio_us;
+        return;
+    }
+    int64_t audio = audio_us - run_audio_us;
+    if (audio >= DRIFT_MIN_AUDIO_US) {
+        ppm = (now - run_start_us - audio) * 1000000 / audio;
+    }
+}
+
+void PlayoutClock::OnOutputFrame(uint32_t timestamp, size_t samples, int sample_rate) {
+    if (sample_rate <= 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = esp_timer_get_time();
+    dma_buffer_us_ = (int64_t)AUDIO_CODEC_DMA_DESC_NUM * AUDIO_CODEC_DMA_FRAME_NUM * 1000000 / sample_rate;
+
+    auto& segment = segments_[(segment_head_ + segment_count_) % PLAYOUT_CLOCK_SEGMENTS];
+    if (segment_count_ == PLAYOUT_CLOCK_SEGMENTS) {
+        segment_head_ = (segment_head_ + 1) % PLAYOUT_CLOCK_SEGMENTS;
+    } else {
+        segment_count_++;
+    }
+    // The frame plays once everything queued before it has played, or right away after an underrun
+    segment.start_us = std::max(now, output_end_us_);
+    segment.duration_us = (int64_t)samples * 1000000 / sample_rate;
+    segment.timestamp = timestamp;
+    output_end_us_ = segment.start_us + segment.duration_us;
+    output_drift_.audio_us += segment.duration_us;
+    write_begin_us_ = now;
+}
+
+void PlayoutClock::OnOutputWritten() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = esp_timer_get_time();
+    bool blocked = now - write_begin_us_ > OUTPUT_BLOCKED_US;
+    if (blocked) {
+        // The DMA was full when the write returned, so its queue ends one DMA buffer from now
+        int64_t measured_end = now + dma_buffer_us_;
+        output_end_us_ -= (output_end_us_ - measured_end) / 8;
+    }
+    output_drift_.Update(now, blocked);
+}
+
+void PlayoutClock::OnInputCaptured(size_t samples, int sample_rate) {
+    if (sample_rate <= 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = esp_timer_get_time();
+    int64_t duration_us = (int64_t)samples * 1000000 / sample_rate;
+    input_sample_rate_ = sample_rate;
+
+    // A read returns once its last sample is in, unless older samples were already waiting in the DMA
+    int64_t predicted_end = capture_end_us_ + duration_us;
+    bool continuous = capture_end_us_ != 0 && now - predicted_end < duration_us;
+    int64_t end = continuous ? std::min(now, predicted_end + (now - predicted_end) / 8) : now;
+    capture_end_us_ = end;
+    input_drift_.audio_us += duration_us;
+    input_drift_.Update(now, continuous);
+
+    auto& capture = captures_[(capture_head_ + capture_count_) % PLAYOUT_CLOCK_CAPTURES];
+    if (capture_count_ == PLAYOUT_CLOCK_CAPTURES) {
+        capture_head_ = (capture_head_ + 1) % PLAYOUT_CLOCK_CAPTURES;
+    } else {
+        capture_count_++;
+    }
+    capture.position = input_position_;
+    capture.start_us = end - duration_us;
+    input_position_ += samples;
+}
+
+uint64_t PlayoutClock::AdvanceUplink(size_t samples) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t position = uplink_position_;
+    uplink_position_ += samples;
+    return position;
+}
+
+uint32_t PlayoutClock::GetPlayoutTimestamp(uint64_t input_position) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Find the read holding this sample, the newest with a position not after it
+    const Capture* capture = nullptr;
+    for (size_t i = capture_count_; i > 0; i--) {
+        auto& candidate = captures_[(capture_head_ + i - 1) % PLAYOUT_CLOCK_CAPTURES];
+        if (candidate.position <= input_position) {
+            capture = &candidate;
+            break;
+        }
+    }
+    if (capture == nullptr) {
+        stats_.untagged_frames++;
+        return 0;
+    }
+    int64_t capture_us = capture->start_us + (int64_t)(input_position - capture->position) * 1000000 / input_sample_rate_;
+
+    for (size_t i = segment_count_; i > 0; i--) {
+        auto& segment = segments_[(segment_head_ + i - 1) % PLAYOUT_CLOCK_SEGMENTS];
+        if (segment.start_us <= capture_us) {
+            int64_t offset_us = capture_us - segment.start_us;
+            if (offset_us >= segment.duration_us || segment.timestamp == 0) {
+                break;  // Nothing with a timestamp was playing
+            }
+            stats_.tagged_frames++;
+            return segment.timestamp + offset_us / 1000;
+        }
+    }
+    stats_.untagged_frames++;
+    return 0;
+}
+
+void PlayoutClock::ResetOutput() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    segment_count_ = 0;
+    segment_head_ = 0;
+    output_end_us_ = 0;
+    output_drift_.run_start_us = 0;
+}
+
+void PlayoutClock::ResetInput() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capture_count_ = 0;
+    capture_head_ = 0;
+    input_position_ = 0;
+    uplink_position_ = 0;
+    capture_end_us_ = 0;
+    input_drift_.run_start_us = 0;
+}
+
+PlayoutClockStats PlayoutClock::GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.output_drift_ppm = output_drift_.ppm;
+    stats_.input_drift_ppm = input_drift_.ppm;
+    return stats_;
+}
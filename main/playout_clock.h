@@ -0,0 +1,99 @@
+#ifndef PLAYOUT_CLOCK_H
+#define PLAYOUT_CLOCK_H
+
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+// Decoded frames and microphone reads remembered for the lookup, about two seconds each
+#define PLAYOUT_CLOCK_SEGMENTS 48
+#define PLAYOUT_CLOCK_CAPTURES 64
+
+struct PlayoutClockStats {
+    int32_t output_drift_ppm = 0;   // Speaker clock against esp_timer
+    int32_t input_drift_ppm = 0;    // Microphone clock against esp_timer
+    uint32_t tagged_frames = 0;     // Uplink frames captured while a timestamped frame was playing
+    uint32_t untagged_frames = 0;
+};
+
+/*
+ * Maps microphone samples to the server timestamp of the audio that was
+ * playing through the speaker when they were captured, for server-side AEC.
+ *
+ * Output side: each decoded frame gets the time it reaches the speaker,
+ * which is right after the frames already queued before it. A write that
+ * blocked means the TX DMA is full, so the end of the queue is known to
+ * be one DMA buffer ahead and the estimate is pulled towards it; this
+ * keeps the clock aligned with the real I2S rate over long replies.
+ *
+ * Input side: every read records the capture time of its first sample,
+ * counted in samples since the audio processor started. Uplink frames
+ * are looked up by the position of their first sample, so frames dropped
+ * or buffered by the encoder do not shift the pairing.
+ *
+ * Both sides also measure their sample clock against esp_timer while
+ * running continuously and report the drift in ppm.
+ */
+class PlayoutClock {
+public:
+    PlayoutClock() = default;
+
+    // Output thread, around the codec write of one decoded frame
+    void OnOutputFrame(uint32_t timestamp, size_t samples, int sample_rate);
+    void OnOutputWritten();
+
+    // Capture thread, after the samples fed to the audio processor were read
+    void OnInputCaptured(size_t samples, int sample_rate);
+    // Audio processor output: returns the input position of the next `samples` and advances it
+    uint64_t AdvanceUplink(size_t samples);
+
+    // Server timestamp of the audio playing when the sample at `input_position` was captured, 0 if none
+    uint32_t GetPlayoutTimestamp(uint64_t input_position);
+
+    void ResetOutput();
+    void ResetInput();
+    PlayoutClockStats GetStats();
+
+private:
+    struct Segment {
+        int64_t start_us = 0;
+        int64_t duration_us = 0;
+        uint32_t timestamp = 0;
+    };
+
+    struct Capture {
+        uint64_t position = 0;
+        int64_t start_us = 0;
+    };
+
+    struct DriftMeter {
+        int64_t run_start_us = 0;
+        int64_t run_audio_us = 0;
+        int64_t audio_us = 0;
+        int32_t ppm = 0;
+
+        void Update(int64_t now, bool continuous);
+    };
+
+    std::mutex mutex_;
+    Segment segments_[PLAYOUT_CLOCK_SEGMENTS];
+    size_t segment_count_ = 0;
+    size_t segment_head_ = 0;
+    int64_t output_end_us_ = 0;
+    int64_t write_begin_us_ = 0;
+    int64_t dma_buffer_us_ = 0;
+    DriftMeter output_drift_;
+
+    Capture captures_[PLAYOUT_CLOCK_CAPTURES];
+    size_t capture_count_ = 0;
+    size_t capture_head_ = 0;
+    uint64_t input_position_ = 0;
+    uint64_t uplink_position_ = 0;
+    int input_sample_rate_ = 16000;
+    int64_t capture_end_us_ = 0;
+    DriftMeter input_drift_;
+
+    PlayoutClockStats stats_;
+};
+
+#endif // PLAYOUT_CLOCK_H
@@ -0,0 +1,99 @@
+#include "power_governor.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+
+#define TAG "PowerGovernor"
+
+PowerGovernor::PowerGovernor() {
+    for (int i = 0; i < kPowerDemandCount; i++) {
+        auto name = GetDemandName((PowerDemand)i);
+        if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, name, &stages_[i].lock) != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to create the %s lock, power management is disabled", name);
+            stages_[i].lock = nullptr;
+        }
+    }
+    idle_since_us_ = esp_timer_get_time();
+}
+
+PowerGovernor::~PowerGovernor() {
+    for (auto& stage : stages_) {
+        if (stage.lock != nullptr) {
+            if (stage.active) {
+                esp_pm_lock_release(stage.lock);
+            }
+            esp_pm_lock_delete(stage.lock);
+        }
+    }
+}
+
+const char* PowerGovernor::GetDemandName(PowerDemand demand) {
+    static const char* const names[] = {
+        "conversation",
+        "wake_word",
+        "display",
+        "ota",
+    };
+    static_assert(sizeof(names) / sizeof(names[0]) == kPowerDemandCount, "Missing power demand name");
+    return names[demand];
+}
+
+void PowerGovernor::SetDemand(PowerDemand demand, bool active) {
+    auto& stage = stages_[demand];
+    if (stage.active.load(std::memory_order_relaxed) == active) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stage.active == active) {
+        return;
+    }
+    stage.active = active;
+    int64_t now = esp_timer_get_time();
+    if (active) {
+        if (stage.lock != nullptr) {
+            esp_pm_lock_acquire(stage.lock);
+        }
+        stage.since_us = now;
+        stage.count++;
+        if (active_count_++ == 0) {
+            idle_total_us_ += now - idle_since_us_;
+        }
+    } else {
+        if (stage.lock != nullptr) {
+            esp_pm_lock_release(stage.lock);
+        }
+        stage.total_us += now - stage.since_us;
+        if (--active_count_ == 0) {
+            idle_since_us_ = now;
+        }
+    }
+    ESP_LOGD(TAG, "%s %s, %d stage(s) running", GetDemandName(demand), active ? "started" : "stopped", active_count_);
+}
+
+std::string PowerGovernor::GetReportJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = esp_timer_get_time();
+    auto root = cJSON_CreateObject();
+    // Time with no stage running, the CPU was free to run at the minimum clock
+    int64_t idle_us = idle_total_us_ + (active_count_ == 0 ? now - idle_since_us_ : 0);
+    cJSON_AddNumberToObject(root, "min_freq_mhz", POWER_GOVERNOR_MIN_FREQ_MHZ);
+    cJSON_AddNumberToObject(root, "uptime_ms", now / 1000);
+    cJSON_AddNumberToObject(root, "scaled_down_ms", idle_us / 1000);
+    auto stages = cJSON_CreateObject();
+    for (int i = 0; i < kPowerDemandCount; i++) {
+        auto& stage = stages_[i];
+        int64_t total_us = stage.total_us + (stage.active ? now - stage.since_us : 0);
+        auto item = cJSON_CreateObject();
+        cJSON_AddBoolToObject(item, "active", stage.active);
+        cJSON_AddNumberToObject(item, "count", stage.count);
+        cJSON_AddNumberToObject(item, "active_ms", total_us / 1000);
+        cJSON_AddItemToObject(stages, GetDemandName((PowerDemand)i), item);
+    }
+    cJSON_AddItemToObject(root, "stages", stages);
+    auto json = cJSON_PrintUnformatted(root);
+    std::string result(json);
+    cJSON_free(json);
+    cJSON_Delete(root);
+    return result;
+}
@@ -0,0 +1,87 @@
+#ifndef POWER_GOVERNOR_H
+#define POWER_GOVERNOR_H
+
+#include <esp_pm.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+// The CPU clock when no stage needs more, the crystal. Peripherals that need APB hold their own locks
+#define POWER_GOVERNOR_MIN_FREQ_MHZ 40
+
+enum PowerDemand {
+    kPowerDemandConversation,   // Audio processor, Opus encoder and decoder of a conversation
+    kPowerDemandWakeWord,       // WakeNet on every chunk, unless the wake word gate runs it only on voice
+    kPowerDemandDisplay,        // An animation on the screen
+    kPowerDemandOta,            // Firmware download and flash writes
+    kPowerDemandCount
+};
+
+/*
+ * Scales the CPU clock to what the running pipeline stages need, instead of
+ * the fixed clock the power save timer used to set while awake.
+ *
+ * Each stage has an esp_pm CPU_FREQ_MAX lock that it holds while it runs.
+ * The power save timer configures the range POWER_GOVERNOR_MIN_FREQ_MHZ to
+ * its maximum while awake, so with no stage running, e.g. an idle clock
+ * screen, the CPU drops to the crystal clock and goes back up within
+ * microseconds when a stage starts. Drivers keep their own locks, a running
+ * I2S channel or Wi-Fi hold the APB clock on their own.
+ *
+ * Residency is kept per stage and for the time no stage ran at all, for
+ * the self.system.get_metrics report.
+ */
+class PowerGovernor {
+public:
+    static PowerGovernor& GetInstance() {
+        static PowerGovernor instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    PowerGovernor(const PowerGovernor&) = delete;
+    PowerGovernor& operator=(const PowerGovernor&) = delete;
+
+    // Any task, cheap when nothing changes, so it can be called for every audio chunk
+    void SetDemand(PowerDemand demand, bool active);
+    std::string GetReportJson();
+
+    static const char* GetDemandName(PowerDemand demand);
+
+private:
+    PowerGovernor();
+    ~PowerGovernor();
+
+    struct Stage {
+        esp_pm_lock_handle_t lock = nullptr;
+        std::atomic<bool> active = false;
+        int64_t since_us = 0;
+        int64_t total_us = 0;
+        uint32_t count = 0;
+    };
+
+    std::mutex mutex_;
+    Stage stages_[kPowerDemandCount];
+    int active_count_ = 0;
+    int64_t idle_since_us_ = 0;
+    int64_t idle_total_us_ = 0;
+};
+
+// Holds a demand until the end of the enclosing scope
+class PowerDemandScope {
+public:
+    explicit PowerDemandScope(PowerDemand demand) : demand_(demand) {
+        PowerGovernor::GetInstance().SetDemand(demand_, true);
+    }
+    ~PowerDemandScope() {
+        PowerGovernor::GetInstance().SetDemand(demand_, false);
+    }
+    PowerDemandScope(const PowerDemandScope&) = delete;
+    PowerDemandScope& operator=(const PowerDemandScope&) = delete;
+
+private:
+    PowerDemand demand_;
+};
+
+#endif // POWER_GOVERNOR_H
@@ -0,0 +1,62 @@
+#include "prompt_player.h"
+#include "protocol.h"
+
+#include <esp_log.h>
+#include <arpa/inet.h>
+
+#define TAG "PromptPlayer"
+
+PromptPlayer::PromptPlayer(size_t max_prompts) : max_prompts_(max_prompts) {
+}
+
+bool PromptPlayer::Enqueue(std::string_view sound) {
+    if (sound.empty()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (prompts_.size() >= max_prompts_) {
+        ESP_LOGW(TAG, "Too many queued prompts, dropping one");
+        return false;
+    }
+    prompts_.push_back(sound);
+    return true;
+}
+
+bool PromptPlayer::NextFrame(const uint8_t*& data, size_t& size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (true) {
+        if (offset_ + sizeof(BinaryProtocol3) <= current_.size()) {
+            auto p3 = (const BinaryProtocol3*)(current_.data() + offset_);
+            size_t payload_size = ntohs(p3->payload_size);
+            if (offset_ + sizeof(BinaryProtocol3) + payload_size <= current_.size()) {
+                data = p3->payload;
+                size = payload_size;
+                offset_ += sizeof(BinaryProtocol3) + payload_size;
+                return true;
+            }
+            ESP_LOGE(TAG, "Truncated P3 frame at offset %u", offset_);
+        }
+
+        // The current prompt is done, continue with the next one without a gap
+        if (prompts_.empty()) {
+            current_ = {};
+            offset_ = 0;
+            return false;
+        }
+        current_ = prompts_.front();
+        prompts_.pop_front();
+        offset_ = 0;
+    }
+}
+
+void PromptPlayer::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    prompts_.clear();
+    current_ = {};
+    offset_ = 0;
+}
+
+bool PromptPlayer::Empty() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return prompts_.empty() && offset_ >= current_.size();
+}
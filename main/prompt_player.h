@@ -0,0 +1,37 @@
+#ifndef PROMPT_PLAYER_H
+#define PROMPT_PLAYER_H
+
+#include <mutex>
+#include <deque>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Plays P3 sound assets that are embedded in the flash-mapped firmware image.
+ *
+ * Sounds are queued as views of the asset and their frames are handed to the
+ * decoder as pointers into flash, without copying. Queued prompts play back
+ * to back, so a sequence like the activation code digits has no gaps, and
+ * Enqueue() never waits for the previous prompt to finish.
+ *
+ * Enqueue() and Clear() may be called from any task, NextFrame() by the audio loop.
+ */
+class PromptPlayer {
+public:
+    explicit PromptPlayer(size_t max_prompts);
+
+    bool Enqueue(std::string_view sound);
+    bool NextFrame(const uint8_t*& data, size_t& size);
+    void Clear();
+    bool Empty();
+
+private:
+    std::mutex mutex_;
+    std::deque<std::string_view> prompts_;
+    size_t max_prompts_;
+    std::string_view current_;
+    size_t offset_ = 0;
+};
+
+#endif // PROMPT_PLAYER_H
@@ -0,0 +1,145 @@
+#include "prompt_store.h"
+#include "sound_pack.h"
+#include "settings.h"
+#include "board.h"
+
+#include <esp_log.h>
+#include <cJSON.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+#define TAG "PromptStore"
+
+PromptStore::PromptStore() {
+    partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, PROMPT_PARTITION_LABEL);
+    if (partition_ == nullptr) {
+        ESP_LOGW(TAG, "No %s partition, custom prompts are not available", PROMPT_PARTITION_LABEL);
+        return;
+    }
+    // Mapped for good, writes through esp_partition_write show up in the mapping
+    const void* data = nullptr;
+    esp_partition_mmap_handle_t handle;
+    if (esp_partition_mmap(partition_, 0, partition_->size, ESP_PARTITION_MMAP_DATA, &data, &handle) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map the %s partition", PROMPT_PARTITION_LABEL);
+        partition_ = nullptr;
+        return;
+    }
+    data_ = static_cast<const uint8_t*>(data);
+    auto header = SoundPack::Parse(data_, partition_->size);
+    ESP_LOGI(TAG, "%u custom prompts, version %s", header != nullptr ? header->count : 0, GetVersion().c_str());
+}
+
+std::string_view PromptStore::Get(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (data_ == nullptr || updating_) {
+        return {};
+    }
+    return SoundPack::Find(data_, partition_->size, name.c_str());
+}
+
+bool PromptStore::Update(const std::string& url, const std::string& version) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (data_ == nullptr || updating_) {
+            return false;
+        }
+        updating_ = true;
+    }
+    ESP_LOGI(TAG, "Updating the prompts to version %s", version.c_str());
+    bool success = Download(url);
+    // A failed download has erased the header, the version goes with it
+    Settings settings("prompts", true);
+    settings.SetString("version", success ? version : "");
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    updating_ = false;
+    auto header = SoundPack::Parse(data_, partition_->size);
+    ESP_LOGI(TAG, "Prompts %s, %u prompts", success ? "updated" : "update failed", header != nullptr ? header->count : 0);
+    return success;
+}
+
+bool PromptStore::Download(const std::string& url) {
+    auto http = std::unique_ptr<Http>(Board::GetInstance().CreateHttp());
+    if (!http->Open("GET", url)) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection");
+        return false;
+    }
+    int status_code = http->GetStatusCode();
+    size_t length = http->GetBodyLength();
+    if (status_code != 200 || length < sizeof(SoundPackHeader) || length > partition_->size) {
+        ESP_LOGE(TAG, "Failed to get the prompts, status code: %d, length: %u", status_code, length);
+        return false;
+    }
+
+    size_t erase_size = (length + partition_->erase_size - 1) / partition_->erase_size * partition_->erase_size;
+    if (esp_partition_erase_range(partition_, 0, erase_size) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to erase the %s partition", PROMPT_PARTITION_LABEL);
+        return false;
+    }
+
+    // 头部最后写入，下载中断时分区里没有有效的镜像
+    SoundPackHeader header;
+    auto buffer = std::make_unique<char[]>(PROMPT_STORE_DOWNLOAD_BUFFER_SIZE);
+    size_t total = 0;
+    while (total < length) {
+        int ret = http->Read(buffer.get(), std::min(length - total, (size_t)PROMPT_STORE_DOWNLOAD_BUFFER_SIZE));
+        if (ret <= 0) {
+            ESP_LOGE(TAG, "Prompts download interrupted at %u/%u, ret: %d", total, length, ret);
+            return false;
+        }
+        size_t skip = 0;
+        if (total < sizeof(header)) {
+            skip = std::min(sizeof(header) - total, (size_t)ret);
+            memcpy(reinterpret_cast<char*>(&header) + total, buffer.get(), skip);
+        }
+        if ((size_t)ret > skip && esp_partition_write(partition_, total + skip, buffer.get() + skip, ret - skip) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to write the %s partition at %u", PROMPT_PARTITION_LABEL, total + skip);
+            return false;
+        }
+        total += ret;
+    }
+    http->Close();
+
+    size_t index_end = sizeof(SoundPackHeader) + header.count * sizeof(SoundPackEntry);
+    if (memcmp(header.magic, SOUND_PACK_MAGIC, 4) != 0 || header.version != SOUND_PACK_VERSION || index_end > length) {
+        ESP_LOGE(TAG, "The download is not a sound pack image");
+        return false;
+    }
+    return esp_partition_write(partition_, 0, &header, sizeof(header)) == ESP_OK;
+}
+
+std::string PromptStore::GetVersion() {
+    Settings settings("prompts");
+    return settings.GetString("version");
+}
+
+std::string PromptStore::GetJson() {
+    auto root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "version", GetVersion().c_str());
+    auto prompts = cJSON_CreateArray();
+    bool updating;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        updating = updating_;
+        auto header = updating_ ? nullptr : SoundPack::Parse(data_, data_ != nullptr ? partition_->size : 0);
+        if (header != nullptr) {
+            auto entries = SoundPack::Entries(header);
+            for (int i = 0; i < header->count; i++) {
+                auto item = cJSON_CreateObject();
+                std::string name(entries[i].name, strnlen(entries[i].name, sizeof(entries[i].name)));
+                cJSON_AddStringToObject(item, "name", name.c_str());
+                cJSON_AddNumberToObject(item, "size", entries[i].size);
+                cJSON_AddItemToArray(prompts, item);
+            }
+        }
+    }
+    cJSON_AddItemToObject(root, "prompts", prompts);
+    cJSON_AddBoolToObject(root, "updating", updating);
+    auto json = cJSON_PrintUnformatted(root);
+    std::string result(json);
+    cJSON_free(json);
+    cJSON_Delete(root);
+    return result;
+}
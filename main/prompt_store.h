@@ -0,0 +1,60 @@
+#ifndef PROMPT_STORE_H
+#define PROMPT_STORE_H
+
+#include <esp_partition.h>
+
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// The data partition the custom prompts are written to, in the sound pack format
+#define PROMPT_PARTITION_LABEL "prompts"
+#define PROMPT_STORE_DOWNLOAD_BUFFER_SIZE 4096
+
+/*
+ * Custom prompts delivered by the server, such as a brand greeting or a
+ * notification chime, kept in the prompts partition so they are played
+ * from flash instead of being streamed every time (CONFIG_USE_PROMPT_STORE).
+ *
+ * The partition holds a sound pack image of any set of P3 files, made with
+ * scripts/gen_sound_partition.py --dir. It is mapped once and stays mapped,
+ * Get() returns views into flash that the prompt player decodes in place,
+ * the same as the built-in sounds. Update() downloads a new image into the
+ * partition, through MCP or the prompts section of the version check, with
+ * no firmware rebuild. The header is written last, so an interrupted
+ * download leaves an empty store rather than a broken one.
+ *
+ * Views taken before an update read whatever the partition holds meanwhile,
+ * Application::UpdatePrompts clears the queued prompts before it starts.
+ */
+class PromptStore {
+public:
+    static PromptStore& GetInstance() {
+        static PromptStore instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    PromptStore(const PromptStore&) = delete;
+    PromptStore& operator=(const PromptStore&) = delete;
+
+    // Empty when there is no such prompt or an update is in progress
+    std::string_view Get(const std::string& name);
+    // Replaces the whole store with the image at `url`, tagged with `version`. Blocks until written
+    bool Update(const std::string& url, const std::string& version);
+
+    std::string GetVersion();
+    // {"version": "", "prompts": [{"name": "", "size": 0}]}
+    std::string GetJson();
+
+private:
+    PromptStore();
+
+    std::mutex mutex_;
+    const esp_partition_t* partition_ = nullptr;
+    const uint8_t* data_ = nullptr;
+    bool updating_ = false;
+
+    bool Download(const std::string& url);
+};
+
+#endif // PROMPT_STORE_H
@@ -0,0 +1,221 @@
+#include "cbor_codec.h"
+
+#include <cstring>
+#include <cmath>
+
+void CborWriter::Head(uint8_t major, uint64_t value) {
+    uint8_t initial = major << 5;
+    int bytes;
+    if (value < 24) {
+        out_.push_back(initial | value);
+        return;
+    } else if (value <= 0xff) {
+        out_.push_back(initial | 24);
+        bytes = 1;
+    } else if (value <= 0xffff) {
+        out_.push_back(initial | 25);
+        bytes = 2;
+    } else if (value <= 0xffffffff) {
+        out_.push_back(initial | 26);
+        bytes = 4;
+    } else {
+        out_.push_back(initial | 27);
+        bytes = 8;
+    }
+    for (int i = bytes - 1; i >= 0; i--) {
+        out_.push_back((value >> (i * 8)) & 0xff);
+    }
+}
+
+void CborWriter::String(std::string_view text) {
+    Head(3, text.size());
+    out_.append(text.data(), text.size());
+}
+
+void CborWriter::Int(int64_t value) {
+    if (value >= 0) {
+        Head(0, value);
+    } else {
+        Head(1, (uint64_t)(-1 - value));
+    }
+}
+
+static double DecodeHalf(uint16_t half) {
+    int exponent = (half >> 10) & 0x1f;
+    int mantissa = half & 0x3ff;
+    double value;
+    if (exponent == 0) {
+        value = ldexp(mantissa, -24);
+    } else if (exponent != 31) {
+        value = ldexp(mantissa + 1024, exponent - 25);
+    } else {
+        value = mantissa == 0 ? INFINITY : NAN;
+    }
+    return (half & 0x8000) ? -value : value;
+}
+
+bool CborReader::Fail() {
+    error_ = true;
+    return false;
+}
+
+bool CborReader::Read(size_t count, uint64_t& value) {
+    if (size_ - offset_ < count) {
+        return Fail();
+    }
+    value = 0;
+    for (size_t i = 0; i < count; i++) {
+        value = (value << 8) | data_[offset_++];
+    }
+    return true;
+}
+
+bool CborReader::Next(CborItem& item) {
+    while (true) {
+        if (error_ || offset_ >= size_) {
+            return false;
+        }
+        uint8_t initial = data_[offset_++];
+        uint8_t major = initial >> 5;
+        uint8_t info = initial & 0x1f;
+        uint64_t value = info;
+        if (info == 24 || info == 25 || info == 26 || info == 27) {
+            if (!Read(1 << (info - 24), value)) {
+                return false;
+            }
+        } else if (info > 27) {
+            return Fail();
+        }
+
+        item = CborItem();
+        item.value = value;
+        switch (major) {
+        case 0:
+            item.type = kCborUnsigned;
+            return true;
+        case 1:
+            item.type = kCborNegative;
+            return true;
+        case 2:
+        case 3:
+            if (size_ - offset_ < value) {
+                return Fail();
+            }
+            item.type = major == 2 ? kCborBytes : kCborString;
+            item.data = std::string_view((const char*)data_ + offset_, value);
+            offset_ += value;
+            return true;
+        case 4:
+            item.type = kCborArray;
+            return true;
+        case 5:
+            item.type = kCborMap;
+            return true;
+        case 6:
+            continue;   // The tagged item follows, the tag itself carries nothing we use
+        default:
+            break;
+        }
+
+        if (info == 20) {
+            item.type = kCborFalse;
+        } else if (info == 21) {
+            item.type = kCborTrue;
+        } else if (info == 22 || info == 23) {
+            item.type = kCborNull;
+        } else if (info == 25) {
+            item.type = kCborFloat;
+            item.number = DecodeHalf(value);
+        } else if (info == 26) {
+            uint32_t bits = value;
+            float number;
+            memcpy(&number, &bits, sizeof(number));
+            item.type = kCborFloat;
+            item.number = number;
+        } else if (info == 27) {
+            memcpy(&item.number, &value, sizeof(item.number));
+            item.type = kCborFloat;
+        } else {
+            return Fail();
+        }
+        return true;
+    }
+}
+
+bool CborReader::Skip(const CborItem& item) {
+    if (item.type != kCborArray && item.type != kCborMap) {
+        return true;
+    }
+    // Counted instead of recursing, so deep nesting cannot exhaust the stack.
+    // Every item takes at least one byte, a larger count is malformed.
+    uint64_t remaining = item.type == kCborMap ? item.value * 2 : item.value;
+    while (remaining > 0) {
+        if (remaining > size_ - offset_) {
+            return Fail();
+        }
+        CborItem child;
+        if (!Next(child)) {
+            return Fail();
+        }
+        remaining--;
+        if (child.type == kCborArray) {
+            remaining += child.value;
+        } else if (child.type == kCborMap) {
+            remaining += child.value * 2;
+        }
+    }
+    return true;
+}
+
+cJSON* CborReader::ToJson(const CborItem& item, int depth) {
+    switch (item.type) {
+    case kCborUnsigned:
+    case kCborNegative:
+        return cJSON_CreateNumber((double)item.AsInt());
+    case kCborFloat:
+        return cJSON_CreateNumber(item.number);
+    case kCborString:
+        return cJSON_CreateString(std::string(item.data).c_str());
+    case kCborTrue:
+        return cJSON_CreateTrue();
+    case kCborFalse:
+        return cJSON_CreateFalse();
+    case kCborNull:
+        return cJSON_CreateNull();
+    case kCborArray:
+    case kCborMap:
+        break;
+    default:
+        // Byte strings have no JSON equivalent
+        Fail();
+        return nullptr;
+    }
+
+    if (depth >= CBOR_MAX_DEPTH || item.value > size_ - offset_) {
+        Fail();
+        return nullptr;
+    }
+    bool is_map = item.type == kCborMap;
+    cJSON* container = is_map ? cJSON_CreateObject() : cJSON_CreateArray();
+    for (uint64_t i = 0; i < item.value; i++) {
+        CborItem key;
+        if (is_map && (!Next(key) || key.type != kCborString)) {
+            Fail();
+            cJSON_Delete(container);
+            return nullptr;
+        }
+        CborItem child;
+        cJSON* element = Next(child) ? ToJson(child, depth + 1) : nullptr;
+        if (element == nullptr) {
+            Fail();
+            cJSON_Delete(container);
+            return nullptr;
+        }
+        if (is_map) {
+            cJSON_AddItemToObject(container, std::string(key.data).c_str(), element);
+        } else {
+            cJSON_AddItemToArray(container, element);
+        }
+    }
+    return container;
+}
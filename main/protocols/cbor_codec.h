@@ -0,0 +1,96 @@
+#ifndef CBOR_CODEC_H
+#define CBOR_CODEC_H
+
+#include <cJSON.h>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+// Containers nested deeper than this are rejected when converting to cJSON
+#define CBOR_MAX_DEPTH 16
+
+enum CborType {
+    kCborInvalid,
+    kCborUnsigned,
+    kCborNegative,
+    kCborBytes,
+    kCborString,
+    kCborArray,
+    kCborMap,
+    kCborFalse,
+    kCborTrue,
+    kCborNull,
+    kCborFloat
+};
+
+struct CborItem {
+    CborType type = kCborInvalid;
+    uint64_t value = 0;     // Integer magnitude, or the element count of an array or map
+    double number = 0;      // Floats only
+    std::string_view data;  // Byte and text strings, points into the message
+
+    inline bool IsScalar() const {
+        return type != kCborInvalid && type != kCborArray && type != kCborMap;
+    }
+    bool Equals(std::string_view text) const {
+        return type == kCborString && data == text;
+    }
+    int64_t AsInt() const {
+        return type == kCborNegative ? -1 - (int64_t)value : (int64_t)value;
+    }
+};
+
+/*
+ * Writes definite length CBOR (RFC 8949) into a string. The caller gives the
+ * element count of each array and map up front, the control messages are
+ * small and their shape is known, so nothing has to be patched afterwards.
+ */
+class CborWriter {
+public:
+    explicit CborWriter(std::string& out) : out_(out) {}
+
+    void Map(size_t pairs) { Head(5, pairs); }
+    void Array(size_t count) { Head(4, count); }
+    void String(std::string_view text);
+    void Int(int64_t value);
+    void Bool(bool value) { out_.push_back(value ? 0xf5 : 0xf4); }
+    void Null() { out_.push_back(0xf6); }
+
+private:
+    std::string& out_;
+
+    void Head(uint8_t major, uint64_t value);
+};
+
+/*
+ * Pull parser over a CBOR message, one item per Next() call. Nothing is
+ * allocated: strings are views into the message, which therefore has to
+ * outlive the items. Tags are skipped, indefinite lengths are rejected as
+ * the server only sends definite length messages.
+ */
+class CborReader {
+public:
+    CborReader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+    // Returns false at the end of the message or on malformed input
+    bool Next(CborItem& item);
+    // Skips the contents of an array or map just returned by Next()
+    bool Skip(const CborItem& item);
+    // Converts the item just returned by Next() and its contents to cJSON, nullptr on error
+    cJSON* ToJson(const CborItem& item, int depth = 0);
+
+    inline bool error() const { return error_; }
+    inline bool done() const { return offset_ == size_; }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t offset_ = 0;
+    bool error_ = false;
+
+    bool Read(size_t count, uint64_t& value);
+    bool Fail();
+};
+
+#endif // CBOR_CODEC_H
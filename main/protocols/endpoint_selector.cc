@@ -0,0 +1,176 @@
+#include "endpoint_selector.h"
+#include "settings.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <lwip/sockets.h>
+#include <lwip/netdb.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cerrno>
+
+#define TAG "EndpointSelector"
+
+EndpointSelector::EndpointSelector(const char* ns, const char* key, const char* list_key, int default_port)
+    : ns_(ns), key_(key), list_key_(list_key), default_port_(default_port) {
+}
+
+// The preferred candidate first, then the single endpoint, then the rest of the list in its order
+std::vector<std::string> EndpointSelector::LoadCandidates() {
+    Settings settings(ns_, false);
+    std::vector<std::string> candidates;
+    auto add = [&candidates](const std::string& endpoint) {
+        if (!endpoint.empty() && std::find(candidates.begin(), candidates.end(), endpoint) == candidates.end()) {
+            candidates.push_back(endpoint);
+        }
+    };
+    auto single = settings.GetString(key_);
+    auto list = settings.GetString(list_key_);
+    std::vector<std::string> listed;
+    size_t start = 0;
+    while (start <= list.size() && !list.empty()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        listed.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+    auto preferred = settings.GetString("preferred");
+    // A preferred endpoint the server no longer lists is dropped
+    if (preferred == single || std::find(listed.begin(), listed.end(), preferred) != listed.end()) {
+        add(preferred);
+    }
+    add(single);
+    for (auto& endpoint : listed) {
+        add(endpoint);
+    }
+    return candidates;
+}
+
+std::string EndpointSelector::Select() {
+    auto candidates = LoadCandidates();
+    if (candidates.empty()) {
+        return "";
+    }
+    auto& endpoint = candidates[failures_ % candidates.size()];
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (endpoint != selected_ && candidates.size() > 1) {
+        ESP_LOGI(TAG, "Using %s (%d/%u)", endpoint.c_str(), failures_ % (int)candidates.size() + 1, candidates.size());
+    }
+    selected_ = endpoint;
+    return endpoint;
+}
+
+void EndpointSelector::OnFailure() {
+    failures_++;
+}
+
+void EndpointSelector::OnSuccess() {
+    if (failures_.exchange(0) == 0) {
+        return;
+    }
+    // Failed over, the endpoint that works is where the next boot starts
+    std::string selected;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        selected = selected_;
+    }
+    Settings settings(ns_, true);
+    if (settings.GetString("preferred") != selected) {
+        settings.SetString("preferred", selected);
+    }
+}
+
+bool EndpointSelector::ParseHostPort(const std::string& endpoint, std::string& host, int& port) const {
+    size_t host_start = 0;
+    port = default_port_;
+    auto scheme_end = endpoint.find("://");
+    if (scheme_end != std::string::npos) {
+        auto scheme = endpoint.substr(0, scheme_end);
+        port = (scheme == "wss" || scheme == "https" || scheme == "mqtts") ? 443 : 80;
+        host_start = scheme_end + 3;
+    }
+    auto host_end = endpoint.find_first_of("/?", host_start);
+    host = endpoint.substr(host_start, host_end == std::string::npos ? std::string::npos : host_end - host_start);
+    auto colon = host.rfind(':');
+    if (colon != std::string::npos && host.find(']') == std::string::npos) {
+        port = atoi(host.c_str() + colon + 1);
+        host.resize(colon);
+    }
+    return !host.empty() && port > 0;
+}
+
+int EndpointSelector::MeasureConnectTime(const std::string& host, int port) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0 || result == nullptr) {
+        ESP_LOGW(TAG, "Failed to resolve %s", host.c_str());
+        return -1;
+    }
+    int fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (fd < 0) {
+        freeaddrinfo(result);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    int64_t start_us = esp_timer_get_time();
+    int ret = connect(fd, result->ai_addr, result->ai_addrlen);
+    freeaddrinfo(result);
+    if (ret != 0 && errno == EINPROGRESS) {
+        fd_set write_set;
+        FD_ZERO(&write_set);
+        FD_SET(fd, &write_set);
+        timeval timeout = { .tv_sec = ENDPOINT_PROBE_TIMEOUT_MS / 1000, .tv_usec = (ENDPOINT_PROBE_TIMEOUT_MS % 1000) * 1000 };
+        int error = -1;
+        socklen_t length = sizeof(error);
+        if (select(fd + 1, nullptr, &write_set, nullptr, &timeout) == 1 &&
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0) {
+            ret = 0;
+        }
+    }
+    int elapsed_ms = (esp_timer_get_time() - start_us) / 1000;
+    close(fd);
+    return ret == 0 ? elapsed_ms : -1;
+}
+
+void EndpointSelector::Probe() {
+    auto candidates = LoadCandidates();
+    if (candidates.size() < 2) {
+        return;
+    }
+    std::string best;
+    int best_ms = -1;
+    for (auto& endpoint : candidates) {
+        std::string host;
+        int port;
+        if (!ParseHostPort(endpoint, host, port)) {
+            continue;
+        }
+        int connect_ms = -1;
+        for (int round = 0; round < ENDPOINT_PROBE_ROUNDS; round++) {
+            int ms = MeasureConnectTime(host, port);
+            if (ms >= 0 && (connect_ms < 0 || ms < connect_ms)) {
+                connect_ms = ms;
+            }
+        }
+        ESP_LOGI(TAG, "%s: %d ms", endpoint.c_str(), connect_ms);
+        if (connect_ms >= 0 && (best_ms < 0 || connect_ms < best_ms)) {
+            best = endpoint;
+            best_ms = connect_ms;
+        }
+    }
+    if (best.empty()) {
+        return;
+    }
+    Settings settings(ns_, true);
+    if (settings.GetString("preferred") != best) {
+        ESP_LOGI(TAG, "Preferring %s from now on", best.c_str());
+        settings.SetString("preferred", best);
+    }
+    // The preferred one is first again, the failover starts over from it
+    failures_ = 0;
+}
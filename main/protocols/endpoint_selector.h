@@ -0,0 +1,57 @@
+#ifndef ENDPOINT_SELECTOR_H
+#define ENDPOINT_SELECTOR_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+// A candidate that does not accept a TCP connection within this time is skipped
+#define ENDPOINT_PROBE_TIMEOUT_MS 1500
+// Connects per candidate, the fastest counts, one slow handshake is noise
+#define ENDPOINT_PROBE_ROUNDS 2
+
+/*
+ * Picks the server endpoint of a protocol among the candidates of the OTA
+ * config, e.g. the same service in several regions.
+ *
+ * The OTA config may give a list next to the single endpoint, "urls" in
+ * the websocket section or "endpoints" in the mqtt section. Probe() times a
+ * TCP connect to each candidate and saves the fastest as the preferred one,
+ * which Select() returns from then on, also after a reboot. A failed
+ * connection moves Select() on to the next candidate until one works.
+ *
+ * The probe resolves every host first, which also warms the lwIP DNS cache
+ * for the connection that follows; lwIP keeps the answers for their TTL.
+ * Without a list all of this comes down to the single endpoint.
+ */
+class EndpointSelector {
+public:
+    // `ns` is the settings namespace of the protocol, `key` its single endpoint and `list_key`
+    // the comma separated candidates. `default_port` applies to a host without a port or scheme
+    EndpointSelector(const char* ns, const char* key, const char* list_key, int default_port);
+
+    // The endpoint to connect to, empty if none is configured
+    std::string Select();
+    // The connection to the endpoint of the last Select() failed
+    void OnFailure();
+    void OnSuccess();
+    // Blocks for up to the probe timeout per candidate, from a background worker
+    void Probe();
+
+private:
+    const char* ns_;
+    const char* key_;
+    const char* list_key_;
+    int default_port_;
+    std::mutex mutex_;
+    std::string selected_;
+    std::atomic<int> failures_ = 0;
+
+    std::vector<std::string> LoadCandidates();
+    bool ParseHostPort(const std::string& endpoint, std::string& host, int& port) const;
+    // TCP connect time in ms, -1 if unreachable
+    static int MeasureConnectTime(const std::string& host, int port);
+};
+
+#endif // ENDPOINT_SELECTOR_H
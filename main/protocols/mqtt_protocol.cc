@@ -2,8 +2,12 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "pipeline_trace.h"
+#include "deferred_log.h"
 
 #include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <rom/miniz.h>
 #include <ml307_mqtt.h>
 #include <ml307_udp.h>
 #include <cstring>
@@ -14,10 +18,31 @@
 
 MqttProtocol::MqttProtocol() {
     event_group_handle_ = xEventGroupCreate();
+    esp_timer_create_args_t reconnect_timer_args = {
+        .callback = [](void* arg) {
+            auto protocol = (MqttProtocol*)arg;
+            Application::GetInstance().Schedule([protocol]() {
+                if (protocol->mqtt_ == nullptr || !protocol->mqtt_->IsConnected()) {
+                    ESP_LOGI(TAG, "Reconnecting to endpoint");
+                    protocol->StartMqttClient(false);
+                }
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "mqtt_reconnect",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&reconnect_timer_args, &reconnect_timer_);
+    reconnect_backoff_.OnRetryNow([this]() {
+        ScheduleReconnect(0);
+    });
 }
 
 MqttProtocol::~MqttProtocol() {
     ESP_LOGI(TAG, "MqttProtocol deinit");
+    esp_timer_stop(reconnect_timer_);
+    esp_timer_delete(reconnect_timer_);
     if (udp_ != nullptr) {
         delete udp_;
     }
@@ -38,11 +63,13 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     }
 
     Settings settings("mqtt", false);
-    auto endpoint = settings.GetString("endpoint");
+    auto endpoint = endpoint_selector_.Select();
     auto client_id = settings.GetString("client_id");
     auto username = settings.GetString("username");
     auto password = settings.GetString("password");
-    int keepalive_interval = settings.GetInt("keepalive", 120);
+    int keepalive_interval = settings.GetInt("keepalive", Board::GetInstance().GetBoardType() == "ml307" ?
+        MQTT_CELLULAR_KEEPALIVE_SECONDS : MQTT_WIFI_KEEPALIVE_SECONDS);
+    reliable_qos_ = settings.GetInt("reliable_qos", MQTT_RELIABLE_QOS);
     publish_topic_ = settings.GetString("publish_topic");
 
     if (endpoint.empty()) {
@@ -58,13 +85,28 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
 
     mqtt_->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Disconnected from endpoint");
+        // After a server restart every device gets here at once, the jittered backoff spreads them out
+        ScheduleReconnect(reconnect_backoff_.OnFailure());
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
-        if (root == nullptr) {
-            ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
-            return;
+#if CONFIG_USE_JSON_ARENA
+        JsonArenaScope arena(json_arena_);
+#endif
+        cJSON* root;
+        if (IsCbor(payload)) {
+            // Frequent messages are handled inside, the rest comes back as cJSON
+            root = DecodeCbor((const uint8_t*)payload.data(), payload.size());
+            if (root == nullptr) {
+                last_incoming_time_ = std::chrono::steady_clock::now();
+                return;
+            }
+        } else {
+            root = cJSON_Parse(payload.c_str());
+            if (root == nullptr) {
+                ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
+                return;
+            }
         }
         cJSON* type = cJSON_GetObjectItem(root, "type");
         if (!cJSON_IsString(type)) {
@@ -102,19 +144,85 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     }
     if (!mqtt_->Connect(broker_address, broker_port, client_id, username, password)) {
         ESP_LOGE(TAG, "Failed to connect to endpoint");
+        endpoint_selector_.OnFailure();
         SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+        ScheduleReconnect(reconnect_backoff_.OnFailure());
         return false;
     }
 
     ESP_LOGI(TAG, "Connected to endpoint");
+    endpoint_selector_.OnSuccess();
+    reconnect_backoff_.OnSuccess();
+    esp_timer_stop(reconnect_timer_);
+    return true;
+}
+
+// Any task. A pending reconnect is moved, so the latest failure decides when it runs
+void MqttProtocol::ScheduleReconnect(int delay_ms) {
+    esp_timer_stop(reconnect_timer_);
+    esp_timer_start_once(reconnect_timer_, delay_ms * 1000ULL);
+    ESP_LOGI(TAG, "Reconnecting in %d ms", delay_ms);
+}
+
+// QoS 1 costs a PUBACK round trip per message, only the messages the conversation cannot recover from pay for it
+int MqttProtocol::GetQos(const std::string& text) const {
+    // CBOR carries the frequent listen, abort and tts messages
+    if (IsCbor(text)) {
+        return 0;
+    }
+    size_t pos = text.find("\"type\":\"");
+    if (pos == std::string::npos || pos > 128) {
+        return 0;
+    }
+    auto type = std::string_view(text).substr(pos + 8);
+    for (auto reliable : {"mcp\"", "iot\"", "goodbye\"", "offline_actions\"", "media\""}) {
+        if (type.starts_with(reliable)) {
+            return reliable_qos_;
+        }
+    }
+    return 0;
+}
+
+// Descriptors and tool lists are JSON and shrink to a fraction. The compressor needs a large
+// dictionary, it is taken from PSRAM for the message and the text goes out as is without it
+bool MqttProtocol::Deflate(const std::string& text, std::string& output) {
+    auto compressor = (tdefl_compressor*)heap_caps_malloc(sizeof(tdefl_compressor), MALLOC_CAP_SPIRAM);
+    if (compressor == nullptr) {
+        return false;
+    }
+    // Anything that does not end up smaller is not worth it
+    output.resize(text.size());
+    size_t in_size = text.size();
+    size_t out_size = output.size();
+    tdefl_init(compressor, nullptr, nullptr, TDEFL_WRITE_ZLIB_HEADER | TDEFL_DEFAULT_MAX_PROBES);
+    auto status = tdefl_compress(compressor, text.data(), &in_size, output.data(), &out_size, TDEFL_FINISH);
+    heap_caps_free(compressor);
+    if (status != TDEFL_STATUS_DONE) {
+        return false;
+    }
+    output.resize(out_size);
     return true;
 }
 
 bool MqttProtocol::SendText(const std::string& text) {
+#if CONFIG_USE_PIPELINE_TRACE
+    PipelineTrace::GetInstance().Emit(kPipelineEventJsonSend, kPipelinePhaseInstant, text.size());
+#endif
     if (publish_topic_.empty()) {
         return false;
     }
-    if (!mqtt_->Publish(publish_topic_, text)) {
+    int qos = GetQos(text);
+    std::string compressed;
+    if (deflate_ && text.size() >= MQTT_DEFLATE_MIN_SIZE && Deflate(text, compressed)) {
+        ESP_LOGD(TAG, "Deflated %u bytes to %u", text.size(), compressed.size());
+        if (!mqtt_->Publish(publish_topic_, compressed, qos)) {
+            ESP_LOGE(TAG, "Failed to publish %u compressed bytes", compressed.size());
+            SetError(Lang::Strings::SERVER_ERROR);
+            return false;
+        }
+        return true;
+    }
+    if (!mqtt_->Publish(publish_topic_, text, qos)) {
         ESP_LOGE(TAG, "Failed to publish message: %s", text.c_str());
         SetError(Lang::Strings::SERVER_ERROR);
         return false;
@@ -128,24 +236,30 @@ bool MqttProtocol::SendAudio(const AudioStreamPacket& packet) {
         return false;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet.payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet.timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet.payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
+    if (udp_send_buffer_.size() < MQTT_UDP_HEADER_SIZE) {
+        return false;
+    }
 
+    // The header was written from the session nonce in the hello, only its per-packet fields change.
+    // Resizing within the reserved capacity keeps the buffer and the header in place.
+    udp_send_buffer_.resize(MQTT_UDP_HEADER_SIZE + packet.payload.size());
+    auto buffer = (uint8_t*)udp_send_buffer_.data();
+    *(uint16_t*)&buffer[2] = htons(packet.payload.size());
+    *(uint32_t*)&buffer[8] = htonl(packet.timestamp);
+    *(uint32_t*)&buffer[12] = htonl(++local_sequence_);
+
+    // CTR mode advances the counter it is given, so it works on a copy of the header
+    uint8_t nonce[MQTT_UDP_HEADER_SIZE];
+    memcpy(nonce, buffer, sizeof(nonce));
     size_t nc_off = 0;
     uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet.payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet.payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet.payload.size(), &nc_off, nonce, stream_block,
+        packet.payload.data(), buffer + MQTT_UDP_HEADER_SIZE) != 0) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return false;
     }
 
-    return udp_->Send(encrypted) > 0;
+    return udp_->Send(udp_send_buffer_) > 0;
 }
 
 void MqttProtocol::CloseAudioChannel() {
@@ -156,6 +270,7 @@ void MqttProtocol::CloseAudioChannel() {
             udp_ = nullptr;
         }
     }
+    receive_tracker_.LogStats(TAG);
 
     std::string message = "{";
     message += "\"session_id\":\"" + session_id_ + "\",";
@@ -168,6 +283,27 @@ void MqttProtocol::CloseAudioChannel() {
     }
 }
 
+// Both the broker connection and the audio socket went out over the old network
+void MqttProtocol::OnNetworkChanged() {
+    bool was_opened;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        was_opened = udp_ != nullptr;
+        if (udp_ != nullptr) {
+            delete udp_;
+            udp_ = nullptr;
+        }
+    }
+    StartMqttClient(false);
+    if (was_opened && on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+}
+
+void MqttProtocol::ProbeEndpoints() {
+    endpoint_selector_.Probe();
+}
+
 bool MqttProtocol::OpenAudioChannel() {
     if (mqtt_ == nullptr || !mqtt_->IsConnected()) {
         ESP_LOGI(TAG, "MQTT is not connected, try to connect now");
@@ -177,6 +313,8 @@ bool MqttProtocol::OpenAudioChannel() {
     }
 
     error_occurred_ = false;
+    binary_control_ = false;
+    deflate_ = false;
     session_id_ = "";
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 
@@ -197,6 +335,7 @@ bool MqttProtocol::OpenAudioChannel() {
     if (udp_ != nullptr) {
         delete udp_;
     }
+    receive_tracker_.Reset();
     udp_ = Board::GetInstance().CreateUdp();
     udp_->OnMessage([this](const std::string& data) {
         /*
@@ -204,35 +343,35 @@ bool MqttProtocol::OpenAudioChannel() {
          * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
          * |payload payload_len|
          */
-        if (data.size() < sizeof(aes_nonce_)) {
-            ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
+        if (data.size() < MQTT_UDP_HEADER_SIZE) {
+            DEFERRED_LOGE(TAG, "Invalid audio packet size: %u", data.size());
             return;
         }
         if (data[0] != 0x01) {
-            ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
+            DEFERRED_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
             return;
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
+        if (!receive_tracker_.Accept(sequence, timestamp)) {
             return;
         }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
-        }
 
-        size_t decrypted_size = data.size() - aes_nonce_.size();
+        // Decrypt straight from the datagram into the pooled payload, this is the only copy.
+        // The datagram is const, CTR mode gets its own copy of the counter.
+        size_t decrypted_size = data.size() - MQTT_UDP_HEADER_SIZE;
         size_t nc_off = 0;
         uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
+        uint8_t nonce[MQTT_UDP_HEADER_SIZE];
+        memcpy(nonce, data.data(), sizeof(nonce));
+        auto encrypted = (const uint8_t*)data.data() + MQTT_UDP_HEADER_SIZE;
         AudioStreamPacket packet;
         packet.sample_rate = server_sample_rate_;
         packet.frame_duration = server_frame_duration_;
         packet.timestamp = timestamp;
+        packet.sequence = sequence;
         packet.payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet.payload.data());
+        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, packet.payload.data());
         if (ret != 0) {
             ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
             return;
@@ -240,8 +379,14 @@ bool MqttProtocol::OpenAudioChannel() {
         if (on_incoming_audio_ != nullptr) {
             on_incoming_audio_(std::move(packet));
         }
-        remote_sequence_ = sequence;
         last_incoming_time_ = std::chrono::steady_clock::now();
+
+        auto report = receive_tracker_.TakeReport(session_id_);
+        if (!report.empty()) {
+            Application::GetInstance().Schedule([this, report = std::move(report)]() {
+                SendText(report);
+            });
+        }
     });
 
     udp_->Connect(udp_server_, udp_port_);
@@ -265,16 +410,35 @@ std::string MqttProtocol::GetHelloMessage() {
 #if CONFIG_IOT_PROTOCOL_MCP
     cJSON_AddBoolToObject(features, "mcp", true);
 #endif
+    cJSON_AddBoolToObject(features, "receiver_report", true);
+    cJSON_AddBoolToObject(features, "deflate", true);
+#if CONFIG_USE_CBOR_CONTROL
+    cJSON_AddBoolToObject(features, "cbor", true);
+#endif
+#if CONFIG_USE_WAKE_WORD_STREAMING
+    cJSON_AddBoolToObject(features, "wake_stream", true);
+#endif
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+    cJSON_AddBoolToObject(features, "tts_cache", true);
+#endif
+#if CONFIG_USE_MEDIA_PLAYBACK
+    cJSON_AddBoolToObject(features, "media", true);
+#endif
+#if CONFIG_USE_UPLINK_SILENCE_SUPPRESSION
+    cJSON_AddBoolToObject(features, "silence", true);
+#endif
+    if (!iot_descriptors_hash_.empty()) {
+        cJSON_AddStringToObject(features, "iot_descriptors", iot_descriptors_hash_.c_str());
+    }
     cJSON_AddItemToObject(root, "features", features);
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    AddOutputChannels(audio_params);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", client_frame_duration_);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
-    auto json_str = cJSON_PrintUnformatted(root);
-    std::string message(json_str);
-    cJSON_free(json_str);
+    std::string message = PrintJson(root);
     cJSON_Delete(root);
     return message;
 }
@@ -291,9 +455,13 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         session_id_ = session_id->valuestring;
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
+    ParseServerFeatures(root);
+    // Compressed payloads start with the zlib header 0x78, neither JSON nor a CBOR map does
+    deflate_ = cJSON_IsTrue(cJSON_GetObjectItem(cJSON_GetObjectItem(root, "features"), "deflate"));
 
     // Get sample rate from hello message
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
+    ParseServerChannels(audio_params);
     if (cJSON_IsObject(audio_params)) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
         if (cJSON_IsNumber(sample_rate)) {
@@ -303,6 +471,7 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         if (cJSON_IsNumber(frame_duration)) {
             server_frame_duration_ = frame_duration->valueint;
         }
+        ParseUplinkFrameDuration(audio_params);
     }
 
     auto udp = cJSON_GetObjectItem(root, "udp");
@@ -318,10 +487,18 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
     aes_nonce_ = DecodeHexString(nonce);
+    if (aes_nonce_.size() != MQTT_UDP_HEADER_SIZE) {
+        ESP_LOGE(TAG, "Invalid UDP nonce size: %u", aes_nonce_.size());
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        udp_send_buffer_.reserve(MQTT_UDP_HEADER_SIZE + MQTT_UDP_MAX_PACKET_SIZE);
+        udp_send_buffer_.assign(aes_nonce_);
+    }
     mbedtls_aes_init(&aes_ctx_);
     mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
     local_sequence_ = 0;
-    remote_sequence_ = 0;
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
@@ -344,6 +521,12 @@ std::string MqttProtocol::DecodeHexString(const std::string& hex_string) {
     return decoded;
 }
 
+TransportStats MqttProtocol::GetTransportStats() const {
+    TransportStats stats;
+    stats.loss_percent = receive_tracker_.GetRecentLossPercent();
+    return stats;
+}
+
 bool MqttProtocol::IsAudioChannelOpened() const {
     return udp_ != nullptr && !error_occurred_ && !IsTimeout();
 }
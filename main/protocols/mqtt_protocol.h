@@ -3,12 +3,16 @@
 
 
 #include "protocol.h"
+#include "udp_receive_tracker.h"
+#include "reconnect_backoff.h"
+#include "endpoint_selector.h"
 #include <mqtt.h>
 #include <udp.h>
 #include <cJSON.h>
 #include <mbedtls/aes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <esp_timer.h>
 
 #include <functional>
 #include <string>
@@ -16,10 +20,24 @@
 #include <mutex>
 
 #define MQTT_PING_INTERVAL_SECONDS 90
-#define MQTT_RECONNECT_INTERVAL_MS 10000
+// A lost broker connection is retried in the background after this, doubling up to the maximum
+#define MQTT_RECONNECT_MIN_DELAY_MS 10000
+#define MQTT_RECONNECT_MAX_DELAY_MS 300000
+// Used when the mqtt settings from the server have no keepalive. Every ping wakes the modem of
+// a cellular link, and carrier NATs keep idle mappings longer than most home routers
+#define MQTT_WIFI_KEEPALIVE_SECONDS 120
+#define MQTT_CELLULAR_KEEPALIVE_SECONDS 300
+// QoS of the control messages the server must not miss, "reliable_qos" in the mqtt settings overrides it
+#define MQTT_RELIABLE_QOS 1
+// Payloads from this size on are sent zlib compressed when the server hello has the deflate feature
+#define MQTT_DEFLATE_MIN_SIZE 1024
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
+// |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|, also the AES-CTR nonce
+#define MQTT_UDP_HEADER_SIZE 16
+#define MQTT_UDP_MAX_PACKET_SIZE 1500
+
 class MqttProtocol : public Protocol {
 public:
     MqttProtocol();
@@ -27,9 +45,14 @@ public:
 
     bool Start() override;
     bool SendAudio(const AudioStreamPacket& packet) override;
+    // The socket is only used under channel_mutex_
+    bool IsAudioSendThreadSafe() const override { return true; }
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    TransportStats GetTransportStats() const override;
+    void OnNetworkChanged() override;
+    void ProbeEndpoints() override;
 
 private:
     EventGroupHandle_t event_group_handle_;
@@ -41,14 +64,25 @@ private:
     Udp* udp_ = nullptr;
     mbedtls_aes_context aes_ctx_;
     std::string aes_nonce_;
+    // Header followed by the encrypted payload, reused for every packet sent
+    std::string udp_send_buffer_;
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
-    uint32_t remote_sequence_;
+    int reliable_qos_ = MQTT_RELIABLE_QOS;
+    bool deflate_ = false;
+
+    UdpReceiveTracker receive_tracker_;
+    ReconnectBackoff reconnect_backoff_{"mqtt", MQTT_RECONNECT_MIN_DELAY_MS, MQTT_RECONNECT_MAX_DELAY_MS};
+    EndpointSelector endpoint_selector_{"mqtt", "endpoint", "endpoints", 8883};
+    esp_timer_handle_t reconnect_timer_ = nullptr;
 
     bool StartMqttClient(bool report_error=false);
+    void ScheduleReconnect(int delay_ms);
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
+    int GetQos(const std::string& text) const;
+    bool Deflate(const std::string& text, std::string& output);
 
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
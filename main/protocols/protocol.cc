@@ -1,4 +1,5 @@
 #include "protocol.h"
+#include "cbor_codec.h"
 
 #include <esp_log.h>
 
@@ -8,6 +9,10 @@ void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
     on_incoming_json_ = callback;
 }
 
+void Protocol::OnIncomingControl(std::function<void(const ControlMessage& message)> callback) {
+    on_incoming_control_ = callback;
+}
+
 void Protocol::OnIncomingAudio(std::function<void(AudioStreamPacket&& packet)> callback) {
     on_incoming_audio_ = callback;
 }
@@ -24,6 +29,10 @@ void Protocol::OnNetworkError(std::function<void(const std::string& message)> ca
     on_network_error_ = callback;
 }
 
+void Protocol::OnUplinkBitrateChanged(std::function<void(int bitrate)> callback) {
+    on_uplink_bitrate_changed_ = callback;
+}
+
 void Protocol::SetError(const std::string& message) {
     error_occurred_ = true;
     if (on_network_error_ != nullptr) {
@@ -31,7 +40,158 @@ void Protocol::SetError(const std::string& message) {
     }
 }
 
+// Older servers do not reply with an uplink duration and accept whatever we proposed,
+// Opus packets are self-describing so their decoder handles any frame size
+void Protocol::ParseUplinkFrameDuration(const cJSON* audio_params) {
+    auto uplink_frame_duration = cJSON_GetObjectItem(audio_params, "uplink_frame_duration");
+    if (!cJSON_IsNumber(uplink_frame_duration)) {
+        return;
+    }
+    int duration = uplink_frame_duration->valueint;
+    if (duration == 20 || duration == 40 || duration == 60 || duration == 120) {
+        client_frame_duration_ = duration;
+    } else {
+        ESP_LOGW(TAG, "Unsupported uplink frame duration: %d", duration);
+    }
+}
+
+// Only offered by a board with a second output, so the hello of a mono board stays as it was
+void Protocol::AddOutputChannels(cJSON* audio_params) {
+    if (output_channels_ > 1) {
+        cJSON_AddNumberToObject(audio_params, "output_channels", output_channels_);
+    }
+}
+
+// A server that does not answer keeps sending mono
+void Protocol::ParseServerChannels(const cJSON* audio_params) {
+    server_channels_ = 1;
+    auto channels = cJSON_GetObjectItem(audio_params, "channels");
+    if (!cJSON_IsNumber(channels)) {
+        return;
+    }
+    if (channels->valueint >= 1 && channels->valueint <= output_channels_) {
+        server_channels_ = channels->valueint;
+        ESP_LOGI(TAG, "Downlink channels: %d", server_channels_);
+    } else {
+        ESP_LOGW(TAG, "Unsupported downlink channels: %d", channels->valueint);
+    }
+}
+
+void Protocol::ParseServerFeatures(const cJSON* root) {
+    auto features = cJSON_GetObjectItem(root, "features");
+    binary_control_ = false;
+#if CONFIG_USE_CBOR_CONTROL
+    binary_control_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "cbor"));
+    if (binary_control_) {
+        ESP_LOGI(TAG, "Using CBOR control messages");
+    }
+#endif
+#if CONFIG_USE_WAKE_WORD_STREAMING
+    // Kept after the channel closes, the next wake word has to decide before the new hello
+    wake_word_streaming_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "wake_stream"));
+    if (wake_word_streaming_) {
+        ESP_LOGI(TAG, "Streaming wake word verification");
+    }
+#endif
+#if CONFIG_USE_CAMERA_STREAMING
+    video_streaming_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "video"));
+    if (video_streaming_) {
+        ESP_LOGI(TAG, "Server accepts camera frames");
+    }
+#endif
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+    tts_caching_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "tts_cache"));
+    if (tts_caching_) {
+        ESP_LOGI(TAG, "Server skips the audio of cached sentences");
+    }
+#endif
+#if CONFIG_USE_MEDIA_PLAYBACK
+    media_streaming_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "media"));
+    if (media_streaming_) {
+        ESP_LOGI(TAG, "Server streams media with flow control");
+    }
+#endif
+#if CONFIG_USE_UPLINK_SILENCE_SUPPRESSION
+    uplink_silence_ = cJSON_IsTrue(cJSON_GetObjectItem(features, "silence"));
+    if (uplink_silence_) {
+        ESP_LOGI(TAG, "Uplink audio pauses while the user is silent");
+    }
+#endif
+    // Servers that do not know the hash never echo it and get the descriptors as before
+    auto iot_descriptors = cJSON_GetObjectItem(features, "iot_descriptors");
+    server_has_iot_descriptors_ = !iot_descriptors_hash_.empty() && cJSON_IsString(iot_descriptors) &&
+        iot_descriptors_hash_ == iot_descriptors->valuestring;
+}
+
+bool Protocol::SendCborFields(std::initializer_list<std::pair<const char*, std::string_view>> fields) {
+    std::string message;
+    CborWriter writer(message);
+    writer.Map(fields.size());
+    for (auto& field : fields) {
+        writer.String(field.first);
+        writer.String(field.second);
+    }
+    return SendCbor(message);
+}
+
+cJSON* Protocol::DecodeCbor(const uint8_t* data, size_t size) {
+    CborReader reader(data, size);
+    CborItem root;
+    if (!reader.Next(root) || root.type != kCborMap) {
+        ESP_LOGE(TAG, "Invalid CBOR message, size %u", size);
+        return nullptr;
+    }
+
+    // The frequent messages are flat maps of strings and are handled straight from the buffer
+    ControlMessage message;
+    bool flat = true;
+    for (uint64_t i = 0; i < root.value && flat; i++) {
+        CborItem key, value;
+        if (!reader.Next(key) || !reader.Next(value)) {
+            flat = false;
+            break;
+        }
+        flat = value.IsScalar();
+        if (value.type != kCborString) {
+            continue;
+        }
+        if (key.Equals("type")) {
+            message.type = value.data;
+        } else if (key.Equals("state")) {
+            message.state = value.data;
+        } else if (key.Equals("text")) {
+            message.text = value.data;
+        } else if (key.Equals("emotion")) {
+            message.emotion = value.data;
+        } else if (key.Equals("hash")) {
+            message.hash = value.data;
+        }
+    }
+    if (flat && reader.done() && on_incoming_control_ != nullptr &&
+        (message.type == "tts" || message.type == "stt" || message.type == "llm")) {
+        on_incoming_control_(message);
+        return nullptr;
+    }
+
+    // Anything else is rare enough to go through the existing cJSON handlers
+    CborReader converter(data, size);
+    converter.Next(root);
+    auto json = converter.ToJson(root);
+    if (json == nullptr) {
+        ESP_LOGE(TAG, "Invalid CBOR message, size %u", size);
+    }
+    return json;
+}
+
 void Protocol::SendAbortSpeaking(AbortReason reason) {
+    if (binary_control_) {
+        if (reason == kAbortReasonWakeWordDetected) {
+            SendCborFields({{"session_id", session_id_}, {"type", "abort"}, {"reason", "wake_word_detected"}});
+        } else {
+            SendCborFields({{"session_id", session_id_}, {"type", "abort"}});
+        }
+        return;
+    }
     std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
     if (reason == kAbortReasonWakeWordDetected) {
         message += ",\"reason\":\"wake_word_detected\"";
@@ -40,13 +200,49 @@ void Protocol::SendAbortSpeaking(AbortReason reason) {
     SendText(message);
 }
 
-void Protocol::SendWakeWordDetected(const std::string& wake_word) {
+void Protocol::SendWakeWordDetected(const std::string& wake_word, const std::string& speaker) {
+    // In streaming mode the detection comes before its audio, which continues into the query
+    if (binary_control_) {
+        std::string message;
+        CborWriter writer(message);
+        writer.Map(4 + !speaker.empty() + wake_word_streaming_);
+        writer.String("session_id");
+        writer.String(session_id_);
+        writer.String("type");
+        writer.String("listen");
+        writer.String("state");
+        writer.String("detect");
+        writer.String("text");
+        writer.String(wake_word);
+        if (!speaker.empty()) {
+            writer.String("speaker");
+            writer.String(speaker);
+        }
+        if (wake_word_streaming_) {
+            writer.String("mode");
+            writer.String("stream");
+        }
+        SendCbor(message);
+        return;
+    }
     std::string json = "{\"session_id\":\"" + session_id_ + 
-                      "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
+                      "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"";
+    if (!speaker.empty()) {
+        json += ",\"speaker\":\"" + speaker + "\"";
+    }
+    if (wake_word_streaming_) {
+        json += ",\"mode\":\"stream\"";
+    }
+    json += "}";
     SendText(json);
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
+    if (binary_control_) {
+        const char* name = mode == kListeningModeRealtime ? "realtime" : mode == kListeningModeAutoStop ? "auto" : "manual";
+        SendCborFields({{"session_id", session_id_}, {"type", "listen"}, {"state", "start"}, {"mode", name}});
+        return;
+    }
     std::string message = "{\"session_id\":\"" + session_id_ + "\"";
     message += ",\"type\":\"listen\",\"state\":\"start\"";
     if (mode == kListeningModeRealtime) {
@@ -60,63 +256,93 @@ void Protocol::SendStartListening(ListeningMode mode) {
     SendText(message);
 }
 
-void Protocol::SendStopListening() {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
-    SendText(message);
-}
-
-void Protocol::SendIotDescriptors(const std::string& descriptors) {
-    cJSON* root = cJSON_Parse(descriptors.c_str());
-    if (root == nullptr) {
-        ESP_LOGE(TAG, "Failed to parse IoT descriptors: %s", descriptors.c_str());
+void Protocol::SendStopListening(bool endpointed) {
+    if (binary_control_) {
+        if (endpointed) {
+            SendCborFields({{"session_id", session_id_}, {"type", "listen"}, {"state", "stop"}, {"reason", "vad"}});
+        } else {
+            SendCborFields({{"session_id", session_id_}, {"type", "listen"}, {"state", "stop"}});
+        }
         return;
     }
-
-    if (!cJSON_IsArray(root)) {
-        ESP_LOGE(TAG, "IoT descriptors should be an array");
-        cJSON_Delete(root);
-        return;
+    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"";
+    if (endpointed) {
+        message += ",\"reason\":\"vad\"";
     }
+    message += "}";
+    SendText(message);
+}
 
-    int arraySize = cJSON_GetArraySize(root);
-    for (int i = 0; i < arraySize; ++i) {
-        cJSON* descriptor = cJSON_GetArrayItem(root, i);
-        if (descriptor == nullptr) {
-            ESP_LOGE(TAG, "Failed to get IoT descriptor at index %d", i);
-            continue;
-        }
+// The descriptors are already serialized, each one is wrapped without parsing it again
+void Protocol::SendIotDescriptors(const std::vector<std::string>& descriptors) {
+    for (auto& descriptor : descriptors) {
+        std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"update\":true,\"descriptors\":[";
+        message += descriptor;
+        message += "]}";
+        SendText(message);
+    }
+}
 
-        cJSON* messageRoot = cJSON_CreateObject();
-        cJSON_AddStringToObject(messageRoot, "session_id", session_id_.c_str());
-        cJSON_AddStringToObject(messageRoot, "type", "iot");
-        cJSON_AddBoolToObject(messageRoot, "update", true);
+void Protocol::SendIotStates(const std::string& states) {
+    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"update\":true,\"states\":" + states + "}";
+    SendText(message);
+}
 
-        cJSON* descriptorArray = cJSON_CreateArray();
-        cJSON_AddItemToArray(descriptorArray, cJSON_Duplicate(descriptor, 1));
-        cJSON_AddItemToObject(messageRoot, "descriptors", descriptorArray);
+void Protocol::SendLinkQuality(int level, int downlink_bitrate) {
+    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"link_quality\",\"level\":" +
+        std::to_string(level) + ",\"downlink_bitrate\":" + std::to_string(downlink_bitrate) + "}";
+    SendText(message);
+}
 
-        char* message = cJSON_PrintUnformatted(messageRoot);
-        if (message == nullptr) {
-            ESP_LOGE(TAG, "Failed to print JSON message for IoT descriptor at index %d", i);
-            cJSON_Delete(messageRoot);
-            continue;
+void Protocol::SendOfflineActions(const std::vector<std::string>& actions) {
+    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"offline_actions\",\"actions\":[";
+    for (size_t i = 0; i < actions.size(); i++) {
+        if (i > 0) {
+            message += ",";
         }
+        message += actions[i];
+    }
+    message += "]}";
+    SendText(message);
+}
 
-        SendText(std::string(message));
-        cJSON_free(message);
-        cJSON_Delete(messageRoot);
+void Protocol::SendTtsCacheHit(std::string_view hash) {
+    if (binary_control_) {
+        SendCborFields({{"session_id", session_id_}, {"type", "tts"}, {"state", "cache_hit"}, {"hash", hash}});
+        return;
     }
+    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"tts\",\"state\":\"cache_hit\",\"hash\":\"";
+    message += hash;
+    message += "\"}";
+    SendText(message);
+}
 
-    cJSON_Delete(root);
+// hold / fill are flow control, pause / resume / seek what the user asked for
+void Protocol::SendMediaControl(std::string_view state, int position_ms) {
+    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"media\",\"state\":\"";
+    message += state;
+    message += "\"";
+    if (position_ms >= 0) {
+        message += ",\"position_ms\":" + std::to_string(position_ms);
+    }
+    message += "}";
+    SendText(message);
 }
 
-void Protocol::SendIotStates(const std::string& states) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"update\":true,\"states\":" + states + "}";
+// Tells the server a gap in the uplink is silence and not loss, repeated while it lasts
+void Protocol::SendUplinkSilence(bool silent, int silence_ms) {
+    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"";
+    message += silent ? "silence" : "voice";
+    message += "\",\"duration_ms\":" + std::to_string(silence_ms) + "}";
     SendText(message);
 }
 
 void Protocol::SendMcpMessage(const std::string& payload) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"mcp\",\"payload\":" + payload + "}";
+    std::string message;
+    message.reserve(payload.size() + session_id_.size() + 48);
+    message += "{\"session_id\":\"" + session_id_ + "\",\"type\":\"mcp\",\"payload\":";
+    message += payload;
+    message += "}";
     SendText(message);
 }
 
@@ -3,20 +3,29 @@
 
 #include <cJSON.h>
 #include <string>
+#include <string_view>
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <utility>
+#include <initializer_list>
+
+#include "audio_payload.h"
+#include "json_arena.h"
 
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
-    std::vector<uint8_t> payload;
+    uint32_t sequence = 0;  // 0 if the transport does not number packets
+    bool fec = false;       // payload belongs to the next packet, decode its FEC data
+    int64_t queued_us = 0;  // When an uplink packet entered the send queue, not sent
+    AudioPayload payload;
 };
 
 struct BinaryProtocol2 {
     uint16_t version;
-    uint16_t type;          // Message type (0: OPUS, 1: JSON)
+    uint16_t type;          // Message type (0: OPUS, 1: JSON, 2: CBOR)
     uint32_t reserved;      // Reserved for future use
     uint32_t timestamp;     // Timestamp in milliseconds (used for server-side AEC)
     uint32_t payload_size;  // Payload size in bytes
@@ -24,12 +33,45 @@ struct BinaryProtocol2 {
 } __attribute__((packed));
 
 struct BinaryProtocol3 {
-    uint8_t type;
+    uint8_t type;           // Message type (0: OPUS, 2: CBOR)
     uint8_t reserved;
     uint16_t payload_size;
     uint8_t payload[];
 } __attribute__((packed));
 
+// Version 4 packs several Opus frames into one message, each frame is preceded by its own header
+struct BinaryProtocol4Frame {
+    uint16_t payload_size;
+    uint32_t timestamp;     // Timestamp in milliseconds (used for server-side AEC)
+    uint8_t payload[];
+} __attribute__((packed));
+
+struct BinaryProtocol4 {
+    uint8_t type;           // Message type (0: OPUS, 2: CBOR with the payload right after this header)
+    uint8_t frame_count;
+    uint16_t reserved;
+    uint8_t frames[];       // frame_count BinaryProtocol4Frame
+} __attribute__((packed));
+
+#define BINARY_PROTOCOL_TYPE_CBOR 2
+// One JPEG frame of the camera stream, with the payload where the Opus data would be
+#define BINARY_PROTOCOL_TYPE_JPEG 3
+
+// A flat control message decoded without building a cJSON tree, the views point into the received data
+struct ControlMessage {
+    std::string_view type;
+    std::string_view state;
+    std::string_view text;
+    std::string_view emotion;
+    std::string_view hash;      // tts sentence_start, the content hash of the sentence audio
+};
+
+// What the transport knows about the link, -1 where it cannot tell
+struct TransportStats {
+    int loss_percent = -1;      // Recent downlink packet loss
+    int send_latency_ms = -1;   // Time an audio send takes
+};
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -51,45 +93,144 @@ public:
     inline int server_frame_duration() const {
         return server_frame_duration_;
     }
+    // Downlink channels agreed in the server hello, never more than the codec outputs
+    inline int server_channels() const {
+        return server_channels_;
+    }
+    // Uplink frame duration, proposed in the hello message and confirmed by the server hello
+    inline int client_frame_duration() const {
+        return client_frame_duration_;
+    }
+    inline void SetClientFrameDuration(int frame_duration) {
+        client_frame_duration_ = frame_duration;
+    }
+    // Offered to the server in the hello message, a mono stream is upmixed on the device
+    inline void SetOutputChannels(int channels) {
+        output_channels_ = channels;
+    }
     inline const std::string& session_id() const {
         return session_id_;
     }
+    // The last server hello agreed to verify the wake word while the query streams in
+    inline bool wake_word_streaming() const {
+        return wake_word_streaming_;
+    }
+    // Sent in the hello, the server answers with the same hash when it still has these descriptors
+    inline void SetIotDescriptorsHash(const std::string& hash) {
+        iot_descriptors_hash_ = hash;
+    }
+    inline bool server_has_iot_descriptors() const {
+        return server_has_iot_descriptors_;
+    }
+    // The last server hello accepted camera frames
+    inline bool video_streaming() const {
+        return video_streaming_;
+    }
+    // The last server hello agreed to skip the audio of sentences the device has cached
+    inline bool tts_caching() const {
+        return tts_caching_;
+    }
+    // The last server hello agreed to media streams with flow control
+    inline bool media_streaming() const {
+        return media_streaming_;
+    }
+    // The last server hello agreed to silence markers in place of uplink audio
+    inline bool uplink_silence() const {
+        return uplink_silence_;
+    }
 
     void OnIncomingAudio(std::function<void(AudioStreamPacket&& packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    // Frequent tts, stt and llm messages received as CBOR, everything else still goes to OnIncomingJson
+    void OnIncomingControl(std::function<void(const ControlMessage& message)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
+    // Transports with congestion control ask for a different uplink bitrate
+    void OnUplinkBitrateChanged(std::function<void(int bitrate)> callback);
 
     virtual bool Start() = 0;
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
     virtual bool SendAudio(const AudioStreamPacket& packet) = 0;
-    virtual void SendWakeWordDetected(const std::string& wake_word);
+    // SendAudio may be called from another task than the rest, e.g. the encoder, while the channel opens or closes
+    virtual bool IsAudioSendThreadSafe() const { return false; }
+    // speaker is the enrolled profile the wake word matched, left out when empty
+    virtual void SendWakeWordDetected(const std::string& wake_word, const std::string& speaker = "");
     virtual void SendStartListening(ListeningMode mode);
-    virtual void SendStopListening();
+    // endpointed: the device detected the end of speech, the server can finalize ASR at once
+    virtual void SendStopListening(bool endpointed = false);
     virtual void SendAbortSpeaking(AbortReason reason);
-    virtual void SendIotDescriptors(const std::string& descriptors);
+    // One message per descriptor, as produced by ThingManager::GetDescriptors
+    virtual void SendIotDescriptors(const std::vector<std::string>& descriptors);
     virtual void SendIotStates(const std::string& states);
     virtual void SendMcpMessage(const std::string& message);
+    // Preferred downlink bitrate for the current link, 0 for no preference
+    virtual void SendLinkQuality(int level, int downlink_bitrate);
+    // Command words the device ran while the server was unreachable, each a JSON object
+    virtual void SendOfflineActions(const std::vector<std::string>& actions);
+    // The sentence with this hash plays from the local cache, the server can skip its audio
+    virtual void SendTtsCacheHit(std::string_view hash);
+    // `position_ms` only for a seek
+    virtual void SendMediaControl(std::string_view state, int position_ms = -1);
+    // The uplink stopped because the user is silent, or started again. `silence_ms` is how long it has lasted
+    virtual void SendUplinkSilence(bool silent, int silence_ms);
+    virtual TransportStats GetTransportStats() const { return TransportStats(); }
+    // Main loop: one JPEG frame of the camera stream, false if the transport or the server cannot take it
+    virtual bool SendVideoFrame(const std::vector<uint8_t>& /* jpeg */, uint32_t /* timestamp */) { return false; }
+    // Main loop: the board moved to another network, connections made over the old one are dropped or moved
+    virtual void OnNetworkChanged() {}
+    // Background worker: times the candidate endpoints of the OTA config, the next connection takes the fastest
+    virtual void ProbeEndpoints() {}
 
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
+    std::function<void(const ControlMessage& message)> on_incoming_control_;
     std::function<void(AudioStreamPacket&& packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
+    std::function<void(int bitrate)> on_uplink_bitrate_changed_;
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    int server_channels_ = 1;
+    int client_frame_duration_ = 60;
+    int output_channels_ = 1;
     bool error_occurred_ = false;
+    // The server hello agreed to CBOR for the frequent control messages
+    bool binary_control_ = false;
+    bool wake_word_streaming_ = false;
+    bool video_streaming_ = false;
+    bool tts_caching_ = false;
+    bool media_streaming_ = false;
+    bool uplink_silence_ = false;
+    std::string iot_descriptors_hash_;
+    bool server_has_iot_descriptors_ = false;
+#if CONFIG_USE_JSON_ARENA
+    // The cJSON trees of the received control messages, on the task that receives them
+    JsonArena json_arena_{CONFIG_JSON_ARENA_SIZE};
+#endif
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
 
     virtual bool SendText(const std::string& text) = 0;
+    // Transports that frame control messages themselves can tell CBOR from JSON by the first byte
+    virtual bool SendCbor(const std::string& message) { return SendText(message); }
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
+    void ParseUplinkFrameDuration(const cJSON* audio_params);
+    void AddOutputChannels(cJSON* audio_params);
+    void ParseServerChannels(const cJSON* audio_params);
+    void ParseServerFeatures(const cJSON* root);
+    bool SendCborFields(std::initializer_list<std::pair<const char*, std::string_view>> fields);
+    // Hands flat tts, stt and llm messages to on_incoming_control_, returns anything else as cJSON
+    cJSON* DecodeCbor(const uint8_t* data, size_t size);
+    static inline bool IsCbor(const std::string& payload) {
+        // A CBOR map starts with major type 5, JSON with '{' or whitespace
+        return !payload.empty() && ((uint8_t)payload[0] >> 5) == 5;
+    }
 };
 
 #endif // PROTOCOL_H
@@ -0,0 +1,610 @@
+#include "udp_protocol.h"
+#include "board.h"
+#include "application.h"
+#include "settings.h"
+#include "pipeline_trace.h"
+#include "deferred_log.h"
+#include "system_info.h"
+
+#include <esp_log.h>
+#include <esp_random.h>
+#include <cstring>
+#include <arpa/inet.h>
+#include <algorithm>
+#include "assets/lang_config.h"
+
+#define TAG "UDP"
+
+void DelayBasedRateController::Reset(int bitrate) {
+    *this = DelayBasedRateController();
+    bitrate_ = bitrate;
+}
+
+void DelayBasedRateController::OnRttSample(int rtt_ms) {
+    if (rtt_ms < 0) {
+        return;
+    }
+    smoothed_rtt_ms_ = smoothed_rtt_ms_ == 0 ? rtt_ms : (smoothed_rtt_ms_ * 7 + rtt_ms) / 8;
+
+    // The minimum of the last full window and the current one, so a route change is picked up
+    int64_t now = esp_timer_get_time();
+    if (min_rtt_window_start_us_ == 0 || now - min_rtt_window_start_us_ > UDP_MIN_RTT_WINDOW_MS * 1000) {
+        min_rtt_ms_ = next_min_rtt_ms_ > 0 ? next_min_rtt_ms_ : rtt_ms;
+        next_min_rtt_ms_ = rtt_ms;
+        min_rtt_window_start_us_ = now;
+    }
+    next_min_rtt_ms_ = std::min(next_min_rtt_ms_, rtt_ms);
+    min_rtt_ms_ = std::min(min_rtt_ms_, rtt_ms);
+}
+
+void DelayBasedRateController::OnPingLost() {
+    congested_ = true;
+}
+
+bool DelayBasedRateController::Update() {
+    int queuing_delay = smoothed_rtt_ms_ - min_rtt_ms_;
+    int bitrate = bitrate_;
+    if (congested_ || (smoothed_rtt_ms_ > 0 && queuing_delay > UDP_QUEUING_DELAY_THRESHOLD_MS)) {
+        bitrate = bitrate * 85 / 100;
+    } else if (smoothed_rtt_ms_ > 0 && queuing_delay < UDP_QUEUING_DELAY_THRESHOLD_MS / 2) {
+        bitrate += UDP_BITRATE_STEP;
+    }
+    congested_ = false;
+    bitrate = std::clamp(bitrate, UDP_MIN_BITRATE, UDP_MAX_BITRATE);
+    if (bitrate == bitrate_) {
+        return false;
+    }
+    bitrate_ = bitrate;
+    return true;
+}
+
+static inline uint8_t CharToHex(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return 0;
+}
+
+static std::string DecodeHexString(const std::string& hex_string) {
+    std::string decoded;
+    decoded.reserve(hex_string.size() / 2);
+    for (size_t i = 0; i + 1 < hex_string.size(); i += 2) {
+        decoded.push_back((CharToHex(hex_string[i]) << 4) | CharToHex(hex_string[i + 1]));
+    }
+    return decoded;
+}
+
+static inline uint32_t NowMs() {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+UdpProtocol::UdpProtocol() {
+    event_group_handle_ = xEventGroupCreate();
+    mbedtls_aes_init(&aes_ctx_);
+    send_buffer_.reserve(UDP_PROTOCOL_MAX_PACKET_SIZE);
+
+    esp_timer_create_args_t tick_timer_args = {
+        .callback = [](void* arg) {
+            auto protocol = (UdpProtocol*)arg;
+            Application::GetInstance().Schedule([protocol]() {
+                protocol->OnTick();
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "udp_protocol",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&tick_timer_args, &tick_timer_);
+}
+
+UdpProtocol::~UdpProtocol() {
+    if (tick_timer_ != nullptr) {
+        esp_timer_stop(tick_timer_);
+        esp_timer_delete(tick_timer_);
+    }
+    if (udp_ != nullptr) {
+        delete udp_;
+    }
+    mbedtls_aes_free(&aes_ctx_);
+    vEventGroupDelete(event_group_handle_);
+}
+
+bool UdpProtocol::Start() {
+    // Only connect to server when audio channel is needed
+    return true;
+}
+
+// Called with mutex_ held
+bool UdpProtocol::SendPacket(uint8_t type, uint8_t flags, uint32_t timestamp, uint32_t sequence,
+    const uint8_t* payload, size_t size, std::string* copy) {
+    if (udp_ == nullptr || UDP_PROTOCOL_HEADER_SIZE + size > UDP_PROTOCOL_MAX_PACKET_SIZE) {
+        return false;
+    }
+
+    send_buffer_.resize(UDP_PROTOCOL_HEADER_SIZE + size);
+    auto buffer = (uint8_t*)send_buffer_.data();
+    buffer[0] = type;
+    buffer[1] = flags;
+    *(uint16_t*)&buffer[2] = htons(size);
+    *(uint32_t*)&buffer[4] = htonl(ssrc_);
+    *(uint32_t*)&buffer[8] = htonl(timestamp);
+    *(uint32_t*)&buffer[12] = htonl(sequence);
+
+    if (size > 0) {
+        uint8_t nonce[UDP_PROTOCOL_HEADER_SIZE];
+        memcpy(nonce, buffer, sizeof(nonce));
+        size_t nc_off = 0;
+        uint8_t stream_block[16] = {0};
+        if (mbedtls_aes_crypt_ctr(&aes_ctx_, size, &nc_off, nonce, stream_block, payload,
+            buffer + UDP_PROTOCOL_HEADER_SIZE) != 0) {
+            ESP_LOGE(TAG, "Failed to encrypt packet");
+            return false;
+        }
+    }
+    if (copy != nullptr) {
+        *copy = send_buffer_;
+    }
+    return udp_->Send(send_buffer_) > 0;
+}
+
+bool UdpProtocol::SendAudio(const AudioStreamPacket& packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!channel_opened_) {
+        return false;
+    }
+    return SendPacket(UDP_PACKET_TYPE_AUDIO, 0, packet.timestamp, ++audio_sequence_,
+        packet.payload.data(), packet.payload.size());
+}
+
+bool UdpProtocol::SendText(const std::string& text) {
+#if CONFIG_USE_PIPELINE_TRACE
+    PipelineTrace::GetInstance().Emit(kPipelineEventJsonSend, kPipelinePhaseInstant, text.size());
+#endif
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (udp_ == nullptr) {
+        return false;
+    }
+
+    // A lost datagram is not an error here, the retransmission timer takes care of it
+    size_t offset = 0;
+    do {
+        size_t size = std::min(text.size() - offset, (size_t)UDP_PROTOCOL_CONTROL_FRAGMENT_SIZE);
+        uint8_t flags = 0;
+        if (offset == 0) {
+            flags |= UDP_FLAG_FIRST_FRAGMENT;
+        }
+        if (offset + size == text.size()) {
+            flags |= UDP_FLAG_LAST_FRAGMENT;
+        }
+        uint32_t sequence = ++control_sequence_;
+        auto& pending = pending_controls_[sequence];
+        pending.sent_us = esp_timer_get_time();
+        SendPacket(UDP_PACKET_TYPE_CONTROL, flags, NowMs(), sequence,
+            (const uint8_t*)text.data() + offset, size, &pending.packet);
+        offset += size;
+    } while (offset < text.size());
+    return true;
+}
+
+// Called with mutex_ held
+int UdpProtocol::GetRetransmitTimeout() const {
+    int srtt = rate_controller_.smoothed_rtt();
+    if (srtt == 0) {
+        return UDP_PROTOCOL_INITIAL_RTO_MS;
+    }
+    return std::clamp(srtt * 2, UDP_PROTOCOL_MIN_RTO_MS, UDP_PROTOCOL_MAX_RTO_MS);
+}
+
+// Runs in the main loop
+void UdpProtocol::OnTick() {
+    bool failed = false;
+    bool bitrate_changed = false;
+    int bitrate = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (udp_ == nullptr) {
+            return;
+        }
+
+        int64_t now = esp_timer_get_time();
+        int rto_ms = GetRetransmitTimeout();
+        for (auto& [sequence, pending] : pending_controls_) {
+            // Back off exponentially, the path may be gone for a few seconds during a fade
+            int64_t timeout_us = (int64_t)std::min(rto_ms << pending.retransmits, UDP_PROTOCOL_MAX_RTO_MS) * 1000;
+            if (now - pending.sent_us < timeout_us) {
+                continue;
+            }
+            if (pending.retransmits >= UDP_PROTOCOL_MAX_RETRANSMITS) {
+                ESP_LOGE(TAG, "Control message %lu not acknowledged", sequence);
+                failed = true;
+                break;
+            }
+            pending.retransmits++;
+            pending.sent_us = now;
+            udp_->Send(pending.packet);
+        }
+
+        if (channel_opened_ && now - last_ping_us_ >= UDP_PROTOCOL_PING_INTERVAL_MS * 1000) {
+            if (ping_outstanding_) {
+                rate_controller_.OnPingLost();
+            }
+            bitrate_changed = rate_controller_.Update();
+            bitrate = rate_controller_.bitrate();
+            last_ping_us_ = now;
+            ping_outstanding_ = true;
+            SendPacket(UDP_PACKET_TYPE_PING, 0, NowMs(), 0, nullptr, 0);
+        }
+    }
+
+    if (failed) {
+        esp_timer_stop(tick_timer_);
+        SetError(Lang::Strings::SERVER_TIMEOUT);
+        return;
+    }
+    if (bitrate_changed && on_uplink_bitrate_changed_ != nullptr) {
+        on_uplink_bitrate_changed_(bitrate);
+    }
+}
+
+// Runs in the UDP receive task
+void UdpProtocol::OnMessage(const std::string& data) {
+    if (data.size() < UDP_PROTOCOL_HEADER_SIZE) {
+        DEFERRED_LOGE(TAG, "Invalid packet size: %u", data.size());
+        return;
+    }
+    auto header = (const uint8_t*)data.data();
+    uint8_t type = header[0];
+    uint8_t flags = header[1];
+    size_t payload_size = ntohs(*(uint16_t*)&header[2]);
+    uint32_t ssrc = ntohl(*(uint32_t*)&header[4]);
+    uint32_t timestamp = ntohl(*(uint32_t*)&header[8]);
+    uint32_t sequence = ntohl(*(uint32_t*)&header[12]);
+    if (ssrc != ssrc_ || !(flags & UDP_FLAG_FROM_SERVER) || UDP_PROTOCOL_HEADER_SIZE + payload_size > data.size()) {
+        DEFERRED_LOGW(TAG, "Dropped packet, type %x, ssrc %lx, size %u", type, ssrc, data.size());
+        return;
+    }
+
+    auto Decrypt = [&](uint8_t* output) {
+        uint8_t nonce[UDP_PROTOCOL_HEADER_SIZE];
+        memcpy(nonce, header, sizeof(nonce));
+        size_t nc_off = 0;
+        uint8_t stream_block[16] = {0};
+        return mbedtls_aes_crypt_ctr(&aes_ctx_, payload_size, &nc_off, nonce, stream_block,
+            header + UDP_PROTOCOL_HEADER_SIZE, output) == 0;
+    };
+
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    switch (type) {
+    case UDP_PACKET_TYPE_AUDIO: {
+        if (!receive_tracker_.Accept(sequence, timestamp)) {
+            return;
+        }
+        AudioStreamPacket packet;
+        packet.sample_rate = server_sample_rate_;
+        packet.frame_duration = server_frame_duration_;
+        packet.timestamp = timestamp;
+        packet.sequence = sequence;
+        packet.payload.resize(payload_size);
+        if (!Decrypt(packet.payload.data())) {
+            ESP_LOGE(TAG, "Failed to decrypt audio data");
+            return;
+        }
+        if (on_incoming_audio_ != nullptr) {
+            on_incoming_audio_(std::move(packet));
+        }
+        auto report = receive_tracker_.TakeReport(session_id_);
+        if (!report.empty()) {
+            Application::GetInstance().Schedule([this, report = std::move(report)]() {
+                SendText(report);
+            });
+        }
+        break;
+    }
+    case UDP_PACKET_TYPE_CONTROL: {
+        // Too far ahead to be buffered: no acknowledgement, the server sends it again later
+        if ((int32_t)(sequence - next_incoming_control_) >= UDP_PROTOCOL_MAX_OUT_OF_ORDER) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            SendPacket(UDP_PACKET_TYPE_ACK, 0, timestamp, sequence, nullptr, 0);
+        }
+        if ((int32_t)(sequence - next_incoming_control_) < 0 || incoming_controls_.count(sequence) > 0) {
+            return;  // The acknowledgement was lost, this is a retransmission
+        }
+        auto& incoming = incoming_controls_[sequence];
+        incoming.flags = flags;
+        incoming.payload.resize(payload_size);
+        if (!Decrypt((uint8_t*)incoming.payload.data())) {
+            ESP_LOGE(TAG, "Failed to decrypt control message");
+            incoming_controls_.erase(sequence);
+            return;
+        }
+        DeliverControls();
+        break;
+    }
+    case UDP_PACKET_TYPE_ACK: {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = pending_controls_.find(sequence);
+        if (it != pending_controls_.end()) {
+            // Karn's rule, a retransmitted message does not tell which copy was answered
+            if (it->second.retransmits == 0) {
+                rate_controller_.OnRttSample(NowMs() - timestamp);
+            }
+            pending_controls_.erase(it);
+        }
+        break;
+    }
+    case UDP_PACKET_TYPE_PING: {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rate_controller_.OnRttSample(NowMs() - timestamp);
+        ping_outstanding_ = false;
+        break;
+    }
+    default:
+        ESP_LOGW(TAG, "Unknown packet type: %x", type);
+        break;
+    }
+}
+
+// Hands over the control messages that are complete and in order
+void UdpProtocol::DeliverControls() {
+    while (true) {
+        auto it = incoming_controls_.find(next_incoming_control_);
+        if (it == incoming_controls_.end()) {
+            return;
+        }
+        if (it->second.flags & UDP_FLAG_FIRST_FRAGMENT) {
+            control_reassembly_.clear();
+        }
+        control_reassembly_ += it->second.payload;
+        bool last = it->second.flags & UDP_FLAG_LAST_FRAGMENT;
+        incoming_controls_.erase(it);
+        next_incoming_control_++;
+        if (last) {
+            OnControlMessage(control_reassembly_);
+            control_reassembly_.clear();
+        }
+    }
+}
+
+void UdpProtocol::OnControlMessage(const std::string& payload) {
+#if CONFIG_USE_JSON_ARENA
+    JsonArenaScope arena(json_arena_);
+#endif
+    cJSON* root;
+    if (IsCbor(payload)) {
+        // Frequent messages are handled inside, the rest comes back as cJSON
+        root = DecodeCbor((const uint8_t*)payload.data(), payload.size());
+        if (root == nullptr) {
+            return;
+        }
+    } else {
+        root = cJSON_Parse(payload.c_str());
+        if (root == nullptr) {
+            ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
+            return;
+        }
+    }
+    cJSON* type = cJSON_GetObjectItem(root, "type");
+    if (!cJSON_IsString(type)) {
+        ESP_LOGE(TAG, "Message type is invalid");
+        cJSON_Delete(root);
+        return;
+    }
+
+    if (strcmp(type->valuestring, "hello") == 0) {
+        ParseServerHello(root);
+    } else if (strcmp(type->valuestring, "goodbye") == 0) {
+        auto session_id = cJSON_GetObjectItem(root, "session_id");
+        ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
+        if (session_id == nullptr || session_id_ == session_id->valuestring) {
+            Application::GetInstance().Schedule([this]() {
+                CloseAudioChannel();
+            });
+        }
+    } else if (on_incoming_json_ != nullptr) {
+        on_incoming_json_(root);
+    }
+    cJSON_Delete(root);
+}
+
+void UdpProtocol::CloseAudioChannel() {
+    if (channel_opened_) {
+        std::string message = "{";
+        message += "\"session_id\":\"" + session_id_ + "\",";
+        message += "\"type\":\"goodbye\"";
+        message += "}";
+        SendText(message);
+    }
+
+    esp_timer_stop(tick_timer_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        channel_opened_ = false;
+        if (udp_ != nullptr) {
+            delete udp_;
+            udp_ = nullptr;
+        }
+        pending_controls_.clear();
+        ESP_LOGI(TAG, "Closed, smoothed RTT %d ms, uplink bitrate %d", rate_controller_.smoothed_rtt(),
+            rate_controller_.bitrate());
+    }
+    receive_tracker_.LogStats(TAG);
+
+    if (on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+}
+
+// The session survives a network change: only the socket is replaced, unacknowledged control
+// messages go out again on the next tick and the server follows the ssrc to the new address
+void UdpProtocol::OnNetworkChanged() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (udp_ == nullptr) {
+        return;
+    }
+    delete udp_;
+    udp_ = Board::GetInstance().CreateUdp();
+    udp_->OnMessage([this](const std::string& data) {
+        OnMessage(data);
+    });
+    udp_->Connect(udp_server_, udp_port_);
+    // The path changed, its delays have to be learned again
+    rate_controller_.Reset(rate_controller_.bitrate());
+    last_ping_us_ = 0;
+    ping_outstanding_ = false;
+    ESP_LOGI(TAG, "Moved session %s to the new network", session_id_.c_str());
+}
+
+bool UdpProtocol::OpenAudioChannel() {
+    Settings settings("udp", false);
+    udp_server_ = settings.GetString("server");
+    udp_port_ = settings.GetInt("port");
+    auto key = DecodeHexString(settings.GetString("key"));
+    if (udp_server_.empty() || udp_port_ == 0 || key.size() != 16) {
+        ESP_LOGE(TAG, "UDP server or key is not specified");
+        SetError(Lang::Strings::SERVER_NOT_FOUND);
+        return false;
+    }
+
+    esp_timer_stop(tick_timer_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (udp_ != nullptr) {
+            delete udp_;
+        }
+        mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)key.data(), 128);
+        // A fresh ssrc per session keeps the AES-CTR nonces unique under the same key
+        ssrc_ = esp_random();
+        audio_sequence_ = 0;
+        control_sequence_ = 0;
+        pending_controls_.clear();
+        last_ping_us_ = 0;
+        ping_outstanding_ = false;
+        rate_controller_.Reset(UDP_START_BITRATE);
+        next_incoming_control_ = 1;
+        incoming_controls_.clear();
+        control_reassembly_.clear();
+        receive_tracker_.Reset();
+        channel_opened_ = false;
+
+        udp_ = Board::GetInstance().CreateUdp();
+        udp_->OnMessage([this](const std::string& data) {
+            OnMessage(data);
+        });
+        udp_->Connect(udp_server_, udp_port_);
+    }
+
+    error_occurred_ = false;
+    binary_control_ = false;
+    session_id_ = "";
+    last_incoming_time_ = std::chrono::steady_clock::now();
+    xEventGroupClearBits(event_group_handle_, UDP_PROTOCOL_SERVER_HELLO_EVENT);
+    esp_timer_start_periodic(tick_timer_, UDP_PROTOCOL_TICK_MS * 1000);
+
+    ESP_LOGI(TAG, "Connecting to %s:%d", udp_server_.c_str(), udp_port_);
+    SendText(GetHelloMessage());
+
+    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, UDP_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
+    if (!(bits & UDP_PROTOCOL_SERVER_HELLO_EVENT)) {
+        ESP_LOGE(TAG, "Failed to receive server hello");
+        esp_timer_stop(tick_timer_);
+        SetError(Lang::Strings::SERVER_TIMEOUT);
+        return false;
+    }
+
+    channel_opened_ = true;
+    if (on_uplink_bitrate_changed_ != nullptr) {
+        on_uplink_bitrate_changed_(UDP_START_BITRATE);
+    }
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+    return true;
+}
+
+TransportStats UdpProtocol::GetTransportStats() const {
+    TransportStats stats;
+    stats.loss_percent = receive_tracker_.GetRecentLossPercent();
+    return stats;
+}
+
+bool UdpProtocol::IsAudioChannelOpened() const {
+    return channel_opened_ && !error_occurred_ && !IsTimeout();
+}
+
+std::string UdpProtocol::GetHelloMessage() {
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "type", "hello");
+    cJSON_AddNumberToObject(root, "version", 1);
+    cJSON_AddStringToObject(root, "transport", "udp_direct");
+    cJSON* features = cJSON_CreateObject();
+#if CONFIG_USE_SERVER_AEC
+    cJSON_AddBoolToObject(features, "aec", true);
+#endif
+#if CONFIG_IOT_PROTOCOL_MCP
+    cJSON_AddBoolToObject(features, "mcp", true);
+#endif
+    cJSON_AddBoolToObject(features, "receiver_report", true);
+#if CONFIG_USE_CBOR_CONTROL
+    cJSON_AddBoolToObject(features, "cbor", true);
+#endif
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+    cJSON_AddBoolToObject(features, "tts_cache", true);
+#endif
+#if CONFIG_USE_MEDIA_PLAYBACK
+    cJSON_AddBoolToObject(features, "media", true);
+#endif
+#if CONFIG_USE_UPLINK_SILENCE_SUPPRESSION
+    cJSON_AddBoolToObject(features, "silence", true);
+#endif
+    if (!iot_descriptors_hash_.empty()) {
+        cJSON_AddStringToObject(features, "iot_descriptors", iot_descriptors_hash_.c_str());
+    }
+    cJSON_AddItemToObject(root, "features", features);
+    cJSON_AddStringToObject(root, "device_id", SystemInfo::GetMacAddress().c_str());
+    cJSON_AddStringToObject(root, "client_id", Board::GetInstance().GetUuid().c_str());
+    cJSON* audio_params = cJSON_CreateObject();
+    cJSON_AddStringToObject(audio_params, "format", "opus");
+    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
+    cJSON_AddNumberToObject(audio_params, "channels", 1);
+    AddOutputChannels(audio_params);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", client_frame_duration_);
+    cJSON_AddItemToObject(root, "audio_params", audio_params);
+    std::string message = PrintJson(root);
+    cJSON_Delete(root);
+    return message;
+}
+
+void UdpProtocol::ParseServerHello(const cJSON* root) {
+    auto transport = cJSON_GetObjectItem(root, "transport");
+    if (!cJSON_IsString(transport) || strcmp(transport->valuestring, "udp_direct") != 0) {
+        ESP_LOGE(TAG, "Unsupported transport");
+        return;
+    }
+
+    auto session_id = cJSON_GetObjectItem(root, "session_id");
+    if (cJSON_IsString(session_id)) {
+        session_id_ = session_id->valuestring;
+        ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
+    }
+    ParseServerFeatures(root);
+
+    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
+    ParseServerChannels(audio_params);
+    if (cJSON_IsObject(audio_params)) {
+        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
+        if (cJSON_IsNumber(sample_rate)) {
+            server_sample_rate_ = sample_rate->valueint;
+        }
+        auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
+        if (cJSON_IsNumber(frame_duration)) {
+            server_frame_duration_ = frame_duration->valueint;
+        }
+        ParseUplinkFrameDuration(audio_params);
+    }
+
+    xEventGroupSetBits(event_group_handle_, UDP_PROTOCOL_SERVER_HELLO_EVENT);
+}
@@ -0,0 +1,163 @@
+#ifndef UDP_PROTOCOL_H
+#define UDP_PROTOCOL_H
+
+
+#include "protocol.h"
+#include "udp_receive_tracker.h"
+#include <udp.h>
+#include <cJSON.h>
+#include <mbedtls/aes.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+#define UDP_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+
+// |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|, also the AES-CTR nonce
+#define UDP_PROTOCOL_HEADER_SIZE 16
+#define UDP_PROTOCOL_MAX_PACKET_SIZE 1500
+// Control messages are split so that no datagram needs IP fragmentation
+#define UDP_PROTOCOL_CONTROL_FRAGMENT_SIZE 1024
+
+#define UDP_PACKET_TYPE_AUDIO 0x01
+#define UDP_PACKET_TYPE_CONTROL 0x02
+#define UDP_PACKET_TYPE_ACK 0x03
+#define UDP_PACKET_TYPE_PING 0x04
+
+#define UDP_FLAG_FROM_SERVER 0x01        // Keeps the nonces of both directions apart
+#define UDP_FLAG_FIRST_FRAGMENT 0x02
+#define UDP_FLAG_LAST_FRAGMENT 0x04
+
+#define UDP_PROTOCOL_TICK_MS 100
+#define UDP_PROTOCOL_PING_INTERVAL_MS 1000
+#define UDP_PROTOCOL_INITIAL_RTO_MS 1000
+#define UDP_PROTOCOL_MIN_RTO_MS 200
+#define UDP_PROTOCOL_MAX_RTO_MS 3000
+#define UDP_PROTOCOL_MAX_RETRANSMITS 6
+// Control messages waiting for the one that is missing before them
+#define UDP_PROTOCOL_MAX_OUT_OF_ORDER 32
+
+#define UDP_MIN_BITRATE 8000
+#define UDP_MAX_BITRATE 32000
+#define UDP_START_BITRATE 24000
+#define UDP_BITRATE_STEP 1000
+// Round trip time above the path minimum that is taken as a filling bottleneck queue
+#define UDP_QUEUING_DELAY_THRESHOLD_MS 80
+#define UDP_MIN_RTT_WINDOW_MS 10000
+
+/*
+ * Uplink bitrate from round trip times, the server only has to echo pings.
+ * Any delay above the smallest recent RTT is queuing somewhere on the path:
+ * above the threshold the bitrate backs off multiplicatively, well below it
+ * it creeps back up. A ping without answer counts as congestion too.
+ */
+class DelayBasedRateController {
+public:
+    void Reset(int bitrate);
+    void OnRttSample(int rtt_ms);
+    void OnPingLost();
+    // Once per ping interval, returns true if the bitrate changed
+    bool Update();
+
+    inline int bitrate() const { return bitrate_; }
+    inline int smoothed_rtt() const { return smoothed_rtt_ms_; }
+
+private:
+    int bitrate_ = UDP_START_BITRATE;
+    int smoothed_rtt_ms_ = 0;
+    int min_rtt_ms_ = 0;
+    int next_min_rtt_ms_ = 0;       // Minimum of the window being collected
+    int64_t min_rtt_window_start_us_ = 0;
+    bool congested_ = false;
+};
+
+/*
+ * Control JSON and audio over one encrypted UDP flow, so a stalled TCP
+ * stream can no longer hold up playback during a signal fade.
+ *
+ * Audio is sent once and never retransmitted, the jitter buffer conceals
+ * what is lost. Control messages are numbered separately, acknowledged
+ * and retransmitted until acknowledged, and handed over in order; long
+ * ones are split into fragments. Pings measure the round trip time that
+ * drives the retransmission timeout and the uplink bitrate.
+ *
+ * Every packet starts with the 16 byte header of the MQTT UDP channel and
+ * its payload is encrypted with AES-CTR using the header as the nonce.
+ * The key is provisioned through the "udp" section of the OTA config.
+ * The server keys sessions by ssrc, so a session moves with the device
+ * when it changes networks.
+ */
+class UdpProtocol : public Protocol {
+public:
+    UdpProtocol();
+    ~UdpProtocol();
+
+    bool Start() override;
+    bool SendAudio(const AudioStreamPacket& packet) override;
+    // The socket and the session state are only used under mutex_
+    bool IsAudioSendThreadSafe() const override { return true; }
+    bool OpenAudioChannel() override;
+    void CloseAudioChannel() override;
+    bool IsAudioChannelOpened() const override;
+    TransportStats GetTransportStats() const override;
+    void OnNetworkChanged() override;
+
+private:
+    struct PendingControl {
+        std::string packet;         // Encrypted, ready to send again
+        int64_t sent_us = 0;
+        int retransmits = 0;
+    };
+
+    struct IncomingControl {
+        uint8_t flags = 0;
+        std::string payload;
+    };
+
+    EventGroupHandle_t event_group_handle_;
+    esp_timer_handle_t tick_timer_ = nullptr;
+
+    // Guards udp_, the send state and the RTT measurements, packets are sent from the main loop
+    // and acknowledgements and RTT samples come from the receive task
+    std::mutex mutex_;
+    Udp* udp_ = nullptr;
+    std::atomic<bool> channel_opened_ = false;
+    mbedtls_aes_context aes_ctx_;
+    bool has_key_ = false;
+    std::string udp_server_;
+    int udp_port_ = 0;
+    uint32_t ssrc_ = 0;
+    uint32_t audio_sequence_ = 0;
+    uint32_t control_sequence_ = 0;
+    std::string send_buffer_;
+    std::map<uint32_t, PendingControl> pending_controls_;
+    int64_t last_ping_us_ = 0;
+    bool ping_outstanding_ = false;
+    DelayBasedRateController rate_controller_;
+
+    // Receive task only
+    uint32_t next_incoming_control_ = 1;
+    std::map<uint32_t, IncomingControl> incoming_controls_;
+    std::string control_reassembly_;
+    UdpReceiveTracker receive_tracker_;
+
+    void OnTick();
+    void OnMessage(const std::string& data);
+    void OnControlMessage(const std::string& payload);
+    void DeliverControls();
+    bool SendPacket(uint8_t type, uint8_t flags, uint32_t timestamp, uint32_t sequence,
+        const uint8_t* payload, size_t size, std::string* copy = nullptr);
+    int GetRetransmitTimeout() const;
+    void ParseServerHello(const cJSON* root);
+    std::string GetHelloMessage();
+
+    bool SendText(const std::string& text) override;
+};
+
+
+#endif // UDP_PROTOCOL_H
@@ -0,0 +1,111 @@
+#include "udp_receive_tracker.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+#include <algorithm>
+
+void UdpReceiveTracker::Reset() {
+    *this = UdpReceiveTracker();
+}
+
+bool UdpReceiveTracker::Accept(uint32_t sequence, uint32_t timestamp) {
+    if (stats_.received == 0 && received_window_ == 0) {
+        first_sequence_ = sequence;
+        highest_sequence_ = sequence;
+        received_window_ = 1;
+    } else {
+        int32_t delta = (int32_t)(sequence - highest_sequence_);
+        if (delta > 0) {
+            received_window_ = delta >= UDP_REORDER_WINDOW ? 0 : received_window_ << delta;
+            received_window_ |= 1;
+            highest_sequence_ = sequence;
+        } else {
+            uint32_t age = -delta;
+            if (age >= UDP_REORDER_WINDOW) {
+                stats_.late++;
+                return false;
+            }
+            if (received_window_ & (1ULL << age)) {
+                stats_.duplicates++;
+                return false;
+            }
+            received_window_ |= 1ULL << age;
+            stats_.reordered++;
+        }
+    }
+    stats_.received++;
+    uint32_t expected = highest_sequence_ - first_sequence_ + 1;
+    stats_.lost = expected > stats_.received ? expected - stats_.received : 0;
+
+    // Interarrival jitter from the server timestamps, which are in milliseconds
+    int64_t arrival_ms = esp_timer_get_time() / 1000;
+    if (timestamp != 0 && last_timestamp_ != 0 && sequence == highest_sequence_) {
+        int64_t deviation = (arrival_ms - last_arrival_ms_) - (int32_t)(timestamp - last_timestamp_);
+        if (deviation < 0) {
+            deviation = -deviation;
+        }
+        jitter_ms_x16_ += deviation - (jitter_ms_x16_ + 8) / 16;
+        stats_.jitter_ms = jitter_ms_x16_ / 16;
+    }
+    if (sequence == highest_sequence_) {
+        last_arrival_ms_ = arrival_ms;
+        last_timestamp_ = timestamp;
+    }
+    return true;
+}
+
+std::string UdpReceiveTracker::TakeReport(const std::string& session_id) {
+    int64_t now = esp_timer_get_time();
+    if (last_report_us_ == 0) {
+        last_report_us_ = now;
+        return "";
+    }
+    if (now - last_report_us_ < UDP_RECEIVER_REPORT_INTERVAL_MS * 1000) {
+        return "";
+    }
+    last_report_us_ = now;
+
+    // Like an RTCP receiver report: the lost fraction of this interval in 1/256, plus running totals
+    uint32_t expected = highest_sequence_ - first_sequence_ + 1;
+    uint32_t interval_expected = expected - report_expected_;
+    uint32_t interval_received = stats_.received - report_received_;
+    report_expected_ = expected;
+    report_received_ = stats_.received;
+    int fraction_lost = 0;
+    if (interval_expected > interval_received) {
+        fraction_lost = (interval_expected - interval_received) * 256 / interval_expected;
+    }
+    recent_loss_percent_ = std::min(fraction_lost, 255) * 100 / 256;
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "session_id", session_id.c_str());
+    cJSON_AddStringToObject(root, "type", "receiver_report");
+    cJSON_AddNumberToObject(root, "fraction_lost", std::min(fraction_lost, 255));
+    cJSON_AddNumberToObject(root, "received", stats_.received);
+    cJSON_AddNumberToObject(root, "lost", stats_.lost);
+    cJSON_AddNumberToObject(root, "reordered", stats_.reordered);
+    cJSON_AddNumberToObject(root, "duplicates", stats_.duplicates);
+    cJSON_AddNumberToObject(root, "late", stats_.late);
+    cJSON_AddNumberToObject(root, "jitter", stats_.jitter_ms);
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string message(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return message;
+}
+
+int UdpReceiveTracker::GetRecentLossPercent() const {
+    // Read from the main loop while the receive task updates it, an int is read in one go
+    if (last_report_us_ == 0 || esp_timer_get_time() - last_report_us_ > 2 * UDP_RECEIVER_REPORT_INTERVAL_MS * 1000) {
+        return -1;
+    }
+    return recent_loss_percent_;
+}
+
+void UdpReceiveTracker::LogStats(const char* tag) const {
+    if (stats_.received > 0) {
+        ESP_LOGI(tag, "UDP receive: %lu received, %lu lost, %lu reordered, %lu duplicates, %lu late, jitter %lu ms",
+            stats_.received, stats_.lost, stats_.reordered, stats_.duplicates, stats_.late, stats_.jitter_ms);
+    }
+}
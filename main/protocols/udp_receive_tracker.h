@@ -0,0 +1,53 @@
+#ifndef UDP_RECEIVE_TRACKER_H
+#define UDP_RECEIVE_TRACKER_H
+
+#include <string>
+#include <cstdint>
+
+// Sequences remembered for duplicate detection, anything older is too late for the jitter buffer
+#define UDP_REORDER_WINDOW 64
+#define UDP_RECEIVER_REPORT_INTERVAL_MS 5000
+
+struct UdpReceiveStats {
+    uint32_t received = 0;
+    uint32_t lost = 0;          // In the sequence range seen so far but never received
+    uint32_t reordered = 0;
+    uint32_t duplicates = 0;
+    uint32_t late = 0;          // Older than the reorder window
+    uint32_t jitter_ms = 0;     // RFC 3550 interarrival jitter
+};
+
+/*
+ * Sequence bookkeeping for audio received over UDP. Out-of-order packets
+ * are accepted, the jitter buffer puts them back in order and conceals the
+ * sequences that never arrive; duplicates and packets older than the
+ * window are rejected. Only used from the UDP receive callback.
+ */
+class UdpReceiveTracker {
+public:
+    void Reset();
+    // False if the packet should be dropped
+    bool Accept(uint32_t sequence, uint32_t timestamp);
+    // A receiver_report message once per UDP_RECEIVER_REPORT_INTERVAL_MS, otherwise empty
+    std::string TakeReport(const std::string& session_id);
+    void LogStats(const char* tag) const;
+    // Loss in the last report interval, -1 if no downlink audio came in lately
+    int GetRecentLossPercent() const;
+
+    inline const UdpReceiveStats& stats() const { return stats_; }
+
+private:
+    uint32_t first_sequence_ = 0;
+    uint32_t highest_sequence_ = 0;
+    uint64_t received_window_ = 0;  // Bit n set if highest_sequence_ - n was received
+    int64_t last_arrival_ms_ = 0;
+    uint32_t last_timestamp_ = 0;
+    int64_t jitter_ms_x16_ = 0;
+    int64_t last_report_us_ = 0;
+    uint32_t report_expected_ = 0;
+    uint32_t report_received_ = 0;
+    int recent_loss_percent_ = -1;
+    UdpReceiveStats stats_;
+};
+
+#endif // UDP_RECEIVE_TRACKER_H
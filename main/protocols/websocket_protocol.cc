@@ -3,8 +3,10 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "pipeline_trace.h"
 
 #include <cstring>
+#include <algorithm>
 #include <cJSON.h>
 #include <esp_log.h>
 #include <arpa/inet.h>
@@ -17,6 +19,10 @@ WebsocketProtocol::WebsocketProtocol() {
 }
 
 WebsocketProtocol::~WebsocketProtocol() {
+    if (keep_warm_timer_ != nullptr) {
+        esp_timer_stop(keep_warm_timer_);
+        esp_timer_delete(keep_warm_timer_);
+    }
     if (websocket_ != nullptr) {
         delete websocket_;
     }
@@ -24,10 +30,49 @@ WebsocketProtocol::~WebsocketProtocol() {
 }
 
 bool WebsocketProtocol::Start() {
-    // Only connect to server when audio channel is needed
+#if CONFIG_WEBSOCKET_KEEP_WARM
+    // Connect while idle and keep the connection alive, so a wake word does not wait for DNS, TCP and TLS
+    esp_timer_create_args_t keep_warm_timer_args = {
+        .callback = [](void* arg) {
+            auto protocol = (WebsocketProtocol*)arg;
+            Application::GetInstance().Schedule([protocol]() {
+                protocol->KeepWarm();
+            });
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "ws_keep_warm",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&keep_warm_timer_args, &keep_warm_timer_);
+    esp_timer_start_periodic(keep_warm_timer_, CONFIG_WEBSOCKET_PING_INTERVAL_SECONDS * 1000000ULL);
+#endif
+    // Otherwise only connect to server when audio channel is needed
     return true;
 }
 
+// Runs in the main loop
+void WebsocketProtocol::KeepWarm() {
+    if (websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_) {
+        if (!channel_opened_ || Application::GetInstance().GetDeviceState() == kDeviceStateIdle) {
+            websocket_->Ping();
+            // Pongs are not passed to OnData, a live connection must not look timed out
+            last_incoming_time_ = std::chrono::steady_clock::now();
+        }
+        return;
+    }
+
+    if (Application::GetInstance().GetDeviceState() != kDeviceStateIdle || !reconnect_backoff_.CanAttempt()) {
+        return;
+    }
+    ESP_LOGI(TAG, "Reconnecting warm connection");
+    if (Connect(false)) {
+        reconnect_backoff_.OnSuccess();
+    } else {
+        reconnect_backoff_.OnFailure();
+    }
+}
+
 bool WebsocketProtocol::SendAudio(const AudioStreamPacket& packet) {
     if (websocket_ == nullptr) {
         return false;
@@ -44,7 +89,7 @@ bool WebsocketProtocol::SendAudio(const AudioStreamPacket& packet) {
         bp2->payload_size = htonl(packet.payload.size());
         memcpy(bp2->payload, packet.payload.data(), packet.payload.size());
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        return SendBinary(serialized.data(), serialized.size());
     } else if (version_ == 3) {
         std::string serialized;
         serialized.resize(sizeof(BinaryProtocol3) + packet.payload.size());
@@ -54,17 +99,114 @@ bool WebsocketProtocol::SendAudio(const AudioStreamPacket& packet) {
         bp3->payload_size = htons(packet.payload.size());
         memcpy(bp3->payload, packet.payload.data(), packet.payload.size());
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        return SendBinary(serialized.data(), serialized.size());
+    } else if (version_ == 4) {
+        // Frames are written straight into the message buffer, which is sent once it holds a full batch
+        if (batched_frames_ == 0) {
+            send_buffer_.resize(sizeof(BinaryProtocol4));
+            auto bp4 = (BinaryProtocol4*)send_buffer_.data();
+            bp4->type = 0;
+            bp4->reserved = 0;
+        }
+        size_t offset = send_buffer_.size();
+        send_buffer_.resize(offset + sizeof(BinaryProtocol4Frame) + packet.payload.size());
+        auto frame = (BinaryProtocol4Frame*)&send_buffer_[offset];
+        frame->payload_size = htons(packet.payload.size());
+        frame->timestamp = htonl(packet.timestamp);
+        memcpy(frame->payload, packet.payload.data(), packet.payload.size());
+        batched_frames_++;
+
+        if (batched_frames_ < frames_per_message_) {
+            return true;
+        }
+        return FlushAudio();
     } else {
-        return websocket_->Send(packet.payload.data(), packet.payload.size(), true);
+        return SendBinary(packet.payload.data(), packet.payload.size());
+    }
+}
+
+// Sent without SendBinary, a frame takes much longer than an audio packet and would skew the send latency
+bool WebsocketProtocol::SendVideoFrame(const std::vector<uint8_t>& jpeg, uint32_t timestamp) {
+    if (websocket_ == nullptr || !video_streaming_ || version_ < 2) {
+        return false;
+    }
+
+    std::string serialized;
+    if (version_ == 2) {
+        serialized.resize(sizeof(BinaryProtocol2) + jpeg.size());
+        auto bp2 = (BinaryProtocol2*)serialized.data();
+        bp2->version = htons(version_);
+        bp2->type = htons(BINARY_PROTOCOL_TYPE_JPEG);
+        bp2->reserved = 0;
+        bp2->timestamp = htonl(timestamp);
+        bp2->payload_size = htonl(jpeg.size());
+        memcpy(bp2->payload, jpeg.data(), jpeg.size());
+    } else if (version_ == 3) {
+        if (jpeg.size() > UINT16_MAX) {
+            ESP_LOGW(TAG, "Video frame too large: %u bytes", jpeg.size());
+            return false;
+        }
+        serialized.resize(sizeof(BinaryProtocol3) + jpeg.size());
+        auto bp3 = (BinaryProtocol3*)serialized.data();
+        bp3->type = BINARY_PROTOCOL_TYPE_JPEG;
+        bp3->reserved = 0;
+        bp3->payload_size = htons(jpeg.size());
+        memcpy(bp3->payload, jpeg.data(), jpeg.size());
+    } else {
+        serialized.resize(sizeof(BinaryProtocol4) + jpeg.size());
+        auto bp4 = (BinaryProtocol4*)serialized.data();
+        bp4->type = BINARY_PROTOCOL_TYPE_JPEG;
+        bp4->frame_count = 0;
+        bp4->reserved = 0;
+        memcpy(bp4->frames, jpeg.data(), jpeg.size());
+    }
+
+    if (!FlushAudio() || !websocket_->Send(serialized.data(), serialized.size(), true)) {
+        ESP_LOGE(TAG, "Failed to send video frame");
+        return false;
     }
+    return true;
+}
+
+bool WebsocketProtocol::SendBinary(const void* data, size_t size) {
+    int64_t start = esp_timer_get_time();
+    bool success = websocket_->Send(data, size, true);
+    int latency_us = esp_timer_get_time() - start;
+    send_latency_us_ = send_latency_us_ < 0 ? latency_us : (send_latency_us_ * 7 + latency_us) / 8;
+    return success;
+}
+
+TransportStats WebsocketProtocol::GetTransportStats() const {
+    TransportStats stats;
+    stats.send_latency_ms = send_latency_us_ < 0 ? -1 : send_latency_us_ / 1000;
+    return stats;
+}
+
+bool WebsocketProtocol::FlushAudio() {
+    if (batched_frames_ == 0) {
+        return true;
+    }
+    auto bp4 = (BinaryProtocol4*)send_buffer_.data();
+    bp4->frame_count = batched_frames_;
+    batched_frames_ = 0;
+    return SendBinary(send_buffer_.data(), send_buffer_.size());
 }
 
 bool WebsocketProtocol::SendText(const std::string& text) {
+#if CONFIG_USE_PIPELINE_TRACE
+    PipelineTrace::GetInstance().Emit(kPipelineEventJsonSend, kPipelinePhaseInstant, text.size());
+#endif
     if (websocket_ == nullptr) {
         return false;
     }
 
+    // Audio still waiting for a full batch goes first, the server expects it before e.g. stop listening
+    if (!FlushAudio()) {
+        ESP_LOGE(TAG, "Failed to send audio");
+        SetError(Lang::Strings::SERVER_ERROR);
+        return false;
+    }
+
     if (!websocket_->Send(text)) {
         ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
         SetError(Lang::Strings::SERVER_ERROR);
@@ -74,24 +216,151 @@ bool WebsocketProtocol::SendText(const std::string& text) {
     return true;
 }
 
+// Version 1 binary messages are bare Opus, so CBOR is only negotiated from version 2 on
+bool WebsocketProtocol::SendCbor(const std::string& message) {
+    if (websocket_ == nullptr) {
+        return false;
+    }
+
+    std::string serialized;
+    if (version_ == 2) {
+        serialized.resize(sizeof(BinaryProtocol2) + message.size());
+        auto bp2 = (BinaryProtocol2*)serialized.data();
+        bp2->version = htons(version_);
+        bp2->type = htons(BINARY_PROTOCOL_TYPE_CBOR);
+        bp2->reserved = 0;
+        bp2->timestamp = 0;
+        bp2->payload_size = htonl(message.size());
+        memcpy(bp2->payload, message.data(), message.size());
+    } else if (version_ == 3) {
+        serialized.resize(sizeof(BinaryProtocol3) + message.size());
+        auto bp3 = (BinaryProtocol3*)serialized.data();
+        bp3->type = BINARY_PROTOCOL_TYPE_CBOR;
+        bp3->reserved = 0;
+        bp3->payload_size = htons(message.size());
+        memcpy(bp3->payload, message.data(), message.size());
+    } else {
+        serialized.resize(sizeof(BinaryProtocol4) + message.size());
+        auto bp4 = (BinaryProtocol4*)serialized.data();
+        bp4->type = BINARY_PROTOCOL_TYPE_CBOR;
+        bp4->frame_count = 0;
+        bp4->reserved = 0;
+        memcpy(bp4->frames, message.data(), message.size());
+    }
+
+    if (!FlushAudio() || !websocket_->Send(serialized.data(), serialized.size(), true)) {
+        ESP_LOGE(TAG, "Failed to send CBOR message");
+        SetError(Lang::Strings::SERVER_ERROR);
+        return false;
+    }
+    return true;
+}
+
+// Returns true if the binary message was a CBOR control message rather than audio
+bool WebsocketProtocol::ParseBinaryControl(const char* data, size_t len) {
+    const uint8_t* payload = nullptr;
+    size_t payload_size = 0;
+    if (version_ == 2 && len >= sizeof(BinaryProtocol2)) {
+        auto bp2 = (const BinaryProtocol2*)data;
+        if (ntohs(bp2->type) != BINARY_PROTOCOL_TYPE_CBOR) {
+            return false;
+        }
+        payload = bp2->payload;
+        payload_size = std::min((size_t)ntohl(bp2->payload_size), len - sizeof(BinaryProtocol2));
+    } else if (version_ == 3 && len >= sizeof(BinaryProtocol3)) {
+        auto bp3 = (const BinaryProtocol3*)data;
+        if (bp3->type != BINARY_PROTOCOL_TYPE_CBOR) {
+            return false;
+        }
+        payload = bp3->payload;
+        payload_size = std::min((size_t)ntohs(bp3->payload_size), len - sizeof(BinaryProtocol3));
+    } else if (version_ == 4 && len >= sizeof(BinaryProtocol4)) {
+        auto bp4 = (const BinaryProtocol4*)data;
+        if (bp4->type != BINARY_PROTOCOL_TYPE_CBOR) {
+            return false;
+        }
+        payload = bp4->frames;
+        payload_size = len - sizeof(BinaryProtocol4);
+    } else {
+        return false;
+    }
+
+    auto root = DecodeCbor(payload, payload_size);
+    if (root != nullptr) {
+        HandleJson(root);
+        cJSON_Delete(root);
+    }
+    return true;
+}
+
+void WebsocketProtocol::HandleJson(const cJSON* root) {
+    auto type = cJSON_GetObjectItem(root, "type");
+    if (!cJSON_IsString(type)) {
+        ESP_LOGE(TAG, "Missing message type");
+        return;
+    }
+    if (strcmp(type->valuestring, "hello") == 0) {
+        ParseServerHello(root);
+    } else if (on_incoming_json_ != nullptr) {
+        on_incoming_json_(root);
+    }
+}
+
 bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+    return channel_opened_ && websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
+    channel_opened_ = false;
+    batched_frames_ = 0;
     if (websocket_ != nullptr) {
         delete websocket_;
         websocket_ = nullptr;
     }
 }
 
+// The socket is bound to the old network. The next turn or keep-warm tick reconnects over the new one,
+// and with keep-warm the hello asks the server to continue the same session.
+void WebsocketProtocol::OnNetworkChanged() {
+    bool was_opened = channel_opened_.exchange(false);
+    batched_frames_ = 0;
+    if (websocket_ != nullptr) {
+        delete websocket_;
+        websocket_ = nullptr;
+    }
+    if (was_opened && on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+}
+
+void WebsocketProtocol::ProbeEndpoints() {
+    endpoint_selector_.Probe();
+}
+
 bool WebsocketProtocol::OpenAudioChannel() {
+    if (websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout()) {
+        ESP_LOGI(TAG, "Using warm connection, session: %s", session_id_.c_str());
+    } else if (!Connect(true)) {
+        reconnect_backoff_.OnFailure();
+        return false;
+    }
+    reconnect_backoff_.OnSuccess();
+
+    channel_opened_ = true;
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+    return true;
+}
+
+bool WebsocketProtocol::Connect(bool report_error) {
     if (websocket_ != nullptr) {
         delete websocket_;
+        websocket_ = nullptr;
     }
 
     Settings settings("websocket", false);
-    std::string url = settings.GetString("url");
+    std::string url = endpoint_selector_.Select();
     std::string token = settings.GetString("token");
     int version = settings.GetInt("version");
     if (version != 0) {
@@ -99,6 +368,10 @@ bool WebsocketProtocol::OpenAudioChannel() {
     }
 
     error_occurred_ = false;
+    binary_control_ = false;
+    send_latency_us_ = -1;
+    frames_per_message_ = 1;
+    batched_frames_ = 0;
 
     websocket_ = Board::GetInstance().CreateWebSocket();
     
@@ -115,7 +388,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
-            if (on_incoming_audio_ != nullptr) {
+            if (!ParseBinaryControl(data, len) && on_incoming_audio_ != nullptr) {
                 if (version_ == 2) {
                     BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
                     bp2->version = ntohs(bp2->version);
@@ -127,7 +400,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
                         .sample_rate = server_sample_rate_,
                         .frame_duration = server_frame_duration_,
                         .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
+                        .payload = AudioPayload(payload, payload + bp2->payload_size)
                     });
                 } else if (version_ == 3) {
                     BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
@@ -138,40 +411,39 @@ bool WebsocketProtocol::OpenAudioChannel() {
                         .sample_rate = server_sample_rate_,
                         .frame_duration = server_frame_duration_,
                         .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
+                        .payload = AudioPayload(payload, payload + bp3->payload_size)
                     });
+                } else if (version_ == 4) {
+                    ParseBinaryProtocol4(data, len);
                 } else {
                     on_incoming_audio_(AudioStreamPacket{
                         .sample_rate = server_sample_rate_,
                         .frame_duration = server_frame_duration_,
                         .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
+                        .payload = AudioPayload((uint8_t*)data, (uint8_t*)data + len)
                     });
                 }
             }
         } else {
             // Parse JSON data
+#if CONFIG_USE_JSON_ARENA
+            JsonArenaScope arena(json_arena_);
+#endif
             auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (cJSON_IsString(type)) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
-                } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
-                    }
-                }
+            if (root != nullptr) {
+                HandleJson(root);
+                cJSON_Delete(root);
             } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
+                ESP_LOGE(TAG, "Failed to parse json message, data: %s", data);
             }
-            cJSON_Delete(root);
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
     websocket_->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Websocket disconnected");
-        if (on_audio_channel_closed_ != nullptr) {
+        // A warm connection going away is not noticed by the application, the next turn reconnects
+        if (channel_opened_.exchange(false) && on_audio_channel_closed_ != nullptr) {
             on_audio_channel_closed_();
         }
     });
@@ -179,13 +451,21 @@ bool WebsocketProtocol::OpenAudioChannel() {
     ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version_);
     if (!websocket_->Connect(url.c_str())) {
         ESP_LOGE(TAG, "Failed to connect to websocket server");
-        SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+        endpoint_selector_.OnFailure();
+        if (report_error) {
+            SetError(Lang::Strings::SERVER_NOT_CONNECTED);
+        }
         return false;
     }
 
     // Send hello message to describe the client
     auto message = GetHelloMessage();
-    if (!SendText(message)) {
+    if (!websocket_->Send(message)) {
+        ESP_LOGE(TAG, "Failed to send hello");
+        endpoint_selector_.OnFailure();
+        if (report_error) {
+            SetError(Lang::Strings::SERVER_ERROR);
+        }
         return false;
     }
 
@@ -193,14 +473,14 @@ bool WebsocketProtocol::OpenAudioChannel() {
     EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
     if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
         ESP_LOGE(TAG, "Failed to receive server hello");
-        SetError(Lang::Strings::SERVER_TIMEOUT);
+        endpoint_selector_.OnFailure();
+        if (report_error) {
+            SetError(Lang::Strings::SERVER_TIMEOUT);
+        }
         return false;
     }
-
-    if (on_audio_channel_opened_ != nullptr) {
-        on_audio_channel_opened_();
-    }
-
+    endpoint_selector_.OnSuccess();
+    last_incoming_time_ = std::chrono::steady_clock::now();
     return true;
 }
 
@@ -209,6 +489,12 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON* root = cJSON_CreateObject();
     cJSON_AddStringToObject(root, "type", "hello");
     cJSON_AddNumberToObject(root, "version", version_);
+#if CONFIG_WEBSOCKET_KEEP_WARM
+    // Ask the server to continue the previous session instead of starting over
+    if (!session_id_.empty()) {
+        cJSON_AddStringToObject(root, "session_id", session_id_.c_str());
+    }
+#endif
     cJSON* features = cJSON_CreateObject();
 #if CONFIG_USE_SERVER_AEC
     cJSON_AddBoolToObject(features, "aec", true);
@@ -216,17 +502,45 @@ std::string WebsocketProtocol::GetHelloMessage() {
 #if CONFIG_IOT_PROTOCOL_MCP
     cJSON_AddBoolToObject(features, "mcp", true);
 #endif
+#if CONFIG_USE_CBOR_CONTROL
+    if (version_ >= 2) {
+        cJSON_AddBoolToObject(features, "cbor", true);
+    }
+#endif
+#if CONFIG_USE_WAKE_WORD_STREAMING
+    cJSON_AddBoolToObject(features, "wake_stream", true);
+#endif
+#if CONFIG_USE_CAMERA_STREAMING
+    // Version 1 binary messages are bare Opus and have no room for a message type
+    if (version_ >= 2 && Board::GetInstance().GetCamera() != nullptr) {
+        cJSON_AddBoolToObject(features, "video", true);
+    }
+#endif
+#if CONFIG_USE_RESPONSE_AUDIO_CACHE
+    cJSON_AddBoolToObject(features, "tts_cache", true);
+#endif
+#if CONFIG_USE_MEDIA_PLAYBACK
+    cJSON_AddBoolToObject(features, "media", true);
+#endif
+#if CONFIG_USE_UPLINK_SILENCE_SUPPRESSION
+    cJSON_AddBoolToObject(features, "silence", true);
+#endif
+    if (!iot_descriptors_hash_.empty()) {
+        cJSON_AddStringToObject(features, "iot_descriptors", iot_descriptors_hash_.c_str());
+    }
     cJSON_AddItemToObject(root, "features", features);
     cJSON_AddStringToObject(root, "transport", "websocket");
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    AddOutputChannels(audio_params);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", client_frame_duration_);
+    if (version_ == 4) {
+        cJSON_AddNumberToObject(audio_params, "frames_per_message", CONFIG_WEBSOCKET_FRAMES_PER_MESSAGE);
+    }
     cJSON_AddItemToObject(root, "audio_params", audio_params);
-    auto json_str = cJSON_PrintUnformatted(root);
-    std::string message(json_str);
-    cJSON_free(json_str);
+    std::string message = PrintJson(root);
     cJSON_Delete(root);
     return message;
 }
@@ -243,8 +557,11 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         session_id_ = session_id->valuestring;
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
+    ParseServerFeatures(root);
+    binary_control_ = binary_control_ && version_ >= 2;
 
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
+    ParseServerChannels(audio_params);
     if (cJSON_IsObject(audio_params)) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
         if (cJSON_IsNumber(sample_rate)) {
@@ -254,7 +571,44 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         if (cJSON_IsNumber(frame_duration)) {
             server_frame_duration_ = frame_duration->valueint;
         }
+        ParseUplinkFrameDuration(audio_params);
+        // Without an answer the server may not expect batches, stay at one frame per message
+        auto frames_per_message = cJSON_GetObjectItem(audio_params, "frames_per_message");
+        if (version_ == 4 && cJSON_IsNumber(frames_per_message)) {
+            frames_per_message_ = std::clamp(frames_per_message->valueint, 1, WEBSOCKET_MAX_FRAMES_PER_MESSAGE);
+            ESP_LOGI(TAG, "Frames per message: %d", frames_per_message_);
+        }
     }
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
+
+void WebsocketProtocol::ParseBinaryProtocol4(const char* data, size_t len) {
+    if (len < sizeof(BinaryProtocol4)) {
+        ESP_LOGE(TAG, "Invalid audio message size: %u", len);
+        return;
+    }
+    auto bp4 = (const BinaryProtocol4*)data;
+    size_t offset = sizeof(BinaryProtocol4);
+    for (int i = 0; i < bp4->frame_count; i++) {
+        if (offset + sizeof(BinaryProtocol4Frame) > len) {
+            ESP_LOGE(TAG, "Truncated audio message, frame %d of %d", i, bp4->frame_count);
+            return;
+        }
+        auto frame = (const BinaryProtocol4Frame*)(data + offset);
+        size_t payload_size = ntohs(frame->payload_size);
+        offset += sizeof(BinaryProtocol4Frame);
+        if (offset + payload_size > len) {
+            ESP_LOGE(TAG, "Truncated audio message, frame %d of %d", i, bp4->frame_count);
+            return;
+        }
+        auto payload = (const uint8_t*)data + offset;
+        offset += payload_size;
+        on_incoming_audio_(AudioStreamPacket{
+            .sample_rate = server_sample_rate_,
+            .frame_duration = server_frame_duration_,
+            .timestamp = ntohl(frame->timestamp),
+            .payload = AudioPayload(payload, payload + payload_size)
+        });
+    }
+}
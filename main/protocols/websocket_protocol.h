@@ -3,12 +3,20 @@
 
 
 #include "protocol.h"
+#include "reconnect_backoff.h"
+#include "endpoint_selector.h"
 
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <esp_timer.h>
+#include <atomic>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+#define WEBSOCKET_MAX_FRAMES_PER_MESSAGE 16
+// Failed connections hold back the background reconnects of the warm connection, checked on each ping
+#define WEBSOCKET_RECONNECT_MIN_DELAY_MS 10000
+#define WEBSOCKET_RECONNECT_MAX_DELAY_MS 240000
 
 class WebsocketProtocol : public Protocol {
 public:
@@ -20,14 +28,37 @@ public:
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    TransportStats GetTransportStats() const override;
+    bool SendVideoFrame(const std::vector<uint8_t>& jpeg, uint32_t timestamp) override;
+    void OnNetworkChanged() override;
+    void ProbeEndpoints() override;
 
 private:
     EventGroupHandle_t event_group_handle_;
     WebSocket* websocket_ = nullptr;
     int version_ = 1;
+    // The connection can outlive the audio channel when kept warm
+    std::atomic<bool> channel_opened_ = false;
+    esp_timer_handle_t keep_warm_timer_ = nullptr;
+    ReconnectBackoff reconnect_backoff_{"websocket", WEBSOCKET_RECONNECT_MIN_DELAY_MS, WEBSOCKET_RECONNECT_MAX_DELAY_MS};
+    EndpointSelector endpoint_selector_{"websocket", "url", "urls", 443};
+    // Protocol version 4: frames per message agreed in the hello, and the message being filled
+    int frames_per_message_ = 1;
+    int batched_frames_ = 0;
+    std::string send_buffer_;
+    // Smoothed time a binary send blocks, grows when the TCP window fills up
+    int send_latency_us_ = -1;
 
+    bool Connect(bool report_error);
+    void KeepWarm();
     void ParseServerHello(const cJSON* root);
+    bool SendBinary(const void* data, size_t size);
+    bool FlushAudio();
+    void ParseBinaryProtocol4(const char* data, size_t len);
+    bool ParseBinaryControl(const char* data, size_t len);
+    void HandleJson(const cJSON* root);
     bool SendText(const std::string& text) override;
+    bool SendCbor(const std::string& message) override;
     std::string GetHelloMessage();
 };
 
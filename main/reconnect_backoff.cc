@@ -0,0 +1,79 @@
+#include "reconnect_backoff.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_random.h>
+
+#include <algorithm>
+
+#define TAG "ReconnectBackoff"
+
+std::mutex ReconnectBackoff::mutex_;
+std::vector<ReconnectBackoff*> ReconnectBackoff::instances_;
+
+ReconnectBackoff::ReconnectBackoff(const char* name, int min_delay_ms, int max_delay_ms)
+    : name_(name), min_delay_ms_(min_delay_ms), max_delay_ms_(std::max(min_delay_ms, max_delay_ms)) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    instances_.push_back(this);
+}
+
+ReconnectBackoff::~ReconnectBackoff() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    instances_.erase(std::remove(instances_.begin(), instances_.end(), this), instances_.end());
+}
+
+int ReconnectBackoff::GetWaitMs() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t wait_us = next_attempt_us_ - esp_timer_get_time();
+    return wait_us > 0 ? (wait_us + 999) / 1000 : 0;
+}
+
+int ReconnectBackoff::OnFailure() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    failures_++;
+    if (failures_ >= CONFIG_RECONNECT_BREAKER_FAILURES) {
+        if (failures_ == CONFIG_RECONNECT_BREAKER_FAILURES) {
+            ESP_LOGW(TAG, "%s: %d failures in a row, waiting %d s between attempts", name_, failures_,
+                CONFIG_RECONNECT_BREAKER_OPEN_SECONDS);
+        }
+        delay_ms_ = CONFIG_RECONNECT_BREAKER_OPEN_SECONDS * 1000;
+    } else {
+        delay_ms_ = failures_ == 1 ? min_delay_ms_ : std::min(delay_ms_ * 2, max_delay_ms_);
+    }
+    // Somewhere in the upper half, a synchronized fleet spreads out over the window
+    int wait_ms = delay_ms_ / 2 + esp_random() % (delay_ms_ / 2 + 1);
+    next_attempt_us_ = esp_timer_get_time() + wait_ms * 1000LL;
+    return wait_ms;
+}
+
+void ReconnectBackoff::OnSuccess() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (failures_ >= CONFIG_RECONNECT_BREAKER_FAILURES) {
+        ESP_LOGI(TAG, "%s: connected again after %d failures", name_, failures_);
+    }
+    failures_ = 0;
+    delay_ms_ = 0;
+    next_attempt_us_ = 0;
+}
+
+int ReconnectBackoff::failures() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return failures_;
+}
+
+void ReconnectBackoff::OnRetryNow(std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    on_retry_now_ = callback;
+}
+
+void ReconnectBackoff::OnNetworkUp() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t now = esp_timer_get_time();
+    for (auto backoff : instances_) {
+        bool waiting = backoff->next_attempt_us_ > now;
+        backoff->next_attempt_us_ = 0;
+        if (waiting && backoff->on_retry_now_) {
+            backoff->on_retry_now_();
+        }
+    }
+}
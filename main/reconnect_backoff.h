@@ -0,0 +1,58 @@
+#ifndef RECONNECT_BACKOFF_H
+#define RECONNECT_BACKOFF_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <functional>
+
+/*
+ * Exponential backoff with jitter and a circuit breaker, shared by everything
+ * that reconnects to the server: the protocols and the version check.
+ *
+ * Each failure doubles the delay from min_delay_ms up to max_delay_ms, and
+ * the actual wait is drawn between half and all of it, so that a fleet which
+ * lost the server at the same moment does not come back in lockstep. After
+ * CONFIG_RECONNECT_BREAKER_FAILURES failures in a row the breaker opens and
+ * every wait is CONFIG_RECONNECT_BREAKER_OPEN_SECONDS, jittered the same way,
+ * until an attempt succeeds.
+ *
+ * When the link comes back or moves to another network, OnNetworkUp() lets
+ * the next attempt of every instance go out at once. The failure count is
+ * kept, so a link that keeps flapping still ends up behind the breaker.
+ */
+class ReconnectBackoff {
+public:
+    ReconnectBackoff(const char* name, int min_delay_ms, int max_delay_ms);
+    ~ReconnectBackoff();
+    ReconnectBackoff(const ReconnectBackoff&) = delete;
+    ReconnectBackoff& operator=(const ReconnectBackoff&) = delete;
+
+    // Milliseconds until the next attempt is due, 0 if it may go now
+    int GetWaitMs() const;
+    inline bool CanAttempt() const { return GetWaitMs() == 0; }
+    // Returns the wait before the next attempt in milliseconds
+    int OnFailure();
+    void OnSuccess();
+    int failures() const;
+    // Called by OnNetworkUp() while an attempt is being held back, for owners that wait on a timer.
+    // It runs under the lock of all instances and must not call back into them
+    void OnRetryNow(std::function<void()> callback);
+
+    // Any task: the network is up again, every instance may retry right away
+    static void OnNetworkUp();
+
+private:
+    static std::mutex mutex_;
+    static std::vector<ReconnectBackoff*> instances_;
+
+    const char* name_;
+    int min_delay_ms_;
+    int max_delay_ms_;
+    int failures_ = 0;
+    int delay_ms_ = 0;              // Before jitter
+    int64_t next_attempt_us_ = 0;
+    std::function<void()> on_retry_now_;
+};
+
+#endif // RECONNECT_BACKOFF_H
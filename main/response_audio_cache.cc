@@ -0,0 +1,203 @@
+#include "response_audio_cache.h"
+#include "memory_accounting.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+#include <cstring>
+
+#define TAG "ResponseAudioCache"
+
+static uint8_t* AllocateAudio(size_t size) {
+    auto data = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (data == nullptr) {
+        data = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    return data;
+}
+
+ResponseAudioCache::ResponseAudioCache(size_t capacity) : capacity_(capacity) {
+}
+
+bool ResponseAudioCache::StartSentence(std::string_view hash, bool can_play, size_t queued) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    StoreRecording();
+    skipping_ = false;
+    if (hash.empty() || hash.size() > RESPONSE_AUDIO_CACHE_MAX_HASH_LENGTH) {
+        return false;
+    }
+
+    for (auto it = sentences_.begin(); it != sentences_.end(); ++it) {
+        if ((*it)->hash != hash) {
+            continue;
+        }
+        if (!can_play) {
+            return false;
+        }
+        sentences_.splice(sentences_.begin(), sentences_, it);
+        Playback playback;
+        playback.sentence = *it;
+        playback.queued = queued;
+        playbacks_.push_back(std::move(playback));
+        skipping_ = true;
+        stats_.hits++;
+        ESP_LOGI(TAG, "Hit %.*s, %u bytes", (int)hash.size(), hash.data(), (*it)->size);
+        return true;
+    }
+
+    stats_.misses++;
+    if (recording_buffer_ == nullptr) {
+        MemoryTagScope tag(kMemoryTagAudio);
+        recording_buffer_ = {AllocateAudio(RESPONSE_AUDIO_CACHE_MAX_SENTENCE_SIZE), heap_caps_free};
+        if (recording_buffer_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate the recording buffer");
+            return false;
+        }
+    }
+    recording_hash_ = hash;
+    recording_size_ = 0;
+    recording_sample_rate_ = 0;
+    recording_frame_duration_ = 0;
+    recording_ = true;
+    return false;
+}
+
+void ResponseAudioCache::EndSentence() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    StoreRecording();
+    skipping_ = false;
+}
+
+bool ResponseAudioCache::OnIncomingPacket(const AudioStreamPacket& packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (skipping_) {
+        return false;
+    }
+    if (!recording_) {
+        return true;
+    }
+
+    if (recording_size_ == 0) {
+        recording_sample_rate_ = packet.sample_rate;
+        recording_frame_duration_ = packet.frame_duration;
+    } else if (packet.sample_rate != recording_sample_rate_ || packet.frame_duration != recording_frame_duration_ ||
+        (packet.sequence != 0 && packet.sequence != last_sequence_ + 1)) {
+        // A gap would be cached as a glitch forever
+        DiscardRecording();
+        return true;
+    }
+    last_sequence_ = packet.sequence;
+
+    size_t size = packet.payload.size();
+    if (size == 0 || size > UINT16_MAX || recording_size_ + 2 + size > RESPONSE_AUDIO_CACHE_MAX_SENTENCE_SIZE) {
+        DiscardRecording();
+        return true;
+    }
+    uint8_t* frame = recording_buffer_.get() + recording_size_;
+    frame[0] = size >> 8;
+    frame[1] = size & 0xff;
+    memcpy(frame + 2, packet.payload.data(), size);
+    recording_size_ += 2 + size;
+    return true;
+}
+
+void ResponseAudioCache::StoreRecording() {
+    if (!recording_) {
+        return;
+    }
+    recording_ = false;
+    if (recording_size_ == 0 || recording_size_ > capacity_) {
+        return;
+    }
+
+    // The least recently used sentences make room, those still playing are freed when they finish
+    size_t total = 0;
+    for (auto& sentence : sentences_) {
+        total += sentence->size;
+    }
+    while (!sentences_.empty() && total + recording_size_ > capacity_) {
+        total -= sentences_.back()->size;
+        sentences_.pop_back();
+        stats_.evictions++;
+    }
+
+    MemoryTagScope tag(kMemoryTagAudio);
+    auto sentence = std::make_shared<Sentence>();
+    sentence->data = {AllocateAudio(recording_size_), heap_caps_free};
+    if (sentence->data == nullptr) {
+        ESP_LOGW(TAG, "No memory for %u bytes", recording_size_);
+        return;
+    }
+    memcpy(sentence->data.get(), recording_buffer_.get(), recording_size_);
+    sentence->hash = std::move(recording_hash_);
+    sentence->sample_rate = recording_sample_rate_;
+    sentence->frame_duration = recording_frame_duration_;
+    sentence->size = recording_size_;
+    ESP_LOGI(TAG, "Stored %s, %u bytes", sentence->hash.c_str(), sentence->size);
+    sentences_.push_front(std::move(sentence));
+}
+
+void ResponseAudioCache::DiscardRecording() {
+    recording_ = false;
+    stats_.discarded++;
+}
+
+bool ResponseAudioCache::NextFrame(AudioStreamPacket& packet, bool stream_empty) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (playbacks_.empty()) {
+        return false;
+    }
+    auto& playback = playbacks_.front();
+    if (playback.queued > 0) {
+        if (!stream_empty) {
+            return false;
+        }
+        playback.queued = 0;
+    }
+
+    auto& sentence = *playback.sentence;
+    const uint8_t* frame = sentence.data.get() + playback.offset;
+    size_t size = (frame[0] << 8) | frame[1];
+    packet.sample_rate = sentence.sample_rate;
+    packet.frame_duration = sentence.frame_duration;
+    packet.timestamp = 0;
+    packet.sequence = 0;
+    packet.fec = false;
+    packet.payload.assign(frame + 2, frame + 2 + size);
+    playback.offset += 2 + size;
+    if (playback.offset >= sentence.size) {
+        playbacks_.pop_front();
+    }
+    return true;
+}
+
+void ResponseAudioCache::OnStreamedPacket() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!playbacks_.empty() && playbacks_.front().queued > 0) {
+        playbacks_.front().queued--;
+    }
+}
+
+bool ResponseAudioCache::Playing() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !playbacks_.empty();
+}
+
+void ResponseAudioCache::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    playbacks_.clear();
+    if (recording_) {
+        DiscardRecording();
+    }
+    skipping_ = false;
+}
+
+ResponseAudioCacheStats ResponseAudioCache::GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ResponseAudioCacheStats stats = stats_;
+    stats.entries = sentences_.size();
+    for (auto& sentence : sentences_) {
+        stats.bytes += sentence->size;
+    }
+    return stats;
+}
@@ -0,0 +1,104 @@
+#ifndef RESPONSE_AUDIO_CACHE_H
+#define RESPONSE_AUDIO_CACHE_H
+
+#include <mutex>
+#include <list>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+#include "protocol.h"
+
+// Hashes are opaque to the device, longer ones are ignored
+#define RESPONSE_AUDIO_CACHE_MAX_HASH_LENGTH 64
+// Longest sentence kept, about 8 seconds at the usual TTS bitrates. Longer ones are streamed every time
+#define RESPONSE_AUDIO_CACHE_MAX_SENTENCE_SIZE (16 * 1024)
+
+struct ResponseAudioCacheStats {
+    size_t entries = 0;
+    size_t bytes = 0;
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+    uint32_t evictions = 0;
+    uint32_t discarded = 0;     // Recordings that were cut, lost packets or too long
+};
+
+/*
+ * Opus frames of TTS sentences the server marked with a content hash in
+ * "tts sentence_start", kept in PSRAM and evicted least recently used first
+ * when CONFIG_RESPONSE_AUDIO_CACHE_SIZE_KB is full.
+ *
+ * A sentence the device has not seen is recorded as it streams in and kept
+ * once the next sentence starts or the reply ends, unless a packet was lost
+ * or the reply was interrupted. For a cached one the device answers
+ * "tts cache_hit" and the server skips its audio; frames of it that were
+ * already on their way are dropped.
+ *
+ * A cached sentence plays in the order it was announced: it waits until the
+ * audio that was in the jitter buffer before its sentence_start has been
+ * taken, and the streamed audio after it waits in the jitter buffer.
+ *
+ * The protocol callbacks run on the network task, NextFrame() and
+ * OnStreamedPacket() on the audio loop.
+ */
+class ResponseAudioCache {
+public:
+    explicit ResponseAudioCache(size_t capacity);
+
+    // A new sentence starts, the previous one is stored if it was recorded whole.
+    // True if `hash` is cached, its frames are queued behind `queued` streamed packets
+    bool StartSentence(std::string_view hash, bool can_play, size_t queued);
+    void EndSentence();
+    // False for the streamed frames of a sentence that plays from the cache
+    bool OnIncomingPacket(const AudioStreamPacket& packet);
+
+    // `stream_empty`: nothing is left in the jitter buffer, a cached sentence does not wait for lost packets
+    bool NextFrame(AudioStreamPacket& packet, bool stream_empty);
+    // A packet was taken from the jitter buffer
+    void OnStreamedPacket();
+    bool Playing();
+    // Stops playback and drops the recording, the cached sentences stay
+    void Reset();
+    ResponseAudioCacheStats GetStats();
+
+private:
+    struct Sentence {
+        std::string hash;
+        int sample_rate = 0;
+        int frame_duration = 0;
+        // Each frame is its 16-bit size followed by the Opus data
+        std::unique_ptr<uint8_t, void (*)(void*)> data{nullptr, nullptr};
+        size_t size = 0;
+    };
+    struct Playback {
+        std::shared_ptr<const Sentence> sentence;
+        size_t offset = 0;
+        size_t queued = 0;      // Streamed packets that play before this sentence
+    };
+
+    std::mutex mutex_;
+    size_t capacity_;
+    // Most recently used first
+    std::list<std::shared_ptr<const Sentence>> sentences_;
+    std::deque<Playback> playbacks_;
+    ResponseAudioCacheStats stats_;
+
+    // The sentence being recorded, in a buffer allocated on first use
+    std::unique_ptr<uint8_t, void (*)(void*)> recording_buffer_{nullptr, nullptr};
+    std::string recording_hash_;
+    size_t recording_size_ = 0;
+    int recording_sample_rate_ = 0;
+    int recording_frame_duration_ = 0;
+    uint32_t last_sequence_ = 0;
+    bool recording_ = false;
+    // The streamed frames of the current sentence are dropped, it plays from the cache
+    bool skipping_ = false;
+
+    void StoreRecording();
+    void DiscardRecording();
+};
+
+#endif // RESPONSE_AUDIO_CACHE_H
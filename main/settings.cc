@@ -1,87 +1,270 @@
 #include "settings.h"
+#include "task_topology.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_system.h>
 #include <nvs_flash.h>
 
+#include <map>
+#include <mutex>
+#include <vector>
+
 #define TAG "Settings"
 
-Settings::Settings(const std::string& ns, bool read_write) : ns_(ns), read_write_(read_write) {
-    nvs_open(ns.c_str(), read_write_ ? NVS_READWRITE : NVS_READONLY, &nvs_handle_);
-}
+namespace {
 
-Settings::~Settings() {
-    if (nvs_handle_ != 0) {
-        if (read_write_ && dirty_) {
-            ESP_ERROR_CHECK(nvs_commit(nvs_handle_));
+struct SettingsValue {
+    nvs_type_t type = NVS_TYPE_ANY;     // NVS_TYPE_ANY: the key is not in NVS
+    int32_t int_value = 0;
+    std::string string_value;
+    bool dirty = false;
+};
+
+struct PendingWrite {
+    std::string ns;
+    std::string key;
+    SettingsValue value;
+};
+
+class SettingsCache {
+public:
+    static SettingsCache& GetInstance() {
+        static SettingsCache instance;
+        return instance;
+    }
+
+    std::mutex mutex_;
+
+    // Called with mutex_ held, reads the key from NVS the first time
+    SettingsValue& Load(const std::string& ns, const std::string& key) {
+        auto& values = namespaces_[ns];
+        auto it = values.find(key);
+        if (it != values.end()) {
+            return it->second;
         }
-        nvs_close(nvs_handle_);
+
+        auto& value = values[key];
+        // NVS reads flash, which a task with a PSRAM stack must not do on its own stack
+        TaskTopology::RunOnInternalStack([&]() {
+            ReadValue(ns, key, value);
+        });
+        return value;
     }
-}
 
-std::string Settings::GetString(const std::string& key, const std::string& default_value) {
-    if (nvs_handle_ == 0) {
-        return default_value;
+    // Called with mutex_ held
+    void MarkDirty(SettingsValue& value) {
+        value.dirty = true;
+        esp_timer_stop(flush_timer_);
+        esp_timer_start_once(flush_timer_, SETTINGS_FLUSH_DELAY_MS * 1000);
     }
 
-    size_t length = 0;
-    if (nvs_get_str(nvs_handle_, key.c_str(), nullptr, &length) != ESP_OK) {
-        return default_value;
+    void EraseNamespace(const std::string& ns) {
+        std::lock_guard<std::mutex> flush_lock(flush_mutex_);
+        std::lock_guard<std::mutex> lock(mutex_);
+        namespaces_.erase(ns);
+        TaskTopology::RunOnInternalStack([&]() {
+            nvs_handle_t handle;
+            if (nvs_open(ns.c_str(), NVS_READWRITE, &handle) == ESP_OK) {
+                ESP_ERROR_CHECK(nvs_erase_all(handle));
+                ESP_ERROR_CHECK(nvs_commit(handle));
+                nvs_close(handle);
+            }
+        });
     }
 
-    std::string value;
-    value.resize(length);
-    ESP_ERROR_CHECK(nvs_get_str(nvs_handle_, key.c_str(), value.data(), &length));
-    while (!value.empty() && value.back() == '\0') {
-        value.pop_back();
+    void Flush() {
+        // 一次只有一个提交，后面的提交不会被前面的旧值覆盖
+        std::lock_guard<std::mutex> flush_lock(flush_mutex_);
+        std::vector<PendingWrite> writes;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& [ns, values] : namespaces_) {
+                for (auto& [key, value] : values) {
+                    if (value.dirty) {
+                        writes.push_back({ns, key, value});
+                        value.dirty = false;
+                    }
+                }
+            }
+        }
+        if (writes.empty()) {
+            return;
+        }
+        TaskTopology::RunOnInternalStack([&]() {
+            WriteValues(writes);
+        });
+        ESP_LOGI(TAG, "Committed %u settings", writes.size());
     }
-    return value;
+
+private:
+    // Namespaces and keys are kept sorted, so a flush visits each namespace once
+    std::map<std::string, std::map<std::string, SettingsValue>> namespaces_;
+    std::mutex flush_mutex_;
+    esp_timer_handle_t flush_timer_ = nullptr;
+
+    static void ReadValue(const std::string& ns, const std::string& key, SettingsValue& value) {
+        nvs_handle_t handle;
+        if (nvs_open(ns.c_str(), NVS_READONLY, &handle) != ESP_OK) {
+            return;
+        }
+        nvs_type_t type;
+        if (nvs_find_key(handle, key.c_str(), &type) == ESP_OK) {
+            if (type == NVS_TYPE_I32 && nvs_get_i32(handle, key.c_str(), &value.int_value) == ESP_OK) {
+                value.type = type;
+            } else if (type == NVS_TYPE_STR) {
+                size_t length = 0;
+                if (nvs_get_str(handle, key.c_str(), nullptr, &length) == ESP_OK) {
+                    value.string_value.resize(length);
+                    ESP_ERROR_CHECK(nvs_get_str(handle, key.c_str(), value.string_value.data(), &length));
+                    while (!value.string_value.empty() && value.string_value.back() == '\0') {
+                        value.string_value.pop_back();
+                    }
+                    value.type = type;
+                }
+            }
+        }
+        nvs_close(handle);
+    }
+
+    // The writes are grouped by namespace, one open and commit each
+    static void WriteValues(const std::vector<PendingWrite>& writes) {
+        nvs_handle_t handle = 0;
+        const std::string* current_ns = nullptr;
+        for (auto& write : writes) {
+            if (current_ns == nullptr || *current_ns != write.ns) {
+                if (handle != 0) {
+                    ESP_ERROR_CHECK(nvs_commit(handle));
+                    nvs_close(handle);
+                    handle = 0;
+                }
+                current_ns = &write.ns;
+                if (nvs_open(write.ns.c_str(), NVS_READWRITE, &handle) != ESP_OK) {
+                    ESP_LOGE(TAG, "Failed to open namespace %s", write.ns.c_str());
+                    handle = 0;
+                    continue;
+                }
+            }
+            if (handle == 0) {
+                continue;
+            }
+            if (write.value.type == NVS_TYPE_I32) {
+                ESP_ERROR_CHECK(nvs_set_i32(handle, write.key.c_str(), write.value.int_value));
+            } else if (write.value.type == NVS_TYPE_STR) {
+                ESP_ERROR_CHECK(nvs_set_str(handle, write.key.c_str(), write.value.string_value.c_str()));
+            } else {
+                auto ret = nvs_erase_key(handle, write.key.c_str());
+                if (ret != ESP_ERR_NVS_NOT_FOUND) {
+                    ESP_ERROR_CHECK(ret);
+                }
+            }
+        }
+        if (handle != 0) {
+            ESP_ERROR_CHECK(nvs_commit(handle));
+            nvs_close(handle);
+        }
+    }
+
+    SettingsCache() {
+        esp_timer_create_args_t timer_args = {
+            .callback = [](void* arg) {
+                static_cast<SettingsCache*>(arg)->Flush();
+            },
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "settings_flush",
+            .skip_unhandled_events = true,
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &flush_timer_));
+        // esp_restart() 前提交还没写入的设置
+        esp_register_shutdown_handler([]() {
+            SettingsCache::GetInstance().Flush();
+        });
+    }
+};
+
+} // namespace
+
+Settings::Settings(const std::string& ns, bool read_write) : ns_(ns), read_write_(read_write) {
+}
+
+std::string Settings::GetString(const std::string& key, const std::string& default_value) {
+    auto& cache = SettingsCache::GetInstance();
+    std::lock_guard<std::mutex> lock(cache.mutex_);
+    auto& value = cache.Load(ns_, key);
+    if (value.type != NVS_TYPE_STR) {
+        return default_value;
+    }
+    return value.string_value;
 }
 
 void Settings::SetString(const std::string& key, const std::string& value) {
-    if (read_write_) {
-        ESP_ERROR_CHECK(nvs_set_str(nvs_handle_, key.c_str(), value.c_str()));
-        dirty_ = true;
-    } else {
+    if (!read_write_) {
         ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
+        return;
+    }
+    auto& cache = SettingsCache::GetInstance();
+    std::lock_guard<std::mutex> lock(cache.mutex_);
+    auto& cached = cache.Load(ns_, key);
+    if (cached.type == NVS_TYPE_STR && cached.string_value == value) {
+        return;
     }
+    cached.type = NVS_TYPE_STR;
+    cached.string_value = value;
+    cache.MarkDirty(cached);
 }
 
 int32_t Settings::GetInt(const std::string& key, int32_t default_value) {
-    if (nvs_handle_ == 0) {
-        return default_value;
-    }
-
-    int32_t value;
-    if (nvs_get_i32(nvs_handle_, key.c_str(), &value) != ESP_OK) {
+    auto& cache = SettingsCache::GetInstance();
+    std::lock_guard<std::mutex> lock(cache.mutex_);
+    auto& value = cache.Load(ns_, key);
+    if (value.type != NVS_TYPE_I32) {
         return default_value;
     }
-    return value;
+    return value.int_value;
 }
 
 void Settings::SetInt(const std::string& key, int32_t value) {
-    if (read_write_) {
-        ESP_ERROR_CHECK(nvs_set_i32(nvs_handle_, key.c_str(), value));
-        dirty_ = true;
-    } else {
+    if (!read_write_) {
         ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
+        return;
     }
+    auto& cache = SettingsCache::GetInstance();
+    std::lock_guard<std::mutex> lock(cache.mutex_);
+    auto& cached = cache.Load(ns_, key);
+    if (cached.type == NVS_TYPE_I32 && cached.int_value == value) {
+        return;
+    }
+    cached.type = NVS_TYPE_I32;
+    cached.int_value = value;
+    cached.string_value.clear();
+    cache.MarkDirty(cached);
 }
 
 void Settings::EraseKey(const std::string& key) {
-    if (read_write_) {
-        auto ret = nvs_erase_key(nvs_handle_, key.c_str());
-        if (ret != ESP_ERR_NVS_NOT_FOUND) {
-            ESP_ERROR_CHECK(ret);
-        }
-    } else {
+    if (!read_write_) {
         ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
+        return;
+    }
+    auto& cache = SettingsCache::GetInstance();
+    std::lock_guard<std::mutex> lock(cache.mutex_);
+    auto& cached = cache.Load(ns_, key);
+    if (cached.type == NVS_TYPE_ANY) {
+        return;
     }
+    cached.type = NVS_TYPE_ANY;
+    cached.string_value.clear();
+    cache.MarkDirty(cached);
 }
 
 void Settings::EraseAll() {
-    if (read_write_) {
-        ESP_ERROR_CHECK(nvs_erase_all(nvs_handle_));
-    } else {
+    if (!read_write_) {
         ESP_LOGW(TAG, "Namespace %s is not open for writing", ns_.c_str());
+        return;
     }
+    SettingsCache::GetInstance().EraseNamespace(ns_);
+}
+
+void Settings::Flush() {
+    SettingsCache::GetInstance().Flush();
 }
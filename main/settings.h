@@ -4,23 +4,34 @@
 #include <string>
 #include <nvs_flash.h>
 
+// 写入后等这么久没有新的写入，才把改动一次性提交到 NVS
+#define SETTINGS_FLUSH_DELAY_MS 3000
+
+/*
+ * A view of one NVS namespace. Values are served from a process-wide RAM
+ * cache, each key is read from NVS once. Writes only touch the cache, the
+ * changed keys of all namespaces are committed together SETTINGS_FLUSH_DELAY_MS
+ * after the last write, on Flush() and on esp_restart(). Writing the value a
+ * key already has does not mark it dirty.
+ */
 class Settings {
 public:
     Settings(const std::string& ns, bool read_write = false);
-    ~Settings();
 
     std::string GetString(const std::string& key, const std::string& default_value = "");
     void SetString(const std::string& key, const std::string& value);
     int32_t GetInt(const std::string& key, int32_t default_value = 0);
     void SetInt(const std::string& key, int32_t value);
     void EraseKey(const std::string& key);
+    // Erases the namespace in NVS right away
     void EraseAll();
 
+    // Commit the pending writes now, before power is cut
+    static void Flush();
+
 private:
     std::string ns_;
-    nvs_handle_t nvs_handle_ = 0;
     bool read_write_ = false;
-    bool dirty_ = false;
 };
 
 #endif
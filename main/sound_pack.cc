@@ -0,0 +1,87 @@
+#include "sound_pack.h"
+
+#include <esp_log.h>
+#include <esp_partition.h>
+
+#include <algorithm>
+#include <cstring>
+
+#define TAG "SoundPack"
+
+struct SoundPackMapping {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+static SoundPackMapping MapSoundPartition() {
+    SoundPackMapping mapping;
+    auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, SOUND_PARTITION_LABEL);
+    if (partition == nullptr) {
+        ESP_LOGW(TAG, "No %s partition", SOUND_PARTITION_LABEL);
+        return mapping;
+    }
+
+    const void* data = nullptr;
+    esp_partition_mmap_handle_t handle;
+    if (esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &data, &handle) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map the %s partition", SOUND_PARTITION_LABEL);
+        return mapping;
+    }
+
+    auto header = SoundPack::Parse(static_cast<const uint8_t*>(data), partition->size);
+    if (header == nullptr) {
+        ESP_LOGW(TAG, "No sound pack in the %s partition", SOUND_PARTITION_LABEL);
+        esp_partition_munmap(handle);
+        return mapping;
+    }
+
+    mapping.data = static_cast<const uint8_t*>(data);
+    mapping.size = partition->size;
+    ESP_LOGI(TAG, "Mapped %u sounds of %.8s", header->count, header->lang);
+    return mapping;
+}
+
+std::string_view SoundPack::Get(const char* name) {
+    static const SoundPackMapping mapping = MapSoundPartition();
+    if (mapping.data == nullptr) {
+        return {};
+    }
+    auto sound = Find(mapping.data, mapping.size, name);
+    if (sound.empty()) {
+        ESP_LOGW(TAG, "Sound %s is not in the sound pack", name);
+    }
+    return sound;
+}
+
+const SoundPackHeader* SoundPack::Parse(const uint8_t* data, size_t size) {
+    if (data == nullptr || size < sizeof(SoundPackHeader)) {
+        return nullptr;
+    }
+    auto header = reinterpret_cast<const SoundPackHeader*>(data);
+    size_t index_end = sizeof(SoundPackHeader) + header->count * sizeof(SoundPackEntry);
+    if (memcmp(header->magic, SOUND_PACK_MAGIC, 4) != 0 || header->version != SOUND_PACK_VERSION || index_end > size) {
+        return nullptr;
+    }
+    return header;
+}
+
+std::string_view SoundPack::Find(const uint8_t* data, size_t size, const char* name) {
+    auto header = Parse(data, size);
+    if (header == nullptr) {
+        return {};
+    }
+    // 索引按名称排序
+    auto entries = Entries(header);
+    auto end = entries + header->count;
+    auto it = std::lower_bound(entries, end, name, [](const SoundPackEntry& entry, const char* name) {
+        return strncmp(entry.name, name, sizeof(entry.name)) < 0;
+    });
+    if (it == end || strncmp(it->name, name, sizeof(it->name)) != 0) {
+        return {};
+    }
+    if (it->offset + it->size > size) {
+        ESP_LOGE(TAG, "Sound %s is out of the image", name);
+        return {};
+    }
+    return std::string_view(reinterpret_cast<const char*>(data + it->offset), it->size);
+}
@@ -0,0 +1,50 @@
+#ifndef SOUND_PACK_H
+#define SOUND_PACK_H
+
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+// The data partition scripts/gen_sound_partition.py images are written to
+#define SOUND_PARTITION_LABEL "sounds"
+
+#define SOUND_PACK_MAGIC "P3PK"
+#define SOUND_PACK_VERSION 1
+#define SOUND_PACK_NAME_SIZE 24
+
+// Layout written by scripts/gen_sound_partition.py
+struct SoundPackHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t count;
+    char lang[8];
+};
+
+struct SoundPackEntry {
+    char name[SOUND_PACK_NAME_SIZE];
+    uint32_t offset;
+    uint32_t size;
+};
+
+/*
+ * The P3 prompt sounds of CONFIG_USE_SOUND_PARTITION builds. The partition is
+ * mapped once and stays mapped, the views returned point into flash and the
+ * prompt player decodes straight from them.
+ *
+ * Lang::Sounds is initialized from Get() before app_main, a missing partition
+ * or sound gives an empty view, which PlaySound ignores.
+ */
+class SoundPack {
+public:
+    static std::string_view Get(const char* name);
+
+    // The index of a pack image of `size` bytes, nullptr if it is not one
+    static const SoundPackHeader* Parse(const uint8_t* data, size_t size);
+    static inline const SoundPackEntry* Entries(const SoundPackHeader* header) {
+        return reinterpret_cast<const SoundPackEntry*>(header + 1);
+    }
+    // A sound of a parsed image, empty if it has no such sound
+    static std::string_view Find(const uint8_t* data, size_t size, const char* name);
+};
+
+#endif // SOUND_PACK_H
@@ -0,0 +1,116 @@
+#ifndef SPSC_RING_BUFFER_H
+#define SPSC_RING_BUFFER_H
+
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+/*
+ * Fixed-capacity single-producer / single-consumer ring buffer.
+ *
+ * All slots are allocated once in the constructor, no node is allocated per
+ * item. Push(const T&) copies into an existing slot, so element types that
+ * own storage (like AudioStreamPacket) reuse the slot's buffer; Push(T&&)
+ * moves the caller's storage into the slot and frees the slot's old one.
+ *
+ * head_ and tail_ are monotonic counters: only the producer writes tail_ and
+ * only the consumer writes head_. Clear() may be called from any thread; it
+ * records the current tail and the consumer discards everything before it on
+ * its next Pop(), so it never races with a slot that is being read.
+ */
+template <typename T>
+class SpscRingBuffer {
+public:
+    explicit SpscRingBuffer(size_t capacity) : slots_(capacity), capacity_(capacity) {}
+
+    SpscRingBuffer(const SpscRingBuffer&) = delete;
+    SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+    // Producer side
+    bool Push(const T& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) >= capacity_) {
+            return false;
+        }
+        slots_[tail % capacity_] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Push(T&& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) >= capacity_) {
+            return false;
+        }
+        slots_[tail % capacity_] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer side, fills the next slot in place so the storage it holds is reused
+    template <typename Fill>
+    bool PushWith(Fill&& fill) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) >= capacity_) {
+            return false;
+        }
+        fill(slots_[tail % capacity_]);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, swaps the slot into item so the caller's storage is recycled
+    bool Pop(T& item) {
+        size_t head = ApplyClear();
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        std::swap(item, slots_[head % capacity_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Any thread
+    void Clear() {
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t current = clear_until_.load(std::memory_order_relaxed);
+        while (current < tail && !clear_until_.compare_exchange_weak(current, tail, std::memory_order_acq_rel)) {
+        }
+    }
+
+    size_t Size() const {
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t clear_until = clear_until_.load(std::memory_order_acquire);
+        if (clear_until > head) {
+            head = clear_until;
+        }
+        return tail > head ? tail - head : 0;
+    }
+
+    inline bool Empty() const { return Size() == 0; }
+    inline bool Full() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire) >= capacity_;
+    }
+    inline size_t capacity() const { return capacity_; }
+
+private:
+    std::vector<T> slots_;
+    const size_t capacity_;
+    std::atomic<size_t> head_{0};
+    std::atomic<size_t> tail_{0};
+    std::atomic<size_t> clear_until_{0};
+
+    size_t ApplyClear() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t clear_until = clear_until_.load(std::memory_order_acquire);
+        if (clear_until > head) {
+            head = clear_until;
+            head_.store(head, std::memory_order_release);
+        }
+        return head;
+    }
+};
+
+#endif // SPSC_RING_BUFFER_H
@@ -1,4 +1,5 @@
 #include "system_info.h"
+#include "memory_accounting.h"
 
 #include <freertos/task.h>
 #include <esp_log.h>
@@ -47,89 +48,64 @@ std::string SystemInfo::GetChipModelName() {
     return std::string(CONFIG_IDF_TARGET);
 }
 
-esp_err_t SystemInfo::PrintTaskCpuUsage(TickType_t xTicksToWait) {
-    #define ARRAY_SIZE_OFFSET 5
-    TaskStatus_t *start_array = NULL, *end_array = NULL;
-    UBaseType_t start_array_size, end_array_size;
-    configRUN_TIME_COUNTER_TYPE start_run_time, end_run_time;
-    esp_err_t ret;
-    uint32_t total_elapsed_time;
-
-    //Allocate array to store current task states
-    start_array_size = uxTaskGetNumberOfTasks() + ARRAY_SIZE_OFFSET;
-    start_array = (TaskStatus_t*)malloc(sizeof(TaskStatus_t) * start_array_size);
-    if (start_array == NULL) {
-        ret = ESP_ERR_NO_MEM;
-        goto exit;
-    }
-    //Get current task states
-    start_array_size = uxTaskGetSystemState(start_array, start_array_size, &start_run_time);
-    if (start_array_size == 0) {
-        ret = ESP_ERR_INVALID_SIZE;
-        goto exit;
-    }
-
-    vTaskDelay(xTicksToWait);
-
-    //Allocate array to store tasks states post delay
-    end_array_size = uxTaskGetNumberOfTasks() + ARRAY_SIZE_OFFSET;
-    end_array = (TaskStatus_t*)malloc(sizeof(TaskStatus_t) * end_array_size);
-    if (end_array == NULL) {
-        ret = ESP_ERR_NO_MEM;
-        goto exit;
-    }
-    //Get post delay task states
-    end_array_size = uxTaskGetSystemState(end_array, end_array_size, &end_run_time);
-    if (end_array_size == 0) {
-        ret = ESP_ERR_INVALID_SIZE;
-        goto exit;
+esp_err_t SystemInfo::TakeTaskSnapshot(TaskSnapshot& snapshot) {
+    // A few spare entries for tasks created meanwhile
+    snapshot.tasks.resize(uxTaskGetNumberOfTasks() + 5);
+    UBaseType_t count = uxTaskGetSystemState(snapshot.tasks.data(), snapshot.tasks.size(), &snapshot.run_time);
+    if (count == 0) {
+        return ESP_ERR_INVALID_SIZE;
     }
+    snapshot.tasks.resize(count);
+    return ESP_OK;
+}
 
-    //Calculate total_elapsed_time in units of run time stats clock period.
-    total_elapsed_time = (end_run_time - start_run_time);
+std::vector<TaskCpuUsage> SystemInfo::GetTaskCpuUsage(const TaskSnapshot& start, const TaskSnapshot& end) {
+    std::vector<TaskCpuUsage> usage;
+    uint32_t total_elapsed_time = end.run_time - start.run_time;
     if (total_elapsed_time == 0) {
-        ret = ESP_ERR_INVALID_STATE;
-        goto exit;
+        return usage;
     }
 
-    printf("| Task | Run Time | Percentage\n");
-    //Match each task in start_array to those in the end_array
-    for (int i = 0; i < start_array_size; i++) {
-        int k = -1;
-        for (int j = 0; j < end_array_size; j++) {
-            if (start_array[i].xHandle == end_array[j].xHandle) {
-                k = j;
-                //Mark that task have been matched by overwriting their handles
-                start_array[i].xHandle = NULL;
-                end_array[j].xHandle = NULL;
+    usage.reserve(end.tasks.size());
+    for (auto& task : end.tasks) {
+        uint32_t start_run_time = 0;
+        for (auto& start_task : start.tasks) {
+            if (start_task.xHandle == task.xHandle) {
+                start_run_time = start_task.ulRunTimeCounter;
                 break;
             }
         }
-        //Check if matching task found
-        if (k >= 0) {
-            uint32_t task_elapsed_time = end_array[k].ulRunTimeCounter - start_array[i].ulRunTimeCounter;
-            uint32_t percentage_time = (task_elapsed_time * 100UL) / (total_elapsed_time * CONFIG_FREERTOS_NUMBER_OF_CORES);
-            printf("| %-16s | %8lu | %4lu%%\n", start_array[i].pcTaskName, task_elapsed_time, percentage_time);
-        }
+        TaskCpuUsage item;
+        item.name = task.pcTaskName;
+        item.run_time = task.ulRunTimeCounter - start_run_time;
+        item.percentage = (uint64_t)item.run_time * 100 / ((uint64_t)total_elapsed_time * CONFIG_FREERTOS_NUMBER_OF_CORES);
+        item.stack_free = task.usStackHighWaterMark;
+        usage.push_back(std::move(item));
     }
+    return usage;
+}
 
-    //Print unmatched tasks
-    for (int i = 0; i < start_array_size; i++) {
-        if (start_array[i].xHandle != NULL) {
-            printf("| %s | Deleted\n", start_array[i].pcTaskName);
-        }
+esp_err_t SystemInfo::PrintTaskCpuUsage(TickType_t xTicksToWait) {
+    TaskSnapshot start, end;
+    esp_err_t ret = TakeTaskSnapshot(start);
+    if (ret != ESP_OK) {
+        return ret;
     }
-    for (int i = 0; i < end_array_size; i++) {
-        if (end_array[i].xHandle != NULL) {
-            printf("| %s | Created\n", end_array[i].pcTaskName);
-        }
+    vTaskDelay(xTicksToWait);
+    ret = TakeTaskSnapshot(end);
+    if (ret != ESP_OK) {
+        return ret;
     }
-    ret = ESP_OK;
 
-exit:    //Common return path
-    free(start_array);
-    free(end_array);
-    return ret;
+    auto usage = GetTaskCpuUsage(start, end);
+    if (usage.empty()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    printf("| Task | Run Time | Percentage\n");
+    for (auto& task : usage) {
+        printf("| %-16s | %8lu | %4lu%%\n", task.name.c_str(), task.run_time, task.percentage);
+    }
+    return ESP_OK;
 }
 
 void SystemInfo::PrintTaskList() {
@@ -142,4 +118,5 @@ void SystemInfo::PrintHeapStats() {
     int free_sram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
     int min_free_sram = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
     ESP_LOGI(TAG, "free sram: %u minimal sram: %u", free_sram, min_free_sram);
+    MemoryAccounting::PrintStats();
 }
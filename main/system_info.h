@@ -2,9 +2,24 @@
 #define _SYSTEM_INFO_H_
 
 #include <string>
+#include <vector>
 
 #include <esp_err.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Run time counters of all tasks at one moment
+struct TaskSnapshot {
+    std::vector<TaskStatus_t> tasks;
+    configRUN_TIME_COUNTER_TYPE run_time = 0;
+};
+
+struct TaskCpuUsage {
+    std::string name;
+    uint32_t run_time = 0;      // Run time stats clock periods between the two snapshots
+    uint32_t percentage = 0;    // Of all cores
+    uint32_t stack_free = 0;    // Stack high-water mark, bytes never used
+};
 
 class SystemInfo {
 public:
@@ -13,6 +28,9 @@ public:
     static size_t GetFreeHeapSize();
     static std::string GetMacAddress();
     static std::string GetChipModelName();
+    static esp_err_t TakeTaskSnapshot(TaskSnapshot& snapshot);
+    // Usage of the tasks alive at end. A task created in between counts from zero, an empty start means since boot
+    static std::vector<TaskCpuUsage> GetTaskCpuUsage(const TaskSnapshot& start, const TaskSnapshot& end);
     static esp_err_t PrintTaskCpuUsage(TickType_t xTicksToWait);
     static void PrintTaskList();
     static void PrintHeapStats();
@@ -0,0 +1,251 @@
+#include "system_metrics.h"
+#include "latency_tracer.h"
+#include "memory_accounting.h"
+#include "boot_arena.h"
+#include "task_topology.h"
+#include "board.h"
+#include "audio_codec.h"
+#include "json_arena.h"
+#if CONFIG_USE_POWER_GOVERNOR
+#include "power_governor.h"
+#endif
+#if CONFIG_USE_DEADLINE_MONITOR
+#include "deadline_monitor.h"
+#endif
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+#define TAG "SystemMetrics"
+
+static std::vector<I2cBusStats> GetI2cStats() {
+    std::vector<I2cBusStats> stats;
+    for (auto bus : I2cBus::GetAll()) {
+        stats.push_back(bus->GetStats());
+    }
+    return stats;
+}
+
+std::string SystemMetrics::GetReportJson(bool delta) {
+    TaskSnapshot start, end;
+    UplinkQueueStats uplink, last_uplink;
+    JitterBufferStats downlink, last_downlink;
+    std::vector<I2cBusStats> i2c, last_i2c;
+    int64_t since_us = 0;
+    auto& app = Application::GetInstance();
+
+    if (delta) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (SystemInfo::TakeTaskSnapshot(end) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read the task states");
+        }
+        uplink = app.GetUplinkQueueStats();
+        downlink = app.GetJitterBufferStats();
+        i2c = GetI2cStats();
+        start = std::move(last_tasks_);
+        last_tasks_ = end;
+        last_uplink = last_uplink_;
+        last_uplink_ = uplink;
+        last_downlink = last_downlink_;
+        last_downlink_ = downlink;
+        last_i2c = std::move(last_i2c_);
+        last_i2c_ = i2c;
+        since_us = last_time_us_;
+        last_time_us_ = esp_timer_get_time();
+    } else {
+        // The counters below are compared with zero, only CPU usage needs a window
+        SystemInfo::TakeTaskSnapshot(start);
+        since_us = esp_timer_get_time();
+        vTaskDelay(pdMS_TO_TICKS(SYSTEM_METRICS_CPU_WINDOW_MS));
+        if (SystemInfo::TakeTaskSnapshot(end) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read the task states");
+        }
+        uplink = app.GetUplinkQueueStats();
+        downlink = app.GetJitterBufferStats();
+        i2c = GetI2cStats();
+    }
+
+    auto root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "mode", delta ? "delta" : "snapshot");
+    cJSON_AddNumberToObject(root, "uptime_ms", esp_timer_get_time() / 1000);
+    cJSON_AddNumberToObject(root, "interval_ms", (esp_timer_get_time() - since_us) / 1000);
+    AddMemory(root);
+    AddTasks(root, start, end);
+    AddAudio(root, uplink, last_uplink, downlink, last_downlink);
+    // Bus utilization of a one-shot report is since boot
+    AddI2c(root, i2c, last_i2c, esp_timer_get_time() - (delta ? since_us : 0));
+    AddLatency(root);
+    AddTaskTopology(root);
+    AddNetwork(root);
+#if CONFIG_USE_POWER_GOVERNOR
+    auto power = cJSON_Parse(PowerGovernor::GetInstance().GetReportJson().c_str());
+    if (power != nullptr) {
+        cJSON_AddItemToObject(root, "power", power);
+    }
+#endif
+#if CONFIG_USE_DEADLINE_MONITOR
+    auto deadlines = cJSON_Parse(DeadlineMonitor::GetInstance().GetReportJson().c_str());
+    if (deadlines != nullptr) {
+        cJSON_AddItemToObject(root, "deadlines", deadlines);
+    }
+#endif
+
+    std::string json = PrintJson(root);
+    cJSON_Delete(root);
+    return json;
+}
+
+void SystemMetrics::AddMemory(cJSON* root) {
+    auto sram = cJSON_CreateObject();
+    cJSON_AddNumberToObject(sram, "free", heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    cJSON_AddNumberToObject(sram, "min_free", heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+    cJSON_AddNumberToObject(sram, "largest_block", heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+    cJSON_AddItemToObject(root, "sram", sram);
+
+    // Boards without PSRAM leave it out
+    if (heap_caps_get_total_size(MALLOC_CAP_SPIRAM) > 0) {
+        auto psram = cJSON_CreateObject();
+        cJSON_AddNumberToObject(psram, "free", heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+        cJSON_AddNumberToObject(psram, "min_free", heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+        cJSON_AddNumberToObject(psram, "largest_block", heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM));
+        cJSON_AddItemToObject(root, "psram", psram);
+    }
+
+    // Current bytes per subsystem, only with CONFIG_USE_MEMORY_ACCOUNTING
+    if (MemoryAccounting::IsEnabled()) {
+        auto tags = cJSON_CreateObject();
+        for (int i = kMemoryTagOther + 1; i < kMemoryTagCount; i++) {
+            auto tag = (MemoryTag)i;
+            auto stats = MemoryAccounting::GetStats(tag);
+            auto item = cJSON_CreateObject();
+            cJSON_AddNumberToObject(item, "sram", stats.sram);
+            cJSON_AddNumberToObject(item, "psram", stats.psram);
+            cJSON_AddNumberToObject(item, "peak", stats.peak);
+            cJSON_AddNumberToObject(item, "allocations", stats.allocations);
+            cJSON_AddItemToObject(tags, MemoryAccounting::GetTagName(tag), item);
+        }
+        cJSON_AddNumberToObject(tags, "untracked", MemoryAccounting::GetUntracked());
+        cJSON_AddItemToObject(root, "memory_tags", tags);
+    }
+
+    // Slots of the static block, only with CONFIG_USE_BOOT_ARENA
+    BootArena::GetInstance().AddJson(root);
+}
+
+void SystemMetrics::AddTasks(cJSON* root, const TaskSnapshot& start, const TaskSnapshot& end) {
+    auto tasks = cJSON_CreateArray();
+    for (auto& usage : SystemInfo::GetTaskCpuUsage(start, end)) {
+        auto task = cJSON_CreateObject();
+        cJSON_AddStringToObject(task, "name", usage.name.c_str());
+        cJSON_AddNumberToObject(task, "cpu_percent", usage.percentage);
+        cJSON_AddNumberToObject(task, "stack_free", usage.stack_free);
+        cJSON_AddItemToArray(tasks, task);
+    }
+    cJSON_AddItemToObject(root, "tasks", tasks);
+}
+
+void SystemMetrics::AddAudio(cJSON* root, const UplinkQueueStats& uplink, const UplinkQueueStats& last_uplink,
+    const JitterBufferStats& downlink, const JitterBufferStats& last_downlink) {
+    auto audio = cJSON_CreateObject();
+
+    auto up = cJSON_CreateObject();
+    cJSON_AddNumberToObject(up, "depth", uplink.depth);
+    cJSON_AddNumberToObject(up, "max_depth", uplink.max_depth);
+    cJSON_AddNumberToObject(up, "sent", uplink.sent - last_uplink.sent);
+    cJSON_AddNumberToObject(up, "dropped_stale", uplink.dropped_stale - last_uplink.dropped_stale);
+    cJSON_AddNumberToObject(up, "dropped_full", uplink.dropped_full - last_uplink.dropped_full);
+    cJSON_AddItemToObject(audio, "uplink", up);
+
+    auto down = cJSON_CreateObject();
+    cJSON_AddNumberToObject(down, "depth", downlink.depth);
+    cJSON_AddNumberToObject(down, "target_depth", downlink.target_depth);
+    cJSON_AddNumberToObject(down, "jitter_ms", downlink.jitter_ms);
+    cJSON_AddNumberToObject(down, "lost_packets", downlink.lost_packets - last_downlink.lost_packets);
+    cJSON_AddNumberToObject(down, "reordered_packets", downlink.reordered_packets - last_downlink.reordered_packets);
+    cJSON_AddNumberToObject(down, "late_drops", downlink.late_drops - last_downlink.late_drops);
+    cJSON_AddNumberToObject(down, "overflow_drops", downlink.overflow_drops - last_downlink.overflow_drops);
+    cJSON_AddNumberToObject(down, "underruns", downlink.underruns - last_downlink.underruns);
+#if CONFIG_USE_ASYNC_AUDIO_OUTPUT
+    // Decoded ahead of the speaker, near zero while a reply plays means the decoder cannot keep up
+    auto codec = Board::GetInstance().GetAudioCodec();
+    cJSON_AddNumberToObject(down, "playout_buffered_ms", codec->output_buffered_ms());
+#endif
+    cJSON_AddItemToObject(audio, "downlink", down);
+
+    cJSON_AddItemToObject(root, "audio", audio);
+}
+
+// Buses are listed in the order their first device was created
+void SystemMetrics::AddI2c(cJSON* root, const std::vector<I2cBusStats>& i2c, const std::vector<I2cBusStats>& last_i2c, int64_t interval_us) {
+    auto buses = cJSON_CreateArray();
+    for (size_t i = 0; i < i2c.size(); i++) {
+        I2cBusStats last;
+        if (i < last_i2c.size()) {
+            last = last_i2c[i];
+        }
+        auto& stats = i2c[i];
+        auto busy_us = stats.busy_us - last.busy_us;
+        auto bus = cJSON_CreateObject();
+        cJSON_AddNumberToObject(bus, "transactions", stats.transactions - last.transactions);
+        cJSON_AddNumberToObject(bus, "errors", stats.errors - last.errors);
+        cJSON_AddNumberToObject(bus, "busy_ms", busy_us / 1000);
+        cJSON_AddNumberToObject(bus, "wait_ms", (stats.wait_us - last.wait_us) / 1000);
+        cJSON_AddNumberToObject(bus, "max_wait_us", stats.max_wait_us);
+        cJSON_AddNumberToObject(bus, "utilization_percent", interval_us > 0 ? busy_us * 100.0 / interval_us : 0);
+        cJSON_AddItemToArray(buses, bus);
+    }
+    cJSON_AddItemToObject(root, "i2c", buses);
+}
+
+// Percentiles of the last LATENCY_TRACER_SAMPLES frames of each stage, in both modes
+void SystemMetrics::AddLatency(cJSON* root) {
+    auto& tracer = LatencyTracer::GetInstance();
+    auto latency = cJSON_CreateObject();
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        auto stage = (LatencyStage)i;
+        auto stats = tracer.GetStats(stage);
+        auto item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "p50_us", stats.p50_us);
+        cJSON_AddNumberToObject(item, "p99_us", stats.p99_us);
+        cJSON_AddNumberToObject(item, "max_us", stats.max_us);
+        cJSON_AddItemToObject(latency, LatencyTracer::GetStageName(stage), item);
+    }
+    cJSON_AddItemToObject(root, "latency", latency);
+}
+
+void SystemMetrics::AddTaskTopology(cJSON* root) {
+    auto& topology = TaskTopology::GetInstance();
+    auto topology_json = cJSON_CreateObject();
+    auto tasks = cJSON_CreateArray();
+    for (int i = 0; i < kTaskRoleCount; i++) {
+        auto role = (TaskRole)i;
+        auto& config = topology.Get(role);
+        auto task = cJSON_CreateObject();
+        cJSON_AddStringToObject(task, "name", TaskTopology::GetRoleName(role));
+        cJSON_AddNumberToObject(task, "priority", config.priority);
+        cJSON_AddNumberToObject(task, "core", config.core == tskNO_AFFINITY ? -1 : config.core);
+        cJSON_AddNumberToObject(task, "stack_size", config.stack_size);
+        cJSON_AddStringToObject(task, "stack_location", config.stack_location == kTaskStackPsram ? "psram" : "internal");
+        cJSON_AddBoolToObject(task, "overridden", topology.IsOverridden(role));
+        cJSON_AddItemToArray(tasks, task);
+    }
+    cJSON_AddItemToObject(topology_json, "tasks", tasks);
+    auto warnings = cJSON_CreateArray();
+    for (auto& warning : topology.GetWarnings()) {
+        cJSON_AddItemToArray(warnings, cJSON_CreateString(warning.c_str()));
+    }
+    cJSON_AddItemToObject(topology_json, "warnings", warnings);
+    cJSON_AddItemToObject(root, "task_topology", topology_json);
+}
+
+void SystemMetrics::AddNetwork(cJSON* root) {
+    auto json = Board::GetInstance().GetNetworkMetricsJson();
+    if (json.empty()) {
+        return;
+    }
+    auto network = cJSON_Parse(json.c_str());
+    if (network != nullptr) {
+        cJSON_AddItemToObject(root, "network", network);
+    }
+}
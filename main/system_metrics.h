@@ -0,0 +1,64 @@
+#ifndef SYSTEM_METRICS_H
+#define SYSTEM_METRICS_H
+
+#include "system_info.h"
+#include "jitter_buffer.h"
+#include "application.h"
+#include "i2c_device.h"
+
+#include <cJSON.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+// CPU usage of a one-shot report is measured over this window
+#define SYSTEM_METRICS_CPU_WINDOW_MS 1000
+
+/*
+ * Device health for the self.system.get_metrics tool: CPU usage and stack
+ * high-water mark per task, heap and PSRAM low-water marks, heap usage per
+ * subsystem when it is accounted, audio queue depths, downlink packet loss,
+ * I2C bus utilization, the audio stage latencies, the task topology and the
+ * counters of the network interface, e.g. the AT round trips of a modem.
+ *
+ * A one-shot report measures CPU usage over SYSTEM_METRICS_CPU_WINDOW_MS and
+ * gives the counters since boot. A delta report gives CPU usage and counters
+ * since the previous delta report, or since boot for the first one, so a
+ * server polling it sees what happened in each interval. Levels such as free
+ * heap and queue depths are current values in both.
+ */
+class SystemMetrics {
+public:
+    static SystemMetrics& GetInstance() {
+        static SystemMetrics instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    SystemMetrics(const SystemMetrics&) = delete;
+    SystemMetrics& operator=(const SystemMetrics&) = delete;
+
+    std::string GetReportJson(bool delta);
+
+private:
+    SystemMetrics() = default;
+
+    // State at the previous delta report
+    std::mutex mutex_;
+    TaskSnapshot last_tasks_;
+    JitterBufferStats last_downlink_;
+    UplinkQueueStats last_uplink_;
+    std::vector<I2cBusStats> last_i2c_;
+    int64_t last_time_us_ = 0;
+
+    void AddMemory(cJSON* root);
+    void AddTasks(cJSON* root, const TaskSnapshot& start, const TaskSnapshot& end);
+    void AddAudio(cJSON* root, const UplinkQueueStats& uplink, const UplinkQueueStats& last_uplink,
+        const JitterBufferStats& downlink, const JitterBufferStats& last_downlink);
+    void AddI2c(cJSON* root, const std::vector<I2cBusStats>& i2c, const std::vector<I2cBusStats>& last_i2c, int64_t interval_us);
+    void AddLatency(cJSON* root);
+    void AddTaskTopology(cJSON* root);
+    void AddNetwork(cJSON* root);
+};
+
+#endif // SYSTEM_METRICS_H
@@ -0,0 +1,117 @@
+#ifndef TASK_CALLBACK_H
+#define TASK_CALLBACK_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Closures up to this size are stored inline, e.g. `this` plus a std::string or a vector
+#define TASK_CALLBACK_INLINE_SIZE 48
+
+/*
+ * Move-only replacement for std::function<void()> used by the task queues.
+ *
+ * A capturing lambda that fits TASK_CALLBACK_INLINE_SIZE is kept in the
+ * object itself, so scheduling it does not touch the heap. Bigger closures
+ * still work and fall back to a single heap allocation. Being move-only,
+ * it can also hold closures that capture move-only state.
+ */
+class TaskCallback {
+public:
+    TaskCallback() = default;
+    TaskCallback(std::nullptr_t) {}
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, TaskCallback> &&
+        !std::is_same_v<std::decay_t<F>, std::nullptr_t>>>
+    TaskCallback(F&& callable) {
+        using Callable = std::decay_t<F>;
+        if constexpr (IsInline<Callable>()) {
+            new (storage_) Callable(std::forward<F>(callable));
+            ops_ = &kInlineOps<Callable>;
+        } else {
+            *reinterpret_cast<Callable**>(storage_) = new Callable(std::forward<F>(callable));
+            ops_ = &kHeapOps<Callable>;
+        }
+    }
+
+    TaskCallback(TaskCallback&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    TaskCallback& operator=(TaskCallback&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    TaskCallback& operator=(std::nullptr_t) noexcept {
+        Reset();
+        return *this;
+    }
+
+    TaskCallback(const TaskCallback&) = delete;
+    TaskCallback& operator=(const TaskCallback&) = delete;
+
+    ~TaskCallback() {
+        Reset();
+    }
+
+    void operator()() {
+        ops_->invoke(storage_);
+    }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void Reset() {
+        if (ops_ != nullptr) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* dest, void* src);  // Move into uninitialized dest and destroy src
+        void (*destroy)(void* storage);
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[TASK_CALLBACK_INLINE_SIZE];
+    const Ops* ops_ = nullptr;
+
+    template <typename Callable>
+    static constexpr bool IsInline() {
+        return sizeof(Callable) <= TASK_CALLBACK_INLINE_SIZE && alignof(Callable) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible_v<Callable>;
+    }
+
+    template <typename Callable>
+    static inline const Ops kInlineOps = {
+        [](void* storage) { (*static_cast<Callable*>(storage))(); },
+        [](void* dest, void* src) {
+            new (dest) Callable(std::move(*static_cast<Callable*>(src)));
+            static_cast<Callable*>(src)->~Callable();
+        },
+        [](void* storage) { static_cast<Callable*>(storage)->~Callable(); },
+    };
+
+    template <typename Callable>
+    static inline const Ops kHeapOps = {
+        [](void* storage) { (**static_cast<Callable**>(storage))(); },
+        [](void* dest, void* src) { *static_cast<Callable**>(dest) = *static_cast<Callable**>(src); },
+        [](void* storage) { delete *static_cast<Callable**>(storage); },
+    };
+
+    void MoveFrom(TaskCallback& other) noexcept {
+        if (other.ops_ != nullptr) {
+            other.ops_->move(storage_, other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+};
+
+#endif // TASK_CALLBACK_H
@@ -0,0 +1,223 @@
+#include "task_profiler.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_console.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define TAG "TaskProfiler"
+
+void TaskProfiler::Start() {
+    if (timer_ != nullptr) {
+        return;
+    }
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            static_cast<TaskProfiler*>(arg)->Sample();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "task_profiler",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&timer_args, &timer_);
+    esp_timer_start_periodic(timer_, CONFIG_TASK_PROFILER_INTERVAL_MS * 1000);
+
+    // Only works on boards that started a REPL, the others have no console to type into
+    const esp_console_cmd_t cmd = {
+        .command = "top",
+        .help = "CPU usage and free stack of each task, and the lowest heap levels. Optional: seconds",
+        .hint = nullptr,
+        .func = [](int argc, char** argv) -> int {
+            TaskProfiler::GetInstance().PrintReport(argc > 1 ? atoi(argv[1]) : 10);
+            return 0;
+        },
+        .argtable = nullptr
+    };
+    if (esp_console_cmd_register(&cmd) != ESP_OK) {
+        ESP_LOGD(TAG, "No console, the top command is not available");
+    }
+    ESP_LOGI(TAG, "Sampling every %d ms", CONFIG_TASK_PROFILER_INTERVAL_MS);
+}
+
+TaskProfiler::TaskSlot* TaskProfiler::FindSlot(TaskHandle_t handle) {
+    for (auto& slot : slots_) {
+        if (slot.alive && slot.handle == handle) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+void TaskProfiler::Sample() {
+    configRUN_TIME_COUNTER_TYPE total_run_time;
+    // Fails when the array is too small, that sample is lost but the next one compares with the last good one
+    UBaseType_t count = uxTaskGetSystemState(status_, TASK_PROFILER_MAX_TASKS, &total_run_time);
+    if (count == 0) {
+        if (skipped_samples_++ == 0) {
+            ESP_LOGW(TAG, "More than %d tasks, samples are skipped", TASK_PROFILER_MAX_TASKS);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t elapsed = (uint32_t)total_run_time - last_total_run_time_;
+    last_total_run_time_ = total_run_time;
+    int index = samples_ % TASK_PROFILER_HISTORY;
+
+    // Slots of the tasks that are gone are free for new ones
+    bool seen[TASK_PROFILER_MAX_TASKS] = {};
+    for (UBaseType_t i = 0; i < count; i++) {
+        auto& status = status_[i];
+        TaskSlot* slot = FindSlot(status.xHandle);
+        uint32_t last_run_time = 0;
+        if (slot != nullptr) {
+            last_run_time = slot->last_run_time;
+        } else {
+            // A task created since the last sample counts from zero
+            for (auto& free_slot : slots_) {
+                if (!free_slot.alive) {
+                    slot = &free_slot;
+                    break;
+                }
+            }
+            if (slot == nullptr) {
+                continue;
+            }
+            slot->handle = status.xHandle;
+            strncpy(slot->name, status.pcTaskName, sizeof(slot->name) - 1);
+            slot->alive = true;
+            memset(slot->cpu, 0, sizeof(slot->cpu));
+        }
+        seen[slot - slots_] = true;
+        uint32_t run_time = (uint32_t)status.ulRunTimeCounter - last_run_time;
+        slot->last_run_time = status.ulRunTimeCounter;
+        slot->stack_free = status.usStackHighWaterMark;
+        uint32_t percent = elapsed > 0 ? (uint64_t)run_time * 100 / ((uint64_t)elapsed * CONFIG_FREERTOS_NUMBER_OF_CORES) : 0;
+        slot->cpu[index] = std::min<uint32_t>(percent, 100);
+    }
+    for (int i = 0; i < TASK_PROFILER_MAX_TASKS; i++) {
+        if (!seen[i]) {
+            slots_[i].alive = false;
+        }
+    }
+
+    // The first sample only sets the counters, usage since boot says nothing about a spike
+    if (!primed_) {
+        primed_ = true;
+        return;
+    }
+    auto& heap = heap_[index];
+    heap.time_us = esp_timer_get_time();
+    heap.sram_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    heap.sram_largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+    heap.psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    samples_++;
+}
+
+int TaskProfiler::GetWindowSamples(int seconds) const {
+    int samples = seconds * 1000 / CONFIG_TASK_PROFILER_INTERVAL_MS;
+    return std::clamp<int>(samples, 1, std::min<uint32_t>(samples_, TASK_PROFILER_HISTORY));
+}
+
+int TaskProfiler::GetWindows(int samples, TaskWindow* windows) {
+    int count = 0;
+    int newest = (samples_ - 1) % TASK_PROFILER_HISTORY;
+    for (auto& slot : slots_) {
+        if (!slot.alive) {
+            continue;
+        }
+        auto& window = windows[count++];
+        window.slot = &slot;
+        window.peak = 0;
+        window.peak_age = 0;
+        uint32_t total = 0;
+        for (int age = 0; age < samples; age++) {
+            uint32_t cpu = slot.cpu[(newest - age + TASK_PROFILER_HISTORY) % TASK_PROFILER_HISTORY];
+            total += cpu;
+            if (cpu > window.peak) {
+                window.peak = cpu;
+                window.peak_age = age;
+            }
+        }
+        window.average = total / samples;
+    }
+    std::sort(windows, windows + count, [](const TaskWindow& a, const TaskWindow& b) {
+        return a.average > b.average || (a.average == b.average && a.peak > b.peak);
+    });
+    return count;
+}
+
+size_t TaskProfiler::FormatReport(char* buffer, size_t size, int seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (samples_ == 0) {
+        return snprintf(buffer, size, "{\"error\":\"No samples yet\"}");
+    }
+    int samples = GetWindowSamples(seconds);
+    int newest = (samples_ - 1) % TASK_PROFILER_HISTORY;
+    HeapSample low = heap_[newest];
+    for (int age = 1; age < samples; age++) {
+        auto& heap = heap_[(newest - age + TASK_PROFILER_HISTORY) % TASK_PROFILER_HISTORY];
+        low.sram_free = std::min(low.sram_free, heap.sram_free);
+        low.sram_largest = std::min(low.sram_largest, heap.sram_largest);
+        low.psram_free = std::min(low.psram_free, heap.psram_free);
+    }
+
+    size_t length = snprintf(buffer, size,
+        "{\"interval_ms\":%d,\"window_seconds\":%d,\"skipped_samples\":%lu,"
+        "\"sram\":{\"free\":%lu,\"window_min_free\":%lu,\"window_min_largest_block\":%lu},"
+        "\"psram\":{\"free\":%lu,\"window_min_free\":%lu},\"tasks\":[",
+        CONFIG_TASK_PROFILER_INTERVAL_MS, samples * CONFIG_TASK_PROFILER_INTERVAL_MS / 1000, (unsigned long)skipped_samples_,
+        (unsigned long)heap_[newest].sram_free, (unsigned long)low.sram_free, (unsigned long)low.sram_largest,
+        (unsigned long)heap_[newest].psram_free, (unsigned long)low.psram_free);
+
+    TaskWindow windows[TASK_PROFILER_MAX_TASKS];
+    int count = GetWindows(samples, windows);
+    for (int i = 0; i < count && length < size; i++) {
+        auto& window = windows[i];
+        // Room is kept for the closing brackets, a task that does not fit is left out with the rest
+        char item[160];
+        int item_length = snprintf(item, sizeof(item),
+            "%s{\"name\":\"%s\",\"cpu_now\":%u,\"cpu_avg\":%lu,\"cpu_peak\":%lu,\"peak_seconds_ago\":%d,\"stack_free\":%lu}",
+            i > 0 ? "," : "", window.slot->name, window.slot->cpu[newest], (unsigned long)window.average,
+            (unsigned long)window.peak, window.peak_age * CONFIG_TASK_PROFILER_INTERVAL_MS / 1000,
+            (unsigned long)window.slot->stack_free);
+        if (length + item_length + 3 > size) {
+            break;
+        }
+        memcpy(buffer + length, item, item_length);
+        length += item_length;
+    }
+    length += snprintf(buffer + length, size - length, "]}");
+    return std::min(length, size - 1);
+}
+
+void TaskProfiler::PrintReport(int seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (samples_ == 0) {
+        printf("No samples yet\n");
+        return;
+    }
+    int samples = GetWindowSamples(seconds);
+    int newest = (samples_ - 1) % TASK_PROFILER_HISTORY;
+    uint32_t min_sram = heap_[newest].sram_free;
+    for (int age = 1; age < samples; age++) {
+        min_sram = std::min(min_sram, heap_[(newest - age + TASK_PROFILER_HISTORY) % TASK_PROFILER_HISTORY].sram_free);
+    }
+    printf("Last %d s, sram free %lu (min %lu), psram free %lu\n", samples * CONFIG_TASK_PROFILER_INTERVAL_MS / 1000,
+        (unsigned long)heap_[newest].sram_free, (unsigned long)min_sram, (unsigned long)heap_[newest].psram_free);
+    printf("| %-16s | Now | Avg | Peak | Peak ago | Stack free\n", "Task");
+
+    TaskWindow windows[TASK_PROFILER_MAX_TASKS];
+    int count = GetWindows(samples, windows);
+    for (int i = 0; i < count; i++) {
+        auto& window = windows[i];
+        printf("| %-16s | %2u%% | %2lu%% | %3lu%% | %6ds | %lu\n", window.slot->name, window.slot->cpu[newest],
+            (unsigned long)window.average, (unsigned long)window.peak,
+            window.peak_age * CONFIG_TASK_PROFILER_INTERVAL_MS / 1000, (unsigned long)window.slot->stack_free);
+    }
+}
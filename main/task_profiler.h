@@ -0,0 +1,93 @@
+#ifndef TASK_PROFILER_H
+#define TASK_PROFILER_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+// Tasks tracked at once, a sample is skipped while more are alive
+#define TASK_PROFILER_MAX_TASKS 48
+// Samples kept per task, CONFIG_TASK_PROFILER_INTERVAL_MS apart
+#define TASK_PROFILER_HISTORY 60
+// Room for a report of every tracked task
+#define TASK_PROFILER_REPORT_SIZE 6144
+
+/*
+ * Samples the CPU usage of every task, its stack high-water mark and the
+ * heap levels every CONFIG_TASK_PROFILER_INTERVAL_MS from an esp_timer, and
+ * keeps the last TASK_PROFILER_HISTORY samples in fixed arrays.
+ *
+ * Sampling and reporting do not allocate: the task states are read into a
+ * member array, a task keeps its slot while it is alive, and reports are
+ * formatted into the caller's buffer or straight to the console. So the
+ * profiler can run on production units all the time, and after a glitch
+ * the report shows which task spiked, by how much and how long ago, and
+ * the lowest heap levels of the window.
+ *
+ * Reports are available through the self.system.get_task_profile tool and,
+ * on boards that start an esp_console REPL, the `top` command.
+ */
+class TaskProfiler {
+public:
+    static TaskProfiler& GetInstance() {
+        static TaskProfiler instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    TaskProfiler(const TaskProfiler&) = delete;
+    TaskProfiler& operator=(const TaskProfiler&) = delete;
+
+    void Start();
+    // JSON of the last `seconds`, returns the length written. A report that does not fit is cut at a task
+    size_t FormatReport(char* buffer, size_t size, int seconds);
+    // The same report as a table on stdout, for the console
+    void PrintReport(int seconds);
+
+private:
+    TaskProfiler() = default;
+
+    struct TaskSlot {
+        TaskHandle_t handle = nullptr;
+        char name[configMAX_TASK_NAME_LEN] = {};
+        bool alive = false;
+        uint32_t last_run_time = 0;
+        uint32_t stack_free = 0;
+        // CPU percent of all cores per sample, 0 for samples before the task existed
+        uint8_t cpu[TASK_PROFILER_HISTORY] = {};
+    };
+    struct HeapSample {
+        int64_t time_us = 0;
+        uint32_t sram_free = 0;
+        uint32_t sram_largest = 0;
+        uint32_t psram_free = 0;
+    };
+    // Totals of one task over a window
+    struct TaskWindow {
+        const TaskSlot* slot;
+        uint32_t average;
+        uint32_t peak;
+        int peak_age;   // Samples since the peak
+    };
+
+    std::mutex mutex_;
+    esp_timer_handle_t timer_ = nullptr;
+    TaskStatus_t status_[TASK_PROFILER_MAX_TASKS];
+    TaskSlot slots_[TASK_PROFILER_MAX_TASKS];
+    HeapSample heap_[TASK_PROFILER_HISTORY];
+    uint32_t last_total_run_time_ = 0;
+    uint32_t samples_ = 0;          // Samples taken since Start(), the newest is at (samples_ - 1) % TASK_PROFILER_HISTORY
+    uint32_t skipped_samples_ = 0;
+    bool primed_ = false;
+
+    void Sample();
+    TaskSlot* FindSlot(TaskHandle_t handle);
+    // Fills `windows` sorted by average usage, returns how many, the mutex must be held
+    int GetWindows(int samples, TaskWindow* windows);
+    int GetWindowSamples(int seconds) const;
+};
+
+#endif // TASK_PROFILER_H
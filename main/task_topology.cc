@@ -0,0 +1,338 @@
+#include "task_topology.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_memory_utils.h>
+#include <esp_cpu.h>
+#include <esp_expression_with_stack.h>
+#include <freertos/idf_additions.h>
+#include <freertos/timers.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+#define TAG "TaskTopology"
+
+// Below this no task of the firmware survives a log call
+#define TASK_TOPOLOGY_MIN_STACK_SIZE 2048
+
+#if CONFIG_FREERTOS_UNICORE
+#define PINNED(core) tskNO_AFFINITY
+#else
+#define PINNED(core) (core)
+#endif
+
+#if CONFIG_ESP_MAIN_TASK_AFFINITY_CPU0
+#define MAIN_TASK_CORE PINNED(0)
+#elif CONFIG_ESP_MAIN_TASK_AFFINITY_CPU1
+#define MAIN_TASK_CORE PINNED(1)
+#else
+#define MAIN_TASK_CORE tskNO_AFFINITY
+#endif
+
+// MIPI panels refresh from the LVGL task at the port's default priority, the
+// smaller SPI and I2C panels of the other chips must not get in the way of audio
+#if CONFIG_IDF_TARGET_ESP32P4
+#define DISPLAY_TASK_PRIORITY 4
+#else
+#define DISPLAY_TASK_PRIORITY 1
+#endif
+
+// Where the stacks of the tasks that are not on the audio path go by default
+#if CONFIG_TASK_STACKS_IN_PSRAM
+#define NON_REALTIME_STACK kTaskStackPsram
+#else
+#define NON_REALTIME_STACK kTaskStackInternal
+#endif
+
+struct TaskRoleInfo {
+    const char* name;
+    TaskConfig config;
+    uint32_t min_stack_size;
+    // The audio tasks with hard deadlines and the workers that run arbitrary callbacks keep an internal stack
+    bool psram_stack_allowed;
+};
+
+// In the order of TaskRole
+static const TaskRoleInfo kTaskRoles[kTaskRoleCount] = {
+    { "main_event_loop", { 3, MAIN_TASK_CORE, CONFIG_ESP_MAIN_TASK_STACK_SIZE, kTaskStackInternal }, 0, false },
+    { "audio_capture", { 9, tskNO_AFFINITY, 4096, kTaskStackInternal }, 3072, false },
+#if CONFIG_USE_AUDIO_PROCESSOR
+    // Away from the Wi-Fi task on core 0, AEC must keep up with the microphones
+    { "audio_loop", { 8, PINNED(1), 4096 * 2, kTaskStackInternal }, 4096, false },
+#else
+    { "audio_loop", { 8, tskNO_AFFINITY, 4096 * 2, kTaskStackInternal }, 4096, false },
+#endif
+    { "audio_playout", { 6, tskNO_AFFINITY, 4096, kTaskStackInternal }, 3072, false },
+    // Encoding and decoding on different cores so that realtime mode runs them in parallel
+    { "audio_decode", { 5, PINNED(1), 4096 * 3, kTaskStackInternal }, 8192, true },
+    { "audio_encode", { 4, PINNED(0), 4096 * 7, kTaskStackInternal }, 16384, true },
+    { "audio_communication", { 3, tskNO_AFFINITY, 4096, kTaskStackInternal }, 3072, false },
+    { "audio_detection", { 3, tskNO_AFFINITY, 4096, kTaskStackInternal }, 3072, false },
+    { "background", { 2, tskNO_AFFINITY, 4096 * 2, kTaskStackInternal }, 6144, false },
+    { "tool_call", { 1, tskNO_AFFINITY, 6144, NON_REALTIME_STACK }, 4096, true },
+    { "lvgl", { DISPLAY_TASK_PRIORITY, tskNO_AFFINITY, 7168, kTaskStackInternal }, 4096, true },
+    { "camera_stream", { 2, tskNO_AFFINITY, 4096, NON_REALTIME_STACK }, 3072, true },
+    // Level with the main loop, the subscribers react while it goes on with the rest of a state change
+    { "event_bus", { 3, tskNO_AFFINITY, 4096, kTaskStackInternal }, 3072, false },
+};
+
+// Pairs of roles where the first must run above the second
+static const TaskRole kPriorityOrder[][2] = {
+    { kTaskAudioCapture, kTaskAudioLoop },      // The capture ring is filled before it is read
+    { kTaskAudioLoop, kTaskAudioPlayout },
+    { kTaskAudioPlayout, kTaskAudioDecode },    // Playout drains what decoding queues
+    { kTaskAudioDecode, kTaskAudioEncode },     // A late frame is heard, a late packet is not
+    { kTaskMainLoop, kTaskBackground },
+    { kTaskBackground, kTaskToolCall },
+};
+
+static std::string FormatCore(BaseType_t core) {
+    return core == tskNO_AFFINITY ? "any" : std::to_string(core);
+}
+
+TaskTopology::TaskTopology() {
+    for (int i = 0; i < kTaskRoleCount; i++) {
+        configs_[i] = kTaskRoles[i].config;
+    }
+    ApplyOverrides(CONFIG_TASK_TOPOLOGY_OVERRIDES);
+    CheckOrder();
+
+    // Taken from internal RAM at boot, before it is fragmented, and only when some task needs it
+    for (int i = 0; i < kTaskRoleCount; i++) {
+        if (configs_[i].stack_location == kTaskStackPsram) {
+            shared_stack_ = heap_caps_malloc(TASK_TOPOLOGY_SHARED_STACK_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+            shared_stack_lock_ = xSemaphoreCreateMutex();
+            if (shared_stack_ == nullptr || shared_stack_lock_ == nullptr) {
+                ESP_LOGE(TAG, "Failed to allocate the shared stack");
+                abort();
+            }
+            break;
+        }
+    }
+    for (int i = 0; i < kTaskRoleCount; i++) {
+        auto& config = configs_[i];
+        ESP_LOGD(TAG, "%-20s priority %2u, core %s, %5lu bytes %s stack%s", kTaskRoles[i].name,
+            config.priority, FormatCore(config.core).c_str(), (unsigned long)config.stack_size,
+            config.stack_location == kTaskStackPsram ? "PSRAM" : "internal", overridden_[i] ? ", overridden" : "");
+    }
+}
+
+const char* TaskTopology::GetRoleName(TaskRole role) {
+    return kTaskRoles[role].name;
+}
+
+uint32_t TaskTopology::GetStackCaps(TaskRole role) const {
+    if (configs_[role].stack_location == kTaskStackPsram) {
+        return MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+    }
+    return MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+}
+
+void TaskTopology::Warn(const std::string& message) {
+    ESP_LOGW(TAG, "%s", message.c_str());
+    warnings_.push_back(message);
+}
+
+void TaskTopology::ApplyOverrides(const char* overrides) {
+    std::string list(overrides);
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        auto entry = list.substr(start, end - start);
+        std::string error;
+        if (!entry.empty() && !ApplyOverride(entry, error)) {
+            Warn("Ignored " + entry + ": " + error);
+        }
+        start = end + 1;
+    }
+}
+
+// name:priority:core:stack_size:location, empty fields keep the default
+bool TaskTopology::ApplyOverride(const std::string& entry, std::string& error) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (true) {
+        size_t end = entry.find(':', start);
+        fields.push_back(entry.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        if (end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    if (fields.size() > 5) {
+        error = "too many fields";
+        return false;
+    }
+
+    int role = 0;
+    while (role < kTaskRoleCount && fields[0] != kTaskRoles[role].name) {
+        role++;
+    }
+    if (role == kTaskRoleCount) {
+        error = "unknown task";
+        return false;
+    }
+
+    TaskConfig config = configs_[role];
+    char* end = nullptr;
+    if (fields.size() > 1 && !fields[1].empty()) {
+        config.priority = strtoul(fields[1].c_str(), &end, 10);
+        if (*end != '\0') {
+            error = "bad priority";
+            return false;
+        }
+    }
+    if (fields.size() > 2 && !fields[2].empty()) {
+        if (fields[2] == "any") {
+            config.core = tskNO_AFFINITY;
+        } else {
+            config.core = strtol(fields[2].c_str(), &end, 10);
+            if (*end != '\0') {
+                error = "bad core";
+                return false;
+            }
+        }
+    }
+    if (fields.size() > 3 && !fields[3].empty()) {
+        config.stack_size = strtoul(fields[3].c_str(), &end, 10);
+        if (*end != '\0') {
+            error = "bad stack size";
+            return false;
+        }
+    }
+    if (fields.size() > 4 && !fields[4].empty()) {
+        if (fields[4] == "internal") {
+            config.stack_location = kTaskStackInternal;
+        } else if (fields[4] == "psram") {
+            config.stack_location = kTaskStackPsram;
+        } else {
+            error = "bad stack location";
+            return false;
+        }
+    }
+
+    if (!Validate((TaskRole)role, config, error)) {
+        return false;
+    }
+    configs_[role] = config;
+    overridden_[role] = true;
+    return true;
+}
+
+bool TaskTopology::Validate(TaskRole role, const TaskConfig& config, std::string& error) const {
+    auto& info = kTaskRoles[role];
+    if (config.priority < 1 || config.priority >= configMAX_PRIORITIES) {
+        error = "priority must be between 1 and " + std::to_string(configMAX_PRIORITIES - 1);
+        return false;
+    }
+    if (config.core != tskNO_AFFINITY && (config.core < 0 || config.core >= portNUM_PROCESSORS)) {
+        error = "no core " + std::to_string(config.core) + " on this chip";
+        return false;
+    }
+    if (role == kTaskMainLoop) {
+        // The main task exists before the table, only its priority can change
+        if (config.core != info.config.core || config.stack_size != info.config.stack_size ||
+            config.stack_location != info.config.stack_location) {
+            error = "only the priority can change, the rest is set by CONFIG_ESP_MAIN_TASK_*";
+            return false;
+        }
+        return true;
+    }
+    if (config.stack_size < std::max<uint32_t>(info.min_stack_size, TASK_TOPOLOGY_MIN_STACK_SIZE)) {
+        error = "stack must be at least " + std::to_string(std::max<uint32_t>(info.min_stack_size, TASK_TOPOLOGY_MIN_STACK_SIZE));
+        return false;
+    }
+    if (config.stack_location == kTaskStackPsram) {
+#if CONFIG_SPIRAM_ALLOW_STACK_EXTERNAL_MEMORY
+        if (!info.psram_stack_allowed) {
+            error = "this task needs an internal stack";
+            return false;
+        }
+#else
+        error = "PSRAM stacks need CONFIG_SPIRAM_ALLOW_STACK_EXTERNAL_MEMORY";
+        return false;
+#endif
+    }
+    return true;
+}
+
+void TaskTopology::CheckOrder() {
+    for (auto& pair : kPriorityOrder) {
+        auto& higher = configs_[pair[0]];
+        auto& lower = configs_[pair[1]];
+        if (higher.priority <= lower.priority) {
+            Warn(std::string(kTaskRoles[pair[0]].name) + " (" + std::to_string(higher.priority) +
+                ") should run above " + kTaskRoles[pair[1]].name + " (" + std::to_string(lower.priority) + ")");
+        }
+    }
+}
+
+bool TaskTopology::CreateTask(TaskRole role, TaskFunction_t function, void* arg, TaskHandle_t* handle,
+    const char* name) const {
+    return CreateTask(configs_[role], name != nullptr ? name : kTaskRoles[role].name, function, arg, handle);
+}
+
+bool TaskTopology::CreateTask(const TaskConfig& config, const char* name, TaskFunction_t function, void* arg,
+    TaskHandle_t* handle) {
+    BaseType_t ret;
+    if (config.stack_location == kTaskStackPsram) {
+        ret = xTaskCreatePinnedToCoreWithCaps(function, name, config.stack_size, arg, config.priority, handle,
+            config.core, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    } else {
+        ret = xTaskCreatePinnedToCore(function, name, config.stack_size, arg, config.priority, handle, config.core);
+    }
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create %s with %lu bytes of %s stack", name, (unsigned long)config.stack_size,
+            config.stack_location == kTaskStackPsram ? "PSRAM" : "internal");
+        return false;
+    }
+    return true;
+}
+
+void TaskTopology::DeleteTask(const TaskConfig& config, TaskHandle_t handle) {
+    if (config.stack_location == kTaskStackPsram) {
+        vTaskDeleteWithCaps(handle);
+    } else {
+        vTaskDelete(handle);
+    }
+}
+
+void TaskTopology::ExitTask() {
+    if (!IsStackInPsram()) {
+        vTaskDelete(NULL);
+    } else {
+        // The timer service task frees the stack, it waits for this task to be suspended first
+        xTimerPendFunctionCall([](void* handle, uint32_t) {
+            while (eTaskGetState((TaskHandle_t)handle) != eSuspended) {
+                vTaskDelay(1);
+            }
+            vTaskDeleteWithCaps((TaskHandle_t)handle);
+        }, xTaskGetCurrentTaskHandle(), 0, portMAX_DELAY);
+    }
+    while (true) {
+        vTaskSuspend(NULL);
+    }
+}
+
+bool TaskTopology::IsStackInPsram() {
+    return esp_ptr_external_ram((const void*)esp_cpu_get_sp());
+}
+
+void TaskTopology::RunOnInternalStack(const std::function<void()>& function) {
+    if (!IsStackInPsram()) {
+        function();
+        return;
+    }
+    auto& topology = GetInstance();
+    std::lock_guard<std::mutex> lock(topology.shared_stack_mutex_);
+    topology.shared_function_ = &function;
+    esp_execute_shared_stack_function(topology.shared_stack_lock_, topology.shared_stack_,
+        TASK_TOPOLOGY_SHARED_STACK_SIZE, []() {
+            (*TaskTopology::GetInstance().shared_function_)();
+        });
+    topology.shared_function_ = nullptr;
+}
@@ -0,0 +1,131 @@
+#ifndef TASK_TOPOLOGY_H
+#define TASK_TOPOLOGY_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+
+// Every task the firmware creates itself, one row of the topology each
+enum TaskRole {
+    kTaskMainLoop = 0,      // main_event_loop, runs on the main task so only its priority applies
+    kTaskAudioCapture,
+    kTaskAudioLoop,
+    kTaskAudioPlayout,
+    kTaskAudioDecode,
+    kTaskAudioEncode,
+    kTaskAudioProcessor,
+    kTaskWakeWord,
+    kTaskBackground,        // One worker per core, the core column is ignored
+    kTaskToolCall,
+    kTaskDisplay,           // The esp_lvgl_port task
+    kTaskCameraStream,
+    kTaskEventBus,          // Runs the EventBus subscribers
+    kTaskRoleCount
+};
+
+enum TaskStackLocation {
+    kTaskStackInternal = 0,
+    kTaskStackPsram,
+};
+
+// Flash operations of the tasks with a PSRAM stack run on this internal stack, one at a time
+#define TASK_TOPOLOGY_SHARED_STACK_SIZE 6144
+
+struct TaskConfig {
+    UBaseType_t priority;
+    BaseType_t core;        // tskNO_AFFINITY for either core
+    uint32_t stack_size;
+    TaskStackLocation stack_location;
+};
+
+/*
+ * Priority, core, stack size and stack location of every task the firmware
+ * creates, in one table instead of scattered over the call sites.
+ *
+ * The defaults depend on the chip: dual-core chips pin the audio tasks so
+ * that encoding and decoding run in parallel, single-core chips leave every
+ * task unpinned. A board changes rows with CONFIG_TASK_TOPOLOGY_OVERRIDES in
+ * its config.json sdkconfig_append, a list of
+ *
+ *     name:priority:core:stack_size:location
+ *
+ * separated by commas, where an empty field keeps the default, the core is
+ * 0, 1 or any and the location is internal or psram. For example
+ * "audio_encode:::20480:psram,lvgl:2" moves the Opus encoder stack to
+ * PSRAM and raises the LVGL task.
+ *
+ * Non-realtime tasks may keep their stack in PSRAM, all of them with
+ * CONFIG_TASK_STACKS_IN_PSRAM or one by one with an override. PSRAM is read
+ * through the flash cache, which is off while flash is written or read, so
+ * such a task must not touch flash on its own stack: Settings and Ota run
+ * their NVS and partition calls through RunOnInternalStack, which switches
+ * to a shared internal stack when needed, and the tasks end with ExitTask
+ * because a task cannot free its own stack.
+ *
+ * The table is validated on first use. An override with a priority, core or
+ * stack size the chip cannot take, or a PSRAM stack for a realtime task or
+ * one that runs arbitrary work, is dropped with a warning. The order the audio
+ * path relies on (capture above the audio loop above playout, decoding above
+ * encoding, the main loop above the background workers) is checked too, a
+ * board may break it on purpose so that only warns. The final table and the
+ * warnings are part of the self.system.get_metrics report.
+ */
+class TaskTopology {
+public:
+    static TaskTopology& GetInstance() {
+        static TaskTopology instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    TaskTopology(const TaskTopology&) = delete;
+    TaskTopology& operator=(const TaskTopology&) = delete;
+
+    const TaskConfig& Get(TaskRole role) const { return configs_[role]; }
+    static const char* GetRoleName(TaskRole role);
+    // Heap caps of the stack, for APIs that take them
+    uint32_t GetStackCaps(TaskRole role) const;
+
+    // Creates a task of `role` with its row of the table, `name` defaults to the role name
+    bool CreateTask(TaskRole role, TaskFunction_t function, void* arg, TaskHandle_t* handle = nullptr,
+        const char* name = nullptr) const;
+    // For callers that adjust a copy of their row, e.g. one worker per core. A task
+    // with a PSRAM stack must not delete itself, it is deleted with DeleteTask
+    static bool CreateTask(const TaskConfig& config, const char* name, TaskFunction_t function, void* arg,
+        TaskHandle_t* handle);
+    static void DeleteTask(const TaskConfig& config, TaskHandle_t handle);
+    // Ends the calling task in place of vTaskDelete(NULL), a PSRAM stack is freed once the task is suspended
+    [[noreturn]] static void ExitTask();
+
+    static bool IsStackInPsram();
+    // Runs `function` on the calling task, on the shared internal stack if its own is in PSRAM.
+    // For code that reads or writes flash
+    static void RunOnInternalStack(const std::function<void()>& function);
+
+    bool IsOverridden(TaskRole role) const { return overridden_[role]; }
+    const std::vector<std::string>& GetWarnings() const { return warnings_; }
+
+private:
+    TaskTopology();
+
+    TaskConfig configs_[kTaskRoleCount];
+    bool overridden_[kTaskRoleCount] = {};
+    std::vector<std::string> warnings_;
+    std::mutex shared_stack_mutex_;
+    SemaphoreHandle_t shared_stack_lock_ = nullptr;
+    void* shared_stack_ = nullptr;
+    const std::function<void()>* shared_function_ = nullptr;
+
+    void ApplyOverrides(const char* overrides);
+    bool ApplyOverride(const std::string& entry, std::string& error);
+    bool Validate(TaskRole role, const TaskConfig& config, std::string& error) const;
+    void CheckOrder();
+    void Warn(const std::string& message);
+};
+
+#endif // TASK_TOPOLOGY_H
@@ -0,0 +1,52 @@
+#ifndef TIMING_HISTOGRAM_H
+#define TIMING_HISTOGRAM_H
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Durations in fixed-width buckets, the last bucket collects everything
+ * slower. Adding is a division and an increment, so a benchmark can record
+ * every call of a hot loop; the percentiles are read once for the report.
+ *
+ * Not thread safe, each benchmark keeps its own.
+ */
+class TimingHistogram {
+public:
+    TimingHistogram(uint32_t bucket_us, size_t buckets) : bucket_us_(bucket_us), buckets_(buckets) {}
+
+    void Add(uint32_t us) {
+        buckets_[std::min<size_t>(us / bucket_us_, buckets_.size() - 1)]++;
+        count_++;
+        total_us_ += us;
+        max_us_ = std::max(max_us_, us);
+    }
+
+    uint32_t Percentile(int percent) const {
+        uint32_t target = (uint64_t)count_ * percent / 100;
+        uint32_t count = 0;
+        for (size_t i = 0; i < buckets_.size(); i++) {
+            count += buckets_[i];
+            if (count > target) {
+                // The upper edge of the bucket, but never above what was actually seen
+                return std::min<uint32_t>((i + 1) * bucket_us_, max_us_);
+            }
+        }
+        return max_us_;
+    }
+
+    inline uint32_t count() const { return count_; }
+    inline uint32_t mean_us() const { return count_ > 0 ? total_us_ / count_ : 0; }
+    inline uint32_t max_us() const { return max_us_; }
+
+private:
+    uint32_t bucket_us_;
+    std::vector<uint32_t> buckets_;
+    uint32_t count_ = 0;
+    uint32_t max_us_ = 0;
+    uint64_t total_us_ = 0;
+};
+
+#endif // TIMING_HISTOGRAM_H
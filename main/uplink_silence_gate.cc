@@ -0,0 +1,116 @@
+#include "uplink_silence_gate.h"
+
+#include <esp_log.h>
+
+#include <utility>
+
+#define TAG "UplinkSilenceGate"
+
+UplinkSilenceGate::UplinkSilenceGate(int hangover_ms, int preroll_ms, int keepalive_ms, size_t preroll_packets)
+    : hangover_ms_(hangover_ms), preroll_ms_(preroll_ms), keepalive_ms_(keepalive_ms),
+      preroll_(preroll_packets), preroll_durations_(preroll_packets) {
+}
+
+void UplinkSilenceGate::OnEvent(std::function<void(UplinkSilenceEvent event, int silence_ms)> callback) {
+    on_event_ = callback;
+}
+
+void UplinkSilenceGate::SetEnabled(bool enabled) {
+    enabled_ = enabled;
+}
+
+void UplinkSilenceGate::SetVoice(bool voice) {
+    voice_ = voice;
+}
+
+void UplinkSilenceGate::Reset() {
+    reset_pending_ = true;
+}
+
+void UplinkSilenceGate::Notify(UplinkSilenceEvent event, int silence_ms) {
+    if (on_event_) {
+        on_event_(event, silence_ms);
+    }
+}
+
+void UplinkSilenceGate::ClearPreroll() {
+    preroll_head_ = 0;
+    preroll_count_ = 0;
+    preroll_total_ms_ = 0;
+    release_count_ = 0;
+}
+
+void UplinkSilenceGate::Keep(AudioStreamPacket& packet, int frame_duration_ms) {
+    size_t slots = preroll_.size();
+    while (preroll_count_ > 0 && (preroll_count_ == slots || preroll_total_ms_ + frame_duration_ms > preroll_ms_)) {
+        preroll_total_ms_ -= preroll_durations_[preroll_head_];
+        preroll_head_ = (preroll_head_ + 1) % slots;
+        preroll_count_--;
+    }
+    if (frame_duration_ms > preroll_ms_) {
+        return;
+    }
+    // The slot gets the packet and the caller the slot's old buffers
+    size_t tail = (preroll_head_ + preroll_count_) % slots;
+    std::swap(preroll_[tail], packet);
+    preroll_durations_[tail] = frame_duration_ms;
+    preroll_count_++;
+    preroll_total_ms_ += frame_duration_ms;
+}
+
+bool UplinkSilenceGate::Admit(AudioStreamPacket& packet, int frame_duration_ms) {
+    if (reset_pending_.exchange(false)) {
+        suppressed_ = false;
+        silence_ms_ = 0;
+        ClearPreroll();
+    }
+    bool enabled = enabled_;
+    if (!enabled || voice_) {
+        silence_ms_ = 0;
+        if (suppressed_) {
+            suppressed_ = false;
+            ESP_LOGI(TAG, "Voice after %d ms of silence", suppressed_ms_);
+            Notify(kUplinkVoiceResumed, suppressed_ms_);
+            // Only speech has an onset worth sending
+            if (enabled) {
+                release_count_ = preroll_count_;
+            } else {
+                ClearPreroll();
+            }
+        }
+        return true;
+    }
+
+    if (!suppressed_) {
+        silence_ms_ += frame_duration_ms;
+        if (silence_ms_ <= hangover_ms_) {
+            return true;
+        }
+        ESP_LOGI(TAG, "Silence, uplink suppressed");
+        suppressed_ = true;
+        suppressed_ms_ = 0;
+        since_keepalive_ms_ = 0;
+        ClearPreroll();
+        Notify(kUplinkSilenceStarted, 0);
+    }
+    suppressed_ms_ += frame_duration_ms;
+    since_keepalive_ms_ += frame_duration_ms;
+    if (since_keepalive_ms_ >= keepalive_ms_) {
+        since_keepalive_ms_ = 0;
+        Notify(kUplinkSilenceKeepalive, suppressed_ms_);
+    }
+    Keep(packet, frame_duration_ms);
+    return false;
+}
+
+bool UplinkSilenceGate::PopPreroll(AudioStreamPacket& packet) {
+    if (release_count_ == 0) {
+        return false;
+    }
+    packet = std::move(preroll_[preroll_head_]);
+    preroll_total_ms_ -= preroll_durations_[preroll_head_];
+    preroll_head_ = (preroll_head_ + 1) % preroll_.size();
+    preroll_count_--;
+    release_count_--;
+    return true;
+}
@@ -0,0 +1,81 @@
+#ifndef UPLINK_SILENCE_GATE_H
+#define UPLINK_SILENCE_GATE_H
+
+#include "protocol.h"
+
+#include <atomic>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+enum UplinkSilenceEvent {
+    kUplinkSilenceStarted,
+    kUplinkSilenceKeepalive,    // Still silent, sent every keepalive interval
+    kUplinkVoiceResumed,
+};
+
+/*
+ * Stops the uplink while the VAD hears nothing in realtime mode, where the
+ * microphone would otherwise stream for the whole session.
+ *
+ * The encoder keeps running so its state stays continuous, and the gate
+ * decides per encoded packet whether it goes out. Once the VAD has reported
+ * silence for the hangover, packets are held back instead of sent, the
+ * latest pre-roll worth of them kept in a ring. When speech starts, the
+ * pre-roll goes out first, so the onset the VAD needed a few frames to
+ * recognize reaches the server too.
+ *
+ * The events let the caller tell the server that the gap is silence and not
+ * loss, and keep telling it while the silence lasts.
+ *
+ * SetEnabled(), SetVoice() and Reset() may be called from any task, the rest
+ * runs on the encode task, which is also where the event callback is called.
+ */
+class UplinkSilenceGate {
+public:
+    // `preroll_packets` bounds the pre-roll when the frames are short
+    UplinkSilenceGate(int hangover_ms, int preroll_ms, int keepalive_ms, size_t preroll_packets);
+
+    // `silence_ms` is how long the uplink has been suppressed, 0 when it starts
+    void OnEvent(std::function<void(UplinkSilenceEvent event, int silence_ms)> callback);
+
+    void SetEnabled(bool enabled);
+    void SetVoice(bool voice);
+    // Drops the pre-roll and starts over sending, e.g. for a new listening session
+    void Reset();
+
+    // False while the uplink is suppressed, the packet is then kept for the pre-roll
+    bool Admit(AudioStreamPacket& packet, int frame_duration_ms);
+    // After Admit() let the first packet of speech through, what goes out before it, oldest first
+    bool PopPreroll(AudioStreamPacket& packet);
+
+private:
+    int hangover_ms_;
+    int preroll_ms_;
+    int keepalive_ms_;
+    std::function<void(UplinkSilenceEvent event, int silence_ms)> on_event_;
+
+    std::atomic<bool> enabled_{false};
+    std::atomic<bool> voice_{false};
+    std::atomic<bool> reset_pending_{false};
+
+    // Encode task
+    bool suppressed_ = false;
+    int silence_ms_ = 0;        // Since the VAD reported silence, until the hangover is over
+    int suppressed_ms_ = 0;
+    int since_keepalive_ms_ = 0;
+    // Held packets and their durations, the oldest at preroll_head_
+    std::vector<AudioStreamPacket> preroll_;
+    std::vector<int> preroll_durations_;
+    size_t preroll_head_ = 0;
+    size_t preroll_count_ = 0;
+    int preroll_total_ms_ = 0;
+    // Held packets still to go out through PopPreroll()
+    size_t release_count_ = 0;
+
+    void Keep(AudioStreamPacket& packet, int frame_duration_ms);
+    void ClearPreroll();
+    void Notify(UplinkSilenceEvent event, int silence_ms);
+};
+
+#endif // UPLINK_SILENCE_GATE_H
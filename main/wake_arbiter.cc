@@ -0,0 +1,200 @@
+#include "wake_arbiter.h"
+
+#include <esp_log.h>
+#include <esp_wifi.h>
+
+#include <cstring>
+
+#define TAG "WakeArbiter"
+
+#define WAKE_ARBITER_MAGIC 0x5741   // "WA"
+#define WAKE_ARBITER_VERSION 1
+
+struct __attribute__((packed)) WakeArbiterMessage {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t type;
+    uint32_t network_hash;
+    int16_t level;
+};
+
+static const uint8_t kBroadcastMac[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+WakeArbiter::WakeArbiter() {
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            static_cast<WakeArbiter*>(arg)->OnTimer();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "wake_arbiter",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&timer_args, &timer_);
+}
+
+WakeArbiter::~WakeArbiter() {
+    if (timer_ != nullptr) {
+        esp_timer_stop(timer_);
+        esp_timer_delete(timer_);
+    }
+    if (started_) {
+        esp_now_deinit();
+    }
+}
+
+bool WakeArbiter::Start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (started_) {
+        return true;
+    }
+    esp_err_t err = esp_now_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize ESP-NOW: %s", esp_err_to_name(err));
+        return false;
+    }
+    esp_now_register_recv_cb(ReceiveCallback);
+    // Channel 0 is the current one, the channel of the access point
+    esp_now_peer_info_t peer = {};
+    memcpy(peer.peer_addr, kBroadcastMac, sizeof(kBroadcastMac));
+    peer.ifidx = WIFI_IF_STA;
+    peer.encrypt = false;
+    err = esp_now_add_peer(&peer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to add the broadcast peer: %s", esp_err_to_name(err));
+        esp_now_deinit();
+        return false;
+    }
+    esp_wifi_get_mac(WIFI_IF_STA, mac_);
+    UpdateNetworkHash();
+    started_ = true;
+    ESP_LOGI(TAG, "Started, window %d ms", CONFIG_WAKE_ARBITRATION_WINDOW_MS);
+    return true;
+}
+
+// FNV-1a of the SSID, refreshed on every send as the board may have moved to another network
+void WakeArbiter::UpdateNetworkHash() {
+    wifi_ap_record_t ap_info = {};
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return;
+    }
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(ap_info.ssid) && ap_info.ssid[i] != 0; i++) {
+        hash = (hash ^ ap_info.ssid[i]) * 16777619u;
+    }
+    network_hash_ = hash;
+}
+
+void WakeArbiter::Send(MessageType type) {
+    UpdateNetworkHash();
+    WakeArbiterMessage message = {
+        .magic = WAKE_ARBITER_MAGIC,
+        .version = WAKE_ARBITER_VERSION,
+        .type = type,
+        .network_hash = network_hash_,
+        .level = level_,
+    };
+    esp_err_t err = esp_now_send(kBroadcastMac, (const uint8_t*)&message, sizeof(message));
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to send: %s", esp_err_to_name(err));
+    }
+}
+
+void WakeArbiter::Arbitrate(float level_db, std::function<void(bool won)> on_result) {
+    if (!started_) {
+        on_result(true);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        level_ = (int16_t)(level_db * 10);
+        arbitrate_us_ = esp_timer_get_time();
+        on_result_ = on_result;
+        resent_ = false;
+        Send(kMessageClaim);
+    }
+    // The claim goes out again halfway, ESP-NOW broadcasts are not acknowledged
+    esp_timer_stop(timer_);
+    esp_timer_start_once(timer_, CONFIG_WAKE_ARBITRATION_WINDOW_MS * 1000 / 2);
+}
+
+void WakeArbiter::Announce() {
+    if (!started_) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    Send(kMessageTaken);
+}
+
+void WakeArbiter::OnTimer() {
+    std::function<void(bool won)> on_result;
+    bool won = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!on_result_) {
+            return;
+        }
+        if (!resent_) {
+            resent_ = true;
+            Send(kMessageClaim);
+            esp_timer_start_once(timer_, CONFIG_WAKE_ARBITRATION_WINDOW_MS * 1000 / 2);
+            return;
+        }
+        // A device that detected up to a window earlier heard the same wake word
+        int64_t since_us = arbitrate_us_ - CONFIG_WAKE_ARBITRATION_WINDOW_MS * 1000;
+        int peers = 0;
+        for (auto& claim : claims_) {
+            if (claim.type == 0 || claim.received_us < since_us) {
+                continue;
+            }
+            peers++;
+            if (claim.type == kMessageTaken || claim.level > level_ ||
+                (claim.level == level_ && memcmp(claim.mac, mac_, sizeof(mac_)) > 0)) {
+                won = false;
+            }
+        }
+        on_result.swap(on_result_);
+        if (won) {
+            Send(kMessageTaken);
+        }
+        ESP_LOGI(TAG, "%s the wake word at %.1f dB against %d other device(s)", won ? "Took" : "Left",
+            level_ / 10.0f, peers);
+    }
+    on_result(won);
+}
+
+void WakeArbiter::OnReceive(const uint8_t* mac, const uint8_t* data, int length) {
+    if (length != sizeof(WakeArbiterMessage)) {
+        return;
+    }
+    WakeArbiterMessage message;
+    memcpy(&message, data, sizeof(message));
+    if (message.magic != WAKE_ARBITER_MAGIC || message.version != WAKE_ARBITER_VERSION ||
+        (message.type != kMessageClaim && message.type != kMessageTaken)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (message.network_hash != network_hash_) {
+        return;
+    }
+    // The entry of the same device, else the oldest one
+    Claim* slot = &claims_[0];
+    for (auto& claim : claims_) {
+        if (memcmp(claim.mac, mac, sizeof(claim.mac)) == 0) {
+            slot = &claim;
+            break;
+        }
+        if (claim.received_us < slot->received_us) {
+            slot = &claim;
+        }
+    }
+    memcpy(slot->mac, mac, sizeof(slot->mac));
+    slot->type = (MessageType)message.type;
+    slot->level = message.level;
+    slot->received_us = esp_timer_get_time();
+}
+
+void WakeArbiter::ReceiveCallback(const esp_now_recv_info_t* info, const uint8_t* data, int length) {
+    GetInstance().OnReceive(info->src_addr, data, length);
+}
@@ -0,0 +1,84 @@
+#ifndef WAKE_ARBITER_H
+#define WAKE_ARBITER_H
+
+#include <esp_timer.h>
+#include <esp_now.h>
+
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+// Claims of other devices kept at once, each is one device that heard the same wake word
+#define WAKE_ARBITER_MAX_CLAIMS 8
+
+/*
+ * Decides among the devices of one home which of them answers a wake word
+ * they all heard, so only one opens a server session.
+ *
+ * On a wake word each device broadcasts a claim over ESP-NOW with the speech
+ * level around the wake word, and waits a short window for the claims of the
+ * others. The loudest one is taken to be closest to the speaker and answers,
+ * a tie goes to the higher MAC address. The winner broadcasts that it took
+ * the wake word, which makes a device that detects it late, after the winner
+ * decided, yield at once. A device already in a conversation announces the
+ * same when it hears the wake word, the idle ones around it stay quiet.
+ *
+ * Claims carry a hash of the SSID, devices on another network on the same
+ * channel are ignored. A device that hears no other decides after the window
+ * alone, which is the latency the arbitration costs.
+ */
+class WakeArbiter {
+public:
+    static WakeArbiter& GetInstance() {
+        static WakeArbiter instance;
+        return instance;
+    }
+    // 删除拷贝构造函数和赋值运算符
+    WakeArbiter(const WakeArbiter&) = delete;
+    WakeArbiter& operator=(const WakeArbiter&) = delete;
+
+    // After Wi-Fi connected, ESP-NOW uses the channel of the access point
+    bool Start();
+    bool started() const { return started_; }
+
+    // Any task. `on_result` runs on the esp_timer task after the window, true if this device answers
+    void Arbitrate(float level_db, std::function<void(bool won)> on_result);
+    // Any task. This device already answers the wake word, e.g. it was in a conversation
+    void Announce();
+
+private:
+    WakeArbiter();
+    ~WakeArbiter();
+
+    enum MessageType : uint8_t {
+        kMessageClaim = 1,
+        kMessageTaken = 2,
+    };
+
+    struct Claim {
+        uint8_t mac[6];
+        MessageType type;
+        int16_t level;          // 1/10 dB
+        int64_t received_us;
+    };
+
+    std::mutex mutex_;
+    std::atomic<bool> started_ = false;
+    uint8_t mac_[6] = {};
+    uint32_t network_hash_ = 0;
+    Claim claims_[WAKE_ARBITER_MAX_CLAIMS] = {};
+    esp_timer_handle_t timer_ = nullptr;
+    std::function<void(bool won)> on_result_;
+    int16_t level_ = 0;
+    int64_t arbitrate_us_ = 0;
+    bool resent_ = false;
+
+    void UpdateNetworkHash();
+    void Send(MessageType type);
+    void OnTimer();
+    void OnReceive(const uint8_t* mac, const uint8_t* data, int length);
+    static void ReceiveCallback(const esp_now_recv_info_t* info, const uint8_t* data, int length);
+};
+
+#endif // WAKE_ARBITER_H
@@ -1,54 +1,159 @@
+#!/usr/bin/env python3
+"""
+接收 AudioDebugger（CONFIG_USE_AUDIO_DEBUGGER）通过 UDP 发送的音频，每个流保存为一个 WAV 文件。
+
+每个数据包带 28 字节的小端头：'AD'、版本、流编号、编码（0 PCM16，1 IMA ADPCM）、声道数、
+帧数（u16）、采样率（u32）、序号（u32）、首帧编号（u32）、设备 esp_timer 时间（u64，微秒）。
+丢失的数据包按帧编号补静音，所以同一个流在 WAV 中的位置与设备上一致。不同流的起点
+按设备时间对齐，并写入 <prefix>_streams.json，可用来检查回采参考信号与播放之间的延迟。
+
+示例：
+    python scripts/audio_debug_server.py --port 8000 --prefix capture
+"""
+import argparse
+import json
 import socket
+import struct
 import wave
-import argparse
 
+HEADER = struct.Struct("<2sBBBBHIIIQ")
+STREAM_NAMES = {0: "input", 1: "processed", 2: "playback"}
 
-'''
-  Create a UDP socket and bind it to the server's IP:8000.
-  Listen for incoming messages and print them to the console.
-  Save the audio to a WAV file.
-'''
-def main(samplerate, channels):
-    # Create a UDP socket
-    server_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
-    server_socket.bind(('0.0.0.0', 8000))
+STEP_TABLE = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+]
+INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8]
+
+
+def decode_adpcm(payload, frames, channels):
+    predictor = []
+    index = []
+    for c in range(channels):
+        value, step_index = struct.unpack_from("<hB", payload, c * 4)
+        predictor.append(value)
+        index.append(step_index)
+    data = payload[channels * 4:]
+    samples = []
+    for i in range(frames * channels):
+        c = i % channels
+        code = (data[i // 2] >> (4 * (i % 2))) & 0x0f
+        step = STEP_TABLE[index[c]]
+        delta = step >> 3
+        if code & 4:
+            delta += step
+        if code & 2:
+            delta += step >> 1
+        if code & 1:
+            delta += step >> 2
+        value = predictor[c] - delta if code & 8 else predictor[c] + delta
+        predictor[c] = max(-32768, min(32767, value))
+        index[c] = max(0, min(88, index[c] + INDEX_TABLE[code]))
+        samples.append(predictor[c])
+    return struct.pack(f"<{len(samples)}h", *samples)
+
+
+class StreamWriter:
+    def __init__(self, prefix, stream, sample_rate, channels, first_frame, time_us):
+        self.name = STREAM_NAMES.get(stream, f"stream{stream}")
+        self.filename = f"{prefix}_{self.name}_{sample_rate}_{channels}.wav"
+        self.sample_rate = sample_rate
+        self.channels = channels
+        self.first_frame = first_frame
+        self.first_time_us = time_us
+        self.next_frame = first_frame
+        self.next_sequence = None
+        self.lost = 0
+        self.reordered = 0
+        self.wav = wave.open(self.filename, "wb")
+        self.wav.setnchannels(channels)
+        self.wav.setsampwidth(2)
+        self.wav.setframerate(sample_rate)
 
-    # Create WAV file with parameters
-    filename = f"{samplerate}_{channels}.wav"
-    wav_file = wave.open(filename, "wb")
-    wav_file.setnchannels(channels)     # channels parameter
-    wav_file.setsampwidth(2)            # 2 bytes per sample (16-bit)
-    wav_file.setframerate(samplerate)   # samplerate parameter
+    def write(self, sequence, first_frame, frames, pcm):
+        if self.next_sequence is not None and sequence != self.next_sequence:
+            if (sequence - self.next_sequence) & 0xffffffff < 0x80000000:
+                self.lost += (sequence - self.next_sequence) & 0xffffffff
+            else:
+                # 迟到的包已经用静音补过了
+                self.reordered += 1
+                return
+        self.next_sequence = (sequence + 1) & 0xffffffff
+        gap = (first_frame - self.next_frame) & 0xffffffff
+        if 0 < gap < self.sample_rate * 60:
+            self.wav.writeframes(b"\x00\x00" * gap * self.channels)
+        self.wav.writeframes(pcm)
+        self.next_frame = (first_frame + frames) & 0xffffffff
 
-    print(f"Start saving audio from 0.0.0.0:8000 to {filename}...")
+    def close(self):
+        self.wav.close()
 
+
+def main(port, prefix):
+    server_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    server_socket.bind(("0.0.0.0", port))
+    print(f"Start saving audio from 0.0.0.0:{port} to {prefix}_*.wav...")
+
+    writers = {}
+    received = 0
     try:
         while True:
-            # Receive a message from the client
-            message, address = server_socket.recvfrom(8000)
-            
-            # Write PCM data to WAV file
-            wav_file.writeframes(message)
-
-            # Print length of the message
-            print(f"Received {len(message)} bytes from {address}")
-    
+            message, address = server_socket.recvfrom(2048)
+            if len(message) < HEADER.size:
+                continue
+            magic, version, stream, codec, channels, frames, sample_rate, sequence, first_frame, time_us = \
+                HEADER.unpack_from(message)
+            if magic != b"AD" or version != 1:
+                print(f"Unknown datagram from {address}, is the firmware up to date?")
+                continue
+            payload = message[HEADER.size:]
+            pcm = decode_adpcm(payload, frames, channels) if codec == 1 else payload
+
+            key = (stream, sample_rate, channels)
+            if key not in writers:
+                writers[key] = StreamWriter(prefix, stream, sample_rate, channels, first_frame, time_us)
+                print(f"New stream {writers[key].name}: {sample_rate} Hz, {channels} channels")
+            writers[key].write(sequence, first_frame, frames, pcm)
+
+            received += 1
+            if received % 500 == 0:
+                status = ", ".join(f"{w.name} lost {w.lost}" for w in writers.values())
+                print(f"Received {received} datagrams: {status}")
+
     except KeyboardInterrupt:
         print("\nStopping recording...")
-    
+
     finally:
-        # Close files and socket
-        wav_file.close()
         server_socket.close()
-        print(f"WAV file '{filename}' saved successfully")
+        if writers:
+            # 各流第一帧的设备时间相对最早的流，单位毫秒
+            start_us = min(w.first_time_us for w in writers.values())
+            summary = []
+            for w in writers.values():
+                w.close()
+                summary.append({
+                    "stream": w.name,
+                    "file": w.filename,
+                    "sample_rate": w.sample_rate,
+                    "channels": w.channels,
+                    "start_offset_ms": (w.first_time_us - start_us) / 1000,
+                    "lost_datagrams": w.lost,
+                    "late_datagrams": w.reordered,
+                })
+                print(f"WAV file '{w.filename}' saved, {w.lost} datagrams lost")
+            with open(f"{prefix}_streams.json", "w") as f:
+                json.dump(summary, f, indent=2)
 
 
 if __name__ == "__main__":
-    parser = argparse.ArgumentParser(description='UDP音频数据接收器，保存为WAV文件')
-    parser.add_argument('--samplerate', '-s', type=int, default=16000, 
-                        help='采样率 (默认: 16000)')
-    parser.add_argument('--channels', '-c', type=int, default=2, 
-                        help='声道数 (默认: 2)')
-    
+    parser = argparse.ArgumentParser(description="UDP音频数据接收器，每个流保存为WAV文件")
+    parser.add_argument("--port", "-p", type=int, default=8000,
+                        help="UDP 端口 (默认: 8000)")
+    parser.add_argument("--prefix", "-o", default="audio_debug",
+                        help="输出文件名前缀 (默认: audio_debug)")
+
     args = parser.parse_args()
-    main(args.samplerate, args.channels)
+    main(args.port, args.prefix)
@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+"""
+为选定的板子编译测试固件、收集测试报告并汇总成对比表（CONFIG_USE_BENCHMARK_SUITE）
+
+测试固件在 config.json 的配置之上打开 CONFIG_USE_BENCHMARK_SUITE 和 CONFIG_BENCHMARK_SUITE_AT_BOOT，
+启动完成后运行音频输入输出、Opus、显示帧率、网络吞吐等测试，并把 JSON 报告以一行打印到串口。
+
+    # 只编译，每个板子一个构建目录 build/benchmark/<名称>
+    python scripts/benchmark_matrix.py build bread-compact-wifi esp-box-3
+    # 烧录一块连接着的板子并读取报告，保存到 benchmarks/<名称>.json
+    python scripts/benchmark_matrix.py run esp-box-3 --port /dev/ttyUSB0
+    # 把 benchmarks/ 下的报告汇总成 CSV，每行一个板子
+    python scripts/benchmark_matrix.py matrix -o benchmarks/matrix.csv
+
+板子名称可以是板子类型（编译 config.json 里的第一个配置）、构建名称或 all。
+网络吞吐测试需要 --download-url 指定一个下载文件，不指定时报告中没有网络部分。
+"""
+import argparse
+import csv
+import glob
+import json
+import os
+import sys
+import time
+
+# 切换到项目根目录
+os.chdir(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+sys.path.insert(0, "scripts")
+from release import get_all_board_types  # noqa: E402
+
+BUILD_ROOT = os.path.join("build", "benchmark")
+REPORT_DIR = "benchmarks"
+# 与 main/benchmark_suite.h 中的 BENCHMARK_SUITE_REPORT_TAG 一致
+REPORT_TAG = "BENCHMARK_REPORT "
+# 启动、连接网络加上整套测试大约需要这么久
+REPORT_TIMEOUT_SECONDS = 300
+
+
+def find_builds(names):
+    """返回 [(构建名称, 目标芯片, sdkconfig 追加项)]"""
+    builds = []
+    for board_config, board_type in get_all_board_types().items():
+        config_path = f"main/boards/{board_type}/config.json"
+        if not os.path.exists(config_path):
+            continue
+        with open(config_path) as f:
+            config = json.load(f)
+        for index, build in enumerate(config["builds"]):
+            wanted = "all" in names or build["name"] in names or (board_type in names and index == 0)
+            if wanted:
+                append = [f"{board_config}=y"] + build.get("sdkconfig_append", [])
+                builds.append((build["name"], config["target"], append))
+    return builds
+
+
+def build_dir(name):
+    return os.path.join(BUILD_ROOT, name)
+
+
+def idf(name, command):
+    directory = build_dir(name)
+    sdkconfig = os.path.join(directory, "sdkconfig")
+    return os.system(f"idf.py -B {directory} -DSDKCONFIG={sdkconfig} -DBOARD_NAME={name} {command}") == 0
+
+
+def build(name, target, append, download_url):
+    os.makedirs(build_dir(name), exist_ok=True)
+    os.environ.pop("IDF_TARGET", None)
+    if not idf(name, f"set-target {target}"):
+        print(f"{name}: set-target failed")
+        return False
+    append = append + [
+        "CONFIG_USE_BENCHMARK_SUITE=y",
+        "CONFIG_BENCHMARK_SUITE_AT_BOOT=y",
+    ]
+    if download_url:
+        append.append("CONFIG_USE_LINK_BENCHMARK=y")
+        append.append(f'CONFIG_BENCHMARK_SUITE_DOWNLOAD_URL="{download_url}"')
+    with open(os.path.join(build_dir(name), "sdkconfig"), "a") as f:
+        f.write("\n")
+        for line in append:
+            f.write(f"{line}\n")
+    if not idf(name, "build"):
+        print(f"{name}: build failed")
+        return False
+    return True
+
+
+def read_report(port):
+    import serial  # pyserial，随 ESP-IDF 安装
+
+    deadline = time.time() + REPORT_TIMEOUT_SECONDS
+    with serial.Serial(port, 115200, timeout=1) as device:
+        while time.time() < deadline:
+            line = device.readline().decode("utf-8", errors="replace")
+            index = line.find(REPORT_TAG)
+            if index >= 0:
+                # 去掉日志颜色的结尾
+                text = line[index + len(REPORT_TAG):].strip().split("\x1b")[0]
+                return json.loads(text)
+    return None
+
+
+def run(name, port):
+    if not idf(name, f"-p {port} flash"):
+        print(f"{name}: flash failed")
+        return False
+    print(f"{name}: waiting for the report on {port}...")
+    report = read_report(port)
+    if report is None:
+        print(f"{name}: no report within {REPORT_TIMEOUT_SECONDS} seconds")
+        return False
+    os.makedirs(REPORT_DIR, exist_ok=True)
+    path = os.path.join(REPORT_DIR, f"{name}.json")
+    with open(path, "w") as f:
+        json.dump(report, f, indent=2, ensure_ascii=False)
+    print(f"{name}: report saved to {path}")
+    return True
+
+
+def flatten(value, prefix, row):
+    """嵌套的报告展开成 a.b.c 形式的列，带 name 字段的数组元素用名称代替下标"""
+    if isinstance(value, dict):
+        for key, item in value.items():
+            flatten(item, f"{prefix}.{key}" if prefix else key, row)
+    elif isinstance(value, list):
+        for index, item in enumerate(value):
+            if isinstance(item, dict) and "name" in item:
+                flatten({k: v for k, v in item.items() if k != "name"}, f"{prefix}.{item['name']}", row)
+            else:
+                flatten(item, f"{prefix}.{index}", row)
+    else:
+        row[prefix] = value
+
+
+def matrix(output, columns):
+    rows = []
+    for path in sorted(glob.glob(os.path.join(REPORT_DIR, "*.json"))):
+        with open(path) as f:
+            report = json.load(f)
+        row = {"name": os.path.splitext(os.path.basename(path))[0]}
+        flatten(report, "", row)
+        rows.append(row)
+    if not rows:
+        print(f"No reports in {REPORT_DIR}")
+        return False
+
+    keys = []
+    for row in rows:
+        for key in row:
+            if key not in keys and (not columns or key == "name" or any(c in key for c in columns)):
+                keys.append(key)
+    with open(output, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=keys, extrasaction="ignore")
+        writer.writeheader()
+        writer.writerows(rows)
+    print(f"{len(rows)} boards, {len(keys)} columns -> {output}")
+    return True
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build, run and compare the benchmark suite of the boards")
+    parser.add_argument("action", choices=["build", "run", "matrix"])
+    parser.add_argument("boards", nargs="*", help="板子类型、构建名称或 all")
+    parser.add_argument("-p", "--port", help="run: 连接板子的串口，一次测一块板子")
+    parser.add_argument("--download-url", default="", help="网络吞吐测试下载的文件")
+    parser.add_argument("-o", "--output", default=os.path.join(REPORT_DIR, "matrix.csv"), help="matrix: 输出的 CSV")
+    parser.add_argument("-c", "--columns", nargs="*", default=[], help="matrix: 只保留名称含有这些字符串的列")
+    args = parser.parse_args()
+
+    if args.action == "matrix":
+        sys.exit(0 if matrix(args.output, args.columns) else 1)
+
+    builds = find_builds(args.boards)
+    if not builds:
+        print(f"未找到板子: {' '.join(args.boards)}")
+        sys.exit(1)
+    if args.action == "run" and not args.port:
+        print("run 需要 --port")
+        sys.exit(1)
+
+    failed = []
+    for name, target, append in builds:
+        if not build(name, target, append, args.download_url):
+            failed.append(name)
+            continue
+        if args.action == "run":
+            if len(builds) > 1:
+                input(f"Connect {name} to {args.port} and press Enter...")
+            if not run(name, args.port):
+                failed.append(name)
+        print("-" * 80)
+    if failed:
+        print(f"Failed: {' '.join(failed)}")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""
+按实际用到的字符生成 font 分区的二进制字体（需要 CONFIG_USE_FONT_PARTITION）
+
+字符来源：所有语言的 language.json、--text 指定的文本（例如导出的聊天记录）、
+--charset 指定的字表（例如常用汉字表），以及 ASCII 和常用中文标点。
+
+示例：
+    python scripts/gen_font_partition.py --font AlibabaPuHuiTi-3-55-Regular.ttf --size 16 --bpp 4 \\
+        --charset common_3500.txt --text chat_log.txt -o build/font.bin
+    parttool.py write_partition --partition-name font --input build/font.bin
+
+依赖 lv_font_conv（npm install -g lv_font_conv）
+"""
+import argparse
+import glob
+import json
+import os
+import shutil
+import subprocess
+import sys
+
+ASSETS_DIR = os.path.join(os.path.dirname(__file__), "..", "main", "assets")
+# 中文标点和全角符号，聊天文字里几乎总会出现
+PUNCTUATION = "，。、；：？！“”‘’（）《》【】—…·～％＋－＝"
+
+
+def collect_language_strings():
+    chars = set()
+    for path in glob.glob(os.path.join(ASSETS_DIR, "*", "language.json")):
+        with open(path, "r", encoding="utf-8") as f:
+            data = json.load(f)
+        for value in data.get("strings", {}).values():
+            chars.update(value)
+    return chars
+
+
+def collect_file(path):
+    with open(path, "r", encoding="utf-8") as f:
+        return set(f.read())
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate a subset font image for the font partition")
+    parser.add_argument("--font", required=True, help="TTF/OTF 字体文件")
+    parser.add_argument("--size", type=int, required=True, help="字号（像素）")
+    parser.add_argument("--bpp", type=int, default=4, choices=[1, 2, 4, 8], help="每像素位数")
+    parser.add_argument("--text", action="append", default=[], help="统计用字的文本文件，可多次指定")
+    parser.add_argument("--charset", action="append", default=[], help="需要完整包含的字表文件，可多次指定")
+    parser.add_argument("--no-compress", action="store_true", help="不压缩字形，占用更多 PSRAM 但首次绘制更快")
+    parser.add_argument("-o", "--output", required=True, help="输出的分区镜像")
+    args = parser.parse_args()
+
+    if shutil.which("lv_font_conv") is None:
+        sys.exit("lv_font_conv not found, install it with: npm install -g lv_font_conv")
+
+    chars = collect_language_strings()
+    chars.update(PUNCTUATION)
+    for path in args.text + args.charset:
+        chars.update(collect_file(path))
+    # ASCII 按范围整体加入，其余控制字符和空白不需要字形
+    symbols = "".join(sorted(c for c in chars if ord(c) > 0x7E and not c.isspace()))
+
+    command = [
+        "lv_font_conv", "--font", args.font, "--size", str(args.size), "--bpp", str(args.bpp),
+        "--format", "bin", "-r", "0x20-0x7E", "--symbols", symbols, "-o", args.output,
+    ]
+    if args.no_compress:
+        command.append("--no-compress")
+    subprocess.run(command, check=True)
+
+    size = os.path.getsize(args.output)
+    print(f"{len(symbols) + 95} glyphs, {size / 1024:.1f} KB written to {args.output}")
+    print(f"Flash it with: parttool.py write_partition --partition-name font --input {args.output}")
+
+
+if __name__ == "__main__":
+    main()
@@ -7,7 +7,7 @@ HEADER_TEMPLATE = """// Auto-generated language config
 #pragma once
 
 #include <string_view>
-
+{sound_include}
 #ifndef {lang_code_for_font}
     #define {lang_code_for_font}  // 預設語言
 #endif
@@ -28,7 +28,21 @@ namespace Lang {{
 }}
 """
 
-def generate_header(input_path, output_path):
+def sound_embedded_entry(base_name):
+    return f'''
+        extern const char p3_{base_name}_start[] asm("_binary_{base_name}_p3_start");
+        extern const char p3_{base_name}_end[] asm("_binary_{base_name}_p3_end");
+        static const std::string_view P3_{base_name.upper()} {{
+        static_cast<const char*>(p3_{base_name}_start),
+        static_cast<size_t>(p3_{base_name}_end - p3_{base_name}_start)
+        }};'''
+
+def sound_partition_entry(base_name):
+    # 从映射的 sounds 分区里查找，分区里没有时为空
+    return f'''
+        inline const std::string_view P3_{base_name.upper()} = SoundPack::Get("{base_name}");'''
+
+def generate_header(input_path, output_path, sound_partition=False):
     with open(input_path, 'r', encoding='utf-8') as f:
         data = json.load(f)
 
@@ -45,33 +59,18 @@ def generate_header(input_path, output_path):
         value = value.replace('"', '\\"')
         strings.append(f'        constexpr const char* {key.upper()} = "{value}";')
 
-    # 生成音效常量
-    for file in os.listdir(os.path.dirname(input_path)):
-        if file.endswith('.p3'):
-            base_name = os.path.splitext(file)[0]
-            sounds.append(f'''
-        extern const char p3_{base_name}_start[] asm("_binary_{base_name}_p3_start");
-        extern const char p3_{base_name}_end[] asm("_binary_{base_name}_p3_end");
-        static const std::string_view P3_{base_name.upper()} {{
-        static_cast<const char*>(p3_{base_name}_start),
-        static_cast<size_t>(p3_{base_name}_end - p3_{base_name}_start)
-        }};''')
-    
-    # 生成公共音效
-    for file in os.listdir(os.path.join(os.path.dirname(output_path), 'common')):
-        if file.endswith('.p3'):
-            base_name = os.path.splitext(file)[0]
-            sounds.append(f'''
-        extern const char p3_{base_name}_start[] asm("_binary_{base_name}_p3_start");
-        extern const char p3_{base_name}_end[] asm("_binary_{base_name}_p3_end");
-        static const std::string_view P3_{base_name.upper()} {{
-        static_cast<const char*>(p3_{base_name}_start),
-        static_cast<size_t>(p3_{base_name}_end - p3_{base_name}_start)
-        }};''')
+    # 生成音效常量，语言目录和公共目录的 P3 文件
+    sound_dirs = [os.path.dirname(input_path), os.path.join(os.path.dirname(output_path), 'common')]
+    for sound_dir in sound_dirs:
+        for file in os.listdir(sound_dir):
+            if file.endswith('.p3'):
+                base_name = os.path.splitext(file)[0]
+                sounds.append(sound_partition_entry(base_name) if sound_partition else sound_embedded_entry(base_name))
 
     # 填充模板
     content = HEADER_TEMPLATE.format(
         lang_code=lang_code,
+        sound_include='#include "sound_pack.h"\n' if sound_partition else '',
         lang_code_for_font=lang_code.replace('-', '_').lower(),
         strings="\n".join(sorted(strings)),
         sounds="\n".join(sorted(sounds))
@@ -86,6 +85,7 @@ if __name__ == "__main__":
     parser = argparse.ArgumentParser()
     parser.add_argument("--input", required=True, help="输入JSON文件路径")
     parser.add_argument("--output", required=True, help="输出头文件路径")
+    parser.add_argument("--sound-partition", action="store_true", help="音效从 sounds 分区读取，不链接进固件")
     args = parser.parse_args()
 
-    generate_header(args.input, args.output)
\ No newline at end of file
+    generate_header(args.input, args.output, args.sound_partition)
\ No newline at end of file
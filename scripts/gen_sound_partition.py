@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""
+把一种语言的提示音和公共提示音打包成 sounds 分区的镜像（需要 CONFIG_USE_SOUND_PARTITION）
+
+构建时会为当前语言生成 build/sounds.bin，分区表里有 sounds 分区时 idf.py flash 会一起烧录。
+换语言只需要写入另一种语言的镜像，不用重新烧录固件：
+    python scripts/gen_sound_partition.py --lang en-US -o build/sounds.bin
+    parttool.py write_partition --partition-name sounds --input build/sounds.bin
+
+--dir 把一个目录里的 P3 文件打包成自定义提示音镜像（需要 CONFIG_USE_PROMPT_STORE），
+放到 HTTP 服务器上由设备下载到 prompts 分区，或者直接写入：
+    python scripts/gen_sound_partition.py --dir my_prompts -o build/prompts.bin
+    parttool.py write_partition --partition-name prompts --input build/prompts.bin
+
+镜像格式（小端）：
+    头部    magic "P3PK", uint16 版本, uint16 条目数, char 语言[8]
+    索引    按名称排序的条目 { char 名称[24], uint32 偏移, uint32 长度 }
+    数据    各个 P3 文件，4 字节对齐，偏移从镜像开头算起
+"""
+import argparse
+import glob
+import os
+import struct
+
+ASSETS_DIR = os.path.join(os.path.dirname(__file__), "..", "main", "assets")
+MAGIC = b"P3PK"
+VERSION = 1
+NAME_SIZE = 24
+HEADER_FORMAT = "<4sHH8s"
+ENTRY_FORMAT = f"<{NAME_SIZE}sII"
+
+
+def collect_sounds(lang_dir, common_dir):
+    sounds = {}
+    for directory in (common_dir, lang_dir):
+        for path in glob.glob(os.path.join(directory, "*.p3")):
+            name = os.path.splitext(os.path.basename(path))[0]
+            if len(name.encode()) >= NAME_SIZE:
+                raise ValueError(f"Sound name is too long: {name}")
+            with open(path, "rb") as f:
+                # 语言目录里的同名文件覆盖公共文件
+                sounds[name] = f.read()
+    return sounds
+
+
+def build_image(lang, sounds):
+    names = sorted(sounds)
+    offset = struct.calcsize(HEADER_FORMAT) + struct.calcsize(ENTRY_FORMAT) * len(names)
+    index = b""
+    data = b""
+    for name in names:
+        offset += (-offset) % 4
+        data += b"\0" * ((-len(data)) % 4)
+        index += struct.pack(ENTRY_FORMAT, name.encode(), offset, len(sounds[name]))
+        data += sounds[name]
+        offset += len(sounds[name])
+    header = struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(names), lang.encode())
+    return header + index + data
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate the sounds partition image of a language")
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("--lang", help="语言目录，例如 zh-CN")
+    source.add_argument("--dir", help="自定义提示音目录，文件名（不含扩展名）即播放时用的名称")
+    parser.add_argument("-o", "--output", required=True, help="输出的分区镜像")
+    args = parser.parse_args()
+
+    if args.dir:
+        sounds = collect_sounds(args.dir, args.dir)
+        image = build_image("custom", sounds)
+    else:
+        sounds = collect_sounds(os.path.join(ASSETS_DIR, args.lang), os.path.join(ASSETS_DIR, "common"))
+        image = build_image(args.lang, sounds)
+    os.makedirs(os.path.dirname(os.path.abspath(args.output)), exist_ok=True)
+    with open(args.output, "wb") as f:
+        f.write(image)
+    print(f"{len(sounds)} sounds, {len(image)} bytes -> {args.output}")
+
+
+if __name__ == "__main__":
+    main()
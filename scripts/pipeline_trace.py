@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""
+接收 PipelineTrace（CONFIG_USE_PIPELINE_TRACE）通过 UDP 发送的流水线事件，保存为 Chrome trace JSON，
+可以用 https://ui.perfetto.dev 或 chrome://tracing 打开，每个任务一条时间线。
+
+每个数据包带 24 字节的小端头：'PT'、版本、类型（0 事件，1 任务名）、序号（u32）、
+设备 esp_timer 时间（u64，微秒）、设备已丢弃的事件数（u32）、条目数（u16）、保留（u16）。
+事件为 16 字节：时间低 32 位（u32）、任务句柄（u32）、参数（u32）、事件编号、
+阶段（0 开始，1 结束，2 瞬时）、核心编号、保留。事件时间用包头的完整时间展开。
+任务名条目为 20 字节：任务句柄（u32）和以 0 结尾的任务名。
+
+示例：
+    python scripts/pipeline_trace.py --port 8001 --output trace.json
+"""
+import argparse
+import json
+import socket
+import struct
+
+HEADER = struct.Struct("<2sBBIQIHH")
+RECORD = struct.Struct("<IIIBBBx")
+TASK_NAME = struct.Struct("<I16s")
+
+# 与 main/latency_tracer.h 的 LatencyStage 和 main/pipeline_trace.h 的 PipelineEvent 一致
+EVENT_NAMES = {
+    0: "i2s_read",
+    1: "afe",
+    2: "encode",
+    3: "send",
+    4: "jitter_buffer",
+    5: "decode",
+    6: "resample",
+    7: "output",
+    8: "response",
+    9: "push_to_talk",
+    32: "audio_receive",
+    33: "json_send",
+    34: "json_receive",
+    35: "display_flush",
+    36: "display_wait",
+    37: "mcp_call",
+}
+PHASES = {0: "B", 1: "E", 2: "i"}
+
+
+def main(port, output):
+    server_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    server_socket.bind(("0.0.0.0", port))
+    print(f"Start receiving pipeline events on 0.0.0.0:{port}, Ctrl+C to save {output}...")
+
+    events = []
+    task_names = {}
+    next_sequence = None
+    lost = 0
+    dropped = 0
+    try:
+        while True:
+            message, address = server_socket.recvfrom(2048)
+            if len(message) < HEADER.size:
+                continue
+            magic, version, kind, sequence, time_us, device_dropped, count, _ = HEADER.unpack_from(message)
+            if magic != b"PT" or version != 1:
+                print(f"Unknown datagram from {address}, is the firmware up to date?")
+                continue
+            if next_sequence is not None and sequence != next_sequence:
+                lost += (sequence - next_sequence) & 0xffffffff
+            next_sequence = (sequence + 1) & 0xffffffff
+            if device_dropped != dropped:
+                print(f"Device dropped {device_dropped - dropped} events, its ring was full")
+                dropped = device_dropped
+
+            if kind == 1:
+                for i in range(count):
+                    handle, name = TASK_NAME.unpack_from(message, HEADER.size + i * TASK_NAME.size)
+                    task_names[handle] = name.split(b"\x00")[0].decode(errors="replace")
+                continue
+
+            for i in range(count):
+                time_lo, task, arg, event, phase, core = RECORD.unpack_from(message, HEADER.size + i * RECORD.size)
+                # 事件早于包头时间，时间差在 32 位内
+                ts = time_us - (((time_us & 0xffffffff) - time_lo) & 0xffffffff)
+                events.append((ts, task, arg, event, phase, core))
+            if len(events) and len(events) % 10000 < count:
+                print(f"Received {len(events)} events, {lost} datagrams lost")
+
+    except KeyboardInterrupt:
+        print("\nStopping...")
+
+    finally:
+        server_socket.close()
+        events.sort(key=lambda e: e[0])
+        trace = []
+        for handle, name in task_names.items():
+            trace.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": handle, "args": {"name": name}})
+        for ts, task, arg, event, phase, core in events:
+            item = {
+                "name": EVENT_NAMES.get(event, f"event{event}"),
+                "ph": PHASES.get(phase, "i"),
+                "ts": ts,
+                "pid": 1,
+                "tid": task,
+                "args": {"arg": arg, "core": core},
+            }
+            if item["ph"] == "i":
+                item["s"] = "t"
+            trace.append(item)
+        with open(output, "w") as f:
+            json.dump({"traceEvents": trace, "displayTimeUnit": "ms"}, f)
+        print(f"Trace '{output}' saved: {len(events)} events, {len(task_names)} tasks, "
+              f"{lost} datagrams lost, {dropped} events dropped on the device")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="UDP流水线事件接收器，保存为Chrome trace JSON")
+    parser.add_argument("--port", "-p", type=int, default=8001,
+                        help="UDP 端口 (默认: 8001)")
+    parser.add_argument("--output", "-o", default="pipeline_trace.json",
+                        help="输出文件 (默认: pipeline_trace.json)")
+
+    args = parser.parse_args()
+    main(args.port, args.output)
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""
+链接后从 map 文件统计静态 RAM 占用（CONFIG_USE_LEAN_PROFILE 时由构建自动运行）
+
+按组件和目标文件汇总放在内部 RAM 的 .data / .bss，并给出 DRAM 段的剩余空间，
+没有 PSRAM 的板子上这里多占的每个字节都是对话时少的堆：
+    python scripts/ram_budget.py --map build/xiaozhi.map --output build/ram_budget.txt
+"""
+import argparse
+import collections
+import os
+import re
+
+# 放在 DRAM 里的输入段，IRAM、RTC 内存和 PSRAM 里的不计入
+RAM_SECTION = re.compile(r"^\.(s?bss|s?data|dram1|noinit)(\.|$)")
+SECTION_LINE = re.compile(r"^ (\.\S+)(?:\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(\S.*))?$")
+ADDRESS_LINE = re.compile(r"^\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(\S.*)$")
+COMMON_LINE = re.compile(r"^ COMMON\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(\S.*)$")
+MEMORY_LINE = re.compile(r"^(\S+)\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)(\s+\S+)?$")
+ARCHIVE = re.compile(r"lib([^/\\]+)\.a\(([^)]+)\)$")
+
+TOP_OBJECTS = 20
+
+
+def parse_map(path):
+    """返回 (各输入段的 [(段名, 大小, 来源)], 内存区域 {名称: 长度})"""
+    sections = []
+    regions = {}
+    with open(path, encoding="utf-8", errors="replace") as f:
+        lines = f.read().splitlines()
+
+    part = None
+    pending = None
+    for line in lines:
+        if line.startswith("Memory Configuration"):
+            part = "memory"
+            continue
+        if line.startswith("Linker script and memory map"):
+            part = "map"
+            continue
+        if part == "memory":
+            match = MEMORY_LINE.match(line)
+            if match and match.group(1) != "Name":
+                regions[match.group(1)] = int(match.group(3), 16)
+            continue
+        if part != "map":
+            continue
+
+        # 段名太长时地址和来源在下一行
+        if pending is not None:
+            match = ADDRESS_LINE.match(line)
+            if match:
+                sections.append((pending, int(match.group(2), 16), match.group(3)))
+            pending = None
+            continue
+        match = COMMON_LINE.match(line)
+        if match:
+            sections.append((".bss.COMMON", int(match.group(2), 16), match.group(3)))
+            continue
+        match = SECTION_LINE.match(line)
+        if not match or not RAM_SECTION.match(match.group(1)):
+            continue
+        if match.group(2) is None:
+            pending = match.group(1)
+        else:
+            sections.append((match.group(1), int(match.group(3), 16), match.group(4)))
+    return sections, regions
+
+
+def source_of(origin):
+    """(组件, 目标文件)，链接脚本生成的段归到 (linker)"""
+    match = ARCHIVE.search(origin)
+    if match:
+        return match.group(1), match.group(2)
+    return "(linker)", os.path.basename(origin)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Static RAM budget from the linker map")
+    parser.add_argument("--map", required=True, help="map file of the firmware, build/<project>.map")
+    parser.add_argument("--output", help="report file, the report is printed as well")
+    args = parser.parse_args()
+
+    sections, regions = parse_map(args.map)
+    kinds = collections.Counter()
+    components = collections.Counter()
+    objects = collections.Counter()
+    for name, size, origin in sections:
+        if size == 0:
+            continue
+        kind = "bss" if "bss" in name or "noinit" in name or "COMMON" in name else "data"
+        kinds[kind] += size
+        component, obj = source_of(origin)
+        components[component] += size
+        objects[f"{component}/{obj}"] += size
+
+    total = sum(kinds.values())
+    lines = ["Static RAM budget", ""]
+    lines.append(f"  .data   {kinds['data']:>8} bytes")
+    lines.append(f"  .bss    {kinds['bss']:>8} bytes")
+    lines.append(f"  total   {total:>8} bytes")
+    dram = {name: length for name, length in regions.items() if name.startswith("dram")}
+    if dram:
+        length = sum(dram.values())
+        lines.append(f"  DRAM    {length:>8} bytes in {', '.join(sorted(dram))}, {length - total} not static")
+    lines.append("")
+    lines.append("By component:")
+    for component, size in components.most_common():
+        lines.append(f"  {size:>8}  {component}")
+    lines.append("")
+    lines.append(f"Largest {TOP_OBJECTS} objects:")
+    for obj, size in objects.most_common(TOP_OBJECTS):
+        lines.append(f"  {size:>8}  {obj}")
+    report = "\n".join(lines) + "\n"
+
+    if args.output:
+        with open(args.output, "w", encoding="utf-8") as f:
+            f.write(report)
+    print(report, end="")
+
+
+if __name__ == "__main__":
+    main()